@@ -0,0 +1,403 @@
+#include "ac_allocator.h"
+#include "ac_pool.h"
+#include "ac_slab.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+  alloc_replay replays an allocation trace against several allocators.  The
+  trace is recorded with ac_allocator_record (or by building the program
+  with _AC_DEBUG_MEMORY_ and _AC_DEBUG_MEMORY_TRACE_ defined).  Each thread
+  of the trace is replayed by its own thread in the recorded order, and a
+  free waits until the allocation it frees has been replayed (which may be
+  by another thread).  Every page of each allocation is written to, so the
+  resident memory is actually used.
+
+    malloc           the system malloc (run with
+                     LD_PRELOAD=libjemalloc.so.2 to replay against jemalloc)
+    ac_malloc_debug  ac_malloc with _AC_DEBUG_MEMORY_ (ac_malloc without it
+                     is the system malloc)
+    ac_pool          one ac_pool per thread, frees are ignored so this shows
+                     how much a pool would hold until it is cleared
+    ac_slab          ac_slab size classes up to 4096 bytes (larger
+                     allocations use malloc)
+
+  Each allocator is replayed in its own process so that the peak resident
+  memory is its own.  The results are the time, the operations (allocations
+  and frees) per second, the peak resident memory above what the process
+  used before the replay, and the fragmentation (the peak resident memory
+  divided by the peak bytes which the trace had allocated at once).
+
+  alloc_replay [-f text|csv|json] [-a allocator] trace
+*/
+
+typedef struct {
+  const char *name;
+  double seconds;
+  double ops_per_second;
+  size_t peak_rss;
+  double fragmentation;
+} result_t;
+
+typedef struct {
+  ac_allocator_record_t *records;
+  size_t num_records;
+  /* the length of each allocation (by id) */
+  uint64_t *lengths;
+  uint64_t max_id;
+  /* the records of each thread (as indexes into records) */
+  size_t **thread_records;
+  size_t *num_thread_records;
+  uint32_t num_threads;
+  size_t num_ops;
+  size_t peak_live;
+  /* the replayed allocations (by id) */
+  void **ptrs;
+} trace_t;
+
+/* the slab size classes are 16 byte steps to 128 bytes and then 4 steps for
+   every power of 2 up to 4096 */
+#define NUM_SLABS 28
+#define MAX_SLAB_SIZE 4096
+
+typedef struct {
+  ac_allocator_t *allocator;
+  ac_pool_t **pools;
+  ac_slab_t *slabs[NUM_SLABS];
+} context_t;
+
+static size_t slab_size(int c) {
+  if (c < 8)
+    return (c + 1) * 16;
+  int shift = 7 + (c - 8) / 4;
+  return ((size_t)1 << shift) + ((size_t)((c - 8) % 4 + 1) << (shift - 2));
+}
+
+static int slab_class(size_t length) {
+  if (length <= 128)
+    return length ? (int)((length - 1) >> 4) : 0;
+  int c = 8;
+  while (slab_size(c) < length)
+    c++;
+  return c;
+}
+
+static void *replay_alloc(context_t *ctx, int allocator, uint32_t thread,
+                          size_t length) {
+  switch (allocator) {
+  case 1:
+    return _ac_malloc_d(ctx->allocator, "alloc_replay", length, false);
+  case 2:
+    return ac_pool_alloc(ctx->pools[thread], length);
+  case 3:
+    if (length <= MAX_SLAB_SIZE)
+      return ac_slab_alloc(ctx->slabs[slab_class(length)]);
+    return malloc(length);
+  default:
+    return malloc(length);
+  }
+}
+
+static void replay_free(context_t *ctx, int allocator, void *p,
+                        size_t length) {
+  switch (allocator) {
+  case 1:
+    _ac_free_d(ctx->allocator, "alloc_replay", p);
+    break;
+  case 2:
+    break;
+  case 3:
+    if (length <= MAX_SLAB_SIZE)
+      ac_slab_free(ctx->slabs[slab_class(length)], p);
+    else
+      free(p);
+    break;
+  default:
+    free(p);
+  }
+}
+
+static const char *allocators[] = {"malloc", "ac_malloc_debug", "ac_pool",
+                                   "ac_slab"};
+#define NUM_ALLOCATORS 4
+
+typedef struct {
+  trace_t *trace;
+  context_t *ctx;
+  int allocator;
+  uint32_t thread;
+  int *start;
+} replay_thread_t;
+
+static void *replay_thread(void *arg) {
+  replay_thread_t *rt = (replay_thread_t *)arg;
+  trace_t *t = rt->trace;
+  while (!__atomic_load_n(rt->start, __ATOMIC_ACQUIRE))
+    sched_yield();
+  size_t *p = t->thread_records[rt->thread];
+  size_t *ep = p + t->num_thread_records[rt->thread];
+  for (; p < ep; p++) {
+    ac_allocator_record_t *r = t->records + *p;
+    if (r->length) {
+      char *m = (char *)replay_alloc(rt->ctx, rt->allocator, rt->thread,
+                                     r->length);
+      for (size_t i = 0; i < r->length; i += 4096)
+        m[i] = 1;
+      __atomic_store_n(t->ptrs + r->id, m, __ATOMIC_RELEASE);
+    } else {
+      void *m;
+      while (!(m = __atomic_load_n(t->ptrs + r->id, __ATOMIC_ACQUIRE)))
+        sched_yield();
+      replay_free(rt->ctx, rt->allocator, m, t->lengths[r->id]);
+    }
+  }
+  return NULL;
+}
+
+/* the value of a field of /proc/self/status in bytes (0 if unknown) */
+static size_t proc_status(const char *field) {
+  FILE *in = fopen("/proc/self/status", "r");
+  if (!in)
+    return 0;
+  char line[256];
+  size_t len = strlen(field), kb = 0;
+  while (fgets(line, sizeof(line), in))
+    if (!strncmp(line, field, len) && line[len] == ':') {
+      kb = strtoull(line + len + 1, NULL, 10);
+      break;
+    }
+  fclose(in);
+  return kb * 1024;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* runs in the child process */
+static void replay(trace_t *t, int allocator, result_t *res) {
+  context_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  if (allocator == 1)
+    ctx.allocator = ac_allocator_init(NULL, true);
+  else if (allocator == 2) {
+    ctx.pools = (ac_pool_t **)malloc(sizeof(ac_pool_t *) * t->num_threads);
+    for (uint32_t i = 0; i < t->num_threads; i++)
+      ctx.pools[i] = ac_pool_init(65536);
+  } else if (allocator == 3)
+    for (int i = 0; i < NUM_SLABS; i++)
+      ctx.slabs[i] = ac_slab_init(slab_size(i));
+
+  /* the pointers are written during the replay, so they are made resident
+     first.  Then the peak resident memory is reset so that it only covers the
+     replay. */
+  memset(t->ptrs, 0, sizeof(void *) * (t->max_id + 1));
+  FILE *clear = fopen("/proc/self/clear_refs", "w");
+  if (clear) {
+    fputs("5", clear);
+    fclose(clear);
+  }
+  size_t base_rss = proc_status("VmRSS");
+
+  int start = 0;
+  pthread_t *threads =
+      (pthread_t *)malloc(sizeof(pthread_t) * t->num_threads);
+  replay_thread_t *rts = (replay_thread_t *)malloc(sizeof(replay_thread_t) *
+                                                   t->num_threads);
+  for (uint32_t i = 0; i < t->num_threads; i++) {
+    rts[i].trace = t;
+    rts[i].ctx = &ctx;
+    rts[i].allocator = allocator;
+    rts[i].thread = i;
+    rts[i].start = &start;
+    pthread_create(threads + i, NULL, replay_thread, rts + i);
+  }
+  uint64_t start_time = now_ns();
+  __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+  for (uint32_t i = 0; i < t->num_threads; i++)
+    pthread_join(threads[i], NULL);
+  uint64_t elapsed = now_ns() - start_time;
+
+  size_t peak_rss = proc_status("VmHWM");
+  res->seconds = elapsed / 1000000000.0;
+  res->ops_per_second = elapsed ? t->num_ops / res->seconds : 0.0;
+  res->peak_rss = peak_rss > base_rss ? peak_rss - base_rss : 0;
+  res->fragmentation =
+      t->peak_live ? (double)res->peak_rss / t->peak_live : 0.0;
+}
+
+static bool load_trace(const char *filename, trace_t *t) {
+  memset(t, 0, sizeof(*t));
+  FILE *in = fopen(filename, "rb");
+  if (!in)
+    return false;
+  char magic[8];
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  if (size < 8 || fread(magic, 8, 1, in) != 1 ||
+      memcmp(magic, AC_ALLOCATOR_RECORD_MAGIC, 8)) {
+    fclose(in);
+    return false;
+  }
+  t->num_records = (size - 8) / sizeof(ac_allocator_record_t);
+  t->records = (ac_allocator_record_t *)malloc(
+      sizeof(ac_allocator_record_t) * (t->num_records + 1));
+  t->num_records = fread(t->records, sizeof(ac_allocator_record_t),
+                         t->num_records, in);
+  fclose(in);
+
+  uint32_t max_thread = 0;
+  for (size_t i = 0; i < t->num_records; i++) {
+    if (t->records[i].id > t->max_id)
+      t->max_id = t->records[i].id;
+    if (t->records[i].thread > max_thread)
+      max_thread = t->records[i].thread;
+  }
+  t->lengths = (uint64_t *)calloc(t->max_id + 1, sizeof(uint64_t));
+  t->ptrs = (void **)calloc(t->max_id + 1, sizeof(void *));
+  t->num_threads = max_thread;
+  t->thread_records = (size_t **)calloc(max_thread, sizeof(size_t *));
+  t->num_thread_records = (size_t *)calloc(max_thread, sizeof(size_t));
+
+  /* drop the frees which don't have an allocation (or repeat one) and the
+     records of thread 0 (which isn't valid), track the live bytes */
+  char *freed = (char *)calloc(t->max_id + 1, 1);
+  size_t live = 0;
+  size_t j = 0;
+  for (size_t i = 0; i < t->num_records; i++) {
+    ac_allocator_record_t *r = t->records + i;
+    if (!r->thread || !r->id)
+      continue;
+    if (r->length) {
+      if (t->lengths[r->id])
+        continue;
+      t->lengths[r->id] = r->length;
+      live += r->length;
+      if (live > t->peak_live)
+        t->peak_live = live;
+    } else {
+      if (!t->lengths[r->id] || freed[r->id])
+        continue;
+      freed[r->id] = 1;
+      live -= t->lengths[r->id];
+    }
+    t->num_thread_records[r->thread - 1]++;
+    t->records[j++] = *r;
+  }
+  free(freed);
+  t->num_records = j;
+  t->num_ops = j;
+  for (uint32_t i = 0; i < t->num_threads; i++)
+    t->thread_records[i] =
+        (size_t *)malloc(sizeof(size_t) * (t->num_thread_records[i] + 1));
+  memset(t->num_thread_records, 0, sizeof(size_t) * t->num_threads);
+  for (size_t i = 0; i < t->num_records; i++) {
+    uint32_t thread = t->records[i].thread - 1;
+    t->thread_records[thread][t->num_thread_records[thread]++] = i;
+  }
+  return true;
+}
+
+static void print_usage(const char *program) {
+  fprintf(stderr, "%s [-f text|csv|json] [-a allocator] trace\n", program);
+}
+
+int main(int argc, char *argv[]) {
+  const char *format = "text";
+  const char *filter = NULL;
+  const char *filename = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-f") && i + 1 < argc)
+      format = argv[++i];
+    else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+      filter = argv[++i];
+    else if (argv[i][0] != '-' && !filename)
+      filename = argv[i];
+    else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+  if (!filename) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  trace_t t;
+  if (!load_trace(filename, &t)) {
+    fprintf(stderr, "%s is not an allocation trace\n", filename);
+    return -1;
+  }
+
+  result_t results[NUM_ALLOCATORS];
+  int num_results = 0;
+  for (int i = 0; i < NUM_ALLOCATORS; i++) {
+    if (filter && !strstr(allocators[i], filter))
+      continue;
+    int fds[2];
+    if (pipe(fds))
+      return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      result_t res;
+      memset(&res, 0, sizeof(res));
+      replay(&t, i, &res);
+      if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+        _exit(1);
+      /* skip freeing everything (and the leak report of the allocator) */
+      _exit(0);
+    }
+    close(fds[1]);
+    result_t *res = results + num_results;
+    bool ok = read(fds[0], res, sizeof(*res)) == sizeof(*res);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    if (!ok) {
+      fprintf(stderr, "replaying %s failed\n", allocators[i]);
+      continue;
+    }
+    res->name = allocators[i];
+    num_results++;
+  }
+
+  if (!strcmp(format, "csv"))
+    printf("allocator,seconds,ops_per_second,peak_rss,fragmentation\n");
+  else if (!strcmp(format, "json"))
+    printf("{\"ops\": %zu, \"threads\": %u, \"peak_live\": %zu, "
+           "\"results\": [",
+           t.num_ops, t.num_threads, t.peak_live);
+  else
+    printf("%zu operations in %u thread(s), at most %zu bytes live\n"
+           "%-16s %10s %14s %14s %14s\n",
+           t.num_ops, t.num_threads, t.peak_live, "allocator", "seconds",
+           "ops/sec", "peak_rss", "fragmentation");
+  for (int i = 0; i < num_results; i++) {
+    result_t *r = results + i;
+    if (!strcmp(format, "csv"))
+      printf("%s,%0.6f,%0.0f,%zu,%0.3f\n", r->name, r->seconds,
+             r->ops_per_second, r->peak_rss, r->fragmentation);
+    else if (!strcmp(format, "json"))
+      printf("%s\n  {\"allocator\": \"%s\", \"seconds\": %0.6f, "
+             "\"ops_per_second\": %0.0f, \"peak_rss\": %zu, "
+             "\"fragmentation\": %0.3f}",
+             i ? "," : "", r->name, r->seconds, r->ops_per_second,
+             r->peak_rss, r->fragmentation);
+    else
+      printf("%-16s %10.3f %14.0f %14zu %14.3f\n", r->name, r->seconds,
+             r->ops_per_second, r->peak_rss, r->fragmentation);
+  }
+  if (!strcmp(format, "json"))
+    printf("\n]}\n");
+  return 0;
+}
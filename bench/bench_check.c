@@ -0,0 +1,223 @@
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  bench_check compares a csv written by one of the benchmarks against a
+  baseline csv from an earlier run (see make bench-baseline) and exits with
+  1 if any result got slower by more than the threshold.  The rows are
+  matched by the key columns and the value column is a time (lower is
+  better).  A file may hold several runs one after another (each with its
+  header), and the fastest value of each row is used, which keeps a noisy
+  sample from failing the check.  Rows which are only in one of the files
+  are listed but don't fail the check, so adding a benchmark doesn't
+  require a new baseline.
+
+  bench_check [-t percent] [-k column,column,...] [-v column]
+              baseline.csv current.csv
+
+  The defaults (a threshold of 10%, a key of name and a value of
+  median_ns) fit the csv of ac_bench_print.  For sort_bench use
+  -k type,distribution,num_elements,algorithm -v ns_per_element.
+*/
+
+#define MAX_COLUMNS 64
+#define MAX_KEYS 16
+
+typedef struct {
+  char *key;
+  double value;
+} row_t;
+
+typedef struct {
+  row_t *rows;
+  size_t num_rows;
+} table_t;
+
+/* splits line at commas in place (no quoting, which the benchmarks don't
+   produce) */
+static int split(char *line, char **fields) {
+  int n = 0;
+  line[strcspn(line, "\r\n")] = 0;
+  fields[n++] = line;
+  for (char *p = line; *p && n < MAX_COLUMNS; p++) {
+    if (*p == ',') {
+      *p = 0;
+      fields[n++] = p + 1;
+    }
+  }
+  return n;
+}
+
+static int find_column(char **header, int num, const char *name) {
+  for (int i = 0; i < num; i++)
+    if (!strcmp(header[i], name))
+      return i;
+  return -1;
+}
+
+static row_t *find_row(table_t *t, const char *key) {
+  for (size_t i = 0; i < t->num_rows; i++)
+    if (!strcmp(t->rows[i].key, key))
+      return t->rows + i;
+  return NULL;
+}
+
+static bool load(const char *filename, char **keys, int num_keys,
+                 const char *value, table_t *t) {
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    fprintf(stderr, "cannot open %s\n", filename);
+    return false;
+  }
+  char line[4096];
+  char *fields[MAX_COLUMNS];
+  int key_columns[MAX_KEYS];
+  int value_column = -1;
+  size_t size = 0;
+  t->rows = NULL;
+  t->num_rows = 0;
+  bool header = true;
+  while (fgets(line, sizeof(line), in)) {
+    int n = split(line, fields);
+    if (header) {
+      header = false;
+      value_column = find_column(fields, n, value);
+      for (int i = 0; i < num_keys; i++)
+        if ((key_columns[i] = find_column(fields, n, keys[i])) < 0)
+          value_column = -1;
+      if (value_column < 0) {
+        fprintf(stderr, "%s doesn't have the key and value columns\n",
+                filename);
+        fclose(in);
+        return false;
+      }
+      continue;
+    }
+    char *ep;
+    double v = n > value_column ? strtod(fields[value_column], &ep) : 0.0;
+    /* an empty value or the header of the next run */
+    if (n <= value_column || ep == fields[value_column])
+      continue;
+    char key[4096];
+    size_t len = 0;
+    bool complete = true;
+    for (int i = 0; i < num_keys; i++) {
+      if (key_columns[i] >= n) {
+        complete = false;
+        break;
+      }
+      len += snprintf(key + len, sizeof(key) - len, "%s%s", i ? "/" : "",
+                      fields[key_columns[i]]);
+      if (len >= sizeof(key))
+        len = sizeof(key) - 1;
+    }
+    if (!complete)
+      continue;
+    row_t *r = find_row(t, key);
+    if (r) {
+      if (v < r->value)
+        r->value = v;
+      continue;
+    }
+    if (t->num_rows == size) {
+      size = size ? size * 2 : 256;
+      t->rows = (row_t *)ac_realloc(t->rows, sizeof(row_t) * size);
+      if (!t->rows)
+        abort();
+    }
+    t->rows[t->num_rows].key = ac_strdup(key);
+    t->rows[t->num_rows].value = v;
+    t->num_rows++;
+  }
+  fclose(in);
+  return true;
+}
+
+static void free_table(table_t *t) {
+  for (size_t i = 0; i < t->num_rows; i++)
+    ac_free(t->rows[i].key);
+  ac_free(t->rows);
+}
+
+static void print_usage(const char *prog) {
+  printf("%s [-t percent] [-k column,column,...] [-v column]\n", prog);
+  printf("     baseline.csv current.csv\n");
+}
+
+int main(int argc, char *argv[]) {
+  double threshold = 10.0;
+  char key_arg[1024] = "name";
+  const char *value = "median_ns";
+  const char *files[2];
+  int num_files = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' && num_files < 2) {
+      files[num_files++] = argv[i];
+      continue;
+    }
+    if (i + 1 >= argc || strlen(argv[i]) != 2) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    char opt = argv[i][1];
+    char *arg = argv[++i];
+    if (opt == 't')
+      threshold = atof(arg);
+    else if (opt == 'k')
+      snprintf(key_arg, sizeof(key_arg), "%s", arg);
+    else if (opt == 'v')
+      value = arg;
+    else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+  if (num_files != 2) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  char *keys[MAX_KEYS];
+  int num_keys = 0;
+  for (char *p = strtok(key_arg, ","); p && num_keys < MAX_KEYS;
+       p = strtok(NULL, ","))
+    keys[num_keys++] = p;
+
+  table_t baseline, current;
+  if (!load(files[0], keys, num_keys, value, &baseline))
+    return -1;
+  if (!load(files[1], keys, num_keys, value, &current))
+    return -1;
+
+  size_t regressions = 0, compared = 0;
+  for (size_t i = 0; i < current.num_rows; i++) {
+    row_t *c = current.rows + i;
+    row_t *b = find_row(&baseline, c->key);
+    if (!b) {
+      printf("%-60s %12s %12.3f  (new)\n", c->key, "", c->value);
+      continue;
+    }
+    compared++;
+    double change = b->value > 0 ? (c->value - b->value) * 100.0 / b->value
+                                 : 0.0;
+    bool slower = change > threshold;
+    if (slower)
+      regressions++;
+    printf("%-60s %12.3f %12.3f %+7.1f%%%s\n", c->key, b->value, c->value,
+           change, slower ? "  REGRESSION" : "");
+  }
+  for (size_t i = 0; i < baseline.num_rows; i++)
+    if (!find_row(&current, baseline.rows[i].key))
+      printf("%-60s %12.3f %12s  (missing)\n", baseline.rows[i].key,
+             baseline.rows[i].value, "");
+  printf("%zu of %zu results are more than %0.1f%% slower than %s\n",
+         regressions, compared, threshold, files[0]);
+  free_table(&baseline);
+  free_table(&current);
+  return regressions ? 1 : 0;
+}
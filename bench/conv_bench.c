@@ -0,0 +1,104 @@
+#include "ac_bench.h"
+#include "ac_cgi.h"
+#include "ac_conv.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  conv_bench compares the ac_conv parsers to libc and times ac_cgi using
+  ac_bench.  Each run parses the same NUM_VALUES strings over and over.
+
+  conv_bench [-f text|csv|json] [-s samples] [-t sample_ms] [-c 1]
+*/
+
+#define NUM_VALUES 1024
+
+static char ints[NUM_VALUES][24];
+static char doubles[NUM_VALUES][32];
+
+static void bench_strtol(void *arg, uint64_t iterations) {
+  long sum = 0;
+  for (uint64_t i = 0; i < iterations; i++)
+    sum += strtol(ints[i & (NUM_VALUES - 1)], NULL, 10);
+  ac_bench_do_not_optimize(sum);
+}
+
+static void bench_ac_long(void *arg, uint64_t iterations) {
+  long sum = 0;
+  for (uint64_t i = 0; i < iterations; i++)
+    sum += ac_long(ints[i & (NUM_VALUES - 1)], 0);
+  ac_bench_do_not_optimize(sum);
+}
+
+static void bench_strtod(void *arg, uint64_t iterations) {
+  double sum = 0;
+  for (uint64_t i = 0; i < iterations; i++)
+    sum += strtod(doubles[i & (NUM_VALUES - 1)], NULL);
+  ac_bench_do_not_optimize(sum);
+}
+
+static void bench_ac_double(void *arg, uint64_t iterations) {
+  double sum = 0;
+  for (uint64_t i = 0; i < iterations; i++)
+    sum += ac_double(doubles[i & (NUM_VALUES - 1)], 0);
+  ac_bench_do_not_optimize(sum);
+}
+
+static void bench_ac_cgi(void *arg, uint64_t iterations) {
+  ac_pool_t *pool = (ac_pool_t *)arg;
+  const char *q = "/search?q=fast+number+parsing&page=2&limit=50&sort=date"
+                  "&lang=en&safe=off&ts=1570000000&from=%2Fhome";
+  int sum = 0;
+  for (uint64_t i = 0; i < iterations; i++) {
+    ac_cgi_t *cgi = ac_cgi_init(pool, q);
+    sum += ac_cgi_int(cgi, "page", 0) + ac_cgi_int(cgi, "limit", 0);
+    ac_bench_do_not_optimize(ac_cgi_str(cgi, "from", NULL));
+    ac_pool_clear(pool);
+  }
+  ac_bench_do_not_optimize(sum);
+}
+
+int main(int argc, char *argv[]) {
+  ac_bench_options_t options;
+  ac_bench_default_options(&options);
+  ac_bench_format_t format = ac_bench_text;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-f"))
+      format = !strcmp(argv[i + 1], "csv")    ? ac_bench_csv
+               : !strcmp(argv[i + 1], "json") ? ac_bench_json
+                                              : ac_bench_text;
+    else if (!strcmp(argv[i], "-s"))
+      options.num_samples = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-t"))
+      options.sample_ns = strtoull(argv[i + 1], NULL, 10) * 1000000;
+    else if (!strcmp(argv[i], "-c"))
+      options.counters = atoi(argv[i + 1]) != 0;
+  }
+
+  uint64_t x = 0x9E3779B97F4A7C15ULL;
+  for (int i = 0; i < NUM_VALUES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    snprintf(ints[i], sizeof(ints[i]), "%ld",
+             (long)(x >> (x & 63)) * ((x & 64) ? -1 : 1));
+    snprintf(doubles[i], sizeof(doubles[i]), "%.*g", (int)(x % 17) + 1,
+             (double)(x >> 11) / (double)(1ULL << (x & 31)));
+  }
+
+  ac_pool_t *pool = ac_pool_init(4096);
+  ac_bench_t *bench = ac_bench_init(&options);
+  ac_bench_run(bench, "strtol", bench_strtol, NULL);
+  ac_bench_run(bench, "ac_long", bench_ac_long, NULL);
+  ac_bench_run(bench, "strtod", bench_strtod, NULL);
+  ac_bench_run(bench, "ac_double", bench_ac_double, NULL);
+  ac_bench_run(bench, "ac_cgi", bench_ac_cgi, pool);
+  ac_bench_print(bench, stdout, format);
+  ac_bench_destroy(bench);
+  ac_pool_destroy(pool);
+  return 0;
+}
@@ -0,0 +1,188 @@
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  datagen writes a reproducible key set, one key per line, so that the
+  benchmarks (and the demos which read a file) can be run against the same
+  data on every machine.  The same options and seed always produce the same
+  output.
+
+    uniform     integers drawn uniformly from [0, max)
+    zipf        integers drawn from unique keys with a zipfian distribution
+                (theta, 0.99 by default), the hot keys are scattered over
+                [0, unique) rather than being the smallest
+    duplicates  integers drawn uniformly from unique distinct keys (n / 10
+                by default), so every key repeats about n / unique times
+    strings     lowercase strings with a length drawn uniformly from
+                [min_len, max_len].  With -u, the strings are drawn from that
+                many distinct strings.
+
+  datagen [-d uniform|zipf|duplicates|strings] [-n count] [-s seed]
+          [-m max] [-u unique] [-t theta] [-l min_len,max_len]
+*/
+
+static uint64_t rng_state;
+
+/* splitmix64, every seed (including 0) gives a full period sequence */
+static inline uint64_t rng(void) {
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static inline double rng_double(void) {
+  return (double)(rng() >> 11) / (double)(1ULL << 53);
+}
+
+/* a random permutation of [0, n) */
+static uint64_t *permutation(size_t n) {
+  uint64_t *perm = (uint64_t *)ac_malloc(sizeof(uint64_t) * n);
+  if (!perm)
+    abort();
+  for (size_t i = 0; i < n; i++)
+    perm[i] = i;
+  for (size_t i = n; i > 1; i--) {
+    size_t j = rng() % i;
+    uint64_t tmp = perm[i - 1];
+    perm[i - 1] = perm[j];
+    perm[j] = tmp;
+  }
+  return perm;
+}
+
+/* the zipfian generator from YCSB (Gray et al.), as in map_bench */
+static void write_zipf(size_t num, size_t unique, double theta) {
+  uint64_t *perm = permutation(unique);
+  double zetan = 0.0;
+  for (size_t i = 1; i <= unique; i++)
+    zetan += 1.0 / pow((double)i, theta);
+  double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+  double alpha = 1.0 / (1.0 - theta);
+  double eta =
+      (1.0 - pow(2.0 / unique, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  for (size_t i = 0; i < num; i++) {
+    double u = rng_double();
+    double uz = u * zetan;
+    size_t rank;
+    if (uz < 1.0)
+      rank = 0;
+    else if (uz < zeta2)
+      rank = 1;
+    else
+      rank = (size_t)(unique * pow(eta * u - eta + 1.0, alpha));
+    if (rank >= unique)
+      rank = unique - 1;
+    printf("%llu\n", (unsigned long long)perm[rank]);
+  }
+  ac_free(perm);
+}
+
+static void random_string(char *s, size_t min_len, size_t max_len) {
+  size_t len = min_len + rng() % (max_len - min_len + 1);
+  for (size_t i = 0; i < len; i++)
+    s[i] = 'a' + rng() % 26;
+  s[len] = 0;
+}
+
+static void write_strings(size_t num, size_t unique, size_t min_len,
+                          size_t max_len) {
+  char *s = (char *)ac_malloc(max_len + 1);
+  if (!s)
+    abort();
+  if (!unique) {
+    for (size_t i = 0; i < num; i++) {
+      random_string(s, min_len, max_len);
+      printf("%s\n", s);
+    }
+    ac_free(s);
+    return;
+  }
+  /* each distinct string is regenerated from its own seed rather than kept */
+  uint64_t seed = rng_state;
+  for (size_t i = 0; i < num; i++) {
+    uint64_t which = rng() % unique;
+    uint64_t saved = rng_state;
+    rng_state = seed ^ (which * 0xD6E8FEB86659FD93ULL);
+    random_string(s, min_len, max_len);
+    rng_state = saved;
+    printf("%s\n", s);
+  }
+  ac_free(s);
+}
+
+static void print_usage(const char *prog) {
+  printf("%s [-d uniform|zipf|duplicates|strings] [-n count] [-s seed]\n",
+         prog);
+  printf("     [-m max] [-u unique] [-t theta] [-l min_len,max_len]\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *dist = "uniform";
+  size_t num = 1000000;
+  uint64_t seed = 1;
+  uint64_t max = 1ULL << 32;
+  size_t unique = 0;
+  double theta = 0.99;
+  size_t min_len = 4, max_len = 64;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    char opt = argv[i][1];
+    char *value = argv[++i];
+    if (opt == 'd')
+      dist = value;
+    else if (opt == 'n')
+      num = strtoull(value, NULL, 10);
+    else if (opt == 's')
+      seed = strtoull(value, NULL, 10);
+    else if (opt == 'm')
+      max = strtoull(value, NULL, 10);
+    else if (opt == 'u')
+      unique = strtoull(value, NULL, 10);
+    else if (opt == 't')
+      theta = atof(value);
+    else if (opt == 'l') {
+      char *ep;
+      min_len = strtoull(value, &ep, 10);
+      max_len = *ep == ',' ? strtoull(ep + 1, NULL, 10) : min_len;
+    } else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+  if (max_len < min_len || !max || theta <= 0.0 || theta == 1.0) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  rng_state = seed;
+
+  if (!strcmp(dist, "uniform")) {
+    for (size_t i = 0; i < num; i++)
+      printf("%llu\n", (unsigned long long)(rng() % max));
+  } else if (!strcmp(dist, "zipf")) {
+    write_zipf(num, unique ? unique : (num ? num : 1), theta);
+  } else if (!strcmp(dist, "duplicates")) {
+    if (!unique)
+      unique = num / 10 ? num / 10 : 1;
+    uint64_t *perm = permutation(unique);
+    for (size_t i = 0; i < num; i++)
+      printf("%llu\n", (unsigned long long)perm[rng() % unique]);
+    ac_free(perm);
+  } else if (!strcmp(dist, "strings")) {
+    write_strings(num, unique, min_len, max_len);
+  } else {
+    print_usage(argv[0]);
+    return -1;
+  }
+  return 0;
+}
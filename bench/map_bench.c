@@ -0,0 +1,525 @@
+#include "ac_bench.h"
+#include "ac_btree.h"
+#include "ac_hashmap.h"
+#include "ac_map.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/*
+  map_bench compares ac_map (a red-black tree), ac_btree (a B+tree), and
+  ac_hashmap (a swiss table) using ac_bench.  The keys are 0..n-1 and each
+  has a 64 bit value (key + 1, so that a miss is 0).  For every size, each
+  container is measured doing
+
+    insert     building the container from empty (in sequential or random
+               order), a sample may cover part of a build so this is the
+               average over every size up to n
+    find       with keys in sequential or random order, or drawn from a
+               zipfian distribution (theta 0.99, the hot keys are scattered)
+    erase      erasing a random key and inserting it again (the container
+               stays at n)
+    iterate    visiting the next item in order (by slot for ac_hashmap)
+
+  Every time is in ns per operation.  The bytes per element (measured from
+  the heap, including the items of the intrusive ac_map and the items that
+  ac_hashmap points to) are printed after the results, or to stderr for csv
+  and json so that stdout stays one document.  Every container is checked
+  to hold all of the keys after it is built.
+
+  map_bench [-f text|csv|json] [-n 1000,100000,...] [-s samples]
+            [-t sample_ms] [-c 1] [-m container] [-o operation]
+
+  -m and -o only run the containers and operations whose name contains the
+  given text.  The default sizes are 1000,100000,1000000 (100000000 needs
+  about 10GB).
+*/
+
+/* the number of keys in a find or erase sequence */
+#define MAX_LOOKUPS (1 << 22)
+
+typedef struct {
+  ac_map_t node;
+  uint64_t key;
+  uint64_t value;
+} item_t;
+
+typedef struct {
+  uint64_t key;
+  uint64_t value;
+} hash_item_t;
+
+static inline int compare_u64(const uint64_t *a, const uint64_t *b) {
+  return (*a < *b) ? -1 : (*a > *b) ? 1 : 0;
+}
+
+static inline int compare_item(const item_t *a, const item_t *b) {
+  return compare_u64(&a->key, &b->key);
+}
+
+static inline int compare_key_item(const uint64_t *key, const item_t *d) {
+  return compare_u64(key, &d->key);
+}
+
+static inline size_t hash_u64(const uint64_t *key) {
+  uint64_t x = *key * 0x9E3779B97F4A7C15ULL;
+  return (size_t)(x ^ (x >> 32));
+}
+
+static inline bool equal_hash_item(const uint64_t *key, const hash_item_t *d) {
+  return *key == d->key;
+}
+
+static ac_map_insert_m(item_insert, item_t, compare_item);
+static ac_map_find_m(item_find, uint64_t, item_t, compare_key_item);
+
+ac_btree_def(u64_btree, uint64_t, uint64_t);
+ac_btree_m(u64_btree, uint64_t, uint64_t, compare_u64);
+
+ac_hashmap_def(u64_hashmap, uint64_t, hash_item_t);
+ac_hashmap_m(u64_hashmap, uint64_t, hash_item_t, hash_u64, equal_hash_item);
+
+typedef struct {
+  size_t n;
+  /* the order the keys are inserted in (sequential or random) */
+  uint64_t *keys;
+  /* the keys which are found or erased */
+  uint64_t *lookups;
+  size_t num_lookups;
+  /* the position in keys or lookups */
+  size_t pos;
+
+  item_t *items;
+  ac_map_t *root;
+  ac_map_t *cur;
+
+  u64_btree_t btree;
+  u64_btree_iter_t btree_iter;
+  bool btree_iter_valid;
+
+  hash_item_t *hash_items;
+  u64_hashmap_t hashmap;
+  size_t hash_pos;
+} bench_t;
+
+/* the containers, item i of ac_map and ac_hashmap is always for key i */
+static void map_init(bench_t *b) {
+  b->items = (item_t *)ac_calloc(sizeof(item_t) * b->n);
+  b->root = NULL;
+  b->cur = NULL;
+}
+
+static void map_clear(bench_t *b) {
+  b->root = NULL;
+  b->cur = NULL;
+}
+
+static void map_destroy(bench_t *b) { ac_free(b->items); }
+
+static inline void map_insert(bench_t *b, uint64_t key) {
+  item_t *item = b->items + key;
+  item->key = key;
+  item->value = key + 1;
+  item_insert(item, &b->root);
+}
+
+static inline uint64_t map_find(bench_t *b, uint64_t key) {
+  item_t *item = item_find(&key, b->root);
+  return item ? item->value : 0;
+}
+
+static inline void map_remove(bench_t *b, uint64_t key) {
+  ac_map_erase(&b->items[key].node, &b->root);
+}
+
+static inline uint64_t map_iterate(bench_t *b) {
+  b->cur = b->cur ? ac_map_next(b->cur) : NULL;
+  if (!b->cur)
+    b->cur = ac_map_first(b->root);
+  return ((item_t *)b->cur)->value;
+}
+
+static void btree_init(bench_t *b) {
+  u64_btree_init(&b->btree);
+  b->btree_iter_valid = false;
+}
+
+static void btree_clear(bench_t *b) {
+  u64_btree_destroy(&b->btree);
+  btree_init(b);
+}
+
+static void btree_destroy(bench_t *b) { u64_btree_destroy(&b->btree); }
+
+static inline void btree_insert(bench_t *b, uint64_t key) {
+  uint64_t value = key + 1;
+  u64_btree_insert(&b->btree, &key, &value);
+}
+
+static inline uint64_t btree_find(bench_t *b, uint64_t key) {
+  uint64_t *value = u64_btree_find(&b->btree, &key);
+  return value ? *value : 0;
+}
+
+static inline void btree_remove(bench_t *b, uint64_t key) {
+  u64_btree_erase(&b->btree, &key);
+}
+
+static inline uint64_t btree_iterate(bench_t *b) {
+  if (!b->btree_iter_valid || !u64_btree_next(&b->btree_iter))
+    b->btree_iter_valid = u64_btree_first(&b->btree, &b->btree_iter);
+  return *u64_btree_iter_value(&b->btree_iter);
+}
+
+static void hashmap_init(bench_t *b) {
+  b->hash_items = (hash_item_t *)ac_calloc(sizeof(hash_item_t) * b->n);
+  u64_hashmap_init(&b->hashmap, NULL, 0);
+  b->hash_pos = 0;
+}
+
+static void hashmap_clear(bench_t *b) {
+  u64_hashmap_destroy(&b->hashmap);
+  u64_hashmap_init(&b->hashmap, NULL, 0);
+  b->hash_pos = 0;
+}
+
+static void hashmap_destroy(bench_t *b) {
+  u64_hashmap_destroy(&b->hashmap);
+  ac_free(b->hash_items);
+}
+
+static inline void hashmap_insert(bench_t *b, uint64_t key) {
+  hash_item_t *item = b->hash_items + key;
+  item->key = key;
+  item->value = key + 1;
+  u64_hashmap_insert(&b->hashmap, &key, item);
+}
+
+static inline uint64_t hashmap_find(bench_t *b, uint64_t key) {
+  hash_item_t *item = u64_hashmap_find(&b->hashmap, &key);
+  return item ? item->value : 0;
+}
+
+static inline void hashmap_remove(bench_t *b, uint64_t key) {
+  u64_hashmap_erase(&b->hashmap, &key);
+}
+
+static inline uint64_t hashmap_iterate(bench_t *b) {
+  hash_item_t *item = u64_hashmap_next(&b->hashmap, &b->hash_pos);
+  if (!item) {
+    b->hash_pos = 0;
+    item = u64_hashmap_next(&b->hashmap, &b->hash_pos);
+  }
+  return item->value;
+}
+
+/* the ac_bench functions for each container */
+#define bench_container_m(cname)                                               \
+  static void cname##_build(bench_t *b) {                                      \
+    for (size_t i = 0; i < b->n; i++)                                          \
+      cname##_insert(b, b->keys[i]);                                           \
+  }                                                                            \
+                                                                               \
+  static bool cname##_check(bench_t *b) {                                      \
+    for (size_t i = 0; i < b->n; i++)                                          \
+      if (cname##_find(b, i) != i + 1)                                         \
+        return false;                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static void cname##_bench_insert(void *arg, uint64_t iterations) {           \
+    bench_t *b = (bench_t *)arg;                                               \
+    for (uint64_t i = 0; i < iterations; i++) {                                \
+      if (b->pos == b->n) {                                                    \
+        cname##_clear(b);                                                      \
+        b->pos = 0;                                                            \
+      }                                                                        \
+      cname##_insert(b, b->keys[b->pos++]);                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void cname##_bench_find(void *arg, uint64_t iterations) {             \
+    bench_t *b = (bench_t *)arg;                                               \
+    uint64_t sum = 0;                                                          \
+    for (uint64_t i = 0; i < iterations; i++) {                                \
+      if (b->pos == b->num_lookups)                                            \
+        b->pos = 0;                                                            \
+      sum += cname##_find(b, b->lookups[b->pos++]);                            \
+    }                                                                          \
+    ac_bench_do_not_optimize(sum);                                             \
+  }                                                                            \
+                                                                               \
+  static void cname##_bench_erase(void *arg, uint64_t iterations) {            \
+    bench_t *b = (bench_t *)arg;                                               \
+    for (uint64_t i = 0; i < iterations; i++) {                                \
+      if (b->pos == b->num_lookups)                                            \
+        b->pos = 0;                                                            \
+      uint64_t key = b->lookups[b->pos++];                                     \
+      cname##_remove(b, key);                                                  \
+      cname##_insert(b, key);                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void cname##_bench_iterate(void *arg, uint64_t iterations) {          \
+    bench_t *b = (bench_t *)arg;                                               \
+    uint64_t sum = 0;                                                          \
+    for (uint64_t i = 0; i < iterations; i++)                                  \
+      sum += cname##_iterate(b);                                               \
+    ac_bench_do_not_optimize(sum);                                             \
+  }
+
+bench_container_m(map);
+bench_container_m(btree);
+bench_container_m(hashmap);
+
+typedef struct {
+  const char *name;
+  void (*init)(bench_t *b);
+  void (*clear)(bench_t *b);
+  void (*destroy)(bench_t *b);
+  void (*build)(bench_t *b);
+  bool (*check)(bench_t *b);
+  ac_bench_f insert;
+  ac_bench_f find;
+  ac_bench_f erase;
+  ac_bench_f iterate;
+} container_t;
+
+#define container(cname, name)                                                 \
+  {                                                                            \
+    name, cname##_init, cname##_clear, cname##_destroy, cname##_build,         \
+        cname##_check, cname##_bench_insert, cname##_bench_find,               \
+        cname##_bench_erase, cname##_bench_iterate                             \
+  }
+
+static container_t containers[] = {container(map, "ac_map"),
+                                   container(btree, "ac_btree"),
+                                   container(hashmap, "ac_hashmap")};
+
+#define NUM_CONTAINERS (sizeof(containers) / sizeof(containers[0]))
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t next_random(void) {
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static void shuffle(uint64_t *keys, size_t n) {
+  for (size_t i = n; i > 1; i--) {
+    size_t j = next_random() % i;
+    uint64_t tmp = keys[i - 1];
+    keys[i - 1] = keys[j];
+    keys[j] = tmp;
+  }
+}
+
+/* the zipfian generator from YCSB (Gray et al.), rank r is mapped to the
+   key perm[r] so that the hot keys are spread through the container */
+static void fill_zipfian(uint64_t *lookups, size_t num_lookups,
+                         const uint64_t *perm, size_t n) {
+  const double theta = 0.99;
+  double zetan = 0.0;
+  for (size_t i = 1; i <= n; i++)
+    zetan += 1.0 / pow((double)i, theta);
+  double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+  double alpha = 1.0 / (1.0 - theta);
+  double eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  for (size_t i = 0; i < num_lookups; i++) {
+    double u = (double)(next_random() >> 11) / (double)(1ULL << 53);
+    double uz = u * zetan;
+    size_t rank;
+    if (uz < 1.0)
+      rank = 0;
+    else if (uz < zeta2)
+      rank = 1;
+    else
+      rank = (size_t)(n * pow(eta * u - eta + 1.0, alpha));
+    lookups[i] = perm[rank < n ? rank : n - 1];
+  }
+}
+
+/* the bytes in use by malloc (0 if it isn't known) */
+static size_t heap_used(void) {
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+typedef struct {
+  const char *container;
+  size_t n;
+  double bytes_per_element;
+} memory_t;
+
+static const char *container_filter = NULL;
+static const char *op_filter = NULL;
+
+static bool matches(const char *name, const char *filter) {
+  return !filter || strstr(name, filter);
+}
+
+static void run(ac_bench_t *bench, container_t *c, bench_t *b,
+                const char *op, const char *pattern, ac_bench_f fn) {
+  if (!matches(op, op_filter))
+    return;
+  char name[128];
+  snprintf(name, sizeof(name), "%s/%s/%s/%zu", c->name, op, pattern, b->n);
+  b->pos = 0;
+  b->cur = NULL;
+  b->btree_iter_valid = false;
+  b->hash_pos = 0;
+  ac_bench_run(bench, name, fn, b);
+}
+
+static void bench_size(ac_bench_t *bench, size_t n, memory_t *memory,
+                       size_t *num_memory) {
+  bench_t b;
+  memset(&b, 0, sizeof(b));
+  b.n = n;
+  uint64_t *sequential = (uint64_t *)ac_malloc(sizeof(uint64_t) * n);
+  uint64_t *random = (uint64_t *)ac_malloc(sizeof(uint64_t) * n);
+  for (size_t i = 0; i < n; i++)
+    sequential[i] = random[i] = i;
+  shuffle(random, n);
+
+  b.num_lookups = n < MAX_LOOKUPS ? n : MAX_LOOKUPS;
+  uint64_t *random_lookups =
+      (uint64_t *)ac_malloc(sizeof(uint64_t) * b.num_lookups);
+  uint64_t *zipf_lookups =
+      (uint64_t *)ac_malloc(sizeof(uint64_t) * b.num_lookups);
+  for (size_t i = 0; i < b.num_lookups; i++)
+    random_lookups[i] = next_random() % n;
+  if (matches("find", op_filter))
+    fill_zipfian(zipf_lookups, b.num_lookups, random, n);
+
+  for (size_t i = 0; i < NUM_CONTAINERS; i++) {
+    container_t *c = containers + i;
+    if (!matches(c->name, container_filter))
+      continue;
+    size_t before = heap_used();
+    c->init(&b);
+    b.keys = random;
+    c->build(&b);
+    memory_t *m = memory + (*num_memory)++;
+    m->container = c->name;
+    m->n = n;
+    m->bytes_per_element = (double)(heap_used() - before) / n;
+    if (!c->check(&b)) {
+      fprintf(stderr, "%s is missing keys after inserting %zu\n", c->name, n);
+      exit(1);
+    }
+
+    b.keys = sequential;
+    c->clear(&b);
+    run(bench, c, &b, "insert", "sequential", c->insert);
+    b.keys = random;
+    c->clear(&b);
+    run(bench, c, &b, "insert", "random", c->insert);
+
+    c->clear(&b);
+    c->build(&b);
+    b.lookups = sequential;
+    run(bench, c, &b, "find", "sequential", c->find);
+    b.lookups = random_lookups;
+    run(bench, c, &b, "find", "random", c->find);
+    b.lookups = zipf_lookups;
+    run(bench, c, &b, "find", "zipfian", c->find);
+    b.lookups = random_lookups;
+    run(bench, c, &b, "erase", "random", c->erase);
+    run(bench, c, &b, "iterate", "sequential", c->iterate);
+    if (!c->check(&b)) {
+      fprintf(stderr, "%s is missing keys after erasing\n", c->name);
+      exit(1);
+    }
+    c->destroy(&b);
+  }
+  ac_free(zipf_lookups);
+  ac_free(random_lookups);
+  ac_free(random);
+  ac_free(sequential);
+}
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "%s [-f text|csv|json] [-n 1000,100000,...] [-s samples]\n"
+          "    [-t sample_ms] [-c 1] [-m container] [-o operation]\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  ac_bench_options_t options;
+  ac_bench_default_options(&options);
+  ac_bench_format_t format = ac_bench_text;
+  const char *sizes_arg = "1000,100000,1000000";
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    char opt = argv[i][1];
+    char *value = argv[++i];
+    if (opt == 'f')
+      format = !strcmp(value, "csv")    ? ac_bench_csv
+               : !strcmp(value, "json") ? ac_bench_json
+                                        : ac_bench_text;
+    else if (opt == 'n')
+      sizes_arg = value;
+    else if (opt == 's')
+      options.num_samples = atoi(value);
+    else if (opt == 't')
+      options.sample_ns = strtoull(value, NULL, 10) * 1000000;
+    else if (opt == 'c')
+      options.counters = atoi(value) != 0;
+    else if (opt == 'm')
+      container_filter = value;
+    else if (opt == 'o')
+      op_filter = value;
+    else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  size_t sizes[32];
+  size_t num_sizes = 0;
+  const char *p = sizes_arg;
+  while (*p && num_sizes < 32) {
+    char *ep;
+    size_t n = strtoull(p, &ep, 10);
+    if (ep == p)
+      break;
+    if (n)
+      sizes[num_sizes++] = n;
+    p = *ep == ',' ? ep + 1 : ep;
+  }
+
+  memory_t memory[32 * NUM_CONTAINERS];
+  size_t num_memory = 0;
+  ac_bench_t *bench = ac_bench_init(&options);
+  for (size_t i = 0; i < num_sizes; i++)
+    bench_size(bench, sizes[i], memory, &num_memory);
+  ac_bench_print(bench, stdout, format);
+  ac_bench_destroy(bench);
+
+  FILE *out = format == ac_bench_text ? stdout : stderr;
+  fprintf(out, "\n%-12s %12s %16s\n", "container", "n", "bytes/element");
+  for (size_t i = 0; i < num_memory; i++)
+    fprintf(out, "%-12s %12zu %16.2f\n", memory[i].container, memory[i].n,
+            memory[i].bytes_per_element);
+  return 0;
+}
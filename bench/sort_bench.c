@@ -0,0 +1,318 @@
+#include "ac_common.h"
+#include "ac_radix_sort.h"
+#include "ac_sort.h"
+#include "ac_sort_parallel.h"
+#include "ac_sort_stable.h"
+#include "ac_sortl.h"
+#include "ac_timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  sort_bench times the sorts in this library against qsort over a number of
+  element types, input distributions, and sizes.  The results are written as
+  csv (the default) or json so that runs can be compared across versions.
+  Every result is checked to be in order.
+
+  sort_bench [-f csv|json] [-n 1000,100000,...] [-r repeat] [-j threads]
+             [-t type] [-d distribution] [-a algorithm]
+
+  -t, -d, and -a only run the types, distributions, and algorithms whose
+  name contains the given text.
+*/
+
+typedef struct {
+  uint64_t key;
+  uint64_t payload[3];
+} rec32_t;
+
+static int num_threads = 4;
+
+#define bench_type_m(tname, type, key)                                         \
+  static inline int tname##_compare(const type *a, const type *b) {            \
+    return (key(a) < key(b)) ? -1 : (key(a) > key(b)) ? 1 : 0;                 \
+  }                                                                            \
+  static inline bool tname##_less(const type *a, const type *b) {              \
+    return key(a) < key(b);                                                    \
+  }                                                                            \
+  static int tname##_qsort_compare(const void *a, const void *b) {             \
+    return tname##_compare((const type *)a, (const type *)b);                  \
+  }                                                                            \
+  static void tname##_qsort(void *base, size_t num_elements) {                 \
+    qsort(base, num_elements, sizeof(type), tname##_qsort_compare);            \
+  }                                                                            \
+  ac_sort_m(tname##_typed_sort, type, tname##_compare);                        \
+  ac_sortl_m(tname##_typed_sortl, type, tname##_less);                         \
+  ac_sort_stable_m(tname##_typed_sort_stable, type, tname##_compare);          \
+  ac_radix_sort_m(tname##_ac_radix, type, key);                                \
+  ac_sort_parallel_m(tname##_ac_sort_parallel, type, tname##_compare);         \
+  static void tname##_ac_sort(void *base, size_t num_elements) {               \
+    tname##_typed_sort((type *)base, num_elements);                            \
+  }                                                                            \
+  static void tname##_ac_sortl(void *base, size_t num_elements) {              \
+    tname##_typed_sortl((type *)base, num_elements);                           \
+  }                                                                            \
+  static void tname##_ac_sort_stable(void *base, size_t num_elements) {        \
+    tname##_typed_sort_stable((type *)base, num_elements);                     \
+  }                                                                            \
+  static void tname##_ac_radix_sort(void *base, size_t num_elements) {         \
+    tname##_ac_radix((type *)base, num_elements, NULL);                        \
+  }                                                                            \
+  static void tname##_ac_parallel_sort(void *base, size_t num_elements) {      \
+    tname##_ac_sort_parallel((type *)base, num_elements, num_threads);         \
+  }                                                                            \
+  static bool tname##_sorted(void *base, size_t num_elements) {                \
+    type *p = (type *)base;                                                    \
+    for (size_t i = 1; i < num_elements; i++)                                  \
+      if (tname##_less(p + i, p + i - 1))                                      \
+        return false;                                                          \
+    return true;                                                               \
+  }                                                                            \
+  static void tname##_fill(void *base, uint64_t *keys, size_t num_elements) {  \
+    type *p = (type *)base;                                                    \
+    memset(p, 0, num_elements * sizeof(type));                                 \
+    for (size_t i = 0; i < num_elements; i++)                                  \
+      tname##_set(p + i, keys[i]);                                             \
+  }
+
+static inline uint32_t u32_key(const uint32_t *el) { return *el; }
+static inline void u32_set(uint32_t *el, uint64_t v) { *el = (uint32_t)v; }
+static inline uint64_t u64_key(const uint64_t *el) { return *el; }
+static inline void u64_set(uint64_t *el, uint64_t v) { *el = v; }
+static inline uint64_t rec32_key(const rec32_t *el) { return el->key; }
+static inline void rec32_set(rec32_t *el, uint64_t v) { el->key = v; }
+
+bench_type_m(u32, uint32_t, u32_key);
+bench_type_m(u64, uint64_t, u64_key);
+bench_type_m(rec32, rec32_t, rec32_key);
+
+typedef void (*sort_f)(void *base, size_t num_elements);
+
+typedef struct {
+  const char *name;
+  size_t size;
+  void (*fill)(void *base, uint64_t *keys, size_t num_elements);
+  bool (*sorted)(void *base, size_t num_elements);
+  sort_f sorts[6];
+} bench_type_t;
+
+static const char *sort_names[] = {"qsort",          "ac_sort",
+                                   "ac_sortl",       "ac_sort_stable",
+                                   "ac_radix_sort",  "ac_sort_parallel"};
+
+#define bench_type(tname, type)                                                \
+  {                                                                            \
+    #tname, sizeof(type), tname##_fill, tname##_sorted, {                      \
+      tname##_qsort, tname##_ac_sort, tname##_ac_sortl,                        \
+          tname##_ac_sort_stable, tname##_ac_radix_sort,                       \
+          tname##_ac_parallel_sort                                             \
+    }                                                                          \
+  }
+
+static bench_type_t types[] = {bench_type(u32, uint32_t),
+                               bench_type(u64, uint64_t),
+                               bench_type(rec32, rec32_t)};
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static const char *distributions[] = {"random",     "sorted",
+                                      "reversed",   "organ_pipe",
+                                      "few_unique", "mostly_sorted"};
+
+/* keys stay below 2^32 so that every type sorts the same values */
+static void fill_keys(uint64_t *keys, size_t num_elements, int dist) {
+  rng_state = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < num_elements; i++) {
+    switch (dist) {
+    case 0:
+      keys[i] = rng() & 0xFFFFFFFFULL;
+      break;
+    case 1:
+    case 5:
+      keys[i] = i;
+      break;
+    case 2:
+      keys[i] = num_elements - i;
+      break;
+    case 3:
+      keys[i] = i < num_elements / 2 ? i : num_elements - i;
+      break;
+    default:
+      keys[i] = rng() & 15;
+      break;
+    }
+  }
+  if (dist == 5 && num_elements > 1) {
+    /* swap 1% of the elements */
+    size_t swaps = num_elements / 200 + 1;
+    for (size_t i = 0; i < swaps; i++) {
+      size_t a = rng() % num_elements;
+      size_t b = rng() % num_elements;
+      uint64_t tmp = keys[a];
+      keys[a] = keys[b];
+      keys[b] = tmp;
+    }
+  }
+}
+
+static bool matches(const char *name, const char *filter) {
+  return !filter || strstr(name, filter) != NULL;
+}
+
+static void print_usage(const char *prog) {
+  printf("%s [-f csv|json] [-n 1000,100000,...] [-r repeat] [-j threads]\n",
+         prog);
+  printf("     [-t type] [-d distribution] [-a algorithm]\n");
+}
+
+int main(int argc, char *argv[]) {
+  bool json = false;
+  const char *sizes_arg = "1000,100000,1000000";
+  const char *type_filter = NULL;
+  const char *dist_filter = NULL;
+  const char *sort_filter = NULL;
+  int repeat_arg = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    char opt = argv[i][1];
+    char *value = argv[++i];
+    if (opt == 'f')
+      json = !strcmp(value, "json");
+    else if (opt == 'n')
+      sizes_arg = value;
+    else if (opt == 'r')
+      repeat_arg = atoi(value);
+    else if (opt == 'j')
+      num_threads = atoi(value);
+    else if (opt == 't')
+      type_filter = value;
+    else if (opt == 'd')
+      dist_filter = value;
+    else if (opt == 'a')
+      sort_filter = value;
+    else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  size_t sizes[32];
+  size_t num_sizes = 0;
+  const char *p = sizes_arg;
+  while (*p && num_sizes < 32) {
+    char *ep;
+    sizes[num_sizes] = strtoull(p, &ep, 10);
+    if (ep == p)
+      break;
+    if (sizes[num_sizes])
+      num_sizes++;
+    p = (*ep == ',') ? ep + 1 : ep;
+  }
+  size_t max_size = 0;
+  for (size_t i = 0; i < num_sizes; i++)
+    if (sizes[i] > max_size)
+      max_size = sizes[i];
+
+  uint64_t *keys = (uint64_t *)malloc(max_size * sizeof(uint64_t));
+  char *input = (char *)malloc(max_size * sizeof(rec32_t));
+  char *work = (char *)malloc(max_size * sizeof(rec32_t));
+  if (!keys || !input || !work)
+    abort();
+
+  if (json)
+    printf("[");
+  else
+    printf("type,element_size,distribution,num_elements,algorithm,repeat,"
+           "ns_per_sort,ns_per_element\n");
+
+  bool first = true;
+  size_t num_types = sizeof(types) / sizeof(types[0]);
+  size_t num_dists = sizeof(distributions) / sizeof(distributions[0]);
+  size_t num_sorts = sizeof(sort_names) / sizeof(sort_names[0]);
+  for (size_t t = 0; t < num_types; t++) {
+    bench_type_t *bt = types + t;
+    if (!matches(bt->name, type_filter))
+      continue;
+    for (size_t d = 0; d < num_dists; d++) {
+      if (!matches(distributions[d], dist_filter))
+        continue;
+      for (size_t s = 0; s < num_sizes; s++) {
+        size_t n = sizes[s];
+        size_t bytes = n * bt->size;
+        fill_keys(keys, n, d);
+        bt->fill(input, keys, n);
+
+        /* aim for roughly 50 million elements sorted per measurement */
+        int repeat = repeat_arg;
+        if (repeat <= 0) {
+          repeat = (int)(50000000 / n);
+          if (repeat < 1)
+            repeat = 1;
+          if (repeat > 10000)
+            repeat = 10000;
+        }
+
+        ac_timer_t *copy_timer = ac_timer_init(repeat);
+        ac_timer_start(copy_timer);
+        for (int r = 0; r < repeat; r++)
+          memcpy(work, input, bytes);
+        ac_timer_stop(copy_timer);
+
+        for (size_t a = 0; a < num_sorts; a++) {
+          if (!matches(sort_names[a], sort_filter))
+            continue;
+          sort_f sort = bt->sorts[a];
+          ac_timer_t *timer = ac_timer_init(repeat);
+          ac_timer_subtract(timer, copy_timer);
+          ac_timer_start(timer);
+          for (int r = 0; r < repeat; r++) {
+            memcpy(work, input, bytes);
+            sort(work, n);
+          }
+          ac_timer_stop(timer);
+          if (!bt->sorted(work, n)) {
+            fprintf(stderr, "%s failed to sort %s %s %zu\n", sort_names[a],
+                    bt->name, distributions[d], n);
+            abort();
+          }
+          double ns = ac_timer_ns(timer);
+          if (json)
+            printf("%s\n  {\"type\": \"%s\", \"element_size\": %zu, "
+                   "\"distribution\": \"%s\", \"num_elements\": %zu, "
+                   "\"algorithm\": \"%s\", \"repeat\": %d, "
+                   "\"ns_per_sort\": %0.1f, \"ns_per_element\": %0.3f}",
+                   first ? "" : ",", bt->name, bt->size, distributions[d], n,
+                   sort_names[a], repeat, ns, ns / n);
+          else
+            printf("%s,%zu,%s,%zu,%s,%d,%0.1f,%0.3f\n", bt->name, bt->size,
+                   distributions[d], n, sort_names[a], repeat, ns, ns / n);
+          fflush(stdout);
+          first = false;
+          ac_timer_destroy(timer);
+        }
+        ac_timer_destroy(copy_timer);
+      }
+    }
+  }
+  if (json)
+    printf("\n]\n");
+
+  free(work);
+  free(input);
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include "ac_pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+  Uppercases a file the way uvdemo1 does, but with ac_pipeline doing the
+  plumbing.  The file is read in blocks of whole lines on the main thread,
+  the blocks are uppercased by four threads, and one thread writes them out
+  in the original order.  At most num_items blocks are in memory at once.
+*/
+#define num_items 32
+#define block_size (64 * 1024)
+#define num_threads 4
+
+bool uppercase(void *arg, ac_pipeline_item_t *item) {
+  char *p = ac_buffer_data(item->bh);
+  char *ep = p + ac_buffer_length(item->bh);
+  while (p < ep) {
+    if (*p >= 'a' && *p <= 'z')
+      *p = *p - 'a' + 'A';
+    p++;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("%s <input> <output>\n", argv[0]);
+    return 0;
+  }
+  printf("Demo illustrating how to process a file in parallel with\n");
+  printf("ac_pipeline.  The lines of %s are uppercased by %d threads and\n",
+         argv[1], num_threads);
+  printf("written in order to %s.\n", argv[2]);
+
+  FILE *in = fopen(argv[1], "rb");
+  FILE *out = fopen(argv[2], "wb");
+  if (!in || !out) {
+    printf("Unable to open %s or %s\n", argv[1], argv[2]);
+    return -1;
+  }
+  ac_pipeline_t *pipeline = ac_pipeline_init(num_items, block_size);
+  ac_pipeline_source(pipeline, ac_pipeline_read_lines, in);
+  ac_pipeline_stage(pipeline, uppercase, NULL, num_threads);
+  ac_pipeline_ordered_stage(pipeline, ac_pipeline_write, out);
+  ac_pipeline_run(pipeline);
+  printf("%llu blocks\n", (unsigned long long)ac_pipeline_count(pipeline));
+  ac_pipeline_destroy(pipeline);
+  fclose(in);
+  fclose(out);
+  return 0;
+}
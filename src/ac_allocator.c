@@ -16,7 +16,9 @@ limitations under the License.
 
 #include "ac_allocator.h"
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 typedef struct ac_allocator_node_s {
   const char *caller;
@@ -24,24 +26,209 @@ typedef struct ac_allocator_node_s {
   struct ac_allocator_node_s *next;
   struct ac_allocator_node_s *previous;
   ac_allocator_t *a;
+  /* untracked (unsampled) nodes are not linked into the allocator's list */
+  bool tracked;
+  /* the id of the allocation in the recording (0 if it wasn't recorded) */
+  uint64_t id;
 } ac_allocator_node_t;
 
+/* Untracked allocations are counted by the thread which allocates or frees
+   them, so only the first allocation of each thread needs the lock.  The
+   counters are merged when they are reported. */
+typedef struct ac_allocator_counters_s {
+  ac_allocator_t *a;
+  ssize_t allocations;
+  ssize_t bytes;
+  struct ac_allocator_counters_s *next;
+  struct ac_allocator_counters_s *thread_next;
+} ac_allocator_counters_t;
+
+static __thread ac_allocator_counters_t *thread_counters = NULL;
+static __thread size_t sample_countdown = 0;
+
+/* threads are numbered in the order they first allocate while recording */
+static __thread uint32_t thread_number = 0;
+static uint32_t num_threads = 0;
+
 struct ac_allocator_s;
 typedef struct ac_allocator_s ac_allocator_t;
 
-struct ac_allocator_s {
+/* The tracked allocations are spread across shards (by address) so that
+   threads which allocate at the same time rarely wait on the same lock.  The
+   shards are only combined when the allocations are reported. */
+#define AC_ALLOCATOR_SHARDS 16
+
+typedef struct {
+  pthread_mutex_t mutex;
   ac_allocator_node_t *head;
   ac_allocator_node_t *tail;
   size_t total_bytes_allocated;
   size_t total_allocations;
+} ac_allocator_shard_t;
+
+struct ac_allocator_s {
+  ac_allocator_shard_t shards[AC_ALLOCATOR_SHARDS];
   const char *logfile;
   bool thread_safe;
   pthread_t thread;
   pthread_cond_t cond;
+  /* the mutex protects everything except the shards */
   pthread_mutex_t mutex;
   int done;
+
+  /* 1 in sample_rate allocations are tracked along with any allocation of at
+     least sample_bytes (if sample_bytes isn't 0) */
+  size_t sample_rate;
+  size_t sample_bytes;
+  ac_allocator_counters_t *counters;
+
+  /* the previous profile (sorted by caller) is kept to report growth.  The
+     profile_mutex only serializes the callers of ac_dump_allocation_profile.
+   */
+  pthread_mutex_t profile_mutex;
+  struct ac_allocator_site_s *last_profile;
+  size_t last_profile_size;
+
+  /* the recording (see ac_allocator_record) is protected by record_mutex.
+     The ids keep increasing across recordings so that a free of something
+     allocated before the current recording (id < first_id) is skipped. */
+  pthread_mutex_t record_mutex;
+  FILE *record;
+  uint64_t record_start;
+  uint64_t record_id;
+  uint64_t first_id;
 };
 
+static inline ac_allocator_shard_t *get_shard(ac_allocator_t *a,
+                                              ac_allocator_node_t *n) {
+  /* neighboring allocations should land in different shards */
+  uint64_t h = ((uint64_t)(uintptr_t)n >> 4) * 11400714819323198485ULL;
+  return a->shards + (h >> 60) % AC_ALLOCATOR_SHARDS;
+}
+
+/* the shards are always locked in order when more than one is needed */
+static void lock_shards(ac_allocator_t *a) {
+  if (a->thread_safe)
+    for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++)
+      pthread_mutex_lock(&a->shards[i].mutex);
+}
+
+static void unlock_shards(ac_allocator_t *a) {
+  if (a->thread_safe)
+    for (int i = AC_ALLOCATOR_SHARDS - 1; i >= 0; i--)
+      pthread_mutex_unlock(&a->shards[i].mutex);
+}
+
+ac_allocator_t *global_allocator = NULL;
+
+static ac_allocator_counters_t *get_counters(ac_allocator_t *a) {
+  ac_allocator_counters_t *c = thread_counters;
+  while (c && c->a != a)
+    c = c->thread_next;
+  if (c)
+    return c;
+  c = (ac_allocator_counters_t *)calloc(1, sizeof(ac_allocator_counters_t));
+  if (!c)
+    abort();
+  c->a = a;
+  c->thread_next = thread_counters;
+  thread_counters = c;
+  if (a->thread_safe)
+    pthread_mutex_lock(&a->mutex);
+  c->next = a->counters;
+  a->counters = c;
+  if (a->thread_safe)
+    pthread_mutex_unlock(&a->mutex);
+  return c;
+}
+
+static inline void count_untracked(ac_allocator_t *a, ssize_t allocations,
+                                   ssize_t bytes) {
+  ac_allocator_counters_t *c = get_counters(a);
+  /* only this thread writes to c, the relaxed atomics allow other threads to
+     read the counters while reporting */
+  __atomic_store_n(&c->allocations, c->allocations + allocations,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&c->bytes, c->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+static void sum_untracked(ac_allocator_t *a, ssize_t *allocations,
+                          ssize_t *bytes) {
+  *allocations = 0;
+  *bytes = 0;
+  for (ac_allocator_counters_t *c = a->counters; c; c = c->next) {
+    *allocations += __atomic_load_n(&c->allocations, __ATOMIC_RELAXED);
+    *bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+  }
+}
+
+static inline bool should_track(ac_allocator_t *a, size_t len) {
+  if (a->sample_rate <= 1)
+    return true;
+  if (a->sample_bytes && len >= a->sample_bytes)
+    return true;
+  if (sample_countdown) {
+    sample_countdown--;
+    return false;
+  }
+  sample_countdown = a->sample_rate - 1;
+  return true;
+}
+
+void ac_allocator_set_sampling(ac_allocator_t *a, size_t one_in_n,
+                               size_t min_bytes) {
+  if (!a)
+    a = global_allocator;
+  a->sample_rate = one_in_n;
+  a->sample_bytes = min_bytes;
+}
+
+static uint64_t record_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* a length of 0 records the free of n */
+static void record(ac_allocator_t *a, ac_allocator_node_t *n, size_t length) {
+  if (!thread_number)
+    thread_number = __atomic_add_fetch(&num_threads, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&a->record_mutex);
+  if (a->record && (length || n->id >= a->first_id)) {
+    if (length)
+      n->id = ++a->record_id;
+    ac_allocator_record_t r;
+    r.time = record_now() - a->record_start;
+    r.id = n->id - a->first_id + 1;
+    r.length = length;
+    r.thread = thread_number;
+    r.reserved = 0;
+    fwrite(&r, sizeof(r), 1, a->record);
+  }
+  pthread_mutex_unlock(&a->record_mutex);
+}
+
+bool ac_allocator_record(ac_allocator_t *a, const char *filename) {
+  if (!a)
+    a = global_allocator;
+  FILE *out = NULL;
+  if (filename) {
+    out = fopen(filename, "wb");
+    if (!out)
+      return false;
+    fwrite(AC_ALLOCATOR_RECORD_MAGIC, 8, 1, out);
+  }
+  pthread_mutex_lock(&a->record_mutex);
+  FILE *old = a->record;
+  a->record_start = record_now();
+  a->first_id = a->record_id + 1;
+  __atomic_store_n(&a->record, out, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&a->record_mutex);
+  if (old)
+    fclose(old);
+  return true;
+}
+
 static void print_node(FILE *out, const char *caller, ssize_t len,
                        ac_allocator_node_t *n) {
   if (len >= 0)
@@ -55,29 +242,176 @@ static void print_node(FILE *out, const char *caller, ssize_t len,
 }
 
 static void _ac_dump_global_allocations(ac_allocator_t *a, FILE *out) {
-  if (a->head) {
+  ssize_t untracked_allocations, untracked_bytes;
+  sum_untracked(a, &untracked_allocations, &untracked_bytes);
+  if (untracked_allocations)
+    fprintf(out, "%ld byte(s) allocated in %ld untracked allocations\n",
+            untracked_bytes, untracked_allocations);
+  size_t total_bytes_allocated = 0, total_allocations = 0;
+  for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++) {
+    total_bytes_allocated += a->shards[i].total_bytes_allocated;
+    total_allocations += a->shards[i].total_allocations;
+  }
+  if (total_allocations) {
     fprintf(out,
             "%lu byte(s) allocated in %lu allocations (%lu byte(s) overhead)\n",
-            a->total_bytes_allocated, a->total_allocations,
-            a->total_allocations * sizeof(ac_allocator_node_t));
-    ac_allocator_node_t *n = a->head;
-    while (n) {
-      print_node(out, n->caller, n->length, n);
-      fprintf(out, "\n");
-      n = n->next;
+            total_bytes_allocated, total_allocations,
+            total_allocations * sizeof(ac_allocator_node_t));
+    for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++) {
+      ac_allocator_node_t *n = a->shards[i].head;
+      while (n) {
+        print_node(out, n->caller, n->length, n);
+        fprintf(out, "\n");
+        n = n->next;
+      }
     }
   }
 }
 
 void ac_dump_global_allocations(ac_allocator_t *a, FILE *out) {
-  if (a->thread_safe)
-    pthread_mutex_lock(&a->mutex);
+  lock_shards(a);
   _ac_dump_global_allocations(a, out);
-  if (a->thread_safe)
-    pthread_mutex_unlock(&a->mutex);
+  unlock_shards(a);
 }
 
-ac_allocator_t *global_allocator = NULL;
+typedef struct ac_allocator_site_s {
+  const char *caller;
+  size_t count;
+  size_t bytes;
+  ssize_t count_growth;
+  ssize_t bytes_growth;
+} ac_allocator_site_t;
+
+/* add n to the table of sites (keyed by the caller pointer).  The table uses
+   open addressing and *size is always a power of 2. */
+static ac_allocator_site_t *add_site(ac_allocator_site_t *table, size_t *size,
+                                     size_t *used, ac_allocator_node_t *n) {
+  if (*used * 2 >= *size) {
+    size_t new_size = *size * 2;
+    ac_allocator_site_t *t =
+        (ac_allocator_site_t *)calloc(new_size, sizeof(ac_allocator_site_t));
+    if (!t)
+      abort();
+    for (size_t i = 0; i < *size; i++) {
+      if (!table[i].caller)
+        continue;
+      size_t h = ((size_t)table[i].caller >> 3) & (new_size - 1);
+      while (t[h].caller)
+        h = (h + 1) & (new_size - 1);
+      t[h] = table[i];
+    }
+    free(table);
+    table = t;
+    *size = new_size;
+  }
+  size_t h = ((size_t)n->caller >> 3) & (*size - 1);
+  while (table[h].caller && table[h].caller != n->caller)
+    h = (h + 1) & (*size - 1);
+  if (!table[h].caller) {
+    table[h].caller = n->caller;
+    (*used)++;
+  }
+  table[h].count++;
+  table[h].bytes += n->length > 0 ? n->length : -n->length;
+  return table;
+}
+
+static int compare_site_callers(const void *p1, const void *p2) {
+  const ac_allocator_site_t *a = (const ac_allocator_site_t *)p1;
+  const ac_allocator_site_t *b = (const ac_allocator_site_t *)p2;
+  return strcmp(a->caller, b->caller);
+}
+
+static int compare_site_bytes(const void *p1, const void *p2) {
+  const ac_allocator_site_t *a = (const ac_allocator_site_t *)p1;
+  const ac_allocator_site_t *b = (const ac_allocator_site_t *)p2;
+  if (a->bytes != b->bytes)
+    return a->bytes < b->bytes ? 1 : -1;
+  return strcmp(a->caller, b->caller);
+}
+
+void ac_dump_allocation_profile(ac_allocator_t *a, FILE *out) {
+  if (!a)
+    a = global_allocator;
+  pthread_mutex_lock(&a->profile_mutex);
+  size_t size = 1024, used = 0;
+  ac_allocator_site_t *table =
+      (ac_allocator_site_t *)calloc(size, sizeof(ac_allocator_site_t));
+  if (!table)
+    abort();
+
+  /* only the grouping by caller pointer happens while a lock is held and
+     only one shard is locked at a time */
+  for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++) {
+    ac_allocator_shard_t *shard = a->shards + i;
+    if (a->thread_safe)
+      pthread_mutex_lock(&shard->mutex);
+    for (ac_allocator_node_t *n = shard->head; n; n = n->next)
+      table = add_site(table, &size, &used, n);
+    if (a->thread_safe)
+      pthread_mutex_unlock(&shard->mutex);
+  }
+
+  /* pack the sites and merge the ones which have the same caller string (but
+     a different pointer) */
+  size_t num_sites = 0;
+  for (size_t i = 0; i < size; i++)
+    if (table[i].caller)
+      table[num_sites++] = table[i];
+  qsort(table, num_sites, sizeof(ac_allocator_site_t), compare_site_callers);
+  size_t j = 0;
+  for (size_t i = 0; i < num_sites; i++) {
+    if (j && !strcmp(table[j - 1].caller, table[i].caller)) {
+      table[j - 1].count += table[i].count;
+      table[j - 1].bytes += table[i].bytes;
+    } else
+      table[j++] = table[i];
+  }
+  num_sites = j;
+
+  /* compare against the last profile (both are sorted by caller) */
+  size_t total_count = 0, total_bytes = 0;
+  ac_allocator_site_t *last = a->last_profile;
+  size_t last_size = a->last_profile_size, k = 0;
+  for (size_t i = 0; i < num_sites; i++) {
+    ac_allocator_site_t *site = table + i;
+    total_count += site->count;
+    total_bytes += site->bytes;
+    while (k < last_size && strcmp(last[k].caller, site->caller) < 0)
+      k++;
+    site->count_growth = site->count;
+    site->bytes_growth = site->bytes;
+    if (k < last_size && !strcmp(last[k].caller, site->caller)) {
+      site->count_growth -= last[k].count;
+      site->bytes_growth -= last[k].bytes;
+    }
+  }
+  free(last);
+  a->last_profile = (ac_allocator_site_t *)malloc(
+      (num_sites ? num_sites : 1) * sizeof(ac_allocator_site_t));
+  if (!a->last_profile)
+    abort();
+  memcpy(a->last_profile, table, num_sites * sizeof(ac_allocator_site_t));
+  a->last_profile_size = num_sites;
+
+  ssize_t untracked_allocations, untracked_bytes;
+  sum_untracked(a, &untracked_allocations, &untracked_bytes);
+  if (untracked_allocations)
+    fprintf(out, "%ld byte(s) allocated in %ld untracked allocations\n",
+            untracked_bytes, untracked_allocations);
+  fprintf(out, "%lu byte(s) allocated in %lu allocations from %lu caller(s)\n",
+          total_bytes, total_count, num_sites);
+  qsort(table, num_sites, sizeof(ac_allocator_site_t), compare_site_bytes);
+  if (num_sites)
+    fprintf(out, "%12s %10s %12s %10s %s\n", "bytes", "count", "growth",
+            "growth", "caller");
+  for (size_t i = 0; i < num_sites; i++)
+    fprintf(out, "%12lu %10lu %+12ld %+10ld %s\n", table[i].bytes,
+            table[i].count, table[i].bytes_growth, table[i].count_growth,
+            table[i].caller);
+  free(table);
+  pthread_mutex_unlock(&a->profile_mutex);
+}
 
 void save_old_log(ac_allocator_t *a, size_t saves, char *tmp) {
   int num = 0;
@@ -109,17 +443,25 @@ void *dump_global_allocations_thread(void *arg) {
   while (!done) {
     save_old_log(a, save, tmp);
     pthread_mutex_lock(&a->mutex);
+    done = a->done;
+    pthread_mutex_unlock(&a->mutex);
+
+    /* the profile is written without holding the lock.  The last write also
+       lists every remaining allocation (they are likely leaks). */
     FILE *out = fopen(a->logfile, "wb");
-    _ac_dump_global_allocations(a, out);
+    ac_dump_allocation_profile(a, out);
+    if (done)
+      ac_dump_global_allocations(a, out);
     fclose(out);
-    if (a->done)
-      done = 1;
-    else {
-      clock_gettime(CLOCK_REALTIME, &ts);
-      ts.tv_sec += _AC_DEBUG_MEMORY_SPEED_;
-      pthread_cond_timedwait(&a->cond, &a->mutex, &ts);
+    if (!done) {
+      pthread_mutex_lock(&a->mutex);
+      if (!a->done) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += _AC_DEBUG_MEMORY_SPEED_;
+        pthread_cond_timedwait(&a->cond, &a->mutex, &ts);
+      }
+      pthread_mutex_unlock(&a->mutex);
     }
-    pthread_mutex_unlock(&a->mutex);
   }
   free(tmp);
   return NULL;
@@ -127,19 +469,34 @@ void *dump_global_allocations_thread(void *arg) {
 
 ac_allocator_t *ac_allocator_init(const char *filename, bool thread_safe) {
   ac_allocator_t *a = (ac_allocator_t *)malloc(sizeof(ac_allocator_t));
-  a->head = NULL;
-  a->tail = NULL;
-  a->total_bytes_allocated = 0;
-  a->total_allocations = 0;
+  for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++) {
+    ac_allocator_shard_t *shard = a->shards + i;
+    shard->head = NULL;
+    shard->tail = NULL;
+    shard->total_bytes_allocated = 0;
+    shard->total_allocations = 0;
+    if (thread_safe)
+      pthread_mutex_init(&shard->mutex, NULL);
+  }
   a->logfile = filename;
   a->done = 0;
   a->thread_safe = thread_safe;
+  a->sample_rate = 1;
+  a->sample_bytes = 0;
+  a->counters = NULL;
+  a->last_profile = NULL;
+  a->last_profile_size = 0;
+  pthread_mutex_init(&a->profile_mutex, NULL);
+  pthread_mutex_init(&a->record_mutex, NULL);
+  a->record = NULL;
+  a->record_id = 0;
+  a->first_id = 1;
   if (thread_safe) {
+    pthread_mutex_init(&a->mutex, NULL);
     if (filename) {
       pthread_cond_init(&a->cond, NULL);
       pthread_create(&(a->thread), NULL, dump_global_allocations_thread, a);
     }
-    pthread_mutex_init(&a->mutex, NULL);
   }
   return a;
 }
@@ -155,11 +512,25 @@ void ac_allocator_destroy(ac_allocator_t *a) {
   } else {
     if (a->logfile) {
       FILE *out = fopen(a->logfile, "wb");
-      ac_dump_global_allocations(a, stderr);
+      ac_dump_global_allocations(a, out);
       fclose(out);
     } else
       ac_dump_global_allocations(a, stderr);
   }
+  ac_allocator_counters_t *c = a->counters;
+  while (c) {
+    ac_allocator_counters_t *next = c->next;
+    free(c);
+    c = next;
+  }
+  free(a->last_profile);
+  pthread_mutex_destroy(&a->profile_mutex);
+  if (a->record)
+    fclose(a->record);
+  pthread_mutex_destroy(&a->record_mutex);
+  if (a->thread_safe)
+    for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++)
+      pthread_mutex_destroy(&a->shards[i].mutex);
   free(a);
 }
 
@@ -172,6 +543,13 @@ void myStartupFun(void) {
 #else
   global_allocator = ac_allocator_init(NULL, true);
 #endif
+#ifdef _AC_DEBUG_MEMORY_SAMPLE_
+  ac_allocator_set_sampling(global_allocator, _AC_DEBUG_MEMORY_SAMPLE_,
+                            _AC_DEBUG_MEMORY_SAMPLE_BYTES_);
+#endif
+#ifdef _AC_DEBUG_MEMORY_TRACE_
+  ac_allocator_record(global_allocator, _AC_DEBUG_MEMORY_TRACE_);
+#endif
 }
 
 void myCleanupFun(void) { ac_allocator_destroy(global_allocator); }
@@ -203,19 +581,29 @@ void *_ac_malloc_d(ac_allocator_t *a, const char *caller, size_t len,
   n->length = l;
   n->next = NULL;
   n->a = a;
+  n->id = 0;
+  if (__atomic_load_n(&a->record, __ATOMIC_RELAXED))
+    record(a, n, len);
+  n->tracked = should_track(a, len);
+  if (!n->tracked) {
+    n->previous = NULL;
+    count_untracked(a, 1, len);
+    return (void *)(n + 1);
+  }
 
+  ac_allocator_shard_t *shard = get_shard(a, n);
   if (a->thread_safe)
-    pthread_mutex_lock(&a->mutex);
-  a->total_bytes_allocated += len;
-  a->total_allocations++;
-  n->previous = a->tail;
+    pthread_mutex_lock(&shard->mutex);
+  shard->total_bytes_allocated += len;
+  shard->total_allocations++;
+  n->previous = shard->tail;
   if (n->previous)
     n->previous->next = n;
   else
-    a->head = n;
-  a->tail = n;
+    shard->head = n;
+  shard->tail = n;
   if (a->thread_safe)
-    pthread_mutex_unlock(&a->mutex);
+    pthread_mutex_unlock(&shard->mutex);
   return (void *)(n + 1);
 }
 
@@ -242,20 +630,23 @@ static ac_allocator_node_t *get_ac_node(ac_allocator_t *a,
   if (n->a == a)
     return n;
 
-  ac_allocator_node_t *n2 = a->head;
   char *c = (char *)p;
   ac_allocator_node_t *closest = NULL;
-  size_t closest_abs_dist;
-  ssize_t closest_dist;
-  while (n2) {
-    char *p2 = (char *)(n2 + 1);
-    size_t dist = p2 < c ? c - p2 : p2 - c;
-    if (!closest || dist < closest_abs_dist) {
-      closest_abs_dist = dist;
-      closest_dist = c - p2;
-      closest = n2;
+  size_t closest_abs_dist = 0;
+  ssize_t closest_dist = 0;
+  lock_shards(a);
+  for (int i = 0; i < AC_ALLOCATOR_SHARDS; i++) {
+    ac_allocator_node_t *n2 = a->shards[i].head;
+    while (n2) {
+      char *p2 = (char *)(n2 + 1);
+      size_t dist = p2 < c ? c - p2 : p2 - c;
+      if (!closest || dist < closest_abs_dist) {
+        closest_abs_dist = dist;
+        closest_dist = c - p2;
+        closest = n2;
+      }
+      n2 = n2->next;
     }
-    n2 = n2->next;
   }
   if (a->thread_safe)
     pthread_mutex_lock(&a->mutex);
@@ -270,6 +661,7 @@ static ac_allocator_node_t *get_ac_node(ac_allocator_t *a,
   fprintf(stderr, "%s\n", message);
   if (a->thread_safe)
     pthread_mutex_unlock(&a->mutex);
+  unlock_shards(a);
   abort();
 }
 
@@ -307,23 +699,32 @@ void _ac_free_d(ac_allocator_t *a, const char *caller, void *p) {
     a = global_allocator;
   ac_allocator_node_t *n =
       get_ac_node(a, caller, p, "ac_free is invalid (double free?)");
+  if (n->id && __atomic_load_n(&a->record, __ATOMIC_RELAXED))
+    record(a, n, 0);
+  if (!n->tracked) {
+    count_untracked(a, -1, n->length > 0 ? -n->length : n->length);
+    n->a--; // to try and protect against double free
+    free(n);
+    return;
+  }
+  ac_allocator_shard_t *shard = get_shard(a, n);
   if (a->thread_safe)
-    pthread_mutex_lock(&a->mutex);
+    pthread_mutex_lock(&shard->mutex);
   if (n->previous)
     n->previous->next = n->next;
   else
-    a->head = n->next;
+    shard->head = n->next;
   if (n->next)
     n->next->previous = n->previous;
   else
-    a->tail = n->previous;
-  a->total_allocations--;
+    shard->tail = n->previous;
+  shard->total_allocations--;
   if (n->length > 0)
-    a->total_bytes_allocated -= n->length;
+    shard->total_bytes_allocated -= n->length;
   else
-    a->total_bytes_allocated += n->length;
+    shard->total_bytes_allocated += n->length;
   if (a->thread_safe)
-    pthread_mutex_unlock(&a->mutex);
+    pthread_mutex_unlock(&shard->mutex);
   n->a--; // to try and protect against double free
   free(n);
 }
@@ -19,6 +19,7 @@ limitations under the License.
 
 #include "ac_common.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +57,49 @@ void ac_allocator_destroy(ac_allocator_t *a);
 
 void ac_dump_global_allocations(ac_allocator_t *a, FILE *out);
 
+/* ac_dump_allocation_profile writes one line per caller with the number of
+   bytes and allocations which are outstanding and how much each changed since
+   the previous profile.  The lock is only held while the allocations are
+   grouped, so this is suitable for processes with many live allocations.  If
+   a is NULL, the global allocator is used.  When _AC_DEBUG_MEMORY_ is a
+   filename, this is what is periodically written to the file. */
+void ac_dump_allocation_profile(ac_allocator_t *a, FILE *out);
+
+/* ac_allocator_set_sampling makes the allocator track only 1 in one_in_n
+   allocations plus every allocation of at least min_bytes (if min_bytes is
+   not 0).  Untracked allocations only update per-thread counters (no lock and
+   no list), so leaks and heap growth can still be seen without the full cost
+   of tracking.  A one_in_n of 1 tracks every allocation (the default).  If a
+   is NULL, the global allocator is changed. */
+void ac_allocator_set_sampling(ac_allocator_t *a, size_t one_in_n,
+                               size_t min_bytes);
+
+/* ac_allocator_record writes every allocation and free which goes through a
+   to filename so that the pattern can be replayed against other allocators
+   (see bench/alloc_replay.c).  The global allocator only sees ac_malloc,
+   ac_free, ... when _AC_DEBUG_MEMORY_ is defined (otherwise they are the
+   system functions).  A realloc is recorded as an allocation and a free (which
+   is what the debug allocator does).  A NULL filename stops the recording,
+   which also stops when a is destroyed.  Returns false if the file can't be
+   created.  If a is NULL, the global allocator is used.  Defining
+   _AC_DEBUG_MEMORY_TRACE_ as a filename records from the start. */
+bool ac_allocator_record(ac_allocator_t *a, const char *filename);
+
+/* the trace is AC_ALLOCATOR_RECORD_MAGIC followed by these records */
+#define AC_ALLOCATOR_RECORD_MAGIC "ACALLOC1"
+
+typedef struct {
+  /* nanoseconds since the recording started */
+  uint64_t time;
+  /* the allocation (numbered from 1 in the order they were allocated) */
+  uint64_t id;
+  /* the length of an allocation, or 0 for a free */
+  uint64_t length;
+  /* the thread (numbered from 1 in the order threads first allocated) */
+  uint32_t thread;
+  uint32_t reserved;
+} ac_allocator_record_t;
+
 void *_ac_malloc_d(ac_allocator_t *a, const char *caller, size_t len,
                    bool custom);
 
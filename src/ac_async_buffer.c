@@ -16,9 +16,18 @@ limitations under the License.
 
 #include "ac_async_buffer.h"
 #include "ac_buffer.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 typedef int (*ac_async_buffer_advance_f)(ac_async_buffer_t *);
 
 struct ac_async_buffer_s {
@@ -40,6 +49,13 @@ struct ac_async_buffer_s {
   char char_delimiter;
   void *mem_delimiter;
   size_t mem_delimiter_length;
+  /*  ac_async_buffer_stream_bytes  */
+  ac_async_buffer_f on_stream_data;
+  size_t stream_remaining;
+  /*  ac_async_buffer_split_to_mem  */
+  ac_async_buffer_records_f on_records;
+  char *split_delimiter;
+  size_t split_delimiter_length;
 };
 
 #ifdef _AC_DEBUG_MEMORY_
@@ -63,6 +79,8 @@ void ac_async_buffer_destroy(ac_async_buffer_t *p) {
     if (p->delayed_advance == advance_mem_delimiter && p->mem_delimiter) {
       ac_free(p->mem_delimiter);
     }
+    if (p->split_delimiter)
+      ac_free(p->split_delimiter);
     ac_free(p);
   }
 }
@@ -79,19 +97,21 @@ void *ac_async_buffer_get_arg(ac_async_buffer_t *p) {
 
 static int advance_char_delimiter(ac_async_buffer_t *p) {
   p->chunk_start = NULL;
-  if ((p->chunk_end = (char *)memchr(p->data_start, p->char_delimiter,
-                                     p->data_end - p->data_start))) {
+  char *delimiter = (char *)memchr(p->data_start, p->char_delimiter,
+                                   p->data_end - p->data_start);
+  if (delimiter) {
     if (ac_buffer_length(p->buffer)) {
       // partial data previously stored in buffer
-      ac_buffer_append(p->buffer, p->data_start, p->chunk_end - p->data_start);
+      ac_buffer_append(p->buffer, p->data_start, delimiter - p->data_start);
       p->chunk_start = ac_buffer_data(p->buffer);
       p->chunk_end = p->chunk_start + ac_buffer_length(p->buffer);
       p->clear_buffer = 1;
     } else {
       // complete chunk available in this one
       p->chunk_start = p->data_start;
+      p->chunk_end = delimiter;
     }
-    p->data_start += ac_async_buffer_data_length(p) + 1;
+    p->data_start = delimiter + 1;
     if (p->data_start >= p->data_end) {
       p->data_start = p->data_end = NULL;
     }
@@ -102,10 +122,78 @@ static int advance_char_delimiter(ac_async_buffer_t *p) {
   return (p->chunk_start) ? 1 : 0;
 }
 
+/* the first and last bytes of the delimiter are compared at 16 (or 32)
+   positions at once and only the positions where both match are checked with
+   memcmp, so most of the data is scanned at close to memory speed */
+static char *find_mem(char *mem, char *end_mem, const char *d, size_t len) {
+  if (mem >= end_mem)
+    return NULL;
+  if (len == 1)
+    return (char *)memchr(mem, d[0], end_mem - mem);
+  if ((size_t)(end_mem - mem) < len)
+    return NULL;
+  /* the last position the delimiter can start at */
+  char *last = end_mem - len;
+#if defined(__AVX2__)
+  __m256i first_v = _mm256_set1_epi8(d[0]);
+  __m256i last_v = _mm256_set1_epi8(d[len - 1]);
+  for (; mem + 32 <= last + 1; mem += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)mem);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(mem + len - 1));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(a, first_v), _mm256_cmpeq_epi8(b, last_v)));
+    while (mask) {
+      char *c = mem + __builtin_ctz(mask);
+      if (!memcmp(c + 1, d + 1, len - 2))
+        return c;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(__SSE2__)
+  __m128i first_v = _mm_set1_epi8(d[0]);
+  __m128i last_v = _mm_set1_epi8(d[len - 1]);
+  for (; mem + 16 <= last + 1; mem += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)mem);
+    __m128i b = _mm_loadu_si128((const __m128i *)(mem + len - 1));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first_v), _mm_cmpeq_epi8(b, last_v)));
+    while (mask) {
+      char *c = mem + __builtin_ctz(mask);
+      if (!memcmp(c + 1, d + 1, len - 2))
+        return c;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(__ARM_NEON)
+  uint8x16_t first_v = vdupq_n_u8((uint8_t)d[0]);
+  uint8x16_t last_v = vdupq_n_u8((uint8_t)d[len - 1]);
+  for (; mem + 16 <= last + 1; mem += 16) {
+    uint8x16_t a = vld1q_u8((const uint8_t *)mem);
+    uint8x16_t b = vld1q_u8((const uint8_t *)(mem + len - 1));
+    uint8x16_t eq = vandq_u8(vceqq_u8(a, first_v), vceqq_u8(b, last_v));
+    /* four bits per byte */
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    while (mask) {
+      char *c = mem + (__builtin_ctzll(mask) >> 2);
+      if (!memcmp(c + 1, d + 1, len - 2))
+        return c;
+      mask &= ~(0xFULL << (__builtin_ctzll(mask) & ~3));
+    }
+  }
+#endif
+  for (; mem <= last; mem++) {
+    if (mem[0] == d[0] && mem[len - 1] == d[len - 1] &&
+        !memcmp(mem + 1, d + 1, len - 2))
+      return mem;
+  }
+  return NULL;
+}
+
 static char *find_mem_delimiter(ac_async_buffer_t *p, char *mem,
                                 char *end_mem) {
-  return (char *)memmem(mem, end_mem - mem, p->mem_delimiter,
-                        p->mem_delimiter_length);
+  return find_mem(mem, end_mem, (const char *)p->mem_delimiter,
+                  p->mem_delimiter_length);
 }
 
 static int advance_mem_delimiter(ac_async_buffer_t *p) {
@@ -123,8 +211,10 @@ static int advance_mem_delimiter(ac_async_buffer_t *p) {
     ac_buffer_append(p->buffer, p->data_start, append_length);
     char *prev = ac_buffer_data(p->buffer);
     char *end_prev = prev + ac_buffer_length(p->buffer);
-    if (ac_buffer_length(p->buffer) > p->mem_delimiter_length) {
-      prev += ac_buffer_length(p->buffer) - (p->mem_delimiter_length + 1);
+    /* a delimiter which is split starts in the last
+       mem_delimiter_length - 1 bytes of the buffered data */
+    if (prev_length > p->mem_delimiter_length - 1) {
+      prev += prev_length - (p->mem_delimiter_length - 1);
     }
     if ((delimiter_start = find_mem_delimiter(p, prev, end_prev))) {
       /*  full record is in the buffer already  */
@@ -179,19 +269,125 @@ static int advance_bytes_delimiter(ac_async_buffer_t *p) {
     p->chunk_end = p->chunk_start + p->bytes;
     p->data_start += needed;
   } else {
+    if (!buffered && available) {
+      /*  reserve the whole record once instead of growing the buffer
+          with every chunk  */
+      size_t reserve = p->bytes;
+      if (reserve > AC_ASYNC_BUFFER_MAX_RESERVE)
+        reserve = AC_ASYNC_BUFFER_MAX_RESERVE;
+      ac_buffer_resize(p->buffer, reserve);
+      ac_buffer_clear(p->buffer);
+    }
     ac_buffer_append(p->buffer, p->data_start, p->data_end - p->data_start);
     p->data_start = p->data_end = NULL;
   }
   return (p->chunk_start) ? 1 : 0;
 }
 
+static int advance_stream(ac_async_buffer_t *p) {
+  size_t available = p->data_end - p->data_start;
+  if (available) {
+    size_t n = available;
+    if (n > p->stream_remaining)
+      n = p->stream_remaining;
+    p->chunk_start = p->data_start;
+    p->chunk_end = p->data_start + n;
+    p->data_start += n;
+    if (p->data_start >= p->data_end) {
+      p->data_start = p->data_end = NULL;
+    }
+    p->stream_remaining -= n;
+    p->on_stream_data(p);
+  }
+  p->chunk_start = p->chunk_end = NULL;
+  return p->stream_remaining ? 0 : 1;
+}
+
 static void clear_buffer(ac_async_buffer_t *p) {
+  /* a new advance replaces one which was still waiting for data */
+  if (p->delayed_advance == advance_mem_delimiter && p->mem_delimiter) {
+    ac_free(p->mem_delimiter);
+    p->mem_delimiter = NULL;
+  }
   if (p->clear_buffer) {
     p->clear_buffer = 0;
     ac_buffer_clear(p->buffer);
   }
 }
 
+static int advance_split(ac_async_buffer_t *p);
+
+/*  returns 0 if the callback left split mode (by advancing)  */
+static int split_flush(ac_async_buffer_t *p,
+                       ac_async_buffer_record_t *records, size_t n) {
+  p->on_records(p, records, n);
+  if (p->delayed_advance != advance_split)
+    return 0;
+  clear_buffer(p);
+  return 1;
+}
+
+/*  only a record which straddles chunks is copied (into the buffer), the
+    rest point into the chunk  */
+static int advance_split(ac_async_buffer_t *p) {
+  ac_async_buffer_record_t records[AC_ASYNC_BUFFER_RECORDS];
+  size_t n = 0;
+  char *delimiter = p->split_delimiter;
+  size_t len = p->split_delimiter_length;
+  char *d;
+  if (p->data_start >= p->data_end) {
+    p->data_start = p->data_end = NULL;
+    return 0;
+  }
+  size_t prev_length = ac_buffer_length(p->buffer);
+  if (prev_length) {
+    /*  the delimiter may be split between the buffer and the chunk  */
+    size_t append_length = len - 1;
+    if ((size_t)(p->data_end - p->data_start) < append_length)
+      append_length = p->data_end - p->data_start;
+    ac_buffer_append(p->buffer, p->data_start, append_length);
+    char *prev = ac_buffer_data(p->buffer);
+    char *end_prev = prev + ac_buffer_length(p->buffer);
+    if (prev_length > len - 1)
+      prev += prev_length - (len - 1);
+    if ((d = find_mem(prev, end_prev, delimiter, len))) {
+      p->data_start += (d - (ac_buffer_data(p->buffer) + prev_length)) + len;
+      ac_buffer_shrink_by(p->buffer, end_prev - d);
+    } else {
+      ac_buffer_shrink_by(p->buffer, append_length);
+      if (!(d = find_mem(p->data_start, p->data_end, delimiter, len))) {
+        ac_buffer_append(p->buffer, p->data_start,
+                         p->data_end - p->data_start);
+        p->data_start = p->data_end = NULL;
+        return 0;
+      }
+      ac_buffer_append(p->buffer, p->data_start, d - p->data_start);
+      p->data_start = d + len;
+    }
+    records[0].data = ac_buffer_data(p->buffer);
+    records[0].length = ac_buffer_length(p->buffer);
+    p->clear_buffer = 1;
+    n = 1;
+  }
+  while ((d = find_mem(p->data_start, p->data_end, delimiter, len))) {
+    records[n].data = p->data_start;
+    records[n].length = d - p->data_start;
+    n++;
+    p->data_start = d + len;
+    if (n == AC_ASYNC_BUFFER_RECORDS) {
+      if (!split_flush(p, records, n))
+        return 0;
+      n = 0;
+    }
+  }
+  if (n && !split_flush(p, records, n))
+    return 0;
+  if (p->data_start < p->data_end)
+    ac_buffer_append(p->buffer, p->data_start, p->data_end - p->data_start);
+  p->data_start = p->data_end = NULL;
+  return 0;
+}
+
 void ac_async_buffer_clear(ac_async_buffer_t *p) {
   if (p) {
     ac_buffer_clear(p->buffer);
@@ -265,6 +461,50 @@ int ac_async_buffer_advance_bytes(ac_async_buffer_t *p, size_t len,
   return res;
 }
 
+int ac_async_buffer_stream_bytes(ac_async_buffer_t *p, size_t len,
+                                 ac_async_buffer_f chunk_cb,
+                                 ac_async_buffer_f cb) {
+  int res = 0;
+  if (p && chunk_cb && cb) {
+    clear_buffer(p);
+    p->on_stream_data = chunk_cb;
+    p->stream_remaining = len;
+    res = advance_stream(p);
+    if (!res) {
+      p->on_data_ready = cb;
+      p->delayed_advance = advance_stream;
+    }
+  }
+  return res;
+}
+
+void ac_async_buffer_split_to_mem(ac_async_buffer_t *p, void *delimiter,
+                                  size_t len, ac_async_buffer_records_f cb) {
+  if (p && delimiter && len && cb) {
+    clear_buffer(p);
+    if (p->split_delimiter)
+      ac_free(p->split_delimiter);
+    p->split_delimiter = (char *)ac_malloc(len);
+    memcpy(p->split_delimiter, delimiter, len);
+    p->split_delimiter_length = len;
+    p->on_records = cb;
+    p->delayed_advance = advance_split;
+    advance_split(p);
+  }
+}
+
+void ac_async_buffer_split_to_char(ac_async_buffer_t *p, char delimiter,
+                                   ac_async_buffer_records_f cb) {
+  ac_async_buffer_split_to_mem(p, &delimiter, 1, cb);
+}
+
+void ac_async_buffer_split_to_string(ac_async_buffer_t *p,
+                                     char const *delimiter,
+                                     ac_async_buffer_records_f cb) {
+  if (delimiter && delimiter[0])
+    ac_async_buffer_split_to_mem(p, (void *)delimiter, strlen(delimiter), cb);
+}
+
 char *ac_async_buffer_data(ac_async_buffer_t *p) {
   return (p) ? p->chunk_start : NULL;
 }
@@ -273,6 +513,23 @@ size_t ac_async_buffer_data_length(ac_async_buffer_t *p) {
   return (p) ? (p->chunk_end - p->chunk_start) : 0;
 }
 
+char *ac_async_buffer_unread(ac_async_buffer_t *p, size_t *length) {
+  if (!p || p->data_start >= p->data_end) {
+    *length = 0;
+    return NULL;
+  }
+  *length = p->data_end - p->data_start;
+  return p->data_start;
+}
+
+void ac_async_buffer_skip(ac_async_buffer_t *p, size_t bytes) {
+  if (p && p->data_start) {
+    p->data_start += bytes;
+    if (p->data_start >= p->data_end)
+      p->data_start = p->data_end = NULL;
+  }
+}
+
 void ac_async_buffer_parse(ac_async_buffer_t *p, void const *data, size_t len) {
   if (p && data && len) {
     if (!p->delayed_advance) {
@@ -19,15 +19,35 @@ limitations under the License.
 
 #include <stddef.h>
 
+/*  the most that ac_async_buffer_advance_bytes reserves up front for a
+    record which spans chunks  */
+#ifndef AC_ASYNC_BUFFER_MAX_RESERVE
+#define AC_ASYNC_BUFFER_MAX_RESERVE (256 * 1024 * 1024)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*  the most records passed to one ac_async_buffer_records_f call  */
+#ifndef AC_ASYNC_BUFFER_RECORDS
+#define AC_ASYNC_BUFFER_RECORDS 256
+#endif
+
 struct ac_async_buffer_s;
 typedef struct ac_async_buffer_s ac_async_buffer_t;
 
 typedef void (*ac_async_buffer_f)(ac_async_buffer_t *);
 
+typedef struct {
+  char *data;
+  size_t length;
+} ac_async_buffer_record_t;
+
+typedef void (*ac_async_buffer_records_f)(ac_async_buffer_t *,
+                                          ac_async_buffer_record_t *records,
+                                          size_t num_records);
+
 /*  Init/clear/destroy functionality  */
 #ifdef _AC_DEBUG_MEMORY_
 #define ac_async_buffer_init()                                                 \
@@ -54,12 +74,43 @@ int ac_async_buffer_advance_to_mem(ac_async_buffer_t *, void *delimiter,
 int ac_async_buffer_advance_bytes(ac_async_buffer_t *, size_t bytes,
                                   ac_async_buffer_f);
 
+/*  Pass the next bytes to chunk_cb as they arrive without buffering them
+    (ac_async_buffer_data is each piece).  Returns 1 if all of the bytes were
+    available, otherwise cb is called once the last piece has been passed to
+    chunk_cb.  chunk_cb must not advance the buffer.  */
+int ac_async_buffer_stream_bytes(ac_async_buffer_t *, size_t bytes,
+                                 ac_async_buffer_f chunk_cb,
+                                 ac_async_buffer_f cb);
+
+/*  Split the input into delimited records until the records callback calls
+    one of the advance functions (which continues after the last record it
+    was given).  Every complete record in a chunk is passed to the callback
+    at once (up to AC_ASYNC_BUFFER_RECORDS at a time) pointing into the
+    chunk, only a record which straddles chunks is copied.  The records are
+    only valid during the callback.  */
+void ac_async_buffer_split_to_char(ac_async_buffer_t *, char delimiter,
+                                   ac_async_buffer_records_f);
+void ac_async_buffer_split_to_string(ac_async_buffer_t *,
+                                     char const *delimiter,
+                                     ac_async_buffer_records_f);
+void ac_async_buffer_split_to_mem(ac_async_buffer_t *, void *delimiter,
+                                  size_t delimiter_length,
+                                  ac_async_buffer_records_f);
+
 /*  Get the data for the current advance action  */
 char *ac_async_buffer_data(ac_async_buffer_t *);
 /*  Get the length of the current advance action.
     This may be 0 if the delimiter was at the 0th position.  */
 size_t ac_async_buffer_data_length(ac_async_buffer_t *);
 
+/*  The input which no advance has consumed yet, for a parser which can
+    consume small records from it directly (such as complete HTTP chunks)
+    instead of advancing to each.  It is only valid between advances (in
+    their callback or after one returns 1) and is NULL if it is empty.
+    ac_async_buffer_skip consumes bytes of it.  */
+char *ac_async_buffer_unread(ac_async_buffer_t *, size_t *length);
+void ac_async_buffer_skip(ac_async_buffer_t *, size_t bytes);
+
 void ac_async_buffer_parse(ac_async_buffer_t *, void const *data,
                            size_t data_length);
 
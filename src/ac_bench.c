@@ -0,0 +1,316 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_bench.h"
+#include "ac_allocator.h"
+#include "ac_perf.h"
+#include "ac_sort.h"
+#include "ac_timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ac_bench_s {
+  ac_bench_options_t options;
+  ac_bench_result_t *results;
+  size_t num_results;
+  size_t max_results;
+  /* the time of each sample (in ns per iteration) */
+  double *samples;
+  /* NULL unless the counters option is set */
+  ac_perf_t *perf;
+};
+
+static inline int compare_double(const double *a, const double *b) {
+  return (*a < *b) ? -1 : (*a > *b) ? 1 : 0;
+}
+
+static ac_sort_m(sort_doubles, double, compare_double);
+
+void ac_bench_default_options(ac_bench_options_t *options) {
+  options->warmup_ns = 100000000;
+  options->sample_ns = 10000000;
+  options->num_samples = 30;
+  options->outlier_k = 1.5;
+  options->counters = false;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_bench_t *_ac_bench_init(const ac_bench_options_t *options,
+                           const char *caller) {
+  ac_bench_t *h =
+      (ac_bench_t *)_ac_malloc_d(NULL, caller, sizeof(ac_bench_t), false);
+#else
+ac_bench_t *_ac_bench_init(const ac_bench_options_t *options) {
+  ac_bench_t *h = (ac_bench_t *)ac_malloc(sizeof(ac_bench_t));
+#endif
+  if (options)
+    h->options = *options;
+  else
+    ac_bench_default_options(&h->options);
+  if (h->options.num_samples < 1)
+    h->options.num_samples = 1;
+  h->results = NULL;
+  h->num_results = h->max_results = 0;
+  h->samples =
+      (double *)ac_malloc(sizeof(double) * h->options.num_samples);
+  h->perf = h->options.counters ? ac_perf_init() : NULL;
+  return h;
+}
+
+void ac_bench_destroy(ac_bench_t *h) {
+  for (size_t i = 0; i < h->num_results; i++)
+    ac_free((char *)h->results[i].name);
+  if (h->results)
+    ac_free(h->results);
+  ac_free(h->samples);
+  if (h->perf)
+    ac_perf_destroy(h->perf);
+  ac_free(h);
+}
+
+/* the time in ns of running fn iterations times */
+static double time_fn(ac_timer_t *t, ac_bench_f fn, void *arg,
+                      uint64_t iterations) {
+  double before = ac_timer_ns(t);
+  ac_timer_start(t);
+  fn(arg, iterations);
+  ac_timer_stop(t);
+  return ac_timer_ns(t) - before;
+}
+
+/* the iterations which take about sample_ns.  The iterations double until a
+   run takes at least a tenth of the target and the runs continue until the
+   warm up is over.  The fastest run is scaled up to the target, so a single
+   run which is interrupted doesn't shrink the samples. */
+static uint64_t choose_iterations(ac_bench_t *h, ac_timer_t *t,
+                                  ac_bench_f fn, void *arg) {
+  double target = (double)h->options.sample_ns;
+  uint64_t iterations = 1;
+  double spent = 0.0;
+  double best = 0.0; /* the fastest ns per iteration */
+  while (true) {
+    double elapsed = time_fn(t, fn, arg, iterations);
+    spent += elapsed;
+    if (elapsed * 10.0 >= target || iterations >= (1ULL << 40)) {
+      best = elapsed / iterations;
+      break;
+    }
+    iterations <<= 1;
+  }
+  while (spent < h->options.warmup_ns) {
+    double elapsed = time_fn(t, fn, arg, iterations);
+    spent += elapsed;
+    if (elapsed / iterations < best)
+      best = elapsed / iterations;
+  }
+  if (best <= 0.0)
+    return iterations;
+  double scaled = target / best;
+  return scaled < 1.0 ? 1 : (uint64_t)scaled;
+}
+
+static double sqrt_double(double v) {
+  if (v <= 0.0)
+    return 0.0;
+  double r = v > 1.0 ? v : 1.0;
+  for (int i = 0; i < 64; i++) {
+    double n = 0.5 * (r + v / r);
+    if (n >= r)
+      break;
+    r = n;
+  }
+  return r;
+}
+
+/* the p percentile of the sorted samples (interpolating between them) */
+static double percentile(const double *samples, size_t num_samples,
+                         double p) {
+  if (num_samples == 1)
+    return samples[0];
+  double pos = p * (num_samples - 1);
+  size_t i = (size_t)pos;
+  if (i + 1 >= num_samples)
+    return samples[num_samples - 1];
+  double frac = pos - i;
+  return samples[i] + (samples[i + 1] - samples[i]) * frac;
+}
+
+static void compute_stats(ac_bench_t *h, ac_bench_result_t *r,
+                          double *samples, size_t num_samples) {
+  sort_doubles(samples, num_samples);
+  size_t lo = 0, hi = num_samples;
+  if (h->options.outlier_k > 0.0 && num_samples >= 4) {
+    double q1 = percentile(samples, num_samples, 0.25);
+    double q3 = percentile(samples, num_samples, 0.75);
+    double fence = h->options.outlier_k * (q3 - q1);
+    while (lo < hi && samples[lo] < q1 - fence)
+      lo++;
+    while (hi > lo && samples[hi - 1] > q3 + fence)
+      hi--;
+  }
+  r->num_outliers = (uint32_t)(num_samples - (hi - lo));
+  samples += lo;
+  num_samples = hi - lo;
+  r->num_samples = (uint32_t)num_samples;
+
+  double sum = 0.0;
+  for (size_t i = 0; i < num_samples; i++)
+    sum += samples[i];
+  r->mean = sum / num_samples;
+  double var = 0.0;
+  for (size_t i = 0; i < num_samples; i++)
+    var += (samples[i] - r->mean) * (samples[i] - r->mean);
+  r->stddev = num_samples > 1 ? sqrt_double(var / (num_samples - 1)) : 0.0;
+  r->min = samples[0];
+  r->max = samples[num_samples - 1];
+  r->median = percentile(samples, num_samples, 0.5);
+  r->p90 = percentile(samples, num_samples, 0.9);
+  r->p99 = percentile(samples, num_samples, 0.99);
+}
+
+const ac_bench_result_t *ac_bench_run(ac_bench_t *h, const char *name,
+                                      ac_bench_f fn, void *arg) {
+  if (h->num_results == h->max_results) {
+    size_t max_results = h->max_results ? h->max_results * 2 : 16;
+    h->results = (ac_bench_result_t *)ac_realloc(
+        h->results, sizeof(ac_bench_result_t) * max_results);
+    h->max_results = max_results;
+  }
+  ac_bench_result_t *r = h->results + h->num_results++;
+  memset(r, 0, sizeof(*r));
+  r->name = ac_strdup(name);
+
+  ac_timer_t *t = ac_timer_init(1);
+  uint64_t iterations = choose_iterations(h, t, fn, arg);
+  r->iterations = iterations;
+  uint32_t num_samples = h->options.num_samples;
+  ac_perf_t *perf = h->perf && ac_perf_available(h->perf) ? h->perf : NULL;
+  if (perf)
+    ac_perf_reset(perf);
+  for (uint32_t i = 0; i < num_samples; i++) {
+    /* the counters are read outside of the timer */
+    if (perf)
+      ac_perf_start(perf);
+    h->samples[i] = time_fn(t, fn, arg, iterations) / iterations;
+    if (perf)
+      ac_perf_stop(perf);
+  }
+  ac_timer_destroy(t);
+
+  ac_perf_counts_t counts;
+  if (perf && ac_perf_counts(perf, &counts)) {
+    double total = (double)iterations * num_samples;
+    r->counters = true;
+    r->cycles = counts.cycles / total;
+    r->instructions = counts.instructions / total;
+    r->cache_misses = counts.cache_misses / total;
+    r->branch_misses = counts.branch_misses / total;
+    r->ipc = counts.ipc;
+  }
+
+  compute_stats(h, r, h->samples, num_samples);
+  return r;
+}
+
+const ac_bench_result_t *ac_bench_results(ac_bench_t *h, size_t *num_results) {
+  *num_results = h->num_results;
+  return h->results;
+}
+
+static void print_counters(FILE *out, ac_bench_result_t *r,
+                           ac_bench_format_t format) {
+  if (format == ac_bench_text) {
+    if (r->counters)
+      fprintf(out, " %10.1f %10.1f %6.2f %10.3f %10.3f", r->cycles,
+              r->instructions, r->ipc, r->cache_misses, r->branch_misses);
+    else
+      fprintf(out, " %10s %10s %6s %10s %10s", "-", "-", "-", "-", "-");
+  } else if (format == ac_bench_csv) {
+    if (r->counters)
+      fprintf(out, ",%0.3f,%0.3f,%0.3f,%0.3f,%0.3f", r->cycles,
+              r->instructions, r->ipc, r->cache_misses, r->branch_misses);
+    else
+      fprintf(out, ",,,,,");
+  } else if (r->counters)
+    fprintf(out,
+            ", \"cycles\": %0.3f, \"instructions\": %0.3f, \"ipc\": %0.3f, "
+            "\"cache_misses\": %0.3f, \"branch_misses\": %0.3f",
+            r->cycles, r->instructions, r->ipc, r->cache_misses,
+            r->branch_misses);
+}
+
+/* names are printed as they are, so they shouldn't need escaping.  The
+   counters are printed per iteration when the counters option is set. */
+void ac_bench_print(ac_bench_t *h, FILE *out, ac_bench_format_t format) {
+  bool counters = h->options.counters;
+  if (format == ac_bench_csv)
+    fprintf(out, "name,iterations,samples,outliers,min_ns,median_ns,mean_ns,"
+                 "stddev_ns,p90_ns,p99_ns,max_ns%s\n",
+            counters ? ",cycles,instructions,ipc,cache_misses,branch_misses"
+                     : "");
+  else if (format == ac_bench_json)
+    fprintf(out, "[");
+  else {
+    int width = 4;
+    for (size_t i = 0; i < h->num_results; i++) {
+      int len = (int)strlen(h->results[i].name);
+      if (len > width)
+        width = len;
+    }
+    fprintf(out, "%-*s %12s %12s %12s %10s %12s %8s", width, "name",
+            "median_ns", "min_ns", "mean_ns", "stddev", "p99_ns",
+            "outliers");
+    if (counters)
+      fprintf(out, " %10s %10s %6s %10s %10s", "cycles", "insns", "ipc",
+              "cache_miss", "br_miss");
+    fprintf(out, "\n");
+    for (size_t i = 0; i < h->num_results; i++) {
+      ac_bench_result_t *r = h->results + i;
+      fprintf(out, "%-*s %12.3f %12.3f %12.3f %10.3f %12.3f %4u/%-3u", width,
+              r->name, r->median, r->min, r->mean, r->stddev, r->p99,
+              r->num_outliers, r->num_outliers + r->num_samples);
+      if (counters)
+        print_counters(out, r, format);
+      fprintf(out, "\n");
+    }
+    return;
+  }
+  for (size_t i = 0; i < h->num_results; i++) {
+    ac_bench_result_t *r = h->results + i;
+    if (format == ac_bench_csv)
+      fprintf(out, "%s,%llu,%u,%u,%0.3f,%0.3f,%0.3f,%0.3f,%0.3f,%0.3f,%0.3f",
+              r->name, (unsigned long long)r->iterations, r->num_samples,
+              r->num_outliers, r->min, r->median, r->mean, r->stddev, r->p90,
+              r->p99, r->max);
+    else
+      fprintf(out,
+              "%s\n  {\"name\": \"%s\", \"iterations\": %llu, "
+              "\"samples\": %u, \"outliers\": %u, \"min_ns\": %0.3f, "
+              "\"median_ns\": %0.3f, \"mean_ns\": %0.3f, "
+              "\"stddev_ns\": %0.3f, \"p90_ns\": %0.3f, \"p99_ns\": %0.3f, "
+              "\"max_ns\": %0.3f",
+              i ? "," : "", r->name, (unsigned long long)r->iterations,
+              r->num_samples, r->num_outliers, r->min, r->median, r->mean,
+              r->stddev, r->p90, r->p99, r->max);
+    if (counters)
+      print_counters(out, r, format);
+    fprintf(out, format == ac_bench_csv ? "\n" : "}");
+  }
+  if (format == ac_bench_json)
+    fprintf(out, "\n]\n");
+}
@@ -0,0 +1,134 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_bench_H
+#define _ac_bench_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_bench runs a function enough times to get a trustworthy time for it.
+  The function is warmed up, the number of iterations which fill
+  sample_ns is found, and then num_samples samples are timed with
+  ac_timer.  Samples outside of Tukey's fences (outlier_k times the
+  interquartile range beyond the first and third quartiles) are rejected
+  before the statistics are computed.  Every time reported is in
+  nanoseconds per iteration.
+
+  The results of every run are kept by the ac_bench_t so that they can be
+  printed together as a table, csv, or json.
+
+  With the counters option, the samples are also measured with ac_perf and
+  the cycles, instructions, cache misses, and branch misses per iteration
+  are reported (averaged over every sample) when the cpu's counters are
+  available.
+*/
+struct ac_bench_s;
+typedef struct ac_bench_s ac_bench_t;
+
+typedef struct {
+  /* time spent running the function before it is measured */
+  uint64_t warmup_ns;
+  /* the target duration of each sample */
+  uint64_t sample_ns;
+  uint32_t num_samples;
+  /* 0 disables outlier rejection */
+  double outlier_k;
+  /* count cycles, instructions, and misses with ac_perf */
+  bool counters;
+} ac_bench_options_t;
+
+typedef struct {
+  const char *name;
+  /* the iterations per sample */
+  uint64_t iterations;
+  /* the samples which were kept and the number rejected as outliers */
+  uint32_t num_samples;
+  uint32_t num_outliers;
+  double min;
+  double max;
+  double mean;
+  double median;
+  double stddev;
+  double p90;
+  double p99;
+  /* true if the counters below were measured (per iteration) */
+  bool counters;
+  double cycles;
+  double instructions;
+  double cache_misses;
+  double branch_misses;
+  double ipc;
+} ac_bench_result_t;
+
+typedef enum {
+  ac_bench_text,
+  ac_bench_csv,
+  ac_bench_json
+} ac_bench_format_t;
+
+/* fn should do the work being measured iterations times */
+typedef void (*ac_bench_f)(void *arg, uint64_t iterations);
+
+/* 100ms of warm up and 30 samples of 10ms with outlier_k of 1.5 (and no
+   counters) */
+void ac_bench_default_options(ac_bench_options_t *options);
+
+/* options may be NULL for the defaults */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_bench_init(options)                                                 \
+  _ac_bench_init(options, AC_FILE_LINE_MACRO("ac_bench"))
+ac_bench_t *_ac_bench_init(const ac_bench_options_t *options,
+                           const char *caller);
+#else
+#define ac_bench_init(options) _ac_bench_init(options)
+ac_bench_t *_ac_bench_init(const ac_bench_options_t *options);
+#endif
+
+void ac_bench_destroy(ac_bench_t *h);
+
+/* measure fn and keep the result under name (which is copied).  The result
+   is valid until the next run or until h is destroyed. */
+const ac_bench_result_t *ac_bench_run(ac_bench_t *h, const char *name,
+                                      ac_bench_f fn, void *arg);
+
+/* the results of all of the runs so far */
+const ac_bench_result_t *ac_bench_results(ac_bench_t *h, size_t *num_results);
+
+/* print all of the results (text is aligned for reading) */
+void ac_bench_print(ac_bench_t *h, FILE *out, ac_bench_format_t format);
+
+/* keep the compiler from optimizing away the computation of value */
+#define ac_bench_do_not_optimize(value)                                        \
+  __asm__ __volatile__("" : : "g"(value) : "memory")
+
+/* make the compiler assume that all memory was read and written (so stores
+   which are never read are kept) */
+#define ac_bench_clobber() __asm__ __volatile__("" : : : "memory")
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_bloom.h"
+#include "ac_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE 32
+
+/* the saved form is the magic, the number of blocks, and 16 reserved bytes
+   followed by the blocks */
+static const char bloom_magic[8] = {'A', 'C', 'B', 'L', 'O', 'O', 'M', '1'};
+#define HEADER_SIZE 32
+
+#ifdef _AC_DEBUG_MEMORY_
+static ac_bloom_t *alloc_bloom(uint64_t num_blocks, bool map,
+                               const char *caller) {
+  size_t len = sizeof(ac_bloom_t) + (map ? 0 : num_blocks * BLOCK_SIZE + 32);
+  ac_bloom_t *h = (ac_bloom_t *)_ac_malloc_d(NULL, caller, len, false);
+#else
+static ac_bloom_t *alloc_bloom(uint64_t num_blocks, bool map) {
+  size_t len = sizeof(ac_bloom_t) + (map ? 0 : num_blocks * BLOCK_SIZE + 32);
+  ac_bloom_t *h = (ac_bloom_t *)ac_malloc(len);
+#endif
+  if (!h)
+    abort();
+  h->num_blocks = num_blocks;
+  h->blocks = NULL;
+  if (!map) {
+    /* align the blocks so that none of them crosses a cache line */
+    uintptr_t p = (uintptr_t)(h + 1);
+    h->blocks = (uint32_t *)((p + 31) & ~(uintptr_t)31);
+  }
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_bloom_t *_ac_bloom_init(size_t expected, size_t bits_per_key,
+                           const char *caller) {
+#else
+ac_bloom_t *_ac_bloom_init(size_t expected, size_t bits_per_key) {
+#endif
+  uint64_t bits = (uint64_t)expected * bits_per_key;
+  uint64_t num_blocks = (bits + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8);
+  if (!num_blocks)
+    num_blocks = 1;
+  /* the block is selected with 32 bits of the hash */
+  if (num_blocks > 0xFFFFFFFFULL)
+    num_blocks = 0xFFFFFFFFULL;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_bloom_t *h = alloc_bloom(num_blocks, false, caller);
+#else
+  ac_bloom_t *h = alloc_bloom(num_blocks, false);
+#endif
+  ac_bloom_clear(h);
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_bloom_t *_ac_bloom_load(const void *data, size_t length, bool map,
+                           const char *caller) {
+#else
+ac_bloom_t *_ac_bloom_load(const void *data, size_t length, bool map) {
+#endif
+  const char *p = (const char *)data;
+  if (length < HEADER_SIZE || memcmp(p, bloom_magic, sizeof(bloom_magic)))
+    return NULL;
+  uint64_t num_blocks;
+  memcpy(&num_blocks, p + sizeof(bloom_magic), sizeof(num_blocks));
+  if (!num_blocks || num_blocks > 0xFFFFFFFFULL ||
+      num_blocks > (length - HEADER_SIZE) / BLOCK_SIZE)
+    return NULL;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_bloom_t *h = alloc_bloom(num_blocks, map, caller);
+#else
+  ac_bloom_t *h = alloc_bloom(num_blocks, map);
+#endif
+  if (map)
+    h->blocks = (uint32_t *)(p + HEADER_SIZE);
+  else
+    memcpy(h->blocks, p + HEADER_SIZE, num_blocks * BLOCK_SIZE);
+  return h;
+}
+
+void ac_bloom_destroy(ac_bloom_t *h) { ac_free(h); }
+
+bool ac_bloom_merge(ac_bloom_t *h, ac_bloom_t *src) {
+  if (h->num_blocks != src->num_blocks)
+    return false;
+  size_t n = h->num_blocks * 8;
+  for (size_t i = 0; i < n; i++)
+    h->blocks[i] |= src->blocks[i];
+  return true;
+}
+
+void ac_bloom_clear(ac_bloom_t *h) {
+  memset(h->blocks, 0, h->num_blocks * BLOCK_SIZE);
+}
+
+size_t ac_bloom_size(ac_bloom_t *h) { return h->num_blocks * BLOCK_SIZE; }
+
+void ac_bloom_save(ac_bloom_t *h, ac_buffer_t *bh) {
+  char header[HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, bloom_magic, sizeof(bloom_magic));
+  memcpy(header + sizeof(bloom_magic), &h->num_blocks, sizeof(uint64_t));
+  ac_buffer_append(bh, header, sizeof(header));
+  ac_buffer_append(bh, h->blocks, h->num_blocks * BLOCK_SIZE);
+}
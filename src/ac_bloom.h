@@ -0,0 +1,113 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_bloom_H
+#define _ac_bloom_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_bloom_t is a blocked bloom filter (the split block design used by
+  Parquet).  A key only sets and tests bits in one 32 byte block (eight 32
+  bit words, one bit in each), so a lookup touches a single cache line and
+  the eight words are checked in a few instructions (with AVX2 if it is
+  available).  A miss means the key was definitely not added, a hit means
+  it probably was.
+
+  The filter works on a 64 bit hash of the key, which should mix all of its
+  bits well (the high 32 bits select the block and the low 32 bits the bits
+  within it).  The false positive rate for a given number of bits per key is
+  about
+
+    bits_per_key   8      10     12     16     24
+    rate           3.3%   1.3%   0.55%  0.13%  0.02%
+
+  A filter can be saved to an ac_buffer and either loaded (copied) or mapped
+  in place with ac_bloom_map, for example from an mmapped file or from the
+  buffer of a global_arg snapshot.  The saved form is a 32 byte header
+  followed by the blocks (in the byte order of the machine), so the blocks
+  are aligned if the data is.
+
+  ac_bloom_maybe_contains can be called by any number of threads while no
+  thread adds.  ac_bloom_add_atomic can be called by many threads at once
+  (and while others call ac_bloom_maybe_contains).
+*/
+struct ac_bloom_s;
+typedef struct ac_bloom_s ac_bloom_t;
+
+/* a filter sized for expected keys at bits_per_key bits each */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_bloom_init(expected, bits_per_key)                                  \
+  _ac_bloom_init(expected, bits_per_key, AC_FILE_LINE_MACRO("ac_bloom"))
+ac_bloom_t *_ac_bloom_init(size_t expected, size_t bits_per_key,
+                           const char *caller);
+#else
+#define ac_bloom_init(expected, bits_per_key)                                  \
+  _ac_bloom_init(expected, bits_per_key)
+ac_bloom_t *_ac_bloom_init(size_t expected, size_t bits_per_key);
+#endif
+
+/* copy a filter saved with ac_bloom_save, returns NULL if the data isn't a
+   valid filter */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_bloom_load(data, length)                                            \
+  _ac_bloom_load(data, length, false, AC_FILE_LINE_MACRO("ac_bloom"))
+#define ac_bloom_map(data, length)                                             \
+  _ac_bloom_load(data, length, true, AC_FILE_LINE_MACRO("ac_bloom"))
+ac_bloom_t *_ac_bloom_load(const void *data, size_t length, bool map,
+                           const char *caller);
+#else
+#define ac_bloom_load(data, length) _ac_bloom_load(data, length, false)
+#define ac_bloom_map(data, length) _ac_bloom_load(data, length, true)
+ac_bloom_t *_ac_bloom_load(const void *data, size_t length, bool map);
+#endif
+/* ac_bloom_map uses the blocks in data (which must outlive the filter)
+   without copying them.  A mapped filter is read only. */
+
+void ac_bloom_destroy(ac_bloom_t *h);
+
+static inline void ac_bloom_add(ac_bloom_t *h, uint64_t hash);
+static inline void ac_bloom_add_atomic(ac_bloom_t *h, uint64_t hash);
+
+/* false if hash was definitely not added */
+static inline bool ac_bloom_maybe_contains(ac_bloom_t *h, uint64_t hash);
+
+/* add every key of src to h, both must have the same number of blocks.
+   Returns false if they don't. */
+bool ac_bloom_merge(ac_bloom_t *h, ac_bloom_t *src);
+
+void ac_bloom_clear(ac_bloom_t *h);
+
+/* the size of the blocks in bytes */
+size_t ac_bloom_size(ac_bloom_t *h);
+
+/* append the filter to bh */
+void ac_bloom_save(ac_bloom_t *h, ac_buffer_t *bh);
+
+#include "impl/ac_bloom.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_btree_H
+#define _ac_btree_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_btree is a B+tree which is meant as a cache-friendly alternative to
+  ac_map for large collections.  The red-black tree in ac_map needs one
+  pointer chase (and likely a cache miss) per level and has about log2(n)
+  levels.  The B+tree packs the keys of a node into one array (about
+  AC_BTREE_NODE_BYTES bytes) which is binary searched, so there are far fewer
+  levels and the keys of a level are close together.  The values are kept in
+  the leaves and the leaves are linked for in-order iteration.
+
+  Unlike ac_map, the nodes are not intrusive.  The keys and values are copied
+  into the tree (use a pointer as the valuetype to refer to larger objects).
+  Keys are unique.  The nodes are allocated with ac_malloc.
+
+  Like the other containers, the functions are generated with macros.  Place
+  ac_btree_def where the declarations are needed (it defines the types) and
+  ac_btree_m in one source file.
+
+  ac_btree_def(name, keytype, valuetype)
+  ac_btree_m(name, keytype, valuetype, compare)
+    expects: int compare(const keytype *a, const keytype *b);
+
+    defines: name_t (the tree) and name_iter_t (an iterator)
+
+    void name_init(name_t *t);
+    void name_destroy(name_t *t);
+    size_t name_size(name_t *t);
+
+    inserts a copy of key and value, returns false if key already exists
+    bool name_insert(name_t *t, const keytype *key, const valuetype *value);
+
+    returns a pointer to the value for key or NULL
+    valuetype *name_find(name_t *t, const keytype *key);
+
+    removes key, returns false if key didn't exist
+    bool name_erase(name_t *t, const keytype *key);
+
+    The following position the iterator and return false if there is no such
+    item.  name_lower_bound finds the first key which is not less than key and
+    name_upper_bound finds the first key which is greater than key.
+    bool name_first(name_t *t, name_iter_t *it);
+    bool name_last(name_t *t, name_iter_t *it);
+    bool name_lower_bound(name_t *t, const keytype *key, name_iter_t *it);
+    bool name_upper_bound(name_t *t, const keytype *key, name_iter_t *it);
+    bool name_next(name_iter_t *it);
+    bool name_previous(name_iter_t *it);
+
+    access the current item of the iterator
+    keytype *name_iter_key(name_iter_t *it);
+    valuetype *name_iter_value(name_iter_t *it);
+
+  Iterators are invalidated by name_insert and name_erase.  The keys must not
+  be modified through name_iter_key.
+*/
+
+#include "impl/ac_btree.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,11 +14,20 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memmem */
+#endif
+
 #include "ac_buffer.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifdef _AC_DEBUG_MEMORY_
 static void dump_buffer(FILE *out, const char *caller, void *p, size_t length) {
   ac_buffer_t *bh = (ac_buffer_t *)p;
@@ -27,33 +36,138 @@ static void dump_buffer(FILE *out, const char *caller, void *p, size_t length) {
 }
 
 ac_buffer_t *_ac_buffer_init(size_t initial_size, const char *caller) {
+  /* small buffers keep their data after the structure */
+  bool has_inline = initial_size <= AC_BUFFER_INLINE_SIZE;
   ac_buffer_t *h = (ac_buffer_t *)_ac_malloc_d(
-      NULL, caller, sizeof(ac_buffer_t), true);
+      NULL, caller,
+      sizeof(ac_buffer_t) + (has_inline ? AC_BUFFER_INLINE_SIZE + 1 : 0),
+      true);
   h->dump.dump = dump_buffer;
   h->initial_size = initial_size;
   h->max_length = 0;
 #else
 ac_buffer_t *_ac_buffer_init(size_t initial_size) {
-  ac_buffer_t *h = (ac_buffer_t *)ac_malloc(sizeof(ac_buffer_t));
+  /* small buffers keep their data after the structure */
+  bool has_inline = initial_size <= AC_BUFFER_INLINE_SIZE;
+  ac_buffer_t *h = (ac_buffer_t *)ac_malloc(
+      sizeof(ac_buffer_t) + (has_inline ? AC_BUFFER_INLINE_SIZE + 1 : 0));
 #endif
-  h->data = initial_size ? (char *)ac_malloc(initial_size + 1)
-                         : (char *)(&(h->size));
+  if (has_inline) {
+    h->data = (char *)(h + 1);
+    initial_size = AC_BUFFER_INLINE_SIZE;
+  } else
+    h->data = (char *)ac_malloc(initial_size + 1);
   h->data[0] = 0;
   h->length = 0;
   h->size = initial_size;
   h->pool = NULL;
+  h->release = NULL;
+  h->release_arg = NULL;
+  h->attached = false;
+  h->has_inline = has_inline;
+  h->embedded = false;
   return h;
 }
 
 void ac_buffer_destroy(ac_buffer_t *h) {
+  if (h->attached)
+    _ac_buffer_detach_release(h);
   if (!h->pool) {
+    if (_ac_buffer_owns_data(h))
+      ac_free(h->data);
+    if (!h->embedded)
+      ac_free(h);
+  }
+}
+
+static inline void reset_empty(ac_buffer_t *h) {
+  h->length = 0;
+  if (h->has_inline) {
+    h->size = AC_BUFFER_INLINE_SIZE;
+    h->data = (char *)(h + 1);
+    h->data[0] = 0;
+    return;
+  }
+  /* a size of 0 means that data doesn't point to allocated memory */
+  h->size = 0;
+  h->data = (char *)(&(h->size));
+}
+
+void ac_buffer_attach(ac_buffer_t *h, const void *data, size_t length,
+                      ac_buffer_release_cb release, void *arg) {
+  if (h->attached)
+    _ac_buffer_detach_release(h);
+  else if (_ac_buffer_owns_data(h))
     ac_free(h->data);
-    ac_free(h);
+  /* size stays 0 so that every path which would write to data first copies
+     it (or releases it), the paths which might write nothing also check
+     attached */
+  h->size = 0;
+  h->data = (char *)data;
+  h->length = length;
+  h->release = release;
+  h->release_arg = arg;
+  h->attached = true;
+#ifdef _AC_DEBUG_MEMORY_
+  if (length > h->max_length)
+    h->max_length = length;
+#endif
+}
+
+void _ac_buffer_detach_release(ac_buffer_t *h) {
+  ac_buffer_release_cb release = h->release;
+  void *data = h->data;
+  size_t length = h->length;
+  h->attached = false;
+  h->release = NULL;
+  reset_empty(h);
+  if (release)
+    release(h->release_arg, data, length);
+}
+
+void _ac_buffer_detach_copy(ac_buffer_t *h, size_t length) {
+  /* the new memory must hold length bytes and the attached bytes which are
+     kept (the attached data may not have a zero terminator to copy) */
+  size_t keep = h->length < length ? h->length : length;
+  size_t len = (length + 50);
+  char *data;
+  if (h->has_inline && length <= AC_BUFFER_INLINE_SIZE) {
+    /* the inline space isn't used while data is attached */
+    data = (char *)(h + 1);
+    len = AC_BUFFER_INLINE_SIZE;
+  } else
+    data = h->pool ? (char *)ac_pool_alloc(h->pool, len + 1)
+                   : (char *)ac_malloc(len + 1);
+  memcpy(data, h->data, keep);
+  data[keep] = 0;
+  char first = data[0];
+  _ac_buffer_detach_release(h);
+  /* releasing resets an inline buffer to be empty */
+  data[0] = first;
+  h->data = data;
+  h->length = keep;
+  h->size = len;
+}
+
+char *ac_buffer_detach(ac_buffer_t *h, size_t *length) {
+  /* make sure that the caller gets memory which can be freed */
+  if (!h->attached && !h->pool && !h->size)
+    _ac_buffer_grow(h, 0);
+  char *r = h->data;
+  if (_ac_buffer_inline(h)) {
+    r = (char *)ac_malloc(h->length + 1);
+    memcpy(r, h->data, h->length + 1);
   }
+  *length = h->length;
+  h->attached = false;
+  h->release = NULL;
+  reset_empty(h);
+  return r;
 }
 
 void _ac_buffer_append(ac_buffer_t *h, const void *data, size_t length) {
-  if (h->length + length > h->size)
+  /* an empty append to attached memory still copies it before terminating */
+  if (h->length + length > h->size || h->attached)
     _ac_buffer_grow(h, h->length + length);
 
   memcpy(h->data + h->length, data, length);
@@ -66,6 +180,8 @@ void _ac_buffer_append(ac_buffer_t *h, const void *data, size_t length) {
 }
 
 void ac_buffer_appendvf(ac_buffer_t *h, const char *fmt, va_list args) {
+  if (h->attached)
+    _ac_buffer_grow(h, h->length);
   va_list args_copy;
   va_copy(args_copy, args);
   size_t leftover = h->size - h->length;
@@ -91,3 +207,327 @@ void ac_buffer_appendvf(ac_buffer_t *h, const char *fmt, va_list args) {
     h->max_length = h->length;
 #endif
 }
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+/* writes the digits of v so that they end at endp and returns the start */
+static inline char *u64_digits(char *endp, uint64_t v) {
+  char *p = endp;
+  while (v >= 100) {
+    const char *d = digit_pairs + ((v % 100) << 1);
+    v /= 100;
+    p -= 2;
+    p[0] = d[0];
+    p[1] = d[1];
+  }
+  if (v >= 10) {
+    const char *d = digit_pairs + (v << 1);
+    p -= 2;
+    p[0] = d[0];
+    p[1] = d[1];
+  } else
+    *--p = '0' + v;
+  return p;
+}
+
+void ac_buffer_append_u64(ac_buffer_t *h, uint64_t v) {
+  char tmp[24];
+  char *endp = tmp + sizeof(tmp);
+  char *p = u64_digits(endp, v);
+  _ac_buffer_append(h, p, endp - p);
+}
+
+void ac_buffer_append_i64(ac_buffer_t *h, int64_t v) {
+  char tmp[24];
+  char *endp = tmp + sizeof(tmp);
+  /* negate as unsigned so that INT64_MIN works */
+  char *p = u64_digits(endp, v < 0 ? -(uint64_t)v : (uint64_t)v);
+  if (v < 0)
+    *--p = '-';
+  _ac_buffer_append(h, p, endp - p);
+}
+
+void ac_buffer_append_double(ac_buffer_t *h, double v) {
+  /* integers which are exactly representable don't need printf */
+  if (v >= -9007199254740992.0 && v <= 9007199254740992.0 &&
+      v == (double)(int64_t)v && (v != 0.0 || !signbit(v))) {
+    ac_buffer_append_i64(h, (int64_t)v);
+    return;
+  }
+  /* 15 digits are usually enough and 17 digits always are */
+  char tmp[32];
+  int n = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    n = snprintf(tmp, sizeof(tmp), "%.*g", precision, v);
+    if (precision == 17 || v != v || strtod(tmp, NULL) == v)
+      break;
+  }
+  _ac_buffer_append(h, tmp, n);
+}
+
+/* true if ch must be escaped as kind */
+static inline bool needs_escape(ac_escape_t kind, unsigned char ch) {
+  switch (kind) {
+  case AC_ESCAPE_JSON:
+    return ch < 0x20 || ch == '"' || ch == '\\';
+  case AC_ESCAPE_HTML:
+    return ch == '&' || ch == '<' || ch == '>' || ch == '"' || ch == '\'';
+  default:
+    return ch == ',' || ch == '"' || ch == '\r' || ch == '\n';
+  }
+}
+
+#ifdef __SSE2__
+/* a mask of the bytes of v which must be escaped as kind */
+static inline int escape_mask(ac_escape_t kind, __m128i v) {
+  __m128i m;
+  switch (kind) {
+  case AC_ESCAPE_JSON:
+    /* v is at most 0x1F where max(v, 0x1F) is 0x1F */
+    m = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)),
+                       _mm_set1_epi8(0x1F));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    break;
+  case AC_ESCAPE_HTML:
+    m = _mm_cmpeq_epi8(v, _mm_set1_epi8('&'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    break;
+  default:
+    m = _mm_cmpeq_epi8(v, _mm_set1_epi8(','));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    break;
+  }
+  return _mm_movemask_epi8(m);
+}
+#endif
+
+/* returns the first byte in [p, ep) which must be escaped as kind or ep */
+static inline const char *find_escape(ac_escape_t kind, const char *p,
+                                      const char *ep) {
+#ifdef __SSE2__
+  while (ep - p >= 16) {
+    int mask = escape_mask(kind, _mm_loadu_si128((const __m128i *)p));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < ep && !needs_escape(kind, *p))
+    p++;
+  return p;
+}
+
+static void append_escaped_json(ac_buffer_t *h, const char *s,
+                                size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  const char *p = s;
+  const char *ep = s + length;
+  while (p < ep) {
+    /* copy runs of bytes which don't need to be escaped in one call */
+    const char *sp = p;
+    p = find_escape(AC_ESCAPE_JSON, p, ep);
+    if (p > sp)
+      _ac_buffer_append(h, sp, p - sp);
+    if (p == ep)
+      break;
+    char esc[6] = {'\\', 0, 0, 0, 0, 0};
+    size_t esc_len = 2;
+    switch (*p) {
+    case '"':
+      esc[1] = '"';
+      break;
+    case '\\':
+      esc[1] = '\\';
+      break;
+    case '\b':
+      esc[1] = 'b';
+      break;
+    case '\f':
+      esc[1] = 'f';
+      break;
+    case '\n':
+      esc[1] = 'n';
+      break;
+    case '\r':
+      esc[1] = 'r';
+      break;
+    case '\t':
+      esc[1] = 't';
+      break;
+    default:
+      esc[1] = 'u';
+      esc[2] = '0';
+      esc[3] = '0';
+      esc[4] = hex[(*p >> 4) & 0xF];
+      esc[5] = hex[*p & 0xF];
+      esc_len = 6;
+      break;
+    }
+    _ac_buffer_append(h, esc, esc_len);
+    p++;
+  }
+}
+
+static void append_escaped_html(ac_buffer_t *h, const char *s,
+                                size_t length) {
+  const char *p = s;
+  const char *ep = s + length;
+  while (p < ep) {
+    const char *sp = p;
+    p = find_escape(AC_ESCAPE_HTML, p, ep);
+    if (p > sp)
+      _ac_buffer_append(h, sp, p - sp);
+    if (p == ep)
+      break;
+    switch (*p) {
+    case '&':
+      _ac_buffer_append(h, "&amp;", 5);
+      break;
+    case '<':
+      _ac_buffer_append(h, "&lt;", 4);
+      break;
+    case '>':
+      _ac_buffer_append(h, "&gt;", 4);
+      break;
+    case '"':
+      _ac_buffer_append(h, "&quot;", 6);
+      break;
+    default:
+      _ac_buffer_append(h, "&#39;", 5);
+      break;
+    }
+    p++;
+  }
+}
+
+static void append_escaped_csv(ac_buffer_t *h, const char *s, size_t length) {
+  const char *ep = s + length;
+  const char *p = find_escape(AC_ESCAPE_CSV, s, ep);
+  if (p == ep) {
+    _ac_buffer_append(h, s, length);
+    return;
+  }
+  /* only quotes need to be doubled once the field is quoted */
+  _ac_buffer_append(h, "\"", 1);
+  p = s;
+  while (p < ep) {
+    const char *sp = p;
+    p = (const char *)memchr(p, '"', ep - p);
+    if (!p)
+      p = ep;
+    else
+      p++;
+    _ac_buffer_append(h, sp, p - sp);
+    if (p[-1] == '"')
+      _ac_buffer_append(h, "\"", 1);
+  }
+  _ac_buffer_append(h, "\"", 1);
+}
+
+void ac_buffer_append_escaped(ac_buffer_t *h, ac_escape_t kind, const char *s,
+                              size_t length) {
+  /* most text needs few (if any) escapes, so it is likely to fit */
+  ac_buffer_reserve(h, h->length + length + (length >> 4) + 2);
+  if (kind == AC_ESCAPE_JSON)
+    append_escaped_json(h, s, length);
+  else if (kind == AC_ESCAPE_HTML)
+    append_escaped_html(h, s, length);
+  else
+    append_escaped_csv(h, s, length);
+}
+
+void ac_buffer_replace_all(ac_buffer_t *h, const char *from, size_t from_len,
+                           const char *to, size_t to_len) {
+  if (!from_len || h->length < from_len)
+    return;
+
+  /* find the matches first so that the buffer grows at most once (and the
+     bytes can be moved from the end when the buffer gets longer) */
+  size_t matches_buf[32];
+  size_t *matches = matches_buf;
+  size_t num_matches = 0, matches_size = 32;
+  const char *p = h->data;
+  const char *ep = h->data + h->length;
+  while ((size_t)(ep - p) >= from_len) {
+    p = (const char *)memmem(p, ep - p, from, from_len);
+    if (!p)
+      break;
+    if (num_matches == matches_size) {
+      matches_size *= 2;
+      if (matches == matches_buf) {
+        matches = (size_t *)ac_malloc(matches_size * sizeof(size_t));
+        memcpy(matches, matches_buf, sizeof(matches_buf));
+      } else
+        matches = (size_t *)ac_realloc(matches, matches_size * sizeof(size_t));
+    }
+    matches[num_matches++] = p - h->data;
+    p += from_len;
+  }
+  if (!num_matches)
+    return;
+
+  /* the bytes are moved in place (and the buffer may move), so a to which
+     points into the buffer is copied first */
+  char *to_copy = NULL;
+  if (to_len && to >= h->data && to < h->data + h->length) {
+    to_copy = (char *)ac_malloc(to_len);
+    memcpy(to_copy, to, to_len);
+    to = to_copy;
+  }
+
+  size_t length = h->length;
+  size_t new_length = length - num_matches * from_len + num_matches * to_len;
+  /* an attached buffer is copied here, so data may move */
+  ac_buffer_reserve(h, new_length);
+  char *d = h->data;
+  if (to_len <= from_len) {
+    /* the result is never ahead of the source moving left to right */
+    size_t wp = matches[0], rp = matches[0];
+    for (size_t i = 0; i < num_matches; i++) {
+      if (matches[i] > rp) {
+        memmove(d + wp, d + rp, matches[i] - rp);
+        wp += matches[i] - rp;
+      }
+      memcpy(d + wp, to, to_len);
+      wp += to_len;
+      rp = matches[i] + from_len;
+    }
+    memmove(d + wp, d + rp, length - rp);
+  } else {
+    /* the result is never behind the source moving right to left */
+    size_t wp = new_length, rp = length;
+    for (size_t i = num_matches; i > 0; i--) {
+      size_t end = matches[i - 1] + from_len;
+      wp -= rp - end;
+      memmove(d + wp, d + end, rp - end);
+      wp -= to_len;
+      memcpy(d + wp, to, to_len);
+      rp = matches[i - 1];
+    }
+  }
+  h->length = new_length;
+  d[new_length] = 0;
+#ifdef _AC_DEBUG_MEMORY_
+  if (new_length > h->max_length)
+    h->max_length = new_length;
+#endif
+  if (matches != matches_buf)
+    ac_free(matches);
+  if (to_copy)
+    ac_free(to_copy);
+}
@@ -22,6 +22,7 @@ limitations under the License.
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -31,6 +32,15 @@ extern "C" {
 struct ac_buffer_s;
 typedef struct ac_buffer_s ac_buffer_t;
 
+/* When a buffer grows, it grows by at least AC_BUFFER_GROWTH_PERCENT of its
+   size so that appending n bytes a little at a time only copies O(n) bytes.
+   A buffer allocated from a pool is extended in place if it is the last
+   allocation in the pool (see ac_pool_extend), otherwise the old copy stays
+   in the pool until it is cleared. */
+#ifndef AC_BUFFER_GROWTH_PERCENT
+#define AC_BUFFER_GROWTH_PERCENT 50
+#endif
+
 /* set the buffer to an initial size, buffer will grow as needed */
 #ifdef _AC_DEBUG_MEMORY_
 #define ac_buffer_init(size)                                                   \
@@ -41,6 +51,20 @@ ac_buffer_t *_ac_buffer_init(size_t size, const char *caller);
 ac_buffer_t *_ac_buffer_init(size_t size);
 #endif
 
+/* A buffer with an initial size of AC_BUFFER_INLINE_SIZE or less keeps its
+   data in the same allocation as the structure until it grows.  An
+   ac_buffer_inline_t can also be declared on the stack (or inside of another
+   structure) and initialized with ac_buffer_init_inline, so a small buffer
+   doesn't allocate at all.  ac_buffer_destroy must still be called, it only
+   frees memory which was allocated after the buffer outgrew its space. */
+#ifndef AC_BUFFER_INLINE_SIZE
+#define AC_BUFFER_INLINE_SIZE 64
+#endif
+
+typedef struct ac_buffer_inline_s ac_buffer_inline_t;
+
+static inline ac_buffer_t *ac_buffer_init_inline(ac_buffer_inline_t *b);
+
 /* like above, except allocated with a pool (no need to destroy) */
 static inline ac_buffer_t *ac_buffer_pool_init(ac_pool_t *pool,
                                                size_t initial_size);
@@ -52,6 +76,8 @@ static inline void ac_buffer_clear(ac_buffer_t *h);
 static inline char *ac_buffer_data(ac_buffer_t *h);
 /* get the length of the buffer */
 static inline size_t ac_buffer_length(ac_buffer_t *h);
+/* the number of bytes the buffer can hold before it grows */
+static inline size_t ac_buffer_capacity(ac_buffer_t *h);
 
 /* Functions to append contents into a buffer (vs set). */
 /* append bytes to the current buffer */
@@ -73,6 +99,45 @@ void ac_buffer_appendvf(ac_buffer_t *h, const char *fmt, va_list args);
 /* append bytes in current buffer using a formatted string -similar to printf */
 static inline void ac_buffer_appendf(ac_buffer_t *h, const char *fmt, ...);
 
+/* The following append formatted values without parsing a format string.
+   They are much faster than ac_buffer_appendf for building logs and JSON. */
+/* append the decimal representation of an unsigned integer */
+void ac_buffer_append_u64(ac_buffer_t *h, uint64_t v);
+
+/* append the decimal representation of a signed integer */
+void ac_buffer_append_i64(ac_buffer_t *h, int64_t v);
+
+/* append the shortest representation of v which converts back to the same
+   double (nan and inf are written as printf would write them). */
+void ac_buffer_append_double(ac_buffer_t *h, double v);
+
+/* The kinds of escaping which ac_buffer_append_escaped supports.
+   AC_ESCAPE_JSON writes s as the inside of a JSON string (quotes, back
+   slashes, and control characters are escaped, other bytes are copied, and
+   the surrounding quotes are not added).  AC_ESCAPE_HTML replaces &, <, >,
+   " and ' with entities so that the text is safe in an element or a quoted
+   attribute.  AC_ESCAPE_CSV writes s as a single field, surrounding it with
+   quotes (and doubling quotes in s) only if it contains a comma, quote,
+   carriage return, or newline. */
+typedef enum { AC_ESCAPE_JSON, AC_ESCAPE_HTML, AC_ESCAPE_CSV } ac_escape_t;
+
+/* append length bytes of s escaped as kind.  The runs of bytes which don't
+   need to be escaped are found 16 bytes at a time and copied in one call,
+   so this is much faster than escaping with ac_buffer_appendc. */
+void ac_buffer_append_escaped(ac_buffer_t *h, ac_escape_t kind, const char *s,
+                              size_t length);
+
+/* an alias for ac_buffer_append_escaped(h, AC_ESCAPE_JSON, s, length), which
+   ac_json and earlier code use */
+static inline void ac_buffer_append_escaped_json(ac_buffer_t *h, const char *s,
+                                                 size_t length);
+
+/* replace every (non-overlapping, left to right) occurrence of from in the
+   contents of the buffer with to.  The buffer grows at most once.  from and
+   to may point into the buffer (to is copied first if it does). */
+void ac_buffer_replace_all(ac_buffer_t *h, const char *from, size_t from_len,
+                           const char *to, size_t to_len);
+
 /* Functions to set the contents into a buffer (vs append). */
 /* set bytes to the current buffer */
 static inline void ac_buffer_set(ac_buffer_t *h, const void *data,
@@ -94,6 +159,10 @@ static inline void ac_buffer_setvf(ac_buffer_t *h, const char *fmt,
 /* set bytes in current buffer using a formatted string -similar to printf */
 static inline void ac_buffer_setf(ac_buffer_t *h, const char *fmt, ...);
 
+/* make room for at least size bytes without changing the contents.  Appends
+   which fit don't need to grow the buffer. */
+static inline void ac_buffer_reserve(ac_buffer_t *h, size_t size);
+
 /* resize the buffer and return a pointer to the beginning of the buffer.  This
    will retain the original data in the buffer for up to length bytes. */
 static inline void *ac_buffer_resize(ac_buffer_t *h, size_t length);
@@ -110,6 +179,32 @@ static inline void *ac_buffer_append_alloc(ac_buffer_t *h, size_t length);
    will NOT retain the original data in the buffer for up to length bytes. */
 static inline void *ac_buffer_alloc(ac_buffer_t *h, size_t length);
 
+/* ac_buffer_release_cb is called when a buffer stops referencing memory
+   which was given to it with ac_buffer_attach. */
+typedef void (*ac_buffer_release_cb)(void *arg, void *data, size_t length);
+
+/* ac_buffer_attach makes the buffer reference length bytes of data without
+   copying them (for example a socket read buffer or an mmap'd region).  The
+   data is treated as read-only and isn't expected to be zero terminated.  The
+   first call which modifies the buffer copies the data into memory owned by
+   the buffer.  release (which may be NULL) is called with arg once the buffer
+   no longer references the data (after the copy, when the buffer is cleared
+   or set, or when it is destroyed).  Any memory which the buffer owned before
+   this call is freed (unless the buffer belongs to a pool). */
+void ac_buffer_attach(ac_buffer_t *h, const void *data, size_t length,
+                      ac_buffer_release_cb release, void *arg);
+
+/* returns true if the buffer currently references attached memory */
+static inline bool ac_buffer_attached(ac_buffer_t *h);
+
+/* ac_buffer_detach lends the buffer's memory to the caller without copying
+   it.  The data and its length (via length) are returned and the buffer is
+   left empty.  If the buffer was created with ac_buffer_pool_init, the data
+   belongs to the pool.  If the data was attached, the caller becomes
+   responsible for it (release will not be called).  Otherwise the data is
+   zero terminated and must be freed with ac_free. */
+char *ac_buffer_detach(ac_buffer_t *h, size_t *length);
+
 /* destroy the buffer */
 void ac_buffer_destroy(ac_buffer_t *h);
 
@@ -0,0 +1,296 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_buffer_cache.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* the number of buffers held by a magazine */
+#define AC_BUFFER_CACHE_MAGAZINE_SIZE 32
+
+#define BUFFER_CACHE_MAX_CLASSES 40
+
+typedef struct buffer_magazine_s {
+  struct buffer_magazine_s *next;
+  int count;
+  ac_buffer_t *buffers[AC_BUFFER_CACHE_MAGAZINE_SIZE];
+} buffer_magazine_t;
+
+typedef struct {
+  /* loaded is used first, previous avoids going to the global lists each
+     time a buffer is taken and returned right at a magazine boundary
+     (either may be NULL until it is needed) */
+  buffer_magazine_t *loaded;
+  buffer_magazine_t *previous;
+} buffer_class_t;
+
+typedef struct buffer_thread_s {
+  ac_buffer_cache_t *h;
+  struct buffer_thread_s *next;
+  struct buffer_thread_s *prev;
+  buffer_class_t classes[];
+} buffer_thread_t;
+
+struct ac_buffer_cache_s {
+  uint64_t id;
+  size_t max_size;
+  int num_classes;
+  pthread_key_t key;
+  /* lock-free stacks of full magazines (per class) and of empty ones */
+  buffer_magazine_t *full[BUFFER_CACHE_MAX_CLASSES];
+  buffer_magazine_t *empty;
+
+  /* the mutex protects the list of threads (which only changes when a
+     thread first uses the cache or exits) */
+  pthread_mutex_t mutex;
+  buffer_thread_t *threads;
+};
+
+/* every cache gets a new id, so the thread's most recently used cache can
+   be remembered without pthread_getspecific (and without mistaking a new
+   cache for a destroyed one at the same address) */
+static uint64_t next_id = 1;
+static __thread uint64_t current_id = 0;
+static __thread buffer_thread_t *current_thread = NULL;
+
+static inline size_t class_size(int c) {
+  return (size_t)AC_BUFFER_CACHE_MIN_SIZE << c;
+}
+
+/* pushing can't suffer from ABA since the node being pushed is owned by the
+   caller, popping takes the whole stack (see pop_magazine) */
+static void push_magazines(buffer_magazine_t **head, buffer_magazine_t *first,
+                           buffer_magazine_t *last) {
+  buffer_magazine_t *top = __atomic_load_n(head, __ATOMIC_RELAXED);
+  do {
+    last->next = top;
+  } while (!__atomic_compare_exchange_n(head, &top, first, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static inline void push_magazine(buffer_magazine_t **head,
+                                 buffer_magazine_t *m) {
+  push_magazines(head, m, m);
+}
+
+/* the stack is detached as a whole and everything but the first magazine is
+   pushed back, so a magazine is never popped while another thread is
+   looking at its next pointer.  A thread which finds the stack empty in the
+   meantime simply misses the cache. */
+static buffer_magazine_t *pop_magazine(buffer_magazine_t **head) {
+  if (!__atomic_load_n(head, __ATOMIC_RELAXED))
+    return NULL;
+  buffer_magazine_t *m = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+  if (m && m->next) {
+    buffer_magazine_t *last = m->next;
+    while (last->next)
+      last = last->next;
+    push_magazines(head, m->next, last);
+  }
+  return m;
+}
+
+static buffer_magazine_t *empty_magazine(ac_buffer_cache_t *h) {
+  buffer_magazine_t *m = pop_magazine(&h->empty);
+  if (!m) {
+    m = (buffer_magazine_t *)ac_malloc(sizeof(buffer_magazine_t));
+    if (!m)
+      abort();
+    m->count = 0;
+  }
+  m->next = NULL;
+  return m;
+}
+
+/* hands a magazine which a thread no longer holds to the global lists */
+static void return_magazine(ac_buffer_cache_t *h, int c,
+                            buffer_magazine_t *m) {
+  if (!m)
+    return;
+  push_magazine(m->count ? &h->full[c] : &h->empty, m);
+}
+
+static void free_magazine(buffer_magazine_t *m) {
+  for (int i = 0; i < m->count; i++)
+    ac_buffer_destroy(m->buffers[i]);
+  ac_free(m);
+}
+
+static void on_thread_exit(void *arg) {
+  buffer_thread_t *t = (buffer_thread_t *)arg;
+  ac_buffer_cache_t *h = t->h;
+  if (current_thread == t)
+    current_id = 0;
+  for (int c = 0; c < h->num_classes; c++) {
+    return_magazine(h, c, t->classes[c].loaded);
+    return_magazine(h, c, t->classes[c].previous);
+  }
+  pthread_mutex_lock(&h->mutex);
+  if (t->prev)
+    t->prev->next = t->next;
+  else
+    h->threads = t->next;
+  if (t->next)
+    t->next->prev = t->prev;
+  pthread_mutex_unlock(&h->mutex);
+  ac_free(t);
+}
+
+static buffer_thread_t *create_thread(ac_buffer_cache_t *h) {
+  buffer_thread_t *t = (buffer_thread_t *)ac_calloc(
+      sizeof(buffer_thread_t) + sizeof(buffer_class_t) * h->num_classes);
+  if (!t)
+    abort();
+  t->h = h;
+  pthread_mutex_lock(&h->mutex);
+  t->next = h->threads;
+  if (t->next)
+    t->next->prev = t;
+  h->threads = t;
+  pthread_mutex_unlock(&h->mutex);
+  pthread_setspecific(h->key, t);
+  return t;
+}
+
+static inline buffer_thread_t *get_thread(ac_buffer_cache_t *h) {
+  if (current_id == h->id)
+    return current_thread;
+  buffer_thread_t *t = (buffer_thread_t *)pthread_getspecific(h->key);
+  if (!t)
+    t = create_thread(h);
+  current_id = h->id;
+  current_thread = t;
+  return t;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_buffer_cache_t *_ac_buffer_cache_init(size_t max_size,
+                                         const char *caller) {
+  ac_buffer_cache_t *h = (ac_buffer_cache_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_buffer_cache_t), false);
+#else
+ac_buffer_cache_t *_ac_buffer_cache_init(size_t max_size) {
+  ac_buffer_cache_t *h =
+      (ac_buffer_cache_t *)ac_calloc(sizeof(ac_buffer_cache_t));
+#endif
+  if (!h)
+    abort();
+  h->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+  h->num_classes = 1;
+  while (h->num_classes < BUFFER_CACHE_MAX_CLASSES &&
+         class_size(h->num_classes) <= max_size)
+    h->num_classes++;
+  h->max_size = max_size < class_size(0) ? class_size(0) : max_size;
+  pthread_mutex_init(&h->mutex, NULL);
+  if (pthread_key_create(&h->key, on_thread_exit))
+    abort();
+  return h;
+}
+
+ac_buffer_t *ac_buffer_cache_get(ac_buffer_cache_t *h, size_t size) {
+  if (size > h->max_size)
+    return ac_buffer_init(size);
+  int c = 0;
+  while (class_size(c) < size)
+    c++;
+  if (c >= h->num_classes)
+    return ac_buffer_init(size);
+  buffer_class_t *bc = get_thread(h)->classes + c;
+  buffer_magazine_t *m = bc->loaded;
+  if (m && m->count)
+    return m->buffers[--m->count];
+  if (bc->previous && bc->previous->count) {
+    bc->loaded = bc->previous;
+    bc->previous = m;
+    return bc->loaded->buffers[--bc->loaded->count];
+  }
+  /* no cached buffer of this class on the thread, take a full magazine
+     from the class's stack (or make a new buffer if there isn't one) */
+  buffer_magazine_t *full = pop_magazine(&h->full[c]);
+  if (!full)
+    return ac_buffer_init(class_size(c));
+  if (bc->previous)
+    return_magazine(h, c, bc->previous);
+  bc->previous = m;
+  bc->loaded = full;
+  return full->buffers[--full->count];
+}
+
+void ac_buffer_cache_put(ac_buffer_cache_t *h, ac_buffer_t *bh) {
+  ac_buffer_clear(bh);
+  size_t capacity = ac_buffer_capacity(bh);
+  if (capacity > h->max_size) {
+    ac_buffer_destroy(bh);
+    return;
+  }
+  /* the largest class which the buffer satisfies */
+  int c = 0;
+  while (c + 1 < h->num_classes && class_size(c + 1) <= capacity)
+    c++;
+  buffer_class_t *bc = get_thread(h)->classes + c;
+  buffer_magazine_t *m = bc->loaded;
+  if (m && m->count < AC_BUFFER_CACHE_MAGAZINE_SIZE) {
+    m->buffers[m->count++] = bh;
+    return;
+  }
+  if (!bc->previous)
+    bc->previous = empty_magazine(h);
+  if (bc->previous->count < AC_BUFFER_CACHE_MAGAZINE_SIZE) {
+    bc->loaded = bc->previous;
+    bc->previous = m;
+  } else {
+    /* the thread holds two full magazines of this class, hand the older
+       one to the class's stack */
+    return_magazine(h, c, bc->previous);
+    bc->previous = m;
+    bc->loaded = empty_magazine(h);
+  }
+  bc->loaded->buffers[bc->loaded->count++] = bh;
+}
+
+void ac_buffer_cache_destroy(ac_buffer_cache_t *h) {
+  /* threads which exit after this don't touch the cache, so the buffers
+     still held per thread are freed here */
+  pthread_key_delete(h->key);
+  for (buffer_thread_t *t = h->threads; t;) {
+    buffer_thread_t *next = t->next;
+    for (int c = 0; c < h->num_classes; c++) {
+      if (t->classes[c].loaded)
+        free_magazine(t->classes[c].loaded);
+      if (t->classes[c].previous)
+        free_magazine(t->classes[c].previous);
+    }
+    ac_free(t);
+    t = next;
+  }
+  for (int c = 0; c < h->num_classes; c++) {
+    while (h->full[c]) {
+      buffer_magazine_t *m = h->full[c];
+      h->full[c] = m->next;
+      free_magazine(m);
+    }
+  }
+  while (h->empty) {
+    buffer_magazine_t *m = h->empty;
+    h->empty = m->next;
+    ac_free(m);
+  }
+  pthread_mutex_destroy(&h->mutex);
+  ac_free(h);
+}
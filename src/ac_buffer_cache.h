@@ -0,0 +1,80 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_buffer_cache_H
+#define _ac_buffer_cache_H
+
+#include "ac_allocator.h"
+#include "ac_buffer.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_buffer_cache_t hands out ac_buffer_t instances which are reused instead
+  of being destroyed, for code which would otherwise keep its own list of
+  buffers behind a mutex.  The buffers are grouped by capacity into power of
+  two size classes starting at AC_BUFFER_CACHE_MIN_SIZE.  Like ac_slab_t,
+  each thread keeps a pair of magazines per size class, so most gets and
+  puts don't touch shared memory.  Full and empty magazines are exchanged
+  with global lists which are lock-free stacks.
+
+  A buffer can be put back by a different thread than the one which got it.
+  Buffers which have grown beyond max_size are destroyed when they are put
+  back, so that one large request doesn't keep its memory pinned in the
+  cache.  Requests above max_size aren't cached at all.
+
+  ac_buffer_cache_t isn't named ac_buffer_pool_t because ac_buffer_pool_init
+  already creates a buffer inside of an ac_pool_t.
+*/
+struct ac_buffer_cache_s;
+typedef struct ac_buffer_cache_s ac_buffer_cache_t;
+
+#ifndef AC_BUFFER_CACHE_MIN_SIZE
+#define AC_BUFFER_CACHE_MIN_SIZE 256
+#endif
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_buffer_cache_init(max_size)                                         \
+  _ac_buffer_cache_init(max_size, AC_FILE_LINE_MACRO("ac_buffer_cache"))
+ac_buffer_cache_t *_ac_buffer_cache_init(size_t max_size, const char *caller);
+#else
+#define ac_buffer_cache_init(max_size) _ac_buffer_cache_init(max_size)
+ac_buffer_cache_t *_ac_buffer_cache_init(size_t max_size);
+#endif
+
+/* returns an empty buffer which can hold at least size bytes without
+   growing */
+ac_buffer_t *ac_buffer_cache_get(ac_buffer_cache_t *h, size_t size);
+
+/* clears bh and keeps it for a later get (or destroys it if it has grown
+   beyond max_size).  bh must have been created with ac_buffer_init (or come
+   from ac_buffer_cache_get). */
+void ac_buffer_cache_put(ac_buffer_cache_t *h, ac_buffer_t *bh);
+
+/* destroys the cache and every buffer in it.  Buffers which are out of the
+   cache aren't affected (and must be destroyed by the caller).  It should
+   only be called once no other thread is using the cache. */
+void ac_buffer_cache_destroy(ac_buffer_cache_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,10 +17,14 @@ limitations under the License.
 #include "ac_cgi.h"
 
 #include "ac_conv.h"
-#include "ac_map.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static inline int to_hex(int v) {
   if (v >= '0' && v <= '9')
@@ -32,12 +36,45 @@ static inline int to_hex(int v) {
   return -1;
 }
 
-char *ac_cgi_decode(ac_pool_t *pool, char *s) {
-  char *res = (char *)ac_pool_alloc(pool, strlen(s) + 1);
-  char *p = s;
-  char *wp = res;
-  while (*p != 0) {
-    if (*p == '%') {
+/* replaces %XX and + in src..src + length, returns the end of dest (which
+   may be src) */
+static char *decode_escapes(char *dest, const char *src, size_t length) {
+  const char *p = src;
+  const char *ep = src + length;
+  char *wp = dest;
+  bool in_place = dest == src;
+  while (p < ep) {
+#ifdef __SSE2__
+    /* copy the bytes before the next '%' sixteen at a time, replacing each
+       '+' with a space as they are copied */
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i space_xor = _mm_set1_epi8('+' ^ ' ');
+    while (ep - p >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, percent));
+      __m128i plus_mask = _mm_cmpeq_epi8(v, plus);
+      int plus_bits = _mm_movemask_epi8(plus_mask);
+      v = _mm_xor_si128(v, _mm_and_si128(plus_mask, space_xor));
+      int n = mask ? __builtin_ctz(mask) : 16;
+      if (!in_place || n == 16) {
+        /* in place, a whole vector is only written if all of it was read */
+        if (wp != p || plus_bits)
+          _mm_storeu_si128((__m128i *)wp, v);
+      } else if (wp != p || (plus_bits & ((1 << n) - 1))) {
+        char tmp[16];
+        _mm_storeu_si128((__m128i *)tmp, v);
+        memmove(wp, tmp, n);
+      }
+      p += n;
+      wp += n;
+      if (n < 16)
+        break;
+    }
+    if (p == ep)
+      break;
+#endif
+    if (*p == '%' && ep - p > 2) {
       int v1 = to_hex(p[1]);
       int v2 = to_hex(p[2]);
       if (v1 >= 0 && v2 >= 0) {
@@ -45,8 +82,7 @@ char *ac_cgi_decode(ac_pool_t *pool, char *s) {
         v1 += v2;
         if (v1 != 1 && v1 < 32)
           v1 = 32;
-        if (v1 <= 255)
-          *wp++ = v1;
+        *wp++ = v1;
         p += 3;
         continue;
       }
@@ -57,229 +93,393 @@ char *ac_cgi_decode(ac_pool_t *pool, char *s) {
     }
     *wp++ = *p++;
   }
-  *wp = 0;
-  wp = res;
-  p = res;
-  while (*p != 0) {
-    if (*p == '&') {
-      p++;
-      if (p[0] == 'a') {
-        if (p[1] == 'p' && p[2] == 'o' && p[3] == 's' && p[4] == ';') {
-          *wp++ = '\'';
-          p += 5;
-        } else if (p[1] == 'm' && p[2] == 'p' && p[3] == ';') {
-          *wp++ = '&';
-          p += 4;
-        } else
-          *wp++ = '&';
-      } else if (p[0] == 'g' && p[1] == 't' && p[2] == ';') {
-        *wp++ = '>';
-        p += 3;
-      } else if (p[0] == 'l' && p[1] == 't' && p[2] == ';') {
-        *wp++ = '<';
-        p += 3;
-      } else if (p[0] == 'q' && p[1] == 'u' && p[2] == 'o' && p[3] == 't' &&
-                 p[4] == ';') {
-        *wp++ = '\"';
-        p += 5;
-      } else
-        *wp++ = '&';
+  return wp;
+}
+
+/* replaces the html entities &apos; &amp; &gt; &lt; and &quot; in place,
+   returns the new end */
+static char *decode_entities(char *s, char *ep) {
+  char *rp = (char *)memchr(s, '&', ep - s);
+  if (!rp)
+    return ep;
+  char *wp = rp;
+  while (rp < ep) {
+    if (*rp != '&') {
+      /* move the run up to the next '&' */
+      char *amp = (char *)memchr(rp, '&', ep - rp);
+      if (!amp)
+        amp = ep;
+      memmove(wp, rp, amp - rp);
+      wp += amp - rp;
+      rp = amp;
+      continue;
     }
+    rp++;
+    size_t left = ep - rp;
+    if (left >= 5 && !memcmp(rp, "apos;", 5)) {
+      *wp++ = '\'';
+      rp += 5;
+    } else if (left >= 4 && !memcmp(rp, "amp;", 4)) {
+      *wp++ = '&';
+      rp += 4;
+    } else if (left >= 3 && !memcmp(rp, "gt;", 3)) {
+      *wp++ = '>';
+      rp += 3;
+    } else if (left >= 3 && !memcmp(rp, "lt;", 3)) {
+      *wp++ = '<';
+      rp += 3;
+    } else if (left >= 5 && !memcmp(rp, "quot;", 5)) {
+      *wp++ = '\"';
+      rp += 5;
+    } else
+      *wp++ = '&';
   }
+  return wp;
+}
+
+size_t ac_cgi_decode_to(char *dest, const char *s, size_t length) {
+  char *ep = decode_escapes(dest, s, length);
+  ep = decode_entities(dest, ep);
+  *ep = 0;
+  return ep - dest;
+}
+
+/* decodes the length bytes of s (which need not be zero terminated) */
+static char *decode(ac_pool_t *pool, const char *s, size_t length) {
+  char *res = (char *)ac_pool_alloc(pool, length + 1);
+  if (res)
+    ac_cgi_decode_to(res, s, length);
   return res;
 }
 
-typedef struct value_s {
-  char *value;
-  char *decoded;
-  struct value_s *next;
-} value_t;
+char *ac_cgi_decode(ac_pool_t *pool, char *s) {
+  return decode(pool, s, strlen(s));
+}
+
+/* letters, digits, and -_.~ are left as they are when encoding */
+static inline bool unreserved(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+         c == '~';
+}
+
+#ifdef __SSE2__
+/* a mask of the bytes of v which are unreserved */
+static inline int unreserved_mask(__m128i v) {
+  /* bytes above 127 are negative, so they are outside of every range */
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+  __m128i other = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('~'))));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), other));
+}
+#endif
+
+char *ac_cgi_encode(ac_pool_t *pool, const char *s) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t length = strlen(s);
+  char *res = (char *)ac_pool_ualloc(pool, length * 3 + 1);
+  if (!res)
+    return NULL;
+  const unsigned char *p = (const unsigned char *)s;
+  const unsigned char *ep = p + length;
+  char *wp = res;
+  while (p < ep) {
+#ifdef __SSE2__
+    while (ep - p >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      int mask = ~unreserved_mask(v) & 0xFFFF;
+      _mm_storeu_si128((__m128i *)wp, v);
+      if (!mask) {
+        p += 16;
+        wp += 16;
+        continue;
+      }
+      int n = __builtin_ctz(mask);
+      p += n;
+      wp += n;
+      break;
+    }
+    if (p == ep)
+      break;
+#endif
+    unsigned char c = *p++;
+    if (unreserved(c))
+      *wp++ = c;
+    else if (c == ' ')
+      *wp++ = '+';
+    else {
+      wp[0] = '%';
+      wp[1] = hex[c >> 4];
+      wp[2] = hex[c & 15];
+      wp += 3;
+    }
+  }
+  *wp = 0;
+  return res;
+}
 
+/* a key=value pair of the query, the value is decoded the first time it is
+   used */
 typedef struct {
-  ac_map_t map;
-  value_t *head, *tail;
-} cgi_node_t;
+  const char *key;
+  const char *value;
+  char *decoded;
+  uint32_t key_length;
+  uint32_t value_length;
+  uint32_t decoded_length;
+  uint32_t hash;
+  /* the index + 1 of the next value for the same key (set by the index) */
+  uint32_t next;
+} cgi_param_t;
 
 struct ac_cgi_s {
   ac_pool_t *pool;
-  ac_map_t *root;
+  char *query;
+  cgi_param_t *params;
+  uint32_t num_params;
+  uint32_t max_params;
+  /* an open addressing table of the index + 1 of the first value of each
+     key, built by the first lookup if there are more than
+     AC_CGI_LINEAR_PARAMS params */
+  uint32_t *slots;
+  uint32_t mask;
 };
 
-static inline const char *get_key(const cgi_node_t *el) {
-  return (char *)(el + 1);
+/* queries with up to this many params are searched without an index */
+#define AC_CGI_LINEAR_PARAMS 8
+
+/* FNV-1a of the lowercased key */
+static inline uint32_t key_hash(const char *key, size_t length) {
+  uint32_t h = 2166136261U;
+  const char *ep = key + length;
+  while (key < ep) {
+    uint32_t c = (unsigned char)*key++;
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    h = (h ^ c) * 16777619U;
+  }
+  return h;
+}
+
+static inline bool same_key(const cgi_param_t *p, const char *key,
+                            size_t length) {
+  return p->key_length == length && !strncasecmp(p->key, key, length);
+}
+
+static void build_index(ac_cgi_t *h) {
+  uint32_t size = 16;
+  while (size < h->num_params * 2)
+    size <<= 1;
+  /* without the memory for the table, lookups stay linear */
+  h->slots = (uint32_t *)ac_pool_calloc(h->pool, sizeof(uint32_t) * size);
+  if (!h->slots)
+    return;
+  h->mask = size - 1;
+  for (uint32_t i = 0; i < h->num_params; i++)
+    h->params[i].hash = key_hash(h->params[i].key, h->params[i].key_length);
+  /* the params are added in reverse so that each key's list of values is in
+     the order of the query */
+  for (uint32_t i = h->num_params; i-- > 0;) {
+    cgi_param_t *p = h->params + i;
+    uint32_t slot = p->hash & h->mask;
+    while (h->slots[slot]) {
+      cgi_param_t *first = h->params + h->slots[slot] - 1;
+      if (first->hash == p->hash && same_key(first, p->key, p->key_length))
+        break;
+      slot = (slot + 1) & h->mask;
+    }
+    p->next = h->slots[slot];
+    h->slots[slot] = i + 1;
+  }
+}
+
+/* the first param for key (which is length bytes) or NULL */
+static cgi_param_t *find_param_n(ac_cgi_t *h, const char *key,
+                                 size_t length) {
+  if (h->num_params > AC_CGI_LINEAR_PARAMS && !h->slots)
+    build_index(h);
+  if (!h->slots) {
+    for (uint32_t i = 0; i < h->num_params; i++)
+      if (same_key(h->params + i, key, length))
+        return h->params + i;
+    return NULL;
+  }
+  uint32_t hash = key_hash(key, length);
+  uint32_t slot = hash & h->mask;
+  while (h->slots[slot]) {
+    cgi_param_t *p = h->params + h->slots[slot] - 1;
+    if (p->hash == hash && same_key(p, key, length))
+      return p;
+    slot = (slot + 1) & h->mask;
+  }
+  return NULL;
+}
+
+/* the first param for key or NULL */
+static cgi_param_t *find_param(ac_cgi_t *h, const char *key) {
+  if (!h || !key)
+    return NULL;
+  return find_param_n(h, key, strlen(key));
+}
+
+/* the next param with the same key as p */
+static cgi_param_t *next_param(ac_cgi_t *h, cgi_param_t *p) {
+  if (h->slots)
+    return p->next ? h->params + p->next - 1 : NULL;
+  cgi_param_t *ep = h->params + h->num_params;
+  for (cgi_param_t *n = p + 1; n < ep; n++)
+    if (same_key(n, p->key, p->key_length))
+      return n;
+  return NULL;
+}
+
+static const char *param_value(ac_cgi_t *h, cgi_param_t *p) {
+  if (!p->decoded) {
+    p->decoded = (char *)ac_pool_alloc(h->pool, p->value_length + 1);
+    if (!p->decoded)
+      return NULL;
+    p->decoded_length =
+        ac_cgi_decode_to(p->decoded, p->value, p->value_length);
+  }
+  return p->decoded;
+}
+
+/* the first decoded value of key or NULL */
+static const char *find_value(ac_cgi_t *h, const char *key) {
+  cgi_param_t *p = find_param(h, key);
+  return p ? param_value(h, p) : NULL;
+}
+
+/* kv..ep is a key=value pair and eq is the first '=' (or NULL) */
+static void add_param(ac_cgi_t *h, const char *kv, const char *eq,
+                      const char *ep) {
+  /* an empty key or a key without a value has no values, so it is the same
+     as a missing key */
+  if (!eq || eq == kv)
+    return;
+  if (h->num_params == h->max_params) {
+    uint32_t max_params = h->max_params ? h->max_params * 2 : 16;
+    cgi_param_t *params = (cgi_param_t *)ac_pool_alloc(
+        h->pool, sizeof(cgi_param_t) * max_params);
+    if (!params)
+      return;
+    if (h->num_params)
+      memcpy(params, h->params, sizeof(cgi_param_t) * h->num_params);
+    h->params = params;
+    h->max_params = max_params;
+  }
+  cgi_param_t *p = h->params + h->num_params++;
+  p->key = kv;
+  p->key_length = eq - kv;
+  p->value = eq + 1;
+  p->value_length = ep - (eq + 1);
+  p->decoded = NULL;
+  p->decoded_length = 0;
+  p->next = 0;
 }
 
-static inline int compare_key(const cgi_node_t *a, const cgi_node_t *b) {
-  return strcasecmp(get_key(a), get_key(b));
+ac_cgi_t *ac_cgi_init_n(ac_pool_t *pool, const char *q, size_t length) {
+  ac_cgi_t *h = (ac_cgi_t *)ac_pool_alloc(pool, sizeof(ac_cgi_t) + length + 1);
+  if (!h)
+    return NULL;
+  h->pool = pool;
+  h->query = (char *)(h + 1);
+  memcpy(h->query, q, length);
+  h->query[length] = 0;
+  h->params = NULL;
+  h->num_params = h->max_params = 0;
+  h->slots = NULL;
+  h->mask = 0;
+
+  const char *ep = h->query + length;
+  const char *p = (const char *)memchr(h->query, '?', length);
+  p = p ? p + 1 : h->query;
+  while (p < ep) {
+    const char *amp = (const char *)memchr(p, '&', ep - p);
+    if (!amp)
+      amp = ep;
+    add_param(h, p, (const char *)memchr(p, '=', amp - p), amp);
+    p = amp + 1;
+  }
+  return h;
 }
 
-static inline int compare_key_for_find(const char *key,
-                                       const cgi_node_t *value) {
-  return strcasecmp(key, get_key(value));
+ac_cgi_t *ac_cgi_init(ac_pool_t *pool, const char *q) {
+  return ac_cgi_init_n(pool, q, strlen(q));
 }
 
-ac_map_find_m(cgi_find, char, cgi_node_t, compare_key_for_find);
-ac_map_insert_m(cgi_insert, cgi_node_t, compare_key);
+const char *ac_cgi_query(ac_cgi_t *h) { return h ? h->query : NULL; }
 
-const char *ac_cgi_query(ac_cgi_t *h) { return (char *)(h + 1); }
+ac_strview_t ac_cgi_view(ac_cgi_t *h, const char *key, size_t key_length) {
+  cgi_param_t *p = (h && key) ? find_param_n(h, key, key_length) : NULL;
+  if (!p)
+    return ac_strview(NULL, 0);
+  const char *value = param_value(h, p);
+  return ac_strview(value, p->decoded_length);
+}
 
 char **ac_cgi_strs(ac_cgi_t *h, const char *key) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
+  cgi_param_t *first = find_param(h, key);
+  if (!first)
     return NULL;
 
   size_t num = 1;
-  value_t *v = n->head;
-  while (v) {
+  for (cgi_param_t *p = first; p; p = next_param(h, p))
     num++;
-    v = v->next;
-  }
   char **res = (char **)ac_pool_alloc(h->pool, sizeof(char *) * num);
+  if (!res)
+    return NULL;
   char **rp = res;
-  v = n->head;
-  while (v) {
-    *rp = v->decoded;
-    rp++;
-    v = v->next;
-  }
+  for (cgi_param_t *p = first; p; p = next_param(h, p))
+    *rp++ = (char *)param_value(h, p);
   *rp = NULL;
   return res;
 }
 
 const char *ac_cgi_str(ac_cgi_t *h, const char *key,
                          const char *default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_str(n->head->decoded, default_value);
+  return ac_str(find_value(h, key), default_value);
 }
 
 bool ac_cgi_bool(ac_cgi_t *h, const char *key, bool default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_bool(n->head->decoded, default_value);
+  return ac_bool(find_value(h, key), default_value);
 }
 
 int ac_cgi_int(ac_cgi_t *h, const char *key, int default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_int(n->head->decoded, default_value);
+  return ac_int(find_value(h, key), default_value);
 }
 
 long ac_cgi_long(ac_cgi_t *h, const char *key, long default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_long(n->head->decoded, default_value);
+  return ac_long(find_value(h, key), default_value);
 }
 
 double ac_cgi_double(ac_cgi_t *h, const char *key, double default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_double(n->head->decoded, default_value);
+  return ac_double(find_value(h, key), default_value);
 }
 
 int32_t ac_cgi_int32_t(ac_cgi_t *h, const char *key,
                          int32_t default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_int32_t(n->head->decoded, default_value);
+  return ac_int32_t(find_value(h, key), default_value);
 }
 
 uint32_t ac_cgi_uint32_t(ac_cgi_t *h, const char *key,
                            uint32_t default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_uint32_t(n->head->decoded, default_value);
+  return ac_uint32_t(find_value(h, key), default_value);
 }
 
 int64_t ac_cgi_int64_t(ac_cgi_t *h, const char *key,
                          int64_t default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_int64_t(n->head->decoded, default_value);
+  return ac_int64_t(find_value(h, key), default_value);
 }
 
 uint64_t ac_cgi_uint64_t(ac_cgi_t *h, const char *key,
                            uint64_t default_value) {
-  cgi_node_t *n = cgi_find(key, h->root);
-  if (!n || !n->head)
-    return default_value;
-
-  return ac_uint64_t(n->head->decoded, default_value);
-}
-
-static void add_key_value(ac_cgi_t *h, char *kv) {
-  if (*kv == 0)
-    return;
-  if (*kv == '=')
-    return;
-  char *p = kv;
-  while (*p && *p != '=')
-    p++;
-  char *value = NULL, *decoded = NULL;
-  if (*p == '=') {
-    *p = 0;
-    p++;
-    value = p;
-    decoded = ac_cgi_decode(h->pool, p);
-  }
-  cgi_node_t *n = cgi_find(kv, h->root);
-  if (!n) {
-    n = (cgi_node_t *)ac_pool_alloc(h->pool,
-                                      sizeof(cgi_node_t) + strlen(kv) + 1);
-    strcpy((char *)(n + 1), kv);
-    n->head = n->tail = NULL;
-    cgi_insert(n, &h->root);
-  }
-  if (value) {
-    value_t *v = (value_t *)ac_pool_alloc(h->pool, sizeof(value_t));
-    v->value = value;
-    v->decoded = decoded;
-    v->next = NULL;
-    if (!n->head)
-      n->head = n->tail = v;
-    else {
-      n->tail->next = v;
-      n->tail = v;
-    }
-  }
-}
-
-ac_cgi_t *ac_cgi_init(ac_pool_t *pool, const char *q) {
-  ac_cgi_t *h = (ac_cgi_t *)ac_pool_alloc(pool, sizeof(ac_cgi_t) +
-                                                          (strlen(q) * 2) + 2);
-  h->pool = pool;
-  strcpy((char *)(h + 1), q);
-
-  char *p = (char *)(h + 1);
-  char *p2 = strchr(p, '?');
-  if (p2)
-    p = p2 + 1;
-
-  while (*p) {
-    char *sp = p;
-    while (*p && *p != '&')
-      p++;
-    if (*p == '&') {
-      *p = 0;
-      p++;
-    }
-    add_key_value(h, sp);
-  }
-  return h;
+  return ac_uint64_t(find_value(h, key), default_value);
 }
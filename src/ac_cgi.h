@@ -19,6 +19,8 @@ limitations under the License.
 
 #include "ac_pool.h"
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,15 +29,28 @@ extern "C" {
 struct ac_cgi_s;
 typedef struct ac_cgi_s ac_cgi_t;
 
-/* initialize a cgi object using a pool (no destroy method exists) */
+/* initialize a cgi object using a pool (no destroy method exists).  The
+   query is copied and split into key=value pairs, and a value is decoded
+   the first time that it is read.  Keys are compared ignoring case.  If the
+   pool has a hard or shared limit (see ac_pool_set_limits), this returns
+   NULL when the pool is out of memory, values which can't be decoded read
+   as missing, and the other functions treat a NULL cgi as empty. */
 ac_cgi_t *ac_cgi_init(ac_pool_t *pool, const char *q);
 
+/* like ac_cgi_init, except q is length bytes (and need not be zero
+   terminated) */
+ac_cgi_t *ac_cgi_init_n(ac_pool_t *pool, const char *q, size_t length);
+
 /* get the original cgi query passed to init */
 const char *ac_cgi_query(ac_cgi_t *h);
 
 /* get a NULL terminated array of decoded values from key */
 char **ac_cgi_strs(ac_cgi_t *h, const char *key);
 
+/* get the first decoded value of key (which is key_length bytes) and its
+   length.  ptr is NULL if key isn't found.  The value is zero terminated. */
+ac_strview_t ac_cgi_view(ac_cgi_t *h, const char *key, size_t key_length);
+
 /* get the first decoded string from key as a string */
 const char *ac_cgi_str(ac_cgi_t *h, const char *key,
                          const char *default_value);
@@ -69,6 +84,15 @@ uint64_t ac_cgi_uint64_t(ac_cgi_t *h, const char *key,
 /* decode cgi text */
 char *ac_cgi_decode(ac_pool_t *pool, char *s);
 
+/* decode the length bytes of s into dest (which may be s) and zero terminate
+   it.  dest must have room for length + 1 bytes.  Returns the decoded
+   length. */
+size_t ac_cgi_decode_to(char *dest, const char *s, size_t length);
+
+/* encode s for a query string or form body.  Letters, digits, and -_.~ are
+   kept, a space becomes '+', and any other byte becomes %XX. */
+char *ac_cgi_encode(ac_pool_t *pool, const char *s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,502 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_codec.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef AC_CODEC_ZLIB
+#include <zlib.h>
+#endif
+#ifdef AC_CODEC_ZSTD
+#include <zstd.h>
+#endif
+
+static void *copy_init(bool compress, int level) {
+  (void)compress;
+  (void)level;
+  /* there is no state, but NULL means the init failed */
+  return (void *)&ac_codec_copy;
+}
+
+static int copy_process(void *state, const char **in, size_t *in_length,
+                        char **out, size_t *out_length, bool finish) {
+  (void)state;
+  (void)finish;
+  size_t n = *in_length < *out_length ? *in_length : *out_length;
+  if (n)
+    memcpy(*out, *in, n);
+  *in += n;
+  *in_length -= n;
+  *out += n;
+  *out_length -= n;
+  /* a stream ends wherever the input does */
+  return *in_length ? AC_CODEC_OK : AC_CODEC_END;
+}
+
+static void copy_reset(void *state) { (void)state; }
+
+static void copy_destroy(void *state) { (void)state; }
+
+const ac_codec_method_t ac_codec_copy = {"copy", copy_init, copy_process,
+                                         copy_reset, copy_destroy};
+
+#ifdef AC_CODEC_ZLIB
+typedef struct {
+  z_stream z;
+  bool compress;
+} gzip_t;
+
+static void *gzip_init(bool compress, int level) {
+  gzip_t *g = (gzip_t *)ac_calloc(sizeof(gzip_t));
+  g->compress = compress;
+  int r;
+  /* 16 writes a gzip header, 32 reads either a gzip or a zlib header */
+  if (compress)
+    r = deflateInit2(&g->z, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+                     Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  else
+    r = inflateInit2(&g->z, 15 + 32);
+  if (r != Z_OK) {
+    ac_free(g);
+    return NULL;
+  }
+  return g;
+}
+
+static int gzip_process(void *state, const char **in, size_t *in_length,
+                        char **out, size_t *out_length, bool finish) {
+  gzip_t *g = (gzip_t *)state;
+  /* zlib counts in uInt, so large buffers are done in more than one call */
+  uInt avail_in = *in_length > UINT_MAX ? UINT_MAX : (uInt)*in_length;
+  uInt avail_out = *out_length > UINT_MAX ? UINT_MAX : (uInt)*out_length;
+  g->z.next_in = (Bytef *)*in;
+  g->z.avail_in = avail_in;
+  g->z.next_out = (Bytef *)*out;
+  g->z.avail_out = avail_out;
+  int r;
+  if (g->compress)
+    r = deflate(&g->z, finish ? Z_FINISH : Z_NO_FLUSH);
+  else
+    r = inflate(&g->z, Z_NO_FLUSH);
+  size_t consumed = avail_in - g->z.avail_in;
+  size_t produced = avail_out - g->z.avail_out;
+  *in += consumed;
+  *in_length -= consumed;
+  *out += produced;
+  *out_length -= produced;
+  if (r == Z_STREAM_END)
+    return AC_CODEC_END;
+  if (r == Z_OK || r == Z_BUF_ERROR)
+    return AC_CODEC_OK;
+  return AC_CODEC_ERROR;
+}
+
+static void gzip_reset(void *state) {
+  gzip_t *g = (gzip_t *)state;
+  if (g->compress)
+    deflateReset(&g->z);
+  else
+    inflateReset(&g->z);
+}
+
+static void gzip_destroy(void *state) {
+  gzip_t *g = (gzip_t *)state;
+  if (g->compress)
+    deflateEnd(&g->z);
+  else
+    inflateEnd(&g->z);
+  ac_free(g);
+}
+
+const ac_codec_method_t ac_codec_gzip = {"gzip", gzip_init, gzip_process,
+                                         gzip_reset, gzip_destroy};
+#endif
+
+#ifdef AC_CODEC_ZSTD
+typedef struct {
+  ZSTD_CCtx *c;
+  ZSTD_DCtx *d;
+} zstd_t;
+
+static void *zstd_init(bool compress, int level) {
+  zstd_t *z = (zstd_t *)ac_calloc(sizeof(zstd_t));
+  if (compress) {
+    z->c = ZSTD_createCCtx();
+    if (z->c)
+      ZSTD_CCtx_setParameter(z->c, ZSTD_c_compressionLevel,
+                             level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+  } else
+    z->d = ZSTD_createDCtx();
+  if (!z->c && !z->d) {
+    ac_free(z);
+    return NULL;
+  }
+  return z;
+}
+
+static int zstd_process(void *state, const char **in, size_t *in_length,
+                        char **out, size_t *out_length, bool finish) {
+  zstd_t *z = (zstd_t *)state;
+  ZSTD_inBuffer input = {*in, *in_length, 0};
+  ZSTD_outBuffer output = {*out, *out_length, 0};
+  size_t r;
+  if (z->c)
+    r = ZSTD_compressStream2(z->c, &output, &input,
+                             finish ? ZSTD_e_end : ZSTD_e_continue);
+  else
+    r = ZSTD_decompressStream(z->d, &output, &input);
+  *in += input.pos;
+  *in_length -= input.pos;
+  *out += output.pos;
+  *out_length -= output.pos;
+  if (ZSTD_isError(r))
+    return AC_CODEC_ERROR;
+  /* 0 means the frame is complete and flushed */
+  if (r == 0 && (finish || z->d))
+    return AC_CODEC_END;
+  return AC_CODEC_OK;
+}
+
+static void zstd_reset(void *state) {
+  zstd_t *z = (zstd_t *)state;
+  if (z->c)
+    ZSTD_CCtx_reset(z->c, ZSTD_reset_session_only);
+  else
+    ZSTD_DCtx_reset(z->d, ZSTD_reset_session_only);
+}
+
+static void zstd_destroy(void *state) {
+  zstd_t *z = (zstd_t *)state;
+  ZSTD_freeCCtx(z->c);
+  ZSTD_freeDCtx(z->d);
+  ac_free(z);
+}
+
+const ac_codec_method_t ac_codec_zstd = {"zstd", zstd_init, zstd_process,
+                                         zstd_reset, zstd_destroy};
+#endif
+
+typedef struct {
+  ac_codec_t *h;
+  ac_buffer_t *in;
+  ac_buffer_t *out;
+  void *state;
+  bool done;
+  bool error;
+} ac_codec_block_t;
+
+struct ac_codec_s {
+  const ac_codec_method_t *method;
+  void *state;
+  int level;
+  bool compress;
+  bool error;
+  /* decompressing: the state has reached the end of a stream, compressing:
+     nothing has been written since the last finish */
+  bool ended;
+  /* decompressing: the state is in the middle of a stream */
+  bool in_stream;
+
+  ac_codec_output_f output;
+  void *output_arg;
+  char *chunk;
+  size_t chunk_size;
+  size_t chunk_length;
+
+  /* blocks head..tail-1 (modulo AC_CODEC_MAX_BLOCKS) are being compressed */
+  ac_threaded_pipe_t *pipe;
+  size_t block_size;
+  size_t head, tail;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  ac_codec_block_t blocks[AC_CODEC_MAX_BLOCKS];
+#ifdef _AC_DEBUG_MEMORY_
+  const char *caller;
+#endif
+};
+
+static void *init_state(ac_codec_t *h) {
+  void *state = h->method->init(h->compress, h->level);
+  if (!state)
+    abort();
+  return state;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_codec_t *_ac_codec_init(const ac_codec_method_t *method, bool compress,
+                           int level, const char *caller) {
+  ac_codec_t *h =
+      (ac_codec_t *)_ac_calloc_d(NULL, caller, sizeof(ac_codec_t), false);
+  h->caller = caller;
+#else
+ac_codec_t *_ac_codec_init(const ac_codec_method_t *method, bool compress,
+                           int level) {
+  ac_codec_t *h = (ac_codec_t *)ac_calloc(sizeof(ac_codec_t));
+#endif
+  if (!h || !method)
+    abort();
+  h->method = method;
+  h->compress = compress;
+  h->level = level;
+  h->ended = true;
+  h->chunk_size = AC_CODEC_CHUNK_SIZE;
+  h->state = init_state(h);
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->cond, NULL);
+  return h;
+}
+
+void ac_codec_to_async_buffer(void *arg, const char *data, size_t length) {
+  ac_async_buffer_parse((ac_async_buffer_t *)arg, data, length);
+}
+
+void ac_codec_to_buffer(void *arg, const char *data, size_t length) {
+  ac_buffer_append((ac_buffer_t *)arg, data, length);
+}
+
+void ac_codec_set_output(ac_codec_t *h, ac_codec_output_f output, void *arg) {
+  h->output = output;
+  h->output_arg = arg;
+}
+
+void ac_codec_set_chunk_size(ac_codec_t *h, size_t chunk_size) {
+  if (h->chunk || chunk_size == 0)
+    abort();
+  h->chunk_size = chunk_size;
+}
+
+void ac_codec_set_threaded_pipe(ac_codec_t *h, ac_threaded_pipe_t *pipe,
+                                size_t block_size) {
+  if (!h->compress)
+    return;
+  if (h->pipe || block_size == 0)
+    abort();
+  h->pipe = pipe;
+  h->block_size = block_size;
+  for (size_t i = 0; i < AC_CODEC_MAX_BLOCKS; i++) {
+    ac_codec_block_t *b = h->blocks + i;
+    b->h = h;
+    b->in = ac_buffer_init(block_size);
+    b->out = ac_buffer_init(block_size / 2);
+    /* the state is created when the block is first used */
+  }
+}
+
+static void emit(ac_codec_t *h, const char *data, size_t length) {
+  if (length && h->output)
+    h->output(h->output_arg, data, length);
+}
+
+static void emit_chunk(ac_codec_t *h) {
+  emit(h, h->chunk, h->chunk_length);
+  h->chunk_length = 0;
+}
+
+/* runs the state over the input until it is consumed (or until the end of
+   the stream when finishing), passing on each chunk as it fills */
+static bool process(ac_codec_t *h, const char *in, size_t in_length,
+                    bool finish) {
+  if (!h->chunk)
+    h->chunk = (char *)ac_malloc(h->chunk_size);
+  while (true) {
+    if (!h->compress && h->ended && in_length) {
+      h->method->reset(h->state);
+      h->ended = false;
+    }
+    char *out = h->chunk + h->chunk_length;
+    size_t out_length = h->chunk_size - h->chunk_length;
+    size_t prior_in = in_length, prior_out = out_length;
+    int r = h->method->process(h->state, &in, &in_length, &out, &out_length,
+                               finish);
+    if (r == AC_CODEC_ERROR) {
+      h->error = true;
+      return false;
+    }
+    h->chunk_length = h->chunk_size - out_length;
+    if (!h->compress) {
+      if (prior_in != in_length)
+        h->in_stream = true;
+      if (r == AC_CODEC_END) {
+        h->ended = true;
+        h->in_stream = false;
+      }
+    }
+    if (out_length == 0)
+      emit_chunk(h);
+    else if (finish ? (r == AC_CODEC_END || !h->compress) : in_length == 0)
+      break;
+    else if (prior_in == in_length && prior_out == out_length)
+      /* the codec can't make progress with the space it has */
+      break;
+  }
+  return true;
+}
+
+static void compress_block(void *global_arg, void *thread_arg, void *object,
+                           void *arg) {
+  (void)global_arg;
+  (void)thread_arg;
+  ac_codec_block_t *b = (ac_codec_block_t *)object;
+  ac_codec_t *h = (ac_codec_t *)arg;
+  const char *in = ac_buffer_data(b->in);
+  size_t in_length = ac_buffer_length(b->in);
+  size_t step = in_length / 4 + 1024;
+  ac_buffer_clear(b->out);
+  while (true) {
+    char *out = (char *)ac_buffer_append_alloc(b->out, step);
+    size_t out_length = step;
+    int r = h->method->process(b->state, &in, &in_length, &out, &out_length,
+                               true);
+    ac_buffer_shrink_by(b->out, out_length);
+    if (r == AC_CODEC_END)
+      break;
+    if (r == AC_CODEC_ERROR || out_length == step) {
+      b->error = true;
+      break;
+    }
+  }
+  h->method->reset(b->state);
+
+  pthread_mutex_lock(&h->mutex);
+  b->done = true;
+  pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+}
+
+static void submit_block(ac_codec_t *h) {
+  ac_codec_block_t *b = h->blocks + (h->tail % AC_CODEC_MAX_BLOCKS);
+  if (!b->state)
+    b->state = init_state(h);
+  b->done = false;
+  b->error = false;
+  h->tail++;
+  h->ended = false;
+  if (!ac_threaded_pipe_write(h->pipe, compress_block, b, h))
+    compress_block(NULL, NULL, b, h);
+}
+
+/* passes on the output of the first block in flight, waiting for it if
+   wait is true.  Returns false if it wasn't done. */
+static bool finish_block(ac_codec_t *h, bool wait) {
+  ac_codec_block_t *b = h->blocks + (h->head % AC_CODEC_MAX_BLOCKS);
+  pthread_mutex_lock(&h->mutex);
+  while (wait && !b->done)
+    pthread_cond_wait(&h->cond, &h->mutex);
+  bool done = b->done;
+  pthread_mutex_unlock(&h->mutex);
+  if (!done)
+    return false;
+  if (b->error)
+    h->error = true;
+  else
+    emit(h, ac_buffer_data(b->out), ac_buffer_length(b->out));
+  ac_buffer_clear(b->in);
+  h->head++;
+  return true;
+}
+
+static bool write_blocks(ac_codec_t *h, const char *data, size_t length) {
+  while (length) {
+    if (h->tail - h->head == AC_CODEC_MAX_BLOCKS)
+      finish_block(h, true);
+    ac_buffer_t *in = h->blocks[h->tail % AC_CODEC_MAX_BLOCKS].in;
+    size_t n = h->block_size - ac_buffer_length(in);
+    if (n > length)
+      n = length;
+    ac_buffer_append(in, data, n);
+    data += n;
+    length -= n;
+    if (ac_buffer_length(in) == h->block_size)
+      submit_block(h);
+  }
+  while (h->head != h->tail && finish_block(h, false))
+    ;
+  return !h->error;
+}
+
+static bool finish_blocks(ac_codec_t *h) {
+  ac_buffer_t *in = h->blocks[h->tail % AC_CODEC_MAX_BLOCKS].in;
+  /* an empty stream is still written as one (empty) block */
+  if (ac_buffer_length(in) || h->ended) {
+    if (h->tail - h->head == AC_CODEC_MAX_BLOCKS)
+      finish_block(h, true);
+    submit_block(h);
+  }
+  while (h->head != h->tail)
+    finish_block(h, true);
+  h->ended = true;
+  return !h->error;
+}
+
+bool ac_codec_write(ac_codec_t *h, const void *data, size_t length) {
+  if (h->error)
+    return false;
+  if (h->pipe)
+    return write_blocks(h, (const char *)data, length);
+  if (h->compress)
+    h->ended = false;
+  bool r = process(h, (const char *)data, length, false);
+  emit_chunk(h);
+  return r;
+}
+
+bool ac_codec_finish(ac_codec_t *h) {
+  if (h->error)
+    return false;
+  if (h->pipe)
+    return finish_blocks(h);
+  bool r = process(h, NULL, 0, true);
+  emit_chunk(h);
+  if (h->compress || h->in_stream) {
+    /* a truncated stream is discarded */
+    if (h->in_stream)
+      r = false;
+    h->method->reset(h->state);
+    h->in_stream = false;
+  }
+  h->ended = true;
+  return r;
+}
+
+void ac_codec_destroy(ac_codec_t *h) {
+  if (h->pipe) {
+    /* wait for any blocks in flight (if the stream wasn't finished) */
+    pthread_mutex_lock(&h->mutex);
+    for (; h->head != h->tail; h->head++) {
+      ac_codec_block_t *b = h->blocks + (h->head % AC_CODEC_MAX_BLOCKS);
+      while (!b->done)
+        pthread_cond_wait(&h->cond, &h->mutex);
+    }
+    pthread_mutex_unlock(&h->mutex);
+    for (size_t i = 0; i < AC_CODEC_MAX_BLOCKS; i++) {
+      ac_codec_block_t *b = h->blocks + i;
+      if (b->state)
+        h->method->destroy(b->state);
+      ac_buffer_destroy(b->in);
+      ac_buffer_destroy(b->out);
+    }
+  }
+  h->method->destroy(h->state);
+  if (h->chunk)
+    ac_free(h->chunk);
+  pthread_mutex_destroy(&h->mutex);
+  pthread_cond_destroy(&h->cond);
+  ac_free(h);
+}
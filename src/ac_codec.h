@@ -0,0 +1,135 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_codec_H
+#define _ac_codec_H
+
+#include "ac_allocator.h"
+#include "ac_async_buffer.h"
+#include "ac_buffer.h"
+#include "ac_common.h"
+#include "ac_threaded_pipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_codec_t is a streaming compression (or decompression) stage.  Input is
+  written to it a piece at a time (such as each chunk from an
+  ac_file_reader or a socket) and the output is passed to a callback in
+  chunks, for example straight into ac_async_buffer_parse with
+  ac_codec_to_async_buffer so that records are split as they are
+  decompressed.  The output chunk is allocated once and reused.
+
+  The codec itself is an ac_codec_method_t.  ac_codec_copy (no compression)
+  is always available, ac_codec_gzip is available if AC_CODEC_ZLIB is
+  defined (link with -lz) and ac_codec_zstd if AC_CODEC_ZSTD is defined (link
+  with -lzstd).  Decompressing gzip also reads zlib streams, and
+  concatenated streams (gzip members or zstd frames) are decompressed as one.
+
+  A compressor can compress blocks in parallel on the workers of an
+  ac_threaded_pipe (see ac_codec_set_threaded_pipe).  Each block is
+  compressed as its own stream and the streams are written in order, so
+  the output is a valid stream for any decompressor (like pigz or pzstd).
+*/
+struct ac_codec_s;
+typedef struct ac_codec_s ac_codec_t;
+
+/* the results of ac_codec_method_t.process */
+enum { AC_CODEC_OK = 0, AC_CODEC_END = 1, AC_CODEC_ERROR = -1 };
+
+typedef struct {
+  const char *name;
+  /* level is the compression level (-1 for the default) */
+  void *(*init)(bool compress, int level);
+  /* consumes from *in and writes to *out, advancing both and reducing the
+     lengths.  finish is true when the stream should be ended (compression
+     only).  Returns AC_CODEC_END once a stream is complete (the end of a
+     compressed stream or everything is written after finish),
+     AC_CODEC_ERROR for corrupt input, and AC_CODEC_OK otherwise. */
+  int (*process)(void *state, const char **in, size_t *in_length, char **out,
+                 size_t *out_length, bool finish);
+  /* start a new stream */
+  void (*reset)(void *state);
+  void (*destroy)(void *state);
+} ac_codec_method_t;
+
+extern const ac_codec_method_t ac_codec_copy;
+#ifdef AC_CODEC_ZLIB
+extern const ac_codec_method_t ac_codec_gzip;
+#endif
+#ifdef AC_CODEC_ZSTD
+extern const ac_codec_method_t ac_codec_zstd;
+#endif
+
+#ifndef AC_CODEC_CHUNK_SIZE
+#define AC_CODEC_CHUNK_SIZE (256 * 1024)
+#endif
+
+/* the most blocks being compressed in parallel at once */
+#ifndef AC_CODEC_MAX_BLOCKS
+#define AC_CODEC_MAX_BLOCKS 16
+#endif
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_codec_init(method, compress, level)                                 \
+  _ac_codec_init(method, compress, level, AC_FILE_LINE_MACRO("ac_codec"))
+ac_codec_t *_ac_codec_init(const ac_codec_method_t *method, bool compress,
+                           int level, const char *caller);
+#else
+#define ac_codec_init(method, compress, level)                                 \
+  _ac_codec_init(method, compress, level)
+ac_codec_t *_ac_codec_init(const ac_codec_method_t *method, bool compress,
+                           int level);
+#endif
+
+typedef void (*ac_codec_output_f)(void *arg, const char *data, size_t length);
+
+/* output callbacks which parse the output with an ac_async_buffer_t or
+   append it to an ac_buffer_t (arg) */
+void ac_codec_to_async_buffer(void *arg, const char *data, size_t length);
+void ac_codec_to_buffer(void *arg, const char *data, size_t length);
+
+void ac_codec_set_output(ac_codec_t *h, ac_codec_output_f output, void *arg);
+
+/* the size of the output chunks (before the first write), the output is
+   also passed on at the end of every write */
+void ac_codec_set_chunk_size(ac_codec_t *h, size_t chunk_size);
+
+/* compress blocks of block_size bytes on the workers of pipe (before the
+   first write).  Up to AC_CODEC_MAX_BLOCKS blocks are in flight, the
+   output of each block is passed on by the thread which writes (or
+   finishes) once it and the blocks before it are done.  This is ignored
+   when decompressing. */
+void ac_codec_set_threaded_pipe(ac_codec_t *h, ac_threaded_pipe_t *pipe,
+                                size_t block_size);
+
+/* returns false if the input is corrupt (every later call fails too) */
+bool ac_codec_write(ac_codec_t *h, const void *data, size_t length);
+
+/* ends the stream and passes on the rest of the output.  Returns false if
+   there was an error or if the compressed input ended in the middle of a
+   stream.  The codec can be used for a new stream afterwards. */
+bool ac_codec_finish(ac_codec_t *h);
+
+void ac_codec_destroy(ac_codec_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_columns.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ac_columns_t *ac_columns_init(ac_pool_t *pool, const size_t *widths,
+                              size_t num_columns, size_t size) {
+  ac_columns_t *h = (ac_columns_t *)ac_pool_alloc(pool, sizeof(ac_columns_t));
+  h->pool = pool;
+  h->num_columns = num_columns;
+  h->num_rows = 0;
+  h->size = 0;
+  h->widths = (size_t *)ac_pool_dup(pool, widths, sizeof(size_t) * num_columns);
+  h->columns = (void **)ac_pool_calloc(pool, sizeof(void *) * num_columns);
+  if (size)
+    ac_columns_reserve(h, size);
+  return h;
+}
+
+void ac_columns_reserve(ac_columns_t *h, size_t size) {
+  if (size <= h->size)
+    return;
+  if (size - 1 > UINT32_MAX)
+    abort();
+  for (size_t i = 0; i < h->num_columns; i++) {
+    size_t width = h->widths[i];
+    void *column = ac_pool_aligned_alloc(h->pool, width * size, 64);
+    if (h->num_rows)
+      memcpy(column, h->columns[i], width * h->num_rows);
+    h->columns[i] = column;
+  }
+  h->size = size;
+}
+
+size_t ac_columns_append(ac_columns_t *h, size_t n) {
+  size_t r = h->num_rows;
+  if (r + n > h->size) {
+    size_t size = h->size ? h->size * 2 : 64;
+    if (size < r + n)
+      size = r + n;
+    ac_columns_reserve(h, size);
+  }
+  h->num_rows += n;
+  return r;
+}
+
+#define gather(type)                                                           \
+  {                                                                            \
+    const type *s = (const type *)src;                                         \
+    type *d = (type *)dest;                                                    \
+    for (size_t i = 0; i < n; i++)                                             \
+      d[i] = s[order[i]];                                                      \
+  }
+
+static void gather_column(void *dest, const void *src, size_t width,
+                          const uint32_t *order, size_t n) {
+  switch (width) {
+  case 1:
+    gather(uint8_t);
+    break;
+  case 2:
+    gather(uint16_t);
+    break;
+  case 4:
+    gather(uint32_t);
+    break;
+  case 8:
+    gather(uint64_t);
+    break;
+  default: {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+    for (size_t i = 0; i < n; i++, d += width)
+      memcpy(d, s + order[i] * width, width);
+  }
+  }
+}
+
+void _ac_columns_permute(ac_columns_t *h, const uint32_t *order,
+                         size_t skip) {
+  size_t n = h->num_rows;
+  if (!n)
+    return;
+  size_t max_width = 0;
+  for (size_t i = 0; i < h->num_columns; i++)
+    if (i != skip && h->widths[i] > max_width)
+      max_width = h->widths[i];
+  if (!max_width)
+    return;
+  void *scratch = ac_malloc(max_width * n);
+  if (!scratch)
+    abort();
+  for (size_t i = 0; i < h->num_columns; i++) {
+    if (i == skip)
+      continue;
+    gather_column(scratch, h->columns[i], h->widths[i], order, n);
+    memcpy(h->columns[i], scratch, h->widths[i] * n);
+  }
+  ac_free(scratch);
+}
+
+void ac_columns_permute(ac_columns_t *h, const uint32_t *order) {
+  _ac_columns_permute(h, order, (size_t)-1);
+}
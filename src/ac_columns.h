@@ -0,0 +1,113 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_columns_H
+#define _ac_columns_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+#include "ac_radix_sort.h"
+#include "ac_sort.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_columns_t is a table stored as a structure of arrays.  Each column is an
+  array of fixed width values allocated from a pool, and row i is made up of
+  the ith value of every column.  Sorting or searching by a key column only
+  touches that column, where ac_sort_m over an array of structures moves
+  whole records through the cache.
+
+  Sorting the table sorts (key, row) pairs for the key column into a
+  permutation and then gathers every column through the permutation.  The
+  permutation can also be computed without being applied, such as to sort
+  several tables the same way or to keep the table in its original order.
+
+  The table and its columns are allocated from the pool and are freed when
+  the pool is cleared or destroyed.  A column moves when the table grows, so
+  the pointer from ac_columns_get should be fetched again after
+  ac_columns_append or ac_columns_reserve.  Rows are indexed by uint32_t.
+*/
+typedef struct {
+  ac_pool_t *pool;
+  void **columns;
+  size_t *widths;
+  size_t num_columns;
+  size_t num_rows;
+  size_t size;
+} ac_columns_t;
+
+/* widths are the sizes in bytes of the values of each column, size is the
+   number of rows to reserve room for (it can be 0) */
+ac_columns_t *ac_columns_init(ac_pool_t *pool, const size_t *widths,
+                              size_t num_columns, size_t size);
+
+/* makes room for at least size rows */
+void ac_columns_reserve(ac_columns_t *h, size_t size);
+
+/* adds n uninitialized rows and returns the index of the first one */
+size_t ac_columns_append(ac_columns_t *h, size_t n);
+
+/* removes all of the rows (keeping the columns) */
+static inline void ac_columns_clear(ac_columns_t *h);
+
+static inline size_t ac_columns_rows(ac_columns_t *h);
+
+/* the values of a column (cast to the column's type) */
+static inline void *ac_columns_get(ac_columns_t *h, size_t column);
+
+/* reorders every column so that new row i is old row order[i].  order must
+   be a permutation of 0..num_rows.  Each column is gathered into a scratch
+   array (allocated with ac_malloc) and copied back. */
+void ac_columns_permute(ac_columns_t *h, const uint32_t *order);
+
+/*
+  Sort macros
+  =====================================================================
+
+  ac_columns_sort_m(name, keytype, compare)
+    expects: int compare(const keytype *a, const keytype *b);
+    returns: void name(ac_columns_t *h, size_t column);
+             void name_order(ac_columns_t *h, size_t column, uint32_t *order);
+
+  ac_columns_radix_sort_m(name, keytype)
+    returns: void name(ac_columns_t *h, size_t column);
+             void name_order(ac_columns_t *h, size_t column, uint32_t *order);
+
+  name sorts every column of the table by the values of column (which must
+  be of keytype).  name_order fills order (num_rows entries) with the
+  permutation which sorts the table without changing it, it can be passed
+  to ac_columns_permute.  The radix version uses ac_radix_sort_m, keytype
+  must be an unsigned integer (use the ac_radix_*_key helpers to fill a key
+  column for signed and floating point values).  Neither sort is stable.
+  The (key, row) pairs are allocated with ac_malloc.
+
+  Once sorted, the key column is a plain array which can be searched with
+  the functions created by ac_search_m or ac_eytzinger_m.
+*/
+
+#include "impl/ac_columns.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
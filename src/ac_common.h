@@ -42,6 +42,29 @@ Snapshots are saved in increasing intervals.
    _AC_DEBUG_MEMORY_ is defined as a string (and not NULL). */
 #define _AC_DEBUG_MEMORY_SPEED_ 60
 
+/* Defining _AC_DEBUG_MEMORY_SAMPLE_ as N will only track 1 in N allocations
+   (and allocations of at least _AC_DEBUG_MEMORY_SAMPLE_BYTES_ bytes).  This
+   is meant for leaving _AC_DEBUG_MEMORY_ on in production.  See
+   ac_allocator_set_sampling. */
+// #define _AC_DEBUG_MEMORY_SAMPLE_ 100
+#ifndef _AC_DEBUG_MEMORY_SAMPLE_BYTES_
+#define _AC_DEBUG_MEMORY_SAMPLE_BYTES_ 0
+#endif
+
+/* Defining _AC_DEBUG_MEMORY_TRACE_ as a filename records every allocation and
+   free to the file for bench/alloc_replay.  See ac_allocator_record. */
+// #define _AC_DEBUG_MEMORY_TRACE_ "memory.trace"
+
+/* bench/calibrate measures sort cutoffs and pool sizes on the machine it runs
+   on and writes them to a header (make tuning in bench writes
+   src/ac_tuning.h).  Defining AC_TUNING_H as the name of the header, such as
+   -DAC_TUNING_H='"ac_tuning.h"', makes the library use those constants in
+   place of the defaults.  Makefile.include does this when src/ac_tuning.h
+   exists. */
+#ifdef AC_TUNING_H
+#include AC_TUNING_H
+#endif
+
 /*
   Given an address of a member of a structure, the base object type, and the
   field name, return the address of the base structure.
@@ -49,6 +72,33 @@ Snapshots are saved in increasing intervals.
 #define ac_parent_object(addr, base_type, field)                               \
   (base_type *)((char *)addr - offsetof(base_type, field))
 
+/*
+  A string which is not necessarily zero terminated, such as a slice of a
+  network buffer.  Functions which can work on a slice in place take a
+  pointer and a length and end in _n (ac_int_n, ac_cgi_init_n, ...).
+*/
+typedef struct {
+  const char *ptr;
+  size_t len;
+} ac_strview_t;
+
+static inline ac_strview_t ac_strview(const char *ptr, size_t len) {
+  ac_strview_t r;
+  r.ptr = ptr;
+  r.len = len;
+  return r;
+}
+
+/* branch hints for fast paths whose slow path is rare (such as a pool
+   growing), the compiler moves the unlikely branch out of the way */
+#if defined(__GNUC__) || defined(__clang__)
+#define ac_likely(x) __builtin_expect(!!(x), 1)
+#define ac_unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define ac_likely(x) (x)
+#define ac_unlikely(x) (x)
+#endif
+
 #define AC_STRINGIZE2(x) #x
 #define AC_STRINGIZE(x) AC_STRINGIZE2(x)
 #define __AC_FILE_LINE__ __FILE__ ":" AC_STRINGIZE(__LINE__)
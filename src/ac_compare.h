@@ -0,0 +1,100 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_compare_H
+#define _ac_compare_H
+
+#include "ac_common.h"
+#include "ac_map.h"
+#include "ac_search.h"
+#include "ac_sort.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Comparators for common keys
+  =====================================================================
+
+  The sort, search, and map macros take a compare function, and most of
+  them compare a number, a string, or a fixed number of bytes.  These
+  comparators are static inline, so the generated functions inline the
+  compare completely (numbers compare without a branch as
+  (a > b) - (a < b)).  Floating point keys must not be NaN.
+
+  kind / type: int32 / int32_t, uint32 / uint32_t, int64 / int64_t,
+               uint64 / uint64_t, float / float, double / double,
+               str / char * (compared with strcmp)
+
+  int ac_compare_<kind>(const type *a, const type *b);
+    compares two elements of an array of type (such as for ac_sort_m)
+
+  ac_compare_field_m(name, datatype, field, kind)
+    returns: int name(const datatype *a, const datatype *b);
+    compares a->field and b->field (for sorts and map inserts)
+
+  ac_compare_key_m(name, datatype, field, kind)
+    returns: int name(const keytype *key, const datatype *v);
+    compares a key with v->field (for searches and map finds), where keytype
+    is type for numbers and char for str (the key is the string)
+
+  ac_compare_mem_field_m(name, datatype, field, length)
+  ac_compare_mem_key_m(name, datatype, field, length)
+    the same for keys which are length bytes compared with memcmp (field may
+    be an array or a pointer, keytype is char)
+
+  Typed generators
+  =====================================================================
+
+  ac_sort_<kind>_m(name)
+    returns: void name(type *base, size_t num_elements);
+
+  ac_sort_by_m(name, datatype, field, kind)
+    returns: void name(datatype *base, size_t num_elements);
+
+  ac_search_by_m(name, datatype, field, kind)
+  ac_search_lower_bound_by_m(name, datatype, field, kind)
+    returns: datatype *name(keytype *key, datatype *base,
+                            size_t num_elements);
+
+  ac_map_find_by_m(name, datatype, field, kind)
+  ac_map_lower_bound_by_m(name, datatype, field, kind)
+    returns: datatype *name(const keytype *key, const ac_map_t *root);
+
+  ac_map_insert_by_m(name, datatype, field, kind)
+  ac_multimap_insert_by_m(name, datatype, field, kind)
+    returns: bool name(datatype *node, ac_map_t **root);
+
+  ac_map_find_str_m(name, datatype, field)
+  ac_map_insert_str_m(name, datatype, field)
+    shorthand for the str kind, the most common map key
+
+  Each generator also defines the comparator it uses as name_compare.  The
+  map generators expect the ac_map_t to be the first member of datatype,
+  like ac_map_find_m.
+*/
+
+#include "impl/ac_compare.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
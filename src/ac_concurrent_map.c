@@ -0,0 +1,88 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_concurrent_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void ac_concurrent_map_init(ac_concurrent_map_t *m, ac_epoch_t *epoch) {
+  m->root = NULL;
+  m->epoch = epoch;
+  m->node_size = 0;
+  m->retired = NULL;
+  m->num_retired = 0;
+  m->retired_size = 0;
+  pthread_mutex_init(&m->mutex, NULL);
+}
+
+static void free_nodes(ac_map_t *n) {
+  while (n) {
+    free_nodes(n->left);
+    ac_map_t *right = n->right;
+    ac_free(n);
+    n = right;
+  }
+}
+
+void ac_concurrent_map_destroy(ac_concurrent_map_t *m) {
+  free_nodes(m->root);
+  m->root = NULL;
+  if (m->retired)
+    ac_free(m->retired);
+  m->retired = NULL;
+  pthread_mutex_destroy(&m->mutex);
+}
+
+ac_map_t *_ac_concurrent_map_dup(const ac_map_t *n, size_t size) {
+  ac_map_t *r = (ac_map_t *)ac_malloc(size);
+  if (!r)
+    abort();
+  memcpy(r, n, size);
+  return r;
+}
+
+void _ac_concurrent_map_retire(ac_concurrent_map_t *m, ac_map_t *n) {
+  if (m->num_retired == m->retired_size) {
+    size_t size = m->retired_size ? m->retired_size * 2 : 64;
+    ac_map_t **r = (ac_map_t **)ac_malloc(sizeof(ac_map_t *) * size);
+    if (!r)
+      abort();
+    if (m->num_retired)
+      memcpy(r, m->retired, sizeof(ac_map_t *) * m->num_retired);
+    if (m->retired)
+      ac_free(m->retired);
+    m->retired = r;
+    m->retired_size = size;
+  }
+  m->retired[m->num_retired++] = n;
+}
+
+ac_map_t *_ac_concurrent_map_copy(ac_map_t *n, void *arg) {
+  ac_concurrent_map_t *m = (ac_concurrent_map_t *)arg;
+  _ac_concurrent_map_retire(m, n);
+  return _ac_concurrent_map_dup(n, m->node_size);
+}
+
+void _ac_concurrent_map_publish(ac_concurrent_map_t *m, ac_map_t *root) {
+  __atomic_store_n(&m->root, root, __ATOMIC_RELEASE);
+  /* the old nodes are unreachable from the new root, so they can be retired
+     (readers which loaded the old root are covered by the epoch) */
+  for (size_t i = 0; i < m->num_retired; i++)
+    ac_epoch_retire(m->epoch, m->retired[i], NULL, NULL);
+  m->num_retired = 0;
+  pthread_mutex_unlock(&m->mutex);
+}
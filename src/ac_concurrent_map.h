@@ -0,0 +1,88 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_concurrent_map_H
+#define _ac_concurrent_map_H
+
+#include "ac_epoch.h"
+#include "ac_map.h"
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_concurrent_map_t is a map which can be read by many threads without a
+  lock while writes are serialized by a mutex.  It is built on the persistent
+  (path copying) functions of ac_map.  A write copies the path to the changed
+  node, publishes the new root, and retires the replaced nodes to an
+  ac_epoch_t.  A reader loads the root with ac_concurrent_map_root and uses
+  the normal find macros (ac_map_find_m, ac_map_lower_bound_m, ...) or
+  ac_map_persistent_first/next on it.
+
+  Readers must be registered with the epoch and must not keep a node past
+  their next quiescent state.  The workers of an ac_threaded_pipe which has
+  been given the epoch (ac_threaded_pipe_set_epoch) are quiescent between
+  tasks, so a task can look up nodes and use them until it returns.
+
+  The map owns its nodes.  Insert copies the given structure into a node
+  allocated with ac_malloc and the nodes are freed with ac_free once they are
+  retired and no reader can see them.  Because nodes are copied, the ac_map_t
+  must be the first member of the structure and anything that the structure
+  points to must outlive the map (or be immutable and freed by other means).
+
+  ac_concurrent_map_insert_m(name, datatype, compare)
+    expects: int compare(datatype *node_to_insert, datatype *value);
+    returns: bool name(ac_concurrent_map_t *m, const datatype *d);
+    inserts a copy of d (replacing the node with the same key), returns false
+    if a node was replaced.
+
+  ac_concurrent_map_erase_m(name, keytype, datatype, compare)
+    expects: int compare(const keytype *key, const datatype *value);
+    returns: bool name(ac_concurrent_map_t *m, const keytype *key);
+    returns false if the key wasn't found.
+*/
+typedef struct {
+  ac_map_t *root;
+  ac_epoch_t *epoch;
+  pthread_mutex_t mutex;
+  /* the size of the nodes which are copied (set by the macros) */
+  size_t node_size;
+  /* the nodes replaced by the write in progress, they are retired once the
+     new root is published */
+  ac_map_t **retired;
+  size_t num_retired;
+  size_t retired_size;
+} ac_concurrent_map_t;
+
+void ac_concurrent_map_init(ac_concurrent_map_t *m, ac_epoch_t *epoch);
+
+/* frees the nodes in the map, no thread may be reading it */
+void ac_concurrent_map_destroy(ac_concurrent_map_t *m);
+
+static inline ac_map_t *ac_concurrent_map_root(ac_concurrent_map_t *m) {
+  return __atomic_load_n(&m->root, __ATOMIC_ACQUIRE);
+}
+
+#include "impl/ac_concurrent_map.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,29 +28,51 @@ extern "C" {
 /* returns value if value is not NULL, otherwise default_value */
 const char *ac_str(const char *value, const char *default_value);
 
+/*
+  The numeric conversions skip leading white space, accept an optional sign,
+  and ignore anything after the number.  default_value is returned if value
+  is NULL, there is no number, or an integer doesn't fit in the type (a
+  negative number is not valid for an unsigned type).  A double which is
+  too large is +/-inf (as with strtod).  The parsers don't depend upon the
+  locale and the doubles are correctly rounded.
+
+  The _n variants parse at most length bytes of value (which doesn't need to
+  be zero terminated).
+*/
+
 /* returns bool if value is not NULL and valid, otherwise default_value */
 bool ac_bool(const char *value, bool default_value);
+bool ac_bool_n(const char *value, size_t length, bool default_value);
 
 /* returns int if value is not NULL and valid, otherwise default_value */
 int ac_int(const char *value, int default_value);
+int ac_int_n(const char *value, size_t length, int default_value);
 
 /* returns long if value is not NULL and valid, otherwise default_value */
 long ac_long(const char *value, long default_value);
+long ac_long_n(const char *value, size_t length, long default_value);
 
 /* returns double if value is not NULL and valid, otherwise default_value */
 double ac_double(const char *value, double default_value);
+double ac_double_n(const char *value, size_t length, double default_value);
 
 /* returns int32_t if value is not NULL and valid, otherwise default_value */
 int32_t ac_int32_t(const char *value, int32_t default_value);
+int32_t ac_int32_t_n(const char *value, size_t length, int32_t default_value);
 
 /* returns uint32_t if value is not NULL and valid, otherwise default_value */
 uint32_t ac_uint32_t(const char *value, uint32_t default_value);
+uint32_t ac_uint32_t_n(const char *value, size_t length,
+                       uint32_t default_value);
 
 /* returns int64_t if value is not NULL and valid, otherwise default_value */
 int64_t ac_int64_t(const char *value, int64_t default_value);
+int64_t ac_int64_t_n(const char *value, size_t length, int64_t default_value);
 
 /* returns uint64_t if value is not NULL and valid, otherwise default_value */
 uint64_t ac_uint64_t(const char *value, uint64_t default_value);
+uint64_t ac_uint64_t_n(const char *value, size_t length,
+                       uint64_t default_value);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,158 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_coroutine_H
+#define _ac_coroutine_H
+
+#include "ac_common.h"
+#include "ac_threaded_pipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_co_t is a stackless coroutine (in the style of protothreads) which lets a
+  chain of callbacks be written as one function.  The coroutine is a structure
+  (usually the first member of a request) which is passed to its function
+  every time it is resumed.  The function returns false when it suspends and
+  true when it is finished.
+
+    typedef struct {
+      ac_co_t co;
+      int n;
+    } request_t;
+
+    static bool handle(ac_co_t *co) {
+      request_t *r = (request_t *)co;
+      ac_co_begin(co);
+      ac_co_await_job(co, pipe, parse, r, NULL);
+      r->n = (int)(intptr_t)co->result;
+      ...
+      ac_co_end(co);
+    }
+
+  Local variables do not survive a suspension, state which is needed after an
+  await must live in the structure.  An ac_co_ macro which suspends can't be
+  used inside of a switch statement within the coroutine.
+
+  A coroutine is resumed through its post function, which must defer the
+  resume to the thread (or loop) that the coroutine runs on rather than
+  calling it directly.  ac_coroutine_uv.h posts to a libuv loop through an
+  ac_object_pipe.  Awaiting a job or being woken doesn't allocate, the
+  coroutine itself carries the job and its result.
+*/
+struct ac_co_s;
+typedef struct ac_co_s ac_co_t;
+
+/* returns true when the coroutine is finished */
+typedef bool (*ac_co_f)(ac_co_t *co);
+
+/* schedule ac_co_resume(co) on the coroutine's own thread */
+typedef void (*ac_co_post_f)(void *post_arg, ac_co_t *co);
+
+struct ac_co_s {
+  int line;
+  ac_co_f fn;
+  ac_co_post_f post;
+  void *post_arg;
+  /* the job of ac_co_await_job */
+  ac_threaded_pipe_job_f job;
+  void *object;
+  void *arg;
+  /* the result of the last await */
+  void *result;
+  /* the jobs of ac_co_await_all which haven't finished */
+  size_t pending;
+};
+
+/* one of the jobs of ac_co_await_all, result is set once it finishes */
+typedef struct {
+  ac_co_t *co;
+  ac_threaded_pipe_job_f job;
+  void *object;
+  void *arg;
+  void *result;
+} ac_co_job_t;
+
+static inline void ac_co_init(ac_co_t *co, ac_co_f fn, ac_co_post_f post,
+                              void *post_arg);
+
+/* run the coroutine until it suspends, returns true if it finished */
+static inline bool ac_co_resume(ac_co_t *co);
+
+/* true if the coroutine has finished */
+static inline bool ac_co_done(ac_co_t *co);
+
+/* resume a coroutine which is suspended in ac_co_await (from any thread),
+   result becomes co->result */
+static inline void ac_co_wake(ac_co_t *co, void *result);
+
+#define ac_co_begin(co)                                                        \
+  switch ((co)->line) {                                                        \
+  case 0:
+
+#define ac_co_end(co)                                                          \
+  }                                                                            \
+  (co)->line = -1;                                                             \
+  return true
+
+/* suspend until ac_co_wake is called */
+#define ac_co_await(co)                                                        \
+  do {                                                                         \
+    (co)->line = __LINE__;                                                     \
+    return false;                                                              \
+  case __LINE__:;                                                              \
+  } while (0)
+
+/* let the rest of the loop run before continuing */
+#define ac_co_yield(co)                                                        \
+  do {                                                                         \
+    (co)->line = __LINE__;                                                     \
+    (co)->post((co)->post_arg, co);                                            \
+    return false;                                                              \
+  case __LINE__:;                                                              \
+  } while (0)
+
+/* run job(global_arg, thread_arg, object, arg) on a worker of pipe and
+   continue with its return value in co->result (NULL if the pipe is closed) */
+#define ac_co_await_job(co, pipe, job, object, arg)                            \
+  do {                                                                         \
+    (co)->line = __LINE__;                                                     \
+    if (!_ac_co_write_job(co, pipe, job, object, arg))                         \
+      break;                                                                   \
+    return false;                                                              \
+  case __LINE__:;                                                              \
+  } while (0)
+
+/* run num_jobs jobs on the workers of pipe and continue once all of them
+   have finished (each job's result is in jobs[i].result) */
+#define ac_co_await_all(co, pipe, jobs, num_jobs)                              \
+  do {                                                                         \
+    (co)->line = __LINE__;                                                     \
+    if (!_ac_co_write_jobs(co, pipe, jobs, num_jobs))                          \
+      break;                                                                   \
+    return false;                                                              \
+  case __LINE__:;                                                              \
+  } while (0)
+
+#include "impl/ac_coroutine.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_coroutine_uv_H
+#define _ac_coroutine_uv_H
+
+#include "ac_coroutine.h"
+#include "ac_object_pipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Runs coroutines on a libuv loop.  ac_co_uv_open returns an ac_object_pipe
+  which resumes every coroutine written to it on the loop, and ac_co_uv_init
+  makes a coroutine post to that pipe, so a coroutine which awaits a job on
+  an ac_threaded_pipe continues on the loop (not on the worker).
+
+    ac_object_pipe_t *resume = ac_co_uv_open(loop);
+    ac_co_uv_init(&r->co, handle, resume);
+    ac_co_resume(&r->co);
+*/
+static inline ac_object_pipe_t *ac_co_uv_open(uv_loop_t *loop);
+
+static inline void ac_co_uv_init(ac_co_t *co, ac_co_f fn,
+                                 ac_object_pipe_t *resume);
+
+static inline void _ac_co_uv_resume(void *arg, void *object) {
+  ac_co_resume((ac_co_t *)object);
+}
+
+static inline void _ac_co_uv_post(void *post_arg, ac_co_t *co) {
+  ac_object_pipe_write((ac_object_pipe_t *)post_arg, co);
+}
+
+static inline ac_object_pipe_t *ac_co_uv_open(uv_loop_t *loop) {
+  return ac_object_pipe_open(loop, _ac_co_uv_resume, NULL);
+}
+
+static inline void ac_co_uv_init(ac_co_t *co, ac_co_f fn,
+                                 ac_object_pipe_t *resume) {
+  ac_co_init(co, fn, _ac_co_uv_post, resume);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,258 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_cpp_H
+#define _ac_cpp_H
+
+/*
+  C++ wrappers around the macro generators
+  =====================================================================
+
+  In C, each use of ac_sort_m and friends is a named instantiation with the
+  compare function as a separate function.  These templates expand the same
+  macros inside a class template whose compare is a member calling the
+  comparator object, so each (type, comparator) pair gets its own copy of
+  the C implementation with the comparator (typically a lambda) inlined.
+
+  Comparators return an int like the C ones (negative, zero, or positive)
+  and take references.  ac::compare<T> uses operator<.  The C code moves
+  elements with memcpy, so T should be trivially copyable.
+
+  template <class T, class Cmp> void ac::sort(T *first, T *last, Cmp cmp);
+  template <class T, class Cmp> void ac::stable_sort(T *first, T *last,
+                                                     Cmp cmp);
+  template <class K, class T, class Cmp>
+    T *ac::find(T *first, T *last, const K &key, Cmp cmp);
+    T *ac::lower_bound(T *first, T *last, const K &key, Cmp cmp);
+    T *ac::upper_bound(T *first, T *last, const K &key, Cmp cmp);
+      (find returns NULL if key isn't found, the bounds return last if there
+       is no such element, cmp is int cmp(const K &key, const T &value))
+
+  template <class T, ac_map_t T::*Node, class Cmp = ac::compare<T> >
+    class ac::map;
+    an intrusive red black tree (ac_map_t) of T through the member Node.
+    Cmp is default constructed and called as cmp(a, b) for two T and as
+    cmp(key, t) for finds (it may have an overload for each key type).  The
+    map doesn't own the objects.
+*/
+
+#ifdef __cplusplus
+
+#include "ac_map.h"
+#include "ac_search.h"
+#include "ac_sort.h"
+#include "ac_sort_stable.h"
+
+#include <cstddef>
+
+namespace ac {
+
+template <class T> struct compare {
+  int operator()(const T &a, const T &b) const {
+    return a < b ? -1 : (b < a ? 1 : 0);
+  }
+};
+
+namespace impl {
+
+/* The macros call compare as a plain function (some of them from static
+   helpers), so the comparator object is reached through a thread local
+   pointer which is set for the duration of each call.  The type of the
+   comparator is known, so its call is still inlined (and a comparator
+   without state never loads the pointer). */
+template <class Cmp> struct scoped_cmp {
+  static thread_local const Cmp *cmp;
+  const Cmp *saved;
+  explicit scoped_cmp(const Cmp &c) : saved(cmp) { cmp = &c; }
+  ~scoped_cmp() { cmp = saved; }
+};
+
+template <class Cmp> thread_local const Cmp *scoped_cmp<Cmp>::cmp = NULL;
+
+template <class T, class Cmp> struct sorter {
+  static inline int compare(const T *a, const T *b) {
+    return (*scoped_cmp<Cmp>::cmp)(*a, *b);
+  }
+  ac_sort_m(sort, T, compare)
+  ac_sort_stable_m(stable_sort, T, compare)
+};
+
+template <class K, class T, class Cmp> struct searcher {
+  static inline int compare(const K *key, const T *v) {
+    return (*scoped_cmp<Cmp>::cmp)(*key, *v);
+  }
+  ac_search_m(find, const K, T, compare)
+  ac_search_lower_bound_m(lower_bound, const K, T, compare)
+  ac_search_upper_bound_m(upper_bound, const K, T, compare)
+};
+
+} // namespace impl
+
+template <class T, class Cmp> inline void sort(T *first, T *last, Cmp cmp) {
+  impl::scoped_cmp<Cmp> scope(cmp);
+  impl::sorter<T, Cmp>().sort(first, last - first);
+}
+
+template <class T> inline void sort(T *first, T *last) {
+  sort(first, last, compare<T>());
+}
+
+template <class T, class Cmp>
+inline void stable_sort(T *first, T *last, Cmp cmp) {
+  impl::scoped_cmp<Cmp> scope(cmp);
+  impl::sorter<T, Cmp>().stable_sort(first, last - first);
+}
+
+template <class T> inline void stable_sort(T *first, T *last) {
+  stable_sort(first, last, compare<T>());
+}
+
+template <class K, class T, class Cmp>
+inline T *find(T *first, T *last, const K &key, Cmp cmp) {
+  impl::scoped_cmp<Cmp> scope(cmp);
+  return impl::searcher<K, T, Cmp>().find(&key, first, last - first);
+}
+
+template <class K, class T, class Cmp>
+inline T *lower_bound(T *first, T *last, const K &key, Cmp cmp) {
+  impl::scoped_cmp<Cmp> scope(cmp);
+  return impl::searcher<K, T, Cmp>().lower_bound(&key, first, last - first);
+}
+
+template <class K, class T, class Cmp>
+inline T *upper_bound(T *first, T *last, const K &key, Cmp cmp) {
+  impl::scoped_cmp<Cmp> scope(cmp);
+  return impl::searcher<K, T, Cmp>().upper_bound(&key, first, last - first);
+}
+
+/* the parameter is declared with the struct tag because ac_map_t carries an
+   alignment attribute, which isn't part of a template argument's type */
+template <class T, struct ac_map_s T::*Node, class Cmp = compare<T> >
+class map {
+public:
+  map() : root_(NULL), size_(0) {}
+
+  /* the object containing the node n */
+  static T *object(const ac_map_t *n) {
+    return n ? reinterpret_cast<T *>(reinterpret_cast<char *>(
+                   const_cast<ac_map_t *>(n)) -
+                                     offset())
+             : NULL;
+  }
+
+  static ac_map_t *node(T *t) { return &(t->*Node); }
+
+  /* returns false (and doesn't insert t) if an equal object is present */
+  bool insert(T *t) {
+    impl::scoped_cmp<Cmp> scope(cmp_);
+    if (!nodes().insert(node(t), &root_))
+      return false;
+    size_++;
+    return true;
+  }
+
+  /* inserts t after any equal objects */
+  void insert_multi(T *t) {
+    impl::scoped_cmp<Cmp> scope(cmp_);
+    nodes().insert_multi(node(t), &root_);
+    size_++;
+  }
+
+  void erase(T *t) {
+    if (ac_map_erase(node(t), &root_))
+      size_--;
+  }
+
+  template <class K> T *find(const K &key) const {
+    impl::scoped_cmp<Cmp> scope(cmp_);
+    return object(keys<K>().find(&key, root_));
+  }
+
+  /* the first object which isn't less than key (or NULL) */
+  template <class K> T *lower_bound(const K &key) const {
+    impl::scoped_cmp<Cmp> scope(cmp_);
+    return object(keys<K>().lower_bound(&key, root_));
+  }
+
+  /* the first object which is greater than key (or NULL) */
+  template <class K> T *upper_bound(const K &key) const {
+    impl::scoped_cmp<Cmp> scope(cmp_);
+    return object(keys<K>().upper_bound(&key, root_));
+  }
+
+  T *first() const { return object(ac_map_first(root_)); }
+  T *last() const { return object(ac_map_last(root_)); }
+  static T *next(T *t) { return object(ac_map_next(node(t))); }
+  static T *previous(T *t) { return object(ac_map_previous(node(t))); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return root_ == NULL; }
+  ac_map_t *root() const { return root_; }
+
+  class iterator {
+  public:
+    explicit iterator(T *t) : t_(t) {}
+    T &operator*() const { return *t_; }
+    T *operator->() const { return t_; }
+    iterator &operator++() {
+      t_ = map::next(t_);
+      return *this;
+    }
+    bool operator==(const iterator &o) const { return t_ == o.t_; }
+    bool operator!=(const iterator &o) const { return t_ != o.t_; }
+
+  private:
+    T *t_;
+  };
+
+  iterator begin() const { return iterator(first()); }
+  iterator end() const { return iterator(NULL); }
+
+private:
+  static size_t offset() {
+    /* no T is constructed, only the address of the member is taken */
+    alignas(T) static char space[sizeof(T)];
+    T *t = reinterpret_cast<T *>(space);
+    return reinterpret_cast<char *>(&(t->*Node)) - space;
+  }
+
+  struct nodes {
+    static inline int compare(const ac_map_t *a, const ac_map_t *b) {
+      return (*impl::scoped_cmp<Cmp>::cmp)(*object(a), *object(b));
+    }
+    ac_map_insert_m(insert, ac_map_t, compare)
+    ac_multimap_insert_m(insert_multi, ac_map_t, compare)
+  };
+
+  template <class K> struct keys {
+    static inline int compare(const K *key, const ac_map_t *n) {
+      return (*impl::scoped_cmp<Cmp>::cmp)(*key, *object(n));
+    }
+    ac_map_find_m(find, K, ac_map_t, compare)
+    ac_map_lower_bound_m(lower_bound, K, ac_map_t, compare)
+    ac_map_upper_bound_m(upper_bound, K, ac_map_t, compare)
+  };
+
+  ac_map_t *root_;
+  size_t size_;
+  Cmp cmp_;
+};
+
+} // namespace ac
+
+#endif
+
+#endif
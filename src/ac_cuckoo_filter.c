@@ -0,0 +1,251 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_cuckoo_filter.h"
+#include "ac_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* each bucket is a uint64_t holding four 16 bit fingerprints, 0 is an
+   empty slot */
+#define SLOTS 4
+#define LANES 0x0001000100010001ULL
+#define HIGH_BITS 0x8000800080008000ULL
+
+/* the saved form is the magic, the number of buckets, the count, and the
+   fingerprint which was kept aside (index << 16 | fingerprint or 0) followed
+   by the buckets */
+static const char cuckoo_magic[8] = {'A', 'C', 'C', 'U', 'C', 'K', 'O', '1'};
+#define HEADER_SIZE 32
+
+struct ac_cuckoo_filter_s {
+  uint64_t *buckets;
+  uint64_t mask;
+  uint64_t count;
+  /* the fingerprint which couldn't be placed and its bucket */
+  uint64_t victim_index;
+  uint16_t victim;
+  uint64_t rng;
+};
+
+static inline uint16_t fingerprint(uint64_t hash) {
+  uint16_t fp = (uint16_t)(hash >> 48);
+  return fp ? fp : 1;
+}
+
+static inline uint64_t alt_index(ac_cuckoo_filter_t *h, uint64_t i,
+                                 uint16_t fp) {
+  return (i ^ ((uint64_t)fp * 0x5bd1e995ULL)) & h->mask;
+}
+
+/* a mask with the high bit of every lane which equals fp set (the lowest set
+   bit is exact, the lanes above it may be a false match) */
+static inline uint64_t match(uint64_t bucket, uint16_t fp) {
+  uint64_t x = bucket ^ (LANES * fp);
+  return (x - LANES) & ~x & HIGH_BITS;
+}
+
+static inline bool bucket_put(uint64_t *b, uint16_t fp) {
+  uint64_t m = match(*b, 0);
+  if (!m)
+    return false;
+  int shift = __builtin_ctzll(m) - 15;
+  *b |= (uint64_t)fp << shift;
+  return true;
+}
+
+static inline bool bucket_remove(uint64_t *b, uint16_t fp) {
+  uint64_t m = match(*b, fp);
+  if (!m)
+    return false;
+  int shift = __builtin_ctzll(m) - 15;
+  *b &= ~(0xFFFFULL << shift);
+  return true;
+}
+
+static inline uint64_t next_random(ac_cuckoo_filter_t *h) {
+  uint64_t x = h->rng;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  h->rng = x;
+  return x;
+}
+
+/* place fp in bucket i or its alternate, displacing other fingerprints to
+   their alternate buckets if both are full */
+static void place(ac_cuckoo_filter_t *h, uint64_t i, uint16_t fp) {
+  if (bucket_put(h->buckets + i, fp))
+    return;
+  i = alt_index(h, i, fp);
+  if (bucket_put(h->buckets + i, fp))
+    return;
+  if (next_random(h) & 1)
+    i = alt_index(h, i, fp);
+  for (int n = 0; n < AC_CUCKOO_FILTER_MAX_KICKS; n++) {
+    int shift = (next_random(h) & (SLOTS - 1)) * 16;
+    uint16_t kicked = (uint16_t)(h->buckets[i] >> shift);
+    h->buckets[i] &= ~(0xFFFFULL << shift);
+    h->buckets[i] |= (uint64_t)fp << shift;
+    fp = kicked;
+    i = alt_index(h, i, fp);
+    if (bucket_put(h->buckets + i, fp))
+      return;
+  }
+  h->victim_index = i;
+  h->victim = fp;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+static ac_cuckoo_filter_t *alloc_filter(uint64_t num_buckets, bool map,
+                                        const char *caller) {
+  size_t len = sizeof(ac_cuckoo_filter_t) + (map ? 0 : num_buckets * 8);
+  ac_cuckoo_filter_t *h =
+      (ac_cuckoo_filter_t *)_ac_malloc_d(NULL, caller, len, false);
+#else
+static ac_cuckoo_filter_t *alloc_filter(uint64_t num_buckets, bool map) {
+  size_t len = sizeof(ac_cuckoo_filter_t) + (map ? 0 : num_buckets * 8);
+  ac_cuckoo_filter_t *h = (ac_cuckoo_filter_t *)ac_malloc(len);
+#endif
+  if (!h)
+    abort();
+  h->buckets = map ? NULL : (uint64_t *)(h + 1);
+  h->mask = num_buckets - 1;
+  h->count = 0;
+  h->victim_index = 0;
+  h->victim = 0;
+  h->rng = 0x9E3779B97F4A7C15ULL;
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_cuckoo_filter_t *_ac_cuckoo_filter_init(size_t expected,
+                                           const char *caller) {
+#else
+ac_cuckoo_filter_t *_ac_cuckoo_filter_init(size_t expected) {
+#endif
+  uint64_t num_buckets = 1;
+  while (num_buckets * SLOTS * 95 / 100 < expected)
+    num_buckets <<= 1;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_cuckoo_filter_t *h = alloc_filter(num_buckets, false, caller);
+#else
+  ac_cuckoo_filter_t *h = alloc_filter(num_buckets, false);
+#endif
+  ac_cuckoo_filter_clear(h);
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_cuckoo_filter_t *_ac_cuckoo_filter_load(const void *data, size_t length,
+                                           bool map, const char *caller) {
+#else
+ac_cuckoo_filter_t *_ac_cuckoo_filter_load(const void *data, size_t length,
+                                           bool map) {
+#endif
+  const char *p = (const char *)data;
+  if (length < HEADER_SIZE || memcmp(p, cuckoo_magic, sizeof(cuckoo_magic)))
+    return NULL;
+  uint64_t header[3];
+  memcpy(header, p + sizeof(cuckoo_magic), sizeof(header));
+  uint64_t num_buckets = header[0];
+  if (!num_buckets || (num_buckets & (num_buckets - 1)) ||
+      num_buckets > (length - HEADER_SIZE) / 8 ||
+      (header[2] >> 16) >= num_buckets)
+    return NULL;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_cuckoo_filter_t *h = alloc_filter(num_buckets, map, caller);
+#else
+  ac_cuckoo_filter_t *h = alloc_filter(num_buckets, map);
+#endif
+  if (map)
+    h->buckets = (uint64_t *)(p + HEADER_SIZE);
+  else
+    memcpy(h->buckets, p + HEADER_SIZE, num_buckets * 8);
+  h->count = header[1];
+  h->victim_index = header[2] >> 16;
+  h->victim = (uint16_t)header[2];
+  return h;
+}
+
+void ac_cuckoo_filter_destroy(ac_cuckoo_filter_t *h) { ac_free(h); }
+
+bool ac_cuckoo_filter_add(ac_cuckoo_filter_t *h, uint64_t hash) {
+  if (h->victim)
+    return false;
+  place(h, hash & h->mask, fingerprint(hash));
+  h->count++;
+  return true;
+}
+
+bool ac_cuckoo_filter_remove(ac_cuckoo_filter_t *h, uint64_t hash) {
+  uint16_t fp = fingerprint(hash);
+  uint64_t i1 = hash & h->mask;
+  uint64_t i2 = alt_index(h, i1, fp);
+  if (h->victim == fp && (h->victim_index == i1 || h->victim_index == i2)) {
+    h->victim = 0;
+    h->count--;
+    return true;
+  }
+  if (!bucket_remove(h->buckets + i1, fp) &&
+      !bucket_remove(h->buckets + i2, fp))
+    return false;
+  h->count--;
+  /* there is room for the fingerprint which was kept aside now */
+  if (h->victim) {
+    uint16_t victim = h->victim;
+    h->victim = 0;
+    place(h, h->victim_index, victim);
+  }
+  return true;
+}
+
+bool ac_cuckoo_filter_maybe_contains(ac_cuckoo_filter_t *h, uint64_t hash) {
+  uint16_t fp = fingerprint(hash);
+  uint64_t i1 = hash & h->mask;
+  uint64_t i2 = alt_index(h, i1, fp);
+  if (match(h->buckets[i1], fp) | match(h->buckets[i2], fp))
+    return true;
+  return h->victim == fp &&
+         (h->victim_index == i1 || h->victim_index == i2);
+}
+
+size_t ac_cuckoo_filter_count(ac_cuckoo_filter_t *h) { return h->count; }
+
+size_t ac_cuckoo_filter_size(ac_cuckoo_filter_t *h) {
+  return (h->mask + 1) * 8;
+}
+
+void ac_cuckoo_filter_clear(ac_cuckoo_filter_t *h) {
+  memset(h->buckets, 0, (h->mask + 1) * 8);
+  h->count = 0;
+  h->victim = 0;
+  h->victim_index = 0;
+}
+
+void ac_cuckoo_filter_save(ac_cuckoo_filter_t *h, ac_buffer_t *bh) {
+  char header[HEADER_SIZE];
+  uint64_t v[3];
+  v[0] = h->mask + 1;
+  v[1] = h->count;
+  v[2] = h->victim ? (h->victim_index << 16) | h->victim : 0;
+  memset(header, 0, sizeof(header));
+  memcpy(header, cuckoo_magic, sizeof(cuckoo_magic));
+  memcpy(header + sizeof(cuckoo_magic), v, sizeof(v));
+  ac_buffer_append(bh, header, sizeof(header));
+  ac_buffer_append(bh, h->buckets, (h->mask + 1) * 8);
+}
@@ -0,0 +1,118 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_cuckoo_filter_H
+#define _ac_cuckoo_filter_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_cuckoo_filter_t answers "definitely not present" like ac_bloom_t, but
+  keys can also be removed.  It stores a 16 bit fingerprint of each key in
+  one of two buckets of four (Fan et al., "Cuckoo Filter: Practically Better
+  Than Bloom").  A bucket is 8 bytes, so a lookup reads at most two words
+  and compares all four fingerprints of a bucket at once.  The false
+  positive rate is about 8 / 65536 (0.012%) at 2 bytes per key when full
+  (filters are sized for 95% occupancy).
+
+  Like ac_bloom_t, the filter works on a 64 bit hash of the key (the low bits
+  select the bucket and the high 16 bits are the fingerprint).  A key must
+  only be removed if it was added (removing a key which wasn't added may
+  remove another key which has the same fingerprint).  Adding the same key
+  twice stores it twice (and it must be removed twice).
+
+  ac_cuckoo_filter_add fails once the filter is too full to place another
+  fingerprint.  The filter keeps every key which was added before that
+  (the last displaced fingerprint is kept aside), so lookups remain
+  correct.
+
+  Filters are saved, loaded, and mapped like ac_bloom_t (a 32 byte header
+  followed by the buckets).  A mapped filter is read only.  Lookups can be
+  made by any number of threads while no thread adds or removes.
+*/
+struct ac_cuckoo_filter_s;
+typedef struct ac_cuckoo_filter_s ac_cuckoo_filter_t;
+
+#ifndef AC_CUCKOO_FILTER_MAX_KICKS
+#define AC_CUCKOO_FILTER_MAX_KICKS 500
+#endif
+
+/* a filter which can hold at least expected keys */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_cuckoo_filter_init(expected)                                        \
+  _ac_cuckoo_filter_init(expected, AC_FILE_LINE_MACRO("ac_cuckoo_filter"))
+ac_cuckoo_filter_t *_ac_cuckoo_filter_init(size_t expected,
+                                           const char *caller);
+#else
+#define ac_cuckoo_filter_init(expected) _ac_cuckoo_filter_init(expected)
+ac_cuckoo_filter_t *_ac_cuckoo_filter_init(size_t expected);
+#endif
+
+/* copy (or map) a filter saved with ac_cuckoo_filter_save, returns NULL if
+   the data isn't a valid filter */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_cuckoo_filter_load(data, length)                                    \
+  _ac_cuckoo_filter_load(data, length, false,                                  \
+                         AC_FILE_LINE_MACRO("ac_cuckoo_filter"))
+#define ac_cuckoo_filter_map(data, length)                                     \
+  _ac_cuckoo_filter_load(data, length, true,                                   \
+                         AC_FILE_LINE_MACRO("ac_cuckoo_filter"))
+ac_cuckoo_filter_t *_ac_cuckoo_filter_load(const void *data, size_t length,
+                                           bool map, const char *caller);
+#else
+#define ac_cuckoo_filter_load(data, length)                                    \
+  _ac_cuckoo_filter_load(data, length, false)
+#define ac_cuckoo_filter_map(data, length)                                     \
+  _ac_cuckoo_filter_load(data, length, true)
+ac_cuckoo_filter_t *_ac_cuckoo_filter_load(const void *data, size_t length,
+                                           bool map);
+#endif
+
+void ac_cuckoo_filter_destroy(ac_cuckoo_filter_t *h);
+
+/* returns false if the filter is full (the key isn't added) */
+bool ac_cuckoo_filter_add(ac_cuckoo_filter_t *h, uint64_t hash);
+
+/* returns false if no key with the hash's fingerprint was in either of its
+   buckets */
+bool ac_cuckoo_filter_remove(ac_cuckoo_filter_t *h, uint64_t hash);
+
+/* false if hash was definitely not added */
+bool ac_cuckoo_filter_maybe_contains(ac_cuckoo_filter_t *h, uint64_t hash);
+
+/* the number of keys in the filter */
+size_t ac_cuckoo_filter_count(ac_cuckoo_filter_t *h);
+
+/* the size of the buckets in bytes */
+size_t ac_cuckoo_filter_size(ac_cuckoo_filter_t *h);
+
+void ac_cuckoo_filter_clear(ac_cuckoo_filter_t *h);
+
+/* append the filter to bh */
+void ac_cuckoo_filter_save(ac_cuckoo_filter_t *h, ac_buffer_t *bh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
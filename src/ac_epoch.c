@@ -0,0 +1,214 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_epoch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* try to reclaim each time this many objects have been retired */
+#define AC_EPOCH_RECLAIM_INTERVAL 64
+
+typedef struct {
+  void *p;
+  ac_epoch_free_f free_cb;
+  void *arg;
+  size_t epoch;
+} ac_epoch_retired_t;
+
+struct ac_epoch_thread_s {
+  ac_epoch_t *e;
+  /* the epoch seen at the last quiescent state, 0 if offline */
+  size_t local;
+  struct ac_epoch_thread_s *next;
+  struct ac_epoch_thread_s *prev;
+};
+
+struct ac_epoch_s {
+  /* the global epoch, it is advanced each time an object is retired */
+  size_t epoch;
+
+  /* everything below is protected by the mutex */
+  pthread_mutex_t mutex;
+  ac_epoch_thread_t *threads;
+  ac_epoch_retired_t *retired;
+  size_t num_retired;
+  size_t retired_size;
+  size_t since_reclaim;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_epoch_t *_ac_epoch_init(const char *caller) {
+  ac_epoch_t *e =
+      (ac_epoch_t *)_ac_malloc_d(NULL, caller, sizeof(ac_epoch_t), false);
+#else
+ac_epoch_t *_ac_epoch_init(void) {
+  ac_epoch_t *e = (ac_epoch_t *)ac_malloc(sizeof(ac_epoch_t));
+#endif
+  if (!e)
+    abort();
+  e->epoch = 1;
+  e->threads = NULL;
+  e->retired = NULL;
+  e->num_retired = 0;
+  e->retired_size = 0;
+  e->since_reclaim = 0;
+  pthread_mutex_init(&e->mutex, NULL);
+  return e;
+}
+
+ac_epoch_thread_t *ac_epoch_register(ac_epoch_t *e) {
+  ac_epoch_thread_t *t =
+      (ac_epoch_thread_t *)ac_malloc(sizeof(ac_epoch_thread_t));
+  if (!t)
+    abort();
+  t->e = e;
+  t->prev = NULL;
+  pthread_mutex_lock(&e->mutex);
+  t->next = e->threads;
+  if (t->next)
+    t->next->prev = t;
+  e->threads = t;
+  pthread_mutex_unlock(&e->mutex);
+  ac_epoch_online(t);
+  return t;
+}
+
+void ac_epoch_unregister(ac_epoch_thread_t *t) {
+  ac_epoch_t *e = t->e;
+  pthread_mutex_lock(&e->mutex);
+  if (t->prev)
+    t->prev->next = t->next;
+  else
+    e->threads = t->next;
+  if (t->next)
+    t->next->prev = t->prev;
+  pthread_mutex_unlock(&e->mutex);
+  ac_free(t);
+}
+
+void ac_epoch_quiescent(ac_epoch_thread_t *t) {
+  __atomic_store_n(&t->local, __atomic_load_n(&t->e->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+  /* the store must be visible before any shared object is read */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void ac_epoch_offline(ac_epoch_thread_t *t) {
+  __atomic_store_n(&t->local, 0, __ATOMIC_RELEASE);
+}
+
+void ac_epoch_online(ac_epoch_thread_t *t) { ac_epoch_quiescent(t); }
+
+static void free_retired(ac_epoch_retired_t *r, size_t num) {
+  for (size_t i = 0; i < num; i++) {
+    if (r[i].free_cb)
+      r[i].free_cb(r[i].arg, r[i].p);
+    else
+      ac_free(r[i].p);
+  }
+}
+
+/* must be called with the lock held, moves the objects which are safe to
+   free into *res */
+static size_t collect_retired(ac_epoch_t *e, ac_epoch_retired_t **res) {
+  *res = NULL;
+  e->since_reclaim = 0;
+  /* an object retired in epoch E is safe once every online thread has
+     observed an epoch after E */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  size_t min = (size_t)-1;
+  for (ac_epoch_thread_t *t = e->threads; t; t = t->next) {
+    size_t local = __atomic_load_n(&t->local, __ATOMIC_SEQ_CST);
+    if (local && local < min)
+      min = local;
+  }
+  /* the objects are retired in epoch order */
+  size_t num = 0;
+  while (num < e->num_retired && e->retired[num].epoch < min)
+    num++;
+  if (!num)
+    return 0;
+  *res = (ac_epoch_retired_t *)ac_malloc(sizeof(ac_epoch_retired_t) * num);
+  if (!*res)
+    abort();
+  memcpy(*res, e->retired, sizeof(ac_epoch_retired_t) * num);
+  e->num_retired -= num;
+  memmove(e->retired, e->retired + num,
+          sizeof(ac_epoch_retired_t) * e->num_retired);
+  return num;
+}
+
+void ac_epoch_retire(ac_epoch_t *e, void *p, ac_epoch_free_f free_cb,
+                     void *arg) {
+  ac_epoch_retired_t *freeable = NULL;
+  size_t num = 0;
+  pthread_mutex_lock(&e->mutex);
+  if (e->num_retired == e->retired_size) {
+    size_t size = e->retired_size ? e->retired_size * 2 : 64;
+    ac_epoch_retired_t *r = (ac_epoch_retired_t *)ac_malloc(
+        sizeof(ac_epoch_retired_t) * size);
+    if (!r)
+      abort();
+    if (e->num_retired)
+      memcpy(r, e->retired, sizeof(ac_epoch_retired_t) * e->num_retired);
+    if (e->retired)
+      ac_free(e->retired);
+    e->retired = r;
+    e->retired_size = size;
+  }
+  ac_epoch_retired_t *r = e->retired + e->num_retired;
+  e->num_retired++;
+  r->p = p;
+  r->free_cb = free_cb;
+  r->arg = arg;
+  r->epoch = __atomic_fetch_add(&e->epoch, 1, __ATOMIC_SEQ_CST);
+  e->since_reclaim++;
+  if (e->since_reclaim >= AC_EPOCH_RECLAIM_INTERVAL)
+    num = collect_retired(e, &freeable);
+  pthread_mutex_unlock(&e->mutex);
+  /* free outside of the lock in case a callback retires more objects */
+  if (num) {
+    free_retired(freeable, num);
+    ac_free(freeable);
+  }
+}
+
+size_t ac_epoch_reclaim(ac_epoch_t *e) {
+  ac_epoch_retired_t *freeable = NULL;
+  pthread_mutex_lock(&e->mutex);
+  size_t num = collect_retired(e, &freeable);
+  pthread_mutex_unlock(&e->mutex);
+  if (num) {
+    free_retired(freeable, num);
+    ac_free(freeable);
+  }
+  return num;
+}
+
+void ac_epoch_destroy(ac_epoch_t *e) {
+  free_retired(e->retired, e->num_retired);
+  if (e->retired)
+    ac_free(e->retired);
+  while (e->threads) {
+    ac_epoch_thread_t *t = e->threads;
+    e->threads = t->next;
+    ac_free(t);
+  }
+  pthread_mutex_destroy(&e->mutex);
+  ac_free(e);
+}
@@ -0,0 +1,85 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_epoch_H
+#define _ac_epoch_H
+
+#include "ac_allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_epoch_t reclaims memory which may still be referenced by readers which
+  don't take a lock (such as the readers of ac_concurrent_map).  A writer
+  unlinks an object and then retires it.  The object is freed once every
+  registered thread has passed through a quiescent state (a point where it
+  holds no references, such as between two tasks) after the object was
+  retired.
+
+  Each reader thread registers itself and calls ac_epoch_quiescent
+  periodically.  A thread which is about to block (waiting for work) should go
+  offline so that it doesn't hold up reclamation and come back online before
+  it reads any shared data.  ac_threaded_pipe does all of this for its worker
+  threads if it is given an epoch with ac_threaded_pipe_set_epoch.
+*/
+struct ac_epoch_s;
+typedef struct ac_epoch_s ac_epoch_t;
+
+struct ac_epoch_thread_s;
+typedef struct ac_epoch_thread_s ac_epoch_thread_t;
+
+typedef void (*ac_epoch_free_f)(void *arg, void *p);
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_epoch_init() _ac_epoch_init(AC_FILE_LINE_MACRO("ac_epoch"))
+ac_epoch_t *_ac_epoch_init(const char *caller);
+#else
+#define ac_epoch_init() _ac_epoch_init()
+ac_epoch_t *_ac_epoch_init(void);
+#endif
+
+/* register the calling thread, the thread starts online */
+ac_epoch_thread_t *ac_epoch_register(ac_epoch_t *e);
+
+/* unregister the thread (it must not reference any shared objects after) */
+void ac_epoch_unregister(ac_epoch_thread_t *t);
+
+/* the thread holds no references to shared objects */
+void ac_epoch_quiescent(ac_epoch_thread_t *t);
+
+/* the thread holds no references until ac_epoch_online is called */
+void ac_epoch_offline(ac_epoch_thread_t *t);
+void ac_epoch_online(ac_epoch_thread_t *t);
+
+/* free p with free_cb(arg, p) (or ac_free if free_cb is NULL) once no thread
+   can reference it.  p must already be unreachable for new readers. */
+void ac_epoch_retire(ac_epoch_t *e, void *p, ac_epoch_free_f free_cb,
+                     void *arg);
+
+/* frees the retired objects which are safe to free and returns how many were
+   freed (this is also done periodically by ac_epoch_retire) */
+size_t ac_epoch_reclaim(ac_epoch_t *e);
+
+/* frees every retired object, no thread may reference them */
+void ac_epoch_destroy(ac_epoch_t *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
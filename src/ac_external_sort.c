@@ -0,0 +1,575 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_external_sort.h"
+#include "ac_async_buffer.h"
+#include "ac_buffer.h"
+#include "ac_file_reader.h"
+#include "ac_pool.h"
+#include "ac_sort.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* size of the reads from input files and the writes to run files */
+#define AC_EXTERNAL_SORT_IO_SIZE (1024 * 1024)
+
+typedef struct {
+  char *data;
+  size_t len;
+} record_t;
+
+typedef struct {
+  ac_pool_t *pool;
+  record_t *records;
+  size_t num_records;
+  size_t size_records;
+} run_buffer_t;
+
+typedef struct {
+  FILE *fp;
+  char *io_buffer;
+  ac_buffer_t *record;
+  bool done;
+} run_reader_t;
+
+/* loser tree over the run readers, tree[0] is the winner and tree[1..n)
+   hold the losers of each match */
+typedef struct {
+  run_reader_t *readers;
+  ssize_t *tree;
+  size_t num_readers;
+  ssize_t last;
+} merge_t;
+
+enum { FRAME_CHAR, FRAME_STRING, FRAME_FIXED };
+
+struct ac_external_sort_s {
+  size_t memory_limit;
+  char *tmp_dir;
+  ac_external_sort_compare_f compare;
+  void *arg;
+
+  /* framing of ac_external_sort_add */
+  ac_async_buffer_t *ab;
+  int framing;
+  char delimiter;
+  char *string_delimiter;
+  size_t delimiter_length;
+  size_t record_size;
+  /* if more bytes were added than were consumed by records, there is a
+     partial record at the end */
+  size_t input_bytes;
+  size_t consumed_bytes;
+
+  /* one buffer is filled while the other is sorted and written */
+  run_buffer_t buffers[2];
+  run_buffer_t *current;
+
+  /* file descriptors of the runs on disk */
+  int *runs;
+  size_t num_runs;
+  size_t size_runs;
+  size_t runs_written;
+  ac_buffer_t *write_buffer;
+
+  pthread_t thread;
+  bool thread_started;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  run_buffer_t *pending;
+  bool quit;
+
+  bool finished;
+  size_t pos;
+  merge_t *merge;
+};
+
+static inline int compare_records(record_t *a, record_t *b, void *arg) {
+  ac_external_sort_t *h = (ac_external_sort_t *)arg;
+  return h->compare(a->data, a->len, b->data, b->len, h->arg);
+}
+
+ac_sort_arg_m(sort_records, record_t, compare_records);
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_external_sort_t *_ac_external_sort_init(size_t memory_limit,
+                                           const char *tmp_dir,
+                                           ac_external_sort_compare_f compare,
+                                           void *arg, const char *caller) {
+  ac_external_sort_t *h = (ac_external_sort_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_external_sort_t), false);
+#else
+ac_external_sort_t *_ac_external_sort_init(size_t memory_limit,
+                                           const char *tmp_dir,
+                                           ac_external_sort_compare_f compare,
+                                           void *arg) {
+  ac_external_sort_t *h =
+      (ac_external_sort_t *)ac_calloc(sizeof(ac_external_sort_t));
+#endif
+  if (!h)
+    abort();
+  if (!tmp_dir)
+    tmp_dir = getenv("TMPDIR");
+  if (!tmp_dir || !tmp_dir[0])
+    tmp_dir = "/tmp";
+  h->tmp_dir = ac_strdup(tmp_dir);
+  h->memory_limit = memory_limit;
+  h->compare = compare;
+  h->arg = arg;
+  h->framing = FRAME_CHAR;
+  h->delimiter = '\n';
+  h->delimiter_length = 1;
+  for (int i = 0; i < 2; i++)
+    h->buffers[i].pool = ac_pool_init(1024 * 1024);
+  h->current = h->buffers;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->cond, NULL);
+  return h;
+}
+
+void ac_external_sort_delimiter(ac_external_sort_t *h, char delimiter) {
+  h->framing = FRAME_CHAR;
+  h->delimiter = delimiter;
+  h->delimiter_length = 1;
+}
+
+void ac_external_sort_delimiter_string(ac_external_sort_t *h,
+                                       const char *delimiter) {
+  if (h->string_delimiter)
+    ac_free(h->string_delimiter);
+  h->framing = FRAME_STRING;
+  h->string_delimiter = ac_strdup(delimiter);
+  h->delimiter_length = strlen(delimiter);
+}
+
+void ac_external_sort_fixed(ac_external_sort_t *h, size_t record_size) {
+  h->framing = FRAME_FIXED;
+  h->record_size = record_size;
+  h->delimiter_length = 0;
+}
+
+static int create_run_file(ac_external_sort_t *h) {
+  size_t len = strlen(h->tmp_dir);
+  char *path = (char *)ac_malloc(len + 32);
+  if (!path)
+    abort();
+  memcpy(path, h->tmp_dir, len);
+  strcpy(path + len, "/ac_external_sort_XXXXXX");
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    fprintf(stderr, "ac_external_sort: unable to create %s\n", path);
+    abort();
+  }
+  unlink(path);
+  ac_free(path);
+  return fd;
+}
+
+static void write_all(int fd, const char *p, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("ac_external_sort");
+      abort();
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+static inline void write_record(ac_external_sort_t *h, int fd,
+                                const void *data, size_t len) {
+  ac_buffer_append(h->write_buffer, &len, sizeof(len));
+  ac_buffer_append(h->write_buffer, data, len);
+  if (ac_buffer_length(h->write_buffer) >= AC_EXTERNAL_SORT_IO_SIZE) {
+    write_all(fd, ac_buffer_data(h->write_buffer),
+              ac_buffer_length(h->write_buffer));
+    ac_buffer_clear(h->write_buffer);
+  }
+}
+
+static void finish_run_file(ac_external_sort_t *h, int fd) {
+  write_all(fd, ac_buffer_data(h->write_buffer),
+            ac_buffer_length(h->write_buffer));
+  ac_buffer_clear(h->write_buffer);
+  pthread_mutex_lock(&h->mutex);
+  if (h->num_runs == h->size_runs) {
+    h->size_runs = h->size_runs ? h->size_runs << 1 : 64;
+    h->runs = (int *)ac_realloc(h->runs, sizeof(int) * h->size_runs);
+    if (!h->runs)
+      abort();
+  }
+  h->runs[h->num_runs] = fd;
+  h->num_runs++;
+  pthread_mutex_unlock(&h->mutex);
+}
+
+static void write_run(ac_external_sort_t *h, run_buffer_t *b) {
+  sort_records(b->records, b->num_records, h);
+  int fd = create_run_file(h);
+  record_t *r = b->records;
+  record_t *ep = r + b->num_records;
+  while (r < ep) {
+    write_record(h, fd, r->data, r->len);
+    r++;
+  }
+  finish_run_file(h, fd);
+  h->runs_written++;
+  ac_pool_clear(b->pool);
+  b->num_records = 0;
+}
+
+static void *run_writer(void *arg) {
+  ac_external_sort_t *h = (ac_external_sort_t *)arg;
+  pthread_mutex_lock(&h->mutex);
+  while (true) {
+    while (!h->pending && !h->quit)
+      pthread_cond_wait(&h->cond, &h->mutex);
+    run_buffer_t *b = h->pending;
+    if (!b)
+      break;
+    pthread_mutex_unlock(&h->mutex);
+    write_run(h, b);
+    pthread_mutex_lock(&h->mutex);
+    h->pending = NULL;
+    pthread_cond_broadcast(&h->cond);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return NULL;
+}
+
+/* hand the current buffer to the writer thread and switch to the other */
+static void spill(ac_external_sort_t *h) {
+  if (!h->thread_started) {
+    h->write_buffer = ac_buffer_init(AC_EXTERNAL_SORT_IO_SIZE + 4096);
+    if (pthread_create(&h->thread, NULL, run_writer, h))
+      abort();
+    h->thread_started = true;
+  }
+  pthread_mutex_lock(&h->mutex);
+  while (h->pending)
+    pthread_cond_wait(&h->cond, &h->mutex);
+  h->pending = h->current;
+  pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+  h->current = h->current == h->buffers ? h->buffers + 1 : h->buffers;
+}
+
+static void stop_writer(ac_external_sort_t *h) {
+  if (!h->thread_started)
+    return;
+  pthread_mutex_lock(&h->mutex);
+  h->quit = true;
+  pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+  pthread_join(h->thread, NULL);
+  h->thread_started = false;
+}
+
+void ac_external_sort_add_record(ac_external_sort_t *h, const void *record,
+                                 size_t len) {
+  run_buffer_t *b = h->current;
+  if (b->num_records &&
+      ac_pool_size(b->pool) + len + (b->num_records + 1) * sizeof(record_t) >
+          h->memory_limit >> 1) {
+    spill(h);
+    b = h->current;
+  }
+  if (b->num_records == b->size_records) {
+    b->size_records = b->size_records ? b->size_records << 1 : 1024;
+    b->records = (record_t *)ac_realloc(b->records,
+                                        sizeof(record_t) * b->size_records);
+    if (!b->records)
+      abort();
+  }
+  record_t *r = b->records + b->num_records;
+  r->data = (char *)ac_pool_udup(b->pool, record, len);
+  r->len = len;
+  b->num_records++;
+}
+
+static void on_record(ac_async_buffer_t *ab);
+
+static int advance(ac_external_sort_t *h) {
+  if (h->framing == FRAME_CHAR)
+    return ac_async_buffer_advance_to_char(h->ab, h->delimiter, on_record);
+  else if (h->framing == FRAME_STRING)
+    return ac_async_buffer_advance_to_mem(h->ab, h->string_delimiter,
+                                          h->delimiter_length, on_record);
+  return ac_async_buffer_advance_bytes(h->ab, h->record_size, on_record);
+}
+
+static void take_records(ac_external_sort_t *h) {
+  do {
+    size_t len = ac_async_buffer_data_length(h->ab);
+    ac_external_sort_add_record(h, ac_async_buffer_data(h->ab), len);
+    h->consumed_bytes += len + h->delimiter_length;
+  } while (advance(h));
+}
+
+static void on_record(ac_async_buffer_t *ab) {
+  take_records((ac_external_sort_t *)ac_async_buffer_get_arg(ab));
+}
+
+void ac_external_sort_add(ac_external_sort_t *h, const void *data,
+                          size_t len) {
+  if (!len)
+    return;
+  if (!h->ab) {
+    h->ab = ac_async_buffer_init();
+    ac_async_buffer_set_arg(h->ab, h);
+    if (advance(h))
+      take_records(h);
+  }
+  h->input_bytes += len;
+  ac_async_buffer_parse(h->ab, data, len);
+}
+
+/* the file is read in mapped chunks (whose pages are released as the reader
+   moves on) so the input doesn't count against the memory limit */
+bool ac_external_sort_add_file(ac_external_sort_t *h, const char *filename) {
+  ac_file_reader_t *r = ac_file_reader_open(filename, AC_EXTERNAL_SORT_IO_SIZE);
+  if (!r)
+    return false;
+  size_t n;
+  char *p;
+  while ((p = ac_file_reader_read(r, &n)))
+    ac_external_sort_add(h, p, n);
+  bool ok = !ac_file_reader_error(r);
+  ac_file_reader_close(r);
+  return ok;
+}
+
+static bool read_next(run_reader_t *r) {
+  size_t len;
+  if (r->done)
+    return false;
+  if (fread(&len, sizeof(len), 1, r->fp) != 1) {
+    r->done = true;
+    return false;
+  }
+  char *p = (char *)ac_buffer_resize(r->record, len);
+  if (len && fread(p, len, 1, r->fp) != 1) {
+    fprintf(stderr, "ac_external_sort: run file is truncated\n");
+    abort();
+  }
+  return true;
+}
+
+/* returns true if run a should be output before run b (-1 is used while the
+   tree is built and beats every run) */
+static inline bool beats(ac_external_sort_t *h, merge_t *m, ssize_t a,
+                         ssize_t b) {
+  if (a == -1)
+    return true;
+  if (b == -1)
+    return false;
+  run_reader_t *ra = m->readers + a;
+  run_reader_t *rb = m->readers + b;
+  if (ra->done)
+    return false;
+  if (rb->done)
+    return true;
+  int n = h->compare(ac_buffer_data(ra->record), ac_buffer_length(ra->record),
+                     ac_buffer_data(rb->record), ac_buffer_length(rb->record),
+                     h->arg);
+  return n < 0 || (n == 0 && a < b);
+}
+
+/* replay the matches from leaf s to the root */
+static void adjust(ac_external_sort_t *h, merge_t *m, ssize_t s) {
+  size_t t = (s + m->num_readers) >> 1;
+  while (t > 0) {
+    if (beats(h, m, m->tree[t], s)) {
+      ssize_t tmp = m->tree[t];
+      m->tree[t] = s;
+      s = tmp;
+    }
+    t >>= 1;
+  }
+  m->tree[0] = s;
+}
+
+static merge_t *merge_init(ac_external_sort_t *h, int *runs,
+                           size_t num_runs) {
+  merge_t *m = (merge_t *)ac_malloc(sizeof(merge_t));
+  if (!m)
+    abort();
+  m->readers = (run_reader_t *)ac_calloc(sizeof(run_reader_t) * num_runs);
+  m->tree = (ssize_t *)ac_malloc(sizeof(ssize_t) * num_runs);
+  if (!m->readers || !m->tree)
+    abort();
+  m->num_readers = num_runs;
+  m->last = -1;
+  /* split the memory limit between the read buffers */
+  size_t io_size = h->memory_limit / num_runs;
+  if (io_size > AC_EXTERNAL_SORT_IO_SIZE)
+    io_size = AC_EXTERNAL_SORT_IO_SIZE;
+  if (io_size < 16384)
+    io_size = 16384;
+  for (size_t i = 0; i < num_runs; i++) {
+    run_reader_t *r = m->readers + i;
+    lseek(runs[i], 0, SEEK_SET);
+    r->fp = fdopen(runs[i], "rb");
+    r->io_buffer = (char *)ac_malloc(io_size);
+    if (!r->fp || !r->io_buffer)
+      abort();
+    setvbuf(r->fp, r->io_buffer, _IOFBF, io_size);
+    r->record = ac_buffer_init(256);
+    read_next(r);
+    m->tree[i] = -1;
+  }
+  for (ssize_t i = num_runs - 1; i >= 0; i--)
+    adjust(h, m, i);
+  return m;
+}
+
+static const void *merge_next(ac_external_sort_t *h, merge_t *m,
+                              size_t *len) {
+  if (m->last != -1) {
+    read_next(m->readers + m->last);
+    adjust(h, m, m->last);
+  }
+  m->last = m->tree[0];
+  run_reader_t *r = m->readers + m->last;
+  if (r->done) {
+    *len = 0;
+    return NULL;
+  }
+  *len = ac_buffer_length(r->record);
+  return ac_buffer_data(r->record);
+}
+
+static void merge_destroy(merge_t *m) {
+  for (size_t i = 0; i < m->num_readers; i++) {
+    run_reader_t *r = m->readers + i;
+    fclose(r->fp);
+    ac_free(r->io_buffer);
+    ac_buffer_destroy(r->record);
+  }
+  ac_free(m->tree);
+  ac_free(m->readers);
+  ac_free(m);
+}
+
+static void finish(ac_external_sort_t *h) {
+  if (h->finished)
+    return;
+  h->finished = true;
+
+  /* a record without a trailing delimiter */
+  if (h->ab && h->input_bytes > h->consumed_bytes) {
+    if (h->framing == FRAME_CHAR)
+      ac_async_buffer_parse(h->ab, &h->delimiter, 1);
+    else if (h->framing == FRAME_STRING)
+      ac_async_buffer_parse(h->ab, h->string_delimiter, h->delimiter_length);
+  }
+
+  if (!h->thread_started) {
+    sort_records(h->current->records, h->current->num_records, h);
+    return;
+  }
+  if (h->current->num_records)
+    spill(h);
+  stop_writer(h);
+  for (int i = 0; i < 2; i++) {
+    run_buffer_t *b = h->buffers + i;
+    ac_pool_destroy(b->pool);
+    b->pool = NULL;
+    if (b->records)
+      ac_free(b->records);
+    b->records = NULL;
+    b->num_records = b->size_records = 0;
+  }
+
+  /* merge the oldest runs into longer runs until they can all be open */
+  size_t start = 0;
+  while (h->num_runs - start > AC_EXTERNAL_SORT_MAX_MERGE) {
+    merge_t *m = merge_init(h, h->runs + start, AC_EXTERNAL_SORT_MAX_MERGE);
+    start += AC_EXTERNAL_SORT_MAX_MERGE;
+    int fd = create_run_file(h);
+    const void *r;
+    size_t len;
+    while ((r = merge_next(h, m, &len)) != NULL)
+      write_record(h, fd, r, len);
+    merge_destroy(m);
+    finish_run_file(h, fd);
+  }
+  h->merge = merge_init(h, h->runs + start, h->num_runs - start);
+}
+
+const void *ac_external_sort_next(ac_external_sort_t *h, size_t *len) {
+  finish(h);
+  if (h->merge)
+    return merge_next(h, h->merge, len);
+  run_buffer_t *b = h->current;
+  if (h->pos >= b->num_records) {
+    *len = 0;
+    return NULL;
+  }
+  record_t *r = b->records + h->pos;
+  h->pos++;
+  *len = r->len;
+  return r->data;
+}
+
+void ac_external_sort_write(ac_external_sort_t *h, FILE *out) {
+  const void *r;
+  size_t len;
+  while ((r = ac_external_sort_next(h, &len)) != NULL) {
+    fwrite(r, len, 1, out);
+    if (h->framing == FRAME_CHAR)
+      fputc(h->delimiter, out);
+    else if (h->framing == FRAME_STRING)
+      fwrite(h->string_delimiter, h->delimiter_length, 1, out);
+  }
+}
+
+size_t ac_external_sort_runs(ac_external_sort_t *h) { return h->runs_written; }
+
+void ac_external_sort_destroy(ac_external_sort_t *h) {
+  stop_writer(h);
+  if (h->merge)
+    merge_destroy(h->merge);
+  else {
+    for (size_t i = 0; i < h->num_runs; i++)
+      close(h->runs[i]);
+  }
+  if (h->runs)
+    ac_free(h->runs);
+  for (int i = 0; i < 2; i++) {
+    if (h->buffers[i].pool)
+      ac_pool_destroy(h->buffers[i].pool);
+    if (h->buffers[i].records)
+      ac_free(h->buffers[i].records);
+  }
+  if (h->write_buffer)
+    ac_buffer_destroy(h->write_buffer);
+  if (h->ab)
+    ac_async_buffer_destroy(h->ab);
+  if (h->string_delimiter)
+    ac_free(h->string_delimiter);
+  pthread_cond_destroy(&h->cond);
+  pthread_mutex_destroy(&h->mutex);
+  ac_free(h->tmp_dir);
+  ac_free(h);
+}
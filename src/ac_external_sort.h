@@ -0,0 +1,127 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_external_sort_H
+#define _ac_external_sort_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_external_sort_t sorts records which may not fit in memory.  Records are
+  collected into a run until the run fills half of the memory limit.  The
+  full run is handed to a background thread which sorts it (with
+  ac_sort_arg_m) and writes it to a temporary file while the next run is
+  collected in the other half.  Once the input is finished, the runs are
+  merged with a loser tree.  If there are more than
+  AC_EXTERNAL_SORT_MAX_MERGE runs, groups of runs are first merged into
+  longer runs so that the number of open files stays bounded.  Input which
+  fits in one run is never written to disk.
+
+  Records are either added one at a time (ac_external_sort_add_record) or as
+  a stream of bytes which is split into records (ac_external_sort_add or
+  ac_external_sort_add_file).  The stream is split with an ac_async_buffer,
+  by default at '\n'.  The delimiter is not part of the record.
+
+  Temporary files are created in tmp_dir (or TMPDIR or /tmp if NULL) and are
+  unlinked as soon as they are opened, so nothing is left behind.  Failing to
+  create or write a temporary file aborts.
+
+  Typical use:
+    ac_external_sort_t *h =
+        ac_external_sort_init(1024 * 1024 * 1024, NULL, compare, NULL);
+    ac_external_sort_add_file(h, "input.txt");
+    ac_external_sort_write(h, stdout);
+    ac_external_sort_destroy(h);
+*/
+
+#ifndef AC_EXTERNAL_SORT_MAX_MERGE
+#define AC_EXTERNAL_SORT_MAX_MERGE 256
+#endif
+
+struct ac_external_sort_s;
+typedef struct ac_external_sort_s ac_external_sort_t;
+
+/* compare two records like memcmp */
+typedef int (*ac_external_sort_compare_f)(const void *a, size_t a_len,
+                                          const void *b, size_t b_len,
+                                          void *arg);
+
+/* memory_limit is the number of bytes used for records and their index
+   (the read buffer of each run file during the merge is extra) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_external_sort_init(memory_limit, tmp_dir, compare, arg)             \
+  _ac_external_sort_init(memory_limit, tmp_dir, compare, arg,                  \
+                         AC_FILE_LINE_MACRO("ac_external_sort"))
+ac_external_sort_t *_ac_external_sort_init(size_t memory_limit,
+                                           const char *tmp_dir,
+                                           ac_external_sort_compare_f compare,
+                                           void *arg, const char *caller);
+#else
+#define ac_external_sort_init(memory_limit, tmp_dir, compare, arg)             \
+  _ac_external_sort_init(memory_limit, tmp_dir, compare, arg)
+ac_external_sort_t *_ac_external_sort_init(size_t memory_limit,
+                                           const char *tmp_dir,
+                                           ac_external_sort_compare_f compare,
+                                           void *arg);
+#endif
+
+void ac_external_sort_destroy(ac_external_sort_t *h);
+
+/* The framing of ac_external_sort_add must be set before adding data.  A
+   record consisting of everything after the last delimiter is added when
+   the input is finished.  For fixed size records, a partial record at the
+   end is dropped. */
+void ac_external_sort_delimiter(ac_external_sort_t *h, char delimiter);
+void ac_external_sort_delimiter_string(ac_external_sort_t *h,
+                                       const char *delimiter);
+void ac_external_sort_fixed(ac_external_sort_t *h, size_t record_size);
+
+/* add a single record */
+void ac_external_sort_add_record(ac_external_sort_t *h, const void *record,
+                                 size_t len);
+
+/* add bytes which are split into records */
+void ac_external_sort_add(ac_external_sort_t *h, const void *data,
+                          size_t len);
+
+/* add the contents of a file (split into records), returns false if the
+   file can't be read */
+bool ac_external_sort_add_file(ac_external_sort_t *h, const char *filename);
+
+/* ac_external_sort_next returns the records in order (after the last one,
+   NULL is returned).  The first call finishes the input.  The record is
+   valid until the next call. */
+const void *ac_external_sort_next(ac_external_sort_t *h, size_t *len);
+
+/* write the remaining records in order, each followed by the delimiter
+   (if any) */
+void ac_external_sort_write(ac_external_sort_t *h, FILE *out);
+
+/* the number of runs which were written to disk */
+size_t ac_external_sort_runs(ac_external_sort_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
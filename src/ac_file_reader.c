@@ -0,0 +1,148 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_file_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ac_file_reader_s {
+  int fd;
+  bool close_fd;
+  bool error;
+  size_t chunk_size;
+  /* the mapping (NULL if the file is read into buf) */
+  char *map;
+  size_t map_length;
+  size_t pos;
+  char *buf;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_file_reader_t *_ac_file_reader_open(const char *filename, size_t chunk_size,
+                                       const char *caller) {
+#else
+ac_file_reader_t *_ac_file_reader_open(const char *filename,
+                                       size_t chunk_size) {
+#endif
+  int fd = 0;
+  bool close_fd = false;
+  if (strcmp(filename, "-")) {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+      return NULL;
+    close_fd = true;
+  }
+#ifdef _AC_DEBUG_MEMORY_
+  ac_file_reader_t *r = (ac_file_reader_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_file_reader_t), false);
+#else
+  ac_file_reader_t *r = (ac_file_reader_t *)ac_calloc(sizeof(ac_file_reader_t));
+#endif
+  r->fd = fd;
+  r->close_fd = close_fd;
+  if (!chunk_size)
+    chunk_size = AC_FILE_READER_CHUNK_SIZE;
+  /* chunks of a mapping start on page boundaries */
+  size_t page = sysconf(_SC_PAGESIZE);
+  r->chunk_size = (chunk_size + page - 1) & ~(page - 1);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      r->map = (char *)p;
+      r->map_length = st.st_size;
+      madvise(p, r->map_length, MADV_SEQUENTIAL);
+    }
+  }
+  if (!r->map) {
+    r->buf = (char *)ac_malloc(r->chunk_size);
+    if (!r->buf)
+      abort();
+  }
+  return r;
+}
+
+char *ac_file_reader_data(ac_file_reader_t *r, size_t *length) {
+  *length = r->map_length;
+  return r->map;
+}
+
+char *ac_file_reader_read(ac_file_reader_t *r, size_t *length) {
+  *length = 0;
+  if (r->map) {
+    if (r->pos >= r->map_length)
+      return NULL;
+    /* the caller is done with the previous chunk */
+    if (r->pos)
+      madvise(r->map + r->pos - r->chunk_size, r->chunk_size, MADV_DONTNEED);
+    char *p = r->map + r->pos;
+    size_t n = r->map_length - r->pos;
+    if (n > r->chunk_size)
+      n = r->chunk_size;
+    r->pos += n;
+    if (r->pos < r->map_length) {
+      size_t ahead = r->map_length - r->pos;
+      madvise(r->map + r->pos, ahead < r->chunk_size ? ahead : r->chunk_size,
+              MADV_WILLNEED);
+    }
+    *length = n;
+    return p;
+  }
+  ssize_t n;
+  while ((n = read(r->fd, r->buf, r->chunk_size)) < 0) {
+    if (errno != EINTR) {
+      r->error = true;
+      return NULL;
+    }
+  }
+  if (!n)
+    return NULL;
+  *length = n;
+  return r->buf;
+}
+
+bool ac_file_reader_parse(ac_file_reader_t *r, ac_async_buffer_t *ab) {
+  size_t length;
+  char *p;
+  if (r->map) {
+    if (r->pos < r->map_length)
+      ac_async_buffer_parse(ab, r->map + r->pos, r->map_length - r->pos);
+    r->pos = r->map_length;
+    return true;
+  }
+  while ((p = ac_file_reader_read(r, &length)))
+    ac_async_buffer_parse(ab, p, length);
+  return !r->error;
+}
+
+bool ac_file_reader_error(ac_file_reader_t *r) { return r->error; }
+
+void ac_file_reader_close(ac_file_reader_t *r) {
+  if (r->map)
+    munmap(r->map, r->map_length);
+  if (r->buf)
+    ac_free(r->buf);
+  if (r->close_fd)
+    close(r->fd);
+  ac_free(r);
+}
@@ -0,0 +1,80 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_file_reader_H
+#define _ac_file_reader_H
+
+#include "ac_allocator.h"
+#include "ac_async_buffer.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_file_reader_t reads a file in chunks without copying it.  A regular file
+  is mapped (with MADV_SEQUENTIAL) and every chunk is a slice of the mapping.
+  The next chunk is prefetched with MADV_WILLNEED and the pages of the
+  previous chunk are released with MADV_DONTNEED as the reader moves forward.
+  Anything which can't be mapped (a pipe, a terminal, an empty or special
+  file) is read into a buffer of chunk_size bytes instead.
+
+  ac_file_reader_parse hands a mapped file to an ac_async_buffer as one
+  chunk, so extracting records only copies the last partial record (if the
+  file doesn't end with a delimiter).
+*/
+struct ac_file_reader_s;
+typedef struct ac_file_reader_s ac_file_reader_t;
+
+#ifndef AC_FILE_READER_CHUNK_SIZE
+#define AC_FILE_READER_CHUNK_SIZE (4 * 1024 * 1024)
+#endif
+
+/* returns NULL if the file can't be opened, a chunk_size of 0 uses
+   AC_FILE_READER_CHUNK_SIZE.  A filename of "-" reads stdin. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_file_reader_open(filename, chunk_size)                              \
+  _ac_file_reader_open(filename, chunk_size,                                   \
+                       AC_FILE_LINE_MACRO("ac_file_reader"))
+ac_file_reader_t *_ac_file_reader_open(const char *filename, size_t chunk_size,
+                                       const char *caller);
+#else
+#define ac_file_reader_open(filename, chunk_size)                              \
+  _ac_file_reader_open(filename, chunk_size)
+ac_file_reader_t *_ac_file_reader_open(const char *filename, size_t chunk_size);
+#endif
+
+/* the whole file if it is mapped, otherwise NULL */
+char *ac_file_reader_data(ac_file_reader_t *r, size_t *length);
+
+/* returns the next chunk (valid until the next call) or NULL at the end of
+   the file or on a read error (see ac_file_reader_error) */
+char *ac_file_reader_read(ac_file_reader_t *r, size_t *length);
+
+/* parse the rest of the file with ab, returns false on a read error */
+bool ac_file_reader_parse(ac_file_reader_t *r, ac_async_buffer_t *ab);
+
+/* true if a read failed */
+bool ac_file_reader_error(ac_file_reader_t *r);
+
+void ac_file_reader_close(ac_file_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
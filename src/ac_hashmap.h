@@ -0,0 +1,88 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_hashmap_H
+#define _ac_hashmap_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_hashmap is an open-addressing hash map for exact-match lookups where the
+  ordering that ac_map provides isn't needed (such as finding a cgi parameter
+  or an http header by name).  It follows the Swiss table design.  Each slot
+  has a control byte which holds 7 bits of the hash (or marks the slot as
+  empty or deleted).  The control bytes are probed AC_HASHMAP_GROUP_SIZE at a
+  time (with SSE2 if it is available), so most lookups only compare the key
+  of the matching item.
+
+  The map is not intrusive, it stores a pointer to datatype (which normally
+  contains the key).  The hash of each item is kept so that the items don't
+  need to be rehashed as the map grows.  When the map grows, the new table is
+  allocated and the items are moved over AC_HASHMAP_MIGRATE_SLOTS slots at a
+  time by the following inserts and erases, so no single insert has to
+  rehash the whole map.
+
+  If a pool is passed to name_init, the tables are allocated from the pool
+  (and are not freed until the pool is cleared or destroyed).  Otherwise,
+  ac_malloc is used and name_destroy frees the tables.
+
+  Like the other containers, the functions are generated with macros.  Place
+  ac_hashmap_def where the declarations are needed (it defines the types) and
+  ac_hashmap_m in one source file.
+
+  ac_hashmap_def(name, keytype, datatype)
+  ac_hashmap_m(name, keytype, datatype, hash, equal)
+    expects: size_t hash(const keytype *key);
+             bool equal(const keytype *key, const datatype *d);
+
+    defines: name_t (the map)
+
+    expected is the number of items to size the map for (it can be 0)
+    void name_init(name_t *h, ac_pool_t *pool, size_t expected);
+    void name_destroy(name_t *h);
+    size_t name_size(name_t *h);
+
+    returns the item which matches key or NULL
+    datatype *name_find(name_t *h, const keytype *key);
+
+    inserts d (which must match key) and returns NULL, if an item already
+    matches key, it is returned and d is not inserted.
+    datatype *name_insert(name_t *h, const keytype *key, datatype *d);
+
+    removes and returns the item which matches key (or NULL)
+    datatype *name_erase(name_t *h, const keytype *key);
+
+    iterates over the items, pos should start at 0.  Returns NULL at the end.
+    Any insert or erase invalidates pos.
+    datatype *name_next(name_t *h, size_t *pos);
+
+  The hash should mix all of its bits well, the low 7 bits are stored in the
+  control bytes and the rest select the group.
+*/
+
+#include "impl/ac_hashmap.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_histogram.h"
+#include "ac_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AC_HISTOGRAM_MIN_BITS 1
+#define AC_HISTOGRAM_MAX_BITS 10
+
+static inline uint32_t num_buckets(uint32_t sub_bucket_bits) {
+  return (65 - sub_bucket_bits) << sub_bucket_bits;
+}
+
+/* the smallest and largest values which fall in bucket i */
+static inline uint64_t bucket_min(uint32_t sub_bucket_bits, uint32_t i) {
+  if (i < (2U << sub_bucket_bits))
+    return i;
+  uint32_t e = (i >> sub_bucket_bits) - 1;
+  return (uint64_t)(i - (e << sub_bucket_bits)) << e;
+}
+
+static inline uint64_t bucket_max(uint32_t sub_bucket_bits, uint32_t i) {
+  if (i < (2U << sub_bucket_bits))
+    return i;
+  uint32_t e = (i >> sub_bucket_bits) - 1;
+  /* the top bucket wraps to UINT64_MAX */
+  return ((uint64_t)(i - (e << sub_bucket_bits) + 1) << e) - 1;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_histogram_t *_ac_histogram_init(uint32_t sub_bucket_bits,
+                                   const char *caller) {
+#else
+ac_histogram_t *_ac_histogram_init(uint32_t sub_bucket_bits) {
+#endif
+  if (sub_bucket_bits < AC_HISTOGRAM_MIN_BITS)
+    sub_bucket_bits = AC_HISTOGRAM_MIN_BITS;
+  if (sub_bucket_bits > AC_HISTOGRAM_MAX_BITS)
+    sub_bucket_bits = AC_HISTOGRAM_MAX_BITS;
+  uint32_t n = num_buckets(sub_bucket_bits);
+  size_t size = sizeof(ac_histogram_t) + sizeof(uint64_t) * n;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_histogram_t *h = (ac_histogram_t *)_ac_malloc_d(NULL, caller, size, false);
+#else
+  ac_histogram_t *h = (ac_histogram_t *)ac_malloc(size);
+#endif
+  h->sub_bucket_bits = sub_bucket_bits;
+  h->num_buckets = n;
+  h->buckets = (uint64_t *)(h + 1);
+  memset(h->buckets, 0, sizeof(uint64_t) * n);
+  h->count = h->sum = h->max = 0;
+  h->min = UINT64_MAX;
+  return h;
+}
+
+void ac_histogram_destroy(ac_histogram_t *h) { ac_free(h); }
+
+void ac_histogram_clear(ac_histogram_t *h) {
+  for (uint32_t i = 0; i < h->num_buckets; i++)
+    __atomic_store_n(h->buckets + i, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->min, UINT64_MAX, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+}
+
+void ac_histogram_merge(ac_histogram_t *dest, ac_histogram_t *src) {
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < src->num_buckets; i++) {
+    uint64_t n = __atomic_load_n(src->buckets + i, __ATOMIC_RELAXED);
+    if (!n)
+      continue;
+    count += n;
+    if (src->sub_bucket_bits == dest->sub_bucket_bits)
+      _ac_histogram_add(dest->buckets + i, n);
+    else {
+      uint64_t lo = bucket_min(src->sub_bucket_bits, i);
+      uint64_t hi = bucket_max(src->sub_bucket_bits, i);
+      _ac_histogram_add(dest->buckets +
+                            _ac_histogram_bucket(dest->sub_bucket_bits,
+                                                 lo + (hi - lo) / 2),
+                        n);
+    }
+  }
+  if (!count)
+    return;
+  _ac_histogram_add(&dest->count, count);
+  _ac_histogram_add(&dest->sum, __atomic_load_n(&src->sum, __ATOMIC_RELAXED));
+  uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+  if (min < dest->min)
+    __atomic_store_n(&dest->min, min, __ATOMIC_RELAXED);
+  if (max > dest->max)
+    __atomic_store_n(&dest->max, max, __ATOMIC_RELAXED);
+}
+
+uint64_t ac_histogram_count(ac_histogram_t *h) {
+  return __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+}
+
+uint64_t ac_histogram_min(ac_histogram_t *h) {
+  uint64_t min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+  return min == UINT64_MAX ? 0 : min;
+}
+
+uint64_t ac_histogram_max(ac_histogram_t *h) {
+  return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+uint64_t ac_histogram_mean(ac_histogram_t *h) {
+  uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (!count)
+    return 0;
+  return __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / count;
+}
+
+/* fills res[i] with the value at percentiles[i] (which must be ascending).
+   The buckets are counted instead of using count so that the percentiles
+   are consistent with each other while values are being recorded. */
+static void percentiles(ac_histogram_t *h, const double *percentiles,
+                        uint64_t *res, uint32_t num) {
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < h->num_buckets; i++)
+    count += __atomic_load_n(h->buckets + i, __ATOMIC_RELAXED);
+  uint32_t r = 0;
+  if (count) {
+    uint64_t max = ac_histogram_max(h);
+    uint64_t min = ac_histogram_min(h);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < h->num_buckets && r < num; i++) {
+      seen += __atomic_load_n(h->buckets + i, __ATOMIC_RELAXED);
+      while (r < num) {
+        uint64_t target = (uint64_t)(percentiles[r] / 100.0 * count + 0.5);
+        if (target < 1)
+          target = 1;
+        if (seen < target)
+          break;
+        uint64_t v = bucket_max(h->sub_bucket_bits, i);
+        res[r++] = v > max ? max : v < min ? min : v;
+      }
+    }
+    while (r < num)
+      res[r++] = max;
+  }
+  while (r < num)
+    res[r++] = 0;
+}
+
+uint64_t ac_histogram_percentile(ac_histogram_t *h, double percentile) {
+  uint64_t res;
+  percentiles(h, &percentile, &res, 1);
+  return res;
+}
+
+void ac_histogram_summary(ac_histogram_t *h, ac_histogram_summary_t *s) {
+  static const double p[] = {50.0, 90.0, 99.0, 99.9};
+  uint64_t res[4];
+  percentiles(h, p, res, 4);
+  s->count = ac_histogram_count(h);
+  s->min = ac_histogram_min(h);
+  s->mean = ac_histogram_mean(h);
+  s->p50 = res[0];
+  s->p90 = res[1];
+  s->p99 = res[2];
+  s->p999 = res[3];
+  s->max = ac_histogram_max(h);
+}
+
+/* The saved form is "ACH1" followed by varints (7 bits per byte, low bits
+   first): sub_bucket_bits, count, sum, min, max, the number of non-empty
+   buckets, and then for each of them the distance from the previous
+   non-empty bucket and its count. */
+static const char histogram_magic[4] = {'A', 'C', 'H', '1'};
+
+static inline char *write_varint(char *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  return p;
+}
+
+static inline bool read_varint(const unsigned char **p,
+                               const unsigned char *ep, uint64_t *v) {
+  uint64_t r = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if (*p >= ep)
+      return false;
+    unsigned char c = *(*p)++;
+    r |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      *v = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ac_histogram_save(ac_histogram_t *h, ac_buffer_t *bh) {
+  char tmp[64];
+  char *p = tmp;
+  uint64_t buckets = 0;
+  for (uint32_t i = 0; i < h->num_buckets; i++)
+    if (__atomic_load_n(h->buckets + i, __ATOMIC_RELAXED))
+      buckets++;
+  ac_buffer_append(bh, histogram_magic, sizeof(histogram_magic));
+  p = write_varint(p, h->sub_bucket_bits);
+  p = write_varint(p, ac_histogram_count(h));
+  p = write_varint(p, __atomic_load_n(&h->sum, __ATOMIC_RELAXED));
+  p = write_varint(p, __atomic_load_n(&h->min, __ATOMIC_RELAXED));
+  p = write_varint(p, ac_histogram_max(h));
+  p = write_varint(p, buckets);
+  ac_buffer_append(bh, tmp, p - tmp);
+  uint32_t prev = 0;
+  for (uint32_t i = 0; i < h->num_buckets && buckets; i++) {
+    uint64_t n = __atomic_load_n(h->buckets + i, __ATOMIC_RELAXED);
+    if (!n)
+      continue;
+    p = write_varint(tmp, i - prev);
+    p = write_varint(p, n);
+    ac_buffer_append(bh, tmp, p - tmp);
+    prev = i;
+    buckets--;
+  }
+}
+
+bool ac_histogram_load(ac_histogram_t *h, const void *data, size_t length) {
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *ep = p + length;
+  if (length < sizeof(histogram_magic) ||
+      memcmp(p, histogram_magic, sizeof(histogram_magic)))
+    return false;
+  p += sizeof(histogram_magic);
+  uint64_t bits, count, sum, min, max, buckets;
+  if (!read_varint(&p, ep, &bits) || !read_varint(&p, ep, &count) ||
+      !read_varint(&p, ep, &sum) || !read_varint(&p, ep, &min) ||
+      !read_varint(&p, ep, &max) || !read_varint(&p, ep, &buckets))
+    return false;
+  if (bits < AC_HISTOGRAM_MIN_BITS || bits > AC_HISTOGRAM_MAX_BITS ||
+      buckets > num_buckets((uint32_t)bits))
+    return false;
+
+  /* the saved histogram is rebuilt and merged so that h is unchanged if
+     the data is invalid */
+  ac_histogram_t *src = ac_histogram_init((uint32_t)bits);
+  uint64_t index = 0;
+  for (uint64_t i = 0; i < buckets; i++) {
+    uint64_t delta, n;
+    if (!read_varint(&p, ep, &delta) || !read_varint(&p, ep, &n) ||
+        (i && !delta) || delta >= src->num_buckets - index) {
+      ac_histogram_destroy(src);
+      return false;
+    }
+    index += delta;
+    src->buckets[index] = n;
+  }
+  src->count = count;
+  src->sum = sum;
+  src->min = min;
+  src->max = max;
+  ac_histogram_merge(h, src);
+  ac_histogram_destroy(src);
+  return true;
+}
@@ -0,0 +1,115 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_histogram_H
+#define _ac_histogram_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_histogram_t counts values (typically latencies in nanoseconds) in log
+  linear buckets like an HDR histogram.  Each power of two is split into
+  1 << sub_bucket_bits buckets, so a value is known to within 1 part in
+  1 << sub_bucket_bits (3 bits is 12.5%, 7 bits is under 1%).  Values below
+  2 << sub_bucket_bits are counted exactly.  Every uint64_t value fits, so
+  there is nothing to configure beyond the precision.
+
+  ac_histogram_record is O(1) and meant to be called by one thread (such as
+  a worker which owns the histogram) while any thread reads or merges it.
+  ac_histogram_record_atomic may be called by many threads at once.
+  Histograms are merged to combine per-thread instances, and can be saved
+  to a buffer and loaded elsewhere.
+*/
+struct ac_histogram_s;
+typedef struct ac_histogram_s ac_histogram_t;
+
+/* sub_bucket_bits is clamped to between 1 and 10 */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_histogram_init(sub_bucket_bits)                                     \
+  _ac_histogram_init(sub_bucket_bits, AC_FILE_LINE_MACRO("ac_histogram"))
+ac_histogram_t *_ac_histogram_init(uint32_t sub_bucket_bits,
+                                   const char *caller);
+#else
+#define ac_histogram_init(sub_bucket_bits) _ac_histogram_init(sub_bucket_bits)
+ac_histogram_t *_ac_histogram_init(uint32_t sub_bucket_bits);
+#endif
+
+void ac_histogram_destroy(ac_histogram_t *h);
+
+/* reset all of the counts to zero */
+void ac_histogram_clear(ac_histogram_t *h);
+
+/* count value once (from the single thread which records into h) */
+static inline void ac_histogram_record(ac_histogram_t *h, uint64_t value);
+
+/* count value n times (from the single thread which records into h) */
+static inline void ac_histogram_record_n(ac_histogram_t *h, uint64_t value,
+                                         uint64_t n);
+
+/* count value once, safe to call from many threads */
+static inline void ac_histogram_record_atomic(ac_histogram_t *h,
+                                              uint64_t value);
+
+/* add the counts of src to dest.  If the precision differs, each bucket of
+   src is added at its middle value. */
+void ac_histogram_merge(ac_histogram_t *dest, ac_histogram_t *src);
+
+uint64_t ac_histogram_count(ac_histogram_t *h);
+uint64_t ac_histogram_min(ac_histogram_t *h);
+uint64_t ac_histogram_max(ac_histogram_t *h);
+uint64_t ac_histogram_mean(ac_histogram_t *h);
+
+/* the value which percentile (0 to 100) percent of the values are less
+   than or equal to.  The top of the value's bucket is returned (never more
+   than the max), or 0 if the histogram is empty. */
+uint64_t ac_histogram_percentile(ac_histogram_t *h, double percentile);
+
+typedef struct {
+  uint64_t count;
+  uint64_t min;
+  uint64_t mean;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} ac_histogram_summary_t;
+
+/* the common percentiles in one pass over the buckets */
+void ac_histogram_summary(ac_histogram_t *h, ac_histogram_summary_t *s);
+
+/* append a compact form of h (only the non-empty buckets) to bh */
+void ac_histogram_save(ac_histogram_t *h, ac_buffer_t *bh);
+
+/* add a histogram saved by ac_histogram_save to h (as ac_histogram_merge
+   does).  Returns false if the data isn't a valid histogram. */
+bool ac_histogram_load(ac_histogram_t *h, const void *data, size_t length);
+
+#include "impl/ac_histogram.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,61 +14,264 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memmem */
+#endif
+
 #include "ac_http.h"
 
 #include "ac_async_buffer.h"
 #include "ac_buffer.h"
 #include "ac_cgi.h"
-#include "ac_conv.h"
 #include "ac_pool.h"
-#include <ctype.h>
+#include "ac_scan.h"
+#include "ac_trace.h"
+#ifdef AC_HTTP_LLHTTP
+#include "llhttp/llhttp.h"
+#endif
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 static const int http_state_reading_headers = 1 << 1;
+static const int http_state_read_complete = 1 << 6;
+/* on_parsing_error was called, the rest of the input is ignored */
+static const int http_state_parse_error = 1 << 9;
+#ifndef AC_HTTP_LLHTTP
 static const int http_state_reading_whole_body = 1 << 2;
 static const int http_state_reading_chunk_size = 1 << 3;
 static const int http_state_reading_chunk_data = 1 << 4;
 static const int http_state_reading_footers = 1 << 5;
-static const int http_state_read_complete = 1 << 6;
+static const int http_state_streaming_body = 1 << 7;
+static const int http_state_reading_until_close = 1 << 8;
+#endif
 
-static const int max_parser_group = 256;
-static bool white_space(int c) { return (c == ' ' || c == '\t'); }
+/* the number of groups which a thread keeps a parser cache for */
+#define AC_HTTP_THREAD_GROUPS 4
+
+/* timing histograms have 1 << AC_HTTP_TIMING_SUB_BITS buckets for each power
+   of two */
+#define AC_HTTP_TIMING_SUB_BITS 3
+
+typedef struct {
+  char *name;
+  char *value; /* NULL if the header has no value */
+  uint32_t name_length;
+  uint32_t value_length;
+  uint32_t hash;
+} ac_http_header_t;
+
+#ifdef AC_HTTP_LLHTTP
+enum { span_none, span_url, span_status, span_field, span_value };
+#endif
 
 struct ac_http_s {
   ac_http_group_t *group;
   ac_http_t *next;
+#ifdef AC_HTTP_LLHTTP
+  llhttp_t llhttp;
+  /* the url or header which llhttp is passing a piece at a time */
+  ac_buffer_t *span;
+  int span_type;
+  /* the body goes to on_body_chunk instead of chunk_body_cache */
+  int stream_body;
+  /* llhttp skips the "\r\n" after a chunk without looking at it, so the
+     bytes left in the chunk are counted and crlf_left of the "\r\n" after
+     it are still to be checked (input_end is the end of the parse call's
+     data) */
+  uint64_t chunk_left;
+  int crlf_left;
+  const char *input_end;
+#else
   ac_async_buffer_t *async_buffer;
+#endif
   ac_pool_t *pool;
   void *arg;
   char *uri;
   char *method;
   char *protocol;
+  /* the status line of a response */
+  int status;
+  char *reason;
+  /* set by ac_http_set_no_body from the headers callback */
+  bool no_body;
   char *post_data;
   size_t post_size;
-  char **headers;
+  ac_http_header_t *headers;
   uint32_t num_headers;
-  struct timeval session_start;
+  uint32_t max_headers;
+  /* an open addressing table of header index + 1 by the hash of the name */
+  uint32_t *header_slots;
+  uint32_t header_mask;
+  /* well known headers which are found while parsing */
+  char *content_length;
+  char *transfer_encoding;
+  /* the value of content_length.  bad_length is set if a Content-Length
+     isn't all digits, doesn't fit in 64 bits, or is repeated. */
+  uint64_t body_length;
+  bool bad_length;
+  ac_http_timestamps_t times;
   uint32_t state;
-  int pool_member;
+  /* set while a callback runs, a release during it is deferred */
+  int in_callback;
+  int release_pending;
   ac_buffer_t *chunk_body_cache;
+  /* the unlinked file which bodies over the group's spool threshold are
+     written to (-1 until the first one), kept until the parser is released */
+  int spool_fd;
+  size_t spooled;
+  bool spooling;
+  bool spool_failed;
   ac_cgi_t *query_cgi;
   ac_cgi_t *body_cgi;
 };
 
+/* released parsers are kept by the thread which released them */
+typedef struct ac_http_cache_s {
+  ac_http_t *head;
+  uint32_t num;
+  struct ac_http_cache_s *next;
+} ac_http_cache_t;
+
 struct ac_http_group_s {
+  /* overflow from the thread caches.  Parsers are pushed one or a list at a
+     time, but only ever popped by taking the whole stack, so there is no ABA
+     problem. */
   ac_http_t *parser_pool;
-  uint32_t pool_size;
+  uint32_t num_pooled;
+  uint32_t max_pooled;
+  uint64_t id;
+  /* protects caches, the list of every thread's cache for the group */
   pthread_mutex_t lock;
+  ac_http_cache_t *caches;
   ac_http_f on_headers;
   ac_http_data_f on_request_end;
   ac_http_f on_parsing_error;
   ac_http_data_f on_body_chunk;
+  size_t max_buffered;
+  /* see ac_http_group_set_memory_limits */
+  size_t request_memory;
+  ac_pool_limit_t *memory;
+  bool memory_limits;
+  bool timing;
+  /* see ac_http_group_set_responses */
+  bool responses;
+  ac_histogram_t *histograms[ac_http_timing_total + 1];
+  /* see ac_http_group_set_spool */
+  size_t spool_threshold;
+  char *spool_dir;
 };
 
+static uint64_t next_group_id = 0;
+
+static __thread struct {
+  uint64_t id;
+  ac_http_cache_t *cache;
+} thread_caches[AC_HTTP_THREAD_GROUPS];
+
+/* the calling thread's cache for g, which is created the first time */
+static ac_http_cache_t *get_cache(ac_http_group_t *g) {
+  uint32_t slot = 0;
+  for (uint32_t i = 0; i < AC_HTTP_THREAD_GROUPS; i++) {
+    if (thread_caches[i].id == g->id)
+      return thread_caches[i].cache;
+    if (thread_caches[i].id < thread_caches[slot].id)
+      slot = i;
+  }
+  /* the cache in the slot (from the oldest group) is left to its group,
+     which frees it when the group is destroyed */
+  ac_http_cache_t *c = (ac_http_cache_t *)ac_calloc(sizeof(*c));
+  pthread_mutex_lock(&g->lock);
+  c->next = g->caches;
+  g->caches = c;
+  pthread_mutex_unlock(&g->lock);
+  thread_caches[slot].id = g->id;
+  thread_caches[slot].cache = c;
+  return c;
+}
+
+static void free_parser(ac_http_t *p) {
+  if (p->chunk_body_cache)
+    ac_buffer_destroy(p->chunk_body_cache);
+  if (p->spool_fd != -1)
+    close(p->spool_fd);
+#ifdef AC_HTTP_LLHTTP
+  ac_buffer_destroy(p->span);
+#else
+  ac_async_buffer_destroy(p->async_buffer);
+#endif
+  ac_pool_destroy(p->pool);
+  ac_free(p);
+}
+
+static void free_parsers(ac_http_t *p) {
+  while (p) {
+    ac_http_t *next = p->next;
+    free_parser(p);
+    p = next;
+  }
+}
+
+/* push the list head..tail of num parsers onto the group's stack, or free
+   them if the stack is full */
+static void push_parsers(ac_http_group_t *g, ac_http_t *head, ac_http_t *tail,
+                         uint32_t num) {
+  if (__atomic_add_fetch(&g->num_pooled, num, __ATOMIC_RELAXED) >
+      g->max_pooled) {
+    __atomic_sub_fetch(&g->num_pooled, num, __ATOMIC_RELAXED);
+    free_parsers(head);
+    return;
+  }
+  ac_http_t *top = __atomic_load_n(&g->parser_pool, __ATOMIC_RELAXED);
+  do {
+    tail->next = top;
+  } while (!__atomic_compare_exchange_n(&g->parser_pool, &top, head, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* take a parser from the cache, or refill the cache from the group's stack
+   (returns NULL if both are empty) */
+static ac_http_t *pop_parser(ac_http_group_t *g, ac_http_cache_t *c) {
+  ac_http_t *p = c->head;
+  if (p) {
+    c->head = p->next;
+    c->num--;
+    return p;
+  }
+  if (!__atomic_load_n(&g->parser_pool, __ATOMIC_RELAXED))
+    return NULL;
+  p = __atomic_exchange_n(&g->parser_pool, NULL, __ATOMIC_ACQUIRE);
+  if (!p)
+    return NULL;
+  /* keep up to half of a cache, the rest goes back for other threads */
+  ac_http_t *tail = p;
+  uint32_t num = 1;
+  while (tail->next && num < AC_HTTP_THREAD_CACHE / 2) {
+    tail = tail->next;
+    num++;
+  }
+  ac_http_t *rest = tail->next;
+  tail->next = NULL;
+  __atomic_sub_fetch(&g->num_pooled, num, __ATOMIC_RELAXED);
+  if (rest) {
+    uint32_t num_rest = 1;
+    ac_http_t *rest_tail = rest;
+    while (rest_tail->next) {
+      rest_tail = rest_tail->next;
+      num_rest++;
+    }
+    __atomic_sub_fetch(&g->num_pooled, num_rest, __ATOMIC_RELAXED);
+    push_parsers(g, rest, rest_tail, num_rest);
+  }
+  c->head = p->next;
+  c->num = num - 1;
+  return p;
+}
+
 ac_http_group_t *ac_http_group_init(ac_http_f on_headers,
                                     ac_http_data_f on_body_chunk,
                                     ac_http_data_f on_request_end,
@@ -82,60 +285,450 @@ ac_http_group_t *ac_http_group_init(ac_http_f on_headers,
     abort();
   }
   g->on_body_chunk = on_body_chunk;
+  g->max_buffered = AC_HTTP_MAX_BUFFERED;
+  g->max_pooled = AC_HTTP_MAX_POOLED;
+  g->id = __atomic_add_fetch(&next_group_id, 1, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i <= ac_http_timing_total; i++)
+    g->histograms[i] = ac_histogram_init(AC_HTTP_TIMING_SUB_BITS);
   return g;
 }
 
 void ac_http_group_destroy(ac_http_group_t *g) {
   if (g) {
-    uint32_t num_pool_destroyed = 0;
-    while (num_pool_destroyed < g->pool_size) {
-      pthread_mutex_lock(&g->lock);
-      while (g->parser_pool) {
-        ac_http_t *pool = g->parser_pool;
-        g->parser_pool = pool->next;
-        pool->pool_member = 0;
-        ac_free(pool);
-        num_pool_destroyed++;
-      }
-      pthread_mutex_unlock(&g->lock);
-      if (num_pool_destroyed < g->pool_size) {
-        sleep(1);
-      }
+    free_parsers(g->parser_pool);
+    ac_http_cache_t *c = g->caches;
+    while (c) {
+      ac_http_cache_t *next = c->next;
+      free_parsers(c->head);
+      ac_free(c);
+      c = next;
     }
+    for (uint32_t i = 0; i <= ac_http_timing_total; i++)
+      ac_histogram_destroy(g->histograms[i]);
+    if (g->memory)
+      ac_pool_limit_destroy(g->memory);
+    if (g->spool_dir)
+      ac_free(g->spool_dir);
+    pthread_mutex_destroy(&g->lock);
     ac_free(g);
   }
 }
 
-static int parse_request_and_headers(ac_http_t *parser, char *headers,
-                                     size_t headers_length) {
-  char *end_headers = headers + headers_length;
-  char *req_line = headers;
-  char *end_req_line;
-  if ((headers = (char *)memmem(headers, headers_length, "\r\n", 2))) {
-    end_req_line = headers;
-    headers += 2;
-    parser->num_headers = 2;
-    char *p = (char *)memmem(headers, headers_length, "\r\n", 2);
-    for (; p; p = (char *)memmem(p + 2, (end_headers - p) - 2, "\r\n", 2),
-              parser->num_headers++)
-      ;
-    parser->headers = (char **)ac_pool_calloc(
-        parser->pool, sizeof(char *) * parser->num_headers);
-    parser->num_headers = 0;
-    p = headers;
-    char *ep;
+static inline uint64_t timing_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* stamp the release and add a complete request to the histograms */
+static void record_timing(ac_http_t *p) {
+  ac_http_timestamps_t *t = &p->times;
+  if (!p->group->timing || !t->body_complete || t->released)
+    return;
+  t->released = timing_now();
+  ac_histogram_t **h = p->group->histograms;
+  ac_histogram_record_atomic(h[ac_http_timing_headers],
+                             t->headers_complete - t->first_byte);
+  ac_histogram_record_atomic(h[ac_http_timing_body],
+                             t->body_complete - t->headers_complete);
+  ac_histogram_record_atomic(h[ac_http_timing_handler],
+                             t->released - t->body_complete);
+  ac_histogram_record_atomic(h[ac_http_timing_total],
+                             t->released - t->first_byte);
+}
+
+static inline void stamp_headers(ac_http_t *p) {
+  if (p->group->timing) {
+    p->times.headers_complete = timing_now();
+    if (!p->times.first_byte)
+      p->times.first_byte = p->times.headers_complete;
+  }
+}
+
+static inline void stamp_body(ac_http_t *p) {
+  if (p->group->timing)
+    p->times.body_complete = timing_now();
+}
+
+void ac_http_group_set_timing(ac_http_group_t *g, bool on) { g->timing = on; }
+
+void ac_http_group_timing(ac_http_group_t *g, ac_http_timing_t which,
+                          ac_http_timing_stats_t *stats) {
+  ac_histogram_summary_t s;
+  ac_histogram_summary(g->histograms[which], &s);
+  stats->count = s.count;
+  stats->mean = s.mean;
+  stats->p50 = s.p50;
+  stats->p90 = s.p90;
+  stats->p99 = s.p99;
+  stats->p999 = s.p999;
+  stats->max = s.max;
+}
+
+ac_histogram_t *ac_http_group_histogram(ac_http_group_t *g,
+                                        ac_http_timing_t which) {
+  return g->histograms[which];
+}
+
+void ac_http_group_reset_timing(ac_http_group_t *g) {
+  for (uint32_t i = 0; i <= ac_http_timing_total; i++)
+    ac_histogram_clear(g->histograms[i]);
+}
+
+/* FNV-1a of the lowercased name */
+static inline uint32_t header_hash(const char *name, size_t length) {
+  uint32_t h = 2166136261U;
+  const char *ep = name + length;
+  while (name < ep) {
+    uint32_t c = (unsigned char)*name++;
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    h = (h ^ c) * 16777619U;
+  }
+  return h;
+}
+
+static ac_http_header_t *find_header(ac_http_t *p, const char *name,
+                                     size_t length, uint32_t hash) {
+  uint32_t i = hash & p->header_mask;
+  uint32_t slot;
+  while ((slot = p->header_slots[i]) != 0) {
+    ac_http_header_t *h = p->headers + slot - 1;
+    if (h->hash == hash && h->name_length == length &&
+        ac_scan_equal_nocase(h->name, name, length))
+      return h;
+    i = (i + 1) & p->header_mask;
+  }
+  return NULL;
+}
+
+/* a Content-Length is only digits (and the spaces around them), anything
+   else (a sign, hex, a list, or a length over 64 bits) is an error since a
+   proxy might read the body length differently */
+static bool parse_length(const char *s, uint64_t *length) {
+  uint64_t r = 0;
+  const char *sp;
+  if (!s)
+    return false;
+  for (; *s == ' ' || *s == '\t'; s++)
+    ;
+  for (sp = s; *s >= '0' && *s <= '9'; s++) {
+    uint64_t d = *s - '0';
+    if (r > (UINT64_MAX - d) / 10)
+      return false;
+    r = r * 10 + d;
+  }
+  if (s == sp)
+    return false;
+  for (; *s == ' ' || *s == '\t'; s++)
+    ;
+  *length = r;
+  return *s == 0;
+}
+
+/* a repeated Content-Length is an error even if it agrees (as llhttp
+   treats it) */
+static void check_length(ac_http_t *parser, const char *value) {
+  uint64_t length;
+  if (!parse_length(value, &length) || parser->content_length)
+    parser->bad_length = true;
+  else
+    parser->body_length = length;
+}
+
+static void index_header(ac_http_t *parser, uint32_t n) {
+  ac_http_header_t *h = parser->headers + n;
+  bool length = h->name_length == 14 &&
+                ac_scan_equal_nocase(h->name, "Content-Length", 14);
+  if (length)
+    check_length(parser, h->value);
+  /* the last Transfer-Encoding has the coding which was applied last */
+  else if (h->value && h->name_length == 17 &&
+           ac_scan_equal_nocase(h->name, "Transfer-Encoding", 17))
+    parser->transfer_encoding = h->value;
+  if (!h->value || find_header(parser, h->name, h->name_length, h->hash))
+    return;
+  uint32_t i = h->hash & parser->header_mask;
+  while (parser->header_slots[i])
+    i = (i + 1) & parser->header_mask;
+  parser->header_slots[i] = n + 1;
+  if (length)
+    parser->content_length = h->value;
+}
+
+/* make room for max_headers, the table has at least twice as many slots.
+   Returns false if the pool is over its limit. */
+static bool reserve_headers(ac_http_t *parser, uint32_t max_headers) {
+  ac_http_header_t *headers = (ac_http_header_t *)ac_pool_alloc(
+      parser->pool, sizeof(ac_http_header_t) * max_headers);
+  uint32_t table_size = 8;
+  while (table_size < max_headers * 2)
+    table_size <<= 1;
+  uint32_t *slots = (uint32_t *)ac_pool_calloc(
+      parser->pool, sizeof(uint32_t) * table_size);
+  if (!headers || !slots)
+    return false;
+  if (parser->num_headers)
+    memcpy(headers, parser->headers,
+           sizeof(ac_http_header_t) * parser->num_headers);
+  parser->headers = headers;
+  parser->max_headers = max_headers;
+  parser->header_slots = slots;
+  parser->header_mask = table_size - 1;
+  /* the well known headers are found again as the headers are indexed */
+  parser->content_length = parser->transfer_encoding = NULL;
+  parser->body_length = 0;
+  parser->bad_length = false;
+  for (uint32_t i = 0; i < parser->num_headers; i++)
+    index_header(parser, i);
+  return true;
+}
+
+/* add a header tokenized by ac_scan_header from the parser's copy of the
+   headers (so the value is zero terminated in place) and index it (the
+   first header with a given name is the one which is found).  false is
+   returned if the pool is over its limit. */
+static bool add_header(ac_http_t *parser, const ac_scan_header_t *line) {
+  if (parser->num_headers == parser->max_headers &&
+      !reserve_headers(parser,
+                       parser->max_headers ? parser->max_headers * 2 : 16))
+    return false;
+  ac_http_header_t *h = parser->headers + parser->num_headers;
+  h->name = (char *)line->name;
+  h->name_length = line->name_length;
+  h->value = NULL;
+  h->value_length = 0;
+  if (!line->value) {
+    h->name[h->name_length] = 0;
+    h->hash = 0;
+    parser->num_headers++;
+    return true;
+  }
+  h->hash = header_hash(h->name, h->name_length);
+  char *v = (char *)line->value;
+  v[line->value_length] = 0;
+  if (line->value_length) {
+    h->value = v;
+    h->value_length = line->value_length;
+  }
+  index_header(parser, parser->num_headers++);
+  return true;
+}
+
+/* the first body of a parser over the spool threshold creates its file, the
+   rest write over it */
+static bool start_spool(ac_http_t *p) {
+  p->spooling = true;
+  p->spooled = 0;
+  if (p->spool_fd != -1)
+    return lseek(p->spool_fd, 0, SEEK_SET) != -1;
+  const char *dir = p->group->spool_dir;
+  size_t len = strlen(dir);
+  char *path = (char *)ac_pool_alloc(p->pool, len + 32);
+  if (!path)
+    return false;
+  memcpy(path, dir, len);
+  strcpy(path + len, "/ac_http_XXXXXX");
+  p->spool_fd = mkstemp(path);
+  if (p->spool_fd == -1)
+    return false;
+  unlink(path);
+  return true;
+}
+
+static bool spool_write(ac_http_t *p, const char *data, size_t length) {
+  while (length) {
+    ssize_t n = write(p->spool_fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    length -= n;
+    p->spooled += n;
+  }
+  return true;
+}
+
+/* add a piece of the body to chunk_body_cache, which is written to the spool
+   file (AC_HTTP_SPOOL_BUFFER bytes at a time) once the body is over the
+   group's threshold.  A failure to write discards the rest of the body and
+   the request goes to the error callback when the body is complete. */
+static void append_body(ac_http_t *p, const char *data, size_t length) {
+  if (!p->chunk_body_cache)
+    p->chunk_body_cache = ac_buffer_init(1024 * 4);
+  ac_buffer_t *bh = p->chunk_body_cache;
+  size_t threshold = p->group->spool_threshold;
+  if (p->spool_failed)
+    return;
+  if (!p->spooling &&
+      (!threshold || ac_buffer_length(bh) + length <= threshold)) {
+    ac_buffer_append(bh, data, length);
+    return;
+  }
+  if (!p->spooling && !start_spool(p)) {
+    p->spool_failed = true;
+    return;
+  }
+  if (ac_buffer_length(bh) + length <= AC_HTTP_SPOOL_BUFFER) {
+    ac_buffer_append(bh, data, length);
+    return;
+  }
+  if (!spool_write(p, ac_buffer_data(bh), ac_buffer_length(bh)))
+    p->spool_failed = true;
+  ac_buffer_clear(bh);
+  if (length >= AC_HTTP_SPOOL_BUFFER) {
+    if (!p->spool_failed && !spool_write(p, data, length))
+      p->spool_failed = true;
+  } else
+    ac_buffer_append(bh, data, length);
+}
+
+/* set the body which goes to the end callback (none if it was spooled, the
+   spool file is left at its start).  Returns false if spooling failed. */
+static bool finish_body(ac_http_t *p) {
+  ac_buffer_t *bh = p->chunk_body_cache;
+  if (p->spooling) {
+    if (!p->spool_failed && bh && ac_buffer_length(bh) &&
+        !spool_write(p, ac_buffer_data(bh), ac_buffer_length(bh)))
+      p->spool_failed = true;
+    if (bh)
+      ac_buffer_clear(bh);
+    if (!p->spool_failed && lseek(p->spool_fd, 0, SEEK_SET) == -1)
+      p->spool_failed = true;
+    return !p->spool_failed;
+  }
+  if (bh && ac_buffer_length(bh)) {
+    p->post_data = ac_buffer_data(bh);
+    p->post_size = ac_buffer_length(bh);
+  }
+  return true;
+}
+
+static void release_parser(ac_http_t *p);
+
+/* forget the previous request (the pool, headers, and cgi parsers) */
+static void reset_request(ac_http_t *p) {
+  ac_pool_clear(p->pool);
+  p->uri = p->method = p->protocol = NULL;
+  p->status = 0;
+  p->reason = NULL;
+  p->no_body = false;
+  p->post_data = NULL;
+  p->post_size = 0;
+  p->headers = NULL;
+  p->num_headers = 0;
+  p->max_headers = 0;
+  p->header_slots = NULL;
+  p->header_mask = 0;
+  p->content_length = p->transfer_encoding = NULL;
+  p->body_length = 0;
+  p->bad_length = false;
+#ifdef AC_HTTP_LLHTTP
+  ac_buffer_clear(p->span);
+  p->span_type = span_none;
+  p->stream_body = 0;
+  p->chunk_left = 0;
+  p->crlf_left = 0;
+#endif
+  p->query_cgi = p->body_cgi = NULL;
+  if (p->chunk_body_cache)
+    ac_buffer_clear(p->chunk_body_cache);
+  if (p->spooling && p->spool_fd != -1 && ftruncate(p->spool_fd, 0) == -1) {
+    /* a new file is made for the next body */
+    close(p->spool_fd);
+    p->spool_fd = -1;
+  }
+  p->spooling = p->spool_failed = false;
+  p->spooled = 0;
+  p->state = http_state_reading_headers;
+  memset(&p->times, 0, sizeof(p->times));
+}
+
+static void parse_error(ac_http_t *p) {
+  p->state |= (http_state_read_complete | http_state_parse_error);
+  p->group->on_parsing_error(p);
+}
+
+static bool white_space(int c) { return (c == ' ' || c == '\t'); }
+
+/* the body is chunked if chunked is the last coding ("gzip, chunked") */
+static bool chunked(const char *encoding) {
+  const char *p = strrchr(encoding, ',');
+  for (p = p ? p + 1 : encoding; white_space(*p); p++)
+    ;
+  if (strncasecmp(p, "chunked", 7))
+    return false;
+  for (p += 7; white_space(*p); p++)
+    ;
+  return *p == 0;
+}
+
+/* a bad or repeated Content-Length, or a Transfer-Encoding with a
+   Content-Length, is a smuggling attempt.  A request which isn't chunked
+   last has no way to end its body (a response without chunked ends when the
+   connection closes).  Both parsers use this once the headers are indexed
+   so the same bytes are rejected by either one. */
+static bool bad_framing(ac_http_t *p) {
+  if (p->bad_length)
+    return true;
+  if (!p->transfer_encoding)
+    return false;
+  return p->content_length ||
+         (!p->group->responses && !chunked(p->transfer_encoding));
+}
+
+#ifndef AC_HTTP_LLHTTP
+static void on_data(ac_async_buffer_t *br);
+static void body_chunk(ac_http_t *p, const char *data, size_t length);
+
+/* "HTTP/1.1 200 OK" is split into the protocol, status, and reason */
+static bool parse_status_line(ac_http_t *parser, char *p) {
+  for (; white_space(*p); p++)
+    ;
+  parser->protocol = p;
+  for (; *p && !white_space(*p); p++)
+    ;
+  if (*p)
+    *p++ = 0;
+  for (; white_space(*p); p++)
+    ;
+  int status = 0, digits = 0;
+  for (; *p >= '0' && *p <= '9' && digits < 3; p++, digits++)
+    status = status * 10 + (*p - '0');
+  if (digits != 3 || (*p && !white_space(*p)))
+    return false;
+  for (; white_space(*p); p++)
+    ;
+  parser->status = status;
+  parser->reason = p;
+  return !strncmp(parser->protocol, "HTTP/", 5);
+}
+
+/* the request (or status) line and headers are copied to the pool once and
+   tokenized in place (each line is zero terminated where its "\r\n" was) */
+static int parse_request_and_headers(ac_http_t *parser, char *data,
+                                     size_t data_length) {
+  char *req_line = (char *)ac_pool_ualloc(parser->pool, data_length + 1);
+  if (!req_line)
+    return false;
+  memcpy(req_line, data, data_length);
+  req_line[data_length] = 0;
+  const char *end_headers = req_line + data_length;
+  char *end_req_line = (char *)ac_scan_find_crlf(req_line, end_headers);
+  if (end_req_line) {
+    const char *p = end_req_line + 2;
+    ac_scan_header_t line;
     while (p < end_headers) {
-      if (!(ep = (char *)memmem(p, end_headers - p, "\r\n", 2))) {
-        ep = end_headers;
-      }
-      parser->headers[parser->num_headers++] =
-          ac_pool_strndup(parser->pool, p, ep - p);
-      p = ep + 2;
+      p = ac_scan_header(p, end_headers, &line);
+      if (line.space_before_colon || !add_header(parser, &line))
+        return false;
     }
-  } else {
-    end_req_line = end_headers;
+    *end_req_line = 0;
   }
-  req_line = ac_pool_strndup(parser->pool, req_line, end_req_line - req_line);
+  if (parser->group->responses)
+    return parse_status_line(parser, req_line);
   char *p = req_line;
   // find beginning of method
   for (; white_space(*p); p++)
@@ -168,6 +761,112 @@ static int parse_request_and_headers(ac_http_t *parser, char *headers,
   return (parser->method && parser->uri && parser->protocol);
 }
 
+/* calls on_request_end and starts on the next request on the connection
+   (keep-alive and pipelining).  Returns true if the next request's headers
+   are already buffered. */
+static bool request_end(ac_http_t *p, char const *data, size_t data_length) {
+  stamp_body(p);
+  p->in_callback = 1;
+  p->group->on_request_end(p, data, data_length);
+  p->in_callback = 0;
+  record_timing(p);
+  if (p->release_pending) {
+    release_parser(p);
+    return false;
+  }
+  reset_request(p);
+  return ac_async_buffer_advance_to_string(p->async_buffer, "\r\n\r\n",
+                                           on_data);
+}
+
+/* a piece of a Content-Length body which is too large to buffer */
+static void on_body_data(ac_async_buffer_t *br) {
+  ac_http_t *p = (ac_http_t *)ac_async_buffer_get_arg(br);
+  p->group->on_body_chunk(p, ac_async_buffer_data(br),
+                          ac_async_buffer_data_length(br));
+}
+
+/* a piece of a response body which ends when the connection closes */
+static void on_close_data(ac_async_buffer_t *br) {
+  ac_http_t *p = (ac_http_t *)ac_async_buffer_get_arg(br);
+  body_chunk(p, ac_async_buffer_data(br), ac_async_buffer_data_length(br));
+}
+
+/* a piece of a Content-Length body which is over the spool threshold */
+static void on_spool_data(ac_async_buffer_t *br) {
+  ac_http_t *p = (ac_http_t *)ac_async_buffer_get_arg(br);
+  append_body(p, ac_async_buffer_data(br), ac_async_buffer_data_length(br));
+}
+
+/* the streamed, spooled, or chunked body is complete.  Returns false if it
+   couldn't be spooled (or as request_end does). */
+static bool body_end(ac_http_t *p) {
+  if (!finish_body(p)) {
+    parse_error(p);
+    return false;
+  }
+  return request_end(p, p->post_data, p->post_size);
+}
+
+/* the size of a chunk from its size line s..ep without the "\r\n" ("1a" or
+   "1a;name=value"), returns false if it doesn't start with hex digits (or
+   there are too many) or anything but an extension follows them */
+static bool chunk_size(const char *s, const char *ep, size_t *size) {
+  size_t r = 0;
+  const char *sp = s;
+  for (; s < ep; s++) {
+    unsigned c = (unsigned char)*s;
+    unsigned lower = c | 0x20;
+    if (c - '0' < 10)
+      c -= '0';
+    else if (lower - 'a' < 6)
+      c = lower - 'a' + 10;
+    else
+      break;
+    if (r >> (sizeof(size_t) * 8 - 8))
+      return false;
+    r = (r << 4) | c;
+  }
+  *size = r;
+  if (s == sp)
+    return false;
+  for (; s < ep && white_space(*s); s++)
+    ;
+  return s == ep || *s == ';';
+}
+
+static void body_chunk(ac_http_t *p, const char *data, size_t length) {
+  if (p->group->on_body_chunk)
+    p->group->on_body_chunk(p, data, length);
+  else // no handler for chunk encoding.  buffer (or spool) it
+    append_body(p, data, length);
+}
+
+/* pass the complete chunks at the start of the unread input to the body
+   without advancing the async buffer to each size line and chunk.  It
+   stops at the last chunk, a chunk which isn't all there, or an error
+   (which the size line or chunk state reports). */
+static void read_chunks(ac_http_t *p) {
+  size_t length;
+  const char *s = ac_async_buffer_unread(p->async_buffer, &length);
+  if (!s)
+    return;
+  const char *ep = s + length;
+  const char *sp = s;
+  size_t size;
+  const char *eol;
+  while ((eol = ac_scan_find_crlf(sp, ep)) && chunk_size(sp, eol, &size) &&
+         size) {
+    /* the size line's "\r\n", the chunk, and the "\r\n" after it */
+    if ((size_t)(ep - eol) < size + 4 || eol[2 + size] != '\r' ||
+        eol[3 + size] != '\n')
+      break;
+    body_chunk(p, eol + 2, size);
+    sp = eol + 4 + size;
+  }
+  ac_async_buffer_skip(p->async_buffer, sp - s);
+}
+
 static void on_data(ac_async_buffer_t *br) {
   ac_http_t *p = (ac_http_t *)ac_async_buffer_get_arg(br);
   char *data;
@@ -178,18 +877,45 @@ static void on_data(ac_async_buffer_t *br) {
     if (p->state & http_state_reading_headers) {
       // First chunk of all requests.  Should include request and headers.
       if (!parse_request_and_headers(p, data, data_length)) {
-        p->state ^= (http_state_reading_headers | http_state_read_complete);
-        p->group->on_parsing_error(p);
+        p->state ^= http_state_reading_headers;
+        parse_error(p);
         return;
       }
       p->state ^= http_state_reading_headers;
+      bool responses = p->group->responses;
+      bool is_chunked = p->transfer_encoding && chunked(p->transfer_encoding);
+      if (bad_framing(p)) {
+        parse_error(p);
+        return;
+      }
+      stamp_headers(p);
       p->group->on_headers(p);
-      uint64_t content_length =
-          ac_uint64_t(ac_http_param(p, header, "Content-Length", NULL), 0);
-      char const *encoding =
-          ac_http_param(p, header, "Transfer-Encoding", NULL);
-      if (content_length) {
-        // TODO read whole body in chunks instead of the complete body.
+      uint64_t content_length = p->body_length;
+      bool no_body = p->no_body ||
+                     (responses && (p->status / 100 == 1 || p->status == 204 ||
+                                    p->status == 304));
+      if (no_body) {
+        content_length = 0;
+        is_chunked = false;
+      }
+      if (content_length && p->group->on_body_chunk &&
+          content_length > p->group->max_buffered) {
+        // Pass the body to on_body_chunk as it arrives.
+        p->state |= http_state_streaming_body;
+        if (!ac_async_buffer_stream_bytes(p->async_buffer, content_length,
+                                          on_body_data, on_data)) {
+          return;
+        }
+      } else if (content_length && !p->group->on_body_chunk &&
+                 p->group->spool_threshold &&
+                 content_length > p->group->spool_threshold) {
+        // Write the body to the spool file as it arrives.
+        p->state |= http_state_streaming_body;
+        if (!ac_async_buffer_stream_bytes(p->async_buffer, content_length,
+                                          on_spool_data, on_data)) {
+          return;
+        }
+      } else if (content_length) {
         // We know the length of the body.
         p->state |= http_state_reading_whole_body;
         if (!ac_async_buffer_advance_bytes(p->async_buffer, content_length,
@@ -198,52 +924,61 @@ static void on_data(ac_async_buffer_t *br) {
         }
         data = ac_async_buffer_data(br);
         data_length = ac_async_buffer_data_length(br);
-      } else if (encoding && !strcasecmp(encoding, "chunked")) {
+      } else if (is_chunked) {
         // We need to start reading chunked encoding
         p->state |= http_state_reading_chunk_size;
+        read_chunks(p);
         if (!ac_async_buffer_advance_to_string(p->async_buffer, "\r\n",
                                                on_data)) {
           return;
         }
         data = ac_async_buffer_data(br);
         data_length = ac_async_buffer_data_length(br);
+      } else if (responses && !no_body && !p->content_length) {
+        // The body ends when the connection closes (see ac_http_finish).
+        p->state |= http_state_reading_until_close;
+        ac_async_buffer_stream_bytes(p->async_buffer, SIZE_MAX, on_close_data,
+                                     on_data);
+        return;
       } else {
         // No body.  We are done.
         p->state |= http_state_read_complete;
-        p->group->on_request_end(p, NULL, 0);
-        return;
+        if (!request_end(p, NULL, 0))
+          return;
+        continue;
       }
     }
+    if (p->state & http_state_streaming_body) {
+      // The body has been passed to on_body_chunk (or spooled).
+      p->state ^= (http_state_streaming_body | http_state_read_complete);
+      if (!body_end(p))
+        return;
+      continue;
+    }
     if (p->state & http_state_reading_whole_body) {
       // Body read finished.  We are done.
       p->post_data = data;
       p->post_size = data_length;
       p->state ^= (http_state_reading_whole_body | http_state_read_complete);
-      p->group->on_request_end(p, data, data_length);
-      return;
+      if (!request_end(p, data, data_length))
+        return;
+      continue;
     }
     if (p->state & http_state_reading_chunk_size) {
       // We should have the length of the next chunk.
       // Format: "5E\r\n" or "5E;key=value\r\n"
-      char buf[64];
-      uint32_t i;
-      for (i = 0; i < data_length && i < 63 && isxdigit(data[i]); i++) {
-        buf[i] = data[i];
-      }
-      buf[i] = 0;
-      size_t chunk_size;
-      if (sscanf(buf, "%zu", &chunk_size) != 1) {
-        p->state ^= (http_state_reading_chunk_size | http_state_read_complete);
-        p->group->on_parsing_error(p);
+      size_t size;
+      if (!chunk_size(data, data + data_length, &size)) {
+        p->state ^= http_state_reading_chunk_size;
+        parse_error(p);
         return;
       } else {
-        if (chunk_size > 0) {
+        if (size > 0) {
           // More data coming.
-          chunk_size += 2; // \r\n at end of chunks
+          size += 2; // \r\n at end of chunks
           p->state ^=
               (http_state_reading_chunk_size | http_state_reading_chunk_data);
-          if (!ac_async_buffer_advance_bytes(p->async_buffer, chunk_size,
-                                             on_data)) {
+          if (!ac_async_buffer_advance_bytes(p->async_buffer, size, on_data)) {
             return;
           }
           data = ac_async_buffer_data(br);
@@ -263,18 +998,16 @@ static void on_data(ac_async_buffer_t *br) {
     }
     if (p->state & http_state_reading_chunk_data) {
       // Actual chunk of body.  Not copying this, simply passing it around.
-      data_length -= 2; // extra \r\n at end of chunk is ignored
-      if (p->group->on_body_chunk) {
-        p->group->on_body_chunk(p, data, data_length);
-      } else {
-        // no handler for chunk encoding.  buffer it up
-        if (!p->chunk_body_cache) {
-          p->chunk_body_cache = ac_buffer_init(1024 * 4);
-        }
-        ac_buffer_append(p->chunk_body_cache, data, data_length);
+      data_length -= 2; // the chunk must end with \r\n
+      if (data[data_length] != '\r' || data[data_length + 1] != '\n') {
+        p->state ^= http_state_reading_chunk_data;
+        parse_error(p);
+        return;
       }
+      body_chunk(p, data, data_length);
       p->state ^=
           (http_state_reading_chunk_data | http_state_reading_chunk_size);
+      read_chunks(p);
       if (!ac_async_buffer_advance_to_string(p->async_buffer, "\r\n",
                                              on_data)) {
         return;
@@ -295,19 +1028,198 @@ static void on_data(ac_async_buffer_t *br) {
       } else {
         // End of transmission. Done.
         p->state ^= (http_state_reading_footers | http_state_read_complete);
-        p->post_data = NULL;
-        p->post_size = 0;
-        if (p->chunk_body_cache) {
-          p->post_data = ac_buffer_data(p->chunk_body_cache);
-          p->post_size = ac_buffer_length(p->chunk_body_cache);
-        }
-        p->group->on_request_end(p, p->post_data, p->post_size);
-        return;
+        if (!body_end(p))
+          return;
+        break;
       }
     }
   }
 }
 
+#else
+/* llhttp parses the request as it arrives and passes the url and headers a
+   piece at a time, the pieces are gathered in span.  finish_span returns false
+   if the pool is over its limit or a header has a space before its colon. */
+static bool finish_span(ac_http_t *p) {
+  if (p->span_type == span_none)
+    return true;
+  if (p->span_type == span_field)
+    ac_buffer_appendc(p->span, ':');
+  char *s = ac_pool_strndup(p->pool, ac_buffer_data(p->span),
+                            ac_buffer_length(p->span));
+  bool r = true;
+  if (p->span_type == span_url)
+    r = (p->uri = s) != NULL;
+  else if (p->span_type == span_status)
+    r = (p->reason = s) != NULL;
+  else if (s) {
+    ac_scan_header_t line;
+    ac_scan_header(s, s + ac_buffer_length(p->span), &line);
+    r = !line.space_before_colon && add_header(p, &line);
+  } else
+    r = false;
+  ac_buffer_clear(p->span);
+  p->span_type = span_none;
+  return r;
+}
+
+/* the callbacks return -1 to stop llhttp with an error */
+static int append_span(ac_http_t *p, int type, const char *at,
+                       size_t length) {
+  if (p->span_type != type) {
+    if (type == span_value && p->span_type == span_field)
+      ac_buffer_appendc(p->span, ':');
+    else if (!finish_span(p))
+      return -1;
+    p->span_type = type;
+  }
+  ac_buffer_append(p->span, at, length);
+  return 0;
+}
+
+static int on_url(llhttp_t *ll, const char *at, size_t length) {
+  return append_span((ac_http_t *)ll->data, span_url, at, length);
+}
+
+static int on_status(llhttp_t *ll, const char *at, size_t length) {
+  return append_span((ac_http_t *)ll->data, span_status, at, length);
+}
+
+static int on_header_field(llhttp_t *ll, const char *at, size_t length) {
+  return append_span((ac_http_t *)ll->data, span_field, at, length);
+}
+
+static int on_header_value(llhttp_t *ll, const char *at, size_t length) {
+  return append_span((ac_http_t *)ll->data, span_value, at, length);
+}
+
+static int on_headers_complete(llhttp_t *ll) {
+  ac_http_t *p = (ac_http_t *)ll->data;
+  if (!finish_span(p))
+    return -1;
+  bool responses = p->group->responses;
+  if (responses) {
+    p->status = ll->status_code;
+    if (!p->reason)
+      p->reason = ac_pool_strdup(p->pool, "");
+  } else {
+    p->method = (char *)llhttp_method_name((llhttp_method_t)ll->method);
+    if (!p->uri)
+      p->uri = ac_pool_strdup(p->pool, "");
+  }
+  p->protocol =
+      ac_pool_strdupf(p->pool, "HTTP/%d.%d", ll->http_major, ll->http_minor);
+  if ((responses ? !p->reason : !p->uri) || !p->protocol || bad_framing(p))
+    return -1;
+  p->state ^= http_state_reading_headers;
+  stamp_headers(p);
+  /* a response without a length ends when the connection closes */
+  p->stream_body =
+      p->group->on_body_chunk &&
+      ((ll->flags & F_CHUNKED) || ll->content_length > p->group->max_buffered ||
+       (responses && !(ll->flags & F_CONTENT_LENGTH)));
+  p->group->on_headers(p);
+  /* 1 tells llhttp that the response has no body */
+  return p->no_body ? 1 : 0;
+}
+
+/* checks as much of the "\r\n" after a chunk as s..ep has */
+static bool check_crlf(ac_http_t *p, const char *s, const char *ep) {
+  for (; p->crlf_left && s < ep; s++, p->crlf_left--)
+    if (*s != (p->crlf_left == 2 ? '\r' : '\n'))
+      return false;
+  return true;
+}
+
+static int on_chunk_header(llhttp_t *ll) {
+  ((ac_http_t *)ll->data)->chunk_left = ll->content_length;
+  return 0;
+}
+
+static int on_body(llhttp_t *ll, const char *at, size_t length) {
+  ac_http_t *p = (ac_http_t *)ll->data;
+  if ((ll->flags & F_CHUNKED) && length) {
+    p->chunk_left -= length;
+    if (!p->chunk_left) {
+      p->crlf_left = 2;
+      if (!check_crlf(p, at + length, p->input_end))
+        return -1;
+    }
+  }
+  if (p->stream_body) {
+    p->group->on_body_chunk(p, at, length);
+    return 0;
+  }
+  append_body(p, at, length);
+  return 0;
+}
+
+/* a release from on_request_end pauses llhttp, ac_http_parse finishes it */
+static int on_message_complete(llhttp_t *ll) {
+  ac_http_t *p = (ac_http_t *)ll->data;
+  /* llhttp leaves the length of a skipped body (HEAD) for the next response
+     to add its Content-Length digits to */
+  ll->content_length = 0;
+  p->state |= http_state_read_complete;
+  if (!finish_body(p))
+    return -1;
+  stamp_body(p);
+  p->in_callback = 1;
+  p->group->on_request_end(p, p->post_data, p->post_size);
+  p->in_callback = 0;
+  record_timing(p);
+  if (p->release_pending)
+    return HPE_PAUSED;
+  reset_request(p);
+  return 0;
+}
+
+static const llhttp_settings_t llhttp_settings = {
+    .on_url = on_url,
+    .on_status = on_status,
+    .on_header_field = on_header_field,
+    .on_header_value = on_header_value,
+    .on_headers_complete = on_headers_complete,
+    .on_body = on_body,
+    .on_message_complete = on_message_complete,
+    .on_chunk_header = on_chunk_header,
+};
+#endif
+
+void ac_http_group_set_responses(ac_http_group_t *g, bool on) {
+  g->responses = on;
+}
+
+void ac_http_group_set_max_buffered(ac_http_group_t *g, size_t size) {
+  g->max_buffered = size;
+}
+
+void ac_http_group_set_spool(ac_http_group_t *g, size_t threshold,
+                             const char *dir) {
+  if (!dir)
+    dir = getenv("TMPDIR");
+  if (!dir || !dir[0])
+    dir = "/tmp";
+  if (g->spool_dir)
+    ac_free(g->spool_dir);
+  g->spool_dir = ac_strdup(dir);
+  g->spool_threshold = threshold;
+}
+
+void ac_http_group_set_max_pooled(ac_http_group_t *g, uint32_t num) {
+  g->max_pooled = num;
+}
+
+void ac_http_group_set_memory_limits(ac_http_group_t *g, size_t per_request,
+                                     size_t total) {
+  g->memory_limits = true;
+  g->request_memory = per_request;
+  if (total && !g->memory)
+    g->memory = ac_pool_limit_init(total);
+  else if (g->memory)
+    ac_pool_limit_set_max_bytes(g->memory, total ? total : (size_t)-1);
+}
+
 void ac_http_set_arg(ac_http_t *p, void *arg) {
   if (p)
     p->arg = arg;
@@ -318,86 +1230,179 @@ void *ac_http_get_arg(ac_http_t *p) { return (p) ? p->arg : NULL; }
 ac_http_t *ac_http_init(ac_http_group_t *g) {
   ac_http_t *res = NULL;
   if (g) {
-    int pool_member = 1;
-    pthread_mutex_lock(&g->lock);
-    if (g->parser_pool) {
-      res = g->parser_pool;
-      g->parser_pool = res->next;
-    } else {
-      pool_member = (g->pool_size + 1 < max_parser_group) ? 1 : 0;
-      if (pool_member) {
-        g->pool_size++;
-      }
-    }
-    pthread_mutex_unlock(&g->lock);
+    res = pop_parser(g, get_cache(g));
     if (!res) {
-      res = (ac_http_t *)ac_malloc(sizeof(*res));
+      res = (ac_http_t *)ac_calloc(sizeof(*res));
       res->group = g;
-      res->pool_member = pool_member;
-      res->pool = ac_pool_init(1024);
+      res->pool = ac_pool_init(AC_HTTP_POOL_SIZE);
+      ac_pool_set_minimum_growth_size(res->pool, AC_HTTP_POOL_GROWTH_SIZE);
+      res->spool_fd = -1;
+#ifdef AC_HTTP_LLHTTP
+      res->span = ac_buffer_init(256);
+#else
       res->async_buffer = ac_async_buffer_init();
       ac_async_buffer_set_arg(res->async_buffer, res);
+#endif
     }
-    res->state = http_state_reading_headers;
-    gettimeofday(&res->session_start, NULL);
+    res->next = NULL;
+    res->arg = NULL;
+    if (g->memory_limits) {
+      ac_pool_set_limits(res->pool, 0, g->request_memory, NULL, NULL);
+      ac_pool_set_shared_limit(res->pool, g->memory);
+    }
+    reset_request(res);
+#ifdef AC_HTTP_LLHTTP
+    /* this llhttp has no lenient mode.  If it is updated, leave the lenient
+       flags off, they accept framing which the builtin parser rejects. */
+    llhttp_init(&res->llhttp, g->responses ? HTTP_RESPONSE : HTTP_REQUEST,
+                &llhttp_settings);
+    res->llhttp.data = res;
+#else
     ac_async_buffer_advance_to_string(res->async_buffer, "\r\n\r\n", on_data);
+#endif
   }
   return res;
 }
 
+static void release_parser(ac_http_t *p) {
+  ac_http_group_t *g = p->group;
+  p->release_pending = 0;
+  if (p->chunk_body_cache)
+    ac_buffer_destroy(p->chunk_body_cache);
+  p->chunk_body_cache = NULL;
+  /* a pooled parser doesn't hold a file */
+  if (p->spool_fd != -1)
+    close(p->spool_fd);
+  p->spool_fd = -1;
+  p->spooling = p->spool_failed = false;
+#ifndef AC_HTTP_LLHTTP
+  ac_async_buffer_clear(p->async_buffer);
+#endif
+  ac_pool_clear(p->pool);
+  ac_http_cache_t *c = get_cache(g);
+  p->next = c->head;
+  c->head = p;
+  c->num++;
+  if (c->num < AC_HTTP_THREAD_CACHE)
+    return;
+  /* move half of the cache to the group's stack */
+  ac_http_t *head = c->head;
+  ac_http_t *tail = head;
+  uint32_t num = 1;
+  while (num < AC_HTTP_THREAD_CACHE / 2) {
+    tail = tail->next;
+    num++;
+  }
+  c->head = tail->next;
+  c->num -= num;
+  tail->next = NULL;
+  push_parsers(g, head, tail, num);
+}
+
 void ac_http_release(ac_http_t *p) {
   if (p) {
-    ac_buffer_destroy(p->chunk_body_cache);
-    p->chunk_body_cache = NULL;
-    if (p->pool_member) {
-      ac_async_buffer_clear(p->async_buffer);
-      ac_pool_clear(p->pool);
-      pthread_mutex_lock(&p->group->lock); // lock
-      p->next = p->group->parser_pool;
-      p->group->parser_pool = p;
-      pthread_mutex_unlock(&p->group->lock); // unlock
-    } else {
-      ac_async_buffer_destroy(p->async_buffer);
-      ac_pool_destroy(p->pool);
-      ac_free(p);
-    }
+    record_timing(p);
+    if (p->in_callback)
+      p->release_pending = 1;
+    else
+      release_parser(p);
   }
 }
 
 void ac_http_parse(ac_http_t *p, char const *data, size_t data_length) {
+  AC_TRACE_SCOPE("ac_http_parse");
+  if (p->state & http_state_parse_error)
+    return;
   if (p->state & http_state_read_complete) {
-    p->group->on_parsing_error(p);
+    parse_error(p);
+    return;
+  }
+  if (p->group->timing && !p->times.first_byte)
+    p->times.first_byte = timing_now();
+#ifdef AC_HTTP_LLHTTP
+  /* the end of the previous chunk's "\r\n" may be in this data */
+  p->input_end = data + data_length;
+  if (p->crlf_left && !check_crlf(p, data, p->input_end)) {
+    parse_error(p);
+    return;
+  }
+  llhttp_errno_t err = llhttp_execute(&p->llhttp, data, data_length);
+  if (err == HPE_OK)
+    return;
+  if (err == HPE_PAUSED && p->release_pending) {
+    release_parser(p);
     return;
   }
+  parse_error(p);
+#else
   ac_async_buffer_parse(p->async_buffer, data, data_length);
+#endif
+}
+
+void ac_http_finish(ac_http_t *p) {
+#ifdef AC_HTTP_LLHTTP
+  /* llhttp completes a response which ends with the connection */
+  if (!(p->state & http_state_read_complete) &&
+      llhttp_finish(&p->llhttp) == HPE_PAUSED && p->release_pending)
+    release_parser(p);
+#else
+  if (p->state & http_state_reading_until_close) {
+    p->state ^= (http_state_reading_until_close | http_state_read_complete);
+    body_end(p);
+  }
+#endif
+}
+
+void ac_http_set_no_body(ac_http_t *p) { p->no_body = true; }
+
+int ac_http_status(ac_http_t *p) { return p ? p->status : 0; }
+
+char const *ac_http_reason(ac_http_t *p) { return p ? p->reason : NULL; }
+
+const ac_http_timestamps_t *ac_http_timestamps(ac_http_t *p) {
+  return &p->times;
 }
 
 char const *ac_http_method(ac_http_t *p) { return p ? p->method : NULL; }
 
 char const *ac_http_uri(ac_http_t *p) { return p ? p->uri : NULL; }
 
+char const *ac_http_protocol(ac_http_t *p) { return p ? p->protocol : NULL; }
+
+ac_pool_t *ac_http_pool(ac_http_t *p) { return p ? p->pool : NULL; }
+
+int ac_http_body_fd(ac_http_t *p, size_t *length) {
+  if (!p || !p->spooling || !(p->state & http_state_read_complete)) {
+    *length = 0;
+    return -1;
+  }
+  *length = p->spooled;
+  return p->spool_fd;
+}
+
+uint32_t ac_http_num_headers(ac_http_t *p) { return p ? p->num_headers : 0; }
+
+char const *ac_http_header(ac_http_t *p, uint32_t i, size_t *name_length,
+                           char const **value) {
+  if (!p || i >= p->num_headers)
+    return NULL;
+  *name_length = p->headers[i].name_length;
+  *value = p->headers[i].value;
+  return p->headers[i].name;
+}
+
+static ac_http_header_t *get_header(ac_http_t *p, char const *field,
+                                    size_t field_length) {
+  if (!p->header_slots)
+    return NULL;
+  return find_header(p, field, field_length,
+                     header_hash(field, field_length));
+}
+
 static char *get_header_param(ac_http_t *p, char const *field,
                               size_t field_length) {
-  char *res = NULL;
-  if (p && field_length) {
-    for (uint32_t i = 0; res == NULL && i < p->num_headers; ++i) {
-      if (!strncasecmp(p->headers[i], field, field_length)) {
-        res = p->headers[i] + field_length;
-        while (*res == ' ')
-          res++;
-        if (*res != ':') {
-          res = NULL;
-        } else {
-          do {
-            res++;
-          } while (*res == ' ');
-          if (*res == 0)
-            res = NULL;
-        }
-      }
-    }
-  }
-  return res;
+  ac_http_header_t *h = get_header(p, field, field_length);
+  return h ? h->value : NULL;
 }
 
 static ac_cgi_t *get_query_cgi(ac_http_t *p) {
@@ -413,8 +1418,7 @@ static ac_cgi_t *get_body_cgi(ac_http_t *p) {
     if (p->post_size && content_type &&
         !strncasecmp(content_type, "application/x-www-form-urlencoded",
                      strlen("application/x-www-form-urlencoded"))) {
-      p->body_cgi = ac_cgi_init(
-          p->pool, ac_pool_strndup(p->pool, p->post_data, p->post_size));
+      p->body_cgi = ac_cgi_init_n(p->pool, p->post_data, p->post_size);
     }
   }
   return p->body_cgi;
@@ -439,6 +1443,27 @@ char const *ac_http_param(ac_http_t *p, ac_http_param_location_t loc,
   return (res == NULL) ? default_value : res;
 }
 
+ac_strview_t ac_http_param_n(ac_http_t *p, ac_http_param_location_t loc,
+                             char const *key, size_t key_length) {
+  ac_strview_t res = ac_strview(NULL, 0);
+  if (p && key && key_length) {
+    switch (loc) {
+    case header: {
+      ac_http_header_t *h = get_header(p, key, key_length);
+      if (h && h->value)
+        res = ac_strview(h->value, h->value_length);
+    } break;
+    case query:
+      res = ac_cgi_view(get_query_cgi(p), key, key_length);
+      break;
+    case body:
+      res = ac_cgi_view(get_body_cgi(p), key, key_length);
+      break;
+    }
+  }
+  return res;
+}
+
 char **ac_http_params(ac_http_t *p, ac_http_param_location_t loc,
                       char const *key) {
 
@@ -16,6 +16,11 @@ limitations under the License.
 
 #ifndef ac_http_H
 #define ac_http_H
+#include "ac_common.h"
+#include "ac_histogram.h"
+#include "ac_pool.h"
+
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -23,6 +28,13 @@ limitations under the License.
 extern "C" {
 #endif
 
+/*  By default, the request line and headers are buffered until the blank
+    line which ends them and then parsed.  Building with AC_HTTP_LLHTTP
+    (LLHTTP_FLAGS and LLHTTP_OBJECTS in Makefile.include) parses requests
+    with the vendored llhttp as the bytes arrive instead.  Both reject the
+    same malformed framing (a repeated or bad Content-Length, one with a
+    Transfer-Encoding, a request which isn't chunked last, or a chunk
+    without its "\r\n").  */
 typedef struct ac_http_group_s ac_http_group_t;
 typedef struct ac_http_s ac_http_t;
 
@@ -30,11 +42,142 @@ typedef void (*ac_http_f)(ac_http_t *);
 typedef void (*ac_http_data_f)(ac_http_t *, char const *data,
                                size_t data_length);
 
-/*  Init/destroy group container for parsers  */
+/*  Content-Length bodies which are larger than this are passed to the chunk
+    callback as they arrive instead of being buffered  */
+#ifndef AC_HTTP_MAX_BUFFERED
+#define AC_HTTP_MAX_BUFFERED (64 * 1024)
+#endif
+
+/*  Spooled bodies are written to their file this many bytes at a time  */
+#ifndef AC_HTTP_SPOOL_BUFFER
+#define AC_HTTP_SPOOL_BUFFER (64 * 1024)
+#endif
+
+/*  Released parsers are reused.  Each thread caches up to
+    AC_HTTP_THREAD_CACHE parsers for a group and the rest are shared through
+    the group, which keeps up to its max pooled (AC_HTTP_MAX_POOLED by
+    default) and frees any more.  */
+#ifndef AC_HTTP_THREAD_CACHE
+#define AC_HTTP_THREAD_CACHE 64
+#endif
+
+#ifndef AC_HTTP_MAX_POOLED
+#define AC_HTTP_MAX_POOLED 4096
+#endif
+
+/*  Each parser's pool (ac_http_pool) starts with AC_HTTP_POOL_SIZE bytes and
+    grows by at least AC_HTTP_POOL_GROWTH_SIZE bytes at a time.  The pool is
+    cleared between requests, so a first block which holds a typical request
+    means that requests don't allocate.  */
+#ifndef AC_HTTP_POOL_SIZE
+#define AC_HTTP_POOL_SIZE 1024
+#endif
+
+#ifndef AC_HTTP_POOL_GROWTH_SIZE
+#define AC_HTTP_POOL_GROWTH_SIZE AC_HTTP_POOL_SIZE
+#endif
+
+/*  Init/destroy group container for parsers.  The chunk callback is
+    optional, without it every body is buffered and passed to the end
+    callback.  With it, chunked bodies and Content-Length bodies larger than
+    the group's max buffered size are passed to it a piece at a time (and
+    the end callback gets no data).  Every parser must be released before
+    the group is destroyed.  */
 ac_http_group_t *ac_http_group_init(ac_http_f headers, ac_http_data_f chunk,
                                     ac_http_data_f end, ac_http_f error);
 void ac_http_group_destroy(ac_http_group_t *);
 
+/*  Set the largest Content-Length body which is buffered (the default is
+    AC_HTTP_MAX_BUFFERED).  Body parameters are only available for buffered
+    bodies.  */
+void ac_http_group_set_max_buffered(ac_http_group_t *, size_t size);
+
+/*  Spool large bodies to a file (off by default).  Without a chunk
+    callback, a body which grows beyond threshold bytes (or has a larger
+    Content-Length) is written to an unlinked temporary file in dir (NULL
+    for $TMPDIR or /tmp) instead of being buffered, so each connection
+    holds at most about threshold bytes of its body.  The end callback gets
+    no data for a spooled body, it reads it with ac_http_body_fd (and there
+    are no body parameters).  A body which can't be written goes to the
+    error callback.  0 turns spooling off.  */
+void ac_http_group_set_spool(ac_http_group_t *, size_t threshold,
+                             const char *dir);
+
+/*  Set the number of released parsers the group shares between threads
+    beyond the thread caches (the default is AC_HTTP_MAX_POOLED).  */
+void ac_http_group_set_max_pooled(ac_http_group_t *, uint32_t num);
+
+/*  Bound the memory that requests take in their pools (ac_http_pool).
+    per_request is a hard limit on each request's pool and total caps the
+    bytes that all of the group's requests add beyond their first blocks
+    (0 turns either off).  A request which goes over a limit while its line
+    and headers are parsed goes to the error callback, which can tell it
+    apart from a malformed request with ac_pool_failed(ac_http_pool(p)) and
+    respond with a 431 or 503.  Handlers that allocate from the pool must
+    check for NULL once limits are set.  The limits apply to parsers as they
+    are initialized.  */
+void ac_http_group_set_memory_limits(ac_http_group_t *, size_t per_request,
+                                     size_t total);
+
+/*  Parse responses (from a server) instead of requests, for a client such as
+    ac_http_client.  The status line is split into ac_http_protocol,
+    ac_http_status and ac_http_reason (ac_http_method and ac_http_uri are
+    NULL), and the end callback is called at the end of each response.
+    Responses with a 1xx, 204, or 304 status have no body and a response
+    without a Content-Length (or chunked encoding) ends when the connection
+    closes (see ac_http_finish).  Must be set before the group's parsers are
+    initialized.  */
+void ac_http_group_set_responses(ac_http_group_t *, bool on);
+
+/*  Per request timing (off by default).  When it is on, each parser
+    records the time (in nanoseconds from a monotonic clock) at which the
+    first byte of the request was parsed, the headers were complete, the
+    body was complete, and the request was released (the end callback
+    returned or the parser was released).  A request whose bytes arrived
+    with the previous request (pipelining) starts when its headers are
+    parsed.  A stamp is 0 until it is reached.  */
+typedef struct {
+  uint64_t first_byte;
+  uint64_t headers_complete;
+  uint64_t body_complete;
+  uint64_t released;
+} ac_http_timestamps_t;
+
+/*  Each complete request adds the time taken reading its headers (from the
+    first byte), reading its body, handling it (from the end of the body to
+    the release), and in total to the group's histograms.  The histograms
+    have eight buckets per power of two (so percentiles are within 12.5%)
+    and may be updated from many threads at once.  */
+typedef enum {
+  ac_http_timing_headers,
+  ac_http_timing_body,
+  ac_http_timing_handler,
+  ac_http_timing_total
+} ac_http_timing_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} ac_http_timing_stats_t;
+
+/*  Turn timing on or off for the parsers of the group  */
+void ac_http_group_set_timing(ac_http_group_t *, bool on);
+
+/*  Summarize (in nanoseconds) or clear the group's histograms  */
+void ac_http_group_timing(ac_http_group_t *, ac_http_timing_t which,
+                          ac_http_timing_stats_t *stats);
+void ac_http_group_reset_timing(ac_http_group_t *);
+
+/*  The histogram behind ac_http_group_timing (to merge, save, or query
+    other percentiles).  It belongs to the group.  */
+ac_histogram_t *ac_http_group_histogram(ac_http_group_t *,
+                                        ac_http_timing_t which);
+
 /*  Initialize/release an http parser  */
 ac_http_t *ac_http_init(ac_http_group_t *);
 void ac_http_release(ac_http_t *);
@@ -44,15 +187,59 @@ void ac_http_set_arg(ac_http_t *, void *);
 void *ac_http_get_arg(ac_http_t *);
 
 /*  Add data to the http parser.  Registered callbacks will be called
-    for each parsing event.  */
+    for each parsing event.  Once the end callback returns, the parser moves
+    on to the next request on the connection (keep-alive), which may already
+    be in the same data (pipelining).  The request is only valid until the
+    end callback returns.  ac_http_release may be called from the end
+    callback, it takes effect after the callback returns.  The error
+    callback is called once, the data given to the parser after it is
+    ignored.  */
 void ac_http_parse(ac_http_t *, char const *data, size_t data_length);
 
+/*  The timestamps of the current request (all 0 if timing is off)  */
+const ac_http_timestamps_t *ac_http_timestamps(ac_http_t *);
+
 /*  Get method of request  */
 char const *ac_http_method(ac_http_t *);
 
 /*  Get uri of request  */
 char const *ac_http_uri(ac_http_t *);
 
+/*  The pool which holds the current request.  It is cleared when the next
+    request begins, so it suits data which lives as long as the request.  */
+ac_pool_t *ac_http_pool(ac_http_t *);
+
+/*  The file which the current request's body was spooled to (positioned at
+    the start of the body) and the length of the body, or -1 if the body
+    wasn't spooled.  The file belongs to the parser (it is reused for the
+    next spooled body), so it shouldn't be closed.  It is only valid until
+    the end callback returns.  */
+int ac_http_body_fd(ac_http_t *, size_t *length);
+
+/*  Get protocol of request (such as HTTP/1.1)  */
+char const *ac_http_protocol(ac_http_t *);
+
+/*  The status code (such as 200) and reason phrase (such as OK) of a
+    response  */
+int ac_http_status(ac_http_t *);
+char const *ac_http_reason(ac_http_t *);
+
+/*  Called from the headers callback to say that the response has no body
+    even though its headers may describe one (the response to a HEAD
+    request)  */
+void ac_http_set_no_body(ac_http_t *);
+
+/*  The connection was closed.  A response whose body ends with the
+    connection is completed (the end callback is called).  */
+void ac_http_finish(ac_http_t *);
+
+/*  The number of headers and the name of header i (which is not zero
+    terminated, its length is name_length).  value is set to the value of
+    the header (NULL if it has none).  Returns NULL if i is out of range.  */
+uint32_t ac_http_num_headers(ac_http_t *);
+char const *ac_http_header(ac_http_t *, uint32_t i, size_t *name_length,
+                           char const **value);
+
 /*  Parameter locations  */
 typedef enum { header, query, body } ac_http_param_location_t;
 
@@ -60,6 +247,12 @@ typedef enum { header, query, body } ac_http_param_location_t;
 char const *ac_http_param(ac_http_t *, ac_http_param_location_t,
                           char const *key, char const *default_value /*=""*/);
 
+/*  Like ac_http_param, except key is key_length bytes and the value is
+    returned with its length (ptr is NULL if key isn't found).  The value is
+    zero terminated and valid for the life of the request.  */
+ac_strview_t ac_http_param_n(ac_http_t *, ac_http_param_location_t,
+                             char const *key, size_t key_length);
+
 /*  Get multiple params for a single key.  Returned value array is
     NULL terminated and valid for the life of the request  */
 char **ac_http_params(ac_http_t *, ac_http_param_location_t, char const *key);
@@ -0,0 +1,615 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_http_client.h"
+
+#include "ac_allocator.h"
+#include "ac_buffer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+typedef struct conn_s conn_t;
+typedef ac_http_client_request_t request_t;
+
+struct ac_http_client_request_s {
+  ac_pool_t *pool;
+  ac_http_upstream_t *upstream;
+  /* the request line and headers */
+  ac_buffer_t *head;
+  const void *body;
+  size_t body_length;
+  ac_http_client_headers_f on_headers;
+  ac_http_client_data_f on_data;
+  ac_http_client_done_f on_done;
+  void *arg;
+  uv_write_t write_req;
+  bool has_host;
+  bool has_body;
+  bool no_body; /* HEAD */
+  bool idempotent;
+  bool retried;
+  bool responding; /* its response has started */
+  /* the write still uses the head and body, so it holds the request until
+     it finishes */
+  bool writing;
+  bool finished;
+  request_t *next;
+};
+
+struct conn_s {
+  uv_tcp_t tcp;
+  uv_connect_t connect_req;
+  ac_http_upstream_t *upstream;
+  ac_http_t *parser;
+  /* the requests which have been sent in the order that their responses
+     will arrive */
+  request_t *head;
+  request_t *tail;
+  uint32_t in_flight;
+  /* the number of responses which have been received */
+  uint64_t responses;
+  bool connected;
+  bool closed;
+  /* the server will close the connection after the current response */
+  bool close_after;
+  bool error;
+  conn_t *next;
+  conn_t *prev;
+};
+
+struct ac_http_upstream_s {
+  ac_http_client_t *client;
+  struct sockaddr_storage addr;
+  char host[64];
+  conn_t *conns;
+  uint32_t num_conns;
+  uint32_t num_connecting;
+  uint32_t max_conns;
+  uint32_t max_idle;
+  uint32_t pipeline;
+  /* requests which haven't been sent */
+  request_t *pending;
+  request_t *pending_tail;
+  uint32_t num_pending;
+  ac_http_upstream_t *next;
+};
+
+struct ac_http_client_s {
+  uv_loop_t *loop;
+  ac_http_group_t *group;
+  ac_http_upstream_t *upstreams;
+  request_t *free_requests;
+  /* connections which haven't been closed, the client is freed once they
+     are after it is destroyed */
+  uint32_t num_conns;
+  bool destroyed;
+  char buffer[AC_HTTP_CLIENT_READ_SIZE];
+};
+
+static void free_client(ac_http_client_t *c) {
+  while (c->upstreams) {
+    ac_http_upstream_t *u = c->upstreams;
+    c->upstreams = u->next;
+    ac_free(u);
+  }
+  while (c->free_requests) {
+    request_t *r = c->free_requests;
+    c->free_requests = r->next;
+    ac_pool_destroy(r->pool);
+    ac_free(r);
+  }
+  ac_http_group_destroy(c->group);
+  ac_free(c);
+}
+
+static void recycle_request(request_t *r) {
+  ac_http_client_t *c = r->upstream->client;
+  ac_pool_clear(r->pool);
+  r->next = c->free_requests;
+  c->free_requests = r;
+}
+
+static void finish_request(request_t *r, int error) {
+  if (r->on_done)
+    r->on_done(r, error);
+  r->finished = true;
+  if (!r->writing)
+    recycle_request(r);
+}
+
+static void push_pending(ac_http_upstream_t *u, request_t *r) {
+  r->next = NULL;
+  if (u->pending_tail)
+    u->pending_tail->next = r;
+  else
+    u->pending = r;
+  u->pending_tail = r;
+  u->num_pending++;
+}
+
+/* requests which are sent again go before the ones which are waiting */
+static void unshift_pending(ac_http_upstream_t *u, request_t *head,
+                            request_t *tail, uint32_t num) {
+  tail->next = u->pending;
+  u->pending = head;
+  if (!u->pending_tail)
+    u->pending_tail = tail;
+  u->num_pending += num;
+}
+
+static void fail_pending(ac_http_upstream_t *u, int error) {
+  while (u->pending) {
+    request_t *r = u->pending;
+    u->pending = r->next;
+    u->num_pending--;
+    finish_request(r, error);
+  }
+  u->pending_tail = NULL;
+}
+
+static void on_conn_close(uv_handle_t *h) {
+  conn_t *c = (conn_t *)h->data;
+  ac_http_client_t *client = c->upstream->client;
+  ac_free(c);
+  client->num_conns--;
+  if (client->destroyed && !client->num_conns)
+    free_client(client);
+}
+
+static void dispatch(ac_http_upstream_t *u);
+
+/* close the connection and finish (or send again) the requests in flight */
+static void close_conn(conn_t *c, int error) {
+  if (c->closed)
+    return;
+  c->closed = true;
+  ac_http_upstream_t *u = c->upstream;
+  if (!c->connected)
+    u->num_connecting--;
+  if (c->next)
+    c->next->prev = c->prev;
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    u->conns = c->next;
+  u->num_conns--;
+  if (c->parser)
+    ac_http_release(c->parser);
+  c->parser = NULL;
+
+  request_t *retry = NULL, *retry_tail = NULL;
+  uint32_t num_retry = 0;
+  bool destroyed = u->client->destroyed;
+  while (c->head) {
+    request_t *r = c->head;
+    c->head = r->next;
+    /* the server didn't see (or ignored) a request if it closed the
+       connection before responding to it.  One which is still being
+       written can't be sent again until the write finishes, so it fails. */
+    bool resend = !destroyed && !r->responding && !r->writing &&
+                  (c->close_after ||
+                   (!r->retried && r->idempotent && c->responses));
+    if (resend) {
+      r->retried = r->retried || !c->close_after;
+      r->next = NULL;
+      if (retry_tail)
+        retry_tail->next = r;
+      else
+        retry = r;
+      retry_tail = r;
+      num_retry++;
+    } else
+      finish_request(r, error);
+  }
+  c->tail = NULL;
+  c->in_flight = 0;
+  uv_close((uv_handle_t *)&c->tcp, on_conn_close);
+  if (retry)
+    unshift_pending(u, retry, retry_tail, num_retry);
+  if (!destroyed)
+    dispatch(u);
+}
+
+static bool has_token(const char *value, const char *token) {
+  size_t len = strlen(token);
+  const char *p = value;
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (!strncasecmp(p, token, len) &&
+        (!p[len] || p[len] == ',' || p[len] == ' ' || p[len] == '\t'))
+      return true;
+    while (*p && *p != ',')
+      p++;
+  }
+  return false;
+}
+
+static void on_headers(ac_http_t *p) {
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  request_t *r = c->head;
+  if (!r) {
+    /* a response without a request */
+    c->error = true;
+    return;
+  }
+  /* an interim response (100 Continue) comes before the real one */
+  if (ac_http_status(p) / 100 == 1)
+    return;
+  if (r->no_body)
+    ac_http_set_no_body(p);
+  const char *connection = ac_http_param(p, header, "Connection", NULL);
+  const char *protocol = ac_http_protocol(p);
+  if (connection && has_token(connection, "close"))
+    c->close_after = true;
+  else if (protocol && !strcmp(protocol, "HTTP/1.0") &&
+           !(connection && has_token(connection, "keep-alive")))
+    c->close_after = true;
+  r->responding = true;
+  if (r->on_headers)
+    r->on_headers(r, p);
+}
+
+static void on_body(ac_http_t *p, char const *data, size_t length) {
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  request_t *r = c->head;
+  if (r && r->responding && r->on_data && length)
+    r->on_data(r, data, length);
+}
+
+static void on_end(ac_http_t *p, char const *data, size_t length) {
+  (void)data;
+  (void)length;
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  request_t *r = c->head;
+  if (!r || !r->responding)
+    return;
+  c->head = r->next;
+  if (!c->head)
+    c->tail = NULL;
+  c->in_flight--;
+  c->responses++;
+  finish_request(r, 0);
+}
+
+static void on_parse_error(ac_http_t *p) {
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  c->error = true;
+}
+
+static void on_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+  (void)suggested;
+  conn_t *c = (conn_t *)h->data;
+  ac_http_client_t *client = c->upstream->client;
+  *buf = uv_buf_init(client->buffer, sizeof(client->buffer));
+}
+
+/* an idle connection is closed if the upstream has more idle connections
+   than it keeps */
+static void check_idle(conn_t *c) {
+  ac_http_upstream_t *u = c->upstream;
+  if (c->in_flight || u->pending)
+    return;
+  uint32_t idle = 0;
+  for (conn_t *n = u->conns; n; n = n->next)
+    if (n->connected && !n->in_flight)
+      idle++;
+  if (idle > u->max_idle)
+    close_conn(c, 0);
+}
+
+static void on_read(uv_stream_t *h, ssize_t nread, const uv_buf_t *buf) {
+  conn_t *c = (conn_t *)h->data;
+  if (nread < 0) {
+    /* a response which ends with the connection is finished */
+    ac_http_finish(c->parser);
+    close_conn(c, nread == UV_EOF ? UV_ECONNRESET : (int)nread);
+    return;
+  }
+  if (!nread)
+    return;
+  ac_http_parse(c->parser, buf->base, nread);
+  if (c->error)
+    close_conn(c, UV_EPROTO);
+  else if (c->close_after && !(c->head && c->head->responding))
+    close_conn(c, UV_ECONNRESET);
+  else {
+    dispatch(c->upstream);
+    if (!c->closed)
+      check_idle(c);
+  }
+}
+
+static void on_write(uv_write_t *w, int status) {
+  request_t *r = (request_t *)w->data;
+  conn_t *c = (conn_t *)w->handle->data;
+  r->writing = false;
+  if (r->finished)
+    recycle_request(r);
+  if (status < 0 && status != UV_ECANCELED)
+    close_conn(c, status);
+}
+
+static void send_request(conn_t *c, request_t *r) {
+  r->next = NULL;
+  if (c->tail)
+    c->tail->next = r;
+  else
+    c->head = r;
+  c->tail = r;
+  c->in_flight++;
+
+  uv_buf_t bufs[2];
+  int num_bufs = 0;
+  bufs[num_bufs++] =
+      uv_buf_init(ac_buffer_data(r->head), ac_buffer_length(r->head));
+  if (r->body_length)
+    bufs[num_bufs++] = uv_buf_init((char *)r->body, r->body_length);
+  r->write_req.data = r;
+  r->writing = true;
+  int err = uv_write(&r->write_req, (uv_stream_t *)&c->tcp, bufs, num_bufs,
+                     on_write);
+  if (err < 0) {
+    r->writing = false;
+    close_conn(c, err);
+  }
+}
+
+/* the waiting requests fail unless another connection can send them
+   (otherwise dispatch would keep opening connections for them) */
+static void connect_failed(conn_t *c, int error) {
+  ac_http_upstream_t *u = c->upstream;
+  bool connected = false;
+  for (conn_t *n = u->conns; n; n = n->next)
+    if (n->connected && !n->close_after)
+      connected = true;
+  if (!connected)
+    fail_pending(u, error);
+  close_conn(c, error);
+}
+
+static void on_connect(uv_connect_t *req, int status) {
+  conn_t *c = (conn_t *)req->data;
+  if (c->closed)
+    return;
+  ac_http_upstream_t *u = c->upstream;
+  if (status < 0) {
+    connect_failed(c, status);
+    return;
+  }
+  u->num_connecting--;
+  c->connected = true;
+  uv_tcp_nodelay(&c->tcp, 1);
+  uv_read_start((uv_stream_t *)&c->tcp, on_alloc, on_read);
+  dispatch(u);
+}
+
+static void open_conn(ac_http_upstream_t *u) {
+  ac_http_client_t *client = u->client;
+  conn_t *c = (conn_t *)ac_calloc(sizeof(*c));
+  if (!c)
+    abort();
+  c->upstream = u;
+  c->next = u->conns;
+  if (c->next)
+    c->next->prev = c;
+  u->conns = c;
+  u->num_conns++;
+  u->num_connecting++;
+  client->num_conns++;
+  uv_tcp_init(client->loop, &c->tcp);
+  c->tcp.data = c;
+  c->parser = ac_http_init(client->group);
+  ac_http_set_arg(c->parser, c);
+  c->connect_req.data = c;
+  int err = uv_tcp_connect(&c->connect_req, &c->tcp,
+                           (const struct sockaddr *)&u->addr, on_connect);
+  if (err < 0) {
+    /* uv_tcp_connect fails the same way for every connection */
+    fail_pending(u, err);
+    close_conn(c, err);
+  }
+}
+
+/* send the pending requests on the connections with the fewest requests in
+   flight, opening connections while the ones being opened can't take all of
+   the pending requests */
+static void dispatch(ac_http_upstream_t *u) {
+  while (u->pending) {
+    conn_t *best = NULL;
+    for (conn_t *c = u->conns; c; c = c->next) {
+      if (c->connected && !c->close_after && c->in_flight < u->pipeline &&
+          (!best || c->in_flight < best->in_flight))
+        best = c;
+    }
+    if (!best) {
+      while (u->num_pending > u->num_connecting * u->pipeline &&
+             u->num_conns < u->max_conns) {
+        open_conn(u);
+        /* the connection may have failed and finished the requests */
+        if (!u->pending)
+          return;
+      }
+      return;
+    }
+    request_t *r = u->pending;
+    u->pending = r->next;
+    if (!u->pending)
+      u->pending_tail = NULL;
+    u->num_pending--;
+    send_request(best, r);
+  }
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_http_client_t *_ac_http_client_init(uv_loop_t *loop, const char *caller) {
+  ac_http_client_t *c = (ac_http_client_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_http_client_t), false);
+#else
+ac_http_client_t *_ac_http_client_init(uv_loop_t *loop) {
+  ac_http_client_t *c = (ac_http_client_t *)ac_malloc(sizeof(ac_http_client_t));
+#endif
+  if (!c)
+    abort();
+  memset(c, 0, sizeof(*c));
+  c->loop = loop;
+  c->group = ac_http_group_init(on_headers, on_body, on_end, on_parse_error);
+  ac_http_group_set_responses(c->group, true);
+  /* every body goes to on_body as it arrives */
+  ac_http_group_set_max_buffered(c->group, 0);
+  return c;
+}
+
+void ac_http_client_destroy(ac_http_client_t *c) {
+  if (!c)
+    return;
+  c->destroyed = true;
+  for (ac_http_upstream_t *u = c->upstreams; u; u = u->next) {
+    fail_pending(u, UV_ECANCELED);
+    while (u->conns)
+      close_conn(u->conns, UV_ECANCELED);
+  }
+  if (!c->num_conns)
+    free_client(c);
+}
+
+ac_http_upstream_t *ac_http_client_upstream(ac_http_client_t *c,
+                                            const char *ip, int port) {
+  ac_http_upstream_t *u =
+      (ac_http_upstream_t *)ac_calloc(sizeof(ac_http_upstream_t));
+  if (!u)
+    abort();
+  if (!uv_ip4_addr(ip, port, (struct sockaddr_in *)&u->addr))
+    snprintf(u->host, sizeof(u->host), "%s:%d", ip, port);
+  else if (!uv_ip6_addr(ip, port, (struct sockaddr_in6 *)&u->addr))
+    snprintf(u->host, sizeof(u->host), "[%s]:%d", ip, port);
+  else {
+    ac_free(u);
+    errno = EINVAL;
+    return NULL;
+  }
+  u->client = c;
+  u->max_conns = u->max_idle = 8;
+  u->pipeline = 1;
+  u->next = c->upstreams;
+  c->upstreams = u;
+  return u;
+}
+
+void ac_http_upstream_set_connections(ac_http_upstream_t *u,
+                                      uint32_t max_connections,
+                                      uint32_t max_idle) {
+  u->max_conns = max_connections ? max_connections : 1;
+  u->max_idle = max_idle;
+}
+
+void ac_http_upstream_set_pipeline(ac_http_upstream_t *u, uint32_t depth) {
+  u->pipeline = depth ? depth : 1;
+}
+
+static bool idempotent(const char *method) {
+  static const char *methods[] = {"GET",    "HEAD",    "PUT",
+                                  "DELETE", "OPTIONS", "TRACE"};
+  for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+    if (!strcmp(method, methods[i]))
+      return true;
+  return false;
+}
+
+ac_http_client_request_t *ac_http_client_request_init(ac_http_upstream_t *u,
+                                                      const char *method,
+                                                      const char *uri) {
+  ac_http_client_t *c = u->client;
+  request_t *r = c->free_requests;
+  if (r)
+    c->free_requests = r->next;
+  else {
+    r = (request_t *)ac_malloc(sizeof(*r));
+    if (!r)
+      abort();
+    r->pool = ac_pool_init(AC_HTTP_CLIENT_POOL_SIZE);
+  }
+  ac_pool_t *pool = r->pool;
+  memset(r, 0, sizeof(*r));
+  r->pool = pool;
+  r->upstream = u;
+  r->head = ac_buffer_pool_init(pool, 256);
+  ac_buffer_appends(r->head, method);
+  ac_buffer_appendc(r->head, ' ');
+  ac_buffer_appends(r->head, uri);
+  ac_buffer_appends(r->head, " HTTP/1.1\r\n");
+  r->no_body = !strcmp(method, "HEAD");
+  r->idempotent = idempotent(method);
+  return r;
+}
+
+ac_pool_t *ac_http_client_request_pool(ac_http_client_request_t *r) {
+  return r->pool;
+}
+
+void ac_http_client_request_header(ac_http_client_request_t *r,
+                                   const char *name, const char *value) {
+  if (!strcasecmp(name, "Host"))
+    r->has_host = true;
+  ac_buffer_appends(r->head, name);
+  ac_buffer_append(r->head, ": ", 2);
+  ac_buffer_appends(r->head, value);
+  ac_buffer_append(r->head, "\r\n", 2);
+}
+
+void ac_http_client_request_body(ac_http_client_request_t *r,
+                                 const void *body, size_t length) {
+  r->body = body;
+  r->body_length = length;
+  r->has_body = true;
+}
+
+void ac_http_client_send(ac_http_client_request_t *r,
+                         ac_http_client_headers_f headers,
+                         ac_http_client_data_f data,
+                         ac_http_client_done_f done, void *arg) {
+  ac_http_upstream_t *u = r->upstream;
+  r->on_headers = headers;
+  r->on_data = data;
+  r->on_done = done;
+  r->arg = arg;
+  if (!r->has_host)
+    ac_http_client_request_header(r, "Host", u->host);
+  if (r->has_body) {
+    ac_buffer_appends(r->head, "Content-Length: ");
+    ac_buffer_append_u64(r->head, r->body_length);
+    ac_buffer_append(r->head, "\r\n", 2);
+  }
+  ac_buffer_append(r->head, "\r\n", 2);
+  if (u->client->destroyed) {
+    finish_request(r, UV_ECANCELED);
+    return;
+  }
+  push_pending(u, r);
+  dispatch(u);
+}
+
+void *ac_http_client_request_arg(ac_http_client_request_t *r) {
+  return r->arg;
+}
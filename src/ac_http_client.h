@@ -0,0 +1,162 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_http_client_H
+#define _ac_http_client_H
+
+#include "ac_common.h"
+#include "ac_http.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_http_client_t sends requests to upstream HTTP/1.1 servers from a libuv
+  loop.  Each upstream is an address and port (no names are resolved) with
+  its own keep-alive connections, which are opened as requests need them (up
+  to its max connections) and reused for the requests which follow.  A
+  connection may have several requests in flight (pipelining), their
+  responses arrive in the order the requests were sent.
+
+  Responses are parsed by an ac_http parser in response mode (see
+  ac_http_group_set_responses), so the framing (Content-Length, chunked, and
+  bodies which end with the connection) is the same code which parses
+  requests.  The body is passed to the data callback a piece at a time as it
+  is read, pointing into the read buffer or parser (it isn't copied and is
+  only valid during the callback).
+
+  Every function (and callback) runs on the loop's thread.
+
+    static void on_headers(ac_http_client_request_t *r, ac_http_t *res) {
+      printf("%d %s\n", ac_http_status(res), ac_http_reason(res));
+    }
+    static void on_data(ac_http_client_request_t *r, const char *data,
+                        size_t length) {
+      fwrite(data, length, 1, stdout);
+    }
+    static void on_done(ac_http_client_request_t *r, int error) { ... }
+
+    ac_http_client_t *client = ac_http_client_init(loop);
+    ac_http_upstream_t *u = ac_http_client_upstream(client, "10.0.0.5", 80);
+    ac_http_client_request_t *r = ac_http_client_request_init(u, "GET", "/");
+    ac_http_client_request_header(r, "Accept", "application/json");
+    ac_http_client_send(r, on_headers, on_data, on_done, NULL);
+*/
+struct ac_http_client_s;
+typedef struct ac_http_client_s ac_http_client_t;
+
+struct ac_http_upstream_s;
+typedef struct ac_http_upstream_s ac_http_upstream_t;
+
+struct ac_http_client_request_s;
+typedef struct ac_http_client_request_s ac_http_client_request_t;
+
+/* the status line and headers of the response (use the ac_http functions,
+   such as ac_http_status and ac_http_param, on response).  response is only
+   valid during the callback. */
+typedef void (*ac_http_client_headers_f)(ac_http_client_request_t *r,
+                                         ac_http_t *response);
+
+/* a piece of the response body */
+typedef void (*ac_http_client_data_f)(ac_http_client_request_t *r,
+                                      const char *data, size_t length);
+
+/* the request is finished.  error is 0 if the whole response was received,
+   otherwise it is a (negative) libuv error code: UV_EPROTO for a malformed
+   response, UV_ECANCELED if the client was destroyed, or the error from
+   connecting, writing or reading.  The request is freed when it returns. */
+typedef void (*ac_http_client_done_f)(ac_http_client_request_t *r,
+                                      int error);
+
+/* the size of the read buffer of a client */
+#ifndef AC_HTTP_CLIENT_READ_SIZE
+#define AC_HTTP_CLIENT_READ_SIZE (64 * 1024)
+#endif
+
+/* the initial size of each request's pool */
+#ifndef AC_HTTP_CLIENT_POOL_SIZE
+#define AC_HTTP_CLIENT_POOL_SIZE 4096
+#endif
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_http_client_init(loop)                                              \
+  _ac_http_client_init(loop, AC_FILE_LINE_MACRO("ac_http_client"))
+ac_http_client_t *_ac_http_client_init(uv_loop_t *loop, const char *caller);
+#else
+#define ac_http_client_init(loop) _ac_http_client_init(loop)
+ac_http_client_t *_ac_http_client_init(uv_loop_t *loop);
+#endif
+
+/* close the connections (the requests which haven't finished are done with
+   UV_ECANCELED) and free the client once the handles are closed, which
+   happens as the loop runs.  It must not be called from a callback. */
+void ac_http_client_destroy(ac_http_client_t *c);
+
+/* an upstream at an IPv4 or IPv6 address and port, NULL (with errno set to
+   EINVAL) if ip isn't an address.  Upstreams belong to the client. */
+ac_http_upstream_t *ac_http_client_upstream(ac_http_client_t *c,
+                                            const char *ip, int port);
+
+/* the most connections which are opened (8 by default) and kept open while
+   they are idle (the same as max_connections by default) */
+void ac_http_upstream_set_connections(ac_http_upstream_t *u,
+                                      uint32_t max_connections,
+                                      uint32_t max_idle);
+
+/* the most requests in flight on a connection, 1 (the default) turns
+   pipelining off.  A request which fails because the server closed a
+   reused connection before responding is sent again once if its method is
+   idempotent (GET, HEAD, PUT, DELETE, OPTIONS, or TRACE).  Requests behind
+   a response with Connection: close are sent again on another connection,
+   since the server didn't handle them. */
+void ac_http_upstream_set_pipeline(ac_http_upstream_t *u, uint32_t depth);
+
+/* start a request.  A Host header (the upstream's address and port) is
+   added unless one is given. */
+ac_http_client_request_t *ac_http_client_request_init(ac_http_upstream_t *u,
+                                                      const char *method,
+                                                      const char *uri);
+
+/* the pool is cleared once the request is done */
+ac_pool_t *ac_http_client_request_pool(ac_http_client_request_t *r);
+
+void ac_http_client_request_header(ac_http_client_request_t *r,
+                                   const char *name, const char *value);
+
+/* the body isn't copied, it must be valid until the request is done */
+void ac_http_client_request_body(ac_http_client_request_t *r,
+                                 const void *body, size_t length);
+
+/* queue the request on its upstream.  headers and data may be NULL. */
+void ac_http_client_send(ac_http_client_request_t *r,
+                         ac_http_client_headers_f headers,
+                         ac_http_client_data_f data,
+                         ac_http_client_done_f done, void *arg);
+
+/* the arg which was passed to ac_http_client_send */
+void *ac_http_client_request_arg(ac_http_client_request_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
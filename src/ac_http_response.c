@@ -0,0 +1,281 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_http_response.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+typedef struct {
+  const char *line;
+  size_t length;
+} status_line_t;
+
+#define STATUS(code, text)                                                     \
+  [code] = {"HTTP/1.1 " #code " " text "\r\n",                                 \
+            sizeof("HTTP/1.1 " #code " " text "\r\n") - 1}
+
+static const status_line_t status_lines[600] = {
+    STATUS(100, "Continue"),
+    STATUS(101, "Switching Protocols"),
+    STATUS(200, "OK"),
+    STATUS(201, "Created"),
+    STATUS(202, "Accepted"),
+    STATUS(204, "No Content"),
+    STATUS(206, "Partial Content"),
+    STATUS(301, "Moved Permanently"),
+    STATUS(302, "Found"),
+    STATUS(303, "See Other"),
+    STATUS(304, "Not Modified"),
+    STATUS(307, "Temporary Redirect"),
+    STATUS(308, "Permanent Redirect"),
+    STATUS(400, "Bad Request"),
+    STATUS(401, "Unauthorized"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(405, "Method Not Allowed"),
+    STATUS(408, "Request Timeout"),
+    STATUS(409, "Conflict"),
+    STATUS(410, "Gone"),
+    STATUS(411, "Length Required"),
+    STATUS(413, "Payload Too Large"),
+    STATUS(414, "URI Too Long"),
+    STATUS(415, "Unsupported Media Type"),
+    STATUS(416, "Range Not Satisfiable"),
+    STATUS(429, "Too Many Requests"),
+    STATUS(500, "Internal Server Error"),
+    STATUS(501, "Not Implemented"),
+    STATUS(502, "Bad Gateway"),
+    STATUS(503, "Service Unavailable"),
+    STATUS(504, "Gateway Timeout"),
+};
+
+/* the Date header is formatted again when the second changes */
+static __thread time_t date_time = 0;
+static __thread char date_line[64];
+static __thread size_t date_length = 0;
+
+static void update_date(void) {
+  time_t now = time(NULL);
+  if (now != date_time) {
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    date_length = strftime(date_line, sizeof(date_line),
+                           "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    date_time = now;
+  }
+}
+
+struct ac_http_response_s {
+  ac_pool_t *pool;
+  const char *status_line;
+  size_t status_length;
+  /* the headers (without the status line) */
+  char *head;
+  size_t head_length;
+  size_t head_size;
+  bool finished;
+  const void *body;
+  size_t body_length;
+  int fd;
+  off_t offset;
+  struct iovec iov[3];
+};
+
+static void append(ac_http_response_t *r, const void *data, size_t length) {
+  if (r->head_length + length > r->head_size) {
+    size_t size = r->head_size * 2;
+    if (size < r->head_length + length)
+      size = r->head_length + length;
+    char *head = (char *)ac_pool_ualloc(r->pool, size);
+    memcpy(head, r->head, r->head_length);
+    r->head = head;
+    r->head_size = size;
+  }
+  memcpy(r->head + r->head_length, data, length);
+  r->head_length += length;
+}
+
+ac_http_response_t *ac_http_response_init(ac_pool_t *pool, int status) {
+  ac_http_response_t *r =
+      (ac_http_response_t *)ac_pool_alloc(pool, sizeof(ac_http_response_t));
+  r->pool = pool;
+  if (status >= 0 && status < 600 && status_lines[status].line) {
+    r->status_line = status_lines[status].line;
+    r->status_length = status_lines[status].length;
+  } else {
+    char *line = ac_pool_strdupf(pool, "HTTP/1.1 %d Unknown\r\n", status);
+    r->status_line = line;
+    r->status_length = strlen(line);
+  }
+  r->head_size = 256;
+  r->head = (char *)ac_pool_ualloc(pool, r->head_size);
+  r->head_length = 0;
+  r->finished = false;
+  r->body = NULL;
+  r->body_length = 0;
+  r->fd = -1;
+  r->offset = 0;
+  update_date();
+  append(r, date_line, date_length);
+  return r;
+}
+
+void ac_http_response_header(ac_http_response_t *r, const char *name,
+                             const char *value) {
+  append(r, name, strlen(name));
+  append(r, ": ", 2);
+  append(r, value, strlen(value));
+  append(r, "\r\n", 2);
+}
+
+void ac_http_response_body(ac_http_response_t *r, const void *data,
+                           size_t length) {
+  r->body = data;
+  r->body_length = length;
+  r->fd = -1;
+}
+
+void ac_http_response_file(ac_http_response_t *r, int fd, off_t offset,
+                           size_t length) {
+  r->body = NULL;
+  r->body_length = length;
+  r->fd = fd;
+  r->offset = offset;
+}
+
+/* add Content-Length and the blank line which ends the headers */
+static void finish(ac_http_response_t *r) {
+  if (r->finished)
+    return;
+  r->finished = true;
+  char buf[48];
+  char *ep = buf + sizeof(buf);
+  char *p = ep;
+  *--p = '\n';
+  *--p = '\r';
+  *--p = '\n';
+  *--p = '\r';
+  size_t v = r->body_length;
+  do {
+    *--p = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  p -= 16;
+  memcpy(p, "Content-Length: ", 16);
+  append(r, p, ep - p);
+}
+
+struct iovec *ac_http_response_iov(ac_http_response_t *r, int *num_iov) {
+  finish(r);
+  r->iov[0].iov_base = (void *)r->status_line;
+  r->iov[0].iov_len = r->status_length;
+  r->iov[1].iov_base = r->head;
+  r->iov[1].iov_len = r->head_length;
+  *num_iov = 2;
+  if (r->body && r->body_length) {
+    r->iov[2].iov_base = (void *)r->body;
+    r->iov[2].iov_len = r->body_length;
+    *num_iov = 3;
+  }
+  return r->iov;
+}
+
+int ac_http_response_fd(ac_http_response_t *r, off_t *offset, size_t *length) {
+  if (r->fd == -1)
+    return -1;
+  *offset = r->offset;
+  *length = r->body_length;
+  return r->fd;
+}
+
+static bool write_file(int fd, int in_fd, off_t offset, size_t length) {
+#ifdef __linux__
+  while (length) {
+    ssize_t n = sendfile(fd, in_fd, &offset, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return false;
+    }
+    length -= n;
+  }
+  return true;
+#else
+  char buf[16384];
+  while (length) {
+    ssize_t n = pread(in_fd, buf, length < sizeof(buf) ? length : sizeof(buf),
+                      offset);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n == 0)
+        errno = EIO;
+      return false;
+    }
+    offset += n;
+    length -= n;
+    char *p = buf;
+    while (n) {
+      ssize_t w = write(fd, p, n);
+      if (w < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      p += w;
+      n -= w;
+    }
+  }
+  return true;
+#endif
+}
+
+bool ac_http_response_write(ac_http_response_t *r, int fd) {
+  int num_iov;
+  struct iovec *iov = ac_http_response_iov(r, &num_iov);
+  while (num_iov) {
+    ssize_t n = writev(fd, iov, num_iov);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    while (num_iov && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      num_iov--;
+    }
+    if (num_iov) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  if (r->fd != -1)
+    return write_file(fd, r->fd, r->offset, r->body_length);
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_http_response_H
+#define _ac_http_response_H
+
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_http_response_t builds an HTTP/1.1 response in a pool (typically the
+  request's pool).  The status line comes from a table of preformatted lines
+  and the Date header is formatted at most once a second per thread.  The
+  headers are appended to one block of the pool, and Content-Length is added
+  from the body.  The body isn't copied, it is either memory owned by the
+  caller (which must stay valid until the response is written) or a range
+  of a file descriptor to be sent with sendfile.
+
+  The response is written with writev using ac_http_response_iov (followed
+  by sendfile for a file body) or with ac_http_response_write.
+*/
+struct ac_http_response_s;
+typedef struct ac_http_response_s ac_http_response_t;
+
+ac_http_response_t *ac_http_response_init(ac_pool_t *pool, int status);
+
+/* the name and value are copied */
+void ac_http_response_header(ac_http_response_t *r, const char *name,
+                             const char *value);
+
+/* the body is referenced, not copied */
+void ac_http_response_body(ac_http_response_t *r, const void *data,
+                           size_t length);
+
+/* send length bytes of fd starting at offset as the body */
+void ac_http_response_file(ac_http_response_t *r, int fd, off_t offset,
+                           size_t length);
+
+/* the status line, headers, and a memory body in at most three iovecs
+   (allocated from the pool) */
+struct iovec *ac_http_response_iov(ac_http_response_t *r, int *num_iov);
+
+/* returns the file descriptor of a file body (and its range) or -1 */
+int ac_http_response_fd(ac_http_response_t *r, off_t *offset, size_t *length);
+
+/* write the whole response to a blocking fd, returns false on an error
+   (errno is set) */
+bool ac_http_response_write(ac_http_response_t *r, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
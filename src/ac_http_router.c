@@ -0,0 +1,272 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_http_router.h"
+#include "ac_allocator.h"
+#include "ac_radix_tree.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct entry_s {
+  /* NULL for every method */
+  const char *method;
+  void *handler;
+  const char **names;
+  uint32_t num_names;
+  struct entry_s *next;
+} entry_t;
+
+typedef struct node_s {
+  uint32_t id;
+  /* the child for a parameter segment */
+  struct node_s *param;
+  /* the routes which end at this node and the routes which end with a
+     wildcard after it */
+  entry_t *routes;
+  entry_t *wildcards;
+} node_t;
+
+struct ac_http_router_s {
+  ac_pool_t *pool;
+  /* the static children of every node keyed by the parent's id and the
+     segment */
+  ac_radix_tree_t *children;
+  node_t *root;
+  uint32_t num_nodes;
+};
+
+#define KEY_SIZE (sizeof(uint32_t) + AC_HTTP_ROUTER_MAX_SEGMENT)
+
+static inline size_t make_key(uint8_t *key, node_t *n, const char *segment,
+                              size_t len) {
+  memcpy(key, &n->id, sizeof(uint32_t));
+  memcpy(key + sizeof(uint32_t), segment, len);
+  return sizeof(uint32_t) + len;
+}
+
+static node_t *new_node(ac_http_router_t *r) {
+  node_t *n = (node_t *)ac_pool_calloc(r->pool, sizeof(node_t));
+  n->id = r->num_nodes++;
+  return n;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_http_router_t *_ac_http_router_init(const char *caller) {
+  ac_http_router_t *r = (ac_http_router_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_http_router_t), false);
+#else
+ac_http_router_t *_ac_http_router_init(void) {
+  ac_http_router_t *r =
+      (ac_http_router_t *)ac_malloc(sizeof(ac_http_router_t));
+#endif
+  r->pool = ac_pool_init(65536);
+  r->children = ac_radix_tree_init();
+  r->num_nodes = 0;
+  r->root = new_node(r);
+  return r;
+}
+
+void ac_http_router_destroy(ac_http_router_t *r) {
+  ac_radix_tree_destroy(r->children);
+  ac_pool_destroy(r->pool);
+  ac_free(r);
+}
+
+static bool valid_pattern(const char *pattern) {
+  if (*pattern != '/')
+    return false;
+  const char *p = pattern + 1;
+  size_t num_params = 0;
+  while (true) {
+    const char *e = strchr(p, '/');
+    size_t len = e ? (size_t)(e - p) : strlen(p);
+    if (len && (*p == ':' || *p == '*')) {
+      if (len == 1 || ++num_params > AC_HTTP_ROUTER_MAX_PARAMS ||
+          (*p == '*' && e))
+        return false;
+    } else if (len > AC_HTTP_ROUTER_MAX_SEGMENT)
+      return false;
+    if (!e)
+      return true;
+    p = e + 1;
+  }
+}
+
+static void add_route(ac_http_router_t *r, entry_t **routes,
+                      const char *method, void *handler, const char **names,
+                      uint32_t num_names) {
+  entry_t *e = *routes;
+  while (e && !(e->method == method ||
+                (e->method && method && !strcmp(e->method, method))))
+    e = e->next;
+  if (!e) {
+    e = (entry_t *)ac_pool_alloc(r->pool, sizeof(entry_t));
+    e->method = method ? ac_pool_strdup(r->pool, method) : NULL;
+    e->next = *routes;
+    *routes = e;
+  }
+  e->handler = handler;
+  e->num_names = num_names;
+  e->names = (const char **)ac_pool_dup(r->pool, names,
+                                        sizeof(const char *) * num_names);
+}
+
+bool ac_http_router_add(ac_http_router_t *r, const char *method,
+                        const char *pattern, void *handler) {
+  if (!valid_pattern(pattern))
+    return false;
+  const char *names[AC_HTTP_ROUTER_MAX_PARAMS];
+  uint32_t num_names = 0;
+  uint8_t key[KEY_SIZE];
+  node_t *n = r->root;
+  const char *p = pattern + 1;
+  while (true) {
+    const char *e = strchr(p, '/');
+    size_t len = e ? (size_t)(e - p) : strlen(p);
+    if (len && *p == '*') {
+      names[num_names++] = ac_pool_strndup(r->pool, p + 1, len - 1);
+      add_route(r, &n->wildcards, method, handler, names, num_names);
+      return true;
+    }
+    if (len && *p == ':') {
+      names[num_names++] = ac_pool_strndup(r->pool, p + 1, len - 1);
+      if (!n->param)
+        n->param = new_node(r);
+      n = n->param;
+    } else {
+      size_t key_len = make_key(key, n, p, len);
+      node_t *child = (node_t *)ac_radix_tree_find(r->children, key, key_len);
+      if (!child) {
+        child = new_node(r);
+        ac_radix_tree_insert(r->children, key, key_len, child);
+      }
+      n = child;
+    }
+    if (!e)
+      break;
+    p = e + 1;
+  }
+  add_route(r, &n->routes, method, handler, names, num_names);
+  return true;
+}
+
+typedef struct {
+  ac_http_router_t *r;
+  const char *method;
+  const char *path;
+  size_t len;
+  const char *values[AC_HTTP_ROUTER_MAX_PARAMS];
+  size_t lengths[AC_HTTP_ROUTER_MAX_PARAMS];
+  uint32_t num_values;
+  bool path_matched;
+  entry_t *found;
+  uint8_t key[KEY_SIZE];
+} match_t;
+
+/* the route for the method (or for every method) */
+static inline entry_t *route_for_method(match_t *m, entry_t *e) {
+  if (e)
+    m->path_matched = true;
+  entry_t *any = NULL;
+  for (; e; e = e->next) {
+    if (!e->method)
+      any = e;
+    else if (m->method && !strcmp(e->method, m->method))
+      return e;
+  }
+  return any;
+}
+
+/* pos is where the next segment begins (or len + 1 once the path is
+   used up) */
+static bool match_node(match_t *m, node_t *n, size_t pos) {
+  if (pos > m->len) {
+    m->found = route_for_method(m, n->routes);
+    return m->found != NULL;
+  }
+  const char *segment = m->path + pos;
+  const char *e = (const char *)memchr(segment, '/', m->len - pos);
+  size_t len = e ? (size_t)(e - segment) : m->len - pos;
+  size_t next = pos + len + 1;
+  if (len <= AC_HTTP_ROUTER_MAX_SEGMENT) {
+    size_t key_len = make_key(m->key, n, segment, len);
+    node_t *child =
+        (node_t *)ac_radix_tree_find(m->r->children, m->key, key_len);
+    if (child && match_node(m, child, next))
+      return true;
+  }
+  if (n->param && len) {
+    m->values[m->num_values] = segment;
+    m->lengths[m->num_values] = len;
+    m->num_values++;
+    if (match_node(m, n->param, next))
+      return true;
+    m->num_values--;
+  }
+  if (n->wildcards) {
+    m->found = route_for_method(m, n->wildcards);
+    if (m->found) {
+      m->values[m->num_values] = segment;
+      m->lengths[m->num_values] = m->len - pos;
+      m->num_values++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void *ac_http_router_match(ac_http_router_t *r, ac_pool_t *pool,
+                           const char *method, const char *path, size_t len,
+                           ac_http_route_t *route) {
+  match_t m;
+  m.r = r;
+  m.method = method;
+  m.path = path;
+  m.len = len;
+  m.num_values = 0;
+  m.path_matched = false;
+  m.found = NULL;
+  route->handler = NULL;
+  route->params = NULL;
+  route->num_params = 0;
+  if (len && *path == '/' && match_node(&m, r->root, 1)) {
+    entry_t *e = m.found;
+    route->handler = e->handler;
+    route->num_params = e->num_names;
+    if (e->num_names) {
+      route->params = (ac_http_route_param_t *)ac_pool_alloc(
+          pool, sizeof(ac_http_route_param_t) * e->num_names);
+      for (uint32_t i = 0; i < e->num_names; i++) {
+        ac_http_route_param_t *p = route->params + i;
+        p->name = e->names[i];
+        p->value = ac_pool_strndup(pool, m.values[i], m.lengths[i]);
+        p->length = m.lengths[i];
+      }
+    }
+  }
+  route->path_matched = m.path_matched;
+  return route->handler;
+}
+
+void *ac_http_router_route(ac_http_router_t *r, ac_http_t *h,
+                           ac_http_route_t *route) {
+  const char *uri = ac_http_uri(h);
+  size_t len = uri ? strcspn(uri, "?#") : 0;
+  return ac_http_router_match(r, ac_http_pool(h), ac_http_method(h), uri, len,
+                              route);
+}
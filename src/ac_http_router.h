@@ -0,0 +1,113 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_http_router_H
+#define _ac_http_router_H
+
+#include "ac_common.h"
+#include "ac_http.h"
+#include "ac_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_http_router_t matches request paths against route patterns which are
+  compiled into a tree of path segments when they are added.  A pattern is a
+  path such as /users/:id/posts where each segment is either static, a
+  parameter (:name, which matches one non-empty segment), or a wildcard
+  (*name, which must be the last segment and matches the rest of the path,
+  including nothing).  The static children of every node are kept in one
+  ac_radix_tree (keyed by the node and the segment), so a match costs one
+  lookup per segment no matter how many routes there are.
+
+  When more than one route matches, static segments are preferred over
+  parameters and parameters over wildcards (a match backs up to the next
+  choice if a more specific branch doesn't lead to a route for the method).
+  Parameter values are not percent-decoded.  Routes are added at startup,
+  after which any number of threads can match at the same time.
+*/
+struct ac_http_router_s;
+typedef struct ac_http_router_s ac_http_router_t;
+
+/* the most parameters (and wildcards) that a route can have */
+#ifndef AC_HTTP_ROUTER_MAX_PARAMS
+#define AC_HTTP_ROUTER_MAX_PARAMS 16
+#endif
+
+/* the longest static segment of a pattern */
+#ifndef AC_HTTP_ROUTER_MAX_SEGMENT
+#define AC_HTTP_ROUTER_MAX_SEGMENT 256
+#endif
+
+typedef struct {
+  const char *name;
+  const char *value;
+  size_t length;
+} ac_http_route_param_t;
+
+typedef struct {
+  void *handler;
+  /* the parameters in the order that they appear in the pattern */
+  ac_http_route_param_t *params;
+  size_t num_params;
+  /* true if a route matched the path but not the method (for a 405) */
+  bool path_matched;
+} ac_http_route_t;
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_http_router_init()                                                  \
+  _ac_http_router_init(AC_FILE_LINE_MACRO("ac_http_router"))
+ac_http_router_t *_ac_http_router_init(const char *caller);
+#else
+#define ac_http_router_init() _ac_http_router_init()
+ac_http_router_t *_ac_http_router_init(void);
+#endif
+
+void ac_http_router_destroy(ac_http_router_t *r);
+
+/* adds a route for method (such as GET) or for every method if method is
+   NULL.  Adding the same method and pattern again replaces the handler.
+   Returns false if the pattern isn't valid (it doesn't begin with /, a
+   wildcard isn't last, a parameter has no name, or a limit above is
+   exceeded). */
+bool ac_http_router_add(ac_http_router_t *r, const char *method,
+                        const char *pattern, void *handler);
+
+/* matches path[0..len) and returns the handler (or NULL).  The parameter
+   values are copied into pool. */
+void *ac_http_router_match(ac_http_router_t *r, ac_pool_t *pool,
+                           const char *method, const char *path, size_t len,
+                           ac_http_route_t *route);
+
+/* matches the method and the path of the request's uri (without the query
+   string), the parameters are copied into the request's pool */
+void *ac_http_router_route(ac_http_router_t *r, ac_http_t *h,
+                           ac_http_route_t *route);
+
+/* the value of the parameter with the given name (or NULL) */
+static inline const char *ac_http_route_param(const ac_http_route_t *route,
+                                              const char *name);
+
+#include "impl/ac_http_router.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,715 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_http_server.h"
+
+#include "ac_allocator.h"
+#include "ac_cgi.h"
+#include "ac_http.h"
+#include "ac_object_pipe.h"
+#include "ac_timer_wheel.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <uv.h>
+
+/* the size of the read buffer of each loop */
+#ifndef AC_HTTP_SERVER_READ_SIZE
+#define AC_HTTP_SERVER_READ_SIZE (64 * 1024)
+#endif
+
+/* the initial size of each request's pool */
+#ifndef AC_HTTP_SERVER_POOL_SIZE
+#define AC_HTTP_SERVER_POOL_SIZE 4096
+#endif
+
+/* the number of responses which may be waiting for each loop */
+#ifndef AC_HTTP_SERVER_QUEUE_SIZE
+#define AC_HTTP_SERVER_QUEUE_SIZE 4096
+#endif
+
+/* the length of a tick of the connection timeouts */
+#ifndef AC_HTTP_SERVER_TICK_MS
+#define AC_HTTP_SERVER_TICK_MS 100
+#endif
+
+typedef struct loop_s loop_t;
+typedef struct conn_s conn_t;
+
+typedef struct {
+  char *name;
+  char *value;
+} header_t;
+
+struct ac_http_server_request_s {
+  ac_pool_t *pool;
+  conn_t *conn;
+  char *method;
+  char *uri;
+  header_t *headers;
+  uint32_t num_headers;
+  char *body;
+  size_t body_length;
+  ac_cgi_t *query;
+  ac_http_response_t *response;
+  bool close;
+  bool done;
+  uv_write_t write_req;
+  struct ac_http_server_request_s *next;
+};
+
+typedef ac_http_server_request_t request_t;
+
+struct conn_s {
+  uv_tcp_t tcp;
+  loop_t *loop;
+  ac_http_t *parser;
+  /* the requests in the order they arrived, their responses are written in
+     the same order */
+  request_t *head;
+  request_t *tail;
+  uint32_t writes;
+  /* the tcp handle and each request which isn't freed hold a reference */
+  uint32_t refs;
+  ac_timer_wheel_node_t timer;
+  /* part of a request has been read */
+  bool in_request;
+  bool request_timer;
+  bool closed;
+  bool close_after;
+  bool error;
+  conn_t *next;
+  conn_t *prev;
+};
+
+struct loop_s {
+  uv_loop_t loop;
+  uv_tcp_t listener;
+  uv_async_t stop;
+  uv_timer_t tick;
+  ac_timer_wheel_t timeouts;
+  ac_object_pipe_t *responses;
+  ac_http_server_t *server;
+  int fd;
+  pthread_t thread;
+  conn_t *conns;
+  uint32_t num_conns;
+  /* the number of respond calls from other threads which haven't returned */
+  uint32_t responding;
+  bool stopping;
+  request_t *free_requests;
+  char buffer[AC_HTTP_SERVER_READ_SIZE];
+};
+
+struct ac_http_server_s {
+  ac_http_server_handler_f handler;
+  void *arg;
+  ac_threaded_pipe_t *workers;
+  ac_http_group_t *group;
+  uint32_t idle_timeout;
+  uint32_t request_timeout;
+  loop_t *loops;
+  int num_loops;
+  bool listening;
+};
+
+static __thread loop_t *current_loop = NULL;
+
+static request_t *new_request(conn_t *c) {
+  loop_t *l = c->loop;
+  request_t *r = l->free_requests;
+  if (r)
+    l->free_requests = r->next;
+  else {
+    r = (request_t *)ac_malloc(sizeof(*r));
+    if (!r)
+      abort();
+    r->pool = ac_pool_init(AC_HTTP_SERVER_POOL_SIZE);
+  }
+  ac_pool_t *pool = r->pool;
+  memset(r, 0, sizeof(*r));
+  r->pool = pool;
+  r->conn = c;
+  c->refs++;
+  return r;
+}
+
+static void free_conn(conn_t *c);
+
+static void free_request(request_t *r) {
+  conn_t *c = r->conn;
+  loop_t *l = c->loop;
+  ac_pool_clear(r->pool);
+  r->next = l->free_requests;
+  l->free_requests = r;
+  c->refs--;
+  if (!c->refs)
+    free_conn(c);
+}
+
+static void finish_loop(loop_t *l) {
+  /* the last response has been received, but the thread which wrote it may
+     not have returned from the write yet */
+  while (__atomic_load_n(&l->responding, __ATOMIC_ACQUIRE))
+    sched_yield();
+  ac_object_pipe_close(l->responses);
+  uv_close((uv_handle_t *)&l->stop, NULL);
+  uv_close((uv_handle_t *)&l->tick, NULL);
+}
+
+static void free_conn(conn_t *c) {
+  loop_t *l = c->loop;
+  if (c->next)
+    c->next->prev = c->prev;
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    l->conns = c->next;
+  l->num_conns--;
+  ac_free(c);
+  if (l->stopping && !l->num_conns)
+    finish_loop(l);
+}
+
+static void on_conn_close(uv_handle_t *h) {
+  conn_t *c = (conn_t *)h->data;
+  c->refs--;
+  if (!c->refs)
+    free_conn(c);
+}
+
+/* the requests which are still being handled are freed when they are
+   responded to */
+static void close_conn(conn_t *c) {
+  if (c->closed)
+    return;
+  c->closed = true;
+  ac_timer_wheel_cancel(&c->loop->timeouts, &c->timer);
+  ac_http_release(c->parser);
+  c->parser = NULL;
+  request_t *r = c->head;
+  c->head = c->tail = NULL;
+  while (r) {
+    request_t *next = r->next;
+    if (r->done)
+      free_request(r);
+    r = next;
+  }
+  uv_close((uv_handle_t *)&c->tcp, on_conn_close);
+}
+
+/* a connection is timed only while no request is being handled or written.
+   A request must arrive within request_timeout of its first byte, otherwise
+   the connection is closed once nothing has been read for idle_timeout. */
+static void update_timer(conn_t *c) {
+  ac_http_server_t *s = c->loop->server;
+  ac_timer_wheel_t *w = &c->loop->timeouts;
+  if (c->closed || c->head || c->writes) {
+    ac_timer_wheel_cancel(w, &c->timer);
+    return;
+  }
+  bool request = c->in_request && s->request_timeout;
+  uint32_t ms = request ? s->request_timeout : s->idle_timeout;
+  if (!ms) {
+    ac_timer_wheel_cancel(w, &c->timer);
+    return;
+  }
+  /* the request timer isn't pushed back by each read */
+  if (request && c->request_timer && ac_timer_wheel_pending(&c->timer))
+    return;
+  c->request_timer = request;
+  uint32_t ticks = (ms + AC_HTTP_SERVER_TICK_MS - 1) / AC_HTTP_SERVER_TICK_MS;
+  ac_timer_wheel_add(w, &c->timer, ticks);
+}
+
+static void on_timeout(ac_timer_wheel_t *w, ac_timer_wheel_node_t *n) {
+  (void)w;
+  close_conn(ac_parent_object(n, conn_t, timer));
+}
+
+static void on_tick(uv_timer_t *h) {
+  loop_t *l = (loop_t *)h->data;
+  ac_timer_wheel_advance(&l->timeouts,
+                         uv_now(&l->loop) / AC_HTTP_SERVER_TICK_MS);
+}
+
+static void maybe_close(conn_t *c) {
+  if (c->close_after && !c->head && !c->writes)
+    close_conn(c);
+}
+
+static void on_write(uv_write_t *w, int status) {
+  request_t *r = (request_t *)w->data;
+  conn_t *c = r->conn;
+  c->writes--;
+  if (status < 0)
+    close_conn(c);
+  else {
+    maybe_close(c);
+    update_timer(c);
+  }
+  free_request(r);
+}
+
+static void write_response(conn_t *c, request_t *r) {
+  ac_http_response_t *res = r->response;
+  if (r->close)
+    ac_http_response_header(res, "Connection", "close");
+  int num_iov = 0;
+  struct iovec *iov = ac_http_response_iov(res, &num_iov);
+  uv_buf_t bufs[4];
+  int num_bufs = 0;
+  for (int i = 0; i < num_iov; i++)
+    bufs[num_bufs++] = uv_buf_init((char *)iov[i].iov_base, iov[i].iov_len);
+
+  off_t offset;
+  size_t length;
+  int fd = ac_http_response_fd(res, &offset, &length);
+  if (fd >= 0 && length) {
+    char *body = (char *)ac_pool_alloc(r->pool, length);
+    size_t n = 0;
+    while (n < length) {
+      ssize_t got = pread(fd, body + n, length - n, offset + n);
+      if (got <= 0) {
+        if (got < 0 && errno == EINTR)
+          continue;
+        break;
+      }
+      n += got;
+    }
+    if (n < length) {
+      /* the Content-Length has been sent, so the connection can't be used */
+      r->close = true;
+      c->close_after = true;
+    }
+    bufs[num_bufs++] = uv_buf_init(body, n);
+  }
+
+  r->write_req.data = r;
+  c->writes++;
+  if (uv_write(&r->write_req, (uv_stream_t *)&c->tcp, bufs, num_bufs,
+               on_write) < 0) {
+    c->writes--;
+    close_conn(c);
+    free_request(r);
+  }
+}
+
+static void flush(conn_t *c) {
+  while (c->head && c->head->done) {
+    request_t *r = c->head;
+    c->head = r->next;
+    if (!c->head)
+      c->tail = NULL;
+    write_response(c, r);
+    if (c->closed)
+      return;
+  }
+}
+
+static void complete(request_t *r) {
+  conn_t *c = r->conn;
+  r->done = true;
+  if (c->closed)
+    free_request(r);
+  else
+    flush(c);
+}
+
+static void on_response(void *arg, void *object) {
+  (void)arg;
+  complete((request_t *)object);
+}
+
+void ac_http_server_respond(ac_http_server_request_t *r,
+                            ac_http_response_t *response) {
+  loop_t *l = r->conn->loop;
+  r->response = response;
+  if (current_loop == l)
+    complete(r);
+  else {
+    __atomic_add_fetch(&l->responding, 1, __ATOMIC_RELAXED);
+    ac_object_pipe_write(l->responses, r);
+    __atomic_sub_fetch(&l->responding, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void run_handler(void *global_arg, void *thread_arg, void *object,
+                        void *arg) {
+  (void)global_arg;
+  (void)thread_arg;
+  ac_http_server_t *s = (ac_http_server_t *)arg;
+  s->handler((request_t *)object, s->arg);
+}
+
+static void add_request(conn_t *c, request_t *r) {
+  if (c->tail)
+    c->tail->next = r;
+  else
+    c->head = r;
+  c->tail = r;
+}
+
+static bool has_token(const char *value, const char *token) {
+  size_t len = strlen(token);
+  const char *p = value;
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (!strncasecmp(p, token, len) &&
+        (!p[len] || p[len] == ',' || p[len] == ' ' || p[len] == '\t'))
+      return true;
+    while (*p && *p != ',')
+      p++;
+  }
+  return false;
+}
+
+static void on_request_end(ac_http_t *p, char const *data,
+                           size_t data_length) {
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  if (c->close_after)
+    return;
+  c->in_request = false;
+  request_t *r = new_request(c);
+  ac_pool_t *pool = r->pool;
+  r->method = ac_pool_strdup(pool, ac_http_method(p));
+  r->uri = ac_pool_strdup(pool, ac_http_uri(p));
+  uint32_t num_headers = ac_http_num_headers(p);
+  r->headers = (header_t *)ac_pool_alloc(pool, sizeof(header_t) * num_headers);
+  const char *connection = NULL;
+  for (uint32_t i = 0; i < num_headers; i++) {
+    size_t name_length;
+    const char *value;
+    const char *name = ac_http_header(p, i, &name_length, &value);
+    r->headers[i].name = ac_pool_strndup(pool, name, name_length);
+    r->headers[i].value = ac_pool_strdup(pool, value ? value : "");
+    if (name_length == 10 && !strncasecmp(name, "connection", 10))
+      connection = r->headers[i].value;
+  }
+  r->num_headers = num_headers;
+  r->body = (char *)ac_pool_ualloc(pool, data_length + 1);
+  if (data_length)
+    memcpy(r->body, data, data_length);
+  r->body[data_length] = 0;
+  r->body_length = data_length;
+
+  const char *protocol = ac_http_protocol(p);
+  if (connection && has_token(connection, "close"))
+    r->close = true;
+  else if (protocol && !strcmp(protocol, "HTTP/1.0") &&
+           !(connection && has_token(connection, "keep-alive")))
+    r->close = true;
+  if (r->close) {
+    /* anything after this request on the connection is ignored */
+    c->close_after = true;
+    uv_read_stop((uv_stream_t *)&c->tcp);
+  }
+  add_request(c, r);
+
+  ac_http_server_t *s = c->loop->server;
+  if (s->workers)
+    ac_threaded_pipe_write(s->workers, run_handler, r, s);
+  else
+    s->handler(r, s->arg);
+}
+
+static void on_headers(ac_http_t *p) { (void)p; }
+
+static void on_parse_error(ac_http_t *p) {
+  conn_t *c = (conn_t *)ac_http_get_arg(p);
+  c->error = true;
+}
+
+static void bad_request(conn_t *c) {
+  c->close_after = true;
+  uv_read_stop((uv_stream_t *)&c->tcp);
+  request_t *r = new_request(c);
+  r->close = true;
+  add_request(c, r);
+  ac_http_response_t *res = ac_http_response_init(r->pool, 400);
+  ac_http_response_body(res, "Bad Request\n", 12);
+  r->response = res;
+  complete(r);
+}
+
+static void on_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+  (void)suggested;
+  conn_t *c = (conn_t *)h->data;
+  *buf = uv_buf_init(c->loop->buffer, sizeof(c->loop->buffer));
+}
+
+static void on_read(uv_stream_t *h, ssize_t nread, const uv_buf_t *buf) {
+  conn_t *c = (conn_t *)h->data;
+  if (nread < 0) {
+    /* the client may have only shut down its side, so the responses to its
+       requests are still written */
+    uv_read_stop(h);
+    if (nread == UV_EOF) {
+      c->close_after = true;
+      maybe_close(c);
+    } else
+      close_conn(c);
+    return;
+  }
+  if (!nread || c->close_after)
+    return;
+  c->in_request = true;
+  ac_http_parse(c->parser, buf->base, nread);
+  if (c->error && !c->closed)
+    bad_request(c);
+  update_timer(c);
+}
+
+static void on_connection(uv_stream_t *server, int status) {
+  loop_t *l = (loop_t *)server->data;
+  if (status < 0 || l->stopping)
+    return;
+  conn_t *c = (conn_t *)ac_calloc(sizeof(*c));
+  if (!c)
+    abort();
+  c->loop = l;
+  c->refs = 1;
+  ac_timer_wheel_node_init(&c->timer, on_timeout);
+  uv_tcp_init(&l->loop, &c->tcp);
+  c->tcp.data = c;
+  c->next = l->conns;
+  if (c->next)
+    c->next->prev = c;
+  l->conns = c;
+  l->num_conns++;
+  if (uv_accept(server, (uv_stream_t *)&c->tcp) < 0) {
+    c->closed = true;
+    uv_close((uv_handle_t *)&c->tcp, on_conn_close);
+    return;
+  }
+  uv_tcp_nodelay(&c->tcp, 1);
+  c->parser = ac_http_init(l->server->group);
+  ac_http_set_arg(c->parser, c);
+  uv_read_start((uv_stream_t *)&c->tcp, on_alloc, on_read);
+  update_timer(c);
+}
+
+static void on_stop(uv_async_t *h) {
+  loop_t *l = (loop_t *)h->data;
+  l->stopping = true;
+  uv_close((uv_handle_t *)&l->listener, NULL);
+  conn_t *c = l->conns;
+  while (c) {
+    conn_t *next = c->next;
+    if (!c->closed) {
+      uv_read_stop((uv_stream_t *)&c->tcp);
+      c->close_after = true;
+      maybe_close(c);
+    }
+    c = next;
+  }
+  if (!l->num_conns)
+    finish_loop(l);
+}
+
+static void *run_loop(void *arg) {
+  loop_t *l = (loop_t *)arg;
+  current_loop = l;
+  uv_run(&l->loop, UV_RUN_DEFAULT);
+  uv_loop_close(&l->loop);
+  return NULL;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_http_server_t *_ac_http_server_init(ac_http_server_handler_f handler,
+                                       void *arg, const char *caller) {
+  ac_http_server_t *s = (ac_http_server_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_http_server_t), false);
+#else
+ac_http_server_t *_ac_http_server_init(ac_http_server_handler_f handler,
+                                       void *arg) {
+  ac_http_server_t *s = (ac_http_server_t *)ac_malloc(sizeof(ac_http_server_t));
+#endif
+  if (!s)
+    abort();
+  memset(s, 0, sizeof(*s));
+  s->handler = handler;
+  s->arg = arg;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  s->num_loops = cpus > 0 ? (int)cpus : 1;
+  return s;
+}
+
+void ac_http_server_set_loops(ac_http_server_t *s, int num_loops) {
+  s->num_loops = num_loops > 0 ? num_loops : 1;
+}
+
+void ac_http_server_set_timeouts(ac_http_server_t *s, uint32_t idle_ms,
+                                 uint32_t request_ms) {
+  s->idle_timeout = idle_ms;
+  s->request_timeout = request_ms;
+}
+
+void ac_http_server_set_workers(ac_http_server_t *s,
+                                ac_threaded_pipe_t *workers) {
+  s->workers = workers;
+}
+
+static int bind_socket(struct addrinfo *ai) {
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd < 0)
+    return -1;
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+      bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  return fd;
+}
+
+bool ac_http_server_listen(ac_http_server_t *s, const char *host, int port) {
+  if (s->listening) {
+    errno = EINVAL;
+    return false;
+  }
+  char service[16];
+  snprintf(service, sizeof(service), "%d", port);
+  struct addrinfo hints, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  int err = getaddrinfo(host, service, &hints, &ai);
+  if (err) {
+    errno = err == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+    return false;
+  }
+
+  s->loops = (loop_t *)ac_calloc(sizeof(loop_t) * s->num_loops);
+  if (!s->loops)
+    abort();
+  /* bind every socket before starting any loop so that a failure leaves
+     nothing running */
+  for (int i = 0; i < s->num_loops; i++) {
+    s->loops[i].fd = bind_socket(ai);
+    if (s->loops[i].fd < 0) {
+      int e = errno;
+      while (i--)
+        close(s->loops[i].fd);
+      freeaddrinfo(ai);
+      ac_free(s->loops);
+      s->loops = NULL;
+      errno = e;
+      return false;
+    }
+  }
+  freeaddrinfo(ai);
+
+  s->group = ac_http_group_init(on_headers, NULL, on_request_end,
+                                on_parse_error);
+  for (int i = 0; i < s->num_loops; i++) {
+    loop_t *l = s->loops + i;
+    l->server = s;
+    if (uv_loop_init(&l->loop) < 0)
+      abort();
+    uv_tcp_init(&l->loop, &l->listener);
+    l->listener.data = l;
+    if (uv_tcp_open(&l->listener, l->fd) < 0 ||
+        uv_listen((uv_stream_t *)&l->listener, SOMAXCONN, on_connection) < 0)
+      abort();
+    uv_async_init(&l->loop, &l->stop, on_stop);
+    l->stop.data = l;
+    ac_timer_wheel_init(&l->timeouts,
+                        uv_now(&l->loop) / AC_HTTP_SERVER_TICK_MS);
+    uv_timer_init(&l->loop, &l->tick);
+    l->tick.data = l;
+    if (s->idle_timeout || s->request_timeout)
+      uv_timer_start(&l->tick, on_tick, AC_HTTP_SERVER_TICK_MS,
+                     AC_HTTP_SERVER_TICK_MS);
+    l->responses = ac_object_pipe_open_queue(&l->loop, on_response, l,
+                                             AC_HTTP_SERVER_QUEUE_SIZE);
+  }
+  for (int i = 0; i < s->num_loops; i++)
+    if (pthread_create(&s->loops[i].thread, NULL, run_loop, s->loops + i))
+      abort();
+  s->listening = true;
+  return true;
+}
+
+void ac_http_server_destroy(ac_http_server_t *s) {
+  if (!s)
+    return;
+  if (s->listening) {
+    for (int i = 0; i < s->num_loops; i++)
+      uv_async_send(&s->loops[i].stop);
+    for (int i = 0; i < s->num_loops; i++) {
+      loop_t *l = s->loops + i;
+      pthread_join(l->thread, NULL);
+      while (l->free_requests) {
+        request_t *r = l->free_requests;
+        l->free_requests = r->next;
+        ac_pool_destroy(r->pool);
+        ac_free(r);
+      }
+    }
+    ac_free(s->loops);
+    ac_http_group_destroy(s->group);
+  }
+  ac_free(s);
+}
+
+const char *ac_http_server_method(ac_http_server_request_t *r) {
+  return r->method;
+}
+
+const char *ac_http_server_uri(ac_http_server_request_t *r) { return r->uri; }
+
+const char *ac_http_server_header(ac_http_server_request_t *r,
+                                  const char *name) {
+  for (uint32_t i = 0; i < r->num_headers; i++)
+    if (!strcasecmp(r->headers[i].name, name))
+      return r->headers[i].value;
+  return NULL;
+}
+
+const char *ac_http_server_query(ac_http_server_request_t *r, const char *key,
+                                 const char *default_value) {
+  if (!r->query)
+    r->query = ac_cgi_init(r->pool, r->uri);
+  return ac_cgi_str(r->query, key, default_value);
+}
+
+const char *ac_http_server_body(ac_http_server_request_t *r, size_t *length) {
+  if (length)
+    *length = r->body_length;
+  return r->body;
+}
+
+ac_pool_t *ac_http_server_pool(ac_http_server_request_t *r) {
+  return r->pool;
+}
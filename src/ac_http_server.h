@@ -0,0 +1,119 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_http_server_H
+#define _ac_http_server_H
+
+#include "ac_common.h"
+#include "ac_http_response.h"
+#include "ac_pool.h"
+#include "ac_threaded_pipe.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_http_server_t is an HTTP/1.1 server with one libuv loop per thread.
+  Every loop has its own listening socket on the same port (SO_REUSEPORT),
+  so the kernel spreads the connections over the loops.  A connection owns
+  an ac_http parser, requests on a connection may be pipelined and their
+  responses are written in order.
+
+  Each request is copied out of the parser into its own pool and passed to
+  the handler, either on the loop (inline) or on the workers of an
+  ac_threaded_pipe.  The handler (or anything it hands the request to)
+  builds an ac_http_response_t from the request's pool and calls
+  ac_http_server_respond, exactly once, from any thread.  Responses which
+  come from other threads go back to the connection's loop through an
+  ac_object_pipe.
+*/
+struct ac_http_server_s;
+typedef struct ac_http_server_s ac_http_server_t;
+
+struct ac_http_server_request_s;
+typedef struct ac_http_server_request_s ac_http_server_request_t;
+
+typedef void (*ac_http_server_handler_f)(ac_http_server_request_t *r,
+                                         void *arg);
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_http_server_init(handler, arg)                                      \
+  _ac_http_server_init(handler, arg, AC_FILE_LINE_MACRO("ac_http_server"))
+ac_http_server_t *_ac_http_server_init(ac_http_server_handler_f handler,
+                                       void *arg, const char *caller);
+#else
+#define ac_http_server_init(handler, arg) _ac_http_server_init(handler, arg)
+ac_http_server_t *_ac_http_server_init(ac_http_server_handler_f handler,
+                                       void *arg);
+#endif
+
+/* the number of loops (threads), the default is the number of cpus */
+void ac_http_server_set_loops(ac_http_server_t *s, int num_loops);
+
+/* close connections which are idle for idle_ms or which take longer than
+   request_ms to send a request (from its first byte), 0 turns a timeout off
+   (both are off by default).  The time a request spends being handled and
+   its response being written isn't limited.  The timeouts are tracked in an
+   ac_timer_wheel_t per loop which ticks every AC_HTTP_SERVER_TICK_MS, so a
+   connection is closed up to a tick late.  Must be called before
+   ac_http_server_listen. */
+void ac_http_server_set_timeouts(ac_http_server_t *s, uint32_t idle_ms,
+                                 uint32_t request_ms);
+
+/* run the handler on the workers (which must be open until the server is
+   destroyed) instead of on the loops */
+void ac_http_server_set_workers(ac_http_server_t *s,
+                                ac_threaded_pipe_t *workers);
+
+/* start the loops listening on host (NULL for any address) and port.
+   Returns false (with errno set) if a socket can't be bound. */
+bool ac_http_server_listen(ac_http_server_t *s, const char *host, int port);
+
+/* stop listening, close the connections once the requests being handled
+   have been responded to, and free the server */
+void ac_http_server_destroy(ac_http_server_t *s);
+
+/* the request (valid until it is responded to) */
+const char *ac_http_server_method(ac_http_server_request_t *r);
+const char *ac_http_server_uri(ac_http_server_request_t *r);
+
+/* returns the value of the header or NULL */
+const char *ac_http_server_header(ac_http_server_request_t *r,
+                                  const char *name);
+
+/* a parameter of the query string */
+const char *ac_http_server_query(ac_http_server_request_t *r, const char *key,
+                                 const char *default_value);
+
+const char *ac_http_server_body(ac_http_server_request_t *r, size_t *length);
+
+/* the pool is cleared once the response has been written */
+ac_pool_t *ac_http_server_pool(ac_http_server_request_t *r);
+
+/* the response must be built from the request's pool.  A file body is read
+   into the pool before it is written. */
+void ac_http_server_respond(ac_http_server_request_t *r,
+                            ac_http_response_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_intern.h"
+#include "ac_allocator.h"
+#include "ac_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a slot holds the top 32 bits of the hash and the local id + 1 (0 is
+   empty) */
+typedef struct {
+  uint32_t hash;
+  uint32_t id;
+} slot_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  ac_pool_t *pool;
+  slot_t *slots;
+  uint32_t mask;
+  /* the strings by local id.  The array is allocated from the pool when it
+     grows, so readers which loaded the old array can keep using it. */
+  const char **strings;
+  uint32_t num_strings;
+  uint32_t strings_size;
+  char pad[64];
+} shard_t;
+
+struct ac_intern_s {
+  shard_t *shards;
+  uint32_t shard_bits;
+  bool concurrent;
+};
+
+static inline uint64_t hash_bytes(const void *s, size_t len) {
+  const unsigned char *p = (const unsigned char *)s;
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    h = (h ^ (v * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 31;
+    p += 8;
+    len -= 8;
+  }
+  uint64_t v = 0;
+  memcpy(&v, p, len);
+  h = (h ^ (v * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 32);
+}
+
+static void init_shard(shard_t *s, size_t expected) {
+  pthread_mutex_init(&s->mutex, NULL);
+  s->pool = ac_pool_init(65536);
+  uint32_t capacity = 16;
+  while (capacity / 2 < expected)
+    capacity <<= 1;
+  s->slots = (slot_t *)ac_calloc(sizeof(slot_t) * capacity);
+  s->mask = capacity - 1;
+  s->strings_size = capacity / 2;
+  s->strings = (const char **)ac_pool_alloc(
+      s->pool, sizeof(const char *) * s->strings_size);
+  s->num_strings = 0;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_intern_t *_ac_intern_init(size_t expected, bool concurrent,
+                             const char *caller) {
+  ac_intern_t *h = (ac_intern_t *)_ac_malloc_d(NULL, caller,
+                                               sizeof(ac_intern_t), false);
+#else
+ac_intern_t *_ac_intern_init(size_t expected, bool concurrent) {
+  ac_intern_t *h = (ac_intern_t *)ac_malloc(sizeof(ac_intern_t));
+#endif
+  h->concurrent = concurrent;
+  h->shard_bits = 0;
+  if (concurrent) {
+    while ((1U << h->shard_bits) < AC_INTERN_SHARDS)
+      h->shard_bits++;
+  }
+  uint32_t num_shards = 1U << h->shard_bits;
+  h->shards = (shard_t *)ac_malloc(sizeof(shard_t) * num_shards);
+  for (uint32_t i = 0; i < num_shards; i++)
+    init_shard(h->shards + i, expected / num_shards);
+  return h;
+}
+
+void ac_intern_destroy(ac_intern_t *h) {
+  uint32_t num_shards = 1U << h->shard_bits;
+  for (uint32_t i = 0; i < num_shards; i++) {
+    shard_t *s = h->shards + i;
+    pthread_mutex_destroy(&s->mutex);
+    ac_pool_destroy(s->pool);
+    ac_free(s->slots);
+  }
+  ac_free(h->shards);
+  ac_free(h);
+}
+
+static inline bool equal(const char *interned, const void *s, size_t len) {
+  return ac_intern_length(interned) == len && !memcmp(interned, s, len);
+}
+
+/* returns the slot which holds s or the empty slot where it belongs */
+static inline slot_t *find_slot(shard_t *sh, uint32_t hash, const void *s,
+                                size_t len) {
+  uint32_t i = hash & sh->mask;
+  while (true) {
+    slot_t *slot = sh->slots + i;
+    if (!slot->id ||
+        (slot->hash == hash && equal(sh->strings[slot->id - 1], s, len)))
+      return slot;
+    i = (i + 1) & sh->mask;
+  }
+}
+
+static void grow(shard_t *sh) {
+  uint32_t capacity = (sh->mask + 1) * 2;
+  slot_t *slots = (slot_t *)ac_calloc(sizeof(slot_t) * capacity);
+  for (uint32_t i = 0; i <= sh->mask; i++) {
+    slot_t *slot = sh->slots + i;
+    if (!slot->id)
+      continue;
+    uint32_t j = slot->hash & (capacity - 1);
+    while (slots[j].id)
+      j = (j + 1) & (capacity - 1);
+    slots[j] = *slot;
+  }
+  ac_free(sh->slots);
+  sh->slots = slots;
+  sh->mask = capacity - 1;
+
+  const char **strings = (const char **)ac_pool_alloc(
+      sh->pool, sizeof(const char *) * capacity / 2);
+  memcpy(strings, sh->strings, sizeof(const char *) * sh->num_strings);
+  sh->strings_size = capacity / 2;
+  __atomic_store_n(&sh->strings, strings, __ATOMIC_RELEASE);
+}
+
+const char *ac_intern_n(ac_intern_t *h, const void *s, size_t len) {
+  uint64_t hv = hash_bytes(s, len);
+  shard_t *sh = h->shards + (hv & ((1U << h->shard_bits) - 1));
+  uint32_t hash = (uint32_t)(hv >> 32);
+  if (h->concurrent)
+    pthread_mutex_lock(&sh->mutex);
+  slot_t *slot = find_slot(sh, hash, s, len);
+  const char *r;
+  if (slot->id)
+    r = sh->strings[slot->id - 1];
+  else {
+    if (sh->num_strings == sh->strings_size) {
+      grow(sh);
+      slot = find_slot(sh, hash, s, len);
+    }
+    uint32_t local = sh->num_strings;
+    if ((uint64_t)local << h->shard_bits > UINT32_MAX || len > UINT32_MAX)
+      abort();
+    uint32_t *p = (uint32_t *)ac_pool_alloc(sh->pool, 8 + len + 1);
+    p[0] = (local << h->shard_bits) | (uint32_t)(sh - h->shards);
+    p[1] = (uint32_t)len;
+    char *d = (char *)(p + 2);
+    memcpy(d, s, len);
+    d[len] = 0;
+    sh->strings[local] = d;
+    __atomic_store_n(&sh->num_strings, local + 1, __ATOMIC_RELEASE);
+    slot->hash = hash;
+    slot->id = local + 1;
+    r = d;
+  }
+  if (h->concurrent)
+    pthread_mutex_unlock(&sh->mutex);
+  return r;
+}
+
+const char *ac_intern_find(ac_intern_t *h, const void *s, size_t len) {
+  uint64_t hv = hash_bytes(s, len);
+  shard_t *sh = h->shards + (hv & ((1U << h->shard_bits) - 1));
+  if (h->concurrent)
+    pthread_mutex_lock(&sh->mutex);
+  slot_t *slot = find_slot(sh, (uint32_t)(hv >> 32), s, len);
+  const char *r = slot->id ? sh->strings[slot->id - 1] : NULL;
+  if (h->concurrent)
+    pthread_mutex_unlock(&sh->mutex);
+  return r;
+}
+
+const char *ac_intern_str(ac_intern_t *h, uint32_t id) {
+  uint32_t shard_mask = (1U << h->shard_bits) - 1;
+  shard_t *sh = h->shards + (id & shard_mask);
+  uint32_t local = id >> h->shard_bits;
+  const char **strings = __atomic_load_n(&sh->strings, __ATOMIC_ACQUIRE);
+  if (local >= __atomic_load_n(&sh->num_strings, __ATOMIC_ACQUIRE))
+    return NULL;
+  return strings[local];
+}
+
+size_t ac_intern_count(ac_intern_t *h) {
+  size_t n = 0;
+  uint32_t num_shards = 1U << h->shard_bits;
+  for (uint32_t i = 0; i < num_shards; i++)
+    n += __atomic_load_n(&h->shards[i].num_strings, __ATOMIC_RELAXED);
+  return n;
+}
+
+size_t ac_intern_bytes(ac_intern_t *h) {
+  size_t n = 0;
+  uint32_t num_shards = 1U << h->shard_bits;
+  for (uint32_t i = 0; i < num_shards; i++) {
+    shard_t *sh = h->shards + i;
+    if (h->concurrent)
+      pthread_mutex_lock(&sh->mutex);
+    n += ac_pool_size(sh->pool);
+    if (h->concurrent)
+      pthread_mutex_unlock(&sh->mutex);
+  }
+  return n;
+}
@@ -0,0 +1,101 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_intern_H
+#define _ac_intern_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_intern_t keeps one copy of each distinct string.  Interning a string
+  returns a pointer to its copy (zero terminated) which stays valid until
+  the table is destroyed, so two interned strings are equal if and only if
+  the pointers are.  Every string also gets a 32 bit id which can be stored
+  instead of the pointer (such as in a sorted array or a record) and turned
+  back into the string with ac_intern_str.
+
+  The copies are allocated from ac_pools which belong to the table, each
+  preceded by its id and length (see ac_intern_id_of and ac_intern_length).
+  Strings are found through an open addressing hash table.
+
+  A concurrent table is split into AC_INTERN_SHARDS shards (by the hash of
+  the string), each with its own pool, hash table, and mutex, so that
+  workers can intern strings at the same time.  ac_intern_str,
+  ac_intern_id_of, and ac_intern_length don't take a lock.  The ids of a
+  concurrent table are not dense (the low bits are the shard).
+*/
+struct ac_intern_s;
+typedef struct ac_intern_s ac_intern_t;
+
+#ifndef AC_INTERN_SHARDS
+#define AC_INTERN_SHARDS 16
+#endif
+
+/* expected is the number of distinct strings to size the table for (it can
+   be 0), concurrent tables can be used by many threads at once */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_intern_init(expected, concurrent)                                   \
+  _ac_intern_init(expected, concurrent, AC_FILE_LINE_MACRO("ac_intern"))
+ac_intern_t *_ac_intern_init(size_t expected, bool concurrent,
+                             const char *caller);
+#else
+#define ac_intern_init(expected, concurrent)                                   \
+  _ac_intern_init(expected, concurrent)
+ac_intern_t *_ac_intern_init(size_t expected, bool concurrent);
+#endif
+
+/* frees the table and every interned string */
+void ac_intern_destroy(ac_intern_t *h);
+
+/* returns the interned copy of s[0..len) (adding it if it is new) */
+const char *ac_intern_n(ac_intern_t *h, const void *s, size_t len);
+
+static inline const char *ac_intern(ac_intern_t *h, const char *s);
+
+/* the id of s[0..len) (adding it if it is new) */
+static inline uint32_t ac_intern_id(ac_intern_t *h, const void *s,
+                                    size_t len);
+
+/* returns the interned copy of s[0..len) or NULL if it hasn't been
+   interned */
+const char *ac_intern_find(ac_intern_t *h, const void *s, size_t len);
+
+/* the string with the given id (NULL if there isn't one) */
+const char *ac_intern_str(ac_intern_t *h, uint32_t id);
+
+/* the id and length of a string returned by ac_intern_n (or ac_intern_str) */
+static inline uint32_t ac_intern_id_of(const char *interned);
+static inline size_t ac_intern_length(const char *interned);
+
+/* the number of distinct strings */
+size_t ac_intern_count(ac_intern_t *h);
+
+/* the bytes used by the strings (and their ids and lengths) */
+size_t ac_intern_bytes(ac_intern_t *h);
+
+#include "impl/ac_intern.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
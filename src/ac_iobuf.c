@@ -0,0 +1,172 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_iobuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ac_iobuf_t *ac_iobuf_init(ac_pool_t *pool, size_t chunk_size) {
+  if (chunk_size == 0)
+    abort(); /* this doesn't make any sense */
+  ac_iobuf_t *h = (ac_iobuf_t *)ac_pool_alloc(pool, sizeof(ac_iobuf_t));
+  h->pool = pool;
+  h->chunk_size = chunk_size;
+  h->iov_size = 16;
+  h->iov = (struct iovec *)ac_pool_alloc(pool,
+                                         sizeof(struct iovec) * h->iov_size);
+  h->first = 0;
+  h->num_iov = 0;
+  h->length = 0;
+  h->tail = NULL;
+  h->tail_end = NULL;
+  return h;
+}
+
+void ac_iobuf_clear(ac_iobuf_t *h) {
+  /* the current chunk can be reused */
+  if (h->num_iov > h->first) {
+    struct iovec *last = h->iov + h->num_iov - 1;
+    if ((char *)last->iov_base + last->iov_len == h->tail)
+      h->tail = (char *)last->iov_base;
+  }
+  h->first = 0;
+  h->num_iov = 0;
+  h->length = 0;
+}
+
+static struct iovec *add_segment(ac_iobuf_t *h, void *base, size_t length) {
+  if (h->num_iov == h->iov_size) {
+    /* slide the consumed segments out before growing */
+    if (h->first) {
+      h->num_iov -= h->first;
+      memmove(h->iov, h->iov + h->first, sizeof(struct iovec) * h->num_iov);
+      h->first = 0;
+    }
+    if (h->num_iov == h->iov_size) {
+      h->iov_size += h->iov_size;
+      struct iovec *iov = (struct iovec *)ac_pool_alloc(
+          h->pool, sizeof(struct iovec) * h->iov_size);
+      memcpy(iov, h->iov, sizeof(struct iovec) * h->num_iov);
+      h->iov = iov;
+    }
+  }
+  struct iovec *r = h->iov + h->num_iov;
+  h->num_iov++;
+  r->iov_base = base;
+  r->iov_len = length;
+  h->length += length;
+  return r;
+}
+
+/* reserve returns length contiguous bytes at tail, starting a new chunk if
+   the current one is too small.  The bytes are added to the last segment. */
+static char *reserve(ac_iobuf_t *h, size_t length) {
+  struct iovec *last =
+      h->num_iov > h->first ? h->iov + h->num_iov - 1 : NULL;
+  if (h->tail + length > h->tail_end) {
+    size_t chunk_size = length > h->chunk_size ? length : h->chunk_size;
+    h->tail = (char *)ac_pool_ualloc(h->pool, chunk_size + 1);
+    h->tail_end = h->tail + chunk_size;
+    last = NULL;
+  }
+  char *r = h->tail;
+  if (last && (char *)last->iov_base + last->iov_len == r) {
+    last->iov_len += length;
+    h->length += length;
+  } else
+    add_segment(h, r, length);
+  h->tail += length;
+  return r;
+}
+
+void _ac_iobuf_append(ac_iobuf_t *h, const void *data, size_t length) {
+  if (!length)
+    return;
+  /* fill what is left of the current chunk before starting a new one */
+  size_t leftover = h->tail_end - h->tail;
+  if (leftover && leftover < length) {
+    memcpy(reserve(h, leftover), data, leftover);
+    data = (const char *)data + leftover;
+    length -= leftover;
+  }
+  memcpy(reserve(h, length), data, length);
+}
+
+void *ac_iobuf_append_alloc(ac_iobuf_t *h, size_t length) {
+  return reserve(h, length);
+}
+
+void ac_iobuf_append_ref(ac_iobuf_t *h, const void *data, size_t length) {
+  if (length)
+    add_segment(h, (void *)data, length);
+}
+
+void ac_iobuf_appendvf(ac_iobuf_t *h, const char *fmt, va_list args) {
+  va_list args_copy;
+  va_copy(args_copy, args);
+  /* each chunk has an extra byte for the zero terminator */
+  size_t leftover = h->tail_end - h->tail;
+  int n;
+  if (h->tail)
+    n = vsnprintf(h->tail, leftover + 1, fmt, args_copy);
+  else
+    n = vsnprintf(NULL, 0, fmt, args_copy);
+  va_end(args_copy);
+  if (n < 0)
+    abort();
+  if (n == 0)
+    return;
+  if (h->tail && n <= leftover) {
+    reserve(h, n);
+    return;
+  }
+  char *r = (char *)reserve(h, n);
+  va_copy(args_copy, args);
+  int n2 = vsnprintf(r, n + 1, fmt, args_copy);
+  if (n != n2)
+    abort(); // should never happen!
+  va_end(args_copy);
+}
+
+void ac_iobuf_consume(ac_iobuf_t *h, size_t length) {
+  if (length >= h->length) {
+    ac_iobuf_clear(h);
+    return;
+  }
+  h->length -= length;
+  while (length) {
+    struct iovec *v = h->iov + h->first;
+    if (length < v->iov_len) {
+      v->iov_base = (char *)v->iov_base + length;
+      v->iov_len -= length;
+      return;
+    }
+    length -= v->iov_len;
+    h->first++;
+  }
+}
+
+char *ac_iobuf_flatten(ac_iobuf_t *h) {
+  char *r = (char *)ac_pool_ualloc(h->pool, h->length + 1);
+  char *p = r;
+  for (int i = h->first; i < h->num_iov; i++) {
+    memcpy(p, h->iov[i].iov_base, h->iov[i].iov_len);
+    p += h->iov[i].iov_len;
+  }
+  *p = 0;
+  return r;
+}
@@ -0,0 +1,96 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_iobuf_H
+#define _ac_iobuf_H
+
+#include "ac_buffer.h"
+#include "ac_pool.h"
+
+#include <stdarg.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An ac_iobuf_t is a segmented buffer.  Data is appended into chunks which
+   are allocated from a pool, so appending never moves bytes which have
+   already been appended.  The segments are kept as an array of struct iovec
+   which can be passed directly to writev or sendmsg.  Like
+   ac_buffer_pool_init, the iobuf belongs to the pool and isn't destroyed. */
+struct ac_iobuf_s;
+typedef struct ac_iobuf_s ac_iobuf_t;
+
+/* ac_iobuf_init creates an iobuf whose chunks are (at least) chunk_size
+   bytes. */
+ac_iobuf_t *ac_iobuf_init(ac_pool_t *pool, size_t chunk_size);
+
+/* ac_iobuf_clear empties the iobuf.  The memory stays in the pool until the
+   pool is cleared. */
+void ac_iobuf_clear(ac_iobuf_t *h);
+
+/* ac_iobuf_length returns the number of bytes in the iobuf */
+static inline size_t ac_iobuf_length(ac_iobuf_t *h);
+
+/* append bytes to the iobuf */
+static inline void ac_iobuf_append(ac_iobuf_t *h, const void *data,
+                                   size_t length);
+
+/* append a string to the iobuf */
+static inline void ac_iobuf_appends(ac_iobuf_t *h, const char *s);
+
+/* append a character to the iobuf */
+static inline void ac_iobuf_appendc(ac_iobuf_t *h, char ch);
+
+/* append the contents of a buffer to the iobuf */
+static inline void ac_iobuf_append_buffer(ac_iobuf_t *h, ac_buffer_t *b);
+
+/* append bytes to the iobuf using va_args and a formatted string */
+void ac_iobuf_appendvf(ac_iobuf_t *h, const char *fmt, va_list args);
+
+/* append bytes to the iobuf using a formatted string - similar to printf */
+static inline void ac_iobuf_appendf(ac_iobuf_t *h, const char *fmt, ...);
+
+/* ac_iobuf_append_alloc returns length contiguous bytes at the end of the
+   iobuf for the caller to fill in. */
+void *ac_iobuf_append_alloc(ac_iobuf_t *h, size_t length);
+
+/* ac_iobuf_append_ref adds data as its own segment without copying it.  The
+   data must remain valid (and unchanged) until the iobuf is written out. */
+void ac_iobuf_append_ref(ac_iobuf_t *h, const void *data, size_t length);
+
+/* ac_iobuf_iov returns the segments of the iobuf and sets num_iov to the
+   number of them.  writev limits the number of segments to IOV_MAX, so
+   callers writing large iobufs should write at most that many at a time. */
+static inline struct iovec *ac_iobuf_iov(ac_iobuf_t *h, int *num_iov);
+
+/* ac_iobuf_consume removes length bytes from the front of the iobuf.  This is
+   meant to be called with the return value of writev so that a partial write
+   can be continued with ac_iobuf_iov. */
+void ac_iobuf_consume(ac_iobuf_t *h, size_t length);
+
+/* ac_iobuf_flatten copies the iobuf into a single zero terminated string
+   allocated from the pool. */
+char *ac_iobuf_flatten(ac_iobuf_t *h);
+
+#include "impl/ac_iobuf.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
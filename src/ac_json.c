@@ -0,0 +1,627 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_json.h"
+
+#include "ac_conv.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __PCLMUL__
+#include <wmmintrin.h>
+#endif
+
+/* the value follows a key (so its key is the node before it) */
+#define AC_JSON_MEMBER 4
+/* the number has a fraction or an exponent */
+#define AC_JSON_REAL 8
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_op(char c) {
+  return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+/* a number or literal has to be followed by one of these */
+static inline bool is_delimiter(char c) { return is_space(c) || is_op(c); }
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+/* bit i of each mask is set if byte i of a 64 byte chunk is in the class */
+typedef struct {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t op;
+  uint64_t space;
+} masks_t;
+
+static inline void classify(const char *s, masks_t *m) {
+  m->quote = m->backslash = m->op = m->space = 0;
+#ifdef __SSE2__
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i * 16));
+    /* or'ing in 0x20 turns [ and ] into { and } */
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i op =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')),
+                                  _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    __m128i space =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    int shift = i * 16;
+    m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))
+                << shift;
+    m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))
+                    << shift;
+    m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+    m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << shift;
+  }
+#else
+  for (int i = 0; i < 64; i++) {
+    uint64_t bit = (uint64_t)1 << i;
+    char c = s[i];
+    if (c == '"')
+      m->quote |= bit;
+    else if (c == '\\')
+      m->backslash |= bit;
+    else if (is_op(c))
+      m->op |= bit;
+    else if (is_space(c))
+      m->space |= bit;
+  }
+#endif
+}
+
+/* bit i is the xor of bits 0..i (1 from an opening quote up to the closing
+   quote) */
+static inline uint64_t prefix_xor(uint64_t x) {
+#ifdef __PCLMUL__
+  __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)x),
+                                   _mm_set1_epi8((char)0xFF), 0);
+  return (uint64_t)_mm_cvtsi128_si64(r);
+#else
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+#endif
+}
+
+/* the bytes which follow an odd number of backslashes.  *prev_escaped
+   carries a trailing backslash into the next chunk. */
+static inline uint64_t find_escaped(uint64_t backslash,
+                                    uint64_t *prev_escaped) {
+  const uint64_t even_bits = 0x5555555555555555ULL;
+  backslash &= ~*prev_escaped;
+  uint64_t follows_escape = (backslash << 1) | *prev_escaped;
+  /* adding a bit to the start of each run which begins on an odd bit carries
+     past the end of the run, which flips the parity of what follows it */
+  uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+  uint64_t even_starts;
+  *prev_escaped = __builtin_add_overflow(odd_starts, backslash, &even_starts);
+  uint64_t invert_mask = even_starts << 1;
+  return (even_bits ^ invert_mask) & follows_escape;
+}
+
+/* the first pass finds the offsets of the operators and the first byte of
+   each string, number, and literal which aren't inside of a string (padded
+   is a multiple of 64).  Returns false if a string isn't closed. */
+static bool find_structurals(const char *s, size_t padded, uint32_t *idx,
+                             uint32_t *num) {
+  uint64_t prev_escaped = 0;
+  uint64_t prev_in_string = 0;
+  uint64_t prev_scalar = 0;
+  uint32_t *wp = idx;
+  for (size_t pos = 0; pos < padded; pos += 64) {
+    masks_t m;
+    classify(s + pos, &m);
+    uint64_t quote = m.quote & ~find_escaped(m.backslash, &prev_escaped);
+    /* the opening quote through the byte before the closing quote */
+    uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    uint64_t scalar = ~(m.op | m.space);
+    uint64_t nonquote_scalar = scalar & ~quote;
+    uint64_t follows_scalar = (nonquote_scalar << 1) | prev_scalar;
+    prev_scalar = nonquote_scalar >> 63;
+    /* in_string ^ quote is the inside of each string and its closing quote,
+       which leaves only the opening quote as the string's start */
+    uint64_t starts =
+        (m.op | (scalar & ~follows_scalar)) & ~(in_string ^ quote);
+    while (starts) {
+      *wp++ = (uint32_t)(pos + __builtin_ctzll(starts));
+      starts &= starts - 1;
+    }
+  }
+  *num = (uint32_t)(wp - idx);
+  return !prev_in_string;
+}
+
+/* p is after the opening quote, returns the closing quote or NULL if the
+   string has a control character or a bad escape */
+static char *scan_string(char *p, uint8_t *flags) {
+  while (true) {
+#ifdef __SSE2__
+    /* the padding after the input makes it safe to read 16 bytes past any
+       byte of the input */
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)),
+                       _mm_set1_epi8(0x1F)));
+    int mask = _mm_movemask_epi8(special);
+    if (!mask) {
+      p += 16;
+      continue;
+    }
+    p += __builtin_ctz(mask);
+#else
+    while ((unsigned char)*p >= 0x20 && *p != '"' && *p != '\\')
+      p++;
+#endif
+    if (*p == '"')
+      return p;
+    if (*p != '\\')
+      return NULL;
+    *flags |= AC_JSON_ESCAPED;
+    switch (p[1]) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      p += 2;
+      break;
+    case 'u':
+      for (int i = 2; i < 6; i++)
+        if (!isxdigit((unsigned char)p[i]))
+          return NULL;
+      p += 6;
+      break;
+    default:
+      return NULL;
+    }
+  }
+}
+
+/* returns the end of the number at p or NULL if it isn't valid */
+static char *scan_number(char *p, uint8_t *flags) {
+  if (*p == '-')
+    p++;
+  if (*p == '0')
+    p++;
+  else if (*p >= '1' && *p <= '9') {
+    while (is_digit(*p))
+      p++;
+  } else
+    return NULL;
+  if (*p == '.') {
+    *flags |= AC_JSON_REAL;
+    p++;
+    if (!is_digit(*p))
+      return NULL;
+    while (is_digit(*p))
+      p++;
+  }
+  if (*p == 'e' || *p == 'E') {
+    *flags |= AC_JSON_REAL;
+    p++;
+    if (*p == '+' || *p == '-')
+      p++;
+    if (!is_digit(*p))
+      return NULL;
+    while (is_digit(*p))
+      p++;
+  }
+  return is_delimiter(*p) ? p : NULL;
+}
+
+static inline bool scan_literal(const char *p, const char *word, size_t n) {
+  return !memcmp(p, word, n) && is_delimiter(p[n]);
+}
+
+/* the second pass checks the grammar and writes the nodes (there can't be
+   more nodes than structurals plus the end of the document) */
+static bool build(char *s, const uint32_t *idx, uint32_t n,
+                  ac_json_t *nodes) {
+  uint32_t stack[AC_JSON_MAX_DEPTH];
+  uint32_t depth = 0;
+  ac_json_t *np = nodes;
+  ac_json_t *parent;
+  uint8_t member = 0;
+  uint32_t i = 0;
+  char *p, *ep;
+  char c;
+
+value:
+  if (i == n)
+    return false;
+  p = s + idx[i++];
+  np->ptr = p;
+  np->length = 0;
+  np->skip = 1;
+  np->count = 0;
+  np->flags = member;
+  member = 0;
+  switch (*p) {
+  case '{':
+  case '[':
+    if (depth == AC_JSON_MAX_DEPTH)
+      return false;
+    np->type = *p == '{' ? ac_json_object : ac_json_array;
+    stack[depth++] = (uint32_t)(np - nodes);
+    np++;
+    if (i < n && s[idx[i]] == (*p == '{' ? '}' : ']')) {
+      i++;
+      goto end;
+    }
+    if (*p == '{')
+      goto key;
+    goto value;
+  case '"':
+    if (!(ep = scan_string(p + 1, &np->flags)))
+      return false;
+    np->type = ac_json_string;
+    np->ptr = p + 1;
+    np->length = (uint32_t)(ep - (p + 1));
+    np++;
+    goto next;
+  case 't':
+    if (!scan_literal(p, "true", 4))
+      return false;
+    np->type = ac_json_true;
+    np++;
+    goto next;
+  case 'f':
+    if (!scan_literal(p, "false", 5))
+      return false;
+    np->type = ac_json_false;
+    np++;
+    goto next;
+  case 'n':
+    if (!scan_literal(p, "null", 4))
+      return false;
+    np->type = ac_json_null;
+    np++;
+    goto next;
+  default:
+    if (!(ep = scan_number(p, &np->flags)))
+      return false;
+    np->type = ac_json_number;
+    np->length = (uint32_t)(ep - p);
+    np++;
+    goto next;
+  }
+
+key:
+  if (i == n || s[idx[i]] != '"')
+    return false;
+  p = s + idx[i++];
+  np->flags = AC_JSON_KEY;
+  if (!(ep = scan_string(p + 1, &np->flags)))
+    return false;
+  np->type = ac_json_string;
+  np->ptr = p + 1;
+  np->length = (uint32_t)(ep - (p + 1));
+  np->skip = 1;
+  np->count = 0;
+  np++;
+  if (i == n || s[idx[i]] != ':')
+    return false;
+  i++;
+  member = AC_JSON_MEMBER;
+  goto value;
+
+next:
+  if (!depth) {
+    if (i != n)
+      return false;
+    np->type = _ac_json_end;
+    np->ptr = NULL;
+    np->length = np->skip = np->count = 0;
+    np->flags = 0;
+    /* the strings and numbers are terminated once nothing needs the bytes
+       which follow them */
+    for (ac_json_t *j = nodes; j < np; j++)
+      if (j->type == ac_json_string || j->type == ac_json_number)
+        j->ptr[j->length] = 0;
+    return true;
+  }
+  parent = nodes + stack[depth - 1];
+  parent->count++;
+  if (i == n)
+    return false;
+  c = s[idx[i++]];
+  if (c == ',') {
+    if (parent->type == ac_json_object)
+      goto key;
+    goto value;
+  }
+  if (c != (parent->type == ac_json_object ? '}' : ']'))
+    return false;
+
+end:
+  parent = nodes + stack[--depth];
+  np->type = _ac_json_end;
+  np->ptr = NULL;
+  np->length = np->count = 0;
+  np->skip = 1;
+  np->flags = 0;
+  np++;
+  parent->skip = (uint32_t)(np - parent);
+  goto next;
+}
+
+ac_json_t *ac_json_parse(ac_pool_t *pool, const char *s, size_t length) {
+  /* offsets and lengths are 32 bits */
+  if (!length || length > UINT32_MAX - 128)
+    return NULL;
+  /* the copy is padded with spaces to a multiple of 64 bytes (plus a chunk
+     so that the scans can read past the end) */
+  size_t padded = (length + 63) & ~(size_t)63;
+  char *buf = (char *)ac_pool_ualloc(pool, padded + 64);
+  uint32_t *idx = (uint32_t *)ac_pool_alloc(pool, sizeof(uint32_t) * length);
+  if (!buf || !idx)
+    return NULL;
+  memcpy(buf, s, length);
+  memset(buf + length, ' ', padded + 64 - length);
+  uint32_t num;
+  if (!find_structurals(buf, padded, idx, &num) || !num)
+    return NULL;
+  ac_json_t *nodes =
+      (ac_json_t *)ac_pool_alloc(pool, sizeof(ac_json_t) * (num + 1));
+  if (!nodes || !build(buf, idx, num, nodes))
+    return NULL;
+  return nodes;
+}
+
+static inline int hex_value(char c) {
+  if (c <= '9')
+    return c - '0';
+  return (c | 0x20) - 'a' + 10;
+}
+
+static uint32_t hex4(const char *p) {
+  return (hex_value(p[0]) << 12) | (hex_value(p[1]) << 8) |
+         (hex_value(p[2]) << 4) | hex_value(p[3]);
+}
+
+static char *append_utf8(char *wp, uint32_t cp) {
+  if (cp < 0x80)
+    *wp++ = (char)cp;
+  else if (cp < 0x800) {
+    *wp++ = (char)(0xC0 | (cp >> 6));
+    *wp++ = (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    *wp++ = (char)(0xE0 | (cp >> 12));
+    *wp++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+    *wp++ = (char)(0x80 | (cp & 0x3F));
+  } else {
+    *wp++ = (char)(0xF0 | (cp >> 18));
+    *wp++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+    *wp++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+    *wp++ = (char)(0x80 | (cp & 0x3F));
+  }
+  return wp;
+}
+
+/* decodes the escapes of a string in place (the escapes were checked by
+   scan_string and a decoded escape is never longer than the escape).  An
+   unpaired surrogate becomes U+FFFD. */
+static void decode(ac_json_t *j) {
+  char *p = j->ptr;
+  char *ep = p + j->length;
+  char *wp = p;
+  while (p < ep) {
+    char *bs = (char *)memchr(p, '\\', ep - p);
+    if (!bs)
+      bs = ep;
+    if (wp != p)
+      memmove(wp, p, bs - p);
+    wp += bs - p;
+    p = bs;
+    if (p == ep)
+      break;
+    uint32_t cp;
+    switch (p[1]) {
+    case 'b':
+      *wp++ = '\b';
+      break;
+    case 'f':
+      *wp++ = '\f';
+      break;
+    case 'n':
+      *wp++ = '\n';
+      break;
+    case 'r':
+      *wp++ = '\r';
+      break;
+    case 't':
+      *wp++ = '\t';
+      break;
+    case 'u':
+      cp = hex4(p + 2);
+      p += 4;
+      if (cp >= 0xD800 && cp < 0xDC00 && ep - p >= 8 && p[2] == '\\' &&
+          p[3] == 'u') {
+        uint32_t lo = hex4(p + 4);
+        if (lo >= 0xDC00 && lo < 0xE000) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          p += 6;
+        } else
+          cp = 0xFFFD;
+      } else if (cp >= 0xD800 && cp < 0xE000)
+        cp = 0xFFFD;
+      wp = append_utf8(wp, cp);
+      break;
+    default: /* " \ and / */
+      *wp++ = p[1];
+      break;
+    }
+    p += 2;
+  }
+  *wp = 0;
+  j->length = (uint32_t)(wp - j->ptr);
+  j->flags &= ~AC_JSON_ESCAPED;
+}
+
+const char *ac_json_key(ac_json_t *j) {
+  if (!j || !(j->flags & AC_JSON_MEMBER))
+    return NULL;
+  if (j[-1].flags & AC_JSON_ESCAPED)
+    decode(j - 1);
+  return j[-1].ptr;
+}
+
+ac_json_t *ac_json_get_n(ac_json_t *j, const char *key, size_t key_length) {
+  if (!j || j->type != ac_json_object)
+    return NULL;
+  /* the members are key, value pairs up to the end node */
+  for (ac_json_t *k = j + 1; k->type != _ac_json_end; k += 1 + k[1].skip) {
+    if (k->flags & AC_JSON_ESCAPED)
+      decode(k);
+    if (k->length == key_length && !memcmp(k->ptr, key, key_length))
+      return k + 1;
+  }
+  return NULL;
+}
+
+ac_json_t *ac_json_get(ac_json_t *j, const char *key) {
+  return key ? ac_json_get_n(j, key, strlen(key)) : NULL;
+}
+
+ac_json_t *ac_json_at(ac_json_t *j, size_t i) {
+  if (!j || i >= j->count)
+    return NULL;
+  ac_json_t *r = ac_json_first(j);
+  while (i--)
+    r = ac_json_next(r);
+  return r;
+}
+
+ac_strview_t ac_json_strview(ac_json_t *j) {
+  if (!j || (j->type != ac_json_string && j->type != ac_json_number))
+    return ac_strview(NULL, 0);
+  if (j->flags & AC_JSON_ESCAPED)
+    decode(j);
+  return ac_strview(j->ptr, j->length);
+}
+
+const char *ac_json_str(ac_json_t *j, const char *default_value) {
+  ac_strview_t r = ac_json_strview(j);
+  return r.ptr ? r.ptr : default_value;
+}
+
+bool ac_json_bool(ac_json_t *j, bool default_value) {
+  if (!j)
+    return default_value;
+  if (j->type == ac_json_true)
+    return true;
+  if (j->type == ac_json_false)
+    return false;
+  return default_value;
+}
+
+int ac_json_int(ac_json_t *j, int default_value) {
+  if (!j || j->type != ac_json_number || (j->flags & AC_JSON_REAL))
+    return default_value;
+  return ac_int_n(j->ptr, j->length, default_value);
+}
+
+int64_t ac_json_int64_t(ac_json_t *j, int64_t default_value) {
+  if (!j || j->type != ac_json_number || (j->flags & AC_JSON_REAL))
+    return default_value;
+  return ac_int64_t_n(j->ptr, j->length, default_value);
+}
+
+uint64_t ac_json_uint64_t(ac_json_t *j, uint64_t default_value) {
+  if (!j || j->type != ac_json_number || (j->flags & AC_JSON_REAL))
+    return default_value;
+  return ac_uint64_t_n(j->ptr, j->length, default_value);
+}
+
+double ac_json_double(ac_json_t *j, double default_value) {
+  if (!j || j->type != ac_json_number)
+    return default_value;
+  return ac_double_n(j->ptr, j->length, default_value);
+}
+
+void ac_json_write_double(ac_json_writer_t *w, double v) {
+  if (isnan(v) || isinf(v)) {
+    ac_json_write_null(w);
+    return;
+  }
+  _ac_json_separate(w);
+  ac_buffer_append_double(w->bh, v);
+}
+
+void ac_json_write_value(ac_json_writer_t *w, ac_json_t *j) {
+  switch (ac_json_type(j)) {
+  case ac_json_false:
+    ac_json_write_bool(w, false);
+    break;
+  case ac_json_true:
+    ac_json_write_bool(w, true);
+    break;
+  case ac_json_number:
+    ac_json_write_raw(w, j->ptr, j->length);
+    break;
+  case ac_json_string: {
+    ac_strview_t s = ac_json_strview(j);
+    ac_json_write_string_n(w, s.ptr, s.len);
+    break;
+  }
+  case ac_json_array:
+    ac_json_write_array(w);
+    for (ac_json_t *v = ac_json_first(j); v; v = ac_json_next(v))
+      ac_json_write_value(w, v);
+    ac_json_write_array_end(w);
+    break;
+  case ac_json_object:
+    ac_json_write_object(w);
+    for (ac_json_t *v = ac_json_first(j); v; v = ac_json_next(v)) {
+      ac_json_key(v);
+      ac_json_write_key_n(w, v[-1].ptr, v[-1].length);
+      ac_json_write_value(w, v);
+    }
+    ac_json_write_object_end(w);
+    break;
+  default:
+    ac_json_write_null(w);
+    break;
+  }
+}
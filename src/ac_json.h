@@ -0,0 +1,177 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_json_H
+#define _ac_json_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_json parses JSON into a pool (such as a request's ac_http_pool) without
+  a malloc per value.  The input is copied into the pool and parsed in two
+  passes.  The first finds the structural characters (brackets, colons,
+  commas and the start of each value) 64 bytes at a time with SSE2, keeping
+  track of which bytes are inside of strings and which quotes are escaped.
+  The second checks the grammar and writes one node per value into an
+  array, so a document is a flat sequence of nodes with each container
+  followed by its members.  Strings and numbers are not converted while
+  parsing.  A string with escapes is decoded (in place) the first time that
+  it is read and numbers are converted when they are read, so a handler
+  only pays for the values it looks at.
+
+    ac_json_t *j = ac_json_parse(pool, body, body_length);
+    const char *name = ac_json_str(ac_json_get(j, "name"), "");
+    for (ac_json_t *v = ac_json_first(ac_json_get(j, "tags")); v;
+         v = ac_json_next(v))
+      ...
+
+  Every function accepts NULL for a missing value and returns the default
+  (or NULL).  The pool owns the document.  Reading a string modifies the
+  node, so a document should only be read by one thread at a time.  Strings
+  are not checked to be valid UTF-8.
+*/
+struct ac_json_s;
+typedef struct ac_json_s ac_json_t;
+
+typedef enum {
+  ac_json_none, /* NULL */
+  ac_json_null,
+  ac_json_false,
+  ac_json_true,
+  ac_json_number,
+  ac_json_string,
+  ac_json_array,
+  ac_json_object
+} ac_json_type_t;
+
+/* containers can be nested this deep */
+#ifndef AC_JSON_MAX_DEPTH
+#define AC_JSON_MAX_DEPTH 1024
+#endif
+
+/* returns the root value, or NULL if s isn't valid JSON (or the pool is over
+   its limit) */
+ac_json_t *ac_json_parse(ac_pool_t *pool, const char *s, size_t length);
+
+static inline ac_json_type_t ac_json_type(const ac_json_t *j);
+
+/* the number of elements of an array or members of an object (0 for other
+   values) */
+static inline size_t ac_json_count(const ac_json_t *j);
+
+/* the first element of an array or the value of the first member of an
+   object, NULL if it is empty or j isn't a container */
+static inline ac_json_t *ac_json_first(ac_json_t *j);
+
+/* the value after j in its array or object, NULL at the end */
+static inline ac_json_t *ac_json_next(ac_json_t *j);
+
+/* the key of j if it is the value of an object member, otherwise NULL */
+const char *ac_json_key(ac_json_t *j);
+
+/* the value of the first member with key (or NULL) */
+ac_json_t *ac_json_get(ac_json_t *j, const char *key);
+ac_json_t *ac_json_get_n(ac_json_t *j, const char *key, size_t key_length);
+
+/* the element at index i of an array (or NULL) */
+ac_json_t *ac_json_at(ac_json_t *j, size_t i);
+
+/* the decoded string (zero terminated) or the text of a number.  ptr is NULL
+   for other values.  A string can have \u0000 in it, so use the length. */
+ac_strview_t ac_json_strview(ac_json_t *j);
+
+/* like ac_json_strview, default_value if j isn't a string or number */
+const char *ac_json_str(ac_json_t *j, const char *default_value);
+
+/* true and false, otherwise default_value */
+bool ac_json_bool(ac_json_t *j, bool default_value);
+
+/* numbers which fit the type (fractions and exponents are only accepted by
+   double), otherwise default_value */
+int ac_json_int(ac_json_t *j, int default_value);
+int64_t ac_json_int64_t(ac_json_t *j, int64_t default_value);
+uint64_t ac_json_uint64_t(ac_json_t *j, uint64_t default_value);
+double ac_json_double(ac_json_t *j, double default_value);
+
+static inline bool ac_json_is_null(const ac_json_t *j);
+
+/*
+  ac_json_writer_t appends JSON to a buffer and keeps track of the commas.
+  Numbers are formatted with ac_buffer_append_i64 and friends (no printf for
+  integers) and strings are escaped with ac_buffer_append_escaped_json.  The
+  writer doesn't check the structure, so keys must be written before the
+  values of an object and every container must be ended.
+
+    ac_json_writer_t w;
+    ac_json_writer_init(&w, bh);
+    ac_json_write_object(&w);
+    ac_json_write_key(&w, "id");
+    ac_json_write_int64(&w, id);
+    ac_json_write_key(&w, "tags");
+    ac_json_write_array(&w);
+    ac_json_write_string(&w, "a");
+    ac_json_write_array_end(&w);
+    ac_json_write_object_end(&w);
+*/
+typedef struct {
+  ac_buffer_t *bh;
+  bool need_comma;
+} ac_json_writer_t;
+
+static inline void ac_json_writer_init(ac_json_writer_t *w, ac_buffer_t *bh);
+
+static inline void ac_json_write_object(ac_json_writer_t *w);
+static inline void ac_json_write_object_end(ac_json_writer_t *w);
+static inline void ac_json_write_array(ac_json_writer_t *w);
+static inline void ac_json_write_array_end(ac_json_writer_t *w);
+
+static inline void ac_json_write_key(ac_json_writer_t *w, const char *key);
+static inline void ac_json_write_key_n(ac_json_writer_t *w, const char *key,
+                                       size_t length);
+
+static inline void ac_json_write_string(ac_json_writer_t *w, const char *s);
+static inline void ac_json_write_string_n(ac_json_writer_t *w, const char *s,
+                                          size_t length);
+static inline void ac_json_write_int64(ac_json_writer_t *w, int64_t v);
+static inline void ac_json_write_uint64(ac_json_writer_t *w, uint64_t v);
+/* nan and inf are written as null */
+void ac_json_write_double(ac_json_writer_t *w, double v);
+static inline void ac_json_write_bool(ac_json_writer_t *w, bool v);
+static inline void ac_json_write_null(ac_json_writer_t *w);
+
+/* appends json as a value without checking it */
+static inline void ac_json_write_raw(ac_json_writer_t *w, const char *json,
+                                     size_t length);
+
+/* writes a parsed value (and everything in it) */
+void ac_json_write_value(ac_json_writer_t *w, ac_json_t *j);
+
+#include "impl/ac_json.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
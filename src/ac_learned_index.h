@@ -0,0 +1,71 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_learned_index_H
+#define _ac_learned_index_H
+
+#include "ac_common.h"
+#include "ac_pool.h"
+#include "ac_search.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Learned index macros
+  =====================================================================
+
+  A learned index models the position of each key in a sorted array as a
+  function of the key.  The model is a list of line segments which is built
+  once.  Each segment predicts the position of every element it covers to
+  within max_error.  A lookup finds the segment (the segments are few and
+  stay in the cache), predicts a position, and then binary searches
+  the 2 * max_error elements around it.  For near-uniform numeric keys
+  (such as ids) there are only a handful of segments, and a lookup touches a
+  couple of cache lines instead of log2(n) of them.
+
+  Keys must be numeric (key returns an integer or floating point value which
+  can be converted to a double).  The array must be sorted by key and must
+  not change after the index is built.  Larger values of max_error make
+  fewer segments and wider final searches, and 16 to 64 works well.
+
+  ac_learned_index_build_m(name, datatype, key)
+    expects: keytype key(const datatype *el);
+    returns: ac_learned_index_t *name(ac_pool_t *pool, datatype *base,
+                                      size_t num_elements, size_t max_error);
+
+    The index is allocated from pool.
+
+  ac_learned_index_lower_bound_m(name, keytype, datatype, key)
+    expects: keytype key(const datatype *el);
+    returns: datatype *name(ac_learned_index_t *h, keytype k,
+                            datatype *base);
+
+    returns the first element whose key is not less than k or
+    base + num_elements if there is none.  base must be the array that the
+    index was built over.
+*/
+struct ac_learned_index_s;
+typedef struct ac_learned_index_s ac_learned_index_t;
+
+#include "impl/ac_learned_index.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_list_H
+#define _ac_list_H
+
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Intrusive linked lists for one thread (see ac_queue.h for lists which are
+  shared between threads).
+
+  ac_list_t   a doubly linked list with O(1) insert, erase, and move
+              anywhere (an LRU queue, connections which may close in any
+              order)
+  ac_slist_t  a singly linked list with a tail, so it can be used as a
+              stack or a FIFO (a freelist, a queue of pending requests)
+
+  Like ac_map_t, the node is embedded in the object and the lists never
+  allocate, so an object can be on several lists at once (with one node for
+  each).  Use ac_parent_object to get from the node back to the object.
+
+    typedef struct {
+      ac_list_node_t node;
+      int fd;
+    } conn_t;
+
+    for (ac_list_node_t *n = ac_list_first(&conns); n; n = n->next) {
+      conn_t *c = ac_parent_object(n, conn_t, node);
+      ...
+    }
+
+  The lists are NULL terminated (node->next is NULL at the tail and
+  node->prev is NULL at the head), so they can be walked by following the
+  links directly.  A whole list, or a chain of nodes which are already
+  linked (first through last), moves onto the front or back of another list
+  in O(1).  The lists don't keep a count, which would make splicing a chain
+  O(n).
+
+  For lists which are mostly iterated, a list of pointers spends most of
+  its time waiting for each node's cache line.  ac_ulist.h stores the items
+  themselves, many to a node.
+*/
+
+typedef struct ac_list_node_s {
+  struct ac_list_node_s *next;
+  struct ac_list_node_s *prev;
+} ac_list_node_t;
+
+typedef struct {
+  ac_list_node_t *head;
+  ac_list_node_t *tail;
+} ac_list_t;
+
+static inline void ac_list_init(ac_list_t *l);
+static inline bool ac_list_empty(ac_list_t *l);
+
+/* NULL if the list is empty */
+static inline ac_list_node_t *ac_list_first(ac_list_t *l);
+static inline ac_list_node_t *ac_list_last(ac_list_t *l);
+
+static inline void ac_list_push_front(ac_list_t *l, ac_list_node_t *n);
+static inline void ac_list_push_back(ac_list_t *l, ac_list_node_t *n);
+
+/* insert n before (or after) pos, which is on l */
+static inline void ac_list_insert_before(ac_list_t *l, ac_list_node_t *pos,
+                                         ac_list_node_t *n);
+static inline void ac_list_insert_after(ac_list_t *l, ac_list_node_t *pos,
+                                        ac_list_node_t *n);
+
+/* unlink n from l (n's links are left as they were) */
+static inline void ac_list_erase(ac_list_t *l, ac_list_node_t *n);
+
+/* remove and return the first (or last) node, NULL if the list is empty */
+static inline ac_list_node_t *ac_list_pop_front(ac_list_t *l);
+static inline ac_list_node_t *ac_list_pop_back(ac_list_t *l);
+
+/* move n (which is on l) to the front or back, such as when an LRU entry is
+   used */
+static inline void ac_list_move_to_front(ac_list_t *l, ac_list_node_t *n);
+static inline void ac_list_move_to_back(ac_list_t *l, ac_list_node_t *n);
+
+/* move every node of other to the front (or back) of l, other is empty
+   afterwards */
+static inline void ac_list_splice_front(ac_list_t *l, ac_list_t *other);
+static inline void ac_list_splice_back(ac_list_t *l, ac_list_t *other);
+
+/* add the chain first..last (already linked through next and prev, and
+   not on any list) to the front (or back) of l */
+static inline void ac_list_prepend_chain(ac_list_t *l, ac_list_node_t *first,
+                                         ac_list_node_t *last);
+static inline void ac_list_append_chain(ac_list_t *l, ac_list_node_t *first,
+                                        ac_list_node_t *last);
+
+/* move n and every node after it from l to the (empty) list tail */
+static inline void ac_list_split(ac_list_t *l, ac_list_node_t *n,
+                                 ac_list_t *tail);
+
+typedef struct ac_slist_node_s {
+  struct ac_slist_node_s *next;
+} ac_slist_node_t;
+
+typedef struct {
+  ac_slist_node_t *head;
+  ac_slist_node_t *tail;
+} ac_slist_t;
+
+static inline void ac_slist_init(ac_slist_t *l);
+static inline bool ac_slist_empty(ac_slist_t *l);
+
+/* NULL if the list is empty */
+static inline ac_slist_node_t *ac_slist_first(ac_slist_t *l);
+static inline ac_slist_node_t *ac_slist_last(ac_slist_t *l);
+
+static inline void ac_slist_push_front(ac_slist_t *l, ac_slist_node_t *n);
+static inline void ac_slist_push_back(ac_slist_t *l, ac_slist_node_t *n);
+
+/* remove and return the first node, NULL if the list is empty */
+static inline ac_slist_node_t *ac_slist_pop_front(ac_slist_t *l);
+
+/* insert n after pos (at the front if pos is NULL) */
+static inline void ac_slist_insert_after(ac_slist_t *l, ac_slist_node_t *pos,
+                                         ac_slist_node_t *n);
+
+/* remove and return the node after pos (the first node if pos is NULL) */
+static inline ac_slist_node_t *ac_slist_erase_after(ac_slist_t *l,
+                                                    ac_slist_node_t *pos);
+
+/* unlink n, which means finding the node before it (O(n)), returns false if
+   n isn't on l.  Keep track of the previous node and use
+   ac_slist_erase_after when possible. */
+static inline bool ac_slist_erase(ac_slist_t *l, ac_slist_node_t *n);
+
+/* move every node of other to the front (or back) of l, other is empty
+   afterwards */
+static inline void ac_slist_splice_front(ac_slist_t *l, ac_slist_t *other);
+static inline void ac_slist_splice_back(ac_slist_t *l, ac_slist_t *other);
+
+/* add the chain first..last (already linked through next) to the front (or
+   back) of l, such as a batch of objects being returned to a freelist */
+static inline void ac_slist_prepend_chain(ac_slist_t *l, ac_slist_node_t *first,
+                                          ac_slist_node_t *last);
+static inline void ac_slist_append_chain(ac_slist_t *l, ac_slist_node_t *first,
+                                         ac_slist_node_t *last);
+
+/* empty the list and return its nodes (linked through next) */
+static inline ac_slist_node_t *ac_slist_take_all(ac_slist_t *l);
+
+#include "impl/ac_list.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,189 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_loader.h"
+#include "ac_buffer.h"
+#include "ac_file_reader.h"
+#include "ac_parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* pieces are at least this large, so small files are parsed by fewer
+   threads */
+#ifndef AC_LOADER_MIN_PIECE
+#define AC_LOADER_MIN_PIECE (1024 * 1024)
+#endif
+
+typedef struct {
+  const char *start;
+  const char *end;
+  ac_pool_t *pool;
+  ac_buffer_t *records;
+} loader_run_t;
+
+struct ac_loader_s {
+  loader_run_t *runs;
+  size_t num_runs;
+  size_t num_records;
+  ac_pool_t *pool;
+  ac_loader_parse_f parse;
+  void *arg;
+  void (*sort)(void **base, size_t num);
+};
+
+static void parse_run(void *arg, size_t chunk, size_t start, size_t end) {
+  ac_loader_t *h = (ac_loader_t *)arg;
+  ac_buffer_t *line = ac_buffer_init(256);
+  for (size_t i = start; i < end; i++) {
+    loader_run_t *r = h->runs + i;
+    const char *p = r->start;
+    while (p < r->end) {
+      const char *ep = (const char *)memchr(p, '\n', r->end - p);
+      const char *next = ep ? ep + 1 : r->end;
+      if (!ep)
+        ep = r->end;
+      if (ep > p && ep[-1] == '\r')
+        ep--;
+      ac_buffer_set(line, p, ep - p);
+      void *record =
+          h->parse(r->pool, ac_buffer_data(line), ep - p, h->arg);
+      if (record)
+        ac_buffer_append(r->records, &record, sizeof(record));
+      p = next;
+    }
+  }
+  ac_buffer_destroy(line);
+  (void)chunk;
+}
+
+static void sort_run(void *arg, size_t chunk, size_t start, size_t end) {
+  ac_loader_t *h = (ac_loader_t *)arg;
+  for (size_t i = start; i < end; i++) {
+    loader_run_t *r = h->runs + i;
+    h->sort((void **)ac_buffer_data(r->records),
+            ac_buffer_length(r->records) / sizeof(void *));
+  }
+  (void)chunk;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_loader_t *_ac_loader_init(const char *filename, ac_loader_parse_f parse,
+                             void *arg, int num_threads, const char *caller) {
+#else
+ac_loader_t *_ac_loader_init(const char *filename, ac_loader_parse_f parse,
+                             void *arg, int num_threads) {
+#endif
+  ac_file_reader_t *fr = ac_file_reader_open(filename, 0);
+  if (!fr)
+    return NULL;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_pool_t *pool = _ac_pool_init(4096, caller);
+#else
+  ac_pool_t *pool = _ac_pool_init(4096);
+#endif
+  ac_loader_t *h = (ac_loader_t *)ac_pool_calloc(pool, sizeof(ac_loader_t));
+  h->pool = pool;
+  h->parse = parse;
+  h->arg = arg;
+
+  /* a pipe (or anything else which isn't mapped) is read first */
+  size_t length;
+  ac_buffer_t *bh = NULL;
+  const char *data = ac_file_reader_data(fr, &length);
+  if (!data) {
+    bh = ac_buffer_init(AC_FILE_READER_CHUNK_SIZE);
+    char *chunk;
+    size_t chunk_length;
+    while ((chunk = ac_file_reader_read(fr, &chunk_length)) != NULL)
+      ac_buffer_append(bh, chunk, chunk_length);
+    data = ac_buffer_data(bh);
+    length = ac_buffer_length(bh);
+  }
+
+  if (num_threads < 1)
+    num_threads = 1;
+  size_t num_runs = length / AC_LOADER_MIN_PIECE;
+  if (num_runs > (size_t)num_threads)
+    num_runs = num_threads;
+  if (!num_runs)
+    num_runs = 1;
+  h->runs = (loader_run_t *)ac_pool_calloc(pool,
+                                           sizeof(loader_run_t) * num_runs);
+  const char *p = data, *ep = data + length;
+  for (size_t i = 0; i < num_runs; i++) {
+    loader_run_t *r = h->runs + i;
+    const char *e = data + (length * (i + 1)) / num_runs;
+    if (e < p)
+      e = p;
+    if (i + 1 < num_runs) {
+      /* end each piece just after a line ending */
+      const char *nl =
+          (e < ep) ? (const char *)memchr(e, '\n', ep - e) : NULL;
+      e = nl ? nl + 1 : ep;
+    } else
+      e = ep;
+    r->start = p;
+    r->end = e;
+#ifdef _AC_DEBUG_MEMORY_
+    r->pool = _ac_pool_init(1024 * 1024, caller);
+#else
+    r->pool = _ac_pool_init(1024 * 1024);
+#endif
+    r->records = ac_buffer_init(4096);
+    p = e;
+  }
+  h->num_runs = num_runs;
+  ac_parallel_for(num_runs, 1, num_threads, parse_run, h);
+
+  for (size_t i = 0; i < num_runs; i++)
+    h->num_records += ac_buffer_length(h->runs[i].records) / sizeof(void *);
+  if (bh)
+    ac_buffer_destroy(bh);
+  ac_file_reader_close(fr);
+  return h;
+}
+
+size_t ac_loader_runs(ac_loader_t *h) { return h->num_runs; }
+
+void **ac_loader_run(ac_loader_t *h, size_t run, size_t *num) {
+  ac_buffer_t *records = h->runs[run].records;
+  *num = ac_buffer_length(records) / sizeof(void *);
+  return (void **)ac_buffer_data(records);
+}
+
+size_t ac_loader_count(ac_loader_t *h) { return h->num_records; }
+
+ac_pool_t *ac_loader_run_pool(ac_loader_t *h, size_t run) {
+  return h->runs[run].pool;
+}
+
+ac_pool_t *ac_loader_pool(ac_loader_t *h) { return h->pool; }
+
+void ac_loader_sort_runs(ac_loader_t *h, void (*sort)(void **base, size_t num),
+                         int num_threads) {
+  h->sort = sort;
+  ac_parallel_for(h->num_runs, 1, num_threads, sort_run, h);
+}
+
+void ac_loader_destroy(ac_loader_t *h) {
+  for (size_t i = 0; i < h->num_runs; i++) {
+    ac_pool_destroy(h->runs[i].pool);
+    ac_buffer_destroy(h->runs[i].records);
+  }
+  ac_pool_destroy(h->pool);
+}
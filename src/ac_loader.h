@@ -0,0 +1,116 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_loader_H
+#define _ac_loader_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_merge.h"
+#include "ac_pool.h"
+#include "ac_sort.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_loader_t parses a file of lines on a group of threads.  The file is
+  mapped (see ac_file_reader_t) and split into num_threads pieces of about
+  the same size, each ending at a line boundary.  Every piece is parsed by
+  one thread with a pool of its own, so parse doesn't need any locking, and
+  the records which parse returns are kept in file order per piece (a run).
+
+  ac_loader_sort_m sorts the runs at the same time and merges them with a
+  parallel k way merge (see ac_merge.h), which is what an index needs before
+  ac_map_build_from_sorted or a binary search.  For a map whose node begins
+  with ac_map_t,
+
+    static void *parse_name(ac_pool_t *pool, char *line, size_t length,
+                            void *arg);
+    static inline int compare_name(name_t *const *a, name_t *const *b);
+    ac_loader_sort_m(name_load_sorted, name_t, compare_name)
+
+    ac_loader_t *l = ac_loader_init("names.txt", parse_name, NULL, 8);
+    size_t num;
+    name_t **names = name_load_sorted(l, &num, 8);
+    ac_map_t *root = ac_map_build_from_sorted((ac_map_t **)names, num);
+
+  The records live in the loader's pools, so the loader must outlive them.
+
+  ac_loader_sort_m(name, datatype, compare)
+    expects: int compare(datatype *const *a, datatype *const *b);
+    returns: datatype **name(ac_loader_t *h, size_t *num, int num_threads);
+    the result is allocated from the loader (see ac_loader_pool) and equal
+    records come out in file order if compare breaks ties (the runs are
+    sorted with ac_sort_m, which isn't stable).
+*/
+struct ac_loader_s;
+typedef struct ac_loader_s ac_loader_t;
+
+/* parse is called with a copy of each line (zero terminated and without the
+   line ending), which it may modify and which is only valid for the call.
+   It returns the record for the line or NULL to skip it.  Anything kept
+   must be allocated from pool. */
+typedef void *(*ac_loader_parse_f)(ac_pool_t *pool, char *line, size_t length,
+                                   void *arg);
+
+/* returns NULL if the file can't be opened, a filename of "-" reads stdin
+   (which is read completely before it is split) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_loader_init(filename, parse, arg, num_threads)                      \
+  _ac_loader_init(filename, parse, arg, num_threads,                           \
+                  AC_FILE_LINE_MACRO("ac_loader"))
+ac_loader_t *_ac_loader_init(const char *filename, ac_loader_parse_f parse,
+                             void *arg, int num_threads, const char *caller);
+#else
+#define ac_loader_init(filename, parse, arg, num_threads)                      \
+  _ac_loader_init(filename, parse, arg, num_threads)
+ac_loader_t *_ac_loader_init(const char *filename, ac_loader_parse_f parse,
+                             void *arg, int num_threads);
+#endif
+
+/* the number of runs (pieces of the file) */
+size_t ac_loader_runs(ac_loader_t *h);
+
+/* the records of a run in file order */
+void **ac_loader_run(ac_loader_t *h, size_t run, size_t *num);
+
+/* the total number of records */
+size_t ac_loader_count(ac_loader_t *h);
+
+/* the pool which run was parsed into (only one thread may use it) */
+ac_pool_t *ac_loader_run_pool(ac_loader_t *h, size_t run);
+
+/* a pool for the caller's own allocations, cleared with the loader */
+ac_pool_t *ac_loader_pool(ac_loader_t *h);
+
+/* sorts every run in place with sort on num_threads threads (this is what
+   ac_loader_sort_m calls) */
+void ac_loader_sort_runs(ac_loader_t *h, void (*sort)(void **base, size_t num),
+                         int num_threads);
+
+/* frees the runs, the pools and so every record */
+void ac_loader_destroy(ac_loader_t *h);
+
+#include "impl/ac_loader.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
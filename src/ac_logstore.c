@@ -0,0 +1,773 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_logstore.h"
+#include "ac_buffer.h"
+#include "ac_hashmap.h"
+#include "ac_sort.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+/* a record is the header, the key, and the value (an erase has no value).
+   The crc covers the lengths, the key, and the value. */
+typedef struct {
+  uint32_t crc;
+  uint32_t key_length;
+  uint32_t value_length;
+} record_header_t;
+
+#define ERASED 0xFFFFFFFFU
+
+static inline size_t record_size(uint32_t key_length, uint32_t value_length) {
+  return sizeof(record_header_t) + key_length +
+         (value_length == ERASED ? 0 : value_length);
+}
+
+/* crc32c, with the SSE4.2 instruction when it is available */
+#ifdef __SSE4_2__
+static uint32_t crc32c(uint32_t crc, const void *p, size_t len) {
+  const unsigned char *s = (const unsigned char *)p;
+  crc = ~crc;
+  for (; len >= 8; s += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+    crc = (uint32_t)_mm_crc32_u64(crc, v);
+  }
+  for (; len; s++, len--)
+    crc = _mm_crc32_u8(crc, *s);
+  return ~crc;
+}
+#else
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int j = 0; j < 8; j++)
+      c = (c >> 1) ^ (0x82F63B78U & (0U - (c & 1)));
+    crc_table[i] = c;
+  }
+}
+
+static uint32_t crc32c(uint32_t crc, const void *p, size_t len) {
+  const unsigned char *s = (const unsigned char *)p;
+  pthread_once(&crc_once, init_crc_table);
+  crc = ~crc;
+  for (; len; s++, len--)
+    crc = crc_table[(crc ^ *s) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+#endif
+
+static record_header_t record_header(const void *key, uint32_t key_length,
+                                     const void *value,
+                                     uint32_t value_length) {
+  record_header_t r;
+  r.key_length = key_length;
+  r.value_length = value_length;
+  uint32_t crc = crc32c(0, &r.key_length, sizeof(uint32_t) * 2);
+  crc = crc32c(crc, key, key_length);
+  if (value_length != ERASED)
+    crc = crc32c(crc, value, value_length);
+  r.crc = crc;
+  return r;
+}
+
+/* the latest record of a key */
+typedef struct {
+  uint64_t pos;
+  uint32_t key_length;
+  uint32_t value_length;
+  char key[];
+} item_t;
+
+typedef struct {
+  const char *key;
+  size_t length;
+} lookup_t;
+
+static inline size_t hash_lookup(const lookup_t *k) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < k->length; i++)
+    h = (h ^ (unsigned char)k->key[i]) * 1099511628211ULL;
+  /* fnv-1a doesn't mix the high bits into the low bits (which the hashmap
+     keeps in the control bytes) */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+static inline bool equal_lookup(const lookup_t *k, const item_t *d) {
+  return d->key_length == k->length && !memcmp(d->key, k->key, k->length);
+}
+
+ac_hashmap_def(ac_logstore_index, lookup_t, item_t);
+ac_hashmap_m(ac_logstore_index, lookup_t, item_t, hash_lookup, equal_lookup);
+
+typedef struct {
+  /* the log position of the first byte of the file */
+  uint64_t base;
+  uint64_t size;
+  /* the bytes of records which were replaced or erased */
+  uint64_t garbage;
+  int fd;
+  char *map;
+  size_t map_size;
+} segment_t;
+
+struct ac_logstore_s {
+  char *dir;
+  int dir_fd;
+
+  /* protects everything below */
+  pthread_mutex_t lock;
+  /* signaled when a flush finishes */
+  pthread_cond_t flushed;
+
+  ac_logstore_index_t index;
+
+  /* sorted by base, the last segment is the one being appended to */
+  segment_t **segments;
+  size_t num_segments;
+  size_t max_segments;
+
+  /* the log is split into three parts. [0, written) is in the segment files,
+     [flushing_pos, pending_pos) is being written by a flush, and the rest is
+     in pending. */
+  ac_buffer_t *pending;
+  uint64_t pending_pos;
+  uint64_t pending_garbage;
+  ac_buffer_t *flushing;
+  uint64_t flushing_pos;
+  uint64_t flushing_garbage;
+  uint64_t written;
+  uint64_t synced;
+  bool flush_active;
+
+  /* one compaction runs at a time */
+  pthread_mutex_t compact_lock;
+  pthread_cond_t compact_cond;
+  pthread_t thread;
+  bool compact_wanted;
+  bool closing;
+};
+
+static const char *segment_path(ac_logstore_t *h, uint64_t base, char *buf,
+                                size_t len) {
+  snprintf(buf, len, "%s/%016" PRIx64 ".log", h->dir, base);
+  return buf;
+}
+
+static void io_failed(const char *what) {
+  perror(what);
+  abort();
+}
+
+static void map_segment(segment_t *seg, size_t map_size) {
+  if (seg->map)
+    munmap(seg->map, seg->map_size);
+  /* the mapping can extend past the end of the file, only the bytes which
+     have been written are read */
+  seg->map = (char *)mmap(NULL, map_size, PROT_READ, MAP_SHARED, seg->fd, 0);
+  if (seg->map == MAP_FAILED)
+    io_failed("ac_logstore mmap");
+  seg->map_size = map_size;
+}
+
+static void add_segment(ac_logstore_t *h, segment_t *seg) {
+  if (h->num_segments == h->max_segments) {
+    h->max_segments = h->max_segments ? h->max_segments * 2 : 16;
+    h->segments = (segment_t **)ac_realloc(
+        h->segments, sizeof(segment_t *) * h->max_segments);
+    if (!h->segments)
+      abort();
+  }
+  h->segments[h->num_segments++] = seg;
+}
+
+static segment_t *create_segment(ac_logstore_t *h, uint64_t base) {
+  char path[4096];
+  segment_path(h, base, path, sizeof(path));
+  segment_t *seg = (segment_t *)ac_calloc(sizeof(segment_t));
+  if (!seg)
+    abort();
+  seg->base = base;
+  seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (seg->fd < 0)
+    io_failed(path);
+  /* the new file's name has to be durable before anything in it is */
+  if (fsync(h->dir_fd))
+    io_failed("ac_logstore fsync");
+  map_segment(seg, AC_LOGSTORE_SEGMENT_SIZE);
+  add_segment(h, seg);
+  return seg;
+}
+
+static void free_segment(segment_t *seg) {
+  if (seg->map)
+    munmap(seg->map, seg->map_size);
+  close(seg->fd);
+  ac_free(seg);
+}
+
+/* the segment which holds pos (which must have been written) */
+static segment_t *find_segment(ac_logstore_t *h, uint64_t pos) {
+  size_t lo = 0, hi = h->num_segments;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) >> 1;
+    if (h->segments[mid]->base <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return h->segments[lo];
+}
+
+static inline bool needs_compaction(segment_t *seg, int percent) {
+  return seg->size && seg->garbage * 100 >= seg->size * (uint64_t)percent;
+}
+
+/* the record at pos became garbage */
+static void add_garbage(ac_logstore_t *h, uint64_t pos, size_t size) {
+  if (pos >= h->pending_pos) {
+    h->pending_garbage += size;
+    return;
+  }
+  if (pos >= h->written) {
+    h->flushing_garbage += size;
+    return;
+  }
+  segment_t *seg = find_segment(h, pos);
+  seg->garbage += size;
+  if (seg != h->segments[h->num_segments - 1] && !h->compact_wanted &&
+      needs_compaction(seg, AC_LOGSTORE_COMPACT_PERCENT)) {
+    h->compact_wanted = true;
+    pthread_cond_signal(&h->compact_cond);
+  }
+}
+
+/* the bytes of the record at pos */
+static const char *record_at(ac_logstore_t *h, uint64_t pos) {
+  if (pos >= h->pending_pos)
+    return ac_buffer_data(h->pending) + (pos - h->pending_pos);
+  if (pos >= h->written)
+    return ac_buffer_data(h->flushing) + (pos - h->flushing_pos);
+  segment_t *seg = find_segment(h, pos);
+  return seg->map + (pos - seg->base);
+}
+
+static inline uint64_t log_end(ac_logstore_t *h) {
+  return h->pending_pos + ac_buffer_length(h->pending);
+}
+
+/* appends a record to pending and returns its position */
+static uint64_t append_record(ac_logstore_t *h, const record_header_t *r,
+                              const void *key, const void *value) {
+  uint64_t pos = log_end(h);
+  ac_buffer_append(h->pending, r, sizeof(*r));
+  ac_buffer_append(h->pending, key, r->key_length);
+  if (r->value_length != ERASED)
+    ac_buffer_append(h->pending, value, r->value_length);
+  return pos;
+}
+
+/* writes (and syncs) the log up to at least target.  If a flush is already
+   running, this waits for it, since the next flush will then also cover the
+   updates which arrived in the meantime. */
+static void flush(ac_logstore_t *h, uint64_t target, bool sync) {
+  pthread_mutex_lock(&h->lock);
+  while (true) {
+    if ((sync ? h->synced : h->written) >= target) {
+      pthread_mutex_unlock(&h->lock);
+      return;
+    }
+    if (!h->flush_active)
+      break;
+    pthread_cond_wait(&h->flushed, &h->lock);
+  }
+  h->flush_active = true;
+  ac_buffer_t *b = h->pending;
+  h->pending = h->flushing;
+  h->flushing = b;
+  h->flushing_pos = h->pending_pos;
+  size_t len = ac_buffer_length(b);
+  h->pending_pos += len;
+  h->flushing_garbage = h->pending_garbage;
+  h->pending_garbage = 0;
+  segment_t *seg = h->segments[h->num_segments - 1];
+  segment_t *sealed = NULL;
+  if (len && seg->size && seg->size + len > AC_LOGSTORE_SEGMENT_SIZE) {
+    sealed = seg;
+    seg = create_segment(h, h->flushing_pos);
+  }
+  pthread_mutex_unlock(&h->lock);
+
+  if (sealed && fdatasync(sealed->fd))
+    io_failed("ac_logstore fdatasync");
+  const char *p = ac_buffer_data(b);
+  size_t left = len;
+  while (left) {
+    ssize_t n = write(seg->fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      io_failed("ac_logstore write");
+    }
+    p += n;
+    left -= n;
+  }
+  if (sync && fdatasync(seg->fd))
+    io_failed("ac_logstore fdatasync");
+
+  pthread_mutex_lock(&h->lock);
+  seg->size += len;
+  seg->garbage += h->flushing_garbage;
+  h->flushing_garbage = 0;
+  if (seg->size > seg->map_size)
+    map_segment(seg, seg->size);
+  h->written = h->flushing_pos + len;
+  if (sync)
+    h->synced = h->written;
+  else if (sealed && h->synced < h->flushing_pos)
+    h->synced = h->flushing_pos;
+  ac_buffer_clear(b);
+  h->flush_active = false;
+  if (sealed && !h->compact_wanted &&
+      needs_compaction(sealed, AC_LOGSTORE_COMPACT_PERCENT)) {
+    h->compact_wanted = true;
+    pthread_cond_signal(&h->compact_cond);
+  }
+  pthread_cond_broadcast(&h->flushed);
+  pthread_mutex_unlock(&h->lock);
+}
+
+void ac_logstore_sync(ac_logstore_t *h) {
+  pthread_mutex_lock(&h->lock);
+  uint64_t end = log_end(h);
+  pthread_mutex_unlock(&h->lock);
+  flush(h, end, true);
+}
+
+void ac_logstore_put(ac_logstore_t *h, const void *key, size_t key_length,
+                     const void *value, size_t value_length, bool sync) {
+  if (key_length >= ERASED || value_length >= ERASED)
+    abort();
+  record_header_t r = record_header(key, (uint32_t)key_length, value,
+                                    (uint32_t)value_length);
+  lookup_t k = {(const char *)key, key_length};
+  pthread_mutex_lock(&h->lock);
+  uint64_t pos = append_record(h, &r, key, value);
+  item_t *item = ac_logstore_index_find(&h->index, &k);
+  if (item) {
+    add_garbage(h, item->pos,
+                record_size(item->key_length, item->value_length));
+  } else {
+    item = (item_t *)ac_malloc(sizeof(item_t) + key_length);
+    if (!item)
+      abort();
+    item->key_length = (uint32_t)key_length;
+    memcpy(item->key, key, key_length);
+    k.key = item->key;
+    ac_logstore_index_insert(&h->index, &k, item);
+  }
+  item->pos = pos;
+  item->value_length = (uint32_t)value_length;
+  uint64_t end = log_end(h);
+  bool full = ac_buffer_length(h->pending) >= AC_LOGSTORE_BATCH_SIZE;
+  pthread_mutex_unlock(&h->lock);
+  if (sync || full)
+    flush(h, end, sync);
+}
+
+bool ac_logstore_erase(ac_logstore_t *h, const void *key, size_t key_length,
+                       bool sync) {
+  if (key_length >= ERASED)
+    return false;
+  record_header_t r = record_header(key, (uint32_t)key_length, NULL, ERASED);
+  lookup_t k = {(const char *)key, key_length};
+  pthread_mutex_lock(&h->lock);
+  item_t *item = ac_logstore_index_erase(&h->index, &k);
+  if (!item) {
+    pthread_mutex_unlock(&h->lock);
+    return false;
+  }
+  append_record(h, &r, key, NULL);
+  add_garbage(h, item->pos, record_size(item->key_length, item->value_length));
+  ac_free(item);
+  uint64_t end = log_end(h);
+  bool full = ac_buffer_length(h->pending) >= AC_LOGSTORE_BATCH_SIZE;
+  pthread_mutex_unlock(&h->lock);
+  if (sync || full)
+    flush(h, end, sync);
+  return true;
+}
+
+void *ac_logstore_get(ac_logstore_t *h, ac_pool_t *pool, const void *key,
+                      size_t key_length, size_t *value_length) {
+  lookup_t k = {(const char *)key, key_length};
+  char *r = NULL;
+  pthread_mutex_lock(&h->lock);
+  item_t *item = ac_logstore_index_find(&h->index, &k);
+  if (item) {
+    const char *p = record_at(h, item->pos) + sizeof(record_header_t) +
+                    item->key_length;
+    r = (char *)ac_pool_alloc(pool, item->value_length + 1);
+    if (r) {
+      memcpy(r, p, item->value_length);
+      r[item->value_length] = 0;
+      if (value_length)
+        *value_length = item->value_length;
+    }
+  }
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+size_t ac_logstore_count(ac_logstore_t *h) {
+  pthread_mutex_lock(&h->lock);
+  size_t r = ac_logstore_index_size(&h->index);
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+void ac_logstore_usage(ac_logstore_t *h, uint64_t *bytes, uint64_t *garbage) {
+  uint64_t b = 0, g = 0;
+  pthread_mutex_lock(&h->lock);
+  for (size_t i = 0; i < h->num_segments; i++) {
+    b += h->segments[i]->size;
+    g += h->segments[i]->garbage;
+  }
+  pthread_mutex_unlock(&h->lock);
+  if (bytes)
+    *bytes = b;
+  if (garbage)
+    *garbage = g;
+}
+
+/* the number of records copied while holding the lock */
+#define COMPACT_BATCH 64
+
+/* appends the live records of a sealed segment to the log, syncs them, and
+   removes the segment.  The segment won't change (or be unmapped) while it is
+   read, since only compaction removes segments. */
+static void compact_segment(ac_logstore_t *h, segment_t *seg) {
+  const char *p = seg->map;
+  const char *ep = p + seg->size;
+  uint64_t pos = seg->base;
+  while (p < ep) {
+    pthread_mutex_lock(&h->lock);
+    for (int i = 0; i < COMPACT_BATCH && p < ep; i++) {
+      record_header_t r;
+      memcpy(&r, p, sizeof(r));
+      const char *key = p + sizeof(r);
+      size_t size = record_size(r.key_length, r.value_length);
+      lookup_t k = {key, r.key_length};
+      item_t *item = ac_logstore_index_find(&h->index, &k);
+      if (r.value_length == ERASED) {
+        /* an older segment may still have a value for the key, unless the
+           key was put again (the copy would be replayed after that put) */
+        if (h->segments[0] != seg && !item)
+          append_record(h, &r, key, NULL);
+      } else {
+        if (item && item->pos == pos)
+          item->pos = append_record(h, &r, key, key + r.key_length);
+      }
+      p += size;
+      pos += size;
+    }
+    uint64_t end = log_end(h);
+    bool full = ac_buffer_length(h->pending) >= AC_LOGSTORE_BATCH_SIZE;
+    pthread_mutex_unlock(&h->lock);
+    if (full)
+      flush(h, end, false);
+  }
+  ac_logstore_sync(h);
+
+  pthread_mutex_lock(&h->lock);
+  size_t i = 0;
+  while (h->segments[i] != seg)
+    i++;
+  memmove(h->segments + i, h->segments + i + 1,
+          sizeof(segment_t *) * (h->num_segments - i - 1));
+  h->num_segments--;
+  pthread_mutex_unlock(&h->lock);
+  char path[4096];
+  unlink(segment_path(h, seg->base, path, sizeof(path)));
+  free_segment(seg);
+}
+
+void ac_logstore_compact(ac_logstore_t *h, int percent) {
+  pthread_mutex_lock(&h->compact_lock);
+  pthread_mutex_lock(&h->lock);
+  /* segments which are sealed while compacting (including the ones which
+     the live records are copied to) are left for the next time */
+  uint64_t limit = log_end(h);
+  while (true) {
+    segment_t *best = NULL;
+    for (size_t i = 0; i + 1 < h->num_segments; i++) {
+      segment_t *seg = h->segments[i];
+      if (seg->base + seg->size <= limit && needs_compaction(seg, percent) &&
+          (!best || seg->garbage * best->size > best->garbage * seg->size))
+        best = seg;
+    }
+    if (!best)
+      break;
+    pthread_mutex_unlock(&h->lock);
+    compact_segment(h, best);
+    pthread_mutex_lock(&h->lock);
+  }
+  pthread_mutex_unlock(&h->lock);
+  pthread_mutex_unlock(&h->compact_lock);
+}
+
+static void *run_compaction(void *arg) {
+  ac_logstore_t *h = (ac_logstore_t *)arg;
+  pthread_mutex_lock(&h->lock);
+  while (!h->closing) {
+    if (!h->compact_wanted) {
+      pthread_cond_wait(&h->compact_cond, &h->lock);
+      continue;
+    }
+    h->compact_wanted = false;
+    pthread_mutex_unlock(&h->lock);
+    ac_logstore_compact(h, AC_LOGSTORE_COMPACT_PERCENT);
+    pthread_mutex_lock(&h->lock);
+  }
+  pthread_mutex_unlock(&h->lock);
+  return NULL;
+}
+
+/* replays the records of a segment into the index.  A record which is cut
+   off or doesn't match its crc ends the segment (the file is truncated). */
+static void replay(ac_logstore_t *h, segment_t *seg) {
+  const char *p = seg->map;
+  const char *ep = p + seg->size;
+  while ((size_t)(ep - p) >= sizeof(record_header_t)) {
+    record_header_t r;
+    memcpy(&r, p, sizeof(r));
+    const char *key = p + sizeof(r);
+    size_t size = (size_t)(ep - p);
+    if (r.key_length >= ERASED ||
+        record_size(r.key_length, r.value_length) > size)
+      break;
+    size = record_size(r.key_length, r.value_length);
+    record_header_t check =
+        record_header(key, r.key_length, key + r.key_length, r.value_length);
+    if (check.crc != r.crc)
+      break;
+    uint64_t pos = seg->base + (p - seg->map);
+    lookup_t k = {key, r.key_length};
+    item_t *item;
+    if (r.value_length == ERASED) {
+      if ((item = ac_logstore_index_erase(&h->index, &k))) {
+        find_segment(h, item->pos)->garbage +=
+            record_size(item->key_length, item->value_length);
+        ac_free(item);
+      }
+    } else {
+      if ((item = ac_logstore_index_find(&h->index, &k)))
+        find_segment(h, item->pos)->garbage +=
+            record_size(item->key_length, item->value_length);
+      else {
+        item = (item_t *)ac_malloc(sizeof(item_t) + r.key_length);
+        if (!item)
+          abort();
+        item->key_length = r.key_length;
+        memcpy(item->key, key, r.key_length);
+        k.key = item->key;
+        ac_logstore_index_insert(&h->index, &k, item);
+      }
+      item->pos = pos;
+      item->value_length = r.value_length;
+    }
+    p += size;
+  }
+  if (p < ep) {
+    seg->size = p - seg->map;
+    if (ftruncate(seg->fd, seg->size))
+      io_failed("ac_logstore ftruncate");
+  }
+}
+
+static inline int compare_base(const uint64_t *a, const uint64_t *b) {
+  if (*a != *b)
+    return *a < *b ? -1 : 1;
+  return 0;
+}
+
+static ac_sort_m(sort_bases, uint64_t, compare_base)
+
+/* the bases of the segment files in dir, sorted */
+static uint64_t *list_segments(const char *dir, size_t *num) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return NULL;
+  size_t max = 16;
+  uint64_t *r = (uint64_t *)ac_malloc(sizeof(uint64_t) * max);
+  if (!r)
+    abort();
+  *num = 0;
+  struct dirent *e;
+  while ((e = readdir(d))) {
+    char *ep;
+    if (strlen(e->d_name) != 20 || strcmp(e->d_name + 16, ".log"))
+      continue;
+    uint64_t base = strtoull(e->d_name, &ep, 16);
+    if (ep != e->d_name + 16)
+      continue;
+    if (*num == max) {
+      max *= 2;
+      r = (uint64_t *)ac_realloc(r, sizeof(uint64_t) * max);
+      if (!r)
+        abort();
+    }
+    r[(*num)++] = base;
+  }
+  closedir(d);
+  sort_bases(r, *num);
+  return r;
+}
+
+/* opens the existing segments, returns false if one can't be read */
+static bool load_segments(ac_logstore_t *h) {
+  size_t num;
+  uint64_t *bases = list_segments(h->dir, &num);
+  if (!bases)
+    return false;
+  bool ok = true;
+  for (size_t i = 0; i < num; i++) {
+    char path[4096];
+    segment_path(h, bases[i], path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+      if (fd >= 0)
+        close(fd);
+      ok = false;
+      break;
+    }
+    bool last = i + 1 == num;
+    if (!st.st_size && !last) {
+      close(fd);
+      unlink(path);
+      continue;
+    }
+    segment_t *seg = (segment_t *)ac_calloc(sizeof(segment_t));
+    if (!seg)
+      abort();
+    seg->base = bases[i];
+    seg->size = st.st_size;
+    seg->fd = fd;
+    map_segment(seg, (last && seg->size < AC_LOGSTORE_SEGMENT_SIZE)
+                         ? AC_LOGSTORE_SEGMENT_SIZE
+                         : seg->size);
+    add_segment(h, seg);
+    replay(h, seg);
+  }
+  ac_free(bases);
+  return ok;
+}
+
+static void free_store(ac_logstore_t *h) {
+  for (size_t i = 0; i < h->num_segments; i++)
+    free_segment(h->segments[i]);
+  if (h->segments)
+    ac_free(h->segments);
+  size_t pos = 0;
+  item_t *item;
+  while ((item = ac_logstore_index_next(&h->index, &pos)))
+    ac_free(item);
+  ac_logstore_index_destroy(&h->index);
+  ac_buffer_destroy(h->pending);
+  ac_buffer_destroy(h->flushing);
+  if (h->dir_fd >= 0)
+    close(h->dir_fd);
+  pthread_mutex_destroy(&h->lock);
+  pthread_cond_destroy(&h->flushed);
+  pthread_mutex_destroy(&h->compact_lock);
+  pthread_cond_destroy(&h->compact_cond);
+  ac_free(h->dir);
+  ac_free(h);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_logstore_t *_ac_logstore_open(const char *dir, const char *caller) {
+  ac_logstore_t *h =
+      (ac_logstore_t *)_ac_calloc_d(NULL, caller, sizeof(ac_logstore_t), false);
+#else
+ac_logstore_t *_ac_logstore_open(const char *dir) {
+  ac_logstore_t *h = (ac_logstore_t *)ac_calloc(sizeof(ac_logstore_t));
+#endif
+  if (!h)
+    abort();
+  h->dir = ac_strdup(dir);
+  pthread_mutex_init(&h->lock, NULL);
+  pthread_cond_init(&h->flushed, NULL);
+  pthread_mutex_init(&h->compact_lock, NULL);
+  pthread_cond_init(&h->compact_cond, NULL);
+  ac_logstore_index_init(&h->index, NULL, 0);
+  h->pending = ac_buffer_init(AC_LOGSTORE_BATCH_SIZE + 4096);
+  h->flushing = ac_buffer_init(AC_LOGSTORE_BATCH_SIZE + 4096);
+  h->dir_fd = -1;
+  if ((mkdir(dir, 0755) && errno != EEXIST) ||
+      (h->dir_fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0 ||
+      !load_segments(h)) {
+    free_store(h);
+    return NULL;
+  }
+  if (!h->num_segments)
+    create_segment(h, 0);
+  segment_t *last = h->segments[h->num_segments - 1];
+  h->pending_pos = h->flushing_pos = h->written = h->synced =
+      last->base + last->size;
+  if (lseek(last->fd, 0, SEEK_END) < 0)
+    io_failed("ac_logstore lseek");
+  for (size_t i = 0; i + 1 < h->num_segments; i++)
+    if (needs_compaction(h->segments[i], AC_LOGSTORE_COMPACT_PERCENT))
+      h->compact_wanted = true;
+  if (pthread_create(&h->thread, NULL, run_compaction, h))
+    abort();
+  return h;
+}
+
+void ac_logstore_close(ac_logstore_t *h) {
+  if (!h)
+    return;
+  pthread_mutex_lock(&h->lock);
+  h->closing = true;
+  pthread_cond_signal(&h->compact_cond);
+  pthread_mutex_unlock(&h->lock);
+  pthread_join(h->thread, NULL);
+  ac_logstore_sync(h);
+  free_store(h);
+}
@@ -0,0 +1,117 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_logstore_H
+#define _ac_logstore_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_logstore_t is a persistent key/value store which only ever appends.
+  Every put and erase is a record (with a crc) at the end of the log, so the
+  disk sees sequential writes no matter which keys are updated.  The log is
+  a directory of segment files, each named by the log position of its first
+  byte.  An in memory hash table maps each key to the position of its latest
+  record, so a get is one lookup and one copy out of the mmap'd segment.
+
+  Updates are appended to a pending batch.  A put with sync set returns once
+  the update is on disk.  The first thread which needs a sync writes the
+  whole batch in one write and calls fdatasync once for it, while the
+  threads which arrive during the fsync wait and are covered by the next
+  one (group commit), so each fsync is shared by every concurrent writer.
+  Updates without sync are written once the batch reaches
+  AC_LOGSTORE_BATCH_SIZE bytes or by the next sync, get always sees them.
+
+  A segment is sealed once it reaches AC_LOGSTORE_SEGMENT_SIZE.  The bytes of
+  records which were replaced or erased are counted per segment, and when
+  AC_LOGSTORE_COMPACT_PERCENT of a sealed segment is garbage, a background
+  thread appends its live records to the end of the log, syncs, and deletes
+  the segment.  Erase records are kept as long as an older segment might
+  hold the key and the key hasn't been put again.
+
+  ac_logstore_open reads the log to rebuild the index.  A torn record at the
+  end of the last segment (from a crash during a write) is truncated.  The
+  store is thread-safe.  Only one ac_logstore_t should open a directory at a
+  time.  Failing to write or sync a segment aborts.
+*/
+struct ac_logstore_s;
+typedef struct ac_logstore_s ac_logstore_t;
+
+#ifndef AC_LOGSTORE_SEGMENT_SIZE
+#define AC_LOGSTORE_SEGMENT_SIZE (64 * 1024 * 1024)
+#endif
+
+#ifndef AC_LOGSTORE_BATCH_SIZE
+#define AC_LOGSTORE_BATCH_SIZE (1024 * 1024)
+#endif
+
+#ifndef AC_LOGSTORE_COMPACT_PERCENT
+#define AC_LOGSTORE_COMPACT_PERCENT 50
+#endif
+
+/* opens (or creates) the store in dir, NULL if dir can't be created or a
+   segment can't be read */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_logstore_open(dir)                                                  \
+  _ac_logstore_open(dir, AC_FILE_LINE_MACRO("ac_logstore"))
+ac_logstore_t *_ac_logstore_open(const char *dir, const char *caller);
+#else
+#define ac_logstore_open(dir) _ac_logstore_open(dir)
+ac_logstore_t *_ac_logstore_open(const char *dir);
+#endif
+
+/* syncs the pending updates, stops compaction, and frees the store */
+void ac_logstore_close(ac_logstore_t *h);
+
+void ac_logstore_put(ac_logstore_t *h, const void *key, size_t key_length,
+                     const void *value, size_t value_length, bool sync);
+
+/* returns false if key wasn't found (nothing is written then) */
+bool ac_logstore_erase(ac_logstore_t *h, const void *key, size_t key_length,
+                       bool sync);
+
+/* copies the value of key into pool (zero terminated) and sets
+   *value_length, returns NULL if key isn't found */
+void *ac_logstore_get(ac_logstore_t *h, ac_pool_t *pool, const void *key,
+                      size_t key_length, size_t *value_length);
+
+/* returns once every update before the call is on disk */
+void ac_logstore_sync(ac_logstore_t *h);
+
+/* the number of keys */
+size_t ac_logstore_count(ac_logstore_t *h);
+
+/* the bytes of the segments and how many of them are garbage */
+void ac_logstore_usage(ac_logstore_t *h, uint64_t *bytes, uint64_t *garbage);
+
+/* compacts every sealed segment which is at least percent garbage on the
+   calling thread (the background thread uses AC_LOGSTORE_COMPACT_PERCENT) */
+void ac_logstore_compact(ac_logstore_t *h, int percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,299 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_lru.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct ac_lru_s {
+  ac_map_t *root;
+  /* head is the most recently used entry */
+  ac_lru_entry_t *head;
+  ac_lru_entry_t *tail;
+  size_t count;
+  size_t bytes;
+  size_t max_entries;
+  size_t max_bytes;
+  ac_lru_compare_f compare;
+  ac_lru_evict_f evict;
+  void *arg;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_lru_t *_ac_lru_init(size_t max_entries, size_t max_bytes,
+                       ac_lru_compare_f compare, ac_lru_evict_f evict,
+                       void *arg, const char *caller) {
+  ac_lru_t *h = (ac_lru_t *)_ac_malloc_d(NULL, caller, sizeof(ac_lru_t), false);
+#else
+ac_lru_t *_ac_lru_init(size_t max_entries, size_t max_bytes,
+                       ac_lru_compare_f compare, ac_lru_evict_f evict,
+                       void *arg) {
+  ac_lru_t *h = (ac_lru_t *)ac_malloc(sizeof(ac_lru_t));
+#endif
+  if (!h)
+    abort();
+  h->root = NULL;
+  h->head = h->tail = NULL;
+  h->count = 0;
+  h->bytes = 0;
+  h->max_entries = max_entries;
+  h->max_bytes = max_bytes;
+  h->compare = compare;
+  h->evict = evict;
+  h->arg = arg;
+  return h;
+}
+
+static inline void unlink_entry(ac_lru_t *h, ac_lru_entry_t *e) {
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    h->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    h->tail = e->prev;
+}
+
+static inline void link_head(ac_lru_t *h, ac_lru_entry_t *e) {
+  e->prev = NULL;
+  e->next = h->head;
+  if (e->next)
+    e->next->prev = e;
+  else
+    h->tail = e;
+  h->head = e;
+}
+
+/* remove e without calling evict */
+static inline void remove_entry(ac_lru_t *h, ac_lru_entry_t *e) {
+  unlink_entry(h, e);
+  ac_map_erase(&e->map, &h->root);
+  h->count--;
+  h->bytes -= e->size;
+}
+
+void ac_lru_destroy(ac_lru_t *h) {
+  ac_lru_entry_t *e = h->head;
+  while (e) {
+    ac_lru_entry_t *next = e->next;
+    if (h->evict)
+      h->evict(h->arg, e);
+    e = next;
+  }
+  ac_free(h);
+}
+
+uint64_t ac_lru_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline ac_lru_entry_t *find_entry(ac_lru_t *h, const void *key,
+                                         ac_map_t ***np, ac_map_t **parent) {
+  ac_map_t **p = &h->root, *par = NULL;
+  while (*p) {
+    par = *p;
+    int n = h->compare(key, (ac_lru_entry_t *)par);
+    if (n < 0)
+      p = &par->left;
+    else if (n > 0)
+      p = &par->right;
+    else
+      return (ac_lru_entry_t *)par;
+  }
+  *np = p;
+  *parent = par;
+  return NULL;
+}
+
+ac_lru_entry_t *ac_lru_find(ac_lru_t *h, const void *key) {
+  ac_map_t **np, *parent;
+  ac_lru_entry_t *e = find_entry(h, key, &np, &parent);
+  if (!e)
+    return NULL;
+  if (e->expires && ac_lru_now() >= e->expires) {
+    ac_lru_erase(h, e);
+    return NULL;
+  }
+  ac_lru_touch(h, e);
+  return e;
+}
+
+void ac_lru_touch(ac_lru_t *h, ac_lru_entry_t *e) {
+  if (h->head == e)
+    return;
+  unlink_entry(h, e);
+  link_head(h, e);
+}
+
+bool ac_lru_insert(ac_lru_t *h, const void *key, ac_lru_entry_t *e,
+                   size_t size, uint64_t ttl_ms) {
+  bool inserted = true;
+  ac_map_t **np = NULL, *parent = NULL;
+  ac_lru_entry_t *old = find_entry(h, key, &np, &parent);
+  if (old) {
+    ac_lru_erase(h, old);
+    inserted = false;
+    /* the tree changed, so search for the position again */
+    find_entry(h, key, &np, &parent);
+  }
+  e->size = size;
+  e->expires = ttl_ms ? ac_lru_now() + ttl_ms : 0;
+  *np = &e->map;
+  ac_map_fix_insert(&e->map, parent, &h->root);
+  link_head(h, e);
+  h->count++;
+  h->bytes += size;
+
+  while (h->tail != e && ((h->max_entries && h->count > h->max_entries) ||
+                          (h->max_bytes && h->bytes > h->max_bytes)))
+    ac_lru_erase(h, h->tail);
+  return inserted;
+}
+
+void ac_lru_erase(ac_lru_t *h, ac_lru_entry_t *e) {
+  remove_entry(h, e);
+  if (h->evict)
+    h->evict(h->arg, e);
+}
+
+size_t ac_lru_expire(ac_lru_t *h) {
+  uint64_t now = ac_lru_now();
+  size_t num = 0;
+  ac_lru_entry_t *e = h->head;
+  while (e) {
+    ac_lru_entry_t *next = e->next;
+    if (e->expires && now >= e->expires) {
+      ac_lru_erase(h, e);
+      num++;
+    }
+    e = next;
+  }
+  return num;
+}
+
+ac_lru_entry_t *ac_lru_most_recent(ac_lru_t *h) { return h->head; }
+
+size_t ac_lru_count(ac_lru_t *h) { return h->count; }
+
+size_t ac_lru_bytes(ac_lru_t *h) { return h->bytes; }
+
+/* sharded */
+typedef struct {
+  pthread_mutex_t mutex;
+  ac_lru_t *lru;
+} ac_lru_shard_t;
+
+struct ac_lru_sharded_s {
+  size_t num_shards;
+  ac_lru_hash_f hash;
+  ac_lru_shard_t *shards;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_lru_sharded_t *_ac_lru_sharded_init(size_t num_shards, size_t max_entries,
+                                       size_t max_bytes, ac_lru_hash_f hash,
+                                       ac_lru_compare_f compare,
+                                       ac_lru_evict_f evict, void *arg,
+                                       const char *caller) {
+  ac_lru_sharded_t *h = (ac_lru_sharded_t *)_ac_malloc_d(
+      NULL, caller,
+      sizeof(ac_lru_sharded_t) + sizeof(ac_lru_shard_t) * num_shards, false);
+#else
+ac_lru_sharded_t *_ac_lru_sharded_init(size_t num_shards, size_t max_entries,
+                                       size_t max_bytes, ac_lru_hash_f hash,
+                                       ac_lru_compare_f compare,
+                                       ac_lru_evict_f evict, void *arg) {
+  ac_lru_sharded_t *h = (ac_lru_sharded_t *)ac_malloc(
+      sizeof(ac_lru_sharded_t) + sizeof(ac_lru_shard_t) * num_shards);
+#endif
+  if (!h || !num_shards)
+    abort();
+  h->num_shards = num_shards;
+  h->hash = hash;
+  h->shards = (ac_lru_shard_t *)(h + 1);
+  /* round the limits up so that the total is at least what was asked for */
+  size_t shard_entries = (max_entries + num_shards - 1) / num_shards;
+  size_t shard_bytes = (max_bytes + num_shards - 1) / num_shards;
+  for (size_t i = 0; i < num_shards; i++) {
+    pthread_mutex_init(&h->shards[i].mutex, NULL);
+#ifdef _AC_DEBUG_MEMORY_
+    h->shards[i].lru = _ac_lru_init(shard_entries, shard_bytes, compare, evict,
+                                    arg, caller);
+#else
+    h->shards[i].lru =
+        _ac_lru_init(shard_entries, shard_bytes, compare, evict, arg);
+#endif
+  }
+  return h;
+}
+
+void ac_lru_sharded_destroy(ac_lru_sharded_t *h) {
+  for (size_t i = 0; i < h->num_shards; i++) {
+    ac_lru_destroy(h->shards[i].lru);
+    pthread_mutex_destroy(&h->shards[i].mutex);
+  }
+  ac_free(h);
+}
+
+static inline ac_lru_shard_t *get_shard(ac_lru_sharded_t *h, const void *key) {
+  return h->shards + (h->hash(key) % h->num_shards);
+}
+
+bool ac_lru_sharded_find(ac_lru_sharded_t *h, const void *key,
+                         ac_lru_found_f found, void *arg) {
+  ac_lru_shard_t *s = get_shard(h, key);
+  pthread_mutex_lock(&s->mutex);
+  ac_lru_entry_t *e = ac_lru_find(s->lru, key);
+  if (e && found)
+    found(arg, e);
+  pthread_mutex_unlock(&s->mutex);
+  return e ? true : false;
+}
+
+bool ac_lru_sharded_insert(ac_lru_sharded_t *h, const void *key,
+                           ac_lru_entry_t *e, size_t size, uint64_t ttl_ms) {
+  ac_lru_shard_t *s = get_shard(h, key);
+  pthread_mutex_lock(&s->mutex);
+  bool r = ac_lru_insert(s->lru, key, e, size, ttl_ms);
+  pthread_mutex_unlock(&s->mutex);
+  return r;
+}
+
+bool ac_lru_sharded_erase(ac_lru_sharded_t *h, const void *key) {
+  ac_lru_shard_t *s = get_shard(h, key);
+  ac_map_t **np, *parent;
+  pthread_mutex_lock(&s->mutex);
+  ac_lru_entry_t *e = find_entry(s->lru, key, &np, &parent);
+  if (e)
+    ac_lru_erase(s->lru, e);
+  pthread_mutex_unlock(&s->mutex);
+  return e ? true : false;
+}
+
+size_t ac_lru_sharded_count(ac_lru_sharded_t *h) {
+  size_t count = 0;
+  for (size_t i = 0; i < h->num_shards; i++) {
+    pthread_mutex_lock(&h->shards[i].mutex);
+    count += h->shards[i].lru->count;
+    pthread_mutex_unlock(&h->shards[i].mutex);
+  }
+  return count;
+}
@@ -0,0 +1,173 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_lru_H
+#define _ac_lru_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_map.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_lru_t is a least recently used cache.  The entries are intrusive, the
+  structure which is cached must begin with an ac_lru_entry_t.  Entries are
+  found through an ac_map and kept in a doubly linked list from the most to
+  the least recently used, so a find, touch, insert, or erase only relinks a
+  few pointers in the list.
+
+  The cache can be limited by the number of entries and/or by bytes (each
+  entry is inserted with a size).  When a limit is exceeded, the least
+  recently used entries are evicted.  An entry may also have a time to live,
+  expired entries are removed when they are found (or by ac_lru_expire).
+
+  The cache doesn't allocate the entries.  Every entry which leaves the cache
+  (evicted, expired, replaced, erased, or destroyed) is passed to the evict
+  callback, which typically returns it to where it came from (ac_slab_free,
+  ac_pool_freelist_free, ac_free, ...).
+*/
+typedef struct ac_lru_entry_s {
+  ac_map_t map;
+  /* next points to the next less recently used entry */
+  struct ac_lru_entry_s *next;
+  struct ac_lru_entry_s *prev;
+  /* the time (see ac_lru_now) that the entry expires, 0 if never */
+  uint64_t expires;
+  size_t size;
+} ac_lru_entry_t;
+
+struct ac_lru_s;
+typedef struct ac_lru_s ac_lru_t;
+
+/* compare the key to the key of the entry (like strcmp) */
+typedef int (*ac_lru_compare_f)(const void *key, const ac_lru_entry_t *e);
+
+/* called for every entry which leaves the cache */
+typedef void (*ac_lru_evict_f)(void *arg, ac_lru_entry_t *e);
+
+/* a max_entries or max_bytes of 0 means there is no limit */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_lru_init(max_entries, max_bytes, compare, evict, arg)               \
+  _ac_lru_init(max_entries, max_bytes, compare, evict, arg,                    \
+               AC_FILE_LINE_MACRO("ac_lru"))
+ac_lru_t *_ac_lru_init(size_t max_entries, size_t max_bytes,
+                       ac_lru_compare_f compare, ac_lru_evict_f evict,
+                       void *arg, const char *caller);
+#else
+#define ac_lru_init(max_entries, max_bytes, compare, evict, arg)               \
+  _ac_lru_init(max_entries, max_bytes, compare, evict, arg)
+ac_lru_t *_ac_lru_init(size_t max_entries, size_t max_bytes,
+                       ac_lru_compare_f compare, ac_lru_evict_f evict,
+                       void *arg);
+#endif
+
+/* evicts all of the entries and frees the cache */
+void ac_lru_destroy(ac_lru_t *h);
+
+/* the current time in milliseconds (from a monotonic clock) */
+uint64_t ac_lru_now(void);
+
+/* returns the entry for key (and makes it the most recently used) or NULL if
+   it isn't found or has expired */
+ac_lru_entry_t *ac_lru_find(ac_lru_t *h, const void *key);
+
+/* make e the most recently used entry */
+void ac_lru_touch(ac_lru_t *h, ac_lru_entry_t *e);
+
+/* insert e for key as the most recently used entry.  size is counted against
+   max_bytes and ttl_ms is the time to live in milliseconds (0 if e doesn't
+   expire).  An existing entry with the same key is replaced (and evicted).
+   Returns false if an entry was replaced.  The least recently used entries
+   are evicted until the cache is within its limits (e itself is never
+   evicted by its own insert). */
+bool ac_lru_insert(ac_lru_t *h, const void *key, ac_lru_entry_t *e,
+                   size_t size, uint64_t ttl_ms);
+
+/* remove e from the cache and pass it to evict */
+void ac_lru_erase(ac_lru_t *h, ac_lru_entry_t *e);
+
+/* remove all of the expired entries, returns the number removed */
+size_t ac_lru_expire(ac_lru_t *h);
+
+/* the most recently used entry, follow next to less recently used entries */
+ac_lru_entry_t *ac_lru_most_recent(ac_lru_t *h);
+
+size_t ac_lru_count(ac_lru_t *h);
+size_t ac_lru_bytes(ac_lru_t *h);
+
+/*
+  ac_lru_sharded_t splits a cache into num_shards caches which each have
+  their own mutex so that it can be used by many threads (such as the workers
+  of an ac_threaded_pipe).  The hash of the key selects the shard and the
+  limits are divided evenly between the shards.  Entries must not be used
+  outside of the shard's lock (another thread could evict them), so find
+  calls a callback with the lock held.  The evict callback is also called
+  with the shard's lock held.
+*/
+struct ac_lru_sharded_s;
+typedef struct ac_lru_sharded_s ac_lru_sharded_t;
+
+typedef uint64_t (*ac_lru_hash_f)(const void *key);
+
+/* called by ac_lru_sharded_find with the entry that was found */
+typedef void (*ac_lru_found_f)(void *arg, ac_lru_entry_t *e);
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_lru_sharded_init(num_shards, max_entries, max_bytes, hash, compare, \
+                            evict, arg)                                        \
+  _ac_lru_sharded_init(num_shards, max_entries, max_bytes, hash, compare,      \
+                       evict, arg, AC_FILE_LINE_MACRO("ac_lru_sharded"))
+ac_lru_sharded_t *_ac_lru_sharded_init(size_t num_shards, size_t max_entries,
+                                       size_t max_bytes, ac_lru_hash_f hash,
+                                       ac_lru_compare_f compare,
+                                       ac_lru_evict_f evict, void *arg,
+                                       const char *caller);
+#else
+#define ac_lru_sharded_init(num_shards, max_entries, max_bytes, hash, compare, \
+                            evict, arg)                                        \
+  _ac_lru_sharded_init(num_shards, max_entries, max_bytes, hash, compare,      \
+                       evict, arg)
+ac_lru_sharded_t *_ac_lru_sharded_init(size_t num_shards, size_t max_entries,
+                                       size_t max_bytes, ac_lru_hash_f hash,
+                                       ac_lru_compare_f compare,
+                                       ac_lru_evict_f evict, void *arg);
+#endif
+
+void ac_lru_sharded_destroy(ac_lru_sharded_t *h);
+
+/* returns false if key isn't found, otherwise calls found with the entry
+   (while the shard is locked) and returns true */
+bool ac_lru_sharded_find(ac_lru_sharded_t *h, const void *key,
+                         ac_lru_found_f found, void *arg);
+
+bool ac_lru_sharded_insert(ac_lru_sharded_t *h, const void *key,
+                           ac_lru_entry_t *e, size_t size, uint64_t ttl_ms);
+
+/* returns false if key isn't found */
+bool ac_lru_sharded_erase(ac_lru_sharded_t *h, const void *key);
+
+size_t ac_lru_sharded_count(ac_lru_sharded_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,8 +16,10 @@ limitations under the License.
 
 #include "ac_map.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define rb_color(n) ((n)->parent_color & 1)
 #define rb_is_red(n) (((n)->parent_color & 1) == 0)
@@ -31,6 +33,23 @@ limitations under the License.
 
 #define rb_clear_black(n) (n)->parent_color = 1
 
+/* subtree sizes for the order statistic variant (ac_map_os_t) */
+#define rb_size(n) (((ac_map_os_t *)(n))->size)
+#define rb_child_size(n) ((n) ? rb_size(n) : 0)
+
+/* after a rotation, new_root has the size that A had and A is recomputed */
+static inline void rb_fix_size(ac_map_t *new_root, ac_map_t *A) {
+  rb_size(new_root) = rb_size(A);
+  rb_size(A) = rb_child_size(A->left) + rb_child_size(A->right) + 1;
+}
+
+static inline void rb_adjust_sizes(ac_map_t *n, ssize_t delta) {
+  while (n) {
+    rb_size(n) += delta;
+    n = rb_parent(n);
+  }
+}
+
 /* iteration */
 ac_map_t *ac_map_first(ac_map_t *n) {
   if (!n)
@@ -103,17 +122,74 @@ ac_map_t *ac_map_postorder_next(ac_map_t *n) {
     return parent;
 }
 
+/* the nodes which have been prefetched but not yet read (a wider window
+   keeps so many pages in flight that the frees start missing the TLB) */
+#define DESTROY_WINDOW 8
+
+void ac_map_destroy_all(ac_map_t *root, ac_map_free_nodes_f free_nodes,
+                        void *tag) {
+  if (!root)
+    return;
+  /* the nodes still to visit, which grows past the local array only if the
+     window keeps many subtrees open at once */
+  ac_map_t *local[256];
+  ac_map_t **stack = local;
+  size_t stack_size = sizeof(local) / sizeof(local[0]);
+  size_t num = 0;
+  ac_map_t *window[DESTROY_WINDOW];
+  size_t head = 0, in_window = 0;
+  ac_map_t *batch[AC_MAP_DESTROY_BATCH];
+  size_t num_batch = 0;
+  stack[num++] = root;
+  while (num || in_window) {
+    /* move nodes from the stack to the window, prefetching them */
+    while (num && in_window < DESTROY_WINDOW) {
+      ac_map_t *n = stack[--num];
+      __builtin_prefetch(n);
+      window[(head + in_window++) % DESTROY_WINDOW] = n;
+    }
+    ac_map_t *n = window[head];
+    head = (head + 1) % DESTROY_WINDOW;
+    in_window--;
+    if (num + 2 > stack_size) {
+      ac_map_t **p =
+          (ac_map_t **)ac_malloc(sizeof(ac_map_t *) * stack_size * 2);
+      if (!p)
+        abort();
+      memcpy(p, stack, sizeof(ac_map_t *) * num);
+      if (stack != local)
+        ac_free(stack);
+      stack = p;
+      stack_size *= 2;
+    }
+    if (n->right)
+      stack[num++] = n->right;
+    if (n->left)
+      stack[num++] = n->left;
+    batch[num_batch++] = n;
+    if (num_batch == AC_MAP_DESTROY_BATCH) {
+      free_nodes(batch, num_batch, tag);
+      num_batch = 0;
+    }
+  }
+  if (num_batch)
+    free_nodes(batch, num_batch, tag);
+  if (stack != local)
+    ac_free(stack);
+}
+
 /* copy */
 static void tree_copy(ac_map_t *n, ac_map_t **res, ac_map_t *parent,
                       ac_map_copy_node_f copy, void *tag) {
   ac_map_t *c = copy(n, tag);
+  *res = c;
   c->parent_color = n->parent_color;
   rb_set_parent(c, parent);
   if (n->left)
     tree_copy(n->left, &c->left, c, copy, tag);
   else
     c->left = NULL;
-  if (n->left)
+  if (n->right)
     tree_copy(n->right, &c->right, c, copy, tag);
   else
     c->right = NULL;
@@ -127,6 +203,137 @@ ac_map_t *ac_map_copy(ac_map_t *root, ac_map_copy_node_f copy,
   return res;
 }
 
+/* parallel copy */
+typedef struct {
+  ac_map_t *n;
+  ac_map_t **res;
+  ac_map_t *parent;
+} ac_map_copy_task_t;
+
+typedef struct {
+  ac_map_copy_task_t *tasks;
+  size_t num_tasks;
+  size_t next_task;
+  ac_map_copy_node_f copy;
+} ac_map_copy_work_t;
+
+typedef struct {
+  ac_map_copy_work_t *work;
+  void *tag;
+} ac_map_copy_worker_t;
+
+/* copy the nodes above split_depth and make a task for each subtree at
+   split_depth */
+static void tree_copy_top(ac_map_t *n, ac_map_t **res, ac_map_t *parent,
+                          int depth, int split_depth, ac_map_copy_work_t *w,
+                          void *tag) {
+  if (depth == split_depth) {
+    ac_map_copy_task_t *t = w->tasks + w->num_tasks;
+    w->num_tasks++;
+    t->n = n;
+    t->res = res;
+    t->parent = parent;
+    return;
+  }
+  ac_map_t *c = w->copy(n, tag);
+  *res = c;
+  c->parent_color = n->parent_color;
+  rb_set_parent(c, parent);
+  c->left = NULL;
+  c->right = NULL;
+  if (n->left)
+    tree_copy_top(n->left, &c->left, c, depth + 1, split_depth, w, tag);
+  if (n->right)
+    tree_copy_top(n->right, &c->right, c, depth + 1, split_depth, w, tag);
+}
+
+static void *copy_worker(void *arg) {
+  ac_map_copy_worker_t *worker = (ac_map_copy_worker_t *)arg;
+  ac_map_copy_work_t *w = worker->work;
+  while (true) {
+    size_t i = __atomic_fetch_add(&w->next_task, 1, __ATOMIC_RELAXED);
+    if (i >= w->num_tasks)
+      break;
+    ac_map_copy_task_t *t = w->tasks + i;
+    tree_copy(t->n, t->res, t->parent, w->copy, worker->tag);
+  }
+  return NULL;
+}
+
+ac_map_t *ac_map_parallel_copy(ac_map_t *root, ac_map_copy_node_f copy,
+                               void **tags, int num_threads) {
+  if (!root || num_threads <= 1)
+    return ac_map_copy(root, copy, num_threads > 0 ? tags[0] : NULL);
+
+  /* make about 8 subtrees per thread so that threads which are given small
+     subtrees can pick up more work */
+  int split_depth = 3;
+  while ((1 << split_depth) < num_threads * 8 && split_depth < 16)
+    split_depth++;
+
+  ac_map_copy_work_t w;
+  w.tasks = (ac_map_copy_task_t *)ac_malloc(sizeof(ac_map_copy_task_t) *
+                                            ((size_t)1 << split_depth));
+  ac_map_copy_worker_t *workers = (ac_map_copy_worker_t *)ac_malloc(
+      sizeof(ac_map_copy_worker_t) * num_threads);
+  pthread_t *threads =
+      (pthread_t *)ac_malloc(sizeof(pthread_t) * num_threads);
+  if (!w.tasks || !workers || !threads)
+    abort();
+  w.num_tasks = 0;
+  w.next_task = 0;
+  w.copy = copy;
+
+  ac_map_t *res = NULL;
+  tree_copy_top(root, &res, NULL, 0, split_depth, &w, tags[0]);
+
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].work = &w;
+    workers[i].tag = tags[i];
+  }
+  for (int i = 1; i < num_threads; i++)
+    if (pthread_create(threads + i, NULL, copy_worker, workers + i))
+      abort();
+  copy_worker(workers);
+  for (int i = 1; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  ac_free(threads);
+  ac_free(workers);
+  ac_free(w.tasks);
+  return res;
+}
+
+/* build from sorted */
+static ac_map_t *build_from_sorted(ac_map_t **nodes, size_t num,
+                                   ac_map_t *parent, int depth,
+                                   int red_depth) {
+  if (!num)
+    return NULL;
+  size_t mid = num >> 1;
+  ac_map_t *n = nodes[mid];
+  /* splitting at the middle puts every leaf at red_depth or red_depth-1, so
+     making the deepest level red gives every path the same black height */
+  n->parent_color = (size_t)parent;
+  if (depth != red_depth)
+    rb_set_black(n);
+  n->left = build_from_sorted(nodes, mid, n, depth + 1, red_depth);
+  n->right = build_from_sorted(nodes + mid + 1, num - mid - 1, n, depth + 1,
+                               red_depth);
+  return n;
+}
+
+ac_map_t *ac_map_build_from_sorted(ac_map_t **nodes, size_t num) {
+  /* red_depth is the depth of the deepest level (the root is at depth 0 and
+     must be black) */
+  int red_depth = 0;
+  while (((size_t)2 << red_depth) <= num)
+    red_depth++;
+  if (!red_depth)
+    red_depth = -1;
+  return build_from_sorted(nodes, num, NULL, 0, red_depth);
+}
+
 static int count_black_nodes(ac_map_t *n) {
   int black_nodes = 0;
   while (n) {
@@ -255,6 +462,221 @@ bool ac_map_valid_to_buffer(ac_buffer_t *bh, ac_pool_t *pool,
   return success;
 }
 
+/* incremental validation.  The stack holds the path from the root to the
+   node being checked and the black nodes on it (including the node). */
+typedef struct {
+  ac_map_t *nodes[AC_MAP_VALIDATOR_MAX_DEPTH];
+  int blacks[AC_MAP_VALIDATOR_MAX_DEPTH];
+  bool right[AC_MAP_VALIDATOR_MAX_DEPTH];
+  int depth;
+  /* the walk stays below this depth (the root of a sampled subtree) */
+  int base;
+  /* the black nodes from the root to any NULL child */
+  int black_height;
+} validate_stack_t;
+
+static bool push_node(validate_stack_t *s, ac_map_t *n, bool right) {
+  if (s->depth + 1 >= AC_MAP_VALIDATOR_MAX_DEPTH)
+    return false;
+  int d = ++s->depth;
+  s->nodes[d] = n;
+  s->right[d] = right;
+  s->blacks[d] = s->blacks[d - 1] + (rb_is_black(n) ? 1 : 0);
+  return true;
+}
+
+static void start_stack(validate_stack_t *s, ac_map_t *root) {
+  s->depth = s->base = 0;
+  s->nodes[0] = root;
+  s->right[0] = false;
+  s->blacks[0] = rb_is_black(root) ? 1 : 0;
+  /* the black height of the leftmost path is the one every path must have */
+  int black_height = 0, depth = 0;
+  for (ac_map_t *n = root; n && depth < AC_MAP_VALIDATOR_MAX_DEPTH;
+       n = n->left, depth++)
+    black_height += rb_is_black(n) ? 1 : 0;
+  s->black_height = black_height;
+}
+
+/* moves to the next node in preorder after the subtree of the top node,
+   returns false once the subtree at base is finished */
+static bool skip_subtree(validate_stack_t *s) {
+  while (s->depth > s->base) {
+    int d = s->depth;
+    ac_map_t *parent = s->nodes[d - 1];
+    s->depth--;
+    if (!s->right[d] && parent->right)
+      return push_node(s, parent->right, true);
+  }
+  return false;
+}
+
+/* returns false if the walk is finished or the tree is too deep */
+static bool next_node(validate_stack_t *s, bool *too_deep) {
+  ac_map_t *n = s->nodes[s->depth];
+  *too_deep = false;
+  if (n->left || n->right) {
+    if (push_node(s, n->left ? n->left : n->right, !n->left))
+      return true;
+    *too_deep = true;
+    return false;
+  }
+  return skip_subtree(s);
+}
+
+static void describe(ac_buffer_t *bh, ac_pool_t *pool, ac_map_t *n,
+                     print_node_to_string_f print_node, const char *what) {
+  if (!bh)
+    return;
+  if (print_node && pool)
+    print_node_with_color_to_buffer(bh, pool, n, print_node);
+  else
+    ac_buffer_appendf(bh, "%p", (void *)n);
+  ac_buffer_appendf(bh, " %s\n", what);
+}
+
+/* checks the node at the top of the stack */
+static bool check_node(validate_stack_t *s, ac_buffer_t *bh, ac_pool_t *pool,
+                       print_node_to_string_f print_node) {
+  int d = s->depth;
+  ac_map_t *n = s->nodes[d];
+  ac_map_t *parent = d ? s->nodes[d - 1] : NULL;
+  bool success = true;
+  if (rb_parent(n) != parent) {
+    success = false;
+    describe(bh, pool, n, print_node, "doesn't point to its parent");
+  }
+  if (!d && rb_is_red(n)) {
+    success = false;
+    describe(bh, pool, n, print_node, "is the root and isn't black");
+  }
+  if (rb_is_red(n) && ((n->left && rb_is_red(n->left)) ||
+                       (n->right && rb_is_red(n->right)) ||
+                       (parent && rb_is_red(parent)))) {
+    success = false;
+    describe(bh, pool, n, print_node, "is red and next to a red node");
+  }
+  if ((!n->left || !n->right) && s->blacks[d] != s->black_height) {
+    success = false;
+    describe(bh, pool, n, print_node,
+             "has a NULL child with a different black height");
+  }
+  return success;
+}
+
+void ac_map_validator_init(ac_map_validator_t *v, uint64_t seed) {
+  memset(v, 0, sizeof(*v));
+  v->depth = -1;
+  v->rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+static inline uint64_t validator_rand(ac_map_validator_t *v) {
+  /* xorshift64* */
+  v->rng ^= v->rng >> 12;
+  v->rng ^= v->rng << 25;
+  v->rng ^= v->rng >> 27;
+  return v->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static inline bool path_right(const ac_map_validator_t *v, int d) {
+  return (v->path[d >> 6] >> (d & 63)) & 1;
+}
+
+/* checks up to max_nodes from the top of the stack, returns false if a node
+   is broken.  *done is set if the walk finished. */
+static bool validate_walk(validate_stack_t *s, size_t max_nodes,
+                          ac_buffer_t *bh, ac_pool_t *pool,
+                          print_node_to_string_f print_node, bool *done) {
+  bool success = true, too_deep;
+  *done = false;
+  for (size_t i = 0; i < max_nodes; i++) {
+    if (!check_node(s, bh, pool, print_node))
+      success = false;
+    if (!next_node(s, &too_deep)) {
+      if (too_deep) {
+        success = false;
+        describe(bh, pool, s->nodes[s->depth], print_node,
+                 "is too deep for a valid tree");
+      }
+      *done = true;
+      break;
+    }
+  }
+  return success;
+}
+
+bool ac_map_validate_step(ac_map_validator_t *v, ac_map_t *root,
+                          size_t max_nodes, ac_buffer_t *bh, ac_pool_t *pool,
+                          print_node_to_string_f print_node) {
+  if (!root) {
+    v->depth = -1;
+    v->passes++;
+    return true;
+  }
+  validate_stack_t s;
+  start_stack(&s, root);
+  /* follow the path to the next node.  If the tree has changed so that the
+     path ends early, the walk continues after the subtree where it ends. */
+  bool resume = true;
+  for (int d = 1; d <= v->depth; d++) {
+    ac_map_t *n = s.nodes[d - 1];
+    ac_map_t *child = path_right(v, d) ? n->right : n->left;
+    if (!child) {
+      resume = skip_subtree(&s);
+      break;
+    }
+    push_node(&s, child, path_right(v, d));
+  }
+  bool done = !resume;
+  bool success = true;
+  if (resume)
+    success = validate_walk(&s, max_nodes, bh, pool, print_node, &done);
+  if (done) {
+    v->depth = -1;
+    v->passes++;
+    return success;
+  }
+  memset(v->path, 0, sizeof(v->path));
+  for (int d = 1; d <= s.depth; d++)
+    if (s.right[d])
+      v->path[d >> 6] |= 1ULL << (d & 63);
+  v->depth = s.depth;
+  return success;
+}
+
+bool ac_map_validate_sample(ac_map_validator_t *v, ac_map_t *root,
+                            size_t max_nodes, ac_buffer_t *bh,
+                            ac_pool_t *pool,
+                            print_node_to_string_f print_node) {
+  if (!root)
+    return true;
+  validate_stack_t s;
+  start_stack(&s, root);
+  /* descend to a random leaf and root the subtree at a random depth on the
+     way (the path above it is still checked for its parent links) */
+  while (true) {
+    ac_map_t *n = s.nodes[s.depth];
+    bool right = n->right && (!n->left || (validator_rand(v) & 1));
+    ac_map_t *child = right ? n->right : n->left;
+    if (!child)
+      break;
+    if (!push_node(&s, child, right)) {
+      describe(bh, pool, child, print_node, "is too deep for a valid tree");
+      return false;
+    }
+  }
+  int depth = (int)(validator_rand(v) % (uint64_t)(s.depth + 1));
+  bool success = true;
+  for (s.depth = 0; s.depth < depth; s.depth++)
+    if (!check_node(&s, bh, pool, print_node))
+      success = false;
+  s.base = depth;
+  bool done;
+  if (!validate_walk(&s, max_nodes, bh, pool, print_node, &done))
+    success = false;
+  return success;
+}
+
 /* print */
 typedef struct ac_map_print_s {
   size_t position;
@@ -456,7 +878,7 @@ void ac_map_print_to_buffer(ac_buffer_t *bh, ac_pool_t *pool,
   }
 }
 
-static void rotate_left(ac_map_t *A, ac_map_t **root) {
+static inline void rotate_left(ac_map_t *A, ac_map_t **root, bool sized) {
   ac_map_t *new_root = A->right;
 
   size_t tmp_pc = A->parent_color;
@@ -478,9 +900,11 @@ static void rotate_left(ac_map_t *A, ac_map_t **root) {
   A->right = tmp;
   if (tmp)
     rb_set_parent(tmp, A);
+  if (sized)
+    rb_fix_size(new_root, A);
 }
 
-static void rotate_right(ac_map_t *A, ac_map_t **root) {
+static inline void rotate_right(ac_map_t *A, ac_map_t **root, bool sized) {
   ac_map_t *new_root = A->left;
   size_t tmp_pc = A->parent_color;
   A->parent_color = new_root->parent_color;
@@ -501,13 +925,19 @@ static void rotate_right(ac_map_t *A, ac_map_t **root) {
   A->left = tmp;
   if (tmp)
     rb_set_parent(tmp, A);
+  if (sized)
+    rb_fix_size(new_root, A);
 }
 
-void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent,
-                         ac_map_t **root) {
+static inline void fix_insert(ac_map_t *node, ac_map_t *parent,
+                              ac_map_t **root, bool sized) {
   rb_set_red(node);
   rb_set_parent(node, parent);
   node->left = node->right = NULL;
+  if (sized) {
+    rb_size(node) = 1;
+    rb_adjust_sizes(parent, 1);
+  }
 
   ac_map_t *grandparent, *uncle;
 
@@ -532,8 +962,8 @@ void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent,
         continue;
       }
       if (parent->right == node)
-        rotate_left(parent, NULL);
-      rotate_right(grandparent, root);
+        rotate_left(parent, NULL, sized);
+      rotate_right(grandparent, root, sized);
       break;
     } else {
       uncle = grandparent->left;
@@ -545,53 +975,53 @@ void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent,
         continue;
       }
       if (parent->left == node)
-        rotate_right(parent, NULL);
-      rotate_left(grandparent, root);
+        rotate_right(parent, NULL, sized);
+      rotate_left(grandparent, root, sized);
       break;
     }
   }
 }
 
 static void fix_color_for_erase(ac_map_t *parent, ac_map_t *node,
-                                ac_map_t **root) {
+                                ac_map_t **root, bool sized) {
   ac_map_t *sibling;
   if (parent->right != node) {
     sibling = parent->right;
     if (rb_is_red(sibling)) {
-      rotate_left(parent, root);
+      rotate_left(parent, root, sized);
       sibling = parent->right;
     }
     if (sibling->right && rb_is_red(sibling->right)) {
       rb_set_black(sibling->right);
-      rotate_left(parent, root);
+      rotate_left(parent, root, sized);
     } else if (sibling->left && rb_is_red(sibling->left)) {
-      rotate_right(sibling, root);
-      rotate_left(parent, root);
+      rotate_right(sibling, root, sized);
+      rotate_left(parent, root, sized);
       rb_set_black(sibling);
     } else {
       rb_set_red(sibling);
       if (rb_parent(parent) && rb_is_black(parent))
-        fix_color_for_erase(rb_parent(parent), parent, root);
+        fix_color_for_erase(rb_parent(parent), parent, root, sized);
       else
         rb_set_black(parent);
     }
   } else {
     sibling = parent->left;
     if (rb_is_red(sibling)) {
-      rotate_right(parent, root);
+      rotate_right(parent, root, sized);
       sibling = parent->left;
     }
     if (sibling->left && rb_is_red(sibling->left)) {
       rb_set_black(sibling->left);
-      rotate_right(parent, root);
+      rotate_right(parent, root, sized);
     } else if (sibling->right && rb_is_red(sibling->right)) {
-      rotate_left(sibling, root);
-      rotate_right(parent, root);
+      rotate_left(sibling, root, sized);
+      rotate_right(parent, root, sized);
       rb_set_black(sibling);
     } else {
       rb_set_red(sibling);
       if (rb_parent(parent) && rb_is_black(parent))
-        fix_color_for_erase(rb_parent(parent), parent, root);
+        fix_color_for_erase(rb_parent(parent), parent, root, sized);
       else
         rb_set_black(parent);
     }
@@ -612,8 +1042,20 @@ static inline void replace_node_with_child(ac_map_t *child, ac_map_t *node,
   child->parent_color = node->parent_color;
 }
 
-bool ac_map_erase(ac_map_t *node, ac_map_t **root) {
+static inline void erase(ac_map_t *node, ac_map_t **root, bool sized) {
   ac_map_t *parent = rb_parent(node);
+  if (sized) {
+    /* every subtree above the position which is physically removed (the
+       node or its successor) loses one */
+    if (node->left && node->right) {
+      ac_map_t *successor = node->right;
+      while (successor->left)
+        successor = successor->left;
+      rb_adjust_sizes(rb_parent(successor), -1);
+      rb_size(successor) = rb_size(node);
+    } else
+      rb_adjust_sizes(parent, -1);
+  }
   if (!node->left) {
     if (node->right)
       replace_node_with_child(node->right, node, root);
@@ -624,7 +1066,7 @@ bool ac_map_erase(ac_map_t *node, ac_map_t **root) {
         else
           parent->right = NULL;
         if (rb_is_black(node))
-          fix_color_for_erase(parent, NULL, root);
+          fix_color_for_erase(parent, NULL, root, sized);
       } else
         *root = NULL;
     }
@@ -641,7 +1083,7 @@ bool ac_map_erase(ac_map_t *node, ac_map_t **root) {
         rb_set_black(successor->right);
       else {
         if (black)
-          fix_color_for_erase(successor, NULL, root);
+          fix_color_for_erase(successor, NULL, root, sized);
       }
     } else {
       while (successor->left)
@@ -662,8 +1104,340 @@ bool ac_map_erase(ac_map_t *node, ac_map_t **root) {
       successor->right = node->right;
       rb_set_parent(successor->right, successor);
       if (black)
-        fix_color_for_erase(parent, NULL, root);
+        fix_color_for_erase(parent, NULL, root, sized);
+    }
+  }
+}
+
+void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root) {
+  fix_insert(node, parent, root, false);
+}
+
+bool ac_map_erase(ac_map_t *node, ac_map_t **root) {
+  erase(node, root, false);
+  return true;
+}
+
+/* persistent */
+#define rb_child(n, dir) (*((dir) ? &(n)->right : &(n)->left))
+
+/* copies of persistent nodes only keep the color */
+static inline ac_map_t *persistent_copy(ac_map_t *n, ac_map_copy_node_f copy,
+                                        void *tag) {
+  ac_map_t *c = copy(n, tag);
+  c->parent_color &= 1;
+  return c;
+}
+
+/* copy the path so that it can be modified and return the new root */
+static inline ac_map_t *persistent_copy_path(ac_map_t **path, char *dirs,
+                                             int depth, ac_map_copy_node_f copy,
+                                             void *tag) {
+  for (int i = 0; i < depth; i++) {
+    path[i] = persistent_copy(path[i], copy, tag);
+    if (i)
+      rb_child(path[i - 1], dirs[i - 1]) = path[i];
+  }
+  return depth ? path[0] : NULL;
+}
+
+ac_map_t *ac_map_persistent_insert(ac_map_t **path, char *dirs, int depth,
+                                   bool replace, ac_map_t *node,
+                                   ac_map_copy_node_f copy, void *tag) {
+  if (replace) {
+    /* node takes the place (and color) of path[depth-1] */
+    ac_map_t *old = path[depth - 1];
+    node->parent_color = old->parent_color & 1;
+    node->left = old->left;
+    node->right = old->right;
+    ac_map_t *root = persistent_copy_path(path, dirs, depth - 1, copy, tag);
+    if (depth == 1)
+      return node;
+    rb_child(path[depth - 2], dirs[depth - 2]) = node;
+    return root;
+  }
+
+  ac_map_t *root = persistent_copy_path(path, dirs, depth, copy, tag);
+  node->parent_color = 0;
+  node->left = node->right = NULL;
+  if (!depth) {
+    rb_set_black(node);
+    return node;
+  }
+  rb_child(path[depth - 1], dirs[depth - 1]) = node;
+  path[depth] = node;
+
+  int i = depth;
+  while (i > 0 && rb_is_red(path[i - 1])) {
+    /* a red parent is never the root */
+    ac_map_t *parent = path[i - 1], *grandparent = path[i - 2];
+    char d = dirs[i - 2];
+    ac_map_t *uncle = rb_child(grandparent, !d);
+    if (uncle && rb_is_red(uncle)) {
+      uncle = persistent_copy(uncle, copy, tag);
+      rb_child(grandparent, !d) = uncle;
+      rb_set_black(uncle);
+      rb_set_black(parent);
+      rb_set_red(grandparent);
+      i -= 2;
+      continue;
+    }
+    if (dirs[i - 1] != d) {
+      ac_map_t *n = path[i];
+      rb_child(parent, !d) = rb_child(n, d);
+      rb_child(n, d) = parent;
+      parent = n;
+    }
+    rb_child(grandparent, d) = rb_child(parent, !d);
+    rb_child(parent, !d) = grandparent;
+    rb_set_black(parent);
+    rb_set_red(grandparent);
+    if (i > 2)
+      rb_child(path[i - 3], dirs[i - 3]) = parent;
+    else
+      root = parent;
+    break;
+  }
+  rb_set_black(root);
+  return root;
+}
+
+ac_map_t *ac_map_persistent_erase(ac_map_t **path, char *dirs, int depth,
+                                  ac_map_copy_node_f copy, void *tag) {
+  ac_map_t *node = path[depth - 1];
+  int t = depth - 1;
+  if (node->left && node->right) {
+    /* extend the path to the successor, it will take the place of node */
+    ac_map_t *n = node->right;
+    dirs[depth - 1] = 1;
+    while (n) {
+      path[depth++] = n;
+      dirs[depth - 1] = 0;
+      n = n->left;
+    }
+  }
+  /* the node being erased isn't copied since it won't be in the new tree */
+  ac_map_t *root = persistent_copy_path(path, dirs, t, copy, tag);
+  persistent_copy_path(path + t + 1, dirs + t + 1, depth - t - 1, copy, tag);
+  /* removed is the position which is physically removed and child is the
+     node which replaces it */
+  int removed = depth - 1;
+  ac_map_t *r = path[removed];
+  ac_map_t *child = r->left ? r->left : r->right;
+  bool black = rb_is_black(r);
+  if (removed != t) {
+    /* if the successor is node->right, r->right is replaced by child below */
+    r->left = node->left;
+    r->right = path[t + 1];
+    r->parent_color = node->parent_color & 1;
+    if (t)
+      rb_child(path[t - 1], dirs[t - 1]) = r;
+    else
+      root = r;
+    path[t] = r;
+  }
+  if (removed)
+    rb_child(path[removed - 1], dirs[removed - 1]) = child;
+  else
+    root = child;
+
+  if (!black)
+    return root;
+  if (child && rb_is_red(child)) {
+    child = persistent_copy(child, copy, tag);
+    rb_set_black(child);
+    if (removed)
+      rb_child(path[removed - 1], dirs[removed - 1]) = child;
+    else
+      root = child;
+    return root;
+  }
+
+  /* child is doubly black */
+  int i = removed;
+  while (i > 0) {
+    ac_map_t *parent = path[i - 1];
+    char d = dirs[i - 1];
+    ac_map_t *sibling = persistent_copy(rb_child(parent, !d), copy, tag);
+    rb_child(parent, !d) = sibling;
+    if (rb_is_red(sibling)) {
+      /* rotate so that the sibling is above the parent */
+      rb_child(parent, !d) = rb_child(sibling, d);
+      rb_child(sibling, d) = parent;
+      rb_set_black(sibling);
+      rb_set_red(parent);
+      if (i > 1)
+        rb_child(path[i - 2], dirs[i - 2]) = sibling;
+      else
+        root = sibling;
+      path[i - 1] = sibling;
+      path[i] = parent;
+      dirs[i] = d;
+      i++;
+      sibling = persistent_copy(rb_child(parent, !d), copy, tag);
+      rb_child(parent, !d) = sibling;
     }
+    ac_map_t *far = rb_child(sibling, !d), *near = rb_child(sibling, d);
+    if ((!far || rb_is_black(far)) && (!near || rb_is_black(near))) {
+      rb_set_red(sibling);
+      if (rb_is_red(parent)) {
+        rb_set_black(parent);
+        return root;
+      }
+      i--;
+      continue;
+    }
+    if (!far || rb_is_black(far)) {
+      near = persistent_copy(near, copy, tag);
+      rb_child(sibling, d) = rb_child(near, !d);
+      rb_child(near, !d) = sibling;
+      rb_set_red(sibling);
+      rb_set_black(near);
+      rb_child(parent, !d) = near;
+      far = sibling;
+      sibling = near;
+    } else {
+      far = persistent_copy(far, copy, tag);
+      rb_child(sibling, !d) = far;
+    }
+    sibling->parent_color = parent->parent_color;
+    rb_set_black(parent);
+    rb_set_black(far);
+    rb_child(parent, !d) = rb_child(sibling, d);
+    rb_child(sibling, d) = parent;
+    if (i > 1)
+      rb_child(path[i - 2], dirs[i - 2]) = sibling;
+    else
+      root = sibling;
+    return root;
+  }
+  return root;
+}
+
+ac_map_t *ac_map_persistent_first(ac_map_persistent_iter_t *it,
+                                  ac_map_t *root) {
+  it->depth = 0;
+  while (root) {
+    it->stack[it->depth++] = root;
+    root = root->left;
+  }
+  return it->depth ? it->stack[it->depth - 1] : NULL;
+}
+
+ac_map_t *ac_map_persistent_next(ac_map_persistent_iter_t *it) {
+  if (!it->depth)
+    return NULL;
+  ac_map_t *n = it->stack[--it->depth]->right;
+  while (n) {
+    it->stack[it->depth++] = n;
+    n = n->left;
+  }
+  return it->depth ? it->stack[it->depth - 1] : NULL;
+}
+
+/* order statistics */
+void ac_map_os_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root) {
+  fix_insert(node, parent, root, true);
+}
+
+bool ac_map_os_erase(ac_map_t *node, ac_map_t **root) {
+  erase(node, root, true);
+  return true;
+}
+
+ac_map_t *ac_map_nth(ac_map_t *root, size_t k) {
+  ac_map_t *n = root;
+  while (n) {
+    size_t left = rb_child_size(n->left);
+    if (k < left)
+      n = n->left;
+    else if (k == left)
+      return n;
+    else {
+      k -= left + 1;
+      n = n->right;
+    }
+  }
+  return NULL;
+}
+
+size_t ac_map_rank(ac_map_t *n) {
+  if (!n)
+    return 0;
+  size_t r = rb_child_size(n->left);
+  ac_map_t *parent = rb_parent(n);
+  while (parent) {
+    if (parent->right == n)
+      r += rb_child_size(parent->left) + 1;
+    n = parent;
+    parent = rb_parent(n);
+  }
+  return r;
+}
+
+/* chained multimaps */
+#ifdef _AC_DEBUG_MEMORY_
+void _ac_map_nodes_init(ac_map_nodes_t *h, size_t node_size,
+                        size_t nodes_per_block, const char *caller) {
+#else
+void _ac_map_nodes_init(ac_map_nodes_t *h, size_t node_size,
+                        size_t nodes_per_block) {
+#endif
+  if (!nodes_per_block)
+    nodes_per_block = 1;
+  /* the freelist rounds node_size the same way */
+  ac_pool_freelist_init(&h->nodes, NULL, node_size);
+  size_t block_size = h->nodes.object_size * nodes_per_block;
+#ifdef _AC_DEBUG_MEMORY_
+  h->nodes.pool = _ac_pool_init(block_size, caller);
+  h->payload = _ac_pool_init(1024, caller);
+#else
+  h->nodes.pool = _ac_pool_init(block_size);
+  h->payload = _ac_pool_init(1024);
+#endif
+  ac_pool_set_minimum_growth_size(h->nodes.pool, block_size);
+}
+
+void ac_map_nodes_clear(ac_map_nodes_t *h) {
+  ac_pool_freelist_clear(&h->nodes);
+  ac_pool_clear(h->nodes.pool);
+  ac_pool_clear(h->payload);
+}
+
+void ac_map_nodes_destroy(ac_map_nodes_t *h) {
+  ac_pool_destroy(h->nodes.pool);
+  ac_pool_destroy(h->payload);
+}
+
+void ac_map_replace(ac_map_t *node, ac_map_t *replacement, ac_map_t **root) {
+  replace_node_with_child(replacement, node, root);
+  replacement->left = node->left;
+  replacement->right = node->right;
+  if (node->left)
+    rb_set_parent(node->left, replacement);
+  if (node->right)
+    rb_set_parent(node->right, replacement);
+}
+
+bool ac_map_chain_erase(ac_map_chain_t *head, ac_map_chain_t *node,
+                        ac_map_t **root) {
+  if (node == head) {
+    ac_map_chain_t *next = head->next;
+    if (next) {
+      next->tail = head->tail;
+      ac_map_replace(&head->map, &next->map, root);
+    } else
+      ac_map_erase(&head->map, root);
+    return true;
+  }
+  ac_map_chain_t *prev = head;
+  while (prev->next != node) {
+    if (!prev->next)
+      return false;
+    prev = prev->next;
   }
+  prev->next = node->next;
+  if (head->tail == node)
+    head->tail = prev;
   return true;
 }
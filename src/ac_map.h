@@ -22,6 +22,7 @@ limitations under the License.
 #include "ac_common.h"
 #include "ac_pool.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -53,6 +54,53 @@ typedef ac_map_t *(*ac_map_copy_node_f)(ac_map_t *n, void *tag);
 
 ac_map_t *ac_map_copy(ac_map_t *root, ac_map_copy_node_f copy, void *tag);
 
+/*
+  ac_map_parallel_copy is like ac_map_copy except that the work is split
+  across num_threads threads (including the calling thread).  The top of the
+  tree is copied first and the subtrees below it are handed out to the
+  threads as they finish their previous subtree.  tags must have num_threads
+  entries and each thread uses its own tag (typically a pool per thread since
+  ac_pool_t isn't thread-safe).  The calling thread uses tags[0].
+*/
+ac_map_t *ac_map_parallel_copy(ac_map_t *root, ac_map_copy_node_f copy,
+                               void **tags, int num_threads);
+
+/*
+  ac_map_build_from_sorted links num nodes which are already in sorted order
+  into a balanced red-black tree in O(num) time and returns the root.  This is
+  much faster than inserting the nodes one at a time (for example after the
+  nodes have been sorted with an ac_sort_m function).  The nodes are expected
+  to be in the order that the insert compare function would place them.
+*/
+ac_map_t *ac_map_build_from_sorted(ac_map_t **nodes, size_t num);
+
+/*
+  ac_map_destroy_all hands every node of the tree rooted at root to
+  free_nodes, AC_MAP_DESTROY_BATCH nodes at a time, for maps whose nodes
+  were allocated one at a time (a pooled map is simply cleared).  The order
+  is unspecified, but a node is only passed after its children have been
+  read, so free_nodes may free (or reuse) each of them.  The walk keeps its
+  own stack and prefetches nodes several steps before it reads them, so it
+  is much faster over a large map than ac_map_postorder_next, which misses
+  the cache on nearly every node.
+
+    static void free_nodes(ac_map_t **nodes, size_t num, void *tag) {
+      for (size_t i = 0; i < num; i++)
+        ac_free(nodes[i]);
+    }
+    ...
+    ac_map_destroy_all(root, free_nodes, NULL);
+    root = NULL;
+*/
+#ifndef AC_MAP_DESTROY_BATCH
+#define AC_MAP_DESTROY_BATCH 64
+#endif
+
+typedef void (*ac_map_free_nodes_f)(ac_map_t **nodes, size_t num, void *tag);
+
+void ac_map_destroy_all(ac_map_t *root, ac_map_free_nodes_f free_nodes,
+                        void *tag);
+
 /*
   print_node_to_string_f is a callback meant to print the value of the node n.
   There is an expectation that the value will be printed on a single line.
@@ -67,6 +115,57 @@ bool ac_map_valid_to_buffer(ac_buffer_t *bh, ac_pool_t *pool, ac_map_t *root,
 bool ac_map_valid(ac_pool_t *pool, ac_map_t *root,
                   print_node_to_string_f print_node);
 
+/*
+  ac_map_validator_t checks a map a bounded number of nodes at a time, so
+  that the red-black invariants (and the parent links) of a large map can
+  be checked continuously in production.  ac_map_validate_step continues a
+  pass over the whole tree (in preorder) from where the previous call
+  stopped, and ac_map_validate_sample checks part of a random subtree.
+  Each call checks the nodes against the tree as it is at the time, so the
+  map may change between calls (the cursor is kept as the path from the
+  root rather than a node, so an erased node is never touched).
+
+  Both return false if a node breaks an invariant (and describe it in bh
+  if bh isn't NULL, pool and print_node are optional as well).  A tree
+  deeper than AC_MAP_VALIDATOR_MAX_DEPTH (which no valid red-black tree
+  of 64 bit addresses can be) is reported as broken, so a cycle doesn't
+  hang the check.
+
+    ac_map_validator_t v;
+    ac_map_validator_init(&v, seed);
+    ...
+    // on a timer
+    if (!ac_map_validate_step(&v, root, 1000, NULL, NULL, NULL))
+      report_corruption();
+*/
+#define AC_MAP_VALIDATOR_MAX_DEPTH 128
+
+typedef struct {
+  /* the directions from the root to the next node (a set bit is right) */
+  uint64_t path[AC_MAP_VALIDATOR_MAX_DEPTH / 64];
+  /* the depth of the next node, -1 to begin a new pass */
+  int depth;
+  /* the passes which have been completed */
+  size_t passes;
+  uint64_t rng;
+} ac_map_validator_t;
+
+void ac_map_validator_init(ac_map_validator_t *v, uint64_t seed);
+
+/* checks the next max_nodes nodes of the pass (a call which finishes the pass
+   stops there) */
+bool ac_map_validate_step(ac_map_validator_t *v, ac_map_t *root,
+                          size_t max_nodes, ac_buffer_t *bh, ac_pool_t *pool,
+                          print_node_to_string_f print_node);
+
+/* checks up to max_nodes nodes of a subtree found by a random descent (the
+   subtree is rooted at a random depth along it, so small subtrees are
+   checked completely) */
+bool ac_map_validate_sample(ac_map_validator_t *v, ac_map_t *root,
+                            size_t max_nodes, ac_buffer_t *bh,
+                            ac_pool_t *pool,
+                            print_node_to_string_f print_node);
+
 #define AC_MAP_DONT_PRINT_RED 1
 #define AC_MAP_DONT_PRINT_BLACK_HEIGHT 2
 
@@ -80,6 +179,308 @@ bool ac_map_erase(ac_map_t *node, ac_map_t **root);
 
 void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root);
 
+/*
+  ac_map_os_t is an order statistic variant of ac_map_t.  Each node also keeps
+  the number of nodes in its subtree, which is maintained by
+  ac_map_os_fix_insert and ac_map_os_erase (including through the rotations).
+  ac_map_os_t must be the first member of the structure (so the ac_map_t
+  pointers and the find macros work as they do for ac_map_t).  A tree must
+  only be modified through the os functions (or the ac_map_os_insert_m and
+  ac_multimap_os_insert_m macros) if ac_map_nth and ac_map_rank are used.
+*/
+typedef struct ac_map_os_s {
+  ac_map_t map;
+  size_t size;
+} ac_map_os_t;
+
+void ac_map_os_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root);
+bool ac_map_os_erase(ac_map_t *node, ac_map_t **root);
+
+/* returns the number of nodes in the tree */
+static inline size_t ac_map_os_size(ac_map_t *root) {
+  return root ? ((ac_map_os_t *)root)->size : 0;
+}
+
+/* returns the kth (starting at 0) node in order or NULL if k >= size */
+ac_map_t *ac_map_nth(ac_map_t *root, size_t k);
+
+/* returns the number of nodes before n.  The number of keys in [a,b) is the
+   rank of the lower bound of b minus the rank of the lower bound of a (where
+   a NULL lower bound has the rank ac_map_os_size(root)). */
+size_t ac_map_rank(ac_map_t *n);
+
+/*
+  ac_map_chain_t is a multimap node which keeps duplicate keys out of the
+  tree.  The first node with a given key is linked into the tree and becomes
+  the head of a chain.  Later nodes with an equal key are appended to the
+  head's chain (through next) without touching the tree, so the tree height
+  and the rebalancing only depend on the number of distinct keys.  Once the
+  head is known, an append is O(1) (ac_map_chain_append).  The chain keeps
+  the insertion order and tail is only valid in the head.  ac_map_chain_t
+  must be the first member of the structure and the tree must be modified
+  through ac_multimap_chain_insert_m and ac_map_chain_erase.  The find, least,
+  lower_bound, etc macros and ac_map_first/ac_map_next return heads, and the
+  values of a key are visited with
+
+    for (datatype *v = head; v; v = (datatype *)v->chain.next)
+*/
+typedef struct ac_map_chain_s {
+  ac_map_t map;
+  struct ac_map_chain_s *next;
+  struct ac_map_chain_s *tail;
+} ac_map_chain_t;
+
+static inline void ac_map_chain_append(ac_map_chain_t *head,
+                                       ac_map_chain_t *node) {
+  node->next = NULL;
+  head->tail->next = node;
+  head->tail = node;
+}
+
+/* returns the number of values in a chain (given its head) */
+static inline size_t ac_map_chain_count(const ac_map_chain_t *head) {
+  size_t r = 0;
+  for (; head; head = head->next)
+    r++;
+  return r;
+}
+
+/* removes node from the chain which begins with head.  If node is the head,
+   the next node in the chain takes its place in the tree (or the key is
+   erased if node was the only value).  Returns false if node isn't in the
+   chain. */
+bool ac_map_chain_erase(ac_map_chain_t *head, ac_map_chain_t *node,
+                        ac_map_t **root);
+
+/* puts replacement in the place (and color) of node, which must be in the
+   tree.  replacement must have the same key. */
+void ac_map_replace(ac_map_t *node, ac_map_t *replacement, ac_map_t **root);
+
+/*
+  ac_map_nodes_t keeps the nodes of a map apart from their variable sized
+  data.  When a node and its strings come from the same pool, the nodes are
+  spread across the blocks with the strings in between and a lookup touches
+  a new cache line at nearly every level.  The nodes (the structure which
+  begins with ac_map_t, including any fixed size key) are allocated in order
+  from a pool that holds nothing else, so they are packed densely, and
+  erased nodes are reused through an ac_pool_freelist_t.  The data that the
+  nodes point to is allocated from the payload pool (ac_map_nodes_pool).
+
+    ac_map_nodes_t nodes;
+    ac_map_nodes_init(&nodes, sizeof(name_t), 256);
+    name_t *n = (name_t *)ac_map_nodes_alloc(&nodes);
+    n->name = ac_pool_strdup(ac_map_nodes_pool(&nodes), name);
+    ...
+    if (ac_map_erase(&n->map, &root))
+      ac_map_nodes_free(&nodes, n);
+*/
+typedef struct {
+  ac_pool_freelist_t nodes;
+  ac_pool_t *payload;
+} ac_map_nodes_t;
+
+/* node_size is the size of the structure which begins with ac_map_t and the
+   nodes pool grows nodes_per_block nodes at a time */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_map_nodes_init(h, node_size, nodes_per_block)                       \
+  _ac_map_nodes_init(h, node_size, nodes_per_block,                            \
+                     AC_FILE_LINE_MACRO("ac_map_nodes"))
+void _ac_map_nodes_init(ac_map_nodes_t *h, size_t node_size,
+                        size_t nodes_per_block, const char *caller);
+#else
+#define ac_map_nodes_init(h, node_size, nodes_per_block)                       \
+  _ac_map_nodes_init(h, node_size, nodes_per_block)
+void _ac_map_nodes_init(ac_map_nodes_t *h, size_t node_size,
+                        size_t nodes_per_block);
+#endif
+
+/* returns an uninitialized node */
+static inline void *ac_map_nodes_alloc(ac_map_nodes_t *h) {
+  return ac_pool_freelist_alloc(&h->nodes);
+}
+
+/* node must have been erased from the map, it is reused by the next alloc
+   (the payload isn't freed until the pool is cleared) */
+static inline void ac_map_nodes_free(ac_map_nodes_t *h, void *node) {
+  ac_pool_freelist_free(&h->nodes, node);
+}
+
+/* the pool for the keys and values which don't fit in the nodes */
+static inline ac_pool_t *ac_map_nodes_pool(ac_map_nodes_t *h) {
+  return h->payload;
+}
+
+/* frees every node and the payload (the map's root must be reset) */
+void ac_map_nodes_clear(ac_map_nodes_t *h);
+
+void ac_map_nodes_destroy(ac_map_nodes_t *h);
+
+/*
+  ac_map_key_t is a node with an integer key stored inline, right after the
+  links.  The generic macros call compare on the user structure, which for
+  most structures means loading the key from a different cache line than
+  the links (or from the payload that the node points to) at every level.
+  Here the key and the links share 32 bytes, so a find or insert only reads
+  the nodes on the path.  ac_map_key_t must be the first member of the
+  structure (or the structure must be found with ac_parent_object) and the
+  tree must only hold ac_map_key_t nodes.  Pairing it with ac_map_nodes_t
+  keeps the nodes densely packed with the rest of the data in the payload.
+  ac_map_erase, ac_map_first, ac_map_next, etc work as usual.
+
+    typedef struct {
+      ac_map_key_t node;
+      char *name;
+    } user_t;
+
+    user_t *u = (user_t *)ac_map_key_find(id, root);
+*/
+typedef struct {
+  ac_map_t map;
+  uint64_t key;
+} ac_map_key_t;
+
+/* returns the node with key or NULL */
+static inline ac_map_key_t *ac_map_key_find(uint64_t key,
+                                            const ac_map_t *root) {
+  while (root) {
+    uint64_t k = ((const ac_map_key_t *)root)->key;
+    if (key < k)
+      root = root->left;
+    else if (key > k)
+      root = root->right;
+    else
+      return (ac_map_key_t *)root;
+  }
+  return NULL;
+}
+
+/* returns the first node whose key is >= key or NULL */
+static inline ac_map_key_t *ac_map_key_lower_bound(uint64_t key,
+                                                   const ac_map_t *root) {
+  ac_map_key_t *res = NULL;
+  while (root) {
+    if (key <= ((const ac_map_key_t *)root)->key) {
+      res = (ac_map_key_t *)root;
+      root = root->left;
+    } else
+      root = root->right;
+  }
+  return res;
+}
+
+/* returns the first node whose key is > key or NULL */
+static inline ac_map_key_t *ac_map_key_upper_bound(uint64_t key,
+                                                   const ac_map_t *root) {
+  ac_map_key_t *res = NULL;
+  while (root) {
+    if (key < ((const ac_map_key_t *)root)->key) {
+      res = (ac_map_key_t *)root;
+      root = root->left;
+    } else
+      root = root->right;
+  }
+  return res;
+}
+
+/* inserts node (with node->key set) and returns true, or returns false if
+   the key is already in the map */
+static inline bool ac_map_key_insert(ac_map_key_t *node, ac_map_t **root) {
+  ac_map_t **np = root, *parent = NULL;
+  uint64_t key = node->key;
+  while (*np) {
+    parent = *np;
+    uint64_t k = ((ac_map_key_t *)parent)->key;
+    if (key < k)
+      np = &(parent->left);
+    else if (key > k)
+      np = &(parent->right);
+    else
+      return false;
+  }
+  *np = &node->map;
+  ac_map_fix_insert(*np, parent, root);
+  return true;
+}
+
+/* inserts node, nodes with equal keys are ordered by their address (like
+   ac_multimap_insert_m) */
+static inline void ac_multimap_key_insert(ac_map_key_t *node,
+                                          ac_map_t **root) {
+  ac_map_t **np = root, *parent = NULL;
+  uint64_t key = node->key;
+  while (*np) {
+    parent = *np;
+    uint64_t k = ((ac_map_key_t *)parent)->key;
+    if (key < k || (key == k && node < (ac_map_key_t *)parent))
+      np = &(parent->left);
+    else
+      np = &(parent->right);
+  }
+  *np = &node->map;
+  ac_map_fix_insert(*np, parent, root);
+}
+
+/*
+  Persistent maps never modify a node once it is in a tree.  An insert or
+  erase copies the nodes on the path from the root (and the few siblings that
+  the rebalancing recolors or rotates) into the pool and returns a new root.
+  The old root still refers to the previous version of the map and unchanged
+  subtrees are shared, so each update costs O(log n) memory.  Readers can keep
+  using an old root without any locking while a writer builds the next
+  version (publishing the new root to other threads needs the usual release
+  and acquire ordering, such as the swap in ac_threaded_pipe).  The old
+  versions are freed when the pool is.
+
+  Because subtrees are shared, the nodes don't have valid parent pointers and
+  ac_map_next, ac_map_previous, ac_map_erase, and the other functions which
+  follow parents must not be used on a persistent map.  The find, least,
+  greatest, lower_bound, and upper_bound macros work as normal.  Iterate with
+  ac_map_persistent_first and ac_map_persistent_next.
+
+  The nodes are copied with ac_pool_dup, so the ac_map_t must be the first
+  member of the structure and the structure must be safe to copy with memcpy.
+  The persistent insert and erase functions are created with the
+  ac_map_persistent_insert_m and ac_map_persistent_erase_m macros (described
+  below).  The functions below are used by those macros (and by
+  ac_concurrent_map) and copy the nodes with the copy callback.
+*/
+
+/* more than the height of any red-black tree plus the room that erase
+   needs to extend the path */
+#define AC_MAP_MAX_HEIGHT 130
+
+/* path[0] is the root and dirs[i] is 1 if path[i+1] is the right child of
+   path[i].  If replace is true, path[depth-1] is replaced by node, otherwise
+   node becomes the child of path[depth-1] in the direction dirs[depth-1]. */
+ac_map_t *ac_map_persistent_insert(ac_map_t **path, char *dirs, int depth,
+                                   bool replace, ac_map_t *node,
+                                   ac_map_copy_node_f copy, void *tag);
+
+/* path[depth-1] is removed, path and dirs must have AC_MAP_MAX_HEIGHT
+   entries.  The removed node (and the replaced node in insert) is not
+   copied. */
+ac_map_t *ac_map_persistent_erase(ac_map_t **path, char *dirs, int depth,
+                                  ac_map_copy_node_f copy, void *tag);
+
+typedef struct {
+  ac_map_t *stack[AC_MAP_MAX_HEIGHT];
+  int depth;
+} ac_map_persistent_iter_t;
+
+ac_map_t *ac_map_persistent_first(ac_map_persistent_iter_t *it,
+                                  ac_map_t *root);
+ac_map_t *ac_map_persistent_next(ac_map_persistent_iter_t *it);
+
+/* the state of a range scan created with ac_map_scan_m (see below) */
+typedef struct {
+  ac_map_t *stack[AC_MAP_MAX_HEIGHT];
+  int depth;
+  const void *end;
+} ac_map_scan_t;
+
+/* the number of nodes the scan callback function fetches at a time */
+#define AC_MAP_SCAN_BATCH 64
+
 /*
   Finding and insertion cannot be made easily generic due to the need to access
   the key and value members of the structure.  Finding is a pretty trivial
@@ -218,6 +619,38 @@ void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root);
                                         void *arg),
                             void *arg);
 
+  The batch find macros look up num keys at once.  AC_MAP_BATCH searches are
+  advanced in turn (one level each) and the next node of each search is
+  prefetched, so the cache misses of the searches overlap instead of each
+  search waiting on its own misses.  res[i] is set to the match for keys[i]
+  (or NULL).
+
+  ac_map_find_batch_m(name, keytype, datatype, compare)
+  ac_map_find_batch2_m(name, keytype, datatype, mapname, compare)
+
+    expects: int compare(const keytype *key, const datatype *value);
+    returns: void name(const keytype *keys, size_t num, const ac_map_t *root,
+                       datatype **res);
+
+  The scan macros visit the nodes in the range [start, end) in order.  A
+  NULL start begins with the first node and a NULL end continues to the last.
+  Instead of following parent pointers (like ac_map_next), the scan keeps the
+  path in an explicit stack, so it also works on persistent maps.  name_fill
+  copies up to max nodes into res and returns the number copied (0 once the
+  range is done).  name calls cb for each node until it returns false and
+  returns the number of nodes passed to cb.
+
+  ac_map_scan_m(name, keytype, datatype, compare)
+  ac_map_scan2_m(name, keytype, datatype, mapname, compare)
+
+    expects: int compare(const keytype *key, const datatype *value);
+    returns: void name_init(ac_map_scan_t *s, const keytype *start,
+                            const keytype *end, const ac_map_t *root);
+             size_t name_fill(ac_map_scan_t *s, datatype **res, size_t max);
+             size_t name(const keytype *start, const keytype *end,
+                         const ac_map_t *root,
+                         bool (*cb)(datatype *d, void *arg), void *arg);
+
   The insert macros are listed below (they are defined in impl/ac_map.h)
 
   ac_map_insert_m(name, datatype, compare)
@@ -267,6 +700,43 @@ void ac_map_fix_insert(ac_map_t *node, ac_map_t *parent, ac_map_t **root);
     returns: datatype *name(datatype *node_to_insert,
                             ac_map_t **root,
                             void *arg);
+
+  The chained multimap insert macros are for nodes which begin with
+  ac_map_chain_t (see above).  If a node with an equal key is already in the
+  tree, node_to_insert is appended to its chain and false is returned.
+  Otherwise node_to_insert becomes the head of a new chain and true is
+  returned.
+
+  ac_multimap_chain_insert_m(name, datatype, compare)
+  ac_multimap_chain_insert_arg_m(name, datatype, compare)
+    expects: int compare( datatype *node_to_insert,  datatype *value);
+             (or with a void *arg for the _arg_ variant)
+    returns: bool name(datatype *node_to_insert, ac_map_t **root);
+             bool name(datatype *node_to_insert, ac_map_t **root, void *arg);
+
+  The persistent macros return the new root and leave root unchanged (see
+  the comments about persistent maps above).  If a node with the same key
+  exists, insert replaces it with node_to_insert.  node_to_insert must not be
+  in another map (it is linked in without being copied).  If the key isn't
+  found, erase returns root.
+
+  ac_map_persistent_insert_m(name, datatype, compare)
+    expects: int compare( datatype *node_to_insert,  datatype *value);
+    returns: ac_map_t *name(datatype *node_to_insert, ac_map_t *root,
+                            ac_pool_t *pool);
+
+  ac_map_persistent_erase_m(name, keytype, datatype, compare)
+    expects: int compare(const keytype *key, const datatype *value);
+    returns: ac_map_t *name(const keytype *key, ac_map_t *root,
+                            ac_pool_t *pool);
+
+  The order statistic insert macros work like ac_map_insert_m and
+  ac_multimap_insert_m for nodes which begin with ac_map_os_t.
+
+  ac_map_os_insert_m(name, datatype, compare)
+  ac_multimap_os_insert_m(name, datatype, compare)
+    expects: int compare( datatype *node_to_insert,  datatype *value);
+    returns: bool name(datatype *node_to_insert, ac_map_t **root);
 */
 
 #include "impl/ac_map.h"
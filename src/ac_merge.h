@@ -0,0 +1,73 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_merge_H
+#define _ac_merge_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_parallel.h"
+#include "ac_sort.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Merge macros
+  =====================================================================
+
+  The merges combine runs which are already sorted (such as chunks which
+  were sorted by separate threads) into dest, which must not overlap them.
+  They are stable, equal elements come out in the order of their runs (a
+  before b, lower run indices first).
+
+  The parallel merges split the output into pieces which are merged at the
+  same time with ac_parallel_for.  The two way merge splits the output
+  into AC_PARALLEL_CHUNK element pieces exactly with co-ranking (the merge
+  path): name_corank finds how many elements of a are among the first k
+  outputs with a binary search, so every piece knows where to start in both
+  inputs.  The k way merge sorts a sample of the runs to pick splitters,
+  finds each splitter in every run with a binary search, and merges the
+  pieces between splitters with loser trees (the pieces are only roughly
+  equal in size).  Merges of no more than AC_PARALLEL_CHUNK elements (or
+  num_threads <= 1) are done on the calling thread.
+
+  ac_merge_m(name, type, compare)
+    expects: int compare(const datatype *a, const datatype *b);
+    returns: void name(type *dest, const type *a, size_t na,
+                       const type *b, size_t nb);
+             size_t name_corank(size_t k, const type *a, size_t na,
+                                const type *b, size_t nb);
+             void name_k(type *dest, const type **runs,
+                         const size_t *lengths, size_t num_runs);
+             void name_parallel(type *dest, const type *a, size_t na,
+                                const type *b, size_t nb, int num_threads);
+             void name_k_parallel(type *dest, const type **runs,
+                                  const size_t *lengths, size_t num_runs,
+                                  int num_threads);
+
+  name_k merges with a loser tree, so each output element costs about
+  log2(num_runs) compares.
+*/
+
+#include "impl/ac_merge.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
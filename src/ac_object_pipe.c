@@ -18,18 +18,52 @@ limitations under the License.
 
 #include "ac_allocator.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+/* writes of up to PIPE_BUF bytes are atomic, so a chunk of a batch is never
+   split (or interleaved with another writer) */
+#define AC_OBJECT_PIPE_CHUNK (PIPE_BUF / sizeof(void *))
+
+typedef struct {
+  size_t seq;
+  void *object;
+} queue_cell_t;
+
 struct ac_object_pipe_s {
   uv_poll_t read_poll;
   int read_fd;
   int write_fd;
   ac_object_pipe_f cb;
+  ac_object_pipe_batch_f batch_cb;
   ac_object_pipe_close_f close_cb;
   void *cb_arg;
+
+  /* the queue transport (cells is NULL for the pipe transport).  Writers
+     claim cells with a CAS on enqueue_pos, only the loop reads.  signaled
+     coalesces the uv_async_send calls until the loop starts draining. */
+  uv_async_t async;
+  queue_cell_t *cells;
+  size_t mask;
+  char pad1[64];
+  size_t enqueue_pos;
+  char pad2[64];
+  size_t dequeue_pos;
+  int signaled;
+  /* set by ac_object_pipe_close as its last use of the pipe */
+  int close_sent;
+  char pad3[64];
+  /* writers which found the queue full wait on not_full */
+  size_t full_waiters;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_full;
 };
 
 static void setnonblock(int fd) {
@@ -46,21 +80,39 @@ static void _destroy_object_pipe(uv_handle_t *h) {
   ac_object_pipe_t *op = (ac_object_pipe_t *)(h->data);
   if (op->close_cb)
     op->close_cb(op->cb_arg);
+  if (op->cells) {
+    pthread_cond_destroy(&op->not_full);
+    pthread_mutex_destroy(&op->mutex);
+  }
   ac_free(op);
 }
 
+static void deliver(ac_object_pipe_t *h, void **objects, size_t num_objects) {
+  if (!num_objects)
+    return;
+  if (h->batch_cb) {
+    h->batch_cb(h->cb_arg, objects, num_objects);
+    return;
+  }
+  for (size_t i = 0; i < num_objects; i++)
+    h->cb(h->cb_arg, objects[i]);
+}
+
+/* every write is a multiple of sizeof(void *) and atomic, so every read is
+   too */
 static void on_poll_receive(uv_poll_t *p, int status, int events) {
   ac_object_pipe_t *h = (ac_object_pipe_t *)p->data;
-  char buffer[sizeof(void *) * 1];
-  int n;
-  while ((n = read(h->read_fd, buffer, sizeof(void *) * 1)) > 0) {
-    void **ptr = (void **)buffer;
-    void **ep = (void **)(buffer + n);
+  void *buffer[AC_OBJECT_PIPE_BATCH];
+  ssize_t n;
+  while ((n = read(h->read_fd, buffer, sizeof(buffer))) > 0) {
+    void **sp = buffer;
+    void **ptr = buffer;
+    void **ep = buffer + (n / sizeof(void *));
     while (ptr < ep) {
-      if ((ssize_t)(*ptr) != -1) {
-        h->cb(h->cb_arg, *ptr);
+      if ((ssize_t)(*ptr) != -1)
         ptr++;
-      } else {
+      else {
+        deliver(h, sp, ptr - sp);
         uv_poll_stop(p);
         close(h->read_fd);
         close(h->write_fd);
@@ -69,9 +121,139 @@ static void on_poll_receive(uv_poll_t *p, int status, int events) {
         return;
       }
     }
+    deliver(h, sp, ptr - sp);
+  }
+}
+
+static bool enqueue(ac_object_pipe_t *h, void *object) {
+  size_t pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    queue_cell_t *cell = h->cells + (pos & h->mask);
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&h->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->object = object;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0)
+      return false;
+    else
+      pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+static bool dequeue(ac_object_pipe_t *h, void **object) {
+  size_t pos = h->dequeue_pos;
+  queue_cell_t *cell = h->cells + (pos & h->mask);
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    return false;
+  *object = cell->object;
+  __atomic_store_n(&cell->seq, pos + h->mask + 1, __ATOMIC_RELEASE);
+  h->dequeue_pos = pos + 1;
+  return true;
+}
+
+static void signal_loop(ac_object_pipe_t *h) {
+  if (!__atomic_exchange_n(&h->signaled, 1, __ATOMIC_SEQ_CST))
+    uv_async_send(&h->async);
+}
+
+/* a writer counts itself in full_waiters before retrying and the loop checks
+   full_waiters after freeing cells, so the wakeup can't be missed */
+static void enqueue_wait(ac_object_pipe_t *h, void *object) {
+  if (enqueue(h, object))
+    return;
+  signal_loop(h);
+  pthread_mutex_lock(&h->mutex);
+  __atomic_add_fetch(&h->full_waiters, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (!enqueue(h, object))
+    pthread_cond_wait(&h->not_full, &h->mutex);
+  __atomic_sub_fetch(&h->full_waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&h->mutex);
+}
+
+static void on_async(uv_async_t *a) {
+  ac_object_pipe_t *h = (ac_object_pipe_t *)a->data;
+  void *buffer[AC_OBJECT_PIPE_BATCH];
+  /* objects written after this will signal again */
+  __atomic_store_n(&h->signaled, 0, __ATOMIC_SEQ_CST);
+  while (true) {
+    size_t n = 0;
+    bool closed = false;
+    while (n < AC_OBJECT_PIPE_BATCH && dequeue(h, buffer + n)) {
+      if ((ssize_t)(buffer[n]) == -1) {
+        closed = true;
+        break;
+      }
+      n++;
+    }
+    if (n) {
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&h->full_waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&h->mutex);
+        pthread_cond_broadcast(&h->not_full);
+        pthread_mutex_unlock(&h->mutex);
+      }
+    }
+    deliver(h, buffer, n);
+    if (closed) {
+      /* the closer may still be signaling */
+      while (!__atomic_load_n(&h->close_sent, __ATOMIC_ACQUIRE))
+        sched_yield();
+      uv_close((uv_handle_t *)a, _destroy_object_pipe);
+      return;
+    }
+    if (n < AC_OBJECT_PIPE_BATCH)
+      return;
   }
 }
 
+#ifdef _AC_DEBUG_MEMORY_
+ac_object_pipe_t *_ac_object_pipe_open_queue(uv_loop_t *loop,
+                                             ac_object_pipe_f cb, void *arg,
+                                             size_t size, const char *caller) {
+#else
+ac_object_pipe_t *_ac_object_pipe_open_queue(uv_loop_t *loop,
+                                             ac_object_pipe_f cb, void *arg,
+                                             size_t size) {
+#endif
+  size_t n = 2;
+  while (n < size)
+    n <<= 1;
+  size_t len = sizeof(ac_object_pipe_t) + sizeof(queue_cell_t) * n;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_object_pipe_t *h = (ac_object_pipe_t *)_ac_malloc_d(NULL, caller, len,
+                                                         false);
+#else
+  ac_object_pipe_t *h = (ac_object_pipe_t *)ac_malloc(len);
+#endif
+  h->read_fd = h->write_fd = -1;
+  h->cb = cb;
+  h->batch_cb = NULL;
+  h->cb_arg = arg;
+  h->close_cb = NULL;
+
+  h->cells = (queue_cell_t *)(h + 1);
+  for (size_t i = 0; i < n; i++)
+    h->cells[i].seq = i;
+  h->mask = n - 1;
+  h->enqueue_pos = 0;
+  h->dequeue_pos = 0;
+  h->signaled = 0;
+  h->close_sent = 0;
+  h->full_waiters = 0;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->not_full, NULL);
+
+  uv_async_init(loop, &h->async, on_async);
+  h->async.data = h;
+  return h;
+}
+
 #ifdef _AC_DEBUG_MEMORY_
 ac_object_pipe_t *_ac_object_pipe_open(uv_loop_t *loop,
                                            ac_object_pipe_f cb, void *arg,
@@ -95,8 +277,10 @@ ac_object_pipe_t *_ac_object_pipe_open(uv_loop_t *loop,
   h->read_fd = fds[0];
   h->write_fd = fds[1];
   h->cb = cb;
+  h->batch_cb = NULL;
   h->cb_arg = arg;
   h->close_cb = NULL;
+  h->cells = NULL;
 
   uv_poll_init(loop, &h->read_poll, fds[0]);
   h->read_poll.data = h;
@@ -109,11 +293,34 @@ void ac_object_pipe_set_close_cb(ac_object_pipe_t *h,
   h->close_cb = cb;
 }
 
-static void _object_pipe_write(ac_object_pipe_t *h, ssize_t object) {
+void ac_object_pipe_set_batch_cb(ac_object_pipe_t *h,
+                                 ac_object_pipe_batch_f cb) {
+  h->batch_cb = cb;
+}
+
+/* len is at most PIPE_BUF, so the write is all or nothing */
+static void _object_pipe_write_all(ac_object_pipe_t *h, const void *d,
+                                   size_t len) {
   if (h->write_fd == -1)
     abort();
-  int n = write(h->write_fd, &object, sizeof(object));
-  (void)n;
+  while (write(h->write_fd, d, len) < 0) {
+    if (errno == EAGAIN) {
+      struct pollfd pfd;
+      pfd.fd = h->write_fd;
+      pfd.events = POLLOUT;
+      poll(&pfd, 1, -1);
+    } else if (errno != EINTR)
+      return;
+  }
+}
+
+static void _object_pipe_write(ac_object_pipe_t *h, ssize_t object) {
+  if (h->cells) {
+    enqueue_wait(h, (void *)object);
+    signal_loop(h);
+    return;
+  }
+  _object_pipe_write_all(h, &object, sizeof(object));
 }
 
 void ac_object_pipe_write(ac_object_pipe_t *h, void *object) {
@@ -122,6 +329,116 @@ void ac_object_pipe_write(ac_object_pipe_t *h, void *object) {
   _object_pipe_write(h, (ssize_t)(object));
 }
 
+bool ac_object_pipe_try_write(ac_object_pipe_t *h, void *object) {
+  if ((ssize_t)(object) == -1)
+    return true;
+  if (h->cells) {
+    if (!enqueue(h, object))
+      return false;
+    signal_loop(h);
+    return true;
+  }
+  if (h->write_fd == -1)
+    abort();
+  while (write(h->write_fd, &object, sizeof(object)) < 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return true;
+}
+
+void ac_object_pipe_write_batch(ac_object_pipe_t *h, void **objects,
+                                size_t num_objects) {
+  if (h->cells) {
+    for (size_t i = 0; i < num_objects; i++) {
+      if ((ssize_t)(objects[i]) != -1)
+        enqueue_wait(h, objects[i]);
+    }
+    signal_loop(h);
+    return;
+  }
+  void *chunk[AC_OBJECT_PIPE_CHUNK];
+  size_t n = 0;
+  for (size_t i = 0; i < num_objects; i++) {
+    if ((ssize_t)(objects[i]) == -1)
+      continue;
+    chunk[n++] = objects[i];
+    if (n == AC_OBJECT_PIPE_CHUNK) {
+      _object_pipe_write_all(h, chunk, n * sizeof(void *));
+      n = 0;
+    }
+  }
+  if (n)
+    _object_pipe_write_all(h, chunk, n * sizeof(void *));
+}
+
 void ac_object_pipe_close(ac_object_pipe_t *h) {
+  /* the loop may free a pipe as soon as it reads the -1 */
+  bool queue = h->cells != NULL;
   _object_pipe_write(h, -1);
+  if (queue)
+    __atomic_store_n(&h->close_sent, 1, __ATOMIC_RELEASE);
+}
+
+struct ac_object_pipe_group_s {
+  ac_object_pipe_t **pipes;
+  size_t num_pipes;
+  size_t next;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_object_pipe_group_t *_ac_object_pipe_group_init(ac_object_pipe_t **pipes,
+                                                   size_t num_pipes,
+                                                   const char *caller) {
+  ac_object_pipe_group_t *g = (ac_object_pipe_group_t *)_ac_malloc_d(
+      NULL, caller,
+      sizeof(ac_object_pipe_group_t) + sizeof(ac_object_pipe_t *) * num_pipes,
+      false);
+#else
+ac_object_pipe_group_t *_ac_object_pipe_group_init(ac_object_pipe_t **pipes,
+                                                   size_t num_pipes) {
+  ac_object_pipe_group_t *g = (ac_object_pipe_group_t *)ac_malloc(
+      sizeof(ac_object_pipe_group_t) + sizeof(ac_object_pipe_t *) * num_pipes);
+#endif
+  if (!num_pipes)
+    abort();
+  g->pipes = (ac_object_pipe_t **)(g + 1);
+  memcpy(g->pipes, pipes, sizeof(ac_object_pipe_t *) * num_pipes);
+  g->num_pipes = num_pipes;
+  g->next = 0;
+  return g;
+}
+
+size_t ac_object_pipe_group_size(ac_object_pipe_group_t *g) {
+  return g->num_pipes;
+}
+
+ac_object_pipe_t *ac_object_pipe_group_pipe(ac_object_pipe_group_t *g,
+                                            size_t i) {
+  return g->pipes[i];
+}
+
+static ac_object_pipe_t *next_pipe(ac_object_pipe_group_t *g) {
+  size_t n = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED);
+  return g->pipes[n % g->num_pipes];
+}
+
+void ac_object_pipe_group_write(ac_object_pipe_group_t *g, void *object) {
+  ac_object_pipe_write(next_pipe(g), object);
+}
+
+void ac_object_pipe_group_write_hash(ac_object_pipe_group_t *g, uint64_t hash,
+                                     void *object) {
+  ac_object_pipe_write(g->pipes[hash % g->num_pipes], object);
+}
+
+void ac_object_pipe_group_write_batch(ac_object_pipe_group_t *g,
+                                      void **objects, size_t num_objects) {
+  ac_object_pipe_write_batch(next_pipe(g), objects, num_objects);
+}
+
+void ac_object_pipe_group_close(ac_object_pipe_group_t *g) {
+  for (size_t i = 0; i < g->num_pipes; i++)
+    ac_object_pipe_close(g->pipes[i]);
+  ac_free(g);
 }
@@ -19,6 +19,7 @@ limitations under the License.
 
 #include "ac_common.h"
 
+#include <stdint.h>
 #include <uv.h>
 
 #ifdef __cplusplus
@@ -28,6 +29,15 @@ extern "C" {
 typedef void (*ac_object_pipe_f)(void *d, void *arg);
 typedef void (*ac_object_pipe_close_f)(void *d);
 
+/* receives the objects of one read at once (in the order they were written) */
+typedef void (*ac_object_pipe_batch_f)(void *d, void **objects,
+                                       size_t num_objects);
+
+/* the number of objects read from the pipe at a time */
+#ifndef AC_OBJECT_PIPE_BATCH
+#define AC_OBJECT_PIPE_BATCH 256
+#endif
+
 struct ac_object_pipe_s;
 typedef struct ac_object_pipe_s ac_object_pipe_t;
 
@@ -42,12 +52,86 @@ ac_object_pipe_t *_ac_object_pipe_open(uv_loop_t *loop, ac_object_pipe_f cb,
                                        void *arg);
 #endif
 
+/* the queue transport puts objects on an in memory queue of size (rounded up
+   to a power of two) objects and wakes the loop with a uv_async_t, so one
+   wakeup delivers every object written since the last.  Writers wait while
+   the queue is full (see ac_object_pipe_try_write). */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_object_pipe_open_queue(loop, cb, arg, size)                         \
+  _ac_object_pipe_open_queue(loop, cb, arg, size,                              \
+                             AC_FILE_LINE_MACRO("ac_object_pipe"))
+ac_object_pipe_t *_ac_object_pipe_open_queue(uv_loop_t *loop,
+                                             ac_object_pipe_f cb, void *arg,
+                                             size_t size, const char *caller);
+#else
+#define ac_object_pipe_open_queue(loop, cb, arg, size)                         \
+  _ac_object_pipe_open_queue(loop, cb, arg, size)
+ac_object_pipe_t *_ac_object_pipe_open_queue(uv_loop_t *loop,
+                                             ac_object_pipe_f cb, void *arg,
+                                             size_t size);
+#endif
+
 void ac_object_pipe_set_close_cb(ac_object_pipe_t *h,
                                  ac_object_pipe_close_f cb);
 
+/* deliver objects to cb (instead of the cb passed to ac_object_pipe_open) */
+void ac_object_pipe_set_batch_cb(ac_object_pipe_t *h,
+                                 ac_object_pipe_batch_f cb);
+
+/* writes wait while the pipe is full, so a loop shouldn't write a large number
+   of objects to its own pipe without returning */
 void ac_object_pipe_write(ac_object_pipe_t *h, void *object);
+
+/* returns false instead of waiting if the pipe (or queue) is full */
+bool ac_object_pipe_try_write(ac_object_pipe_t *h, void *object);
+
+/* write the objects with one write per PIPE_BUF bytes (or one wakeup) */
+void ac_object_pipe_write_batch(ac_object_pipe_t *h, void **objects,
+                                size_t num_objects);
+/* every write must have returned before the pipe is closed */
 void ac_object_pipe_close(ac_object_pipe_t *h);
 
+/*
+  ac_object_pipe_group_t spreads writes over pipes opened on different loops
+  (one loop per core), either round robin or by the hash of a key so that
+  objects with the same key always reach the same loop.
+*/
+struct ac_object_pipe_group_s;
+typedef struct ac_object_pipe_group_s ac_object_pipe_group_t;
+
+/* the group takes ownership of the pipes (the array itself is copied) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_object_pipe_group_init(pipes, num_pipes)                            \
+  _ac_object_pipe_group_init(pipes, num_pipes,                                 \
+                             AC_FILE_LINE_MACRO("ac_object_pipe_group"))
+ac_object_pipe_group_t *_ac_object_pipe_group_init(ac_object_pipe_t **pipes,
+                                                   size_t num_pipes,
+                                                   const char *caller);
+#else
+#define ac_object_pipe_group_init(pipes, num_pipes)                            \
+  _ac_object_pipe_group_init(pipes, num_pipes)
+ac_object_pipe_group_t *_ac_object_pipe_group_init(ac_object_pipe_t **pipes,
+                                                   size_t num_pipes);
+#endif
+
+size_t ac_object_pipe_group_size(ac_object_pipe_group_t *g);
+ac_object_pipe_t *ac_object_pipe_group_pipe(ac_object_pipe_group_t *g,
+                                            size_t i);
+
+/* write to the next pipe (round robin) */
+void ac_object_pipe_group_write(ac_object_pipe_group_t *g, void *object);
+
+/* write to the pipe selected by hash */
+void ac_object_pipe_group_write_hash(ac_object_pipe_group_t *g, uint64_t hash,
+                                     void *object);
+
+/* write the objects to the next pipe as one batch */
+void ac_object_pipe_group_write_batch(ac_object_pipe_group_t *g,
+                                      void **objects, size_t num_objects);
+
+/* closes every pipe and frees the group */
+void ac_object_pipe_group_close(ac_object_pipe_group_t *g);
+
 #ifdef __cplusplus
 }
 #endif
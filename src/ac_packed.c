@@ -0,0 +1,159 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_packed.h"
+#include "ac_eytzinger.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the header is the magic followed by uint64_t fields (and reserved space) */
+static const char packed_magic[8] = {'A', 'C', 'P', 'A', 'C', 'K', 'D', '1'};
+#define HEADER_SIZE 64
+
+enum {
+  NUM_RECORDS = 1,
+  RECORD_SIZE,
+  BLOB_OFFSET,
+  BLOB_LENGTH,
+  FLAGS,
+  NUM_FIELDS
+};
+
+#define FLAG_EYTZINGER 1
+
+void ac_packed_save(ac_buffer_t *bh, const void *sorted, size_t num_records,
+                    size_t record_size, const void *blob, size_t blob_length,
+                    bool eytzinger) {
+  size_t records_length = num_records * record_size;
+  size_t pad = (8 - (records_length & 7)) & 7;
+  uint64_t header[HEADER_SIZE / sizeof(uint64_t)];
+  memset(header, 0, sizeof(header));
+  memcpy(header, packed_magic, sizeof(packed_magic));
+  header[NUM_RECORDS] = num_records;
+  header[RECORD_SIZE] = record_size;
+  header[BLOB_OFFSET] = HEADER_SIZE + records_length + pad;
+  header[BLOB_LENGTH] = blob_length;
+  header[FLAGS] = eytzinger ? FLAG_EYTZINGER : 0;
+  ac_buffer_append(bh, header, sizeof(header));
+  if (eytzinger && num_records) {
+    void *dest = ac_buffer_append_alloc(bh, records_length);
+    ac_eytzinger_build(dest, sorted, num_records, record_size);
+  } else
+    ac_buffer_append(bh, sorted, records_length);
+  ac_buffer_appendn(bh, 0, pad);
+  ac_buffer_append(bh, blob, blob_length);
+}
+
+void ac_packed_save_map(ac_buffer_t *bh, ac_map_t *root, size_t record_size,
+                        ac_packed_record_f fill, void *arg, bool eytzinger) {
+  ac_buffer_t *records = ac_buffer_init(record_size * 64);
+  ac_buffer_t *blob = ac_buffer_init(1024);
+  size_t num_records = 0;
+  for (ac_map_t *n = ac_map_first(root); n; n = ac_map_next(n)) {
+    void *record = ac_buffer_append_alloc(records, record_size);
+    memset(record, 0, record_size);
+    fill(record, n, blob, arg);
+    num_records++;
+  }
+  ac_packed_save(bh, ac_buffer_data(records), num_records, record_size,
+                 ac_buffer_data(blob), ac_buffer_length(blob), eytzinger);
+  ac_buffer_destroy(blob);
+  ac_buffer_destroy(records);
+}
+
+bool ac_packed_load(ac_packed_t *h, const void *data, size_t length) {
+  const char *p = (const char *)data;
+  uint64_t header[NUM_FIELDS];
+  if (length < HEADER_SIZE || memcmp(p, packed_magic, sizeof(packed_magic)))
+    return false;
+  memcpy(header, p, sizeof(header));
+  uint64_t num_records = header[NUM_RECORDS];
+  uint64_t record_size = header[RECORD_SIZE];
+  uint64_t blob_offset = header[BLOB_OFFSET];
+  uint64_t blob_length = header[BLOB_LENGTH];
+  if (!record_size || num_records > (length - HEADER_SIZE) / record_size ||
+      blob_offset < HEADER_SIZE + num_records * record_size ||
+      blob_offset > length || blob_length > length - blob_offset)
+    return false;
+  h->records = p + HEADER_SIZE;
+  h->num_records = num_records;
+  h->record_size = record_size;
+  h->blob = p + blob_offset;
+  h->blob_length = blob_length;
+  h->eytzinger = (header[FLAGS] & FLAG_EYTZINGER) != 0;
+  h->map = NULL;
+  h->map_length = 0;
+  return true;
+}
+
+bool ac_packed_map_file(ac_packed_t *h, const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= HEADER_SIZE)
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  if (!ac_packed_load(h, p, st.st_size)) {
+    munmap(p, st.st_size);
+    return false;
+  }
+  madvise(p, st.st_size, MADV_WILLNEED);
+  h->map = p;
+  h->map_length = st.st_size;
+  return true;
+}
+
+void ac_packed_close(ac_packed_t *h) {
+  if (h->map)
+    munmap(h->map, h->map_length);
+  h->map = NULL;
+  h->map_length = 0;
+  h->records = NULL;
+  h->num_records = 0;
+  h->blob = NULL;
+  h->blob_length = 0;
+}
+
+bool ac_packed_write_file(ac_buffer_t *bh, const char *filename) {
+  ac_buffer_inline_t space;
+  ac_buffer_t *tmp = ac_buffer_init_inline(&space);
+  ac_buffer_setf(tmp, "%s.%d.tmp", filename, (int)getpid());
+  const char *tmp_name = ac_buffer_data(tmp);
+  bool ok = false;
+  FILE *out = fopen(tmp_name, "wb");
+  if (out) {
+    size_t length = ac_buffer_length(bh);
+    ok = fwrite(ac_buffer_data(bh), 1, length, out) == length;
+    if (fclose(out))
+      ok = false;
+    if (ok)
+      ok = rename(tmp_name, filename) == 0;
+    if (!ok)
+      remove(tmp_name);
+  }
+  ac_buffer_destroy(tmp);
+  return ok;
+}
@@ -0,0 +1,120 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_packed_H
+#define _ac_packed_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+#include "ac_map.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_packed stores a sorted array of fixed size records (and the variable
+  length data they refer to) in a form which can be written to a file and
+  mapped back in without parsing or copying it.  A large index which would
+  take minutes to rebuild from text (as demo5 does with names.txt) is
+  searchable as soon as the file is mapped.
+
+  Records can't contain pointers.  Strings and other variable length data
+  are appended to a blob with ac_packed_blob_append, and the record keeps
+  the offset that it returns.  ac_packed_string turns an offset back into a
+  pointer.
+
+  The saved form is a 64 byte header followed by the records and then by
+  the blob (in the byte order of the machine).  The records start at offset
+  64 and the blob at a multiple of 8, so both are aligned if the data is
+  (mapped files are page aligned).  The records are either in sorted order,
+  so that the functions created by ac_search_m work on them directly, or in
+  the Eytzinger layout for the ac_eytzinger_*_m functions (see
+  ac_eytzinger.h).  For example,
+
+    ac_search_m(find_name, const char, name_t, compare_name)
+
+    ac_packed_t p;
+    if (ac_packed_map_file(&p, "names.idx")) {
+      name_t *r = find_name(key, (name_t *)p.records, p.num_records);
+      ...
+      ac_packed_close(&p);
+    }
+*/
+typedef struct {
+  const void *records;
+  size_t num_records;
+  size_t record_size;
+  const char *blob;
+  size_t blob_length;
+  /* the records are in the Eytzinger layout instead of sorted */
+  bool eytzinger;
+
+  /* set by ac_packed_map_file */
+  void *map;
+  size_t map_length;
+} ac_packed_t;
+
+/* appends num_records records of record_size bytes (in sorted order) and
+   the blob to bh.  If eytzinger is true, the records are saved in the
+   Eytzinger layout. */
+void ac_packed_save(ac_buffer_t *bh, const void *sorted, size_t num_records,
+                    size_t record_size, const void *blob, size_t blob_length,
+                    bool eytzinger);
+
+/* fills record (record_size bytes) from node, appending any variable length
+   data to blob */
+typedef void (*ac_packed_record_f)(void *record, ac_map_t *node,
+                                   ac_buffer_t *blob, void *arg);
+
+/* like ac_packed_save with one record for every node of the map (in the
+   order of the map) */
+void ac_packed_save_map(ac_buffer_t *bh, ac_map_t *root, size_t record_size,
+                        ac_packed_record_f fill, void *arg, bool eytzinger);
+
+/* appends data and a zero terminator to blob and returns the offset to
+   store in a record */
+static inline uint64_t ac_packed_blob_append(ac_buffer_t *blob,
+                                             const void *data, size_t length);
+
+/* the data at offset in the blob */
+static inline const char *ac_packed_string(const ac_packed_t *h,
+                                           uint64_t offset);
+
+/* fills h from data saved with ac_packed_save (which must outlive h).
+   Returns false if the data isn't valid. */
+bool ac_packed_load(ac_packed_t *h, const void *data, size_t length);
+
+/* maps filename read only and loads it, returns false if the file can't be
+   mapped or isn't valid */
+bool ac_packed_map_file(ac_packed_t *h, const char *filename);
+
+/* unmaps a file mapped with ac_packed_map_file */
+void ac_packed_close(ac_packed_t *h);
+
+/* writes bh to filename (through a temporary file which is renamed, so a
+   reader never maps a partial file).  Returns false on an error. */
+bool ac_packed_write_file(ac_buffer_t *bh, const char *filename);
+
+#include "impl/ac_packed.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct {
+  size_t num_elements;
+  size_t chunk_size;
+  size_t num_chunks;
+  /* the next chunk to take */
+  size_t next;
+  ac_parallel_f work;
+  void *arg;
+} parallel_t;
+
+static void *parallel_worker(void *arg) {
+  parallel_t *h = (parallel_t *)arg;
+  size_t chunk;
+  while ((chunk = __atomic_fetch_add(&h->next, 1, __ATOMIC_RELAXED)) <
+         h->num_chunks) {
+    size_t start = chunk * h->chunk_size;
+    size_t end = start + h->chunk_size;
+    if (end > h->num_elements)
+      end = h->num_elements;
+    h->work(h->arg, chunk, start, end);
+  }
+  return NULL;
+}
+
+void ac_parallel_for(size_t num_elements, size_t chunk_size, int num_threads,
+                     ac_parallel_f work, void *arg) {
+  if (chunk_size == 0)
+    abort();
+  parallel_t h;
+  h.num_elements = num_elements;
+  h.chunk_size = chunk_size;
+  h.num_chunks = ac_parallel_chunks(num_elements, chunk_size);
+  h.next = 0;
+  h.work = work;
+  h.arg = arg;
+  if (num_threads < 1)
+    num_threads = 1;
+  if ((size_t)num_threads > h.num_chunks)
+    num_threads = (int)h.num_chunks;
+  if (num_threads <= 1) {
+    parallel_worker(&h);
+    return;
+  }
+
+  pthread_t *threads =
+      (pthread_t *)ac_malloc(sizeof(pthread_t) * num_threads);
+  if (!threads)
+    abort();
+  for (int i = 1; i < num_threads; i++)
+    if (pthread_create(threads + i, NULL, parallel_worker, &h))
+      abort();
+  parallel_worker(&h);
+  for (int i = 1; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+  ac_free(threads);
+}
@@ -0,0 +1,97 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_parallel_H
+#define _ac_parallel_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Data parallel macros
+  =====================================================================
+
+  These split an array into chunks of AC_PARALLEL_CHUNK elements which a
+  group of threads take in turn (a thread which finishes early takes the
+  next chunk, so uneven chunks balance out).  The calling thread is one of
+  the num_threads threads, and arrays which are no larger than one chunk
+  (or num_threads <= 1) are done on the calling thread without starting any
+  threads.  The inner loops are plain loops over a chunk so that the
+  compiler can vectorize them.
+
+  ac_reduce_m(name, type, identity, combine)
+    expects: type combine(type a, type b); which is associative (the chunks
+             are combined in order, so it doesn't need to be commutative)
+    returns: type name(const type *base, size_t num_elements,
+                       int num_threads);
+
+  ac_scan_m(name, type, identity, combine)
+    expects: type combine(type a, type b); which is associative
+    returns: void name(type *dest, const type *base, size_t num_elements,
+                       int num_threads);
+               dest[i] = base[0] + ... + base[i]  (inclusive)
+             void name_exclusive(type *dest, const type *base,
+                                 size_t num_elements, int num_threads);
+               dest[i] = identity + base[0] + ... + base[i-1]
+    dest may be base.  The chunks are reduced in parallel, the chunk totals
+    are scanned, and then the chunks are scanned in parallel from their
+    offsets (so base is read twice).
+
+  ac_for_each_parallel_m(name, type, fn)
+    expects: void fn(type *el, void *arg);
+    returns: void name(type *base, size_t num_elements, void *arg,
+                       int num_threads);
+
+  ac_partition_parallel_m(name, type, pred)
+    expects: bool pred(const type *el, void *arg);
+    returns: size_t name(type *base, size_t num_elements, void *arg,
+                         int num_threads);
+    moves the elements for which pred is true to the front (and returns how
+    many there are).  Both sides keep their order.  The chunks are counted
+    in parallel and then copied in parallel through a temporary array.
+*/
+
+#ifndef AC_PARALLEL_CHUNK
+#define AC_PARALLEL_CHUNK 65536
+#endif
+
+/* called for each chunk [start, end) of the array, chunk is the index of
+   the chunk (start / chunk_size) */
+typedef void (*ac_parallel_f)(void *arg, size_t chunk, size_t start,
+                              size_t end);
+
+/* runs work over [0, num_elements) in chunks of chunk_size on num_threads
+   threads (this is what the macros call) */
+void ac_parallel_for(size_t num_elements, size_t chunk_size, int num_threads,
+                     ac_parallel_f work, void *arg);
+
+/* the number of chunks ac_parallel_for splits num_elements into */
+static inline size_t ac_parallel_chunks(size_t num_elements,
+                                        size_t chunk_size) {
+  return (num_elements + chunk_size - 1) / chunk_size;
+}
+
+#include "impl/ac_parallel.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
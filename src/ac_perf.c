@@ -0,0 +1,216 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_perf.h"
+#include "ac_allocator.h"
+
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define NUM_COUNTERS 4
+
+/* the counters in the order of ac_perf_counts_t */
+enum { cycles, instructions, cache_misses, branch_misses };
+
+typedef struct {
+  int fd; /* the leader */
+  /* the counters in the group in the order they were opened */
+  int counters[NUM_COUNTERS];
+  int num_counters;
+  /* the values when the region started: enabled, running, counters... */
+  uint64_t start[2 + NUM_COUNTERS];
+  double enabled;
+  double running;
+} group_t;
+
+struct ac_perf_s {
+  group_t groups[2];
+  int num_groups;
+  int fds[NUM_COUNTERS];
+  double totals[NUM_COUNTERS];
+};
+
+#ifdef __linux__
+static const uint64_t configs[NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+static int open_counter(int counter, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = configs[counter];
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+
+/* reads nr, enabled, running, and the counters of the group into values
+   (without nr) */
+static bool read_group(group_t *g, uint64_t *values) {
+  uint64_t buf[3 + NUM_COUNTERS];
+  size_t len = sizeof(uint64_t) * (3 + g->num_counters);
+  if (read(g->fd, buf, len) != (ssize_t)len)
+    return false;
+  memcpy(values, buf + 1, sizeof(uint64_t) * (2 + g->num_counters));
+  return true;
+}
+#endif
+
+static void close_counters(ac_perf_t *h) {
+#ifdef __linux__
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    if (h->fds[i] != -1)
+      close(h->fds[i]);
+#endif
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    h->fds[i] = -1;
+  h->num_groups = 0;
+}
+
+#ifdef __linux__
+/* opens the counters from first to last as a group, returns false if
+   any of them can't be opened */
+static bool open_group(ac_perf_t *h, int first, int last) {
+  group_t *g = h->groups + h->num_groups;
+  g->fd = -1;
+  g->num_counters = 0;
+  for (int i = first; i <= last; i++) {
+    int fd = open_counter(i, g->fd);
+    if (fd == -1)
+      return false;
+    h->fds[i] = fd;
+    if (g->fd == -1)
+      g->fd = fd;
+    g->counters[g->num_counters++] = i;
+  }
+  h->num_groups++;
+  ioctl(g->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+/* a group which the cpu can't schedule opens, but it never runs */
+static bool groups_run(ac_perf_t *h) {
+  uint64_t values[2 + NUM_COUNTERS];
+  volatile uint64_t x = 0;
+  for (int i = 0; i < 100000; i++)
+    x += i;
+  for (int i = 0; i < h->num_groups; i++)
+    if (!read_group(h->groups + i, values) || values[1] == 0)
+      return false;
+  return true;
+}
+#endif
+
+static void open_counters(ac_perf_t *h) {
+#ifdef __linux__
+  if (open_group(h, cycles, branch_misses) && groups_run(h))
+    return;
+  close_counters(h);
+  if (open_group(h, cycles, instructions) &&
+      open_group(h, cache_misses, branch_misses) && groups_run(h))
+    return;
+  close_counters(h);
+#endif
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_perf_t *_ac_perf_init(const char *caller) {
+  ac_perf_t *h =
+      (ac_perf_t *)_ac_malloc_d(NULL, caller, sizeof(ac_perf_t), false);
+#else
+ac_perf_t *_ac_perf_init(void) {
+  ac_perf_t *h = (ac_perf_t *)ac_malloc(sizeof(ac_perf_t));
+#endif
+  memset(h, 0, sizeof(*h));
+  close_counters(h);
+  open_counters(h);
+  return h;
+}
+
+void ac_perf_destroy(ac_perf_t *h) {
+  close_counters(h);
+  ac_free(h);
+}
+
+bool ac_perf_available(ac_perf_t *h) { return h->num_groups > 0; }
+
+void ac_perf_start(ac_perf_t *h) {
+#ifdef __linux__
+  for (int i = 0; i < h->num_groups; i++)
+    read_group(h->groups + i, h->groups[i].start);
+#endif
+}
+
+/* each group's counts are scaled by enabled / running for the region, which
+   is 1 unless the group was multiplexed */
+void ac_perf_stop(ac_perf_t *h) {
+#ifdef __linux__
+  uint64_t values[2 + NUM_COUNTERS];
+  for (int i = 0; i < h->num_groups; i++) {
+    group_t *g = h->groups + i;
+    if (!read_group(g, values))
+      continue;
+    uint64_t enabled = values[0] - g->start[0];
+    uint64_t running = values[1] - g->start[1];
+    g->enabled += enabled;
+    g->running += running;
+    if (!running)
+      continue;
+    double scale = (double)enabled / running;
+    for (int j = 0; j < g->num_counters; j++)
+      h->totals[g->counters[j]] += (values[2 + j] - g->start[2 + j]) * scale;
+  }
+#endif
+}
+
+void ac_perf_reset(ac_perf_t *h) {
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    h->totals[i] = 0.0;
+  for (int i = 0; i < h->num_groups; i++)
+    h->groups[i].enabled = h->groups[i].running = 0.0;
+}
+
+bool ac_perf_counts(ac_perf_t *h, ac_perf_counts_t *counts) {
+  memset(counts, 0, sizeof(*counts));
+  if (!h->num_groups)
+    return false;
+  counts->cycles = (uint64_t)h->totals[cycles];
+  counts->instructions = (uint64_t)h->totals[instructions];
+  counts->cache_misses = (uint64_t)h->totals[cache_misses];
+  counts->branch_misses = (uint64_t)h->totals[branch_misses];
+  if (counts->cycles)
+    counts->ipc = h->totals[instructions] / h->totals[cycles];
+  counts->running = 1.0;
+  for (int i = 0; i < h->num_groups; i++) {
+    group_t *g = h->groups + i;
+    if (g->enabled > 0.0 && g->running / g->enabled < counts->running)
+      counts->running = g->running / g->enabled;
+  }
+  return true;
+}
@@ -0,0 +1,97 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_perf_H
+#define _ac_perf_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_perf counts cycles, instructions, cache misses, and branch misses with
+  the hardware performance counters (perf_event_open on linux) so that a
+  change in time can be explained by what the cpu did.  Like ac_timer, the
+  counts of every start/stop pair are added together.
+
+    ac_perf_t *p = ac_perf_init();
+    ac_perf_start(p);
+    ... work ...
+    ac_perf_stop(p);
+    ac_perf_counts_t c;
+    if (ac_perf_counts(p, &c))
+      printf("%.2f ipc\n", c.ipc);
+    ac_perf_destroy(p);
+
+  The four counters are opened as one group so that they count exactly the
+  same instructions.  If the cpu can't schedule all of them at once, they
+  are opened as two groups (cycles and instructions, and the misses) and
+  the kernel multiplexes them.  The counts are then scaled by the time each
+  group actually counted, and running is less than 1.
+
+  The counters are often unavailable (in a virtual machine, on another OS,
+  or when perf_event_paranoid forbids them), in which case ac_perf_counts
+  returns false and everything else does nothing.  Counting is limited to
+  the calling thread (and user space, so paranoid level 2 is enough).
+*/
+struct ac_perf_s;
+typedef struct ac_perf_s ac_perf_t;
+
+typedef struct {
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t cache_misses;
+  uint64_t branch_misses;
+  /* instructions per cycle */
+  double ipc;
+  /* the fraction of the time the counters were counting (1 unless they
+     were multiplexed) */
+  double running;
+} ac_perf_counts_t;
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_perf_init() _ac_perf_init(AC_FILE_LINE_MACRO("ac_perf"))
+ac_perf_t *_ac_perf_init(const char *caller);
+#else
+#define ac_perf_init() _ac_perf_init()
+ac_perf_t *_ac_perf_init(void);
+#endif
+
+void ac_perf_destroy(ac_perf_t *h);
+
+/* true if the counters could be opened */
+bool ac_perf_available(ac_perf_t *h);
+
+void ac_perf_start(ac_perf_t *h);
+void ac_perf_stop(ac_perf_t *h);
+
+/* clear the counts */
+void ac_perf_reset(ac_perf_t *h);
+
+/* the counts of the regions between every start and stop, returns false
+   (and zeros counts) if the counters aren't available */
+bool ac_perf_counts(ac_perf_t *h, ac_perf_counts_t *counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_pipeline.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* A thread which finds nothing to do sleeps on the cond after counting
+   itself in waiting and trying once more.  Whoever makes work checks waiting
+   after publishing it (the fences order the two) and only then takes the
+   mutex to signal, so nothing is lost and there is no system call while the
+   threads are busy. */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int waiting;
+} waiter_t;
+
+static void waiter_init(waiter_t *w) {
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  w->waiting = 0;
+}
+
+static void waiter_destroy(waiter_t *w) {
+  pthread_mutex_destroy(&w->mutex);
+  pthread_cond_destroy(&w->cond);
+}
+
+static void waiter_wake(waiter_t *w) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->waiting, __ATOMIC_RELAXED) == 0)
+    return;
+  pthread_mutex_lock(&w->mutex);
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+}
+
+typedef struct {
+  ac_pipeline_t *h;
+  ac_pipeline_stage_f fn;
+  void *arg;
+  int num_threads;
+  bool ordered;
+
+  /* the items waiting for this stage */
+  ac_queue_mpmc_t queue;
+  waiter_t waiter;
+  bool closed;
+  int running;
+
+  /* ordered stages put items in pending[seq % num_items] until it is their
+     turn.  Fewer than num_items items are in flight, so they can't
+     collide. */
+  ac_pipeline_item_t **pending;
+  uint64_t next_seq;
+
+  pthread_t *threads;
+} stage_t;
+
+struct ac_pipeline_s {
+  ac_pipeline_source_f source;
+  void *source_arg;
+
+  ac_pipeline_item_t *items;
+  size_t num_items;
+  ac_stack_t free_items;
+  waiter_t free_waiter;
+  uint64_t count;
+
+  stage_t stages[AC_PIPELINE_MAX_STAGES];
+  int num_stages;
+#ifdef _AC_DEBUG_MEMORY_
+  const char *caller;
+#endif
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_pipeline_t *_ac_pipeline_init(size_t num_items, size_t buffer_size,
+                                 const char *caller) {
+  ac_pipeline_t *h = (ac_pipeline_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_pipeline_t), false);
+  h->caller = caller;
+#else
+ac_pipeline_t *_ac_pipeline_init(size_t num_items, size_t buffer_size) {
+  ac_pipeline_t *h = (ac_pipeline_t *)ac_calloc(sizeof(ac_pipeline_t));
+#endif
+  if (!h || num_items == 0)
+    abort();
+  h->num_items = num_items;
+  h->items =
+      (ac_pipeline_item_t *)ac_calloc(sizeof(ac_pipeline_item_t) * num_items);
+  ac_stack_init(&h->free_items);
+  for (size_t i = 0; i < num_items; i++) {
+    h->items[i].bh = ac_buffer_init(buffer_size);
+    h->items[i].block_size = buffer_size;
+    ac_stack_push(&h->free_items, &h->items[i].node);
+  }
+  waiter_init(&h->free_waiter);
+  return h;
+}
+
+void ac_pipeline_source(ac_pipeline_t *h, ac_pipeline_source_f source,
+                        void *arg) {
+  h->source = source;
+  h->source_arg = arg;
+}
+
+static void add_stage(ac_pipeline_t *h, ac_pipeline_stage_f fn, void *arg,
+                      int num_threads, bool ordered) {
+  if (h->num_stages == AC_PIPELINE_MAX_STAGES || num_threads < 1)
+    abort();
+  stage_t *s = h->stages + h->num_stages++;
+  s->h = h;
+  s->fn = fn;
+  s->arg = arg;
+  s->num_threads = num_threads;
+  s->ordered = ordered;
+  /* the ring holds every item, so a push never fails */
+  ac_queue_mpmc_init(&s->queue, h->num_items);
+  waiter_init(&s->waiter);
+  if (ordered)
+    s->pending = (ac_pipeline_item_t **)ac_calloc(sizeof(ac_pipeline_item_t *) *
+                                                  h->num_items);
+  s->threads = (pthread_t *)ac_malloc(sizeof(pthread_t) * num_threads);
+}
+
+void ac_pipeline_stage(ac_pipeline_t *h, ac_pipeline_stage_f stage, void *arg,
+                       int num_threads) {
+  add_stage(h, stage, arg, num_threads, false);
+}
+
+void ac_pipeline_ordered_stage(ac_pipeline_t *h, ac_pipeline_stage_f stage,
+                               void *arg) {
+  add_stage(h, stage, arg, 1, true);
+}
+
+static void recycle(ac_pipeline_t *h, ac_pipeline_item_t *item) {
+  ac_stack_push(&h->free_items, &item->node);
+  waiter_wake(&h->free_waiter);
+}
+
+/* passes the item to stage (or back to the free items after the last
+   stage) */
+static void forward(ac_pipeline_t *h, int stage, ac_pipeline_item_t *item) {
+  if (stage == h->num_stages) {
+    recycle(h, item);
+    return;
+  }
+  stage_t *s = h->stages + stage;
+  if (!ac_queue_mpmc_push(&s->queue, item))
+    abort();
+  waiter_wake(&s->waiter);
+}
+
+static ac_pipeline_item_t *take(stage_t *s) {
+  ac_pipeline_item_t *item = (ac_pipeline_item_t *)ac_queue_mpmc_pop(&s->queue);
+  if (item)
+    return item;
+  waiter_t *w = &s->waiter;
+  pthread_mutex_lock(&w->mutex);
+  __atomic_add_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+  while (true) {
+    item = (ac_pipeline_item_t *)ac_queue_mpmc_pop(&s->queue);
+    if (item || __atomic_load_n(&s->closed, __ATOMIC_ACQUIRE))
+      break;
+    pthread_cond_wait(&w->cond, &w->mutex);
+  }
+  __atomic_sub_fetch(&w->waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&w->mutex);
+  /* closed is only set once the stage before is done, so an empty ring is
+     final */
+  if (!item)
+    item = (ac_pipeline_item_t *)ac_queue_mpmc_pop(&s->queue);
+  return item;
+}
+
+static ac_pipeline_item_t *take_ordered(stage_t *s) {
+  size_t num_items = s->h->num_items;
+  ac_pipeline_item_t **slot = s->pending + (s->next_seq % num_items);
+  while (!*slot) {
+    ac_pipeline_item_t *item = take(s);
+    if (!item)
+      return NULL;
+    s->pending[item->seq % num_items] = item;
+  }
+  ac_pipeline_item_t *item = *slot;
+  *slot = NULL;
+  s->next_seq++;
+  return item;
+}
+
+/* no more items will be forwarded to the stage */
+static void close_stage(stage_t *s) {
+  __atomic_store_n(&s->closed, true, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&s->waiter.mutex);
+  pthread_cond_broadcast(&s->waiter.cond);
+  pthread_mutex_unlock(&s->waiter.mutex);
+}
+
+static void *run_stage(void *arg) {
+  stage_t *s = (stage_t *)arg;
+  ac_pipeline_t *h = s->h;
+  int next = (int)(s - h->stages) + 1;
+  ac_pipeline_item_t *item;
+  while ((item = s->ordered ? take_ordered(s) : take(s)) != NULL) {
+    if (!item->dropped && !s->fn(s->arg, item))
+      item->dropped = true;
+    forward(h, next, item);
+  }
+  /* the last thread out closes the next stage */
+  if (__atomic_sub_fetch(&s->running, 1, __ATOMIC_ACQ_REL) == 0 &&
+      next < h->num_stages)
+    close_stage(h->stages + next);
+  return NULL;
+}
+
+static ac_pipeline_item_t *take_free(ac_pipeline_t *h) {
+  ac_stack_node_t *n = ac_stack_pop(&h->free_items);
+  if (!n) {
+    waiter_t *w = &h->free_waiter;
+    pthread_mutex_lock(&w->mutex);
+    __atomic_add_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+    while ((n = ac_stack_pop(&h->free_items)) == NULL)
+      pthread_cond_wait(&w->cond, &w->mutex);
+    __atomic_sub_fetch(&w->waiting, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->mutex);
+  }
+  return ac_parent_object(n, ac_pipeline_item_t, node);
+}
+
+void ac_pipeline_run(ac_pipeline_t *h) {
+  if (!h->source)
+    abort();
+  for (int i = 0; i < h->num_stages; i++) {
+    stage_t *s = h->stages + i;
+    s->closed = false;
+    s->running = s->num_threads;
+    s->next_seq = 0;
+    for (int j = 0; j < s->num_threads; j++)
+      if (pthread_create(s->threads + j, NULL, run_stage, s))
+        abort();
+  }
+
+  h->count = 0;
+  while (true) {
+    ac_pipeline_item_t *item = take_free(h);
+    ac_buffer_clear(item->bh);
+    item->seq = h->count;
+    item->data = NULL;
+    item->dropped = false;
+    if (!h->source(h->source_arg, item)) {
+      recycle(h, item);
+      break;
+    }
+    h->count++;
+    forward(h, 0, item);
+  }
+
+  if (h->num_stages)
+    close_stage(h->stages);
+  for (int i = 0; i < h->num_stages; i++) {
+    stage_t *s = h->stages + i;
+    for (int j = 0; j < s->num_threads; j++)
+      pthread_join(s->threads[j], NULL);
+  }
+}
+
+uint64_t ac_pipeline_count(ac_pipeline_t *h) { return h->count; }
+
+void ac_pipeline_destroy(ac_pipeline_t *h) {
+  for (int i = 0; i < h->num_stages; i++) {
+    stage_t *s = h->stages + i;
+    ac_queue_mpmc_destroy(&s->queue);
+    waiter_destroy(&s->waiter);
+    if (s->pending)
+      ac_free(s->pending);
+    ac_free(s->threads);
+  }
+  for (size_t i = 0; i < h->num_items; i++)
+    ac_buffer_destroy(h->items[i].bh);
+  ac_free(h->items);
+  waiter_destroy(&h->free_waiter);
+  ac_free(h);
+}
+
+bool ac_pipeline_read_blocks(void *arg, ac_pipeline_item_t *item) {
+  FILE *in = (FILE *)arg;
+  char *p = (char *)ac_buffer_resize(item->bh, item->block_size);
+  size_t n = fread(p, 1, item->block_size, in);
+  ac_buffer_resize(item->bh, n);
+  return n > 0;
+}
+
+bool ac_pipeline_read_lines(void *arg, ac_pipeline_item_t *item) {
+  FILE *in = (FILE *)arg;
+  if (!ac_pipeline_read_blocks(arg, item))
+    return false;
+  ac_buffer_t *bh = item->bh;
+  if (ac_buffer_data(bh)[ac_buffer_length(bh) - 1] == '\n')
+    return true;
+  int ch;
+  while ((ch = getc_unlocked(in)) != EOF) {
+    ac_buffer_appendc(bh, (char)ch);
+    if (ch == '\n')
+      break;
+  }
+  return true;
+}
+
+bool ac_pipeline_write(void *arg, ac_pipeline_item_t *item) {
+  FILE *out = (FILE *)arg;
+  fwrite(ac_buffer_data(item->bh), 1, ac_buffer_length(item->bh), out);
+  return true;
+}
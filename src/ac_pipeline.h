@@ -0,0 +1,126 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_pipeline_H
+#define _ac_pipeline_H
+
+#include "ac_buffer.h"
+#include "ac_common.h"
+#include "ac_queue.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_pipeline_t runs a source (such as a reader of a large file) on the
+  calling thread and passes each item it fills through a series of stages,
+  each with its own threads, like uvdemo1 does by hand with an
+  ac_threaded_pipe and an ac_object_pipe.
+
+  A fixed number of items (each with an ac_buffer_t) is allocated up front
+  and recycled through a lock-free stack (ac_stack_t) once the last stage is
+  done with an item.  That bounds the memory and gives backpressure: when
+  every item is in use, the source waits until the slowest stage frees one.
+  Stages are connected by lock-free rings (ac_queue_mpmc_t) which can hold
+  every item, so passing an item on never waits.  Threads only sleep (and
+  writers only make the system call to wake them) when there is nothing to
+  do.
+
+  Items are numbered in the order the source fills them.  An ordered stage
+  has one thread and sees the items in that order, so a stage which
+  transforms blocks in parallel can be followed by an ordered stage which
+  writes the results.  A stage drops an item by returning false, later
+  stages don't see it (but it keeps its place in the order).
+*/
+struct ac_pipeline_s;
+typedef struct ac_pipeline_s ac_pipeline_t;
+
+typedef struct {
+  ac_stack_node_t node;
+  ac_buffer_t *bh;
+  /* the order in which the source filled the item */
+  uint64_t seq;
+  /* the buffer size given to ac_pipeline_init */
+  size_t block_size;
+  /* for the stages to use as they like */
+  void *data;
+  bool dropped;
+} ac_pipeline_item_t;
+
+/* fills item->bh (which is cleared) and returns true, or returns false at
+   the end of the input */
+typedef bool (*ac_pipeline_source_f)(void *arg, ac_pipeline_item_t *item);
+
+/* returns false to drop the item */
+typedef bool (*ac_pipeline_stage_f)(void *arg, ac_pipeline_item_t *item);
+
+#ifndef AC_PIPELINE_MAX_STAGES
+#define AC_PIPELINE_MAX_STAGES 16
+#endif
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_pipeline_init(num_items, buffer_size)                               \
+  _ac_pipeline_init(num_items, buffer_size,                                    \
+                    AC_FILE_LINE_MACRO("ac_pipeline"))
+ac_pipeline_t *_ac_pipeline_init(size_t num_items, size_t buffer_size,
+                                 const char *caller);
+#else
+#define ac_pipeline_init(num_items, buffer_size)                               \
+  _ac_pipeline_init(num_items, buffer_size)
+ac_pipeline_t *_ac_pipeline_init(size_t num_items, size_t buffer_size);
+#endif
+
+void ac_pipeline_source(ac_pipeline_t *h, ac_pipeline_source_f source,
+                        void *arg);
+
+/* adds a stage which runs on num_threads threads */
+void ac_pipeline_stage(ac_pipeline_t *h, ac_pipeline_stage_f stage, void *arg,
+                       int num_threads);
+
+/* adds a stage which runs on one thread and sees the items in the order the
+   source filled them */
+void ac_pipeline_ordered_stage(ac_pipeline_t *h, ac_pipeline_stage_f stage,
+                               void *arg);
+
+/* starts the stages, runs the source on the calling thread until it returns
+   false, and returns once every item has passed through every stage.  A
+   pipeline can be run more than once. */
+void ac_pipeline_run(ac_pipeline_t *h);
+
+/* the number of items the source filled in the last run */
+uint64_t ac_pipeline_count(ac_pipeline_t *h);
+
+void ac_pipeline_destroy(ac_pipeline_t *h);
+
+/* a source which reads blocks of block_size bytes from a FILE * (arg) */
+bool ac_pipeline_read_blocks(void *arg, ac_pipeline_item_t *item);
+
+/* a source which reads blocks from a FILE * (arg) which are extended past
+   block_size to the end of their last line, so that the lines can be
+   processed in parallel */
+bool ac_pipeline_read_lines(void *arg, ac_pipeline_item_t *item);
+
+/* an ordered stage which writes each item's buffer to a FILE * (arg) */
+bool ac_pipeline_write(void *arg, ac_pipeline_item_t *item);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,18 +16,370 @@ limitations under the License.
 
 #include "ac_allocator.h"
 #include "ac_pool.h"
+#include "ac_sort.h"
+#include "ac_trace.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ac_pool_cache_s {
+  pthread_mutex_t mutex;
+  /* cached blocks are linked together through their prev pointer */
+  ac_pool_node_t *head;
+  /* bytes is the total of the cached blocks (including their nodes) */
+  size_t bytes;
+  size_t max_bytes;
+};
+
+struct ac_pool_limit_s {
+  size_t bytes;
+  size_t max_bytes;
+};
+
+/* see ac_pool_set_limits, charged is the bytes of growth blocks which are
+   counted against shared */
+struct ac_pool_limits_s {
+  size_t soft_limit;
+  size_t hard_limit;
+  ac_pool_limit_f cb;
+  void *arg;
+  ac_pool_limit_t *shared;
+  size_t charged;
+  bool soft_reported;
+  bool failed;
+};
+
+/* Blocks which don't fit are usually the first in the cache because blocks
+   tend to be the minimum_growth_size of the pool.  There is no reason to
+   search the whole cache while holding the lock. */
+#define AC_POOL_CACHE_MAX_SCAN 8
+
+static inline size_t block_capacity(ac_pool_node_t *n) {
+  return n->endp - (char *)(n + 1);
+}
+
+static ac_pool_cache_t *default_cache = NULL;
+
+/* huge pools map their blocks in multiples of this size */
+#define AC_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static inline size_t huge_length(size_t length) {
+  return (length + AC_POOL_HUGE_PAGE_SIZE - 1) &
+         ~((size_t)AC_POOL_HUGE_PAGE_SIZE - 1);
+}
+
+static void *huge_map(size_t length) {
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  /* this only succeeds if huge pages have been reserved by the system */
+  p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED)
+      abort();
+#ifdef MADV_HUGEPAGE
+    /* ask for transparent huge pages, failure is not an error */
+    madvise(p, length, MADV_HUGEPAGE);
+#endif
+  }
+  return p;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_pool_cache_t *_ac_pool_cache_init(size_t max_bytes,
+                                     const char *caller) {
+  ac_pool_cache_t *c = (ac_pool_cache_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_pool_cache_t), false);
+#else
+ac_pool_cache_t *_ac_pool_cache_init(size_t max_bytes) {
+  ac_pool_cache_t *c = (ac_pool_cache_t *)ac_malloc(sizeof(ac_pool_cache_t));
+#endif
+  if (!c)
+    abort();
+  pthread_mutex_init(&c->mutex, NULL);
+  c->head = NULL;
+  c->bytes = 0;
+  c->max_bytes = max_bytes;
+  return c;
+}
+
+static void free_block_list(ac_pool_node_t *n) {
+  while (n) {
+    ac_pool_node_t *prev = n->prev;
+    ac_free(n);
+    n = prev;
+  }
+}
+
+void ac_pool_cache_destroy(ac_pool_cache_t *c) {
+  if (default_cache == c)
+    default_cache = NULL;
+  free_block_list(c->head);
+  pthread_mutex_destroy(&c->mutex);
+  ac_free(c);
+}
+
+void ac_pool_cache_set_max_bytes(ac_pool_cache_t *c, size_t max_bytes) {
+  ac_pool_node_t *trimmed = NULL;
+  pthread_mutex_lock(&c->mutex);
+  c->max_bytes = max_bytes;
+  while (c->head && c->bytes > max_bytes) {
+    ac_pool_node_t *n = c->head;
+    c->head = n->prev;
+    c->bytes -= sizeof(ac_pool_node_t) + block_capacity(n);
+    n->prev = trimmed;
+    trimmed = n;
+  }
+  pthread_mutex_unlock(&c->mutex);
+  free_block_list(trimmed);
+}
+
+size_t ac_pool_cache_bytes(ac_pool_cache_t *c) {
+  pthread_mutex_lock(&c->mutex);
+  size_t r = c->bytes;
+  pthread_mutex_unlock(&c->mutex);
+  return r;
+}
+
+void ac_pool_cache_set_default(ac_pool_cache_t *c) { default_cache = c; }
+
+void ac_pool_set_cache(ac_pool_t *h, ac_pool_cache_t *c) { h->cache = c; }
+
+/* a block with a capacity from block_size to max_size */
+static ac_pool_node_t *cache_get(ac_pool_cache_t *c, size_t block_size,
+                                 size_t max_size) {
+  ac_pool_node_t *r = NULL;
+  pthread_mutex_lock(&c->mutex);
+  ac_pool_node_t **np = &c->head;
+  for (int i = 0; *np && i < AC_POOL_CACHE_MAX_SCAN; i++) {
+    size_t capacity = block_capacity(*np);
+    if (capacity >= block_size && capacity <= max_size) {
+      r = *np;
+      *np = r->prev;
+      c->bytes -= sizeof(ac_pool_node_t) + block_capacity(r);
+      break;
+    }
+    np = &((*np)->prev);
+  }
+  pthread_mutex_unlock(&c->mutex);
+  return r;
+}
+
+/* free_blocks releases the blocks starting with n and following the prev
+   pointers up to (but not including) stop.  Blocks go to the cache while
+   there is room and are freed otherwise. */
+static void free_blocks(ac_pool_t *h, ac_pool_node_t *n,
+                        ac_pool_node_t *stop) {
+  if (h->huge) {
+    while (n != stop) {
+      ac_pool_node_t *prev = n->prev;
+      munmap(n, sizeof(ac_pool_node_t) + block_capacity(n));
+      n = prev;
+    }
+    return;
+  }
+  ac_pool_cache_t *c = h->cache;
+  ac_pool_node_t *overflow = NULL;
+  if (c)
+    pthread_mutex_lock(&c->mutex);
+  while (n != stop) {
+    ac_pool_node_t *prev = n->prev;
+    size_t bytes = sizeof(ac_pool_node_t) + block_capacity(n);
+    if (c && c->bytes + bytes <= c->max_bytes) {
+      n->prev = c->head;
+      c->head = n;
+      c->bytes += bytes;
+    } else {
+      n->prev = overflow;
+      overflow = n;
+    }
+    n = prev;
+  }
+  if (c)
+    pthread_mutex_unlock(&c->mutex);
+  /* free outside of the lock */
+  free_block_list(overflow);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_pool_limit_t *_ac_pool_limit_init(size_t max_bytes, const char *caller) {
+  ac_pool_limit_t *l = (ac_pool_limit_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_pool_limit_t), false);
+#else
+ac_pool_limit_t *_ac_pool_limit_init(size_t max_bytes) {
+  ac_pool_limit_t *l = (ac_pool_limit_t *)ac_malloc(sizeof(ac_pool_limit_t));
+#endif
+  if (!l)
+    abort();
+  l->bytes = 0;
+  l->max_bytes = max_bytes;
+  return l;
+}
+
+void ac_pool_limit_destroy(ac_pool_limit_t *l) { ac_free(l); }
+
+void ac_pool_limit_set_max_bytes(ac_pool_limit_t *l, size_t max_bytes) {
+  __atomic_store_n(&l->max_bytes, max_bytes, __ATOMIC_RELAXED);
+}
+
+size_t ac_pool_limit_bytes(ac_pool_limit_t *l) {
+  return __atomic_load_n(&l->bytes, __ATOMIC_RELAXED);
+}
+
+static struct ac_pool_limits_s *get_limits(ac_pool_t *h) {
+  if (!h->limits) {
+    h->limits = (struct ac_pool_limits_s *)ac_calloc(sizeof(*h->limits));
+    if (!h->limits)
+      abort();
+  }
+  return h->limits;
+}
+
+void ac_pool_set_limits(ac_pool_t *h, size_t soft_limit, size_t hard_limit,
+                        ac_pool_limit_f cb, void *arg) {
+  struct ac_pool_limits_s *l = get_limits(h);
+  l->soft_limit = soft_limit;
+  l->hard_limit = hard_limit;
+  l->cb = cb;
+  l->arg = arg;
+}
+
+bool ac_pool_failed(ac_pool_t *h) { return h->limits && h->limits->failed; }
+
+/* the bytes of the blocks after the first one */
+static size_t growth_bytes(ac_pool_t *h) {
+  ac_pool_node_t *first = (ac_pool_node_t *)(h + 1);
+  size_t r = 0;
+  for (ac_pool_node_t *n = h->current; n != first; n = n->prev)
+    r += sizeof(ac_pool_node_t) + block_capacity(n);
+  return r;
+}
+
+static void uncharge(ac_pool_t *h, size_t bytes) {
+  struct ac_pool_limits_s *l = h->limits;
+  if (!l || !l->shared)
+    return;
+  if (bytes > l->charged)
+    bytes = l->charged;
+  __atomic_sub_fetch(&l->shared->bytes, bytes, __ATOMIC_RELAXED);
+  l->charged -= bytes;
+}
+
+static void charge(ac_pool_t *h, size_t bytes) {
+  struct ac_pool_limits_s *l = h->limits;
+  if (!l || !l->shared)
+    return;
+  __atomic_add_fetch(&l->shared->bytes, bytes, __ATOMIC_RELAXED);
+  l->charged += bytes;
+}
+
+void ac_pool_set_shared_limit(ac_pool_t *h, ac_pool_limit_t *shared) {
+  if (!shared && !h->limits)
+    return;
+  struct ac_pool_limits_s *l = get_limits(h);
+  uncharge(h, l->charged);
+  l->shared = shared;
+  charge(h, growth_bytes(h));
+}
+
+/* checks the limits before a block of *block_size bytes is added for an
+   allocation of len bytes.  The block is shrunk to what is left under a
+   limit if len still fits. */
+static bool check_limits(ac_pool_t *h, size_t len, size_t *block_size) {
+  struct ac_pool_limits_s *l = h->limits;
+  if (l->failed)
+    return false;
+  size_t node = sizeof(ac_pool_node_t);
+  if (l->hard_limit) {
+    if (len > l->hard_limit || h->used + node + len > l->hard_limit)
+      goto failed;
+    if (h->used + node + *block_size > l->hard_limit) {
+      if (h->huge)
+        goto failed;
+      *block_size = l->hard_limit - h->used - node;
+    }
+  }
+  if (l->shared) {
+    ac_pool_limit_t *s = l->shared;
+    size_t max_bytes = __atomic_load_n(&s->max_bytes, __ATOMIC_RELAXED);
+    size_t bytes = __atomic_add_fetch(&s->bytes, node + *block_size,
+                                      __ATOMIC_RELAXED);
+    if (bytes > max_bytes) {
+      __atomic_sub_fetch(&s->bytes, node + *block_size, __ATOMIC_RELAXED);
+      if (h->huge || *block_size == len)
+        goto failed;
+      *block_size = len;
+      bytes = __atomic_add_fetch(&s->bytes, node + len, __ATOMIC_RELAXED);
+      if (bytes > max_bytes) {
+        __atomic_sub_fetch(&s->bytes, node + len, __ATOMIC_RELAXED);
+        goto failed;
+      }
+    }
+    l->charged += node + *block_size;
+  }
+  if (l->soft_limit && !l->soft_reported &&
+      h->used + node + *block_size > l->soft_limit) {
+    l->soft_reported = true;
+    if (l->cb)
+      l->cb(h, len, false, l->arg);
+  }
+  return true;
+
+failed:
+  l->failed = true;
+  if (l->cb)
+    l->cb(h, len, true, l->arg);
+  return false;
+}
 
 size_t ac_pool_size(ac_pool_t *h) {
-  return h->size + (h->current->endp - h->curp);
+  return h->size + (h->curp - (char *)(h->current + 1));
 }
 
 size_t ac_pool_used(ac_pool_t *h) { return h->used; }
 
+void ac_pool_get_stats(ac_pool_t *h, ac_pool_stats_t *stats) {
+  stats->num_blocks = h->num_blocks;
+  stats->wasted = h->wasted;
+  stats->grow_count = h->grow_count;
+  stats->clear_count = h->clear_count;
+  stats->size = ac_pool_size(h);
+  stats->used = h->used;
+  stats->peak_size = h->peak_size;
+  if (stats->size > stats->peak_size)
+    stats->peak_size = stats->size;
+}
+
+void ac_pool_stats_add(ac_pool_stats_t *dest, const ac_pool_stats_t *src) {
+  dest->num_blocks += src->num_blocks;
+  dest->wasted += src->wasted;
+  dest->grow_count += src->grow_count;
+  dest->clear_count += src->clear_count;
+  dest->peak_size += src->peak_size;
+  dest->size += src->size;
+  dest->used += src->used;
+}
+
 void ac_pool_set_minimum_growth_size(ac_pool_t *h, size_t size) {
   if (size == 0)
     abort(); /* this doesn't make sense */
   h->minimum_growth_size = size;
+  h->growth_size = size;
+}
+
+void ac_pool_set_max_growth_size(ac_pool_t *h, size_t max_size) {
+  h->max_growth_size = max_size;
+}
+
+void ac_pool_set_growth_feedback(ac_pool_t *h, bool on) {
+  h->growth_feedback = on;
 }
 
 #ifdef _AC_DEBUG_MEMORY_
@@ -57,7 +409,8 @@ ac_pool_t *_ac_pool_init(size_t initial_size) {
   /* If the initial_size is an even multiple of 4096, then reduce the block size
    so that the actual memory allocated via the system malloc is 4096 bytes. */
   size_t block_size = initial_size;
-  if ((block_size & 4096) == 0)
+  if ((block_size & 4095) == 0 &&
+      block_size > sizeof(ac_pool_t) + sizeof(ac_pool_node_t))
     block_size -= (sizeof(ac_pool_t) + sizeof(ac_pool_node_t));
 
   ac_pool_t *h;
@@ -77,22 +430,97 @@ ac_pool_t *_ac_pool_init(size_t initial_size) {
     abort();
   h->used = initial_size + sizeof(ac_pool_t) + sizeof(ac_pool_node_t);
   h->size = 0;
+  h->num_blocks = 1;
+  h->wasted = 0;
+  h->grow_count = 0;
+  h->clear_count = 0;
+  h->peak_size = 0;
+  h->max_growth_size = 0;
+  h->growth_feedback = false;
   h->current = (ac_pool_node_t *)(h + 1);
   h->curp = (char *)(h->current + 1);
   h->current->endp = h->curp + block_size;
   h->current->prev = NULL;
+  h->cache = default_cache;
+  h->huge = false;
+  h->frozen = false;
+  h->relocations = NULL;
+  h->num_relocations = 0;
+  h->limits = NULL;
 
   ac_pool_set_minimum_growth_size(h, initial_size);
   return h;
 }
 
+#ifdef _AC_DEBUG_MEMORY_
+ac_pool_t *_ac_pool_huge_init(size_t initial_size, const char *caller) {
+#else
+ac_pool_t *_ac_pool_huge_init(size_t initial_size) {
+#endif
+  if (initial_size == 0)
+    abort(); /* this doesn't make any sense */
+
+  /* The pool, the first node, and the first block share one mapping and the
+     block is extended to the end of the mapping.  The mapping isn't tracked
+     by the debug allocator. */
+  size_t length =
+      huge_length(initial_size + sizeof(ac_pool_t) + sizeof(ac_pool_node_t));
+  ac_pool_t *h = (ac_pool_t *)huge_map(length);
+#ifdef _AC_DEBUG_MEMORY_
+  h->dump.dump = dump_pool;
+  h->initial_size = initial_size;
+  h->cur_size = 0;
+  h->max_size = 0;
+#endif
+  h->used = length;
+  h->size = 0;
+  h->num_blocks = 1;
+  h->wasted = 0;
+  h->grow_count = 0;
+  h->clear_count = 0;
+  h->peak_size = 0;
+  h->max_growth_size = 0;
+  h->growth_feedback = false;
+  h->current = (ac_pool_node_t *)(h + 1);
+  h->curp = (char *)(h->current + 1);
+  h->current->endp = (char *)h + length;
+  h->current->prev = NULL;
+  h->cache = NULL;
+  h->huge = true;
+  h->frozen = false;
+  h->relocations = NULL;
+  h->num_relocations = 0;
+  h->limits = NULL;
+
+  ac_pool_set_minimum_growth_size(h, h->current->endp - h->curp);
+  return h;
+}
+
 void ac_pool_clear(ac_pool_t *h) {
-  /* remove the extra blocks (the ones where prev != NULL) */
-  ac_pool_node_t *prev = h->current->prev;
-  while (prev) {
-    ac_free(h->current);
-    h->current = prev;
-    prev = prev->prev;
+  /* remove the extra blocks (the ones where prev != NULL).  The first block
+     always immediately follows the pool structure. */
+  ac_pool_node_t *first = (ac_pool_node_t *)(h + 1);
+  size_t peak = ac_pool_size(h);
+  if (h->peak_size > peak)
+    peak = h->peak_size;
+  /* allow for the bytes which were lost at the end of blocks */
+  peak += h->wasted;
+  free_blocks(h, h->current, first);
+  h->current = first;
+  if (h->limits) {
+    uncharge(h, h->limits->charged);
+    h->limits->soft_reported = false;
+    h->limits->failed = false;
+  }
+
+  h->growth_size = h->minimum_growth_size;
+  if (h->growth_feedback) {
+    /* one block should hold whatever didn't fit in the first block */
+    size_t first_size = first->endp - (char *)(first + 1);
+    if (peak > first_size && peak - first_size > h->growth_size)
+      h->growth_size = peak - first_size;
+    if (h->max_growth_size && h->growth_size > h->max_growth_size)
+      h->growth_size = h->max_growth_size;
   }
 
   /* reset curp to the beginning */
@@ -100,6 +528,15 @@ void ac_pool_clear(ac_pool_t *h) {
 
   /* reset size and used */
   h->size = 0;
+  h->num_blocks = 1;
+  h->wasted = 0;
+  h->peak_size = 0;
+  h->clear_count++;
+  h->frozen = false;
+  if (h->relocations)
+    ac_free(h->relocations);
+  h->relocations = NULL;
+  h->num_relocations = 0;
 #ifdef _AC_DEBUG_MEMORY_
   h->cur_size = 0;
 #endif
@@ -111,20 +548,54 @@ void ac_pool_destroy(ac_pool_t *h) {
   /* pool_clear frees all of the memory from all of the extra nodes and only
     leaves the main block and main node allocated */
   ac_pool_clear(h);
+  if (h->limits)
+    ac_free(h->limits);
   /* free the main block and the main node */
-  ac_free(h);
+  if (h->huge)
+    munmap(h, h->current->endp - (char *)h);
+  else
+    ac_free(h);
 }
 
 void *_ac_pool_alloc_grow(ac_pool_t *h, size_t len) {
+  AC_TRACE_EVENT("ac_pool_grow", len);
   size_t block_size = len;
-  if (block_size < h->minimum_growth_size)
-    block_size = h->minimum_growth_size;
-  ac_pool_node_t *block =
-      (ac_pool_node_t *)ac_malloc(sizeof(ac_pool_node_t) + block_size);
-  if (!block)
-    abort();
-  if (h->current->prev)
-    h->size += (h->current->endp - h->curp);
+  if (block_size < h->growth_size)
+    block_size = h->growth_size;
+  if (h->huge)
+    block_size = huge_length(sizeof(ac_pool_node_t) + block_size) -
+                 sizeof(ac_pool_node_t);
+  if (h->limits && !check_limits(h, len, &block_size))
+    return NULL;
+  if (h->max_growth_size && h->growth_size < h->max_growth_size) {
+    h->growth_size += h->growth_size;
+    if (h->growth_size > h->max_growth_size)
+      h->growth_size = h->max_growth_size;
+  }
+  ac_pool_node_t *block = NULL;
+  if (h->huge)
+    block = (ac_pool_node_t *)huge_map(sizeof(ac_pool_node_t) + block_size);
+  else {
+    /* a limited pool only takes a block of the size that it checked */
+    if (h->cache)
+      block = cache_get(h->cache, block_size,
+                        h->limits ? block_size : (size_t)-1);
+    if (block)
+      block_size = block_capacity(block);
+    else {
+      block = (ac_pool_node_t *)ac_malloc(sizeof(ac_pool_node_t) + block_size);
+      if (!block)
+        abort();
+    }
+  }
+  h->current->usedp = h->curp;
+  h->frozen = false;
+  h->size += (h->curp - (char *)(h->current + 1));
+  h->wasted += (h->current->endp - h->curp);
+  if (h->size + len > h->peak_size)
+    h->peak_size = h->size + len;
+  h->num_blocks++;
+  h->grow_count++;
   h->used += sizeof(ac_pool_node_t) + block_size;
   block->prev = h->current;
   h->current = block;
@@ -139,6 +610,37 @@ void *_ac_pool_alloc_grow(ac_pool_t *h, size_t len) {
   return r;
 }
 
+void _ac_pool_pop(ac_pool_t *h, ac_pool_checkpoint_t *cp) {
+  AC_TRACE_EVENT("ac_pool_pop", h->num_blocks - cp->num_blocks);
+  /* the blocks after the checkpoint's block are linked in front of it */
+  size_t released = 0;
+  for (ac_pool_node_t *n = h->current; n != cp->current; n = n->prev)
+    released += sizeof(ac_pool_node_t) + block_capacity(n);
+  free_blocks(h, h->current, cp->current);
+  h->current = cp->current;
+  h->curp = cp->curp;
+  h->size = cp->size;
+  h->wasted = cp->wasted;
+  h->num_blocks = cp->num_blocks;
+  h->peak_size = cp->peak_size;
+  h->used -= released;
+  uncharge(h, released);
+#ifdef _AC_DEBUG_MEMORY_
+  h->cur_size = cp->cur_size;
+#endif
+}
+
+void *_ac_pool_aligned_alloc_grow(ac_pool_t *h, size_t len, size_t align) {
+  /* a new block is only guaranteed to be aligned to sizeof(size_t), so grow
+     by enough to align the result and then give back the extra bytes */
+  char *r = (char *)_ac_pool_alloc_grow(h, len + align - 1);
+  if (!r)
+    return NULL;
+  r += (align - ((size_t)r & (align - 1))) & (align - 1);
+  h->curp = r + len;
+  return r;
+}
+
 char *ac_pool_strdupvf(ac_pool_t *pool, const char *fmt, va_list args) {
   va_list args_copy;
   va_copy(args_copy, args);
@@ -158,6 +660,8 @@ char *ac_pool_strdupvf(ac_pool_t *pool, const char *fmt, va_list args) {
     return r;
   }
   r = (char *)ac_pool_ualloc(pool, n + 1);
+  if (!r)
+    return NULL;
   va_copy(args_copy, args);
   int n2 = vsnprintf(r, n + 1, fmt, args_copy);
   if (n != n2)
@@ -165,3 +669,218 @@ char *ac_pool_strdupvf(ac_pool_t *pool, const char *fmt, va_list args) {
   va_end(args_copy);
   return r;
 }
+
+static inline int compare_relocation(const ac_pool_relocation_t *a,
+                                     const ac_pool_relocation_t *b) {
+  if (a->old_start != b->old_start)
+    return a->old_start < b->old_start ? -1 : 1;
+  return 0;
+}
+
+static ac_sort_m(sort_relocations, ac_pool_relocation_t, compare_relocation)
+
+/* allocations are copied so that they keep their offset within a cache
+   line, which keeps the alignment from ac_pool_aligned_alloc (up to 64) */
+#define FREEZE_ALIGN 64
+
+void ac_pool_freeze(ac_pool_t *h) {
+  if (h->frozen)
+    return;
+  if (h->relocations)
+    ac_free(h->relocations);
+  h->relocations = NULL;
+  h->num_relocations = 0;
+  h->frozen = true;
+  if (h->num_blocks == 1)
+    return;
+
+  ac_pool_node_t *first = (ac_pool_node_t *)(h + 1);
+  h->current->usedp = h->curp;
+  size_t num_blocks = 0;
+  size_t total = 0;
+  for (ac_pool_node_t *n = h->current; n; n = n->prev) {
+    if (n->usedp > (char *)(n + 1)) {
+      num_blocks++;
+      total += (n->usedp - (char *)(n + 1)) + FREEZE_ALIGN;
+    }
+  }
+  ac_pool_relocation_t *r = (ac_pool_relocation_t *)ac_malloc(
+      sizeof(ac_pool_relocation_t) * (num_blocks ? num_blocks : 1));
+  if (!r)
+    abort();
+  /* the blocks are linked from newest to oldest */
+  size_t i = num_blocks;
+  for (ac_pool_node_t *n = h->current; n; n = n->prev) {
+    if (n->usedp > (char *)(n + 1)) {
+      i--;
+      r[i].old_start = (char *)(n + 1);
+      r[i].old_end = n->usedp;
+    }
+  }
+
+  ac_pool_node_t *block;
+  size_t block_size;
+  if (h->huge) {
+    size_t length = huge_length(sizeof(ac_pool_node_t) + total + 1);
+    block = (ac_pool_node_t *)huge_map(length);
+    block_size = length - sizeof(ac_pool_node_t);
+  } else {
+    block_size = total + 1;
+    block = (ac_pool_node_t *)ac_malloc(sizeof(ac_pool_node_t) + block_size);
+    if (!block)
+      abort();
+  }
+  char *p = (char *)(block + 1);
+  for (i = 0; i < num_blocks; i++) {
+    p += ((size_t)r[i].old_start - (size_t)p) & (FREEZE_ALIGN - 1);
+    size_t len = r[i].old_end - r[i].old_start;
+    memcpy(p, r[i].old_start, len);
+    r[i].new_start = p;
+    p += len;
+  }
+
+  free_blocks(h, h->current, first);
+  /* the first block can't be freed, its allocations are dead */
+  first->usedp = (char *)(first + 1);
+  block->prev = first;
+  block->endp = (char *)(block + 1) + block_size;
+  block->usedp = NULL;
+  h->current = block;
+  h->curp = p;
+  h->size = 0;
+  h->wasted = block_capacity(first);
+  h->num_blocks = 2;
+  h->grow_count++;
+  h->used = (first->endp - (char *)h) + sizeof(ac_pool_node_t) + block_size;
+  /* the new block isn't checked against the limits (it replaces blocks
+     which were already counted) */
+  if (h->limits) {
+    uncharge(h, h->limits->charged);
+    charge(h, growth_bytes(h));
+  }
+
+  sort_relocations(r, num_blocks);
+  h->relocations = r;
+  h->num_relocations = num_blocks;
+}
+
+void *ac_pool_relocate(ac_pool_t *h, const void *p) {
+  const char *s = (const char *)p;
+  ac_pool_relocation_t *low = h->relocations;
+  ac_pool_relocation_t *high = low + h->num_relocations;
+  /* find the last block which starts at or before p */
+  while (low < high) {
+    ac_pool_relocation_t *mid = low + ((high - low) >> 1);
+    if (mid->old_start <= s)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low == h->relocations)
+    return (void *)p;
+  low--;
+  if (s > low->old_end)
+    return (void *)p;
+  return low->new_start + (s - low->old_start);
+}
+
+/* the file starts with a page which holds the header, followed by the region
+   (which starts at the same offset within a page as it did in memory) */
+static const char image_magic[8] = {'A', 'C', 'P', 'O', 'O', 'L', 'I', '1'};
+
+enum { SAVED_BASE = 1, LENGTH, ROOT, REGION_OFFSET, NUM_FIELDS };
+
+bool ac_pool_save(ac_pool_t *h, const void *root, const char *filename) {
+  if (h->num_blocks != 1 && !h->frozen)
+    return false;
+  char *base = (char *)(h->current + 1);
+  size_t length = h->curp - base;
+  size_t page = sysconf(_SC_PAGESIZE);
+  uint64_t header[NUM_FIELDS];
+  memset(header, 0, sizeof(header));
+  memcpy(header, image_magic, sizeof(image_magic));
+  header[SAVED_BASE] = (uintptr_t)base;
+  header[LENGTH] = length;
+  header[ROOT] = root ? (uint64_t)((const char *)root - base) : UINT64_MAX;
+  header[REGION_OFFSET] = page + ((uintptr_t)base & (page - 1));
+
+  size_t name_len = strlen(filename);
+  char *tmp_name = (char *)ac_malloc(name_len + 32);
+  if (!tmp_name)
+    abort();
+  snprintf(tmp_name, name_len + 32, "%s.%d.tmp", filename, (int)getpid());
+  bool ok = false;
+  FILE *out = fopen(tmp_name, "wb");
+  if (out) {
+    size_t pad = header[REGION_OFFSET] - sizeof(header);
+    ok = fwrite(header, sizeof(header), 1, out) == 1;
+    for (; ok && pad; pad--)
+      ok = fputc(0, out) != EOF;
+    if (ok && length)
+      ok = fwrite(base, length, 1, out) == 1;
+    if (fclose(out))
+      ok = false;
+    if (ok)
+      ok = rename(tmp_name, filename) == 0;
+    if (!ok)
+      remove(tmp_name);
+  }
+  ac_free(tmp_name);
+  return ok;
+}
+
+bool ac_pool_mmap(ac_pool_image_t *img, const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return false;
+  uint64_t header[NUM_FIELDS];
+  struct stat st;
+  size_t page = sysconf(_SC_PAGESIZE);
+  bool ok = fstat(fd, &st) == 0 &&
+            pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header);
+  if (!ok || memcmp(header, image_magic, sizeof(image_magic)) ||
+      header[REGION_OFFSET] < sizeof(header) ||
+      header[REGION_OFFSET] > (uint64_t)st.st_size ||
+      header[LENGTH] > (uint64_t)st.st_size - header[REGION_OFFSET] ||
+      (header[ROOT] != UINT64_MAX && header[ROOT] > header[LENGTH])) {
+    close(fd);
+    return false;
+  }
+  size_t map_length = st.st_size;
+  uintptr_t want = (uintptr_t)(header[SAVED_BASE] - header[REGION_OFFSET]);
+  void *p = MAP_FAILED;
+  if ((want & (page - 1)) == 0) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    p = mmap((void *)want, map_length, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (p != MAP_FAILED && (uintptr_t)p != want) {
+      munmap(p, map_length);
+      p = MAP_FAILED;
+    }
+  }
+  img->fixed = p != MAP_FAILED;
+  if (p == MAP_FAILED)
+    p = mmap(NULL, map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  img->map = p;
+  img->map_length = map_length;
+  img->base = (char *)p + header[REGION_OFFSET];
+  img->length = header[LENGTH];
+  img->saved_base = (const char *)(uintptr_t)header[SAVED_BASE];
+  img->root = header[ROOT] == UINT64_MAX ? NULL : img->base + header[ROOT];
+  return true;
+}
+
+void ac_pool_munmap(ac_pool_image_t *img) {
+  if (img->map)
+    munmap(img->map, img->map_length);
+  img->map = NULL;
+  img->map_length = 0;
+  img->base = NULL;
+  img->length = 0;
+  img->root = NULL;
+}
@@ -39,16 +39,55 @@ ac_pool_t *_ac_pool_init(size_t size, const char *caller);
 ac_pool_t *_ac_pool_init(size_t size);
 #endif
 
+/* ac_pool_huge_init is like ac_pool_init except that the blocks are mapped
+  with mmap and sized in multiples of 2MB so that they can be backed by huge
+  pages (MAP_HUGETLB is tried first and if the system has no huge pages
+  reserved, the mapping is advised with MADV_HUGEPAGE).  This reduces TLB
+  misses for large pools which are touched randomly.  These pools don't use a
+  block cache. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_pool_huge_init(size)                                                \
+  _ac_pool_huge_init(size, AC_FILE_LINE_MACRO("ac_pool_huge"))
+ac_pool_t *_ac_pool_huge_init(size_t size, const char *caller);
+#else
+#define ac_pool_huge_init(size) _ac_pool_huge_init(size)
+ac_pool_t *_ac_pool_huge_init(size_t size);
+#endif
+
 /* ac_pool_clear will make all of the pool's memory reusable.  If the
   initial block was exceeded and additional blocks were added, those blocks
   will be freed. */
 void ac_pool_clear(ac_pool_t *h);
 
-/*
-ac_pool_checkpoint_t *ac_get_checkpoint(ac_pool_t *pool);
+/* ac_pool_push saves the state of the pool in cp and ac_pool_pop gives back
+  everything which was allocated after it.  Blocks which were added after
+  the push are returned to the block cache (or freed), so scratch memory in
+  a deep call stack doesn't grow the pool until it is cleared.  Pushes can
+  be nested, but they must be popped in reverse order and not across an
+  ac_pool_clear or ac_pool_freeze.  Popping in the block where the push
+  happened only resets a pointer.  Scratch allocations don't count toward
+  the peak_size of the pool (which sizes blocks with growth feedback).
 
-void ac_pool_clear_to(ac_pool_t *h, ac_pool_checkpoint_t *cp);
+    ac_pool_checkpoint_t cp;
+    ac_pool_push(pool, &cp);
+    char *tmp = (char *)ac_pool_alloc(pool, len);
+    ...
+    ac_pool_pop(pool, &cp);
 */
+typedef struct {
+  struct ac_pool_node_s *current;
+  char *curp;
+  size_t size;
+  size_t wasted;
+  size_t num_blocks;
+  size_t peak_size;
+#ifdef _AC_DEBUG_MEMORY_
+  size_t cur_size;
+#endif
+} ac_pool_checkpoint_t;
+
+static inline void ac_pool_push(ac_pool_t *h, ac_pool_checkpoint_t *cp);
+static inline void ac_pool_pop(ac_pool_t *h, ac_pool_checkpoint_t *cp);
 
 /* ac_pool_destroy frees up all memory associated with the pool object */
 void ac_pool_destroy(ac_pool_t *h);
@@ -59,15 +98,138 @@ void ac_pool_destroy(ac_pool_t *h);
    original block size for the new block (effectively doubling memory usage). */
 void ac_pool_set_minimum_growth_size(ac_pool_t *h, size_t size);
 
+/* ac_pool_set_max_growth_size turns on geometric growth.  Each new block is
+   twice the size of the previous one (starting at the minimum growth size)
+   until max_size is reached.  The growth size starts over when the pool is
+   cleared.  A max_size of 0 turns geometric growth off. */
+void ac_pool_set_max_growth_size(ac_pool_t *h, size_t max_size);
+
+/* ac_pool_set_growth_feedback makes ac_pool_clear size the first growth block
+   of the next cycle from the peak size of the cycle which just ended, so a
+   pool which is used the same way repeatedly only grows once per cycle.  The
+   max growth size (if set) still applies. */
+void ac_pool_set_growth_feedback(ac_pool_t *h, bool on);
+
+/* A block cache holds the extra blocks which are released by ac_pool_clear
+  so that a pool which grows again can reuse them instead of calling malloc.
+  A cache has its own lock, so it can be shared by a group of pools (even if
+  the pools are used by different threads).  The lock is only needed when a
+  pool grows or is cleared. */
+struct ac_pool_cache_s;
+typedef struct ac_pool_cache_s ac_pool_cache_t;
+
+/* ac_pool_cache_init creates a cache which will hold up to max_bytes of
+  blocks.  Blocks which are released once the cache is full are freed. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_pool_cache_init(max_bytes)                                          \
+  _ac_pool_cache_init(max_bytes, AC_FILE_LINE_MACRO("ac_pool_cache"))
+ac_pool_cache_t *_ac_pool_cache_init(size_t max_bytes, const char *caller);
+#else
+#define ac_pool_cache_init(max_bytes) _ac_pool_cache_init(max_bytes)
+ac_pool_cache_t *_ac_pool_cache_init(size_t max_bytes);
+#endif
+
+/* ac_pool_cache_destroy frees the cache and all of the blocks in it.  Pools
+  which use the cache must be destroyed (or have their cache changed) first. */
+void ac_pool_cache_destroy(ac_pool_cache_t *c);
+
+/* ac_pool_cache_set_max_bytes changes the high-water mark of the cache.  If
+  the cache holds more than max_bytes, blocks are freed until it doesn't. */
+void ac_pool_cache_set_max_bytes(ac_pool_cache_t *c, size_t max_bytes);
+
+/* ac_pool_cache_bytes returns the number of bytes held by the cache */
+size_t ac_pool_cache_bytes(ac_pool_cache_t *c);
+
+/* ac_pool_cache_set_default makes c the cache for every pool created after
+  this call (c may be NULL to stop using a default cache).  This should be
+  done before other threads start creating pools. */
+void ac_pool_cache_set_default(ac_pool_cache_t *c);
+
+/* ac_pool_set_cache changes the cache that the pool uses (c may be NULL). */
+void ac_pool_set_cache(ac_pool_t *h, ac_pool_cache_t *c);
+
+/* Memory limits.  A pool can have a soft and a hard limit on the bytes that
+  it uses (ac_pool_used), and a group of pools (such as the request pools of
+  a server) can share an ac_pool_limit_t which caps the bytes that they add
+  beyond their first blocks.  The limits are checked when the pool needs a
+  new block, so the inlined allocations don't get any slower.
+
+  When a new block would take the pool past its soft limit, the callback is
+  called with hard set to false (once until the pool is cleared) and the
+  allocation goes ahead.  When a new block would pass the hard limit or the
+  shared limit (and an exact fit would too), the callback is called with hard
+  set to true, the allocation returns NULL, and the pool fails every grow
+  until it is cleared (see ac_pool_failed).  The functions which copy into
+  the pool (ac_pool_strdup, ac_pool_dup, ...) return NULL as well, so code
+  which uses a pool with a hard or shared limit must check for NULL.  Pools
+  without limits abort if malloc fails like they always have. */
+typedef void (*ac_pool_limit_f)(ac_pool_t *h, size_t len, bool hard,
+                                void *arg);
+
+/* a limit of 0 turns it off and cb may be NULL */
+void ac_pool_set_limits(ac_pool_t *h, size_t soft_limit, size_t hard_limit,
+                        ac_pool_limit_f cb, void *arg);
+
+/* true if an allocation failed because of a limit since the last
+   ac_pool_clear */
+bool ac_pool_failed(ac_pool_t *h);
+
+struct ac_pool_limit_s;
+typedef struct ac_pool_limit_s ac_pool_limit_t;
+
+/* a shared limit which allows up to max_bytes of growth blocks across the
+   pools which use it (it is thread-safe) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_pool_limit_init(max_bytes)                                          \
+  _ac_pool_limit_init(max_bytes, AC_FILE_LINE_MACRO("ac_pool_limit"))
+ac_pool_limit_t *_ac_pool_limit_init(size_t max_bytes, const char *caller);
+#else
+#define ac_pool_limit_init(max_bytes) _ac_pool_limit_init(max_bytes)
+ac_pool_limit_t *_ac_pool_limit_init(size_t max_bytes);
+#endif
+
+/* pools which use l must be destroyed (or have their limit changed) first */
+void ac_pool_limit_destroy(ac_pool_limit_t *l);
+
+void ac_pool_limit_set_max_bytes(ac_pool_limit_t *l, size_t max_bytes);
+
+/* the bytes of growth blocks which are currently held by the pools */
+size_t ac_pool_limit_bytes(ac_pool_limit_t *l);
+
+/* ac_pool_set_shared_limit moves the pool's growth blocks to l (which may be
+   NULL) */
+void ac_pool_set_shared_limit(ac_pool_t *h, ac_pool_limit_t *l);
+
 /* ac_pool_alloc allocates len uninitialized bytes which are aligned. */
 static inline void *ac_pool_alloc(ac_pool_t *h, size_t len);
 
+/* ac_pool_alloc_n allocates num objects of size bytes with one bounds check
+  and returns the first.  size is rounded up so that every object is aligned
+  (object i starts at i * the rounded size).  A loop which creates a known
+  number of objects can carve them out of the result instead of calling
+  ac_pool_alloc for each one. */
+static inline void *ac_pool_alloc_n(ac_pool_t *h, size_t num, size_t size);
+
+/* ac_pool_aligned_alloc allocates len uninitialized bytes which are aligned
+  to align bytes (align must be a power of 2).  This is useful for SIMD data
+  and for structures which should start on a cache line. */
+static inline void *ac_pool_aligned_alloc(ac_pool_t *h, size_t len,
+                                          size_t align);
+
 /* ac_pool_alloc allocates len uninitialized bytes which are unaligned. */
 static inline void *ac_pool_ualloc(ac_pool_t *h, size_t len);
 
 /* ac_pool_alloc allocates len zero'd bytes which are aligned. */
 static inline void *ac_pool_calloc(ac_pool_t *h, size_t len);
 
+/* ac_pool_extend grows the allocation p from len to new_len bytes in place
+  and returns true if p is the last allocation from the pool and the current
+  block has room.  Otherwise, nothing changes and false is returned (the
+  caller must allocate new memory and copy p).  Growable arrays use this to
+  avoid a copy when nothing else has been allocated since they last grew. */
+static inline bool ac_pool_extend(ac_pool_t *h, void *p, size_t len,
+                                  size_t new_len);
+
 /* ac_pool_strdup allocates a copy of the string p.  The memory will be
   unaligned.  If you need the memory to be aligned, consider using ac_pool_dup
   like char *s = ac_pool_dup(pool, p, strlen(p)+1); */
@@ -100,6 +262,139 @@ size_t ac_pool_size(ac_pool_t *h);
 */
 size_t ac_pool_used(ac_pool_t *h);
 
+/* ac_pool_stats_t describes how a pool has used its blocks.  The counters are
+  only updated when the pool grows or is cleared, so they are always available
+  (unlike the max_size tracking of _AC_DEBUG_MEMORY_).  The numbers are useful
+  for choosing the size passed to ac_pool_init and
+  ac_pool_set_minimum_growth_size. */
+typedef struct {
+  /* the number of blocks currently held by the pool (including the first) */
+  size_t num_blocks;
+  /* the bytes left unused at the end of blocks which were filled since the
+     last ac_pool_clear */
+  size_t wasted;
+  /* the number of times the pool has added a block */
+  size_t grow_count;
+  /* the number of times ac_pool_clear has been called */
+  size_t clear_count;
+  /* the largest ac_pool_size since the last ac_pool_clear */
+  size_t peak_size;
+  /* ac_pool_size and ac_pool_used */
+  size_t size;
+  size_t used;
+} ac_pool_stats_t;
+
+/* ac_pool_get_stats fills stats with the pool's current statistics */
+void ac_pool_get_stats(ac_pool_t *h, ac_pool_stats_t *stats);
+
+/* ac_pool_stats_add adds src to dest so that the stats of a group of pools
+  can be combined.  dest should be zeroed before the first call. */
+void ac_pool_stats_add(ac_pool_stats_t *dest, const ac_pool_stats_t *src);
+
+/* A pool which holds a long lived structure (such as a lookup table) can be
+  frozen into one contiguous region, saved to a file, and mapped back in by a
+  later process instead of rebuilding the structure.
+
+  ac_pool_freeze copies every allocation into one new block (in the order of
+  the blocks, keeping the alignment of each allocation) and frees the other
+  blocks.  Pointers into the pool must then be translated with
+  ac_pool_relocate, which works until the pool is cleared or frozen again.
+  Structures which store offsets from the start of the region (see
+  ac_pool_offset) don't need to be translated.  A pool which never grew
+  beyond its first block is already contiguous and isn't copied.
+
+  ac_pool_save writes the region of a frozen pool (or one with a single
+  block) to filename and returns false on an error or if the pool has grown
+  since it was frozen.  root is the pointer (into the region) which the
+  reader starts from.
+
+  ac_pool_mmap maps a saved region (copy on write) where it was when it was
+  saved if that address range is free, in which case the pointers inside of
+  it are valid as they are (fixed is true).  Otherwise, the region is mapped
+  elsewhere and the pointers in it have to be translated with
+  ac_pool_image_relocate (offsets work either way). */
+void ac_pool_freeze(ac_pool_t *h);
+
+/* the new address of p (which pointed into the pool before ac_pool_freeze),
+  pointers which weren't into the pool are returned as is */
+void *ac_pool_relocate(ac_pool_t *h, const void *p);
+
+/* the offset of p from the start of the region of a frozen pool */
+static inline size_t ac_pool_offset(ac_pool_t *h, const void *p);
+
+bool ac_pool_save(ac_pool_t *h, const void *root, const char *filename);
+
+typedef struct {
+  /* the saved region and the root passed to ac_pool_save */
+  char *base;
+  size_t length;
+  void *root;
+  /* true if the region is mapped at the address it was saved from */
+  bool fixed;
+  const char *saved_base;
+
+  void *map;
+  size_t map_length;
+} ac_pool_image_t;
+
+/* returns false if the file can't be mapped or wasn't saved by
+   ac_pool_save */
+bool ac_pool_mmap(ac_pool_image_t *img, const char *filename);
+
+void ac_pool_munmap(ac_pool_image_t *img);
+
+/* the address of a pointer saved inside of the region */
+static inline void *ac_pool_image_relocate(ac_pool_image_t *img,
+                                           const void *saved);
+
+/* the address of an offset from ac_pool_offset */
+static inline void *ac_pool_image_pointer(ac_pool_image_t *img,
+                                          size_t offset);
+
+/* ac_pool_freelist_t recycles fixed size objects (such as the nodes of an
+  ac_map) which are allocated from a pool.  A pool can't free individual
+  allocations, so a structure which erases as often as it inserts would grow
+  until the pool is cleared.  Freed objects are kept on a list (linked through
+  the objects themselves) and reused by the next alloc, so the memory used
+  stays at the peak number of live objects.  New objects always come from the
+  pool and never from malloc.  The freelist must be cleared whenever the pool
+  is cleared. */
+typedef struct ac_pool_freelist_s {
+  ac_pool_t *pool;
+  size_t object_size;
+  void *head;
+  size_t num_free;
+} ac_pool_freelist_t;
+
+/* object_size is rounded up so that the objects are aligned */
+static inline void ac_pool_freelist_init(ac_pool_freelist_t *fl,
+                                         ac_pool_t *pool, size_t object_size);
+
+/* returns an uninitialized object */
+static inline void *ac_pool_freelist_alloc(ac_pool_freelist_t *fl);
+
+/* returns a zero'd object */
+static inline void *ac_pool_freelist_calloc(ac_pool_freelist_t *fl);
+
+/* p must have come from ac_pool_freelist_alloc */
+static inline void ac_pool_freelist_free(ac_pool_freelist_t *fl, void *p);
+
+/* forget the free objects (call this when the pool is cleared) */
+static inline void ac_pool_freelist_clear(ac_pool_freelist_t *fl);
+
+/* ac_pool_freelist_m creates typed functions for a freelist of type.
+    type *name_alloc(ac_pool_freelist_t *fl);
+    void name_free(ac_pool_freelist_t *fl, type *p);
+  For example, an ac_map user might generate node_alloc and node_free and
+  call node_free after ac_map_erase. */
+#define ac_pool_freelist_m(name, type)                                         \
+  static inline type *name##_alloc(ac_pool_freelist_t *fl) {                   \
+    return (type *)ac_pool_freelist_alloc(fl);                                 \
+  }                                                                            \
+  static inline void name##_free(ac_pool_freelist_t *fl, type *p) {            \
+    ac_pool_freelist_free(fl, p);                                              \
+  }
+
 #include "impl/ac_pool.h"
 
 #ifdef __cplusplus
@@ -0,0 +1,135 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_pool_tls.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct ac_pool_tls_node_s {
+  ac_pool_t *pool;
+  ac_pool_tls_t *h;
+  struct ac_pool_tls_node_s *next;
+  struct ac_pool_tls_node_s *previous;
+} ac_pool_tls_node_t;
+
+struct ac_pool_tls_s {
+  size_t size;
+#ifdef _AC_DEBUG_MEMORY_
+  const char *caller;
+#endif
+  pthread_key_t key;
+  ac_pool_cache_t *cache;
+  /* all of the thread pools which are alive are tracked so that they can be
+     destroyed by ac_pool_tls_destroy.  The mutex is only needed when a thread
+     creates or destroys its pool. */
+  pthread_mutex_t mutex;
+  ac_pool_tls_node_t *head;
+};
+
+static void destroy_node(ac_pool_tls_node_t *n) {
+  ac_pool_destroy(n->pool);
+  ac_free(n);
+}
+
+static void on_thread_exit(void *arg) {
+  ac_pool_tls_node_t *n = (ac_pool_tls_node_t *)arg;
+  ac_pool_tls_t *h = n->h;
+  pthread_mutex_lock(&h->mutex);
+  if (n->previous)
+    n->previous->next = n->next;
+  else
+    h->head = n->next;
+  if (n->next)
+    n->next->previous = n->previous;
+  pthread_mutex_unlock(&h->mutex);
+  destroy_node(n);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_pool_tls_t *_ac_pool_tls_init(size_t size, size_t max_cached_bytes,
+                                 const char *caller) {
+  ac_pool_tls_t *h = (ac_pool_tls_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_pool_tls_t), false);
+  h->caller = caller;
+#else
+ac_pool_tls_t *_ac_pool_tls_init(size_t size, size_t max_cached_bytes) {
+  ac_pool_tls_t *h = (ac_pool_tls_t *)ac_malloc(sizeof(ac_pool_tls_t));
+#endif
+  if (!h || size == 0)
+    abort();
+  h->size = size;
+  h->head = NULL;
+#ifdef _AC_DEBUG_MEMORY_
+  h->cache = _ac_pool_cache_init(max_cached_bytes, caller);
+#else
+  h->cache = _ac_pool_cache_init(max_cached_bytes);
+#endif
+  pthread_mutex_init(&h->mutex, NULL);
+  if (pthread_key_create(&h->key, on_thread_exit))
+    abort();
+  return h;
+}
+
+static ac_pool_t *create_thread_pool(ac_pool_tls_t *h) {
+  ac_pool_tls_node_t *n =
+      (ac_pool_tls_node_t *)ac_malloc(sizeof(ac_pool_tls_node_t));
+  if (!n)
+    abort();
+#ifdef _AC_DEBUG_MEMORY_
+  n->pool = _ac_pool_init(h->size, h->caller);
+#else
+  n->pool = _ac_pool_init(h->size);
+#endif
+  ac_pool_set_cache(n->pool, h->cache);
+  n->h = h;
+  n->previous = NULL;
+  pthread_mutex_lock(&h->mutex);
+  n->next = h->head;
+  if (n->next)
+    n->next->previous = n;
+  h->head = n;
+  pthread_mutex_unlock(&h->mutex);
+  pthread_setspecific(h->key, n);
+  return n->pool;
+}
+
+ac_pool_t *ac_pool_tls_get(ac_pool_tls_t *h) {
+  ac_pool_tls_node_t *n = (ac_pool_tls_node_t *)pthread_getspecific(h->key);
+  if (n)
+    return n->pool;
+  return create_thread_pool(h);
+}
+
+void ac_pool_tls_clear(ac_pool_tls_t *h) {
+  ac_pool_tls_node_t *n = (ac_pool_tls_node_t *)pthread_getspecific(h->key);
+  if (n)
+    ac_pool_clear(n->pool);
+}
+
+void ac_pool_tls_destroy(ac_pool_tls_t *h) {
+  /* once the key is deleted, on_thread_exit will no longer be called */
+  pthread_key_delete(h->key);
+  ac_pool_tls_node_t *n = h->head;
+  while (n) {
+    ac_pool_tls_node_t *next = n->next;
+    destroy_node(n);
+    n = next;
+  }
+  ac_pool_cache_destroy(h->cache);
+  pthread_mutex_destroy(&h->mutex);
+  ac_free(h);
+}
@@ -0,0 +1,68 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_pool_tls_H
+#define _ac_pool_tls_H
+
+#include "ac_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_pool_tls_t gives every thread which calls ac_pool_tls_get its own pool.
+  The ac_pool_t is not thread-safe, but since each thread has its own, none of
+  the allocation calls need a lock.  The blocks that the thread pools grow into
+  are returned to a block cache which is shared by all of the threads when a
+  pool is cleared.  This way, clearing and refilling a pool doesn't need to go
+  back through malloc/free (only the cache needs a lock and only when a block
+  is needed or released).
+*/
+struct ac_pool_tls_s;
+typedef struct ac_pool_tls_s ac_pool_tls_t;
+
+/* ac_pool_tls_init creates the handle.  Each thread's pool will initially have
+   size bytes.  Up to max_cached_bytes of released blocks will be kept in the
+   shared cache. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_pool_tls_init(size, max_cached_bytes)                               \
+  _ac_pool_tls_init(size, max_cached_bytes, AC_FILE_LINE_MACRO("ac_pool_tls"))
+ac_pool_tls_t *_ac_pool_tls_init(size_t size, size_t max_cached_bytes,
+                                 const char *caller);
+#else
+#define ac_pool_tls_init(size, max_cached_bytes)                               \
+  _ac_pool_tls_init(size, max_cached_bytes)
+ac_pool_tls_t *_ac_pool_tls_init(size_t size, size_t max_cached_bytes);
+#endif
+
+/* ac_pool_tls_get returns the pool for the calling thread (creating it on the
+   first call).  The pool is destroyed when the thread exits. */
+ac_pool_t *ac_pool_tls_get(ac_pool_tls_t *h);
+
+/* ac_pool_tls_clear clears the pool for the calling thread */
+void ac_pool_tls_clear(ac_pool_tls_t *h);
+
+/* ac_pool_tls_destroy destroys all of the pools which haven't been destroyed
+   by their threads exiting and the block cache.  It should only be called
+   once the threads are no longer using their pools. */
+void ac_pool_tls_destroy(ac_pool_tls_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_queue.h"
+#include "ac_allocator.h"
+
+#include <stdlib.h>
+
+static size_t round_up_size(size_t size) {
+  size_t n = 2;
+  while (n < size)
+    n <<= 1;
+  return n;
+}
+
+void ac_queue_spsc_init(ac_queue_spsc_t *q, size_t size) {
+  size = round_up_size(size);
+  q->cells = (void **)ac_calloc(sizeof(void *) * size);
+  q->mask = size - 1;
+  q->tail = 0;
+  q->cached_head = 0;
+  q->head = 0;
+  q->cached_tail = 0;
+}
+
+void ac_queue_spsc_destroy(ac_queue_spsc_t *q) {
+  ac_free(q->cells);
+  q->cells = NULL;
+}
+
+void ac_queue_mpmc_init(ac_queue_mpmc_t *q, size_t size) {
+  size = round_up_size(size);
+  q->cells = (ac_queue_cell_t *)ac_malloc(sizeof(ac_queue_cell_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    q->cells[i].seq = i;
+    q->cells[i].object = NULL;
+  }
+  q->mask = size - 1;
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+}
+
+void ac_queue_mpmc_destroy(ac_queue_mpmc_t *q) {
+  ac_free(q->cells);
+  q->cells = NULL;
+}
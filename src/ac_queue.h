@@ -0,0 +1,185 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_queue_H
+#define _ac_queue_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Lock-free queues and a stack for passing objects between threads.
+
+  ac_queue_spsc_t   a bounded ring for one producer and one consumer
+  ac_queue_mpmc_t   a bounded ring for any number of producers and consumers
+                    (Dmitry Vyukov's design, as used by ac_threaded_pipe)
+  ac_queue_mpsc_t   an unbounded intrusive queue for any number of producers
+                    and one consumer (Vyukov's intrusive MPSC queue)
+  ac_stack_t        an unbounded intrusive Treiber stack for any number of
+                    threads, with a tagged top to protect pop from ABA
+
+  The rings hold pointers (which may not be NULL, NULL means empty) and
+  allocate their cells with ac_queue_xxx_init.  The intrusive containers
+  link an ac_queue_node_t (or ac_stack_node_t) which is embedded in the
+  object, like ac_map_t, and never allocate.  Use ac_parent_object to get
+  from the node back to the object.  None of them wait.  Push on a full ring
+  returns false and pop on an empty container returns NULL, so the caller
+  decides whether to spin, yield, or sleep.
+*/
+
+typedef struct {
+  void **cells;
+  size_t mask;
+  char pad1[64];
+  /* written by the producer */
+  size_t tail;
+  size_t cached_head;
+  char pad2[64];
+  /* written by the consumer */
+  size_t head;
+  size_t cached_tail;
+  char pad3[64];
+} ac_queue_spsc_t;
+
+/* size is rounded up to a power of two */
+void ac_queue_spsc_init(ac_queue_spsc_t *q, size_t size);
+void ac_queue_spsc_destroy(ac_queue_spsc_t *q);
+
+/* returns false if the ring is full (producer only) */
+static inline bool ac_queue_spsc_push(ac_queue_spsc_t *q, void *object);
+
+/* returns NULL if the ring is empty (consumer only) */
+static inline void *ac_queue_spsc_pop(ac_queue_spsc_t *q);
+
+/* the number of objects in the ring (exact from the producer or consumer,
+   approximate from other threads) */
+static inline size_t ac_queue_spsc_size(ac_queue_spsc_t *q);
+
+typedef struct {
+  size_t seq;
+  void *object;
+} ac_queue_cell_t;
+
+typedef struct {
+  ac_queue_cell_t *cells;
+  size_t mask;
+  char pad1[64];
+  size_t enqueue_pos;
+  char pad2[64];
+  size_t dequeue_pos;
+  char pad3[64];
+} ac_queue_mpmc_t;
+
+/* size is rounded up to a power of two */
+void ac_queue_mpmc_init(ac_queue_mpmc_t *q, size_t size);
+void ac_queue_mpmc_destroy(ac_queue_mpmc_t *q);
+
+/* returns false if the ring is full */
+static inline bool ac_queue_mpmc_push(ac_queue_mpmc_t *q, void *object);
+
+/* returns NULL if the ring is empty */
+static inline void *ac_queue_mpmc_pop(ac_queue_mpmc_t *q);
+
+typedef struct ac_queue_node_s {
+  struct ac_queue_node_s *next;
+} ac_queue_node_t;
+
+typedef struct {
+  /* the last node pushed (swapped in by the producers) */
+  ac_queue_node_t *head;
+  char pad1[64];
+  /* the next node to pop (consumer only) */
+  ac_queue_node_t *tail;
+  ac_queue_node_t stub;
+} ac_queue_mpsc_t;
+
+/* the queue must not be moved once it is initialized (the stub node is part
+   of it) */
+static inline void ac_queue_mpsc_init(ac_queue_mpsc_t *q);
+
+/* wait free, one exchange per push */
+static inline void ac_queue_mpsc_push(ac_queue_mpsc_t *q, ac_queue_node_t *n);
+
+/* returns the oldest node or NULL (consumer only).  A producer which has
+   swapped itself in but not yet linked its node hides the nodes after it,
+   so pop can return NULL for a moment while a push is in progress. */
+static inline ac_queue_node_t *ac_queue_mpsc_pop(ac_queue_mpsc_t *q);
+
+/* true if no nodes have been pushed which haven't been popped (consumer
+   only) */
+static inline bool ac_queue_mpsc_empty(ac_queue_mpsc_t *q);
+
+/* The top of the stack carries a tag which is incremented by every pop, so a
+   pop which read top and top->next before another thread popped top (and
+   pushed it again) fails its compare and swap instead of corrupting the
+   stack.  With a 16 byte compare and swap (x86_64 built with -mcx16), the
+   tag is 64 bits.  Otherwise 64 bit platforms keep 16 bits of tag above the
+   48 bits of a user space address and 32 bit platforms pair the pointer with
+   a 32 bit tag.
+
+   pop reads top->next after another thread may have popped top, so nodes
+   must stay readable while any thread may pop (a node may be reused, such
+   as in a freelist, but its memory may not be unmapped). */
+#if UINTPTR_MAX == 0xFFFFFFFFu
+typedef uint64_t ac_stack_top_t;
+#define AC_STACK_POINTER_BITS 32
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+typedef unsigned __int128 ac_stack_top_t;
+#define AC_STACK_POINTER_BITS 64
+#else
+typedef uintptr_t ac_stack_top_t;
+#define AC_STACK_POINTER_BITS 48
+#endif
+
+typedef struct ac_stack_node_s {
+  struct ac_stack_node_s *next;
+} ac_stack_node_t;
+
+typedef struct {
+  ac_stack_top_t top __attribute__((aligned(sizeof(ac_stack_top_t))));
+} ac_stack_t;
+
+static inline void ac_stack_init(ac_stack_t *s);
+
+static inline void ac_stack_push(ac_stack_t *s, ac_stack_node_t *n);
+
+/* push the list first..last (linked through next) with one compare and
+   swap */
+static inline void ac_stack_push_list(ac_stack_t *s, ac_stack_node_t *first,
+                                      ac_stack_node_t *last);
+
+/* returns NULL if the stack is empty */
+static inline ac_stack_node_t *ac_stack_pop(ac_stack_t *s);
+
+/* take every node at once (the list is linked through next, most recently
+   pushed first) */
+static inline ac_stack_node_t *ac_stack_pop_all(ac_stack_t *s);
+
+/* the top node (only a hint if other threads are using the stack) */
+static inline ac_stack_node_t *ac_stack_peek(ac_stack_t *s);
+
+#include "impl/ac_queue.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_radix_sort_H
+#define _ac_radix_sort_H
+
+#include "ac_common.h"
+#include "ac_pool.h"
+#include "ac_sort.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Radix sort macros
+  =====================================================================
+
+  The radix sorts order the elements by a key instead of calling a compare
+  function for every comparison.  The scratch space (one copy of the input)
+  is allocated from pool, so it stays allocated until the pool is cleared or
+  destroyed.  If pool is NULL, the scratch space is allocated with ac_malloc
+  and freed before returning.  Inputs of AC_RADIX_SORT_CUTOFF elements or
+  fewer are sorted with ac_sort_m.  The sorts are not stable.
+
+  ac_radix_sort_m(name, datatype, key)
+    expects: keytype key(const datatype *el);
+    returns: void name(datatype *base, size_t num_elements, ac_pool_t *pool);
+
+    LSD radix sort (8 bits per pass) for fixed width keys.  keytype must be
+    an unsigned integer type of 1 to 8 bytes, the number of passes is
+    sizeof(keytype).  Passes where every key has the same byte are skipped,
+    so small keys in a wide type are cheap.  Use the ac_radix_*_key helpers
+    below to convert signed and floating point keys.
+
+  ac_radix_sort_bytes_m(name, datatype, key)
+    expects: const void *key(const datatype *el, size_t *len);
+    returns: void name(datatype *base, size_t num_elements, ac_pool_t *pool);
+
+    MSD radix sort for strings and other byte keys.  Keys are ordered like
+    memcmp with a shorter key ordered before a longer key that it is a
+    prefix of.  Buckets of AC_RADIX_SORT_CUTOFF elements or fewer are
+    finished with ac_sort_arg_m comparing from the current depth.
+*/
+
+#ifndef AC_RADIX_SORT_CUTOFF
+#define AC_RADIX_SORT_CUTOFF 256
+#endif
+
+/* keys that sort the same way as the given signed or floating point value */
+static inline uint32_t ac_radix_int32_key(int32_t v);
+static inline uint64_t ac_radix_int64_key(int64_t v);
+static inline uint32_t ac_radix_float_key(float v);
+static inline uint64_t ac_radix_double_key(double v);
+
+#include "impl/ac_radix_sort.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,660 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_radix_tree.h"
+#include "ac_allocator.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+  void *value;
+  size_t len;
+  uint8_t key[];
+} leaf_t;
+
+/* children are either nodes or leaves with the lowest bit set */
+#define is_leaf(p) ((uintptr_t)(p)&1)
+#define to_leaf(p) ((leaf_t *)((uintptr_t)(p)-1))
+#define leaf_ref(l) ((void *)((uintptr_t)(l) + 1))
+
+enum { NODE4, NODE16, NODE48, NODE256 };
+
+typedef struct {
+  uint8_t type;
+  uint16_t num_children;
+  uint32_t prefix_len;
+  /* points into the key of a leaf (or a prefix of another node) */
+  const uint8_t *prefix;
+  /* the key which ends at this node (the free list when unused) */
+  leaf_t *leaf;
+} node_t;
+
+typedef struct {
+  node_t n;
+  uint8_t keys[4];
+  void *children[4];
+} node4_t;
+
+typedef struct {
+  node_t n;
+  uint8_t keys[16];
+  void *children[16];
+} node16_t;
+
+/* index is the position in children + 1 (0 means that there is no child) */
+typedef struct {
+  node_t n;
+  uint8_t index[256];
+  void *children[48];
+} node48_t;
+
+typedef struct {
+  node_t n;
+  void *children[256];
+} node256_t;
+
+static const size_t node_sizes[] = {sizeof(node4_t), sizeof(node16_t),
+                                    sizeof(node48_t), sizeof(node256_t)};
+
+struct ac_radix_tree_s {
+  ac_pool_t *pool;
+  node_t *root;
+  size_t count;
+  /* nodes which were replaced by a bigger (or no) node */
+  node_t *free_nodes[4];
+};
+
+static node_t *new_node(ac_radix_tree_t *h, int type) {
+  node_t *n = h->free_nodes[type];
+  if (n)
+    h->free_nodes[type] = (node_t *)n->leaf;
+  else
+    n = (node_t *)ac_pool_alloc(h->pool, node_sizes[type]);
+  n->type = type;
+  n->num_children = 0;
+  n->prefix_len = 0;
+  n->prefix = NULL;
+  n->leaf = NULL;
+  if (type == NODE48)
+    memset(((node48_t *)n)->index, 0, 256);
+  else if (type == NODE256)
+    memset(((node256_t *)n)->children, 0, sizeof(void *) * 256);
+  return n;
+}
+
+static inline void free_node(ac_radix_tree_t *h, node_t *n) {
+  n->leaf = (leaf_t *)h->free_nodes[n->type];
+  h->free_nodes[n->type] = n;
+}
+
+static inline leaf_t *new_leaf(ac_radix_tree_t *h, const void *key,
+                               size_t len, void *value) {
+  leaf_t *l = (leaf_t *)ac_pool_alloc(h->pool, sizeof(leaf_t) + len);
+  l->value = value;
+  l->len = len;
+  if (len)
+    memcpy(l->key, key, len);
+  return l;
+}
+
+static void reset(ac_radix_tree_t *h) {
+  h->count = 0;
+  for (int i = 0; i < 4; i++)
+    h->free_nodes[i] = NULL;
+  h->root = new_node(h, NODE4);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_radix_tree_t *_ac_radix_tree_init(const char *caller) {
+  ac_radix_tree_t *h = (ac_radix_tree_t *)_ac_malloc_d(
+      NULL, caller, sizeof(ac_radix_tree_t), false);
+#else
+ac_radix_tree_t *_ac_radix_tree_init(void) {
+  ac_radix_tree_t *h = (ac_radix_tree_t *)ac_malloc(sizeof(ac_radix_tree_t));
+#endif
+  h->pool = ac_pool_init(65536);
+  reset(h);
+  return h;
+}
+
+void ac_radix_tree_clear(ac_radix_tree_t *h) {
+  ac_pool_clear(h->pool);
+  reset(h);
+}
+
+void ac_radix_tree_destroy(ac_radix_tree_t *h) {
+  ac_pool_destroy(h->pool);
+  ac_free(h);
+}
+
+size_t ac_radix_tree_count(ac_radix_tree_t *h) { return h->count; }
+
+size_t ac_radix_tree_bytes(ac_radix_tree_t *h) { return ac_pool_size(h->pool); }
+
+/* returns the slot of the child for byte b or NULL */
+static inline void **find_child(node_t *n, uint8_t b) {
+  switch (n->type) {
+  case NODE4: {
+    node4_t *p = (node4_t *)n;
+    for (int i = 0; i < n->num_children; i++)
+      if (p->keys[i] == b)
+        return p->children + i;
+    return NULL;
+  }
+  case NODE16: {
+    node16_t *p = (node16_t *)n;
+#ifdef __SSE2__
+    __m128i eq = _mm_cmpeq_epi8(_mm_set1_epi8((char)b),
+                                _mm_loadu_si128((const __m128i *)p->keys));
+    int mask = _mm_movemask_epi8(eq) & ((1 << n->num_children) - 1);
+    return mask ? p->children + __builtin_ctz(mask) : NULL;
+#else
+    for (int i = 0; i < n->num_children; i++)
+      if (p->keys[i] == b)
+        return p->children + i;
+    return NULL;
+#endif
+  }
+  case NODE48: {
+    node48_t *p = (node48_t *)n;
+    return p->index[b] ? p->children + p->index[b] - 1 : NULL;
+  }
+  default: {
+    node256_t *p = (node256_t *)n;
+    return p->children[b] ? p->children + b : NULL;
+  }
+  }
+}
+
+/* the position of the first key which is greater than b in a sorted node */
+static inline int insert_position(node_t *n, const uint8_t *keys, uint8_t b) {
+#ifdef __SSE2__
+  if (n->type == NODE16) {
+    /* the bytes are flipped to compare them as unsigned */
+    __m128i flip = _mm_set1_epi8((char)0x80);
+    __m128i lt = _mm_cmplt_epi8(
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)keys), flip),
+        _mm_xor_si128(_mm_set1_epi8((char)b), flip));
+    int mask = _mm_movemask_epi8(lt) & ((1 << n->num_children) - 1);
+    return __builtin_popcount(mask);
+  }
+#endif
+  int i = 0;
+  while (i < n->num_children && keys[i] < b)
+    i++;
+  return i;
+}
+
+static inline void copy_header(node_t *dest, node_t *src) {
+  dest->num_children = src->num_children;
+  dest->prefix_len = src->prefix_len;
+  dest->prefix = src->prefix;
+  dest->leaf = src->leaf;
+}
+
+/* adds child under byte b to n (which is held in *ref and doesn't have a
+   child for b), n is replaced by a bigger node if it is full */
+static void add_child(ac_radix_tree_t *h, void **ref, node_t *n, uint8_t b,
+                      void *child) {
+  switch (n->type) {
+  case NODE4:
+  case NODE16: {
+    int max = n->type == NODE4 ? 4 : 16;
+    uint8_t *keys = n->type == NODE4 ? ((node4_t *)n)->keys
+                                     : ((node16_t *)n)->keys;
+    void **children = n->type == NODE4 ? ((node4_t *)n)->children
+                                       : ((node16_t *)n)->children;
+    if (n->num_children < max) {
+      int i = insert_position(n, keys, b);
+      int rest = n->num_children - i;
+      memmove(keys + i + 1, keys + i, rest);
+      memmove(children + i + 1, children + i, sizeof(void *) * rest);
+      keys[i] = b;
+      children[i] = child;
+      n->num_children++;
+      return;
+    }
+    node_t *g;
+    if (n->type == NODE4) {
+      node16_t *p = (node16_t *)new_node(h, NODE16);
+      memcpy(p->keys, keys, 4);
+      memcpy(p->children, children, sizeof(void *) * 4);
+      g = &p->n;
+    } else {
+      node48_t *p = (node48_t *)new_node(h, NODE48);
+      for (int i = 0; i < 16; i++) {
+        p->index[keys[i]] = i + 1;
+        p->children[i] = children[i];
+      }
+      memset(p->children + 16, 0, sizeof(void *) * 32);
+      g = &p->n;
+    }
+    copy_header(g, n);
+    free_node(h, n);
+    *ref = g;
+    add_child(h, ref, g, b, child);
+    return;
+  }
+  case NODE48: {
+    node48_t *p = (node48_t *)n;
+    if (n->num_children < 48) {
+      int i = 0;
+      while (p->children[i])
+        i++;
+      p->children[i] = child;
+      p->index[b] = i + 1;
+      n->num_children++;
+      return;
+    }
+    node256_t *g = (node256_t *)new_node(h, NODE256);
+    for (int i = 0; i < 256; i++)
+      if (p->index[i])
+        g->children[i] = p->children[p->index[i] - 1];
+    copy_header(&g->n, n);
+    free_node(h, n);
+    *ref = g;
+    g->children[b] = child;
+    g->n.num_children++;
+    return;
+  }
+  default:
+    ((node256_t *)n)->children[b] = child;
+    n->num_children++;
+  }
+}
+
+/* removes the child in slot (for byte b) from n */
+static void remove_child(node_t *n, void **slot, uint8_t b) {
+  switch (n->type) {
+  case NODE4:
+  case NODE16: {
+    uint8_t *keys = n->type == NODE4 ? ((node4_t *)n)->keys
+                                     : ((node16_t *)n)->keys;
+    void **children = n->type == NODE4 ? ((node4_t *)n)->children
+                                       : ((node16_t *)n)->children;
+    int i = slot - children;
+    int rest = n->num_children - i - 1;
+    memmove(keys + i, keys + i + 1, rest);
+    memmove(children + i, children + i + 1, sizeof(void *) * rest);
+    break;
+  }
+  case NODE48:
+    ((node48_t *)n)->index[b] = 0;
+    *slot = NULL;
+    break;
+  default:
+    *slot = NULL;
+  }
+  n->num_children--;
+}
+
+/* the only child of a node with one child */
+static void *only_child(node_t *n) {
+  if (n->type == NODE4)
+    return ((node4_t *)n)->children[0];
+  if (n->type == NODE16)
+    return ((node16_t *)n)->children[0];
+  void **children = n->type == NODE48 ? ((node48_t *)n)->children
+                                      : ((node256_t *)n)->children;
+  int max = n->type == NODE48 ? 48 : 256;
+  for (int i = 0; i < max; i++)
+    if (children[i])
+      return children[i];
+  return NULL;
+}
+
+/* the number of bytes of the prefix of n which match key[depth..len) */
+static inline uint32_t prefix_match(node_t *n, const uint8_t *key, size_t len,
+                                    size_t depth) {
+  uint32_t i = 0;
+  while (i < n->prefix_len && depth + i < len &&
+         n->prefix[i] == key[depth + i])
+    i++;
+  return i;
+}
+
+bool ac_radix_tree_insert(ac_radix_tree_t *h, const void *key, size_t len,
+                          void *value) {
+  const uint8_t *k = (const uint8_t *)key;
+  void **ref = (void **)&h->root;
+  size_t depth = 0;
+  while (true) {
+    void *c = *ref;
+    if (is_leaf(c)) {
+      /* the bytes before depth match since they were on the path */
+      leaf_t *l = to_leaf(c);
+      if (l->len == len && !memcmp(l->key + depth, k + depth, len - depth)) {
+        l->value = value;
+        return false;
+      }
+      leaf_t *nl = new_leaf(h, key, len, value);
+      size_t p = depth;
+      size_t limit = l->len < len ? l->len : len;
+      while (p < limit && l->key[p] == k[p])
+        p++;
+      if (p - depth > UINT32_MAX)
+        abort();
+      node_t *n = new_node(h, NODE4);
+      n->prefix = nl->key + depth;
+      n->prefix_len = p - depth;
+      if (l->len == p)
+        n->leaf = l;
+      else
+        add_child(h, ref, n, l->key[p], c);
+      if (len == p)
+        n->leaf = nl;
+      else
+        add_child(h, ref, n, k[p], leaf_ref(nl));
+      *ref = n;
+      h->count++;
+      return true;
+    }
+    node_t *n = (node_t *)c;
+    if (n->prefix_len) {
+      uint32_t m = prefix_match(n, k, len, depth);
+      if (m < n->prefix_len) {
+        /* split the prefix at m */
+        leaf_t *nl = new_leaf(h, key, len, value);
+        node_t *s = new_node(h, NODE4);
+        s->prefix = n->prefix;
+        s->prefix_len = m;
+        uint8_t b = n->prefix[m];
+        n->prefix += m + 1;
+        n->prefix_len -= m + 1;
+        add_child(h, ref, s, b, n);
+        if (depth + m == len)
+          s->leaf = nl;
+        else
+          add_child(h, ref, s, k[depth + m], leaf_ref(nl));
+        *ref = s;
+        h->count++;
+        return true;
+      }
+      depth += n->prefix_len;
+    }
+    if (depth == len) {
+      if (n->leaf) {
+        n->leaf->value = value;
+        return false;
+      }
+      n->leaf = new_leaf(h, key, len, value);
+      h->count++;
+      return true;
+    }
+    void **slot = find_child(n, k[depth]);
+    if (!slot) {
+      add_child(h, ref, n, k[depth], leaf_ref(new_leaf(h, key, len, value)));
+      h->count++;
+      return true;
+    }
+    ref = slot;
+    depth++;
+  }
+}
+
+void *ac_radix_tree_find(ac_radix_tree_t *h, const void *key, size_t len) {
+  const uint8_t *k = (const uint8_t *)key;
+  void *c = h->root;
+  size_t depth = 0;
+  while (true) {
+    if (is_leaf(c)) {
+      leaf_t *l = to_leaf(c);
+      if (l->len == len && !memcmp(l->key + depth, k + depth, len - depth))
+        return l->value;
+      return NULL;
+    }
+    node_t *n = (node_t *)c;
+    if (n->prefix_len) {
+      if (len - depth < n->prefix_len ||
+          memcmp(n->prefix, k + depth, n->prefix_len))
+        return NULL;
+      depth += n->prefix_len;
+    }
+    if (depth == len)
+      return n->leaf ? n->leaf->value : NULL;
+    void **slot = find_child(n, k[depth]);
+    if (!slot)
+      return NULL;
+    c = *slot;
+    depth++;
+  }
+}
+
+void *ac_radix_tree_longest_prefix(ac_radix_tree_t *h, const void *key,
+                                   size_t len, size_t *matched) {
+  const uint8_t *k = (const uint8_t *)key;
+  leaf_t *best = NULL;
+  void *c = h->root;
+  size_t depth = 0;
+  while (true) {
+    if (is_leaf(c)) {
+      leaf_t *l = to_leaf(c);
+      if (l->len <= len && !memcmp(l->key + depth, k + depth, l->len - depth))
+        best = l;
+      break;
+    }
+    node_t *n = (node_t *)c;
+    if (n->prefix_len) {
+      if (len - depth < n->prefix_len ||
+          memcmp(n->prefix, k + depth, n->prefix_len))
+        break;
+      depth += n->prefix_len;
+    }
+    if (n->leaf)
+      best = n->leaf;
+    if (depth == len)
+      break;
+    void **slot = find_child(n, k[depth]);
+    if (!slot)
+      break;
+    c = *slot;
+    depth++;
+  }
+  if (matched)
+    *matched = best ? best->len : 0;
+  return best ? best->value : NULL;
+}
+
+/* returns 0 if the key isn't found, 1 if it is erased, and 2 if the child
+   in *ref must be removed from its parent */
+static int erase_key(ac_radix_tree_t *h, void **ref, const uint8_t *key,
+                     size_t len, size_t depth) {
+  void *c = *ref;
+  if (is_leaf(c)) {
+    leaf_t *l = to_leaf(c);
+    if (l->len == len && !memcmp(l->key + depth, key + depth, len - depth))
+      return 2;
+    return 0;
+  }
+  node_t *n = (node_t *)c;
+  if (n->prefix_len) {
+    if (len - depth < n->prefix_len ||
+        memcmp(n->prefix, key + depth, n->prefix_len))
+      return 0;
+    depth += n->prefix_len;
+  }
+  if (depth == len) {
+    if (!n->leaf)
+      return 0;
+    n->leaf = NULL;
+  } else {
+    void **slot = find_child(n, key[depth]);
+    if (!slot)
+      return 0;
+    int r = erase_key(h, slot, key, len, depth + 1);
+    if (r != 2)
+      return r;
+    remove_child(n, slot, key[depth]);
+  }
+  if (n == h->root)
+    return 1;
+  /* a node with a single key is replaced by the key's leaf (leaves hold the
+     whole key, so they can be anywhere below the bytes which they match) */
+  void *single = NULL;
+  if (!n->num_children && n->leaf)
+    single = leaf_ref(n->leaf);
+  else if (n->num_children == 1 && !n->leaf) {
+    single = only_child(n);
+    if (!is_leaf(single))
+      return 1;
+  } else if (n->num_children || n->leaf)
+    return 1;
+  free_node(h, n);
+  if (!single)
+    return 2;
+  *ref = single;
+  return 1;
+}
+
+bool ac_radix_tree_erase(ac_radix_tree_t *h, const void *key, size_t len) {
+  if (!erase_key(h, (void **)&h->root, (const uint8_t *)key, len, 0))
+    return false;
+  h->count--;
+  return true;
+}
+
+typedef struct {
+  ac_radix_tree_f cb;
+  void *arg;
+  const uint8_t *start, *end, *prefix;
+  size_t start_len, end_len, prefix_len;
+  size_t count;
+} scan_t;
+
+static inline int compare_keys(const uint8_t *a, size_t a_len,
+                               const uint8_t *b, size_t b_len) {
+  int n = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (n)
+    return n;
+  return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+/* keys arrive in order, so the first key past the end stops the scan */
+static inline bool emit(scan_t *s, leaf_t *l) {
+  if (s->end && compare_keys(l->key, l->len, s->end, s->end_len) >= 0)
+    return false;
+  if (s->prefix &&
+      (l->len < s->prefix_len || memcmp(l->key, s->prefix, s->prefix_len)))
+    return false;
+  s->count++;
+  return s->cb(l->key, l->len, l->value, s->arg);
+}
+
+/* lo is true while the path to c matches start, so that keys less than
+   start are skipped */
+static bool scan(scan_t *s, void *c, size_t depth, bool lo) {
+  if (is_leaf(c)) {
+    leaf_t *l = to_leaf(c);
+    if (lo && compare_keys(l->key, l->len, s->start, s->start_len) < 0)
+      return true;
+    return emit(s, l);
+  }
+  node_t *n = (node_t *)c;
+  if (lo) {
+    for (uint32_t i = 0; i < n->prefix_len; i++) {
+      if (depth + i == s->start_len) {
+        lo = false;
+        break;
+      }
+      if (n->prefix[i] != s->start[depth + i]) {
+        if (n->prefix[i] < s->start[depth + i])
+          return true;
+        lo = false;
+        break;
+      }
+    }
+  }
+  depth += n->prefix_len;
+  if (lo && depth == s->start_len)
+    lo = false;
+  /* a key which ends at n is less than start if lo is still true */
+  if (n->leaf && !lo && !emit(s, n->leaf))
+    return false;
+  if (!n->num_children)
+    return true;
+  int from = lo ? s->start[depth] : 0;
+  switch (n->type) {
+  case NODE4:
+  case NODE16: {
+    uint8_t *keys = n->type == NODE4 ? ((node4_t *)n)->keys
+                                     : ((node16_t *)n)->keys;
+    void **children = n->type == NODE4 ? ((node4_t *)n)->children
+                                       : ((node16_t *)n)->children;
+    for (int i = 0; i < n->num_children; i++) {
+      if (keys[i] < from)
+        continue;
+      if (!scan(s, children[i], depth + 1, lo && keys[i] == from))
+        return false;
+    }
+    return true;
+  }
+  case NODE48: {
+    node48_t *p = (node48_t *)n;
+    for (int b = from; b < 256; b++) {
+      if (p->index[b] && !scan(s, p->children[p->index[b] - 1], depth + 1,
+                               lo && b == from))
+        return false;
+    }
+    return true;
+  }
+  default: {
+    node256_t *p = (node256_t *)n;
+    for (int b = from; b < 256; b++) {
+      if (p->children[b] &&
+          !scan(s, p->children[b], depth + 1, lo && b == from))
+        return false;
+    }
+    return true;
+  }
+  }
+}
+
+size_t ac_radix_tree_prefix(ac_radix_tree_t *h, const void *prefix,
+                            size_t len, ac_radix_tree_f cb, void *arg) {
+  scan_t s;
+  memset(&s, 0, sizeof(s));
+  s.cb = cb;
+  s.arg = arg;
+  s.start = s.prefix = (const uint8_t *)prefix;
+  s.start_len = s.prefix_len = len;
+  if (!len)
+    s.prefix = NULL;
+  scan(&s, h->root, 0, len > 0);
+  return s.count;
+}
+
+size_t ac_radix_tree_range(ac_radix_tree_t *h, const void *start,
+                           size_t start_len, const void *end, size_t end_len,
+                           ac_radix_tree_f cb, void *arg) {
+  scan_t s;
+  memset(&s, 0, sizeof(s));
+  s.cb = cb;
+  s.arg = arg;
+  s.start = (const uint8_t *)start;
+  s.start_len = start_len;
+  s.end = (const uint8_t *)end;
+  s.end_len = end_len;
+  scan(&s, h->root, 0, s.start != NULL);
+  return s.count;
+}
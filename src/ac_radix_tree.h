@@ -0,0 +1,107 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_radix_tree_H
+#define _ac_radix_tree_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_radix_tree_t maps byte string keys to values with an adaptive radix
+  tree (ART).  Each inner node branches on one byte of the key and holds the
+  bytes which all of its keys share (the prefix) so that a lookup checks
+  each of those bytes once instead of comparing whole strings at every
+  level like a binary tree.  Inner nodes start with room for 4 children and
+  grow to 16, 48, and 256 children as they fill, which keeps sparse nodes
+  small.  The 16 way nodes are searched with SSE2 when it is available.  A
+  key which ends at an inner node (such as "ab" when "abc" is also in the
+  tree) is kept in the node itself, so keys don't need a terminator.
+
+  The nodes and the copies of the keys are allocated from a pool owned by
+  the tree.  Nodes which are replaced by a bigger node are reused, but
+  erasing a key doesn't free memory (it is released by ac_radix_tree_clear
+  and ac_radix_tree_destroy).  Keys are visited in lexicographic (memcmp)
+  order with shorter keys first.  The tree isn't thread-safe.
+*/
+struct ac_radix_tree_s;
+typedef struct ac_radix_tree_s ac_radix_tree_t;
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_radix_tree_init()                                                   \
+  _ac_radix_tree_init(AC_FILE_LINE_MACRO("ac_radix_tree"))
+ac_radix_tree_t *_ac_radix_tree_init(const char *caller);
+#else
+#define ac_radix_tree_init() _ac_radix_tree_init()
+ac_radix_tree_t *_ac_radix_tree_init(void);
+#endif
+
+/* removes every key (and releases the memory of the pool) */
+void ac_radix_tree_clear(ac_radix_tree_t *h);
+
+void ac_radix_tree_destroy(ac_radix_tree_t *h);
+
+/* the number of keys in the tree */
+size_t ac_radix_tree_count(ac_radix_tree_t *h);
+
+/* the bytes which are used by the nodes and the keys */
+size_t ac_radix_tree_bytes(ac_radix_tree_t *h);
+
+/* adds key[0..len) with value and returns true.  If the key already exists,
+   its value is replaced and false is returned. */
+bool ac_radix_tree_insert(ac_radix_tree_t *h, const void *key, size_t len,
+                          void *value);
+
+/* the value of key[0..len) or NULL if it isn't in the tree */
+void *ac_radix_tree_find(ac_radix_tree_t *h, const void *key, size_t len);
+
+/* removes key[0..len) and returns true if it was found */
+bool ac_radix_tree_erase(ac_radix_tree_t *h, const void *key, size_t len);
+
+/* returns the value of the longest key in the tree which is a prefix of
+   key[0..len) (or NULL if there isn't one) and sets *matched to its length
+   if matched isn't NULL.  This is the lookup that routing tables need. */
+void *ac_radix_tree_longest_prefix(ac_radix_tree_t *h, const void *key,
+                                   size_t len, size_t *matched);
+
+/* keys passed to the callback stay valid until the tree is cleared or
+   destroyed.  Returning false stops the iteration. */
+typedef bool (*ac_radix_tree_f)(const void *key, size_t len, void *value,
+                                void *arg);
+
+/* calls cb for each key which begins with prefix[0..len) in order and
+   returns the number of keys passed to cb (len can be 0 for all keys) */
+size_t ac_radix_tree_prefix(ac_radix_tree_t *h, const void *prefix,
+                            size_t len, ac_radix_tree_f cb, void *arg);
+
+/* calls cb for each key in [start, end) in order and returns the number of
+   keys passed to cb.  A NULL start begins with the first key and a NULL end
+   continues to the last. */
+size_t ac_radix_tree_range(ac_radix_tree_t *h, const void *start,
+                           size_t start_len, const void *end, size_t end_len,
+                           ac_radix_tree_f cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_ratelimit.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY 0
+/* the key of a slot which is being given to another key */
+#define BUSY 1
+
+typedef struct {
+  uint64_t key;
+  uint64_t full_at;
+} slot_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  slot_t *slots;
+  size_t mask;
+} __attribute__((aligned(64))) shard_t;
+
+struct ac_ratelimit_s {
+  shard_t *shards;
+  size_t num_shards;
+  uint32_t shard_bits;
+  uint64_t interval;
+  uint64_t tolerance;
+};
+
+static void bucket_params(double rate, double burst, uint64_t *interval,
+                          uint64_t *tolerance) {
+  double ns = 1000000000.0 / rate;
+  *interval = ns < 1.0 ? 1 : (uint64_t)ns;
+  *tolerance = (uint64_t)(burst * (double)*interval);
+}
+
+void ac_ratelimit_bucket_init(ac_ratelimit_bucket_t *b, double rate,
+                              double burst) {
+  b->full_at = 0;
+  bucket_params(rate, burst, &b->interval, &b->tolerance);
+}
+
+static uint64_t wait_ns(uint64_t full_at, uint64_t interval,
+                        uint64_t tolerance, uint64_t now, uint32_t tokens) {
+  uint64_t cost;
+  if (__builtin_mul_overflow(interval, (uint64_t)tokens, &cost) ||
+      cost > tolerance)
+    return UINT64_MAX;
+  uint64_t next = (full_at > now ? full_at : now) + cost;
+  return next - now > tolerance ? next - now - tolerance : 0;
+}
+
+uint64_t ac_ratelimit_bucket_wait_ns(ac_ratelimit_bucket_t *b,
+                                     uint32_t tokens) {
+  return wait_ns(__atomic_load_n(&b->full_at, __ATOMIC_RELAXED), b->interval,
+                 b->tolerance, ac_timer_now_ns(), tokens);
+}
+
+static inline uint64_t hash_bytes(const void *s, size_t len) {
+  const unsigned char *p = (const unsigned char *)s;
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    h = (h ^ (v * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 31;
+    p += 8;
+    len -= 8;
+  }
+  uint64_t v = 0;
+  memcpy(&v, p, len);
+  h = (h ^ (v * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 32;
+  /* EMPTY and BUSY aren't keys */
+  return h > BUSY ? h : h + 2;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_ratelimit_t *_ac_ratelimit_init(size_t num_shards, size_t max_keys,
+                                   double rate, double burst,
+                                   const char *caller) {
+  ac_ratelimit_t *h = (ac_ratelimit_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_ratelimit_t), false);
+#else
+ac_ratelimit_t *_ac_ratelimit_init(size_t num_shards, size_t max_keys,
+                                   double rate, double burst) {
+  ac_ratelimit_t *h = (ac_ratelimit_t *)ac_calloc(sizeof(ac_ratelimit_t));
+#endif
+  if (!h)
+    abort();
+  h->num_shards = 1;
+  while (h->num_shards < num_shards) {
+    h->num_shards <<= 1;
+    h->shard_bits++;
+  }
+  bucket_params(rate, burst, &h->interval, &h->tolerance);
+  /* twice as many slots as keys keeps the probes short */
+  size_t per_shard = (max_keys + h->num_shards - 1) / h->num_shards;
+  size_t capacity = AC_RATELIMIT_PROBES;
+  while (capacity < per_shard * 2)
+    capacity <<= 1;
+  h->shards = (shard_t *)ac_malloc(sizeof(shard_t) * h->num_shards);
+  if (!h->shards)
+    abort();
+  for (size_t i = 0; i < h->num_shards; i++) {
+    shard_t *s = h->shards + i;
+    pthread_mutex_init(&s->mutex, NULL);
+    s->slots = (slot_t *)ac_calloc(sizeof(slot_t) * capacity);
+    if (!s->slots)
+      abort();
+    s->mask = capacity - 1;
+  }
+  return h;
+}
+
+void ac_ratelimit_destroy(ac_ratelimit_t *h) {
+  if (!h)
+    return;
+  for (size_t i = 0; i < h->num_shards; i++) {
+    pthread_mutex_destroy(&h->shards[i].mutex);
+    ac_free(h->shards[i].slots);
+  }
+  ac_free(h->shards);
+  ac_free(h);
+}
+
+/* slots are never emptied, so the probe stops at the first empty slot */
+static slot_t *find_slot(shard_t *s, uint64_t key, size_t start) {
+  for (size_t i = 0; i < AC_RATELIMIT_PROBES; i++) {
+    slot_t *slot = s->slots + ((start + i) & s->mask);
+    uint64_t k = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (k == key)
+      return slot;
+    if (k == EMPTY)
+      return NULL;
+  }
+  return NULL;
+}
+
+/* takes tokens from the bucket in slot unless the slot is given to another
+   key first (returns -1 then) */
+static int take_slot(ac_ratelimit_t *h, slot_t *slot, uint64_t key,
+                     uint64_t now, uint32_t tokens) {
+  uint64_t cost;
+  if (__builtin_mul_overflow(h->interval, (uint64_t)tokens, &cost) ||
+      cost > h->tolerance)
+    return 0;
+  uint64_t cur = __atomic_load_n(&slot->full_at, __ATOMIC_ACQUIRE);
+  while (true) {
+    /* a slot which is given to another key is marked BUSY before its time
+       changes, so if the key still matches, cur was the key's time and the
+       swap below only succeeds if the slot still has it */
+    if (__atomic_load_n(&slot->key, __ATOMIC_RELAXED) != key)
+      return -1;
+    uint64_t next = (cur > now ? cur : now) + cost;
+    if (next - now > h->tolerance)
+      return 0;
+    if (__atomic_compare_exchange_n(&slot->full_at, &cur, next, true,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      return 1;
+  }
+}
+
+/* gives a slot to key, the shard must be locked */
+static slot_t *claim_slot(shard_t *s, uint64_t key, size_t start,
+                          uint64_t now) {
+  slot_t *best = NULL;
+  for (size_t i = 0; i < AC_RATELIMIT_PROBES; i++) {
+    slot_t *slot = s->slots + ((start + i) & s->mask);
+    if (slot->key == EMPTY) {
+      best = slot;
+      break;
+    }
+    /* the bucket which is the most full */
+    if (!best || __atomic_load_n(&slot->full_at, __ATOMIC_RELAXED) <
+                     __atomic_load_n(&best->full_at, __ATOMIC_RELAXED))
+      best = slot;
+  }
+  __atomic_store_n(&best->key, BUSY, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  /* a new bucket is full (now rather than 0 so that the time differs from
+     any time the slot had before) */
+  __atomic_store_n(&best->full_at, now, __ATOMIC_RELAXED);
+  __atomic_store_n(&best->key, key, __ATOMIC_RELEASE);
+  return best;
+}
+
+static slot_t *get_slot(ac_ratelimit_t *h, uint64_t key, uint64_t now) {
+  shard_t *s = h->shards + (key & (h->num_shards - 1));
+  size_t start = (size_t)(key >> h->shard_bits);
+  slot_t *slot = find_slot(s, key, start);
+  if (slot)
+    return slot;
+  pthread_mutex_lock(&s->mutex);
+  slot = find_slot(s, key, start);
+  if (!slot)
+    slot = claim_slot(s, key, start, now);
+  pthread_mutex_unlock(&s->mutex);
+  return slot;
+}
+
+bool ac_ratelimit_take(ac_ratelimit_t *h, const void *key, size_t key_length,
+                       uint32_t tokens) {
+  uint64_t k = hash_bytes(key, key_length);
+  uint64_t now = ac_timer_now_ns();
+  while (true) {
+    int r = take_slot(h, get_slot(h, k, now), k, now, tokens);
+    if (r >= 0)
+      return r > 0;
+  }
+}
+
+uint64_t ac_ratelimit_wait_ns(ac_ratelimit_t *h, const void *key,
+                              size_t key_length, uint32_t tokens) {
+  uint64_t k = hash_bytes(key, key_length);
+  shard_t *s = h->shards + (k & (h->num_shards - 1));
+  slot_t *slot = find_slot(s, k, (size_t)(k >> h->shard_bits));
+  uint64_t full_at =
+      slot ? __atomic_load_n(&slot->full_at, __ATOMIC_ACQUIRE) : 0;
+  if (slot && __atomic_load_n(&slot->key, __ATOMIC_RELAXED) != k)
+    full_at = 0;
+  return wait_ns(full_at, h->interval, h->tolerance, ac_timer_now_ns(),
+                 tokens);
+}
@@ -0,0 +1,115 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_ratelimit_H
+#define _ac_ratelimit_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_timer.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Token buckets for throttling (such as the requests of each client in an
+  ac_http_server handler or the submissions to an ac_threaded_pipe).  A
+  bucket holds up to burst tokens and refills at rate tokens per second, a
+  take of n tokens succeeds if the bucket has them.
+
+  A bucket is kept as a single 64 bit time (the generic cell rate algorithm):
+  the time at which the bucket will be full again.  The refill is lazy, a
+  take compares that time to now and moves it forward with one compare and
+  swap, so there is no background thread and buckets which aren't used cost
+  nothing.  The time is ac_timer_now_ns.
+
+  ac_ratelimit_bucket_t is one bucket (embedded wherever it is needed).
+  ac_ratelimit_t is a table of buckets by key which all share a rate and
+  burst.  The table is split into shards, each an open addressing table with
+  a fixed number of slots.  A take of a key which is in the table only reads
+  its slot and swaps the time, a new key takes the shard's mutex to claim a
+  slot.  When the AC_RATELIMIT_PROBES slots which a new key may use are all
+  taken, the key replaces the one whose bucket is the most full (a full
+  bucket is the same as a new one, so as long as the table has room for the
+  keys which are active, nothing is lost).  Keys are identified by a 64 bit
+  hash of their bytes, so two keys which collide share a bucket.  Every
+  function is thread-safe.
+*/
+
+#ifndef AC_RATELIMIT_PROBES
+#define AC_RATELIMIT_PROBES 16
+#endif
+
+typedef struct {
+  uint64_t full_at;
+  uint64_t interval;
+  uint64_t tolerance;
+} ac_ratelimit_bucket_t;
+
+/* rate is the tokens per second and burst the size of the bucket (the
+   bucket starts full) */
+void ac_ratelimit_bucket_init(ac_ratelimit_bucket_t *b, double rate,
+                              double burst);
+
+/* returns true if tokens were taken from the bucket */
+static inline bool ac_ratelimit_bucket_take(ac_ratelimit_bucket_t *b,
+                                            uint32_t tokens);
+
+/* the nanoseconds until tokens can be taken (0 if they can be now) */
+uint64_t ac_ratelimit_bucket_wait_ns(ac_ratelimit_bucket_t *b,
+                                     uint32_t tokens);
+
+struct ac_ratelimit_s;
+typedef struct ac_ratelimit_s ac_ratelimit_t;
+
+/* max_keys is the number of keys which can be tracked at once (split over
+   num_shards shards, num_shards is rounded up to a power of two) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_ratelimit_init(num_shards, max_keys, rate, burst)                   \
+  _ac_ratelimit_init(num_shards, max_keys, rate, burst,                        \
+                     AC_FILE_LINE_MACRO("ac_ratelimit"))
+ac_ratelimit_t *_ac_ratelimit_init(size_t num_shards, size_t max_keys,
+                                   double rate, double burst,
+                                   const char *caller);
+#else
+#define ac_ratelimit_init(num_shards, max_keys, rate, burst)                   \
+  _ac_ratelimit_init(num_shards, max_keys, rate, burst)
+ac_ratelimit_t *_ac_ratelimit_init(size_t num_shards, size_t max_keys,
+                                   double rate, double burst);
+#endif
+
+void ac_ratelimit_destroy(ac_ratelimit_t *h);
+
+/* returns true if tokens were taken from key's bucket */
+bool ac_ratelimit_take(ac_ratelimit_t *h, const void *key, size_t key_length,
+                       uint32_t tokens);
+
+/* the nanoseconds until tokens can be taken from key's bucket (0 if they
+   can be now), for a Retry-After header or a producer which backs off */
+uint64_t ac_ratelimit_wait_ns(ac_ratelimit_t *h, const void *key,
+                              size_t key_length, uint32_t tokens);
+
+#include "impl/ac_ratelimit.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
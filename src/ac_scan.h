@@ -0,0 +1,98 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_scan_H
+#define _ac_scan_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Scanning text sixteen bytes at a time
+  =====================================================================
+
+  Parsers spend most of their time looking for the next delimiter and
+  comparing names without case.  These helpers do both with SSE2 (or NEON)
+  and fall back to a byte at a time elsewhere.  They only read within
+  the ranges they are given.
+
+  ac_scan_set_t is a set of up to AC_SCAN_SET_MAX bytes, so that
+
+    ac_scan_set_t set;
+    ac_scan_set_init(&set, ":\r\n ");
+    const char *p = ac_scan_find(s, s + length, &set);
+
+  finds the first colon, carriage return, line feed, or space in s.
+*/
+
+/* true if the length bytes at a and b are equal ignoring ASCII case */
+static inline bool ac_scan_equal_nocase(const char *a, const char *b,
+                                        size_t length);
+
+#define AC_SCAN_SET_MAX 8
+
+typedef struct {
+  uint8_t bytes[AC_SCAN_SET_MAX];
+  uint32_t num;
+  /* the bytes as a bitmap (for the tail and non-SIMD targets) */
+  uint64_t bits[4];
+} ac_scan_set_t;
+
+/* the set of bytes in chars (which aborts if it has more than
+   AC_SCAN_SET_MAX) */
+static inline void ac_scan_set_init(ac_scan_set_t *set, const char *chars);
+
+/* the first byte in p..ep which is in set, or NULL */
+static inline const char *ac_scan_find(const char *p, const char *ep,
+                                       const ac_scan_set_t *set);
+
+/* the first occurrence of "\r\n" in p..ep, or NULL */
+static inline const char *ac_scan_find_crlf(const char *p, const char *ep);
+
+/*
+  An HTTP style header line.  The value has any spaces after the colon
+  removed.  value is NULL if the line doesn't have a colon.  The name is
+  everything before the colon.  space_before_colon is set if the name ends
+  in a space or tab, which RFC 7230 3.2.4 requires a server to reject (a
+  proxy might read the header differently).
+*/
+typedef struct {
+  const char *name;
+  size_t name_length;
+  const char *value;
+  size_t value_length;
+  bool space_before_colon;
+} ac_scan_header_t;
+
+/* tokenizes the header line at p (lines end in "\r\n", the last may end at
+   ep) in one pass and returns the start of the next line (ep after the
+   last) */
+static inline const char *ac_scan_header(const char *p, const char *ep,
+                                         ac_scan_header_t *h);
+
+#include "impl/ac_scan.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
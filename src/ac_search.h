@@ -67,6 +67,58 @@ limitations under the License.
                                         const datatype *v,
                                         void *arg),
                             void *arg);
+
+  Bounds for primitive keys
+  =====================================================================
+
+  The generated searches call compare and branch on its result, which the
+  processor can't predict.  For arrays of primitive types, these functions
+  compare directly and select the next half with a conditional move.  The
+  last AC_SEARCH_LINEAR_CUTOFF (16) elements are finished with a count that
+  the compiler vectorizes.  Floating point arrays must not contain NaN.
+
+  type *ac_search_lower_bound_<suffix>(type key, type *base,
+                                       size_t num_elements);
+    returns the first element which is not less than key
+
+  type *ac_search_upper_bound_<suffix>(type key, type *base,
+                                       size_t num_elements);
+    returns the first element which is greater than key
+
+    both return base + num_elements if there is no such element
+
+  suffix / type: int32 / int32_t, uint32 / uint32_t, int64 / int64_t,
+                 uint64 / uint64_t, float / float, double / double
+
+  Batch search macros
+  =====================================================================
+
+  These look up many keys in one sorted array and fill res with one result
+  per key.  The _m versions return the equal element or NULL like
+  ac_search_m.  The _lower_bound_m versions return the first element which
+  is not less than the key (or base + num_elements) like
+  ac_search_lower_bound_m.
+
+  ac_search_batch_m(name, keytype, datatype, compare)
+  ac_search_batch_lower_bound_m(name, keytype, datatype, compare)
+
+    The keys must be sorted.  Each search gallops (an exponential search)
+    forward from the previous result, so keys which land close together
+    cost only a few comparisons each.
+
+  ac_search_batch_unsorted_m(name, keytype, datatype, compare)
+  ac_search_batch_unsorted_lower_bound_m(name, keytype, datatype, compare)
+
+    The keys may be in any order.  AC_SEARCH_BATCH_GROUP (8) keys are
+    searched together with their steps interleaved, and the next probe of
+    each is prefetched.
+
+    expects: int compare(const keytype *k, const datatype *v);
+    returns: void name(keytype *keys, size_t num_keys, datatype *base,
+                       size_t num_elements, datatype **res);
+
+  ac_eytzinger.h has faster searches for sorted arrays which don't change.
+  ac_learned_index.h is faster still for arrays of near-uniform numeric keys.
 */
 
 #include "impl/ac_search.h"
@@ -0,0 +1,92 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_select_H
+#define _ac_select_H
+
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Selection macros
+  =====================================================================
+
+  These are for when only part of a sorted order is needed (the median, the
+  first page of results, the top 100 of a leaderboard, ...).  The compare
+  functions are the same as the ones used with ac_sort_m and the variants
+  follow the same pattern (_arg, _compare, and _compare_arg).  "Top" means
+  first in sorted order, so to get the greatest elements use a compare
+  function which sorts in descending order.
+
+  ac_select_m(name, type, compare)
+    expects: int compare(const type *a, const type *b);
+    returns: void name(type *base, size_t num_elements, size_t nth);
+
+    Rearranges base so that base[nth] is the element which would be there
+    if base were sorted.  No element before nth is greater than it and no
+    element after is less.  This is an introselect which is O(n) on
+    average.  Nothing is done if nth >= num_elements.
+
+  ac_partial_sort_m(name, type, compare)
+    expects: int compare(const type *a, const type *b);
+    returns: void name(type *base, size_t num_elements, size_t k);
+
+    Sorts the k least elements into base[0..k), the order of the rest is
+    unspecified.  The cost is O(n + k log k).
+
+  ac_topk_m(name, type, compare)
+    expects: int compare(const type *a, const type *b);
+    returns: size_t name(type *res, size_t k, type *base,
+                         size_t num_elements);
+
+    Copies the k least elements of base into res in sorted order and returns
+    the number copied (the lesser of k and num_elements).  base is not
+    modified.  A heap of k elements is kept in res, so the cost is
+    O(n log k) but typically close to one comparison per element when k is
+    small.  This is the better choice when base must not be rearranged.
+
+  The other variants add arguments in the same order as ac_sort_m.
+
+  ac_select_arg_m(name, type, compare)
+    expects: int compare(const type *a, const type *b, void *arg);
+    returns: void name(type *base, size_t num_elements, size_t nth,
+                       void *arg);
+
+  ac_select_compare_m(name, type)
+    returns: void name(type *base, size_t num_elements, size_t nth,
+                       int compare(const type *a, const type *b));
+
+  ac_select_compare_arg_m(name, type)
+    returns: void name(type *base, size_t num_elements, size_t nth,
+                       int compare(const type *a, const type *b, void *arg),
+                       void *arg);
+
+  ac_partial_sort_arg_m, ac_partial_sort_compare_m,
+  ac_partial_sort_compare_arg_m, ac_topk_arg_m, ac_topk_compare_m, and
+  ac_topk_compare_arg_m are alike.  There are matching _def macros for
+  declaring each of the functions in a header.
+*/
+
+#include "impl/ac_select.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
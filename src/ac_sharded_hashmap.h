@@ -0,0 +1,96 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_sharded_hashmap_H
+#define _ac_sharded_hashmap_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_slab.h"
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_sharded_hashmap is a hash map which many threads can read and write at
+  once, meant for a cache which the workers of an ac_threaded_pipe share
+  (such as memoized results).  The hash of the key selects one of num_shards
+  shards.  Each shard is an open addressing (linear probing) table with its
+  own mutex for writers and a sequence number which a writer makes odd while
+  it changes the shard.  Readers don't take the mutex, they copy the item out
+  and retry if the sequence number changed (falling back to the mutex after
+  AC_SHARDED_HASHMAP_RETRIES tries), so reads of different keys (or of the
+  same key) never write to shared memory.
+
+  The map stores copies of the items in entries which are allocated from an
+  ac_slab.  Since a reader may compare the key of an entry which is being
+  replaced or freed, equal must only look at the datatype itself (datatype
+  should be a flat structure holding the key and the value, anything it
+  points to is copied as a pointer).
+
+  Each shard holds up to max_bytes / num_shards bytes of entries (but at
+  least one entry).  Its table is allocated up front with twice as many
+  slots as entries and is never resized.  Once a shard is full, an insert
+  evicts an entry with the CLOCK algorithm (an entry which was found since
+  the clock hand last passed it gets a second chance).
+
+  Like the other containers, the functions are generated with macros.  Place
+  ac_sharded_hashmap_def where the declarations are needed and
+  ac_sharded_hashmap_m in one source file.
+
+  ac_sharded_hashmap_def(name, keytype, datatype)
+  ac_sharded_hashmap_m(name, keytype, datatype, hash, equal)
+    expects: size_t hash(const keytype *key);
+             bool equal(const keytype *key, const datatype *d);
+
+    defines: name_t (the map)
+
+    num_shards is rounded up to a power of two
+    void name_init(name_t *h, size_t num_shards, size_t max_bytes);
+    void name_destroy(name_t *h);
+
+    copies the item which matches key to res and returns true, or returns
+    false if there isn't one
+    bool name_find(name_t *h, const keytype *key, datatype *res);
+
+    copies d (which must match key) into the map, replacing the item which
+    matches key if there is one.  Returns false if an item was replaced.
+    bool name_insert(name_t *h, const keytype *key, const datatype *d);
+
+    returns false if no item matches key
+    bool name_erase(name_t *h, const keytype *key);
+
+    the number of items (approximate while other threads are writing)
+    size_t name_size(name_t *h);
+
+  The hash should mix all of its bits well, the low bits select the shard
+  and the bits above them the slot.
+*/
+
+#ifndef AC_SHARDED_HASHMAP_RETRIES
+#define AC_SHARDED_HASHMAP_RETRIES 16
+#endif
+
+#include "impl/ac_sharded_hashmap.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,515 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ac_shm_pipe.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SHM_PIPE_MAGIC 0x6163736870697031ULL /* "acshpip1" */
+#define SHM_PIPE_PAGE 4096
+
+/* the free list holds a buffer's number (plus one, so zero is empty)
+   below a tag which every pop increments, so a pop which read a buffer's
+   next before another process popped and pushed it again fails its compare
+   and swap */
+#define INDEX_MASK 0xFFFFFFFFULL
+#define TAG_ONE (1ULL << 32)
+
+/* a futex word and the number of threads which have started waiting on it
+   since the last wake up.  The word only changes (and the wake up system
+   call is only made) when someone is waiting, and the waker takes the count,
+   so the writes after a wake up don't make the system call again while the
+   reader is still being scheduled. */
+typedef struct {
+  uint32_t seq;
+  uint32_t waiters;
+  char pad[56];
+} waitq_t;
+
+typedef struct {
+  uint64_t seq;
+  uint64_t offset;
+  uint64_t length;
+} cell_t;
+
+typedef struct {
+  uint64_t magic;
+  uint64_t size;
+  uint64_t mask;
+  uint64_t ring_offset;
+  uint64_t arena_offset;
+  uint64_t buffer_size;
+  uint64_t num_buffers;
+  uint32_t closed;
+  char pad1[64];
+  uint64_t enqueue_pos;
+  char pad2[64];
+  uint64_t dequeue_pos;
+  char pad3[64];
+  /* buffers which have been carved from the arena */
+  uint64_t buffers_used;
+  char pad4[64];
+  uint64_t free_buffers;
+  char pad5[64];
+  waitq_t readable;
+  waitq_t ring_space;
+  waitq_t arena_space;
+} header_t;
+
+struct ac_shm_pipe_s {
+  header_t *header;
+  char *base;
+  cell_t *cells;
+  size_t size;
+  int fd;
+  /* set in the creator of a named segment, which unlinks it */
+  char *name;
+};
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(uint32_t *addr, uint32_t value) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr, int num) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, num, NULL, NULL, 0);
+}
+
+/* called after the change a waiter may be waiting for.  The full fence
+   pairs with the one in begin_wait, so either the waiter sees the change
+   when it checks again or this sees the waiter. */
+static inline void wake(waitq_t *w) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->waiters, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&w->waiters, 0, __ATOMIC_ACQ_REL)) {
+    __atomic_fetch_add(&w->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&w->seq, INT_MAX);
+  }
+}
+
+/* the waiter checks again after begin_wait and sleeps with end_wait.  The
+   sleep returns at once if the word changed after begin_wait.  A waiter
+   which doesn't sleep leaves its count, which costs one extra wake up. */
+static inline uint32_t begin_wait(waitq_t *w) {
+  uint32_t seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+  __atomic_fetch_add(&w->waiters, 1, __ATOMIC_SEQ_CST);
+  return seq;
+}
+
+static inline void end_wait(waitq_t *w, uint32_t seq, bool sleep) {
+  if (sleep)
+    futex_wait(&w->seq, seq);
+}
+
+static inline bool is_closed(ac_shm_pipe_t *h) {
+  return __atomic_load_n(&h->header->closed, __ATOMIC_ACQUIRE);
+}
+
+static size_t round_up(size_t n, size_t to) { return (n + to - 1) & ~(to - 1); }
+
+static ac_shm_pipe_t *map_segment(int fd, const char *name,
+                                  const char *caller) {
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(header_t)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  size_t name_len = name ? strlen(name) + 1 : 0;
+#ifdef _AC_DEBUG_MEMORY_
+  ac_shm_pipe_t *h = (ac_shm_pipe_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_shm_pipe_t) + name_len, false);
+#else
+  (void)caller;
+  ac_shm_pipe_t *h =
+      (ac_shm_pipe_t *)ac_calloc(sizeof(ac_shm_pipe_t) + name_len);
+#endif
+  if (!h)
+    abort();
+  h->header = (header_t *)base;
+  h->base = (char *)base;
+  h->size = size;
+  h->fd = fd;
+  if (name) {
+    h->name = (char *)(h + 1);
+    memcpy(h->name, name, name_len);
+  }
+  return h;
+}
+
+static ac_shm_pipe_t *attach(int fd, const char *caller) {
+  ac_shm_pipe_t *h = map_segment(fd, NULL, caller);
+  if (!h)
+    return NULL;
+  header_t *hdr = h->header;
+  if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_PIPE_MAGIC ||
+      hdr->size != h->size || !hdr->buffer_size ||
+      hdr->num_buffers > INDEX_MASK - 1 ||
+      hdr->arena_offset + hdr->buffer_size * hdr->num_buffers > h->size ||
+      hdr->ring_offset + (hdr->mask + 1) * sizeof(cell_t) >
+          hdr->arena_offset) {
+    ac_shm_pipe_destroy(h);
+    return NULL;
+  }
+  h->cells = (cell_t *)(h->base + hdr->ring_offset);
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers,
+                                 const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers) {
+  const char *caller = NULL;
+#endif
+  size_t cells = 2;
+  while (cells < ring_size)
+    cells <<= 1;
+  size_t ring_offset = round_up(sizeof(header_t), SHM_PIPE_PAGE);
+  size_t arena_offset =
+      ring_offset + round_up(cells * sizeof(cell_t), SHM_PIPE_PAGE);
+  buffer_size = round_up(buffer_size ? buffer_size : 1, 64);
+  if (!num_buffers || num_buffers > INDEX_MASK - 1 ||
+      num_buffers > (SIZE_MAX - arena_offset) / buffer_size) {
+    errno = EINVAL;
+    return NULL;
+  }
+  size_t size = round_up(arena_offset + buffer_size * num_buffers,
+                         SHM_PIPE_PAGE);
+
+  int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                : memfd_create("ac_shm_pipe", 0);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, size)) {
+    if (name)
+      shm_unlink(name);
+    close(fd);
+    return NULL;
+  }
+  ac_shm_pipe_t *h = map_segment(fd, name, caller);
+  if (!h) {
+    if (name)
+      shm_unlink(name);
+    return NULL;
+  }
+  /* the new file is zero filled, so only the nonzero fields are set */
+  header_t *hdr = h->header;
+  hdr->size = size;
+  hdr->mask = cells - 1;
+  hdr->ring_offset = ring_offset;
+  hdr->arena_offset = arena_offset;
+  hdr->buffer_size = buffer_size;
+  hdr->num_buffers = num_buffers;
+  h->cells = (cell_t *)(h->base + ring_offset);
+  for (size_t i = 0; i < cells; i++)
+    h->cells[i].seq = i;
+  __atomic_store_n(&hdr->magic, SHM_PIPE_MAGIC, __ATOMIC_RELEASE);
+  return h;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name, const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name) {
+  const char *caller = NULL;
+#endif
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+  return attach(fd, caller);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd, const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd) {
+  const char *caller = NULL;
+#endif
+  return attach(fd, caller);
+}
+
+int ac_shm_pipe_fd(ac_shm_pipe_t *h) { return h->fd; }
+
+void ac_shm_pipe_destroy(ac_shm_pipe_t *h) {
+  if (!h)
+    return;
+  munmap(h->base, h->size);
+  close(h->fd);
+  if (h->name)
+    shm_unlink(h->name);
+  ac_free(h);
+}
+
+size_t ac_shm_pipe_buffer_size(ac_shm_pipe_t *h) {
+  return h->header->buffer_size;
+}
+
+static inline char *get_buffer(ac_shm_pipe_t *h, uint64_t index) {
+  header_t *hdr = h->header;
+  return h->base + hdr->arena_offset + (index - 1) * hdr->buffer_size;
+}
+
+void *ac_shm_pipe_try_alloc(ac_shm_pipe_t *h) {
+  header_t *hdr = h->header;
+  if (is_closed(h))
+    return NULL;
+
+  /* a free buffer holds the index of the next one */
+  uint64_t top = __atomic_load_n(&hdr->free_buffers, __ATOMIC_ACQUIRE);
+  while (top & INDEX_MASK) {
+    char *p = get_buffer(h, top & INDEX_MASK);
+    uint64_t next = __atomic_load_n((uint64_t *)p, __ATOMIC_RELAXED);
+    uint64_t new_top = next | ((top + TAG_ONE) & ~INDEX_MASK);
+    if (__atomic_compare_exchange_n(&hdr->free_buffers, &top, new_top, true,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      return p;
+  }
+
+  /* carve a new buffer from the arena */
+  uint64_t used = __atomic_load_n(&hdr->buffers_used, __ATOMIC_RELAXED);
+  do {
+    if (used == hdr->num_buffers)
+      return NULL;
+  } while (!__atomic_compare_exchange_n(&hdr->buffers_used, &used, used + 1,
+                                        true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+  return get_buffer(h, used + 1);
+}
+
+void *ac_shm_pipe_alloc(ac_shm_pipe_t *h) {
+  waitq_t *w = &h->header->arena_space;
+  while (true) {
+    for (int i = 0; i < AC_SHM_PIPE_SPIN; i++) {
+      void *p = ac_shm_pipe_try_alloc(h);
+      if (p || is_closed(h))
+        return p;
+      cpu_relax();
+    }
+    uint32_t seq = begin_wait(w);
+    void *p = ac_shm_pipe_try_alloc(h);
+    end_wait(w, seq, !p && !is_closed(h));
+    if (p)
+      return p;
+  }
+}
+
+void ac_shm_pipe_free(ac_shm_pipe_t *h, void *p) {
+  header_t *hdr = h->header;
+  uint64_t index =
+      ((char *)p - h->base - hdr->arena_offset) / hdr->buffer_size + 1;
+  uint64_t top = __atomic_load_n(&hdr->free_buffers, __ATOMIC_RELAXED);
+  do {
+    __atomic_store_n((uint64_t *)p, top & INDEX_MASK, __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&hdr->free_buffers, &top,
+                                        index | (top & ~INDEX_MASK), true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  wake(&hdr->arena_space);
+}
+
+/* the ring is ac_queue_mpmc_t's, with offsets in place of pointers */
+bool ac_shm_pipe_try_write(ac_shm_pipe_t *h, void *p, size_t length) {
+  header_t *hdr = h->header;
+  if (is_closed(h))
+    return false;
+  uint64_t pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    cell_t *cell = h->cells + (pos & hdr->mask);
+    uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)seq - (int64_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&hdr->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->offset = (char *)p - h->base;
+        cell->length = length;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        wake(&hdr->readable);
+        return true;
+      }
+    } else if (diff < 0)
+      return false;
+    else
+      pos = __atomic_load_n(&hdr->enqueue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+bool ac_shm_pipe_write(ac_shm_pipe_t *h, void *p, size_t length) {
+  waitq_t *w = &h->header->ring_space;
+  while (true) {
+    for (int i = 0; i < AC_SHM_PIPE_SPIN; i++) {
+      if (ac_shm_pipe_try_write(h, p, length))
+        return true;
+      if (is_closed(h))
+        return false;
+      cpu_relax();
+    }
+    uint32_t seq = begin_wait(w);
+    bool written = ac_shm_pipe_try_write(h, p, length);
+    end_wait(w, seq, !written && !is_closed(h));
+    if (written)
+      return true;
+  }
+}
+
+void *ac_shm_pipe_try_read(ac_shm_pipe_t *h, size_t *length) {
+  header_t *hdr = h->header;
+  uint64_t pos = __atomic_load_n(&hdr->dequeue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    cell_t *cell = h->cells + (pos & hdr->mask);
+    uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&hdr->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        uint64_t offset = cell->offset;
+        if (length)
+          *length = cell->length;
+        __atomic_store_n(&cell->seq, pos + hdr->mask + 1, __ATOMIC_RELEASE);
+        wake(&hdr->ring_space);
+        return h->base + offset;
+      }
+    } else if (diff < 0)
+      return NULL;
+    else
+      pos = __atomic_load_n(&hdr->dequeue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+void *ac_shm_pipe_read(ac_shm_pipe_t *h, size_t *length) {
+  waitq_t *w = &h->header->readable;
+  while (true) {
+    for (int i = 0; i < AC_SHM_PIPE_SPIN; i++) {
+      void *p = ac_shm_pipe_try_read(h, length);
+      if (p)
+        return p;
+      /* writes which finished before the shutdown are still read */
+      if (is_closed(h))
+        return ac_shm_pipe_try_read(h, length);
+      cpu_relax();
+    }
+    uint32_t seq = begin_wait(w);
+    void *p = ac_shm_pipe_try_read(h, length);
+    end_wait(w, seq, !p && !is_closed(h));
+    if (p)
+      return p;
+  }
+}
+
+size_t ac_shm_pipe_size(ac_shm_pipe_t *h) {
+  uint64_t head = __atomic_load_n(&h->header->dequeue_pos, __ATOMIC_ACQUIRE);
+  uint64_t tail = __atomic_load_n(&h->header->enqueue_pos, __ATOMIC_ACQUIRE);
+  return tail > head ? tail - head : 0;
+}
+
+void ac_shm_pipe_shutdown(ac_shm_pipe_t *h) {
+  header_t *hdr = h->header;
+  __atomic_store_n(&hdr->closed, 1, __ATOMIC_RELEASE);
+  waitq_t *queues[] = {&hdr->readable, &hdr->ring_space, &hdr->arena_space};
+  for (size_t i = 0; i < 3; i++) {
+    __atomic_fetch_add(&queues[i]->seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&queues[i]->seq, INT_MAX);
+  }
+}
+
+uint64_t ac_shm_pipe_offset(ac_shm_pipe_t *h, const void *p) {
+  return (uint64_t)((const char *)p - h->base);
+}
+
+void *ac_shm_pipe_pointer(ac_shm_pipe_t *h, uint64_t offset) {
+  return h->base + offset;
+}
+
+#else
+/* shared futexes and memfd are Linux only */
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers,
+                                 const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers) {
+#endif
+  errno = ENOSYS;
+  return NULL;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name, const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name) {
+#endif
+  errno = ENOSYS;
+  return NULL;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd, const char *caller) {
+#else
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd) {
+#endif
+  errno = ENOSYS;
+  return NULL;
+}
+
+int ac_shm_pipe_fd(ac_shm_pipe_t *h) { return -1; }
+void ac_shm_pipe_destroy(ac_shm_pipe_t *h) {}
+size_t ac_shm_pipe_buffer_size(ac_shm_pipe_t *h) { return 0; }
+void *ac_shm_pipe_alloc(ac_shm_pipe_t *h) { return NULL; }
+void *ac_shm_pipe_try_alloc(ac_shm_pipe_t *h) { return NULL; }
+void ac_shm_pipe_free(ac_shm_pipe_t *h, void *p) {}
+bool ac_shm_pipe_write(ac_shm_pipe_t *h, void *p, size_t length) {
+  return false;
+}
+bool ac_shm_pipe_try_write(ac_shm_pipe_t *h, void *p, size_t length) {
+  return false;
+}
+void *ac_shm_pipe_read(ac_shm_pipe_t *h, size_t *length) { return NULL; }
+void *ac_shm_pipe_try_read(ac_shm_pipe_t *h, size_t *length) { return NULL; }
+size_t ac_shm_pipe_size(ac_shm_pipe_t *h) { return 0; }
+void ac_shm_pipe_shutdown(ac_shm_pipe_t *h) {}
+uint64_t ac_shm_pipe_offset(ac_shm_pipe_t *h, const void *p) { return 0; }
+void *ac_shm_pipe_pointer(ac_shm_pipe_t *h, uint64_t offset) { return NULL; }
+#endif
@@ -0,0 +1,179 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_shm_pipe_H
+#define _ac_shm_pipe_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_shm_pipe_t passes buffers between processes through shared memory.
+  The segment (a memfd, or a POSIX shm object when it has a name) holds a
+  bounded ring like ac_queue_mpmc_t and an arena of fixed size buffers which
+  the payloads are allocated from.  A writer allocates a buffer, fills it,
+  and writes it to the ring, and a reader gets a pointer to the same bytes
+  in its own mapping and frees the buffer once it's done.  Nothing is copied or
+  serialized, so a handoff costs about what ac_object_pipe's queue
+  transport does within a process.
+
+  Any number of threads in any number of processes can write and read.  The
+  ring and the arena's free lists store offsets (the segment is mapped at a
+  different address in each process), so pointers must not be stored inside
+  a payload, use ac_shm_pipe_offset and ac_shm_pipe_pointer instead.
+
+  The arena is carved like an ac_pool, from the front as buffers are
+  needed, and freed buffers go on a shared free list (like ac_slab, every
+  buffer is the same size, so the arena can't fragment between processes
+  which can't coordinate a compaction).  Payloads larger than a buffer
+  should be split or link further buffers by offset.
+
+  A reader which finds the ring empty (or a writer which finds it or the
+  arena full) spins for a moment and then sleeps on a process shared futex
+  in the segment.  The other side only makes the wake up system call when
+  someone is sleeping, so a busy pipe makes no system calls.
+
+  The creator (or a process which inherited the mapping with fork):
+
+    ac_shm_pipe_t *p = ac_shm_pipe_init(NULL, 4096, 16384, 4096);
+    ...
+    char *buf = (char *)ac_shm_pipe_alloc(p);
+    memcpy(buf, data, len);
+    ac_shm_pipe_write(p, buf, len);
+
+  Another process (after getting the fd with SCM_RIGHTS or exec, or opening
+  the name):
+
+    ac_shm_pipe_t *p = ac_shm_pipe_open_fd(fd);
+    size_t len;
+    void *buf;
+    while ((buf = ac_shm_pipe_read(p, &len)) != NULL) {
+      process(buf, len);
+      ac_shm_pipe_free(p, buf);
+    }
+
+  ac_shm_pipe_init and the open functions return NULL if the segment can't
+  be created or mapped (or isn't a pipe), and are only available on Linux.
+*/
+struct ac_shm_pipe_s;
+typedef struct ac_shm_pipe_s ac_shm_pipe_t;
+
+/* how many times a reader or writer checks again before it sleeps */
+#ifndef AC_SHM_PIPE_SPIN
+#define AC_SHM_PIPE_SPIN 256
+#endif
+
+/* Create a segment with a ring of ring_size (rounded up to a power of two)
+   entries and an arena of num_buffers buffers of buffer_size bytes (rounded
+   up to a multiple of 64 so that buffers don't share cache lines).  Without
+   a name, the segment is a memfd which isn't closed on exec (see
+   ac_shm_pipe_fd).  With a name, such as "/ingest", it is created with
+   shm_open (failing if it exists) and unlinked when the creator destroys
+   it. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_shm_pipe_init(name, ring_size, buffer_size, num_buffers)            \
+  _ac_shm_pipe_init(name, ring_size, buffer_size, num_buffers,                 \
+                    AC_FILE_LINE_MACRO("ac_shm_pipe"))
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers,
+                                 const char *caller);
+#else
+#define ac_shm_pipe_init(name, ring_size, buffer_size, num_buffers)            \
+  _ac_shm_pipe_init(name, ring_size, buffer_size, num_buffers)
+ac_shm_pipe_t *_ac_shm_pipe_init(const char *name, size_t ring_size,
+                                 size_t buffer_size, size_t num_buffers);
+#endif
+
+/* map a segment created by another process by its name */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_shm_pipe_open(name)                                                 \
+  _ac_shm_pipe_open(name, AC_FILE_LINE_MACRO("ac_shm_pipe"))
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name, const char *caller);
+#else
+#define ac_shm_pipe_open(name) _ac_shm_pipe_open(name)
+ac_shm_pipe_t *_ac_shm_pipe_open(const char *name);
+#endif
+
+/* map the segment open as fd (the pipe takes ownership of fd) */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_shm_pipe_open_fd(fd)                                                \
+  _ac_shm_pipe_open_fd(fd, AC_FILE_LINE_MACRO("ac_shm_pipe"))
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd, const char *caller);
+#else
+#define ac_shm_pipe_open_fd(fd) _ac_shm_pipe_open_fd(fd)
+ac_shm_pipe_t *_ac_shm_pipe_open_fd(int fd);
+#endif
+
+/* the segment's file descriptor (to pass to another process) */
+int ac_shm_pipe_fd(ac_shm_pipe_t *h);
+
+/* unmap the segment in this process.  Buffers which this process allocated
+   and didn't write stay allocated. */
+void ac_shm_pipe_destroy(ac_shm_pipe_t *h);
+
+/* the (rounded) size of the buffers */
+size_t ac_shm_pipe_buffer_size(ac_shm_pipe_t *h);
+
+/* allocate a buffer from the arena, waiting while every buffer is in use.
+   Returns NULL if the pipe was shut down. */
+void *ac_shm_pipe_alloc(ac_shm_pipe_t *h);
+
+/* returns NULL instead of waiting if every buffer is in use */
+void *ac_shm_pipe_try_alloc(ac_shm_pipe_t *h);
+
+/* return a buffer (allocated by any process) to the arena */
+void ac_shm_pipe_free(ac_shm_pipe_t *h, void *p);
+
+/* hand p (from ac_shm_pipe_alloc) and the first length bytes of it (at
+   most the buffer size) to a reader, waiting while the ring is full.  The
+   reader frees p.  Returns false (and leaves p to the caller) if the pipe
+   was shut down. */
+bool ac_shm_pipe_write(ac_shm_pipe_t *h, void *p, size_t length);
+
+/* returns false instead of waiting if the ring is full */
+bool ac_shm_pipe_try_write(ac_shm_pipe_t *h, void *p, size_t length);
+
+/* the next buffer, waiting while the ring is empty.  Returns NULL once the
+   pipe is shut down and every buffer has been read. */
+void *ac_shm_pipe_read(ac_shm_pipe_t *h, size_t *length);
+
+/* returns NULL instead of waiting if the ring is empty */
+void *ac_shm_pipe_try_read(ac_shm_pipe_t *h, size_t *length);
+
+/* the number of buffers in the ring (approximate while it's in use) */
+size_t ac_shm_pipe_size(ac_shm_pipe_t *h);
+
+/* wake every process waiting on the pipe.  Writes and allocations fail from
+   then on and reads return what is left in the ring and then NULL. */
+void ac_shm_pipe_shutdown(ac_shm_pipe_t *h);
+
+/* convert between a pointer into the arena and the offset which refers to
+   it in every process (for links between payloads) */
+uint64_t ac_shm_pipe_offset(ac_shm_pipe_t *h, const void *p);
+void *ac_shm_pipe_pointer(ac_shm_pipe_t *h, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_slab.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the number of objects held by a magazine */
+#define AC_SLAB_MAGAZINE_SIZE 64
+
+/* objects are carved out of chunks which are at least this big */
+#define AC_SLAB_CHUNK_SIZE (64 * 1024)
+
+typedef struct ac_slab_magazine_s {
+  struct ac_slab_magazine_s *next;
+  int count;
+  void *objects[AC_SLAB_MAGAZINE_SIZE];
+} ac_slab_magazine_t;
+
+/* the chunks are linked together so that they can be freed */
+typedef struct ac_slab_chunk_s {
+  struct ac_slab_chunk_s *next;
+  /* pad to 16 bytes so the objects which follow are aligned */
+  size_t unused;
+} ac_slab_chunk_t;
+
+typedef struct ac_slab_thread_s {
+  ac_slab_t *h;
+  /* loaded is used first, previous avoids going to the depot each time an
+     object is allocated and freed right at a magazine boundary */
+  ac_slab_magazine_t *loaded;
+  ac_slab_magazine_t *previous;
+  struct ac_slab_thread_s *next;
+  struct ac_slab_thread_s *prev;
+} ac_slab_thread_t;
+
+struct ac_slab_s {
+  size_t object_size;
+  pthread_key_t key;
+
+  /* everything below is protected by the mutex */
+  pthread_mutex_t mutex;
+  ac_slab_magazine_t *full;
+  ac_slab_magazine_t *empty;
+  ac_slab_chunk_t *chunks;
+  char *chunk_p;
+  char *chunk_ep;
+  ac_slab_thread_t *threads;
+};
+
+static ac_slab_magazine_t *new_magazine(void) {
+  ac_slab_magazine_t *m =
+      (ac_slab_magazine_t *)ac_malloc(sizeof(ac_slab_magazine_t));
+  if (!m)
+    abort();
+  m->count = 0;
+  m->next = NULL;
+  return m;
+}
+
+/* must be called with the lock held */
+static void push_magazine(ac_slab_magazine_t **head, ac_slab_magazine_t *m) {
+  m->next = *head;
+  *head = m;
+}
+
+/* must be called with the lock held */
+static ac_slab_magazine_t *pop_magazine(ac_slab_magazine_t **head) {
+  ac_slab_magazine_t *m = *head;
+  if (m)
+    *head = m->next;
+  return m;
+}
+
+/* fill m with new objects carved from the chunks (lock must be held) */
+static void carve(ac_slab_t *h, ac_slab_magazine_t *m) {
+  size_t object_size = h->object_size;
+  if (h->chunk_p + object_size > h->chunk_ep) {
+    size_t size = object_size * AC_SLAB_MAGAZINE_SIZE;
+    if (size < AC_SLAB_CHUNK_SIZE)
+      size = AC_SLAB_CHUNK_SIZE;
+    ac_slab_chunk_t *c =
+        (ac_slab_chunk_t *)ac_malloc(sizeof(ac_slab_chunk_t) + size);
+    if (!c)
+      abort();
+    c->next = h->chunks;
+    h->chunks = c;
+    h->chunk_p = (char *)(c + 1);
+    h->chunk_ep = h->chunk_p + size;
+  }
+  while (m->count < AC_SLAB_MAGAZINE_SIZE &&
+         h->chunk_p + object_size <= h->chunk_ep) {
+    m->objects[m->count++] = h->chunk_p;
+    h->chunk_p += object_size;
+  }
+}
+
+static void on_thread_exit(void *arg) {
+  ac_slab_thread_t *t = (ac_slab_thread_t *)arg;
+  ac_slab_t *h = t->h;
+  pthread_mutex_lock(&h->mutex);
+  /* the objects in the thread's magazines go back to the depot */
+  push_magazine(t->loaded->count ? &h->full : &h->empty, t->loaded);
+  push_magazine(t->previous->count ? &h->full : &h->empty, t->previous);
+  if (t->prev)
+    t->prev->next = t->next;
+  else
+    h->threads = t->next;
+  if (t->next)
+    t->next->prev = t->prev;
+  pthread_mutex_unlock(&h->mutex);
+  ac_free(t);
+}
+
+static ac_slab_thread_t *create_thread(ac_slab_t *h) {
+  ac_slab_thread_t *t = (ac_slab_thread_t *)ac_malloc(sizeof(ac_slab_thread_t));
+  if (!t)
+    abort();
+  t->h = h;
+  t->prev = NULL;
+  pthread_mutex_lock(&h->mutex);
+  t->loaded = pop_magazine(&h->empty);
+  t->previous = pop_magazine(&h->empty);
+  t->next = h->threads;
+  if (t->next)
+    t->next->prev = t;
+  h->threads = t;
+  pthread_mutex_unlock(&h->mutex);
+  if (!t->loaded)
+    t->loaded = new_magazine();
+  if (!t->previous)
+    t->previous = new_magazine();
+  pthread_setspecific(h->key, t);
+  return t;
+}
+
+static inline ac_slab_thread_t *get_thread(ac_slab_t *h) {
+  ac_slab_thread_t *t = (ac_slab_thread_t *)pthread_getspecific(h->key);
+  if (t)
+    return t;
+  return create_thread(h);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_slab_t *_ac_slab_init(size_t object_size, const char *caller) {
+  ac_slab_t *h =
+      (ac_slab_t *)_ac_malloc_d(NULL, caller, sizeof(ac_slab_t), false);
+#else
+ac_slab_t *_ac_slab_init(size_t object_size) {
+  ac_slab_t *h = (ac_slab_t *)ac_malloc(sizeof(ac_slab_t));
+#endif
+  if (!h || object_size == 0)
+    abort();
+  h->object_size = (object_size + 15) & ~((size_t)15);
+  h->full = NULL;
+  h->empty = NULL;
+  h->chunks = NULL;
+  h->chunk_p = NULL;
+  h->chunk_ep = NULL;
+  h->threads = NULL;
+  pthread_mutex_init(&h->mutex, NULL);
+  if (pthread_key_create(&h->key, on_thread_exit))
+    abort();
+  return h;
+}
+
+size_t ac_slab_object_size(ac_slab_t *h) { return h->object_size; }
+
+void *ac_slab_alloc(ac_slab_t *h) {
+  ac_slab_thread_t *t = get_thread(h);
+  if (t->loaded->count)
+    return t->loaded->objects[--t->loaded->count];
+  if (t->previous->count) {
+    ac_slab_magazine_t *m = t->loaded;
+    t->loaded = t->previous;
+    t->previous = m;
+    return t->loaded->objects[--t->loaded->count];
+  }
+  /* both magazines are empty, trade one for a full magazine */
+  pthread_mutex_lock(&h->mutex);
+  ac_slab_magazine_t *m = pop_magazine(&h->full);
+  if (m) {
+    push_magazine(&h->empty, t->previous);
+    t->previous = t->loaded;
+    t->loaded = m;
+  } else
+    carve(h, t->loaded);
+  pthread_mutex_unlock(&h->mutex);
+  return t->loaded->objects[--t->loaded->count];
+}
+
+void *ac_slab_calloc(ac_slab_t *h) {
+  void *r = ac_slab_alloc(h);
+  memset(r, 0, h->object_size);
+  return r;
+}
+
+void ac_slab_free(ac_slab_t *h, void *p) {
+  ac_slab_thread_t *t = get_thread(h);
+  if (t->loaded->count < AC_SLAB_MAGAZINE_SIZE) {
+    t->loaded->objects[t->loaded->count++] = p;
+    return;
+  }
+  if (t->previous->count == 0) {
+    ac_slab_magazine_t *m = t->loaded;
+    t->loaded = t->previous;
+    t->previous = m;
+    t->loaded->objects[t->loaded->count++] = p;
+    return;
+  }
+  /* both magazines are full, give one to the depot */
+  pthread_mutex_lock(&h->mutex);
+  push_magazine(&h->full, t->previous);
+  ac_slab_magazine_t *m = pop_magazine(&h->empty);
+  pthread_mutex_unlock(&h->mutex);
+  t->previous = t->loaded;
+  t->loaded = m ? m : new_magazine();
+  t->loaded->objects[t->loaded->count++] = p;
+}
+
+static void free_magazines(ac_slab_magazine_t *m) {
+  while (m) {
+    ac_slab_magazine_t *next = m->next;
+    ac_free(m);
+    m = next;
+  }
+}
+
+void ac_slab_destroy(ac_slab_t *h) {
+  /* once the key is deleted, on_thread_exit will no longer be called */
+  pthread_key_delete(h->key);
+  ac_slab_thread_t *t = h->threads;
+  while (t) {
+    ac_slab_thread_t *next = t->next;
+    ac_free(t->loaded);
+    ac_free(t->previous);
+    ac_free(t);
+    t = next;
+  }
+  free_magazines(h->full);
+  free_magazines(h->empty);
+  ac_slab_chunk_t *c = h->chunks;
+  while (c) {
+    ac_slab_chunk_t *next = c->next;
+    ac_free(c);
+    c = next;
+  }
+  pthread_mutex_destroy(&h->mutex);
+  ac_free(h);
+}
@@ -0,0 +1,71 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_slab_H
+#define _ac_slab_H
+
+#include "ac_allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_slab_t allocates objects of one fixed size (a size class).  It is meant
+  for structures which are created and destroyed frequently (like one per
+  connection).  Each thread has a pair of magazines (small arrays of free
+  objects) so that most allocations and frees don't take a lock.  When a
+  thread's magazines are empty or full, a whole magazine is exchanged with a
+  central depot.  Memory is carved out of large chunks which are only returned
+  to the system when the slab is destroyed, so the latency is predictable and
+  long-running processes don't fragment the heap.
+*/
+struct ac_slab_s;
+typedef struct ac_slab_s ac_slab_t;
+
+/* ac_slab_init creates a slab for objects of object_size bytes.  The size is
+   rounded up to a multiple of 16 so that every object is aligned. */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_slab_init(object_size)                                              \
+  _ac_slab_init(object_size, AC_FILE_LINE_MACRO("ac_slab"))
+ac_slab_t *_ac_slab_init(size_t object_size, const char *caller);
+#else
+#define ac_slab_init(object_size) _ac_slab_init(object_size)
+ac_slab_t *_ac_slab_init(size_t object_size);
+#endif
+
+/* ac_slab_alloc returns an uninitialized object */
+void *ac_slab_alloc(ac_slab_t *h);
+
+/* ac_slab_calloc returns a zero'd object */
+void *ac_slab_calloc(ac_slab_t *h);
+
+/* ac_slab_free returns an object to the slab.  The object may be freed by a
+   different thread than the one which allocated it. */
+void ac_slab_free(ac_slab_t *h, void *p);
+
+/* ac_slab_object_size returns the (rounded) size of the objects */
+size_t ac_slab_object_size(ac_slab_t *h);
+
+/* ac_slab_destroy frees all of the memory associated with the slab.  It
+   should only be called once no thread is using the slab. */
+void ac_slab_destroy(ac_slab_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_slice.h"
+#include "ac_slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SLICE_MAX_CLASSES 32
+
+struct ac_slice_pool_s {
+  ac_slab_t *slabs[SLICE_MAX_CLASSES];
+  int num_classes;
+  /* the largest allocation which comes from a slab */
+  size_t max_size;
+};
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_slice_pool_t *_ac_slice_pool_init(size_t max_size, const char *caller) {
+  ac_slice_pool_t *h = (ac_slice_pool_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_slice_pool_t), false);
+#else
+ac_slice_pool_t *_ac_slice_pool_init(size_t max_size) {
+  ac_slice_pool_t *h = (ac_slice_pool_t *)ac_calloc(sizeof(ac_slice_pool_t));
+#endif
+  if (!h)
+    abort();
+  size_t size = AC_SLICE_MIN_SIZE;
+  do {
+#ifdef _AC_DEBUG_MEMORY_
+    h->slabs[h->num_classes++] = _ac_slab_init(size, caller);
+#else
+    h->slabs[h->num_classes++] = _ac_slab_init(size);
+#endif
+    h->max_size = size;
+    size <<= 1;
+  } while (size <= max_size && h->num_classes < SLICE_MAX_CLASSES);
+  return h;
+}
+
+void ac_slice_pool_destroy(ac_slice_pool_t *h) {
+  for (int i = 0; i < h->num_classes; i++)
+    ac_slab_destroy(h->slabs[i]);
+  ac_free(h);
+}
+
+static ac_slice_t *new_slice(ac_slice_pool_t *pool, size_t size) {
+  ac_slice_t *s;
+  int size_class = -1;
+  if (pool && size <= pool->max_size) {
+    size_class = 0;
+    while (((size_t)AC_SLICE_MIN_SIZE << size_class) < size)
+      size_class++;
+    s = (ac_slice_t *)ac_slab_alloc(pool->slabs[size_class]);
+  } else {
+    s = (ac_slice_t *)ac_malloc(size);
+    if (!s)
+      abort();
+  }
+  s->refs = 1;
+  s->owner = s;
+  s->pool = pool;
+  s->size_class = size_class;
+  return s;
+}
+
+ac_slice_t *ac_slice_alloc(ac_slice_pool_t *pool, size_t length) {
+  ac_slice_t *s = new_slice(pool, sizeof(ac_slice_t) + length + 1);
+  s->data = (char *)(s + 1);
+  s->length = length;
+  s->data[length] = 0;
+  return s;
+}
+
+ac_slice_t *ac_slice_copy(ac_slice_pool_t *pool, const void *data,
+                          size_t length) {
+  ac_slice_t *s = ac_slice_alloc(pool, length);
+  if (length)
+    memcpy(s->data, data, length);
+  return s;
+}
+
+ac_slice_t *ac_slice_sub(ac_slice_t *s, size_t offset, size_t length) {
+  if (offset > s->length)
+    offset = s->length;
+  if (length > s->length - offset)
+    length = s->length - offset;
+  ac_slice_t *r = new_slice(s->pool, sizeof(ac_slice_t));
+  r->data = s->data + offset;
+  r->length = length;
+  r->owner = ac_slice_ref(s->owner);
+  return r;
+}
+
+void ac_slice_release(ac_slice_t *s) {
+  if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+  ac_slice_t *owner = s->owner;
+  if (s->size_class >= 0)
+    ac_slab_free(s->pool->slabs[s->size_class], s);
+  else
+    ac_free(s);
+  if (owner != s)
+    ac_slice_release(owner);
+}
+
+char *ac_slice_modify(ac_slice_t **s) {
+  ac_slice_t *p = *s;
+  if (p->owner == p && __atomic_load_n(&p->refs, __ATOMIC_ACQUIRE) == 1)
+    return p->data;
+  ac_slice_t *r = ac_slice_copy(p->pool, p->data, p->length);
+  ac_slice_release(p);
+  *s = r;
+  return r->data;
+}
+
+static void release_attached(void *arg, void *data, size_t length) {
+  ac_slice_release((ac_slice_t *)arg);
+  (void)data;
+  (void)length;
+}
+
+void ac_slice_attach(ac_buffer_t *bh, ac_slice_t *s) {
+  ac_buffer_attach(bh, s->data, s->length, release_attached, s);
+}
@@ -0,0 +1,125 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_slice_H
+#define _ac_slice_H
+
+#include "ac_allocator.h"
+#include "ac_buffer.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_slice_t is an immutable, reference counted piece of memory which can be
+  handed to many threads (or connections) without copying it.  A slice is
+  created with a copy of the data (ac_slice_copy) or filled in before it is
+  shared (ac_slice_alloc).  After that the bytes are never changed, which
+  is what makes fanning one payload out to many readers safe.
+
+  Each reader takes its own reference with ac_slice_ref (an atomic
+  increment) and drops it with ac_slice_release.  The memory goes back to
+  where it came from when the last reference is dropped, and that may
+  happen on any thread.  ac_slice_sub makes a slice of a part of another
+  slice.  It shares the memory and keeps the whole allocation alive.
+  ac_slice_attach lends a slice to an ac_buffer_t.  The buffer copies the
+  data the first time it is modified (copy on write) and releases the
+  reference when it lets go of the data.
+
+    ac_slice_t *s = ac_slice_copy(pool, body, body_length);
+    for (size_t i = 0; i < num_pipes; i++)
+      ac_object_pipe_write(pipes[i], ac_slice_ref(s));
+    ac_slice_release(s);
+
+  A slice pool keeps an ac_slab_t for every power of two size up to
+  max_size, so the memory is reused without going back to the heap.  Larger
+  slices, and slices made without a pool (pool is NULL), are allocated with
+  ac_malloc.
+*/
+struct ac_slice_s;
+typedef struct ac_slice_s ac_slice_t;
+
+struct ac_slice_pool_s;
+typedef struct ac_slice_pool_s ac_slice_pool_t;
+
+/* the smallest allocation which a pool hands out (including the slice) */
+#ifndef AC_SLICE_MIN_SIZE
+#define AC_SLICE_MIN_SIZE 64
+#endif
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_slice_pool_init(max_size)                                           \
+  _ac_slice_pool_init(max_size, AC_FILE_LINE_MACRO("ac_slice_pool"))
+ac_slice_pool_t *_ac_slice_pool_init(size_t max_size, const char *caller);
+#else
+#define ac_slice_pool_init(max_size) _ac_slice_pool_init(max_size)
+ac_slice_pool_t *_ac_slice_pool_init(size_t max_size);
+#endif
+
+/* every slice which came from the pool must have been released */
+void ac_slice_pool_destroy(ac_slice_pool_t *h);
+
+/* returns a slice of length bytes for the caller to fill in (through
+   ac_slice_mutable_data) before it is shared.  The data is followed by a
+   zero. */
+ac_slice_t *ac_slice_alloc(ac_slice_pool_t *pool, size_t length);
+
+/* returns a slice holding a copy of data */
+ac_slice_t *ac_slice_copy(ac_slice_pool_t *pool, const void *data,
+                          size_t length);
+
+/* returns a slice holding a copy of the buffer's contents */
+static inline ac_slice_t *ac_slice_buffer(ac_slice_pool_t *pool,
+                                          ac_buffer_t *bh) {
+  return ac_slice_copy(pool, ac_buffer_data(bh), ac_buffer_length(bh));
+}
+
+/* returns a new slice of length bytes of s starting at offset (both are
+   clamped to s) which shares the memory of s */
+ac_slice_t *ac_slice_sub(ac_slice_t *s, size_t offset, size_t length);
+
+/* adds a reference and returns s */
+static inline ac_slice_t *ac_slice_ref(ac_slice_t *s);
+
+/* drops a reference, the slice is freed with the last one */
+void ac_slice_release(ac_slice_t *s);
+
+static inline const char *ac_slice_data(const ac_slice_t *s);
+static inline size_t ac_slice_length(const ac_slice_t *s);
+
+/* the data of a slice from ac_slice_alloc while it has one reference (the
+   data must not change once the slice is shared) */
+static inline char *ac_slice_mutable_data(ac_slice_t *s);
+
+/* returns data which only the caller refers to.  If *s is shared (or is a
+   sub slice), the data is copied into a new slice, the reference to the old
+   one is dropped and *s is replaced. */
+char *ac_slice_modify(ac_slice_t **s);
+
+/* makes bh reference the data of s without copying it (see
+   ac_buffer_attach).  The buffer takes over the caller's reference. */
+void ac_slice_attach(ac_buffer_t *bh, ac_slice_t *s);
+
+#include "impl/ac_slice.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,8 @@ limitations under the License.
 #ifndef _ac_sort_H
 #define _ac_sort_H
 
+#include "ac_common.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,8 +49,22 @@ extern "C" {
                        int compare(const datatype *a,
                                  const datatype *b, void *arg),
                        void *arg);
+
+  Related sorts are in other headers
+    ac_sort_parallel.h - multithreaded variants for large inputs
+    ac_radix_sort.h - radix sorts for integer, floating point and byte keys
+    ac_sort_stable.h - stable (natural merge) sorts
+    ac_select.h - nth element, partial sorts, and top k
+    ac_sort_indirect.h - sorts large elements through an array of pointers
 */
 
+/* Partitions with fewer than AC_SORT_SMALL_CUTOFF elements are split around
+   the median of three elements instead of five (and partitions of fewer than
+   6 elements are sorted directly), so it must be at least 6. */
+#ifndef AC_SORT_SMALL_CUTOFF
+#define AC_SORT_SMALL_CUTOFF 40
+#endif
+
 /*
   Print macros (used to print sorted set for debugging mostly)
   =====================================================================
@@ -0,0 +1,62 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_sort_indirect_H
+#define _ac_sort_indirect_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_sortl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Indirect sort macros
+  =====================================================================
+
+  Every swap in ac_sort_m copies an element three times, which dominates the
+  cost of sorting large structures.  The indirect sorts sort an array of
+  pointers to the elements instead (with the same algorithm as ac_sortl_m)
+  and then move each element to its final position once by following the
+  cycles of the permutation.
+
+  Comparing through the pointers touches the elements in a random order, so
+  this only pays off for large elements.  Elements of 512 bytes or more sort
+  about twice as fast.  256 byte elements gain while the array fits in the
+  cache and lose a little beyond that.  Elements smaller than
+  AC_SORT_INDIRECT_MIN_SIZE bytes (256 by default, define it before
+  including this header to change it) and small arrays are sorted in place,
+  so the indirect sorts may be used for any type.  The pointer array is
+  allocated with ac_malloc and freed before returning.
+
+  ac_sort_indirect_m(name, type, compare)
+    expects: int compare(const type *a, const type *b);
+    returns: void name(type *base, size_t num_elements);
+
+  ac_sort_indirect_arg_m(name, type, compare)
+    expects: int compare(const type *a, const type *b, void *arg);
+    returns: void name(type *base, size_t num_elements, void *arg);
+*/
+
+#include "impl/ac_sort_indirect.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_sort_parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct ac_sort_parallel_s {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  /* partitions which haven't been picked up by a thread */
+  sort_stack_t *tasks;
+  size_t num_tasks;
+  size_t size_tasks;
+  /* partitions which are queued or being worked on, the sort is done when
+     this reaches zero */
+  size_t pending;
+  ac_sort_parallel_f work;
+  void *arg;
+};
+
+void ac_sort_parallel_push(ac_sort_parallel_t *h, void *base,
+                           size_t num_elements) {
+  pthread_mutex_lock(&h->mutex);
+  if (h->num_tasks == h->size_tasks) {
+    h->size_tasks = h->size_tasks ? h->size_tasks << 1 : 64;
+    h->tasks = (sort_stack_t *)ac_realloc(h->tasks, sizeof(sort_stack_t) *
+                                                        h->size_tasks);
+    if (!h->tasks)
+      abort();
+  }
+  h->tasks[h->num_tasks].base = base;
+  h->tasks[h->num_tasks].num_elements = num_elements;
+  h->num_tasks++;
+  h->pending++;
+  pthread_cond_signal(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+}
+
+void *ac_sort_parallel_arg(ac_sort_parallel_t *h) { return h->arg; }
+
+static void *sort_worker(void *arg) {
+  ac_sort_parallel_t *h = (ac_sort_parallel_t *)arg;
+  pthread_mutex_lock(&h->mutex);
+  while (true) {
+    while (!h->num_tasks && h->pending)
+      pthread_cond_wait(&h->cond, &h->mutex);
+    if (!h->pending)
+      break;
+    /* take the most recently pushed partition, it is the most likely to
+       still be in a cache */
+    h->num_tasks--;
+    sort_stack_t t = h->tasks[h->num_tasks];
+    pthread_mutex_unlock(&h->mutex);
+
+    h->work(h, t.base, t.num_elements);
+
+    pthread_mutex_lock(&h->mutex);
+    h->pending--;
+    if (!h->pending)
+      pthread_cond_broadcast(&h->cond);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return NULL;
+}
+
+void ac_sort_parallel(void *base, size_t num_elements, int num_threads,
+                      ac_sort_parallel_f work, void *arg) {
+  if (num_threads < 1)
+    num_threads = 1;
+
+  ac_sort_parallel_t h;
+  pthread_mutex_init(&h.mutex, NULL);
+  pthread_cond_init(&h.cond, NULL);
+  h.tasks = NULL;
+  h.num_tasks = 0;
+  h.size_tasks = 0;
+  h.pending = 0;
+  h.work = work;
+  h.arg = arg;
+  ac_sort_parallel_push(&h, base, num_elements);
+
+  pthread_t *threads =
+      (pthread_t *)ac_malloc(sizeof(pthread_t) * num_threads);
+  if (!threads)
+    abort();
+  for (int i = 1; i < num_threads; i++)
+    if (pthread_create(threads + i, NULL, sort_worker, &h))
+      abort();
+  sort_worker(&h);
+  for (int i = 1; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  ac_free(threads);
+  if (h.tasks)
+    ac_free(h.tasks);
+  pthread_cond_destroy(&h.cond);
+  pthread_mutex_destroy(&h.mutex);
+}
@@ -0,0 +1,83 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_sort_parallel_H
+#define _ac_sort_parallel_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_sort.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Parallel sort macros
+  =====================================================================
+
+  The parallel sorts partition the input on a group of threads.  Each thread
+  takes a partition, splits it around a pivot, queues the smaller half for
+  any idle thread and keeps working on the larger half.  Partitions which are
+  not larger than AC_SORT_PARALLEL_CUTOFF elements are finished with the
+  sequential sort from ac_sort.h (name_sequential is also defined by the
+  macros).  Inputs which are not larger than the cutoff (or num_threads <= 1)
+  are sorted on the calling thread without starting any threads.
+
+  The calling thread is one of the num_threads threads.  The first partition
+  of the whole input is done by one thread, so the speedup is bounded by how
+  long that takes relative to the sort.
+
+  ac_sort_parallel_m(name, type, compare)
+    expects: int compare(const datatype *a, const datatype *b);
+    returns: void name(type *base, size_t num_elements, int num_threads);
+
+  ac_sort_parallel_arg_m(name, type, compare)
+    expects: int compare(const datatype *a, const datatype *b, void *arg);
+    returns: void name(type *base, size_t num_elements, void *arg,
+                       int num_threads);
+*/
+
+#ifndef AC_SORT_PARALLEL_CUTOFF
+#define AC_SORT_PARALLEL_CUTOFF 65536
+#endif
+
+struct ac_sort_parallel_s;
+typedef struct ac_sort_parallel_s ac_sort_parallel_t;
+
+/* sorts (or further splits) the partition base[0..num_elements) */
+typedef void (*ac_sort_parallel_f)(ac_sort_parallel_t *h, void *base,
+                                   size_t num_elements);
+
+/* runs work on base with num_threads threads until every partition which was
+   pushed has been handled (this is what the macros call) */
+void ac_sort_parallel(void *base, size_t num_elements, int num_threads,
+                      ac_sort_parallel_f work, void *arg);
+
+/* queue a partition for another thread */
+void ac_sort_parallel_push(ac_sort_parallel_t *h, void *base,
+                           size_t num_elements);
+
+/* the arg which was passed to ac_sort_parallel */
+void *ac_sort_parallel_arg(ac_sort_parallel_t *h);
+
+#include "impl/ac_sort_parallel.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_sort_stable_H
+#define _ac_sort_stable_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Stable sort macros
+  =====================================================================
+
+  The stable sorts keep equal elements in their original order.  They are
+  natural merge sorts in the style of timsort.  The input is split into runs
+  which are already in order (descending runs are reversed, which is only
+  done for strictly descending runs so that stability holds).  Runs shorter
+  than a minimum length (32 to 64 elements) are extended with a binary
+  insertion sort.  The runs are merged while keeping the lengths on the run
+  stack balanced.  Before each merge, the elements which are already in place
+  at the front and back are found with a binary search and left alone, so
+  input which is mostly sorted (such as logs which are mostly appended in
+  order) is sorted in close to linear time.
+
+  A merge buffer of up to num_elements / 2 elements is allocated with
+  ac_malloc and freed before returning.
+
+  ac_sort_stable_m(name, type, compare)
+    expects: int compare(const datatype *a, const datatype *b);
+    returns: void name(type *base, size_t num_elements);
+
+  ac_sortl_stable_m(name, type, less)
+    expects: bool less(const datatype *a, const datatype *b);
+    returns: void name(type *base, size_t num_elements);
+*/
+
+#include "impl/ac_sort_stable.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
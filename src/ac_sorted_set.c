@@ -0,0 +1,105 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_sorted_set.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline int compare_uint32(uint32_t *a, uint32_t *b) {
+  return (*a < *b) ? -1 : (*a > *b) ? 1 : 0;
+}
+
+_ac_sorted_set_gallop_m(uint32, uint32_t, compare_uint32)
+_ac_sorted_set_intersect_m(uint32, uint32_t, compare_uint32)
+_ac_sorted_set_union_m(uint32, uint32_t, compare_uint32)
+_ac_sorted_set_difference_m(uint32, uint32_t, compare_uint32)
+
+/* merges a and b keeping the elements which are in both.  The scalar loop
+   advances through both arrays without branching on the comparison.  With
+   SSE2, four elements of a are compared to four of b at once (b is rotated
+   through all four lanes), the four elements of a are stored and the matches
+   are counted, and the block with the smaller last element is skipped. */
+static size_t merge_intersect_uint32(uint32_t *res, uint32_t *a,
+                                     size_t num_a, uint32_t *b,
+                                     size_t num_b) {
+  size_t i = 0, j = 0, r = 0;
+#ifdef __SSE2__
+  while (i + 4 <= num_a && j + 4 <= num_b) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+    __m128i r1 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+    __m128i r2 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i r3 = _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3));
+    __m128i eq = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, r1)),
+        _mm_or_si128(_mm_cmpeq_epi32(va, r2), _mm_cmpeq_epi32(va, r3)));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    res[r] = a[i];
+    r += mask & 1;
+    res[r] = a[i + 1];
+    r += (mask >> 1) & 1;
+    res[r] = a[i + 2];
+    r += (mask >> 2) & 1;
+    res[r] = a[i + 3];
+    r += mask >> 3;
+    uint32_t a_max = a[i + 3];
+    uint32_t b_max = b[j + 3];
+    i += (a_max <= b_max) << 2;
+    j += (b_max <= a_max) << 2;
+  }
+#endif
+  while (i < num_a && j < num_b) {
+    uint32_t x = a[i];
+    uint32_t y = b[j];
+    res[r] = x;
+    r += (x == y);
+    i += (x <= y);
+    j += (y <= x);
+  }
+  return r;
+}
+
+uint32_t *ac_intersect_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                              size_t num_a, uint32_t *b, size_t num_b) {
+  size_t max = num_a < num_b ? num_a : num_b;
+  /* the merge always stores four elements and then counts the matches, so it
+     may write a few elements past the result */
+  uint32_t *res =
+      (uint32_t *)ac_pool_alloc(pool, (max + 4) * sizeof(uint32_t));
+  if (num_a * AC_SORTED_SET_GALLOP_RATIO < num_b ||
+      num_b * AC_SORTED_SET_GALLOP_RATIO < num_a)
+    *num_res = uint32_intersect(res, a, num_a, b, num_b);
+  else
+    *num_res = merge_intersect_uint32(res, a, num_a, b, num_b);
+  return res;
+}
+
+uint32_t *ac_union_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                          size_t num_a, uint32_t *b, size_t num_b) {
+  uint32_t *res =
+      (uint32_t *)ac_pool_alloc(pool, (num_a + num_b) * sizeof(uint32_t));
+  *num_res = uint32_union(res, a, num_a, b, num_b);
+  return res;
+}
+
+uint32_t *ac_difference_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                               size_t num_a, uint32_t *b, size_t num_b) {
+  uint32_t *res = (uint32_t *)ac_pool_alloc(pool, num_a * sizeof(uint32_t));
+  *num_res = uint32_difference(res, a, num_a, b, num_b);
+  return res;
+}
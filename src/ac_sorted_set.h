@@ -0,0 +1,80 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_sorted_set_H
+#define _ac_sorted_set_H
+
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Sorted set macros
+  =====================================================================
+
+  These combine two arrays which are sorted by compare (such as the output
+  of ac_sort_m).  The result is allocated from pool and is also sorted.
+  When one array is more than AC_SORTED_SET_GALLOP_RATIO (32) times larger
+  than the other, each element of the smaller array gallops (an exponential
+  search from the last position) through the larger one, and the runs of
+  the larger array between matches are copied with memcpy.  Otherwise the
+  arrays are merged.
+
+  Equal elements are paired off one to one, so duplicates behave like a
+  multiset.  Elements of the result come from a when both arrays have an
+  equal element.
+
+  ac_intersect_m(name, type, compare)
+    the elements in both a and b
+
+  ac_union_m(name, type, compare)
+    the elements in a or b
+
+  ac_difference_m(name, type, compare)
+    the elements in a which aren't in b
+
+    expects: int compare(const type *a, const type *b);
+    returns: type *name(ac_pool_t *pool, size_t *num_res,
+                        type *a, size_t num_a, type *b, size_t num_b);
+*/
+
+/*
+  The same operations for arrays of uint32_t (such as posting lists).  The
+  arrays must be strictly increasing.  When the arrays are of similar size,
+  the intersection compares four elements of a to four of b at once with
+  SSE2 (or a merge without branches on other processors).
+*/
+uint32_t *ac_intersect_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                              size_t num_a, uint32_t *b, size_t num_b);
+
+uint32_t *ac_union_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                          size_t num_a, uint32_t *b, size_t num_b);
+
+uint32_t *ac_difference_uint32(ac_pool_t *pool, size_t *num_res, uint32_t *a,
+                               size_t num_a, uint32_t *b, size_t num_b);
+
+#include "impl/ac_sorted_set.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,8 @@ limitations under the License.
 #ifndef _ac_sortl_H
 #define _ac_sortl_H
 
+#include "ac_common.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,8 +49,32 @@ extern "C" {
                        bool less(const datatype *a,
                                  const datatype *b, void *arg),
                        void *arg);
+
+  ac_sortl_m and ac_sortl_arg_m inline less into a pattern defeating
+  quicksort.  The partition compares blocks of elements into offset arrays
+  before swapping them, so the outcome of less is not branched on and random
+  input doesn't suffer from branch mispredictions.  Sorted or reversed input
+  is detected up front and runs of elements equal to a previous pivot are
+  skipped in one pass.  A heap sort is used if the partitions stay badly
+  unbalanced, so the worst case is O(n log n).  ac_sortl_less_m and
+  ac_sortl_less_arg_m (where less is a function pointer) use the original
+  quicksort.
+
+  ac_sortl_stable_m (a stable sort) is in ac_sort_stable.h.
 */
 
+/* ac_sortl_m and ac_sortl_arg_m finish partitions with fewer than
+   AC_SORTL_INSERTION_CUTOFF elements with an insertion sort and choose the
+   pivot of partitions with more than AC_SORTL_NINTHER_CUTOFF elements as the
+   median of three medians (otherwise the median of three). */
+#ifndef AC_SORTL_INSERTION_CUTOFF
+#define AC_SORTL_INSERTION_CUTOFF 24
+#endif
+
+#ifndef AC_SORTL_NINTHER_CUTOFF
+#define AC_SORTL_NINTHER_CUTOFF 128
+#endif
+
 /*
   Print macros (used to print sorted set for debugging mostly)
   =====================================================================
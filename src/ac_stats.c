@@ -0,0 +1,363 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_stats.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COUNTER 0
+#define GAUGE 1
+#define GAUGE_FN 2
+#define HISTOGRAM 3
+
+typedef struct ac_stats_metric_s {
+  int type;
+  char *name;
+  char *help;
+  /* the length of the name before its labels */
+  size_t base_length;
+  union {
+    ac_stats_counter_t counter;
+    ac_stats_gauge_t gauge;
+    ac_stats_histogram_t histogram;
+    struct {
+      ac_stats_gauge_f cb;
+      void *arg;
+    } fn;
+  } u;
+} metric_t;
+
+__thread uint32_t _ac_stats_thread = 0;
+
+/* the slots of threads which have exited, reused by new threads */
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slots_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slots_key;
+static uint32_t free_slots[AC_STATS_MAX_THREADS];
+static uint32_t num_free_slots = 0;
+static uint32_t next_slot = 0;
+
+static void release_slot(void *arg) {
+  uint32_t slot = (uint32_t)(uintptr_t)arg - 1;
+  pthread_mutex_lock(&slots_lock);
+  free_slots[num_free_slots++] = slot;
+  pthread_mutex_unlock(&slots_lock);
+}
+
+static void create_key(void) { pthread_key_create(&slots_key, release_slot); }
+
+uint32_t _ac_stats_thread_slot(void) {
+  pthread_once(&slots_once, create_key);
+  uint32_t slot = AC_STATS_MAX_THREADS;
+  /* a slot which is reused was last written by a thread which has exited,
+     the lock makes those writes visible to this thread */
+  pthread_mutex_lock(&slots_lock);
+  if (num_free_slots)
+    slot = free_slots[--num_free_slots];
+  else if (next_slot < AC_STATS_MAX_THREADS)
+    slot = next_slot++;
+  pthread_mutex_unlock(&slots_lock);
+  if (slot < AC_STATS_MAX_THREADS)
+    pthread_setspecific(slots_key, (void *)(uintptr_t)(slot + 1));
+  _ac_stats_thread = slot + 1;
+  return slot;
+}
+
+/* a block is a cache line of padding on either side of the counters, so
+   that no other thread's counters share its lines */
+#define PAD (64 / sizeof(uint64_t))
+
+static uint64_t *new_block(void) {
+  uint64_t *p = (uint64_t *)ac_calloc(sizeof(uint64_t) *
+                                      (AC_STATS_MAX_COUNTERS + PAD * 2));
+  if (!p)
+    abort();
+  return p + PAD;
+}
+
+uint64_t *_ac_stats_block(ac_stats_t *s, uint32_t slot) {
+  /* only the thread which owns the slot allocates its block */
+  uint64_t *block = new_block();
+  __atomic_store_n(s->blocks + slot, block, __ATOMIC_RELEASE);
+  return block;
+}
+
+ac_histogram_t *_ac_stats_thread_histogram(ac_stats_histogram_t *h,
+                                           uint32_t slot) {
+  ac_histogram_t *t = ac_histogram_init(h->sub_bucket_bits);
+  __atomic_store_n(h->threads + slot, t, __ATOMIC_RELEASE);
+  return t;
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_stats_t *_ac_stats_init(const char *caller) {
+  ac_stats_t *s =
+      (ac_stats_t *)_ac_calloc_d(NULL, caller, sizeof(ac_stats_t), false);
+#else
+ac_stats_t *_ac_stats_init(void) {
+  ac_stats_t *s = (ac_stats_t *)ac_calloc(sizeof(ac_stats_t));
+#endif
+  if (!s)
+    abort();
+  pthread_mutex_init(&s->mutex, NULL);
+  /* the shared slot is there from the start, so that threads beyond
+     AC_STATS_MAX_THREADS don't race to allocate it */
+  s->blocks[AC_STATS_MAX_THREADS] = new_block();
+  return s;
+}
+
+void ac_stats_destroy(ac_stats_t *s) {
+  if (!s)
+    return;
+  for (size_t i = 0; i < s->num_metrics; i++) {
+    metric_t *m = s->metrics[i];
+    if (m->type == HISTOGRAM) {
+      for (size_t j = 0; j <= AC_STATS_MAX_THREADS; j++)
+        if (m->u.histogram.threads[j])
+          ac_histogram_destroy(m->u.histogram.threads[j]);
+    }
+    ac_free(m->name);
+    if (m->help)
+      ac_free(m->help);
+    ac_free(m);
+  }
+  if (s->metrics)
+    ac_free(s->metrics);
+  for (size_t i = 0; i <= AC_STATS_MAX_THREADS; i++)
+    if (s->blocks[i])
+      ac_free(s->blocks[i] - PAD);
+  pthread_mutex_destroy(&s->mutex);
+  ac_free(s);
+}
+
+/* returns the metric with name (if it has type) or a new one.  The caller
+   holds the mutex. */
+static metric_t *get_metric(ac_stats_t *s, int type, const char *name,
+                            const char *help, bool *created) {
+  *created = false;
+  for (size_t i = 0; i < s->num_metrics; i++) {
+    metric_t *m = s->metrics[i];
+    if (!strcmp(m->name, name)) {
+      if (m->type != type)
+        abort();
+      return m;
+    }
+  }
+  if (s->num_metrics == s->max_metrics) {
+    s->max_metrics = s->max_metrics ? s->max_metrics * 2 : 16;
+    s->metrics = (metric_t **)ac_realloc(s->metrics,
+                                         sizeof(metric_t *) * s->max_metrics);
+    if (!s->metrics)
+      abort();
+  }
+  metric_t *m = (metric_t *)ac_calloc(sizeof(metric_t));
+  if (!m)
+    abort();
+  m->type = type;
+  m->name = ac_strdup(name);
+  m->help = help ? ac_strdup(help) : NULL;
+  const char *labels = strchr(name, '{');
+  m->base_length = labels ? (size_t)(labels - name) : strlen(name);
+  s->metrics[s->num_metrics++] = m;
+  *created = true;
+  return m;
+}
+
+ac_stats_counter_t *ac_stats_counter(ac_stats_t *s, const char *name,
+                                     const char *help) {
+  bool created;
+  pthread_mutex_lock(&s->mutex);
+  metric_t *m = get_metric(s, COUNTER, name, help, &created);
+  if (created) {
+    if (s->num_counters == AC_STATS_MAX_COUNTERS)
+      abort();
+    m->u.counter.stats = s;
+    m->u.counter.index = s->num_counters++;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return &m->u.counter;
+}
+
+uint64_t ac_stats_counter_value(ac_stats_counter_t *c) {
+  ac_stats_t *s = c->stats;
+  uint64_t r = 0;
+  for (size_t i = 0; i <= AC_STATS_MAX_THREADS; i++) {
+    uint64_t *block = __atomic_load_n(s->blocks + i, __ATOMIC_ACQUIRE);
+    if (block)
+      r += __atomic_load_n(block + c->index, __ATOMIC_RELAXED);
+  }
+  return r;
+}
+
+ac_stats_gauge_t *ac_stats_gauge(ac_stats_t *s, const char *name,
+                                 const char *help) {
+  bool created;
+  pthread_mutex_lock(&s->mutex);
+  metric_t *m = get_metric(s, GAUGE, name, help, &created);
+  pthread_mutex_unlock(&s->mutex);
+  return &m->u.gauge;
+}
+
+void ac_stats_gauge_fn(ac_stats_t *s, const char *name, const char *help,
+                       ac_stats_gauge_f cb, void *arg) {
+  bool created;
+  pthread_mutex_lock(&s->mutex);
+  metric_t *m = get_metric(s, GAUGE_FN, name, help, &created);
+  m->u.fn.cb = cb;
+  m->u.fn.arg = arg;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+ac_stats_histogram_t *ac_stats_histogram(ac_stats_t *s, const char *name,
+                                         const char *help,
+                                         uint32_t sub_bucket_bits) {
+  bool created;
+  pthread_mutex_lock(&s->mutex);
+  metric_t *m = get_metric(s, HISTOGRAM, name, help, &created);
+  if (created) {
+    ac_stats_histogram_t *h = &m->u.histogram;
+    h->sub_bucket_bits = sub_bucket_bits;
+    h->threads[AC_STATS_MAX_THREADS] = ac_histogram_init(sub_bucket_bits);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return &m->u.histogram;
+}
+
+void ac_stats_histogram_merge(ac_stats_histogram_t *h, ac_histogram_t *dest) {
+  for (size_t i = 0; i <= AC_STATS_MAX_THREADS; i++) {
+    ac_histogram_t *t = __atomic_load_n(h->threads + i, __ATOMIC_ACQUIRE);
+    if (t)
+      ac_histogram_merge(dest, t);
+  }
+}
+
+static const char *type_name(int type) {
+  if (type == COUNTER)
+    return "counter";
+  if (type == HISTOGRAM)
+    return "summary";
+  return "gauge";
+}
+
+/* name with suffix added before the labels and extra added to them */
+static void append_name(ac_buffer_t *bh, metric_t *m, const char *suffix,
+                        const char *extra) {
+  ac_buffer_append(bh, m->name, m->base_length);
+  ac_buffer_appends(bh, suffix);
+  const char *labels = m->name + m->base_length;
+  size_t len = strlen(labels);
+  if (!extra) {
+    ac_buffer_append(bh, labels, len);
+    return;
+  }
+  if (len > 2) {
+    /* drop the closing brace */
+    ac_buffer_append(bh, labels, len - 1);
+    ac_buffer_appendc(bh, ',');
+  } else
+    ac_buffer_appendc(bh, '{');
+  ac_buffer_appends(bh, extra);
+  ac_buffer_appendc(bh, '}');
+}
+
+static void append_double(ac_buffer_t *bh, double v) {
+  if (isnan(v))
+    ac_buffer_appends(bh, "NaN");
+  else if (isinf(v))
+    ac_buffer_appends(bh, v > 0 ? "+Inf" : "-Inf");
+  else
+    ac_buffer_appendf(bh, "%.17g", v);
+}
+
+static void append_metric(ac_buffer_t *bh, metric_t *m) {
+  if (m->type == COUNTER) {
+    append_name(bh, m, "", NULL);
+    ac_buffer_appendf(bh, " %" PRIu64 "\n",
+                      ac_stats_counter_value(&m->u.counter));
+  } else if (m->type == GAUGE) {
+    append_name(bh, m, "", NULL);
+    ac_buffer_appendf(bh, " %" PRId64 "\n",
+                      ac_stats_gauge_value(&m->u.gauge));
+  } else if (m->type == GAUGE_FN) {
+    append_name(bh, m, "", NULL);
+    ac_buffer_appendc(bh, ' ');
+    append_double(bh, m->u.fn.cb(m->u.fn.arg));
+    ac_buffer_appendc(bh, '\n');
+  } else {
+    ac_stats_histogram_t *h = &m->u.histogram;
+    ac_histogram_t *merged = ac_histogram_init(h->sub_bucket_bits);
+    ac_stats_histogram_merge(h, merged);
+    ac_histogram_summary_t s;
+    ac_histogram_summary(merged, &s);
+    static const char *quantiles[] = {"quantile=\"0.5\"", "quantile=\"0.9\"",
+                                      "quantile=\"0.99\"",
+                                      "quantile=\"0.999\""};
+    uint64_t values[] = {s.p50, s.p90, s.p99, s.p999};
+    for (int i = 0; i < 4; i++) {
+      append_name(bh, m, "", quantiles[i]);
+      ac_buffer_appendf(bh, " %" PRIu64 "\n", values[i]);
+    }
+    append_name(bh, m, "_sum", NULL);
+    ac_buffer_appendf(bh, " %" PRIu64 "\n", merged->sum);
+    append_name(bh, m, "_count", NULL);
+    ac_buffer_appendf(bh, " %" PRIu64 "\n", s.count);
+    ac_histogram_destroy(merged);
+  }
+}
+
+static inline bool same_family(metric_t *a, metric_t *b) {
+  return a->base_length == b->base_length &&
+         !memcmp(a->name, b->name, a->base_length);
+}
+
+void ac_stats_prometheus(ac_stats_t *s, ac_buffer_t *bh) {
+  pthread_mutex_lock(&s->mutex);
+  for (size_t i = 0; i < s->num_metrics; i++) {
+    metric_t *m = s->metrics[i];
+    /* a family is written (all of it) where its first metric is */
+    size_t j = 0;
+    while (j < i && !same_family(s->metrics[j], m))
+      j++;
+    if (j < i)
+      continue;
+    if (m->help) {
+      ac_buffer_appends(bh, "# HELP ");
+      ac_buffer_append(bh, m->name, m->base_length);
+      ac_buffer_appendc(bh, ' ');
+      for (const char *p = m->help; *p; p++) {
+        if (*p == '\\')
+          ac_buffer_appends(bh, "\\\\");
+        else if (*p == '\n')
+          ac_buffer_appends(bh, "\\n");
+        else
+          ac_buffer_appendc(bh, *p);
+      }
+      ac_buffer_appendc(bh, '\n');
+    }
+    ac_buffer_appends(bh, "# TYPE ");
+    ac_buffer_append(bh, m->name, m->base_length);
+    ac_buffer_appendf(bh, " %s\n", type_name(m->type));
+    for (j = i; j < s->num_metrics; j++)
+      if (j == i || same_family(s->metrics[j], m))
+        append_metric(bh, s->metrics[j]);
+  }
+  pthread_mutex_unlock(&s->mutex);
+}
@@ -0,0 +1,139 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_stats_H
+#define _ac_stats_H
+
+#include "ac_allocator.h"
+#include "ac_buffer.h"
+#include "ac_common.h"
+#include "ac_histogram.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_stats_t is a registry of named metrics which hot paths can update from
+  any number of threads without contending.  Each thread which updates a
+  counter gets its own block of counter slots (padded apart from the blocks
+  of other threads), so ac_stats_add is a load and a store to memory that no
+  other thread writes.  Reading a counter sums the slots of every thread.
+  Histograms are kept the same way, one ac_histogram_t per thread, merged
+  when they are read.  Gauges are single values which are set (or computed
+  by a callback when the stats are exported).
+
+  Threads get a slot id when they first update a metric, and give it back
+  when they exit (a later thread continues in the same slots, which is fine
+  since the slots are summed).  Beyond AC_STATS_MAX_THREADS threads at once,
+  the extra threads share one slot with atomic adds.
+
+  Metrics are registered once (registering a name again returns the same
+  metric) and live until the registry is destroyed.  A name may carry
+  Prometheus labels (http_requests_total{code="200"}), the metrics which
+  share the name before the labels are exported as one family.
+  ac_stats_prometheus writes every metric in the Prometheus text format.
+
+    ac_stats_counter_t *requests =
+        ac_stats_counter(stats, "requests_total", "Requests handled");
+    ...
+    ac_stats_inc(requests);
+*/
+
+#ifndef AC_STATS_MAX_THREADS
+#define AC_STATS_MAX_THREADS 256
+#endif
+
+/* the counters each registry can hold (each thread's block has a slot for
+   every one of them) */
+#ifndef AC_STATS_MAX_COUNTERS
+#define AC_STATS_MAX_COUNTERS 256
+#endif
+
+struct ac_stats_s;
+typedef struct ac_stats_s ac_stats_t;
+
+struct ac_stats_counter_s;
+typedef struct ac_stats_counter_s ac_stats_counter_t;
+
+struct ac_stats_gauge_s;
+typedef struct ac_stats_gauge_s ac_stats_gauge_t;
+
+struct ac_stats_histogram_s;
+typedef struct ac_stats_histogram_s ac_stats_histogram_t;
+
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_stats_init() _ac_stats_init(AC_FILE_LINE_MACRO("ac_stats"))
+ac_stats_t *_ac_stats_init(const char *caller);
+#else
+#define ac_stats_init() _ac_stats_init()
+ac_stats_t *_ac_stats_init(void);
+#endif
+
+void ac_stats_destroy(ac_stats_t *s);
+
+/* a monotonic counter, aborts if more than AC_STATS_MAX_COUNTERS are
+   registered */
+ac_stats_counter_t *ac_stats_counter(ac_stats_t *s, const char *name,
+                                     const char *help);
+
+static inline void ac_stats_add(ac_stats_counter_t *c, uint64_t v);
+static inline void ac_stats_inc(ac_stats_counter_t *c);
+
+/* the sum over the threads */
+uint64_t ac_stats_counter_value(ac_stats_counter_t *c);
+
+/* a value which goes up and down */
+ac_stats_gauge_t *ac_stats_gauge(ac_stats_t *s, const char *name,
+                                 const char *help);
+
+static inline void ac_stats_gauge_set(ac_stats_gauge_t *g, int64_t v);
+static inline void ac_stats_gauge_add(ac_stats_gauge_t *g, int64_t v);
+static inline int64_t ac_stats_gauge_value(ac_stats_gauge_t *g);
+
+/* a gauge whose value is computed when the stats are exported (such as the
+   queued tasks of an ac_threaded_pipe or the bytes a pool holds) */
+typedef double (*ac_stats_gauge_f)(void *arg);
+
+void ac_stats_gauge_fn(ac_stats_t *s, const char *name, const char *help,
+                       ac_stats_gauge_f cb, void *arg);
+
+/* a distribution (such as latencies in nanoseconds), see ac_histogram_init
+   for sub_bucket_bits.  It is exported as a summary with the 0.5, 0.9, 0.99,
+   and 0.999 quantiles. */
+ac_stats_histogram_t *ac_stats_histogram(ac_stats_t *s, const char *name,
+                                         const char *help,
+                                         uint32_t sub_bucket_bits);
+
+static inline void ac_stats_record(ac_stats_histogram_t *h, uint64_t value);
+
+/* adds the histograms of every thread to dest */
+void ac_stats_histogram_merge(ac_stats_histogram_t *h, ac_histogram_t *dest);
+
+/* appends every metric to bh in the Prometheus text exposition format */
+void ac_stats_prometheus(ac_stats_t *s, ac_buffer_t *bh);
+
+#include "impl/ac_stats.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
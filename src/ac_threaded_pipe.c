@@ -14,35 +14,179 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sched_getcpu, pthread_setaffinity_np */
+#endif
+
 #include "ac_threaded_pipe.h"
 
 #include "ac_allocator.h"
+#include "ac_epoch.h"
+#include "ac_trace.h"
 
-#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+/* the number of times a worker checks for a task before it sleeps */
+#define AC_THREADED_PIPE_SPIN 64
+
+/* how often the number of workers is adjusted (in milliseconds) */
+#define AC_THREADED_PIPE_SCALE_MS 10
+
+/* the state of a worker slot */
+#define WORKER_NONE 0
+#define WORKER_RUNNING 1
+#define WORKER_EXITED 2 /* not yet joined */
+
+typedef struct {
+  void *object;
+  void *arg;
+  ac_threaded_pipe_f cb;
+  /* see ac_threaded_pipe_now, 0 if the task doesn't expire */
+  uint64_t deadline;
+} ac_threaded_pipe_object_t;
+
+/* A fixed size Chase-Lev deque (with the orderings from Le et al., "Correct
+   and Efficient Work-Stealing for Weak Memory Models").  The owner pushes and
+   pops at bottom and the other workers steal from top. */
+typedef struct {
+  ac_threaded_pipe_object_t *cells;
+  char pad1[64];
+  ssize_t top;
+  char pad2[64];
+  ssize_t bottom;
+  char pad3[64];
+} deque_t;
+
 typedef struct {
   void *thread_arg;
   void *global_arg;
   pthread_t thread;
   ac_threaded_pipe_t *h;
-  void *new_args[8];
+  /* the generation of the global_arg which the worker uses, the thread_arg
+     created for the next generation, and the thread_arg which was replaced by
+     the last switch (destroyed by the publisher) */
+  size_t generation;
+  void *next_thread_arg;
+  void *old_thread_arg;
+  deque_t deque;
+  int id;
+  int victim;
+  /* the node (and queue) of the worker and the cpu it is pinned to (or -1) */
+  int node;
+  int cpu;
+  /* the priority which the worker is serving and how many more tasks it
+     takes from it (for weighted priorities) */
+  int priority;
+  int credit;
+  /* only written by the worker (see stat_add) */
+  ac_threaded_pipe_worker_stats_t stats;
+  /* the callback times (recorded by the worker if timing is set) */
+  ac_histogram_t *service;
+  /* the scratch pool (see ac_threaded_pipe_set_worker_pool) */
+  ac_pool_t *pool;
+  /* WORKER_NONE, WORKER_RUNNING, or WORKER_EXITED (changed and read by other
+     threads with switch_mutex held).  retire asks the worker to exit. */
+  int state;
+  bool retire;
 } thread_data_t;
 
+/* the worker which is running on this thread (if any) */
+static __thread thread_data_t *current_worker = NULL;
+
+/* A bounded multi-producer, multi-consumer queue (Dmitry Vyukov's design).
+   Each cell has a sequence number which says whether it is ready to be
+   written (seq == pos) or read (seq == pos + 1) at position pos, so
+   producers and consumers only contend on their own position counter. */
 typedef struct {
-  void *object;
-  void *arg;
-  ac_threaded_pipe_f cb;
-} ac_threaded_pipe_object_t;
+  size_t seq;
+  ac_threaded_pipe_object_t obj;
+} queue_cell_t;
+
+typedef struct {
+  queue_cell_t *cells;
+  size_t mask;
+  char pad1[64];
+  size_t enqueue_pos;
+  char pad2[64];
+  size_t dequeue_pos;
+  char pad3[64];
+} queue_t;
 
 struct ac_threaded_pipe_s {
-  int read_fd;
-  int write_fd;
+  /* one queue per node (or just one) for each priority, the queue for a
+     priority and node is queues[priority * num_queues + node] */
+  queue_t *queues;
+  int num_queues;
+  int num_priorities;
+  /* NULL if the priorities are strict */
+  int *weights;
+  ac_threaded_pipe_f expired_cb;
+  /* set by ac_threaded_pipe_abort, the tasks which are left are expired */
+  bool aborting;
+
+  /* threads waiting in ac_threaded_pipe_future_wait sleep on future_cond */
+  pthread_mutex_t future_mutex;
+  pthread_cond_t future_cond;
+  size_t future_waiters;
+
+  /* time the callbacks, and the writes which found a full queue or failed */
+  bool timing;
+  uint64_t full_writes;
+  uint64_t rejected_writes;
+
+  /* workers sleep on wake when the queue is empty, idle counts them so that
+     writers only signal when a worker is asleep */
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  size_t idle;
+  /* threads in ac_threaded_pipe_drain wait on drained, which workers signal
+     when they become idle */
+  pthread_cond_t drained;
+  size_t drainers;
+  size_t queue_size;
+  bool closed;
+  bool work_stealing;
+
+  /* placement of the workers */
+  size_t stack_size;
+  int *cpus;
+  int num_cpus;
+  bool numa;
+  int num_nodes;
+  /* the node of each cpu */
+  int *cpu_node;
+  int num_cpu_node;
+  /* if the workers are pinned, they create their own thread_arg (so that it
+     is allocated on their node) and open waits until they all have */
+  bool worker_thread_args;
+  pthread_cond_t started;
+  int num_started;
+
   ac_threaded_pipe_f cb;
+  /* max_threads slots, the workers run in threads[0..num_threads) (apart
+     from retired workers which haven't exited yet) */
   thread_data_t *threads;
   int num_threads;
+  int min_threads;
+  int max_threads;
+  bool own_threads;
+
+  /* the scale thread adds a worker when the queue wait is estimated to be
+     more than scale_wait_us and retires one when there have been idle workers
+     for scale_idle_ms */
+  pthread_t scale_thread;
+  uint64_t scale_wait_us;
+  uint64_t scale_idle_ms;
+
+  /* see ac_threaded_pipe_set_spin */
+  uint64_t spin_ns;
+  uint64_t yield_ns;
 
   ac_threaded_pipe_close_f close_cb;
   void *close_arg;
@@ -51,10 +195,20 @@ struct ac_threaded_pipe_s {
   bool done;
 
   pthread_t update_thread;
+  pthread_cond_t update_cond;
   void *update_arg;
   size_t update_interval;
   time_t global_update_time;
 
+  /* publishing a global_arg increments generation.  Each worker switches to
+     it between tasks (or when it wakes), once every running worker has, the
+     old arguments can't be in use.  Publishes and changes to the number of
+     workers are serialized by publish_lock. */
+  size_t generation;
+  pthread_mutex_t publish_lock;
+  pthread_mutex_t switch_mutex;
+  pthread_cond_t switched;
+
   ac_threaded_pipe_create_global_arg_f create_global_arg;
   ac_threaded_pipe_destroy_global_arg_f destroy_global_arg;
   void *global_arg;
@@ -62,112 +216,534 @@ struct ac_threaded_pipe_s {
   ac_threaded_pipe_create_thread_arg_f create_thread_arg;
   ac_threaded_pipe_clear_thread_arg_f clear_thread_arg;
   ac_threaded_pipe_destroy_thread_arg_f destroy_thread_arg;
+
+  /* if set, the worker threads are registered with the epoch */
+  ac_epoch_t *epoch;
+
+  /* the block size of the workers' scratch pools (0 if they have none) */
+  size_t worker_pool_size;
 };
 
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* a worker's stats are only written by the worker, the stores are atomic so
+   that ac_threaded_pipe_stats can read them from any thread */
+static inline void stat_add(uint64_t *p, uint64_t v) {
+  __atomic_store_n(p, *p + v, __ATOMIC_RELAXED);
+}
+
 void *update_task(void *arg) {
   ac_threaded_pipe_t *h = (ac_threaded_pipe_t *)arg;
+  pthread_mutex_lock(&h->mutex);
   while (true) {
-    if (h->done || (getppid() != h->parent_pid))
-      return NULL;
-    for (size_t i = 0; i < h->update_interval; i++) {
-      sleep(1);
-      if (h->done || (getppid() != h->parent_pid))
-        return NULL;
+    /* close signals update_cond, the parent is checked every second */
+    time_t deadline = time(NULL) + h->update_interval;
+    while (!h->done && getppid() == h->parent_pid && time(NULL) < deadline) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;
+      pthread_cond_timedwait(&h->update_cond, &h->mutex, &ts);
     }
-
+    if (h->done || getppid() != h->parent_pid)
+      break;
+    pthread_mutex_unlock(&h->mutex);
     void *new_gbl = h->create_global_arg(h->update_arg, h->global_arg);
-    if (new_gbl) {
-      if (new_gbl != h->global_arg) {
-        for (int i = 0; i < h->num_threads; i++) {
-          thread_data_t *t = h->threads + i;
-          void *new_thread_arg = t->thread_arg;
-          if (h->create_thread_arg)
-            new_thread_arg = h->create_thread_arg(new_gbl);
-          t->new_args[0] = new_thread_arg;
-          t->new_args[1] = NULL;
-          t->new_args[2] = new_gbl;
-          t->new_args[3] = new_gbl;
-          t->new_args[4] = new_gbl;
-          t->new_args[5] = new_gbl;
-          t->new_args[6] = new_gbl;
-          t->new_args[7] = new_gbl;
-        }
-        bool found_arg = true;
-        while (found_arg) {
-          found_arg = false;
-          for (int i = 0; i < h->num_threads; i++) {
-            thread_data_t *t = h->threads + i;
-            bool found = false;
-            for (int j = 2; j < 7; j++) {
-              if (t->new_args[j]) {
-                found = true;
-                break;
-              }
-            }
-            if (t->new_args[0] != t->new_args[1])
-              found = true;
-            if (!found) {
-              if (t->new_args[0] && h->destroy_thread_arg)
-                h->destroy_thread_arg(h->global_arg, t->new_args[0]);
-              t->new_args[1] = NULL;
-            } else
-              found_arg = true;
-          }
-          if (found_arg)
-            sleep(1);
-        }
-        if (h->global_arg && h->destroy_global_arg)
-          h->destroy_global_arg(h->update_arg, h->global_arg);
-        h->global_arg = new_gbl;
-        h->global_update_time = time(NULL);
+    if (new_gbl)
+      ac_threaded_pipe_publish_global_arg(h, new_gbl);
+    pthread_mutex_lock(&h->mutex);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return NULL;
+}
+
+/* switch the worker to the latest global_arg (and its thread_arg) */
+static void switch_args(ac_threaded_pipe_t *h, thread_data_t *t) {
+  size_t generation = __atomic_load_n(&h->generation, __ATOMIC_ACQUIRE);
+  if (generation == t->generation)
+    return;
+  t->global_arg = h->global_arg;
+  if (h->create_thread_arg) {
+    t->old_thread_arg = t->thread_arg;
+    if (h->worker_thread_args)
+      t->thread_arg = h->create_thread_arg(t->global_arg);
+    else
+      t->thread_arg = t->next_thread_arg;
+    t->next_thread_arg = NULL;
+  }
+  pthread_mutex_lock(&h->switch_mutex);
+  t->generation = generation;
+  pthread_cond_broadcast(&h->switched);
+  pthread_mutex_unlock(&h->switch_mutex);
+}
+static bool enqueue(queue_t *q, ac_threaded_pipe_object_t *o) {
+  size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  queue_cell_t *cell;
+  while (true) {
+    cell = q->cells + (pos & q->mask);
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    ssize_t dif = (ssize_t)seq - (ssize_t)pos;
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (dif < 0)
+      return false; /* full */
+    else
+      pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  }
+  cell->obj = *o;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool dequeue(queue_t *q, ac_threaded_pipe_object_t *o) {
+  size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  queue_cell_t *cell;
+  while (true) {
+    cell = q->cells + (pos & q->mask);
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    ssize_t dif = (ssize_t)seq - (ssize_t)(pos + 1);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (dif < 0)
+      return false; /* empty */
+    else
+      pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  }
+  *o = cell->obj;
+  __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* a thief may read a cell while the owner reuses it (the thief then fails to
+   take it), so cells are copied with atomic loads and stores */
+static inline void cell_copy(ac_threaded_pipe_object_t *dest,
+                             ac_threaded_pipe_object_t *src) {
+  __atomic_store_n(&dest->object,
+                   __atomic_load_n(&src->object, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&dest->arg, __atomic_load_n(&src->arg, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&dest->cb, __atomic_load_n(&src->cb, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&dest->deadline,
+                   __atomic_load_n(&src->deadline, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+}
+
+static bool deque_push(deque_t *d, ac_threaded_pipe_object_t *o) {
+  ssize_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  ssize_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  if (b - t >= AC_THREADED_PIPE_DEQUE_SIZE)
+    return false;
+  cell_copy(d->cells + (b & (AC_THREADED_PIPE_DEQUE_SIZE - 1)), o);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool deque_pop(deque_t *d, ac_threaded_pipe_object_t *o) {
+  ssize_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ssize_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  if (t > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  cell_copy(o, d->cells + (b & (AC_THREADED_PIPE_DEQUE_SIZE - 1)));
+  if (t == b) {
+    /* the last task, race the thieves for it */
+    bool r = __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return r;
+  }
+  return true;
+}
+
+static bool deque_steal(deque_t *d, ac_threaded_pipe_object_t *o) {
+  ssize_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ssize_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return false;
+  cell_copy(o, d->cells + (t & (AC_THREADED_PIPE_DEQUE_SIZE - 1)));
+  return __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* steal the oldest task of another worker on the node (or on another node) */
+static bool steal_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                       ac_threaded_pipe_object_t *o, bool same_node) {
+  int num_threads = __atomic_load_n(&h->num_threads, __ATOMIC_ACQUIRE);
+  /* one pass over every slot, the worker's own slot is skipped below */
+  for (int i = 0; i < num_threads; i++) {
+    t->victim++;
+    if (t->victim >= num_threads)
+      t->victim = 0;
+    thread_data_t *v = h->threads + t->victim;
+    if (v != t && (v->node == t->node) == same_node &&
+        deque_steal(&v->deque, o)) {
+      stat_add(&t->stats.steals, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* the closest work first: own deque (the most recently pushed task), the
+   node's queue, the deques of the node's workers, and then the other nodes.
+   The deques only hold tasks of the first priority. */
+static bool find_priority_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                               ac_threaded_pipe_object_t *o, int priority) {
+  bool deques = h->work_stealing && priority == 0;
+  queue_t *queues = h->queues + priority * h->num_queues;
+  if (deques && deque_pop(&t->deque, o))
+    return true;
+  if (dequeue(queues + t->node, o))
+    return true;
+  if (deques && steal_task(h, t, o, true))
+    return true;
+  for (int i = 1; i < h->num_queues; i++) {
+    if (dequeue(queues + ((t->node + i) % h->num_queues), o))
+      return true;
+  }
+  return h->num_queues > 1 && deques && steal_task(h, t, o, false);
+}
+
+/* with strict priorities, a task is taken from the first priority which has
+   one.  Otherwise each worker takes up to weights[p] tasks from priority p
+   before it moves on to the next priority (skipping priorities without
+   tasks). */
+static bool find_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                      ac_threaded_pipe_object_t *o) {
+  if (!h->weights) {
+    for (int p = 0; p < h->num_priorities; p++) {
+      if (find_priority_task(h, t, o, p))
+        return true;
+    }
+    return false;
+  }
+  for (int i = 0; i < h->num_priorities; i++) {
+    int p = (t->priority + i) % h->num_priorities;
+    if (find_priority_task(h, t, o, p)) {
+      if (p != t->priority) {
+        t->priority = p;
+        t->credit = h->weights[p];
+      }
+      if (--t->credit <= 0) {
+        t->priority = (p + 1) % h->num_priorities;
+        t->credit = h->weights[t->priority];
       }
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/* keeps looking for a task for spin_ns and then yield_ns (yielding the cpu
+   between checks), returns false if there is none or the worker needs to go
+   through the slow path in next_task (to close, retire or switch args) */
+static bool spin_for_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                          ac_threaded_pipe_object_t *o) {
+  uint64_t spin_end = now_ns() + h->spin_ns;
+  uint64_t end = spin_end + h->yield_ns;
+  while (true) {
+    for (int i = 0; i < AC_THREADED_PIPE_SPIN; i++) {
+      if (find_task(h, t, o))
+        return true;
+      cpu_relax();
+    }
+    if (__atomic_load_n(&h->closed, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&t->retire, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&h->generation, __ATOMIC_RELAXED) != t->generation)
+      return false;
+    uint64_t now = now_ns();
+    if (now >= end)
+      return false;
+    if (now >= spin_end)
+      sched_yield();
+  }
+}
+
+/* returns false once the pipe is closed and every task has been taken.  The
+   worker becomes idle before checking the queue a last time and writers
+   check idle after adding a task (each with a full fence between), so either
+   the worker sees the task or the writer sees the idle worker. */
+static bool next_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                      ac_threaded_pipe_object_t *o, ac_epoch_thread_t *et) {
+  for (int i = 0; i < AC_THREADED_PIPE_SPIN; i++) {
+    if (find_task(h, t, o))
+      return true;
+  }
+  /* the previous task is done, so the thread holds no references while it
+     waits for the next task */
+  if (et)
+    ac_epoch_offline(et);
+  if ((h->spin_ns || h->yield_ns) && spin_for_task(h, t, o)) {
+    if (et)
+      ac_epoch_online(et);
+    return true;
+  }
+  bool r = true;
+  uint64_t start = now_ns();
+  stat_add(&t->stats.sleeps, 1);
+  pthread_mutex_lock(&h->mutex);
+  __atomic_add_fetch(&h->idle, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (h->drainers)
+    pthread_cond_broadcast(&h->drained);
+  while (!find_task(h, t, o)) {
+    if (h->closed || __atomic_load_n(&t->retire, __ATOMIC_ACQUIRE)) {
+      r = false;
+      break;
+    }
+    if (__atomic_load_n(&h->generation, __ATOMIC_ACQUIRE) != t->generation) {
+      /* don't hold up the publisher while asleep */
+      pthread_mutex_unlock(&h->mutex);
+      switch_args(h, t);
+      pthread_mutex_lock(&h->mutex);
+      continue;
     }
+    pthread_cond_wait(&h->wake, &h->mutex);
+  }
+  __atomic_sub_fetch(&h->idle, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&h->mutex);
+  stat_add(&t->stats.idle_ns, now_ns() - start);
+  if (et)
+    ac_epoch_online(et);
+  return r;
+}
+
+#ifdef __linux__
+/* parses a cpulist such as 0-3,8-11 */
+static void parse_cpulist(const char *s, cpu_set_t *set) {
+  CPU_ZERO(set);
+  while (*s >= '0' && *s <= '9') {
+    char *e;
+    long lo = strtol(s, &e, 10);
+    long hi = lo;
+    if (*e == '-')
+      hi = strtol(e + 1, &e, 10);
+    for (long i = lo; i <= hi && i < CPU_SETSIZE; i++)
+      CPU_SET(i, set);
+    s = *e == ',' ? e + 1 : e;
+  }
+}
+
+/* reads the cpus of node from sysfs, returns false if there is no such node
+ */
+static bool node_cpus(int node, cpu_set_t *set) {
+  char path[64];
+  char line[4096];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  FILE *in = fopen(path, "r");
+  if (!in)
+    return false;
+  bool r = fgets(line, sizeof(line), in) != NULL;
+  fclose(in);
+  if (r)
+    parse_cpulist(line, set);
+  return r;
+}
+#endif
+
+/* finds the numa nodes and the node of each cpu */
+static void find_nodes(ac_threaded_pipe_t *h) {
+  h->num_nodes = 1;
+  h->num_cpu_node = 0;
+  h->cpu_node = NULL;
+#ifdef __linux__
+  cpu_set_t set;
+  int num_nodes = 0;
+  while (node_cpus(num_nodes, &set))
+    num_nodes++;
+  if (num_nodes < 2)
+    return;
+  h->num_nodes = num_nodes;
+  h->num_cpu_node = CPU_SETSIZE;
+  h->cpu_node = (int *)ac_calloc(sizeof(int) * CPU_SETSIZE);
+  for (int node = 0; node < num_nodes; node++) {
+    node_cpus(node, &set);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set))
+        h->cpu_node[i] = node;
+    }
+  }
+#endif
+}
+
+static int cpu_to_node(ac_threaded_pipe_t *h, int cpu) {
+  if (cpu < 0 || cpu >= h->num_cpu_node)
+    return 0;
+  return h->cpu_node[cpu];
+}
+
+/* the queue for tasks written by threads which aren't workers, the one on the
+   node of the cpu the writer is running on */
+static queue_t *writer_queue(ac_threaded_pipe_t *h, int priority) {
+  queue_t *queues = h->queues + priority * h->num_queues;
+  if (h->num_queues == 1)
+    return queues;
+#ifdef __linux__
+  return queues + cpu_to_node(h, sched_getcpu());
+#else
+  return queues;
+#endif
+}
+
+/* sets the affinity of the calling worker to its cpu or to its node */
+static void pin_worker(ac_threaded_pipe_t *h, thread_data_t *t) {
+#ifdef __linux__
+  cpu_set_t set;
+  if (t->cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+  } else if (h->num_nodes > 1) {
+    if (!node_cpus(t->node, &set))
+      return;
+  } else
+    return;
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)h;
+  (void)t;
+#endif
+}
+
+static void wake_workers(ac_threaded_pipe_t *h, size_t n);
+static bool expire_internal(ac_threaded_pipe_object_t *o);
+
+static void run_callback(ac_threaded_pipe_t *h, thread_data_t *t,
+                         ac_threaded_pipe_object_t *o) {
+  if ((o->deadline && ac_threaded_pipe_now() > o->deadline) ||
+      __atomic_load_n(&h->aborting, __ATOMIC_RELAXED)) {
+    stat_add(&t->stats.expired, 1);
+    if (!expire_internal(o) && h->expired_cb)
+      h->expired_cb(t->global_arg, t->thread_arg, o->object, o->arg);
+    return;
   }
+  AC_TRACE_SCOPE("ac_threaded_pipe_task");
+  if (h->timing) {
+    uint64_t start = now_ns();
+    o->cb(t->global_arg, t->thread_arg, o->object, o->arg);
+    uint64_t elapsed = now_ns() - start;
+    stat_add(&t->stats.service_ns, elapsed);
+    if (elapsed > t->stats.max_service_ns)
+      __atomic_store_n(&t->stats.max_service_ns, elapsed, __ATOMIC_RELAXED);
+    ac_histogram_record(t->service, elapsed);
+  } else
+    o->cb(t->global_arg, t->thread_arg, o->object, o->arg);
+  stat_add(&t->stats.tasks, 1);
+}
+
+/* the scratch pool is brought back to where it was before the task, so a
+   task which runs other tasks (waiting on a future) keeps its memory */
+static void run_task(ac_threaded_pipe_t *h, thread_data_t *t,
+                     ac_threaded_pipe_object_t *o) {
+  ac_pool_t *pool = t->pool;
+  if (!pool) {
+    run_callback(h, t, o);
+    return;
+  }
+  ac_pool_checkpoint_t cp;
+  ac_pool_push(pool, &cp);
+  run_callback(h, t, o);
+  uint64_t size = ac_pool_size(pool) - cp.size;
+  if (size > t->stats.max_pool_size)
+    __atomic_store_n(&t->stats.max_pool_size, size, __ATOMIC_RELAXED);
+  ac_pool_pop(pool, &cp);
+  if (ac_pool_used(pool) != t->stats.pool_bytes)
+    __atomic_store_n(&t->stats.pool_bytes, ac_pool_used(pool),
+                     __ATOMIC_RELAXED);
+}
+
+ac_pool_t *ac_threaded_pipe_pool(void) {
+  return current_worker ? current_worker->pool : NULL;
+}
+
+void ac_threaded_pipe_set_worker_pool(ac_threaded_pipe_t *h,
+                                      size_t block_size) {
+  h->worker_pool_size = block_size;
 }
 
 void *do_task(void *arg) {
   thread_data_t *t = (thread_data_t *)arg;
   ac_threaded_pipe_t *h = t->h;
-  int n;
   ac_threaded_pipe_object_t obj;
+  pin_worker(h, t);
+#ifdef AC_TRACE
+  ac_trace_name_thread("ac_threaded_pipe worker");
+#endif
+  /* created by the worker so that a pinned worker's pool is on its node */
+  if (h->worker_pool_size)
+    t->pool = ac_pool_init(h->worker_pool_size);
+  if (h->worker_thread_args) {
+    void *thread_arg = NULL;
+    if (h->create_thread_arg)
+      thread_arg = h->create_thread_arg(t->global_arg);
+    t->thread_arg = thread_arg;
+    pthread_mutex_lock(&h->mutex);
+    h->num_started++;
+    pthread_cond_signal(&h->started);
+    pthread_mutex_unlock(&h->mutex);
+  }
+  ac_epoch_thread_t *et = h->epoch ? ac_epoch_register(h->epoch) : NULL;
+  current_worker = t;
 
-  while (true) {
-    /* I think this is a safe way to avoid a mutex */
-    if (t->new_args[7] != t->global_arg) {
-      bool found = false;
-      for (int i = 2; i < 7; i++) {
-        if (t->new_args[i] != t->new_args[7]) {
-          found = true;
-          break;
-        }
-      }
-      if (!found) {
-        t->new_args[1] = t->thread_arg;
-        t->thread_arg = t->new_args[0];
-        t->global_arg = t->new_args[2];
-        t->new_args[0] = t->thread_arg;
-        t->new_args[2] = NULL;
-        t->new_args[3] = NULL;
-        t->new_args[4] = NULL;
-        t->new_args[5] = NULL;
-        t->new_args[6] = NULL;
-      }
-    }
+  while (!__atomic_load_n(&t->retire, __ATOMIC_ACQUIRE)) {
+    switch_args(h, t);
     if (h->clear_thread_arg)
       h->clear_thread_arg(t->thread_arg);
-    n = read(h->read_fd, &obj, sizeof(obj));
-    if (n > 0) {
-      if ((ssize_t)(obj.object) != -1) {
-        obj.cb(t->global_arg, t->thread_arg, obj.object, obj.arg);
-      } else {
-        close(h->read_fd);
-        close(h->write_fd);
-        h->write_fd = -1;
-        return NULL;
-      }
-    } else
+    if (et)
+      ac_epoch_quiescent(et);
+    if (!next_task(h, t, &obj, et))
       break;
+    run_task(h, t, &obj);
   }
+  if (__atomic_load_n(&t->retire, __ATOMIC_ACQUIRE)) {
+    /* hand the tasks in the deque to the other workers */
+    size_t n = 0;
+    if (h->work_stealing) {
+      while (deque_pop(&t->deque, &obj)) {
+        if (enqueue(h->queues + t->node, &obj))
+          n++;
+        else
+          run_task(h, t, &obj);
+      }
+    }
+    if (n)
+      wake_workers(h, n);
+    if (h->destroy_thread_arg && t->thread_arg)
+      h->destroy_thread_arg(t->global_arg, t->thread_arg);
+    t->thread_arg = NULL;
+  }
+  current_worker = NULL;
+  if (t->pool) {
+    ac_pool_destroy(t->pool);
+    t->pool = NULL;
+  }
+  if (et)
+    ac_epoch_unregister(et);
+  pthread_mutex_lock(&h->switch_mutex);
+  t->state = WORKER_EXITED;
+  pthread_cond_broadcast(&h->switched);
+  pthread_mutex_unlock(&h->switch_mutex);
   return NULL;
 }
 
@@ -185,6 +761,13 @@ ac_threaded_pipe_t *_ac_threaded_pipe_init(int num_threads) {
 #endif
   h->threads = (thread_data_t *)(h + 1);
   h->num_threads = num_threads;
+  h->min_threads = num_threads;
+  h->max_threads = num_threads;
+  h->own_threads = false;
+  h->scale_wait_us = AC_THREADED_PIPE_SCALE_WAIT_US;
+  h->scale_idle_ms = AC_THREADED_PIPE_SCALE_IDLE_MS;
+  h->spin_ns = 0;
+  h->yield_ns = 0;
   h->global_arg = NULL;
   h->destroy_global_arg = NULL;
   h->create_global_arg = NULL;
@@ -193,10 +776,35 @@ ac_threaded_pipe_t *_ac_threaded_pipe_init(int num_threads) {
   h->create_thread_arg = NULL;
   h->clear_thread_arg = NULL;
   h->destroy_thread_arg = NULL;
+  h->epoch = NULL;
   h->cb = NULL;
   h->close_cb = NULL;
   h->parent_pid = getppid();
   h->done = false;
+  h->queues = NULL;
+  h->num_queues = 1;
+  h->num_priorities = 1;
+  h->weights = NULL;
+  h->expired_cb = NULL;
+  h->aborting = false;
+  h->drainers = 0;
+  h->timing = false;
+  h->full_writes = 0;
+  h->rejected_writes = 0;
+  h->queue_size = AC_THREADED_PIPE_QUEUE_SIZE;
+  h->closed = true;
+  h->work_stealing = false;
+  h->stack_size = 0;
+  h->cpus = NULL;
+  h->num_cpus = 0;
+  h->numa = false;
+  h->num_nodes = 1;
+  h->cpu_node = NULL;
+  h->num_cpu_node = 0;
+  h->worker_thread_args = false;
+  h->num_started = 0;
+  h->generation = 0;
+  h->worker_pool_size = 0;
   return h;
 }
 
@@ -219,6 +827,64 @@ void ac_threaded_pipe_set_global_methods(
     s->global_arg = create_arg(update_arg, NULL);
 }
 
+static bool all_switched(ac_threaded_pipe_t *h, size_t generation) {
+  for (int i = 0; i < h->max_threads; i++) {
+    thread_data_t *t = h->threads + i;
+    if (t->state == WORKER_RUNNING && t->generation != generation)
+      return false;
+  }
+  return true;
+}
+
+void ac_threaded_pipe_publish_global_arg(ac_threaded_pipe_t *h, void *arg) {
+  if (!h->queues) { /* not open */
+    if (h->global_arg && h->global_arg != arg && h->destroy_global_arg)
+      h->destroy_global_arg(h->update_arg, h->global_arg);
+    h->global_arg = arg;
+    return;
+  }
+  pthread_mutex_lock(&h->publish_lock);
+  void *old = h->global_arg;
+  if (arg == old) {
+    pthread_mutex_unlock(&h->publish_lock);
+    return;
+  }
+  pthread_mutex_lock(&h->switch_mutex);
+  if (h->create_thread_arg && !h->worker_thread_args) {
+    for (int i = 0; i < h->max_threads; i++) {
+      if (h->threads[i].state == WORKER_RUNNING)
+        h->threads[i].next_thread_arg = h->create_thread_arg(arg);
+    }
+  }
+  h->global_arg = arg;
+  size_t generation = h->generation + 1;
+  __atomic_store_n(&h->generation, generation, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&h->switch_mutex);
+
+  /* idle workers switch as soon as they are woken, workers which are
+     retiring may exit instead */
+  pthread_mutex_lock(&h->mutex);
+  pthread_cond_broadcast(&h->wake);
+  pthread_mutex_unlock(&h->mutex);
+  pthread_mutex_lock(&h->switch_mutex);
+  while (!all_switched(h, generation))
+    pthread_cond_wait(&h->switched, &h->switch_mutex);
+  pthread_mutex_unlock(&h->switch_mutex);
+
+  for (int i = 0; i < h->max_threads; i++) {
+    thread_data_t *t = h->threads + i;
+    if (t->old_thread_arg && h->destroy_thread_arg)
+      h->destroy_thread_arg(old, t->old_thread_arg);
+    t->old_thread_arg = NULL;
+    if (t->next_thread_arg && h->destroy_thread_arg) /* exited instead */
+      h->destroy_thread_arg(arg, t->next_thread_arg);
+    t->next_thread_arg = NULL;
+  }
+  if (old && h->destroy_global_arg)
+    h->destroy_global_arg(h->update_arg, old);
+  h->global_update_time = time(NULL);
+  pthread_mutex_unlock(&h->publish_lock);
+}
 void ac_threaded_pipe_set_thread_methods(
     ac_threaded_pipe_t *s, ac_threaded_pipe_create_thread_arg_f create,
     ac_threaded_pipe_clear_thread_arg_f clear,
@@ -228,92 +894,913 @@ void ac_threaded_pipe_set_thread_methods(
   s->destroy_thread_arg = destroy;
 }
 
+void ac_threaded_pipe_set_epoch(ac_threaded_pipe_t *h, ac_epoch_t *epoch) {
+  h->epoch = epoch;
+}
+
+void ac_threaded_pipe_set_queue_size(ac_threaded_pipe_t *h, size_t size) {
+  size_t n = 2;
+  while (n < size)
+    n <<= 1;
+  h->queue_size = n;
+}
+
+void ac_threaded_pipe_set_work_stealing(ac_threaded_pipe_t *h) {
+  h->work_stealing = true;
+}
+
+void ac_threaded_pipe_set_cpus(ac_threaded_pipe_t *h, const int *cpus,
+                               int num_cpus) {
+  if (h->cpus)
+    ac_free(h->cpus);
+  h->cpus = NULL;
+  h->num_cpus = 0;
+  if (num_cpus > 0) {
+    h->cpus = (int *)ac_malloc(sizeof(int) * num_cpus);
+    memcpy(h->cpus, cpus, sizeof(int) * num_cpus);
+    h->num_cpus = num_cpus;
+  }
+}
+
+void ac_threaded_pipe_set_numa(ac_threaded_pipe_t *h) { h->numa = true; }
+
+void ac_threaded_pipe_set_stack_size(ac_threaded_pipe_t *h,
+                                     size_t stack_size) {
+  h->stack_size = stack_size;
+}
+
+void ac_threaded_pipe_set_priorities(ac_threaded_pipe_t *h,
+                                     int num_priorities, const int *weights) {
+  if (num_priorities < 1)
+    num_priorities = 1;
+  h->num_priorities = num_priorities;
+  if (h->weights)
+    ac_free(h->weights);
+  h->weights = NULL;
+  if (weights) {
+    h->weights = (int *)ac_malloc(sizeof(int) * num_priorities);
+    for (int i = 0; i < num_priorities; i++)
+      h->weights[i] = weights[i] > 0 ? weights[i] : 1;
+  }
+}
+
+void ac_threaded_pipe_set_expired_cb(ac_threaded_pipe_t *h,
+                                     ac_threaded_pipe_f expired) {
+  h->expired_cb = expired;
+}
+
+void ac_threaded_pipe_set_timing(ac_threaded_pipe_t *h) { h->timing = true; }
+
+void ac_threaded_pipe_service_histogram(ac_threaded_pipe_t *h,
+                                        ac_histogram_t *dest) {
+  if (!h->queues)
+    return;
+  for (int i = 0; i < h->max_threads; i++)
+    ac_histogram_merge(dest, h->threads[i].service);
+}
+
+static size_t deque_size(deque_t *d) {
+  ssize_t top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  ssize_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  return bottom > top ? bottom - top : 0;
+}
+
+/* the tasks in the queues and deques, the positions are read at different
+   times, so this is approximate */
+static size_t queued_tasks(ac_threaded_pipe_t *h) {
+  size_t queued = 0;
+  for (int i = 0; i < h->num_queues * h->num_priorities; i++) {
+    queue_t *q = h->queues + i;
+    size_t dequeued = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    size_t enqueued = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    if (enqueued > dequeued)
+      queued += enqueued - dequeued;
+  }
+  if (h->work_stealing) {
+    for (int i = 0; i < h->max_threads; i++)
+      queued += deque_size(&h->threads[i].deque);
+  }
+  return queued;
+}
+
+void ac_threaded_pipe_stats(ac_threaded_pipe_t *h,
+                            ac_threaded_pipe_stats_t *stats,
+                            ac_threaded_pipe_worker_stats_t *workers) {
+  memset(stats, 0, sizeof(*stats));
+  stats->num_threads = __atomic_load_n(&h->num_threads, __ATOMIC_RELAXED);
+  stats->max_threads = h->max_threads;
+  stats->full_writes = __atomic_load_n(&h->full_writes, __ATOMIC_RELAXED);
+  stats->rejected_writes =
+      __atomic_load_n(&h->rejected_writes, __ATOMIC_RELAXED);
+  if (!h->queues)
+    return;
+  stats->queued = queued_tasks(h);
+
+  ac_threaded_pipe_worker_stats_t *total = &stats->total;
+  for (int i = 0; i < h->max_threads; i++) {
+    thread_data_t *t = h->threads + i;
+    ac_threaded_pipe_worker_stats_t ws;
+    ws.tasks = __atomic_load_n(&t->stats.tasks, __ATOMIC_RELAXED);
+    ws.expired = __atomic_load_n(&t->stats.expired, __ATOMIC_RELAXED);
+    ws.steals = __atomic_load_n(&t->stats.steals, __ATOMIC_RELAXED);
+    ws.sleeps = __atomic_load_n(&t->stats.sleeps, __ATOMIC_RELAXED);
+    ws.idle_ns = __atomic_load_n(&t->stats.idle_ns, __ATOMIC_RELAXED);
+    ws.service_ns = __atomic_load_n(&t->stats.service_ns, __ATOMIC_RELAXED);
+    ws.max_service_ns =
+        __atomic_load_n(&t->stats.max_service_ns, __ATOMIC_RELAXED);
+    ws.pool_bytes = __atomic_load_n(&t->stats.pool_bytes, __ATOMIC_RELAXED);
+    ws.max_pool_size =
+        __atomic_load_n(&t->stats.max_pool_size, __ATOMIC_RELAXED);
+    ws.queued = deque_size(&t->deque);
+    if (workers)
+      workers[i] = ws;
+    total->queued += ws.queued;
+    total->tasks += ws.tasks;
+    total->expired += ws.expired;
+    total->steals += ws.steals;
+    total->sleeps += ws.sleeps;
+    total->idle_ns += ws.idle_ns;
+    total->service_ns += ws.service_ns;
+    if (ws.max_service_ns > total->max_service_ns)
+      total->max_service_ns = ws.max_service_ns;
+    total->pool_bytes += ws.pool_bytes;
+    if (ws.max_pool_size > total->max_pool_size)
+      total->max_pool_size = ws.max_pool_size;
+  }
+}
+
+void ac_threaded_pipe_set_threads(ac_threaded_pipe_t *h, int min_threads,
+                                  int max_threads) {
+  if (min_threads < 1)
+    min_threads = 1;
+  if (max_threads < min_threads)
+    max_threads = min_threads;
+  if (max_threads > h->max_threads) {
+    if (h->own_threads)
+      ac_free(h->threads);
+    h->threads =
+        (thread_data_t *)ac_malloc(sizeof(thread_data_t) * max_threads);
+    h->own_threads = true;
+  }
+  h->min_threads = min_threads;
+  h->max_threads = max_threads;
+  if (h->num_threads < min_threads)
+    h->num_threads = min_threads;
+  else if (h->num_threads > max_threads)
+    h->num_threads = max_threads;
+}
+
+void ac_threaded_pipe_set_scaling(ac_threaded_pipe_t *h, uint64_t max_wait_us,
+                                  uint64_t idle_ms) {
+  h->scale_wait_us = max_wait_us;
+  h->scale_idle_ms = idle_ms;
+}
+
+void ac_threaded_pipe_set_spin(ac_threaded_pipe_t *h, uint64_t spin_ns,
+                               uint64_t yield_ns) {
+  /* with a single cpu, a worker which keeps looking only delays the writer */
+  if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+    spin_ns = yield_ns = 0;
+  h->spin_ns = spin_ns;
+  h->yield_ns = yield_ns;
+}
+
 void ac_threaded_pipe_set_close_cb(ac_threaded_pipe_t *h,
                                      ac_threaded_pipe_close_f cb, void *arg) {
   h->close_cb = cb;
   h->close_arg = arg;
 }
 
-bool ac_threaded_pipe_write(ac_threaded_pipe_t *h, ac_threaded_pipe_f cb,
-                              void *object, void *arg) {
-  if (h->write_fd == -1 || (ssize_t)(object) == -1 ||
-      (ssize_t)(object) == -2) // protect -1 from getting through
+/* the worker of h which is calling (or NULL).  A worker can still add tasks
+   while the pipe closes, it will run them itself if the other workers have
+   exited. */
+static inline thread_data_t *calling_worker(ac_threaded_pipe_t *h) {
+  thread_data_t *w = current_worker;
+  return w && w->h == h ? w : NULL;
+}
+
+static void wake_workers(ac_threaded_pipe_t *h, size_t n) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->idle, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&h->mutex);
+    if (n > 1)
+      pthread_cond_broadcast(&h->wake);
+    else
+      pthread_cond_signal(&h->wake);
+    pthread_mutex_unlock(&h->mutex);
+  }
+}
+
+/* reserves up to n cells with one compare and swap and fills them, returns
+   the number queued (0 if the queue is full).  Only positions which a worker
+   has already taken are reserved, so each cell is freed shortly (when that
+   worker has copied the task out). */
+static size_t enqueue_batch(queue_t *q, ac_threaded_pipe_f cb, void **objects,
+                            size_t n, void *arg) {
+  size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  size_t k;
+  do {
+    size_t dequeued = __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE);
+    size_t avail = dequeued + q->mask + 1 - pos;
+    if ((ssize_t)avail <= 0)
+      return 0;
+    k = n < avail ? n : avail;
+  } while (!__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + k, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  for (size_t i = 0; i < k; i++) {
+    queue_cell_t *cell = q->cells + ((pos + i) & q->mask);
+    while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + i)
+      sched_yield();
+    cell->obj.object = objects[i];
+    cell->obj.arg = arg;
+    cell->obj.cb = cb;
+    cell->obj.deadline = 0;
+    __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+  }
+  return k;
+}
+
+static bool try_write(ac_threaded_pipe_t *h, thread_data_t *w,
+                      ac_threaded_pipe_object_t *o, int priority) {
+  if (priority < 0)
+    priority = 0;
+  else if (priority >= h->num_priorities)
+    priority = h->num_priorities - 1;
+  if (!w)
+    return enqueue(writer_queue(h, priority), o);
+  if (h->work_stealing && priority == 0 && deque_push(&w->deque, o))
+    return true;
+  return enqueue(h->queues + priority * h->num_queues + w->node, o);
+}
+
+static bool write_task(ac_threaded_pipe_t *h, ac_threaded_pipe_object_t *o,
+                       int priority, bool wait) {
+  thread_data_t *w = calling_worker(h);
+  if (h->closed && !w) {
+    __atomic_add_fetch(&h->rejected_writes, 1, __ATOMIC_RELAXED);
     return false;
+  }
+  if (try_write(h, w, o, priority)) {
+    wake_workers(h, 1);
+    return true;
+  }
+  __atomic_add_fetch(&h->full_writes, 1, __ATOMIC_RELAXED);
+  if (!wait) {
+    __atomic_add_fetch(&h->rejected_writes, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  while (!try_write(h, w, o, priority)) {
+    /* the queue is full.  A worker can't wait for the others (they may all
+       be waiting too), so it runs the task itself (counted in its stats
+       as any other). */
+    if (w) {
+      run_task(h, w, o);
+      return true;
+    }
+    sched_yield();
+  }
+  wake_workers(h, 1);
+  return true;
+}
+
+bool ac_threaded_pipe_write(ac_threaded_pipe_t *h, ac_threaded_pipe_f cb,
+                            void *object, void *arg) {
   ac_threaded_pipe_object_t o;
   o.object = object;
   o.arg = arg;
   o.cb = cb;
-  int n = write(h->write_fd, &o, sizeof(o));
-  (void)n;
+  o.deadline = 0;
+  return write_task(h, &o, 0, true);
+}
+
+bool ac_threaded_pipe_try_write(ac_threaded_pipe_t *h, ac_threaded_pipe_f cb,
+                                void *object, void *arg) {
+  ac_threaded_pipe_object_t o;
+  o.object = object;
+  o.arg = arg;
+  o.cb = cb;
+  o.deadline = 0;
+  return write_task(h, &o, 0, false);
+}
+
+bool ac_threaded_pipe_write_priority(ac_threaded_pipe_t *h, int priority,
+                                     uint64_t deadline, ac_threaded_pipe_f cb,
+                                     void *object, void *arg) {
+  ac_threaded_pipe_object_t o;
+  o.object = object;
+  o.arg = arg;
+  o.cb = cb;
+  o.deadline = deadline;
+  return write_task(h, &o, priority, true);
+}
+
+struct ac_threaded_pipe_future_s {
+  ac_threaded_pipe_t *h;
+  ac_threaded_pipe_job_f job;
+  void *object;
+  void *arg;
+  ac_threaded_pipe_done_f done_cb;
+  void *done_arg;
+  void *result;
+  bool done;
+  /* the caller and the worker */
+  int refs;
+};
+
+static void release_future(ac_threaded_pipe_future_t *f) {
+  if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    ac_free(f);
+}
+
+/* Waiters check done after counting themselves (with a full fence between)
+   and this checks for waiters after setting done, so a waiter can't miss
+   the broadcast. */
+static void finish_future(ac_threaded_pipe_future_t *f, void *result) {
+  ac_threaded_pipe_t *h = f->h;
+  f->result = result;
+  __atomic_store_n(&f->done, true, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->future_waiters, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&h->future_mutex);
+    pthread_cond_broadcast(&h->future_cond);
+    pthread_mutex_unlock(&h->future_mutex);
+  }
+  if (f->done_cb)
+    f->done_cb(f->done_arg, f);
+  release_future(f);
+}
+
+/* the task which runs a submitted job */
+static void future_task(void *global_arg, void *thread_arg, void *object,
+                        void *arg) {
+  ac_threaded_pipe_future_t *f = (ac_threaded_pipe_future_t *)object;
+  finish_future(f, f->job(global_arg, thread_arg, f->object, f->arg));
+}
+
+ac_threaded_pipe_future_t *
+ac_threaded_pipe_submit_notify(ac_threaded_pipe_t *h, ac_threaded_pipe_job_f cb,
+                               void *object, void *arg,
+                               ac_threaded_pipe_done_f done, void *done_arg) {
+  ac_threaded_pipe_future_t *f =
+      (ac_threaded_pipe_future_t *)ac_malloc(sizeof(*f));
+  f->h = h;
+  f->job = cb;
+  f->object = object;
+  f->arg = arg;
+  f->done_cb = done;
+  f->done_arg = done_arg;
+  f->result = NULL;
+  f->done = false;
+  f->refs = 2;
+  if (!ac_threaded_pipe_write(h, future_task, f, NULL)) {
+    ac_free(f);
+    return NULL;
+  }
+  return f;
+}
+
+ac_threaded_pipe_future_t *ac_threaded_pipe_submit(ac_threaded_pipe_t *h,
+                                                   ac_threaded_pipe_job_f cb,
+                                                   void *object, void *arg) {
+  return ac_threaded_pipe_submit_notify(h, cb, object, arg, NULL, NULL);
+}
+
+bool ac_threaded_pipe_future_done(ac_threaded_pipe_future_t *f) {
+  return __atomic_load_n(&f->done, __ATOMIC_ACQUIRE);
+}
+
+void *ac_threaded_pipe_future_result(ac_threaded_pipe_future_t *f) {
+  return f->result;
+}
+
+void *ac_threaded_pipe_future_wait(ac_threaded_pipe_future_t *f) {
+  ac_threaded_pipe_t *h = f->h;
+  thread_data_t *w = calling_worker(h);
+  for (int i = 0; i < AC_THREADED_PIPE_SPIN; i++) {
+    if (__atomic_load_n(&f->done, __ATOMIC_ACQUIRE))
+      return f->result;
+  }
+  /* a worker runs other tasks (possibly the job itself) while it waits */
+  ac_threaded_pipe_object_t o;
+  while (w && !__atomic_load_n(&f->done, __ATOMIC_ACQUIRE) &&
+         find_task(h, w, &o))
+    run_task(h, w, &o);
+
+  pthread_mutex_lock(&h->future_mutex);
+  __atomic_add_fetch(&h->future_waiters, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&f->done, __ATOMIC_SEQ_CST))
+    pthread_cond_wait(&h->future_cond, &h->future_mutex);
+  __atomic_sub_fetch(&h->future_waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&h->future_mutex);
+  return f->result;
+}
+
+void ac_threaded_pipe_future_destroy(ac_threaded_pipe_future_t *f) {
+  release_future(f);
+}
+
+typedef struct {
+  void *object;
+  void *result;
+  uint64_t seq;
+  /* seq + 1 once the result is ready to emit, 0 after it is emitted */
+  uint64_t ready;
+} ordered_slot_t;
+
+struct ac_threaded_pipe_ordered_s {
+  ac_threaded_pipe_t *h;
+  ac_threaded_pipe_job_f job;
+  void *arg;
+  ac_threaded_pipe_emit_f emit;
+  void *emit_arg;
+  ordered_slot_t *slots;
+  size_t window;
+  /* the next sequence number to write (the writer only) */
+  uint64_t next;
+  /* the next sequence number to emit */
+  uint64_t released;
+  /* a worker is emitting */
+  int emitting;
+};
+
+/* One worker at a time takes emitting and passes on the results which are
+   ready from released on.  A worker which finishes a job while another
+   emits leaves its result for the emitter, so the emitter checks once more
+   after it lets go (with full fences on both sides, one of the two sees the
+   result). */
+static void emit_ordered(ac_threaded_pipe_ordered_t *o) {
+  ac_threaded_pipe_t *h = o->h;
+  bool released = false;
+  while (!__atomic_exchange_n(&o->emitting, 1, __ATOMIC_SEQ_CST)) {
+    uint64_t seq = o->released;
+    ordered_slot_t *s = o->slots + (seq % o->window);
+    while (__atomic_load_n(&s->ready, __ATOMIC_ACQUIRE) == seq + 1) {
+      o->emit(o->emit_arg, seq, s->object, s->result);
+      __atomic_store_n(&s->ready, 0, __ATOMIC_RELAXED);
+      seq++;
+      __atomic_store_n(&o->released, seq, __ATOMIC_SEQ_CST);
+      released = true;
+      s = o->slots + (seq % o->window);
+    }
+    __atomic_store_n(&o->emitting, 0, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->ready, __ATOMIC_SEQ_CST) != seq + 1)
+      break;
+  }
+  if (released && __atomic_load_n(&h->future_waiters, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&h->future_mutex);
+    pthread_cond_broadcast(&h->future_cond);
+    pthread_mutex_unlock(&h->future_mutex);
+  }
+}
+
+static void ordered_task(void *global_arg, void *thread_arg, void *object,
+                         void *arg) {
+  ordered_slot_t *s = (ordered_slot_t *)object;
+  ac_threaded_pipe_ordered_t *o = (ac_threaded_pipe_ordered_t *)arg;
+  s->result = o->job(global_arg, thread_arg, s->object, o->arg);
+  __atomic_store_n(&s->ready, s->seq + 1, __ATOMIC_SEQ_CST);
+  emit_ordered(o);
+}
+
+/* An expired (or aborted) future or ordered job isn't run, but it still
+   completes with a NULL result, so nothing waits for it forever.  Returns
+   false for the tasks which were written by the user. */
+static bool expire_internal(ac_threaded_pipe_object_t *o) {
+  if (o->cb == future_task) {
+    finish_future((ac_threaded_pipe_future_t *)o->object, NULL);
+    return true;
+  }
+  if (o->cb == ordered_task) {
+    ordered_slot_t *s = (ordered_slot_t *)o->object;
+    s->result = NULL;
+    __atomic_store_n(&s->ready, s->seq + 1, __ATOMIC_SEQ_CST);
+    emit_ordered((ac_threaded_pipe_ordered_t *)o->arg);
+    return true;
+  }
+  return false;
+}
+
+/* waits until every result before seq has been emitted, like
+   ac_threaded_pipe_future_wait */
+static void wait_released(ac_threaded_pipe_ordered_t *o, uint64_t seq) {
+  ac_threaded_pipe_t *h = o->h;
+  thread_data_t *w = calling_worker(h);
+  for (int i = 0; i < AC_THREADED_PIPE_SPIN; i++) {
+    if (__atomic_load_n(&o->released, __ATOMIC_ACQUIRE) >= seq)
+      return;
+  }
+  ac_threaded_pipe_object_t t;
+  while (w && __atomic_load_n(&o->released, __ATOMIC_ACQUIRE) < seq &&
+         find_task(h, w, &t))
+    run_task(h, w, &t);
+
+  pthread_mutex_lock(&h->future_mutex);
+  __atomic_add_fetch(&h->future_waiters, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&o->released, __ATOMIC_SEQ_CST) < seq)
+    pthread_cond_wait(&h->future_cond, &h->future_mutex);
+  __atomic_sub_fetch(&h->future_waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&h->future_mutex);
+}
+
+ac_threaded_pipe_ordered_t *
+ac_threaded_pipe_ordered_init(ac_threaded_pipe_t *h, size_t window,
+                              ac_threaded_pipe_job_f cb, void *arg,
+                              ac_threaded_pipe_emit_f emit, void *emit_arg) {
+  if (window == 0)
+    abort();
+  ac_threaded_pipe_ordered_t *o =
+      (ac_threaded_pipe_ordered_t *)ac_calloc(sizeof(*o));
+  o->h = h;
+  o->job = cb;
+  o->arg = arg;
+  o->emit = emit;
+  o->emit_arg = emit_arg;
+  o->window = window;
+  o->slots = (ordered_slot_t *)ac_calloc(sizeof(ordered_slot_t) * window);
+  return o;
+}
+
+bool ac_threaded_pipe_ordered_write(ac_threaded_pipe_ordered_t *o,
+                                    void *object) {
+  uint64_t seq = o->next;
+  if (seq >= o->window)
+    wait_released(o, seq - o->window + 1);
+  ordered_slot_t *s = o->slots + (seq % o->window);
+  s->object = object;
+  s->seq = seq;
+  if (!ac_threaded_pipe_write(o->h, ordered_task, s, o))
+    return false;
+  o->next = seq + 1;
   return true;
 }
 
+void ac_threaded_pipe_ordered_finish(ac_threaded_pipe_ordered_t *o) {
+  wait_released(o, o->next);
+}
+
+void ac_threaded_pipe_ordered_destroy(ac_threaded_pipe_ordered_t *o) {
+  ac_threaded_pipe_ordered_finish(o);
+  ac_free(o->slots);
+  ac_free(o);
+}
+
+uint64_t ac_threaded_pipe_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+size_t ac_threaded_pipe_write_batch(ac_threaded_pipe_t *h,
+                                    ac_threaded_pipe_f cb, void **objects,
+                                    size_t num_objects, void *arg) {
+  thread_data_t *w = calling_worker(h);
+  if (w) {
+    for (size_t i = 0; i < num_objects; i++)
+      ac_threaded_pipe_write(h, cb, objects[i], arg);
+    return num_objects;
+  }
+  if (h->closed) {
+    __atomic_add_fetch(&h->rejected_writes, num_objects, __ATOMIC_RELAXED);
+    return 0;
+  }
+  queue_t *q = writer_queue(h, 0);
+  size_t n = 0;
+  while (n < num_objects) {
+    size_t k = enqueue_batch(q, cb, objects + n, num_objects - n, arg);
+    if (k) {
+      wake_workers(h, k);
+      n += k;
+    } else {
+      __atomic_add_fetch(&h->full_writes, 1, __ATOMIC_RELAXED);
+      sched_yield();
+    }
+  }
+  return n;
+}
+
+size_t ac_threaded_pipe_try_write_batch(ac_threaded_pipe_t *h,
+                                        ac_threaded_pipe_f cb, void **objects,
+                                        size_t num_objects, void *arg) {
+  thread_data_t *w = calling_worker(h);
+  if (w) {
+    size_t n = 0;
+    while (n < num_objects &&
+           ac_threaded_pipe_try_write(h, cb, objects[n], arg))
+      n++;
+    return n;
+  }
+  size_t n = 0;
+  if (!h->closed)
+    n = enqueue_batch(writer_queue(h, 0), cb, objects, num_objects, arg);
+  if (n)
+    wake_workers(h, n);
+  if (n < num_objects) {
+    if (!h->closed)
+      __atomic_add_fetch(&h->full_writes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->rejected_writes, num_objects - n,
+                       __ATOMIC_RELAXED);
+  }
+  return n;
+}
+
+static void start_worker(ac_threaded_pipe_t *h, thread_data_t *t) {
+  t->thread_arg = NULL;
+  if (h->create_thread_arg && !h->worker_thread_args)
+    t->thread_arg = h->create_thread_arg(h->global_arg);
+  t->global_arg = h->global_arg;
+  t->generation = h->generation;
+  t->next_thread_arg = NULL;
+  t->old_thread_arg = NULL;
+  t->pool = NULL;
+  t->retire = false;
+  pthread_mutex_lock(&h->switch_mutex);
+  t->state = WORKER_RUNNING;
+  pthread_mutex_unlock(&h->switch_mutex);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (h->stack_size)
+    pthread_attr_setstacksize(&attr, h->stack_size);
+  pthread_create(&t->thread, &attr, do_task, t);
+  pthread_attr_destroy(&attr);
+}
+
+/* joins a worker which has exited or been asked to retire */
+static void join_worker(ac_threaded_pipe_t *h, thread_data_t *t) {
+  pthread_join(t->thread, NULL);
+  if (h->destroy_thread_arg && t->thread_arg)
+    h->destroy_thread_arg(t->global_arg, t->thread_arg);
+  t->thread_arg = NULL;
+  t->state = WORKER_NONE;
+}
+
+static int worker_state(ac_threaded_pipe_t *h, thread_data_t *t) {
+  pthread_mutex_lock(&h->switch_mutex);
+  int state = t->state;
+  pthread_mutex_unlock(&h->switch_mutex);
+  return state;
+}
+
+typedef struct {
+  uint64_t last_ns;
+  uint64_t last_tasks;
+  uint64_t idle_since_ns;
+} scale_state_t;
+
+static void scale(ac_threaded_pipe_t *h, scale_state_t *s) {
+  pthread_mutex_lock(&h->publish_lock);
+  int num_threads = h->num_threads;
+  for (int i = num_threads; i < h->max_threads; i++) {
+    thread_data_t *t = h->threads + i;
+    if (worker_state(h, t) == WORKER_EXITED)
+      join_worker(h, t);
+  }
+
+  uint64_t now = now_ns();
+  uint64_t tasks = 0;
+  for (int i = 0; i < h->max_threads; i++)
+    tasks += __atomic_load_n(&h->threads[i].stats.tasks, __ATOMIC_RELAXED) +
+             __atomic_load_n(&h->threads[i].stats.expired, __ATOMIC_RELAXED);
+  size_t queued = queued_tasks(h);
+  /* the time to run the queued tasks at the recent rate */
+  double rate = (double)(tasks - s->last_tasks) / (now - s->last_ns + 1);
+  double wait_us = rate > 0 ? queued / rate / 1000.0 : queued ? 1e18 : 0;
+  s->last_ns = now;
+  s->last_tasks = tasks;
+
+  if (wait_us > h->scale_wait_us && num_threads < h->max_threads) {
+    thread_data_t *t = h->threads + num_threads;
+    if (worker_state(h, t) != WORKER_NONE) /* still retiring */
+      join_worker(h, t);
+    start_worker(h, t);
+    __atomic_store_n(&h->num_threads, num_threads + 1, __ATOMIC_RELEASE);
+    s->idle_since_ns = now;
+  } else if (queued == 0 && __atomic_load_n(&h->idle, __ATOMIC_SEQ_CST)) {
+    if (now - s->idle_since_ns >= h->scale_idle_ms * 1000000 &&
+        num_threads > h->min_threads) {
+      thread_data_t *t = h->threads + num_threads - 1;
+      __atomic_store_n(&h->num_threads, num_threads - 1, __ATOMIC_RELEASE);
+      pthread_mutex_lock(&h->mutex);
+      __atomic_store_n(&t->retire, true, __ATOMIC_RELEASE);
+      pthread_cond_broadcast(&h->wake);
+      pthread_mutex_unlock(&h->mutex);
+      s->idle_since_ns = now;
+    }
+  } else
+    s->idle_since_ns = now;
+  pthread_mutex_unlock(&h->publish_lock);
+}
+
+static void *scale_task(void *arg) {
+  ac_threaded_pipe_t *h = (ac_threaded_pipe_t *)arg;
+  scale_state_t s;
+  s.last_ns = now_ns();
+  s.last_tasks = 0;
+  s.idle_since_ns = s.last_ns;
+  pthread_mutex_lock(&h->mutex);
+  while (!h->done) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += AC_THREADED_PIPE_SCALE_MS * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&h->update_cond, &h->mutex, &ts);
+    if (h->done)
+      break;
+    pthread_mutex_unlock(&h->mutex);
+    scale(h, &s);
+    pthread_mutex_lock(&h->mutex);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return NULL;
+}
+
+/* every worker is asleep and there are no tasks (h->mutex is held) */
+static bool is_drained(ac_threaded_pipe_t *h) {
+  return __atomic_load_n(&h->idle, __ATOMIC_SEQ_CST) >=
+             (size_t)__atomic_load_n(&h->num_threads, __ATOMIC_ACQUIRE) &&
+         !queued_tasks(h);
+}
+
+bool ac_threaded_pipe_drain(ac_threaded_pipe_t *h, uint64_t timeout_ms) {
+  if (!h->queues || h->closed)
+    return true;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeout_ms / 1000;
+  ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  bool r = true;
+  pthread_mutex_lock(&h->mutex);
+  h->drainers++;
+  while (!is_drained(h)) {
+    if (!timeout_ms)
+      pthread_cond_wait(&h->drained, &h->mutex);
+    else if (pthread_cond_timedwait(&h->drained, &h->mutex, &ts) &&
+             !is_drained(h)) {
+      r = false;
+      break;
+    }
+  }
+  h->drainers--;
+  pthread_mutex_unlock(&h->mutex);
+  return r;
+}
+
+void ac_threaded_pipe_abort(ac_threaded_pipe_t *h) {
+  __atomic_store_n(&h->aborting, true, __ATOMIC_RELAXED);
+  ac_threaded_pipe_close(h);
+}
+
 void ac_threaded_pipe_close(ac_threaded_pipe_t *h) {
-  if (h->write_fd == -1)
+  if (!h->queues) { /* never opened */
+    if (h->own_threads)
+      ac_free(h->threads);
+    if (h->cpus)
+      ac_free(h->cpus);
+    if (h->weights)
+      ac_free(h->weights);
+    ac_free(h);
     return;
+  }
 
-  ac_threaded_pipe_object_t o;
-  ssize_t v = -1;
-  o.object = (void *)(v);
-  o.arg = NULL;
-  o.cb = NULL;
-  int n = write(h->write_fd, &o, sizeof(o));
-  (void)n;
+  /* the update thread may be publishing, which needs the workers */
+  pthread_mutex_lock(&h->mutex);
   h->done = true;
+  pthread_cond_broadcast(&h->update_cond);
+  pthread_mutex_unlock(&h->mutex);
   if (h->update_interval)
     pthread_join(h->update_thread, NULL);
-  for (int i = 0; i < h->num_threads; i++) {
-    pthread_join(h->threads[i].thread, NULL);
-    if (h->destroy_thread_arg && h->threads[i].thread_arg)
-      h->destroy_thread_arg(h->threads[i].global_arg, h->threads[i].thread_arg);
+  if (h->min_threads < h->max_threads)
+    pthread_join(h->scale_thread, NULL);
+
+  /* the workers finish the tasks which are queued before they exit */
+  pthread_mutex_lock(&h->mutex);
+  /* spinning workers check closed without the lock */
+  __atomic_store_n(&h->closed, true, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&h->wake);
+  pthread_mutex_unlock(&h->mutex);
+  for (int i = 0; i < h->max_threads; i++) {
+    if (worker_state(h, h->threads + i) != WORKER_NONE)
+      join_worker(h, h->threads + i);
   }
   if (h->destroy_global_arg)
     h->destroy_global_arg(h->update_arg, h->global_arg);
   if (h->close_cb)
     h->close_cb(h->close_arg);
+  pthread_cond_destroy(&h->future_cond);
+  pthread_mutex_destroy(&h->future_mutex);
+  pthread_cond_destroy(&h->switched);
+  pthread_mutex_destroy(&h->switch_mutex);
+  pthread_mutex_destroy(&h->publish_lock);
+  pthread_cond_destroy(&h->update_cond);
+  pthread_cond_destroy(&h->started);
+  pthread_cond_destroy(&h->wake);
+  pthread_cond_destroy(&h->drained);
+  pthread_mutex_destroy(&h->mutex);
+  if (h->work_stealing) {
+    for (int i = 0; i < h->max_threads; i++)
+      ac_free(h->threads[i].deque.cells);
+  }
+  for (int i = 0; i < h->max_threads; i++)
+    ac_histogram_destroy(h->threads[i].service);
+  if (h->own_threads)
+    ac_free(h->threads);
+  for (int i = 0; i < h->num_queues * h->num_priorities; i++)
+    ac_free(h->queues[i].cells);
+  ac_free(h->queues);
+  if (h->weights)
+    ac_free(h->weights);
+  if (h->cpus)
+    ac_free(h->cpus);
+  if (h->cpu_node)
+    ac_free(h->cpu_node);
   ac_free(h);
 }
 
-static void setnonblock(int fd) {
-  int flags = fcntl(fd, F_GETFL);
-  if (flags < 0)
-    abort();
-
-  flags |= O_NONBLOCK;
-  if (fcntl(fd, F_SETFL, flags) < 0)
-    abort();
-}
-
 void ac_threaded_pipe_open(ac_threaded_pipe_t *h) {
-  int fds[2];
-  int n = pipe(fds);
-  if (n < 0)
-    abort();
-
-  setnonblock(fds[1]);
+  if (h->numa)
+    find_nodes(h);
+  h->num_queues = h->numa ? h->num_nodes : 1;
+  int num_queues = h->num_queues * h->num_priorities;
+  h->queues = (queue_t *)ac_malloc(sizeof(queue_t) * num_queues);
+  for (int i = 0; i < num_queues; i++) {
+    queue_t *q = h->queues + i;
+    q->cells = (queue_cell_t *)ac_malloc(sizeof(queue_cell_t) * h->queue_size);
+    for (size_t j = 0; j < h->queue_size; j++)
+      q->cells[j].seq = j;
+    q->mask = h->queue_size - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+  }
+  h->idle = 0;
+  h->closed = false;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->wake, NULL);
+  pthread_cond_init(&h->drained, NULL);
+  pthread_cond_init(&h->started, NULL);
+  pthread_cond_init(&h->update_cond, NULL);
+  pthread_mutex_init(&h->publish_lock, NULL);
+  pthread_mutex_init(&h->switch_mutex, NULL);
+  pthread_cond_init(&h->switched, NULL);
+  pthread_mutex_init(&h->future_mutex, NULL);
+  pthread_cond_init(&h->future_cond, NULL);
+  h->future_waiters = 0;
 
-  h->read_fd = fds[0];
-  h->write_fd = fds[1];
-  void *global_arg = h->global_arg;
-  for (int i = 0; i < h->num_threads; i++) {
+  /* workers are spread evenly over the nodes unless they are given cpus */
+  bool pinned = false;
+  for (int i = 0; i < h->max_threads; i++) {
     thread_data_t *t = h->threads + i;
-    void *thread_arg = NULL;
-    if (h->create_thread_arg)
-      thread_arg = h->create_thread_arg(global_arg);
-
-    t->thread_arg = thread_arg;
-    t->global_arg = global_arg;
-    t->new_args[0] = thread_arg;
-    t->new_args[1] = thread_arg;
-    t->new_args[2] = NULL;
-    t->new_args[3] = NULL;
-    t->new_args[4] = NULL;
-    t->new_args[5] = NULL;
-    t->new_args[6] = NULL;
-    t->new_args[7] = global_arg;
+    t->id = i;
+    t->victim = i;
+    memset(&t->stats, 0, sizeof(t->stats));
+    t->service = ac_histogram_init(AC_THREADED_PIPE_HISTOGRAM_BITS);
+    t->priority = 0;
+    t->credit = h->weights ? h->weights[0] : 0;
+    t->deque.top = 0;
+    t->deque.bottom = 0;
+    t->deque.cells = NULL;
+    if (h->work_stealing)
+      t->deque.cells = (ac_threaded_pipe_object_t *)ac_malloc(
+          sizeof(ac_threaded_pipe_object_t) * AC_THREADED_PIPE_DEQUE_SIZE);
+    t->cpu = h->num_cpus ? h->cpus[i % h->num_cpus] : -1;
+    t->node = 0;
+    if (h->num_queues > 1)
+      t->node = t->cpu >= 0 ? cpu_to_node(h, t->cpu) : i % h->num_queues;
+    if (t->cpu >= 0 || h->num_queues > 1)
+      pinned = true;
+    t->state = WORKER_NONE;
+    t->retire = false;
+    t->thread_arg = NULL;
+    t->next_thread_arg = NULL;
+    t->old_thread_arg = NULL;
     t->h = h;
-    pthread_create(&h->threads[i].thread, NULL, do_task, t);
   }
+#ifndef __linux__
+  pinned = false;
+#endif
+  h->worker_thread_args = pinned;
+  h->num_started = 0;
+
+  for (int i = 0; i < h->num_threads; i++)
+    start_worker(h, h->threads + i);
+  if (pinned) {
+    /* the thread args are created by the pinned workers */
+    pthread_mutex_lock(&h->mutex);
+    while (h->num_started < h->num_threads)
+      pthread_cond_wait(&h->started, &h->mutex);
+    pthread_mutex_unlock(&h->mutex);
+  }
+  if (h->min_threads < h->max_threads)
+    pthread_create(&h->scale_thread, NULL, scale_task, h);
   if (h->update_interval) {
     pthread_create(&h->update_thread, NULL, update_task, h);
   }
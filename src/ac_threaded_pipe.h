@@ -18,6 +18,11 @@ limitations under the License.
 #define _ac_threaded_pipe_H
 
 #include "ac_common.h"
+#include "ac_epoch.h"
+#include "ac_histogram.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,6 +56,16 @@ void ac_threaded_pipe_set_global_methods(
     ac_threaded_pipe_create_global_arg_f create_arg,
     ac_threaded_pipe_destroy_global_arg_f destroy_arg);
 
+/* replace the global_arg.  New thread args are created for it (if there is a
+   create_thread_arg) and each worker switches to them before its next task
+   (idle workers are woken to switch).  Once every worker has switched, the
+   old thread args and the old global_arg are destroyed and this returns.
+   This is what the update thread of ac_threaded_pipe_set_global_methods
+   calls, it can also be called directly (but not during
+   ac_threaded_pipe_close).  Before ac_threaded_pipe_open, this just replaces
+   (and destroys) the global_arg. */
+void ac_threaded_pipe_publish_global_arg(ac_threaded_pipe_t *h, void *arg);
+
 typedef void *(*ac_threaded_pipe_create_thread_arg_f)(void *global_arg);
 typedef void (*ac_threaded_pipe_clear_thread_arg_f)(void *thread_arg);
 typedef void (*ac_threaded_pipe_destroy_thread_arg_f)(void *global_arg,
@@ -61,6 +76,100 @@ void ac_threaded_pipe_set_thread_methods(
     ac_threaded_pipe_clear_thread_arg_f clear,
     ac_threaded_pipe_destroy_thread_arg_f destroy);
 
+/* register each worker thread with epoch (before ac_threaded_pipe_open).  A
+   worker is quiescent between tasks (after clear_thread_arg is called) and is
+   offline while it waits for the next task, so objects retired to the epoch
+   (such as the nodes of an ac_concurrent_map) can be used until the task
+   returns. */
+void ac_threaded_pipe_set_epoch(ac_threaded_pipe_t *h, ac_epoch_t *epoch);
+
+/* give each worker a scratch pool with blocks of block_size bytes (before
+   ac_threaded_pipe_open), for a thread_arg which would only hold a pool.  A
+   task gets its worker's pool from ac_threaded_pipe_pool, and everything it
+   allocates is given back (with ac_pool_push/pop) once it returns, so the
+   pool stays at the size of the largest task and tasks don't call malloc.
+   Memory from the pool must not be used after the task returns.  A task
+   which a worker runs itself while it writes to a full queue allocates after
+   the memory of the task which wrote it and only gives back its own. */
+void ac_threaded_pipe_set_worker_pool(ac_threaded_pipe_t *h,
+                                      size_t block_size);
+
+/* the scratch pool of the worker running on this thread (NULL on other
+   threads or if the workers have no pools) */
+ac_pool_t *ac_threaded_pipe_pool(void);
+
+/* tasks are passed to the workers through a lock-free queue which holds
+   AC_THREADED_PIPE_QUEUE_SIZE tasks unless this is called (before
+   ac_threaded_pipe_open).  size is rounded up to a power of two. */
+#ifndef AC_THREADED_PIPE_QUEUE_SIZE
+#define AC_THREADED_PIPE_QUEUE_SIZE 65536
+#endif
+void ac_threaded_pipe_set_queue_size(ac_threaded_pipe_t *h, size_t size);
+
+/* give each worker its own deque (before ac_threaded_pipe_open).  A task
+   written by a worker (such as one half of a recursive split) is pushed onto
+   that worker's deque and run by it next, while idle workers steal the oldest
+   tasks from the other deques.  Tasks written from other threads (or when a
+   deque is full) still go through the shared queue. */
+#ifndef AC_THREADED_PIPE_DEQUE_SIZE
+#define AC_THREADED_PIPE_DEQUE_SIZE 4096
+#endif
+void ac_threaded_pipe_set_work_stealing(ac_threaded_pipe_t *h);
+
+/* pin worker i to cpus[i % num_cpus] (before ac_threaded_pipe_open).  Pinned
+   workers call create_thread_arg themselves (once they are pinned) so that
+   the thread_arg is allocated on the worker's numa node.  Pinning is only
+   supported on linux, elsewhere this is ignored. */
+void ac_threaded_pipe_set_cpus(ac_threaded_pipe_t *h, const int *cpus,
+                               int num_cpus);
+
+/* split the workers evenly over the numa nodes (before ac_threaded_pipe_open).
+   Each node gets its own queue and the workers of a node are pinned to its
+   cpus (or to the cpus from ac_threaded_pipe_set_cpus).  A task written by a
+   thread which isn't a worker goes to the queue of the node it is running
+   on.  Workers take tasks from their own node first (their own deque, the
+   node's queue, and then the other workers on the node) before they take
+   tasks from other nodes.  The nodes are found in /sys, if there is only one
+   node (or this isn't linux), there is one queue as usual. */
+void ac_threaded_pipe_set_numa(ac_threaded_pipe_t *h);
+
+/* the stack size of the workers (the default if this isn't called) */
+void ac_threaded_pipe_set_stack_size(ac_threaded_pipe_t *h, size_t stack_size);
+
+/* vary the number of workers between min_threads and max_threads (before
+   ac_threaded_pipe_open).  The pipe starts with the num_threads given to
+   ac_threaded_pipe_init (within the range).  Every 10ms, a worker is added if
+   the queued tasks would take longer than max_wait_us to be taken at the rate
+   tasks were recently finished, and the last worker is retired if there have
+   been idle workers (and no queued tasks) for idle_ms.  Workers which are
+   added get a thread_arg from create_thread_arg as usual, retired workers
+   finish their task, hand the tasks in their deque to the other workers (and
+   run the ones which don't fit in the queue, counted in their stats), and
+   destroy their thread_arg before they exit. */
+#ifndef AC_THREADED_PIPE_SCALE_WAIT_US
+#define AC_THREADED_PIPE_SCALE_WAIT_US 1000
+#endif
+#ifndef AC_THREADED_PIPE_SCALE_IDLE_MS
+#define AC_THREADED_PIPE_SCALE_IDLE_MS 1000
+#endif
+void ac_threaded_pipe_set_threads(ac_threaded_pipe_t *h, int min_threads,
+                                  int max_threads);
+
+/* the max_wait_us and idle_ms used by ac_threaded_pipe_set_threads */
+void ac_threaded_pipe_set_scaling(ac_threaded_pipe_t *h, uint64_t max_wait_us,
+                                  uint64_t idle_ms);
+
+/* an idle worker normally checks the queue a few times and then sleeps on a
+   condition variable, so a task written to an idle pipe waits for the kernel
+   to wake a thread.  With this (before ac_threaded_pipe_open), an idle
+   worker keeps checking for spin_ns nanoseconds, and then for yield_ns more
+   with a sched_yield between checks, before it sleeps.  Writers don't have
+   to wake a worker which is still looking, so a task is picked up without
+   a system call at the cost of the cpu time spent looking.  Both are 0 by
+   default (and on machines with a single cpu). */
+void ac_threaded_pipe_set_spin(ac_threaded_pipe_t *h, uint64_t spin_ns,
+                               uint64_t yield_ns);
+
 void ac_threaded_pipe_set_close_cb(ac_threaded_pipe_t *h,
                                    ac_threaded_pipe_close_f cb, void *arg);
 
@@ -69,11 +178,210 @@ void ac_threaded_pipe_open(ac_threaded_pipe_t *h);
 typedef void (*ac_threaded_pipe_f)(void *global_arg, void *thread_arg,
                                    void *object, void *arg);
 
+/* queue cb(global_arg, thread_arg, object, arg) to be called by one of the
+   workers.  If the queue is full, this waits for the workers to take a task
+   (or runs the task if it is called by a worker).  Workers are only woken (a
+   system call) if they are idle.  Returns false if the pipe isn't open.
+   Workers may write tasks until they have all been joined by close. */
 bool ac_threaded_pipe_write(ac_threaded_pipe_t *h, ac_threaded_pipe_f cb,
                             void *object, void *arg);
 
+/* like ac_threaded_pipe_write, but returns false instead of waiting if the
+   queue is full */
+bool ac_threaded_pipe_try_write(ac_threaded_pipe_t *h, ac_threaded_pipe_f cb,
+                                void *object, void *arg);
+
+/* queue cb(global_arg, thread_arg, objects[i], arg) for each of the objects.
+   Space is reserved in the queue for as many of the objects as fit at once,
+   so the cost per task is much less than for ac_threaded_pipe_write.  This
+   waits for space until all of the objects are queued and returns
+   num_objects (or 0 if the pipe isn't open). */
+size_t ac_threaded_pipe_write_batch(ac_threaded_pipe_t *h,
+                                    ac_threaded_pipe_f cb, void **objects,
+                                    size_t num_objects, void *arg);
+
+/* like ac_threaded_pipe_write_batch, but doesn't wait.  Returns the number of
+   objects which were queued (objects[0..n)), the rest are not. */
+size_t ac_threaded_pipe_try_write_batch(ac_threaded_pipe_t *h,
+                                        ac_threaded_pipe_f cb, void **objects,
+                                        size_t num_objects, void *arg);
+
+/* split the tasks into num_priorities priorities (before
+   ac_threaded_pipe_open), 0 is the first.  ac_threaded_pipe_write and the
+   batch writes use priority 0.  If weights is NULL, workers always take a
+   task of the first priority which has one.  Otherwise a worker takes up to
+   weights[p] tasks of priority p before it moves on to p + 1 (wrapping
+   around), so that every priority gets its share.  Priorities without tasks
+   are skipped either way.  With work stealing, only priority 0 tasks which are
+   written by workers go through the workers' deques. */
+void ac_threaded_pipe_set_priorities(ac_threaded_pipe_t *h,
+                                     int num_priorities, const int *weights);
+
+/* the current time in milliseconds (from a monotonic clock) */
+uint64_t ac_threaded_pipe_now(void);
+
+/* called instead of the task's callback for a task which is past its
+   deadline, if this isn't set, those tasks are dropped.  It is never called
+   for the jobs of futures or ordered streams (see ac_threaded_pipe_abort). */
+void ac_threaded_pipe_set_expired_cb(ac_threaded_pipe_t *h,
+                                     ac_threaded_pipe_f expired);
+
+/* like ac_threaded_pipe_write, with a priority (clamped to the priorities
+   which exist) and a deadline (see ac_threaded_pipe_now, 0 for none).  If a
+   worker takes the task after the deadline, it isn't run. */
+bool ac_threaded_pipe_write_priority(ac_threaded_pipe_t *h, int priority,
+                                     uint64_t deadline, ac_threaded_pipe_f cb,
+                                     void *object, void *arg);
+
+typedef struct {
+  /* tasks run (not counting expired tasks) */
+  uint64_t tasks;
+  uint64_t expired;
+  /* tasks taken from another worker's deque */
+  uint64_t steals;
+  /* the number of times and the time spent waiting for a task */
+  uint64_t sleeps;
+  uint64_t idle_ns;
+  /* the total and the longest time in the callbacks (if timing is set) */
+  uint64_t service_ns;
+  uint64_t max_service_ns;
+  /* the bytes the worker's scratch pool holds (ac_pool_used) and the most
+   that one task grew its ac_pool_size by (the sum and the max in total) */
+  uint64_t pool_bytes;
+  uint64_t max_pool_size;
+  /* tasks in the worker's deque */
+  size_t queued;
+} ac_threaded_pipe_worker_stats_t;
+
+typedef struct {
+  /* the workers which are running and the maximum (the number of entries
+     filled in by ac_threaded_pipe_stats) */
+  int num_threads;
+  int max_threads;
+  /* tasks which are written but not yet taken by a worker */
+  size_t queued;
+  /* writes which found the queue full (and waited, ran the task in the
+     writing worker, or failed) */
+  uint64_t full_writes;
+  /* tasks which weren't queued (the pipe was closed or a try write found the
+     queue full) */
+  uint64_t rejected_writes;
+  /* the sum over the workers (the max for max_service_ns) */
+  ac_threaded_pipe_worker_stats_t total;
+} ac_threaded_pipe_stats_t;
+
+/* time the callbacks for ac_threaded_pipe_stats (two clock reads per task).
+   Each worker also records the time of every callback in its own histogram
+   (see ac_threaded_pipe_service_histogram) with
+   AC_THREADED_PIPE_HISTOGRAM_BITS of precision. */
+#ifndef AC_THREADED_PIPE_HISTOGRAM_BITS
+#define AC_THREADED_PIPE_HISTOGRAM_BITS 3
+#endif
+void ac_threaded_pipe_set_timing(ac_threaded_pipe_t *h);
+
+/* merge the histograms of the callback times (in nanoseconds) of every
+   worker into dest.  This can be called from any thread while the pipe is
+   open. */
+void ac_threaded_pipe_service_histogram(ac_threaded_pipe_t *h,
+                                        ac_histogram_t *dest);
+
+/* fills stats and, if workers isn't NULL, workers[0..max_threads) with the
+   stats of each worker (slot, see ac_threaded_pipe_set_threads).  This can be
+   called from any thread while the pipe is open, the counters are read
+   without stopping the workers (so are only roughly consistent with each
+   other). */
+void ac_threaded_pipe_stats(ac_threaded_pipe_t *h,
+                            ac_threaded_pipe_stats_t *stats,
+                            ac_threaded_pipe_worker_stats_t *workers);
+
+/*
+  Futures run a job which returns a result.  submit queues the job (as a
+  priority 0 task) and returns a future which can be polled, waited for, or
+  which calls a done callback from the worker once the job has finished.  To
+  get the completion onto a libuv loop, the done callback can write the future
+  to an ac_object_pipe.  A worker which waits for a future (a fork/join job
+  waiting for the jobs it submitted) runs other tasks until it's done.  Every
+  future must be destroyed (which may be before it is done).
+*/
+struct ac_threaded_pipe_future_s;
+typedef struct ac_threaded_pipe_future_s ac_threaded_pipe_future_t;
+
+typedef void *(*ac_threaded_pipe_job_f)(void *global_arg, void *thread_arg,
+                                        void *object, void *arg);
+
+/* called by the worker after the job has finished */
+typedef void (*ac_threaded_pipe_done_f)(void *done_arg,
+                                        ac_threaded_pipe_future_t *f);
+
+/* returns NULL if the pipe isn't open */
+ac_threaded_pipe_future_t *ac_threaded_pipe_submit(ac_threaded_pipe_t *h,
+                                                   ac_threaded_pipe_job_f cb,
+                                                   void *object, void *arg);
+
+ac_threaded_pipe_future_t *
+ac_threaded_pipe_submit_notify(ac_threaded_pipe_t *h, ac_threaded_pipe_job_f cb,
+                               void *object, void *arg,
+                               ac_threaded_pipe_done_f done, void *done_arg);
+
+/* true if the job has finished */
+bool ac_threaded_pipe_future_done(ac_threaded_pipe_future_t *f);
+
+/* waits for the job to finish and returns its result */
+void *ac_threaded_pipe_future_wait(ac_threaded_pipe_future_t *f);
+
+/* the result of a job which is done */
+void *ac_threaded_pipe_future_result(ac_threaded_pipe_future_t *f);
+
+void ac_threaded_pipe_future_destroy(ac_threaded_pipe_future_t *f);
+
+/*
+  An ordered stream is a parallel map which keeps the order.  Each object
+  written gets the next sequence number and is passed to the job on a
+  worker, and the results are passed to emit in sequence order (one at a
+  time, by whichever worker finishes the job which lets the oldest results
+  be released).  At most window jobs are in flight or waiting to be
+  emitted, write waits when the window is full (a worker runs other tasks
+  meanwhile), so a slow job holds back at most window results.  One thread
+  at a time may write to a stream.
+*/
+struct ac_threaded_pipe_ordered_s;
+typedef struct ac_threaded_pipe_ordered_s ac_threaded_pipe_ordered_t;
+
+typedef void (*ac_threaded_pipe_emit_f)(void *emit_arg, uint64_t seq,
+                                        void *object, void *result);
+
+ac_threaded_pipe_ordered_t *
+ac_threaded_pipe_ordered_init(ac_threaded_pipe_t *h, size_t window,
+                              ac_threaded_pipe_job_f cb, void *arg,
+                              ac_threaded_pipe_emit_f emit, void *emit_arg);
+
+/* returns false (and doesn't use a sequence number) if the pipe isn't
+   open */
+bool ac_threaded_pipe_ordered_write(ac_threaded_pipe_ordered_t *o,
+                                    void *object);
+
+/* waits until every result written so far has been emitted */
+void ac_threaded_pipe_ordered_finish(ac_threaded_pipe_ordered_t *o);
+
+/* finishes and frees the stream */
+void ac_threaded_pipe_ordered_destroy(ac_threaded_pipe_ordered_t *o);
+
+/* waits (on a condition variable, which the workers signal as they become
+   idle) until no tasks are queued and every worker is idle, such as before
+   a restart hands the traffic to a new process.  The pipe stays open.
+   Returns false if timeout_ms (0 waits as long as it takes) passed first. */
+bool ac_threaded_pipe_drain(ac_threaded_pipe_t *h, uint64_t timeout_ms);
+
+/* the queued tasks are run before the workers are joined */
 void ac_threaded_pipe_close(ac_threaded_pipe_t *h);
 
+/* like ac_threaded_pipe_close, except that the tasks which haven't started
+   are passed to the expired callback (see ac_threaded_pipe_set_expired_cb)
+   or dropped instead of being run.  The tasks which are running finish
+   first.  The jobs of futures and ordered streams aren't run either, the
+   futures are done (and the results emitted) with a NULL result.  A restart can drain for as long as it can wait and then abort. */
+void ac_threaded_pipe_abort(ac_threaded_pipe_t *h);
+
 #ifdef __cplusplus
 }
 #endif
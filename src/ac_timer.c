@@ -14,19 +14,144 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
-#include "ac_allocator.h"
 #include "ac_timer.h"
+#include "ac_allocator.h"
+
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <time.h>
 
+#if AC_TIMER_CYCLES && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define AC_TIMER_TSC
+#elif AC_TIMER_CYCLES && defined(__aarch64__)
+#define AC_TIMER_CNTVCT
+#endif
+
 struct ac_timer_s {
-  long base;
+  int64_t base;
   int repeat;
-  long time_spent;
-  long start_time;
+  int64_t time_spent;
+  int64_t start_time;
 };
 
+/* the nanoseconds per tick of the clock source, set before clock_chosen */
+static double ns_per_tick = 1.0;
+/* the ticks when the clock was chosen (ac_timer_now_ns counts from it) */
+static uint64_t base_ticks = 0;
+static int clock_chosen = 0;
+#ifdef AC_TIMER_TSC
+static bool use_tsc = false;
+#endif
+
+static inline uint64_t clock_ns(void) {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef AC_TIMER_TSC
+/* the time stamp counter only measures time if it ticks at a constant rate
+   in every power state (the invariant tsc cpuid bit) */
+static bool invariant_tsc(void) {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+    return false;
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return (d >> 8) & 1;
+}
+#endif
+
+/* picks the clock source (and measures the frequency of the tsc) the first
+   time a timer is created or the time is read.  It only runs once, so that
+   every thread counts ac_timer_now_ns from the same base. */
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+
+static void pick_clock(void) {
+  double r = 1.0;
+  uint64_t base = 0;
+#if defined(AC_TIMER_TSC)
+  if (invariant_tsc()) {
+    uint64_t ns = clock_ns();
+    uint64_t ticks = __rdtsc();
+    uint64_t ns2, ticks2;
+    do {
+      ns2 = clock_ns();
+      ticks2 = __rdtsc();
+    } while (ns2 - ns < AC_TIMER_CALIBRATE_NS);
+    if (ticks2 > ticks) {
+      r = (double)(ns2 - ns) / (double)(ticks2 - ticks);
+      base = ticks;
+      use_tsc = true;
+    }
+  }
+#elif defined(AC_TIMER_CNTVCT)
+  uint64_t freq;
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+  r = 1000000000.0 / (double)freq;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(base));
+#endif
+  ns_per_tick = r;
+  base_ticks = base;
+  __atomic_store_n(&clock_chosen, 1, __ATOMIC_RELEASE);
+}
+
+static inline void choose_clock(void) {
+  if (!__atomic_load_n(&clock_chosen, __ATOMIC_ACQUIRE))
+    pthread_once(&clock_once, pick_clock);
+}
+
+/* start and end ticks are read so that the work being timed can't be moved
+   outside of them by the cpu */
+static inline int64_t start_ticks(void) {
+#if defined(AC_TIMER_TSC)
+  if (use_tsc) {
+    _mm_lfence();
+    return (int64_t)__rdtsc();
+  }
+#elif defined(AC_TIMER_CNTVCT)
+  uint64_t v;
+  __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v)::"memory");
+  return (int64_t)v;
+#endif
+  return (int64_t)clock_ns();
+}
+
+static inline int64_t end_ticks(void) {
+#if defined(AC_TIMER_TSC)
+  if (use_tsc) {
+    unsigned int aux;
+    int64_t v = (int64_t)__rdtscp(&aux);
+    _mm_lfence();
+    return v;
+  }
+#elif defined(AC_TIMER_CNTVCT)
+  uint64_t v;
+  __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v)::"memory");
+  return (int64_t)v;
+#endif
+  return (int64_t)clock_ns();
+}
+
+uint64_t ac_timer_now_ns(void) {
+  choose_clock();
+#if defined(AC_TIMER_TSC)
+  if (use_tsc)
+    return (uint64_t)((double)(__rdtsc() - base_ticks) * ns_per_tick);
+#elif defined(AC_TIMER_CNTVCT)
+  uint64_t v;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+  return (uint64_t)((double)(v - base_ticks) * ns_per_tick);
+#endif
+  return clock_ns();
+}
+
 #ifdef _AC_DEBUG_MEMORY_
 ac_timer_t *_ac_timer_init(int repeat, const char *caller) {
   ac_timer_t *t =
@@ -35,6 +160,7 @@ ac_timer_t *_ac_timer_init(int repeat, const char *caller) {
 ac_timer_t *_ac_timer_init(int repeat) {
   ac_timer_t *t = (ac_timer_t *)ac_malloc(sizeof(ac_timer_t));
 #endif
+  choose_clock();
   t->repeat = repeat;
   t->base = t->time_spent = t->start_time = 0;
   return t;
@@ -56,40 +182,20 @@ void ac_timer_add(ac_timer_t *t, ac_timer_t *add) {
   t->base += (add->time_spent + add->base);
 }
 
-void ac_timer_start(ac_timer_t *t) {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  t->start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
-}
+void ac_timer_start(ac_timer_t *t) { t->start_time = start_ticks(); }
 
 void ac_timer_stop(ac_timer_t *t) {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  long v = (tv.tv_sec * 1000000) + tv.tv_usec;
-  v -= t->start_time;
-  t->time_spent += v;
+  t->time_spent += end_ticks() - t->start_time;
 }
 
 double ac_timer_ns(ac_timer_t *t) {
   double r = t->repeat * 1.0;
-  double ts = t->time_spent + t->base;
-  return (ts * 1000.0) / r;
-}
-
-double ac_timer_us(ac_timer_t *t) {
-  double r = t->repeat * 1.0;
-  double ts = t->time_spent + t->base;
+  double ts = (t->time_spent + t->base) * ns_per_tick;
   return ts / r;
 }
 
-double ac_timer_ms(ac_timer_t *t) {
-  double r = t->repeat * 1.0;
-  double ts = t->time_spent + t->base;
-  return ts / (r * 1000.0);
-}
+double ac_timer_us(ac_timer_t *t) { return ac_timer_ns(t) / 1000.0; }
 
-double ac_timer_sec(ac_timer_t *t) {
-  double r = t->repeat * 1.0;
-  double ts = t->time_spent + t->base;
-  return ts / (r * 1000000.0);
-}
+double ac_timer_ms(ac_timer_t *t) { return ac_timer_ns(t) / 1000000.0; }
+
+double ac_timer_sec(ac_timer_t *t) { return ac_timer_ns(t) / 1000000000.0; }
@@ -19,10 +19,29 @@ limitations under the License.
 
 #include "ac_common.h"
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+  Timers read CLOCK_MONOTONIC_RAW, which isn't adjusted by NTP.  If
+  AC_TIMER_CYCLES is non-zero (the default), an x86 cpu with an invariant
+  time stamp counter is timed with rdtsc/rdtscp and an ARM64 cpu with the
+  virtual counter, so that a start/stop costs a few nanoseconds.  The tsc
+  frequency is measured against the monotonic clock for
+  AC_TIMER_CALIBRATE_NS when the first timer is created.  Times are always
+  reported in true nanoseconds (or a multiple of them).
+*/
+#ifndef AC_TIMER_CYCLES
+#define AC_TIMER_CYCLES 1
+#endif
+
+#ifndef AC_TIMER_CALIBRATE_NS
+#define AC_TIMER_CALIBRATE_NS 5000000
+#endif
+
 struct ac_timer_s;
 typedef struct ac_timer_s ac_timer_t;
 
@@ -69,6 +88,15 @@ double ac_timer_us(ac_timer_t *t);
 double ac_timer_ms(ac_timer_t *t);
 double ac_timer_sec(ac_timer_t *t);
 
+/*
+  The current time in nanoseconds from the clock which the timers use.  With
+  the time stamp counter, this is one rdtsc (without the fences which keep
+  the work being timed between a start and a stop) and a multiply, so it can
+  be read for every request.  Only the difference between two times has a
+  meaning.
+*/
+uint64_t ac_timer_now_ns(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,118 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_timer_wheel.h"
+
+#include <string.h>
+
+#define SLOT_BITS 6
+#define SLOT_MASK 63
+
+void ac_timer_wheel_init(ac_timer_wheel_t *w, uint64_t now) {
+  memset(w, 0, sizeof(*w));
+  w->now = now;
+}
+
+static inline void link_node(ac_timer_wheel_node_t **head,
+                             ac_timer_wheel_node_t *n) {
+  n->next = *head;
+  if (n->next)
+    n->next->pprev = &n->next;
+  n->pprev = head;
+  *head = n;
+}
+
+/* places n (which isn't linked) by its distance from now */
+static void place(ac_timer_wheel_t *w, ac_timer_wheel_node_t *n) {
+  uint64_t expires = n->expires;
+  uint64_t distance = expires > w->now ? expires - w->now : 0;
+  int level = 0;
+  while (level < AC_TIMER_WHEEL_LEVELS - 1 &&
+         distance >> (SLOT_BITS * (level + 1)))
+    level++;
+  int shift = SLOT_BITS * level;
+  if (distance >> (shift + SLOT_BITS))
+    /* out of range, the slot which is spread out last */
+    expires = w->now + ((uint64_t)SLOT_MASK << shift);
+  else if (!distance)
+    expires = w->now;
+  link_node(&w->slots[level][(expires >> shift) & SLOT_MASK], n);
+}
+
+void ac_timer_wheel_add(ac_timer_wheel_t *w, ac_timer_wheel_node_t *n,
+                        uint64_t ticks) {
+  ac_timer_wheel_cancel(w, n);
+  n->expires = w->now + (ticks ? ticks : 1);
+  place(w, n);
+  w->count++;
+}
+
+/* moves the timers of a slot to the levels below */
+static void cascade(ac_timer_wheel_t *w, int level) {
+  int shift = SLOT_BITS * level;
+  ac_timer_wheel_node_t **head =
+      &w->slots[level][(w->now >> shift) & SLOT_MASK];
+  ac_timer_wheel_node_t *n = *head;
+  *head = NULL;
+  while (n) {
+    ac_timer_wheel_node_t *next = n->next;
+    place(w, n);
+    n = next;
+  }
+}
+
+static size_t fire(ac_timer_wheel_t *w) {
+  ac_timer_wheel_node_t **slot = &w->slots[0][w->now & SLOT_MASK];
+  if (!*slot)
+    return 0;
+  /* the callbacks may add timers to this slot (for the next lap), so the
+     timers are moved to a list of their own first */
+  ac_timer_wheel_node_t *head = *slot;
+  *slot = NULL;
+  head->pprev = &head;
+  size_t r = 0;
+  while (head) {
+    ac_timer_wheel_node_t *n = head;
+    ac_timer_wheel_cancel(w, n);
+    r++;
+    n->cb(w, n);
+  }
+  return r;
+}
+
+size_t ac_timer_wheel_advance(ac_timer_wheel_t *w, uint64_t now) {
+  size_t r = 0;
+  while (w->now < now) {
+    if (!w->count) {
+      w->now = now;
+      break;
+    }
+    w->now++;
+    if (!(w->now & SLOT_MASK)) {
+      /* the highest level which wrapped is spread out first, so its timers
+         can land in the slots of the levels below which are spread next */
+      int level = 1;
+      while (level < AC_TIMER_WHEEL_LEVELS - 1 &&
+             !((w->now >> (SLOT_BITS * level)) & SLOT_MASK))
+        level++;
+      for (; level > 0; level--)
+        cascade(w, level);
+    }
+    r += fire(w);
+  }
+  return r;
+}
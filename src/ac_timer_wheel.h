@@ -0,0 +1,111 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_timer_wheel_H
+#define _ac_timer_wheel_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_timer_wheel_t is a hierarchical hashed timing wheel for large numbers of
+  timeouts which are mostly cancelled or pushed back before they fire (such
+  as the idle timeout of every connection of a server).  Time is counted in
+  ticks of whatever length the caller chooses, and the wheel is moved
+  forward by ac_timer_wheel_advance (typically from one repeating uv_timer
+  or a thread which sleeps for a tick).
+
+  The wheel has AC_TIMER_WHEEL_LEVELS levels of 64 slots.  A timer is added
+  to the slot of the lowest level which covers its distance from now, so an
+  add or a cancel only links or unlinks a node from a doubly linked list.
+  When the lowest level wraps around, the next slot of the level above is
+  spread over the level below (a timer is moved at most once per level).
+  Timers further out than 64^AC_TIMER_WHEEL_LEVELS ticks are parked in the
+  top level until they are in range.  A timer fires on the tick it expires
+  (or on the first advance after it).
+
+  The nodes are intrusive, like ac_map_t, an ac_timer_wheel_node_t is
+  embedded in the object which times out and ac_parent_object gets back to
+  it in the callback.  The wheel never allocates and isn't thread-safe.
+*/
+
+#ifndef AC_TIMER_WHEEL_LEVELS
+#define AC_TIMER_WHEEL_LEVELS 4
+#endif
+
+struct ac_timer_wheel_s;
+typedef struct ac_timer_wheel_s ac_timer_wheel_t;
+
+struct ac_timer_wheel_node_s;
+typedef struct ac_timer_wheel_node_s ac_timer_wheel_node_t;
+
+typedef void (*ac_timer_wheel_f)(ac_timer_wheel_t *w, ac_timer_wheel_node_t *n);
+
+struct ac_timer_wheel_node_s {
+  ac_timer_wheel_node_t *next;
+  /* the pointer which points to this node, NULL if it isn't scheduled */
+  ac_timer_wheel_node_t **pprev;
+  uint64_t expires;
+  ac_timer_wheel_f cb;
+};
+
+struct ac_timer_wheel_s {
+  uint64_t now;
+  size_t count;
+  ac_timer_wheel_node_t *slots[AC_TIMER_WHEEL_LEVELS][64];
+};
+
+/* the wheel starts at tick now */
+void ac_timer_wheel_init(ac_timer_wheel_t *w, uint64_t now);
+
+/* a node must be initialized before it is first added */
+static inline void ac_timer_wheel_node_init(ac_timer_wheel_node_t *n,
+                                            ac_timer_wheel_f cb);
+
+/* fire n ticks from now (at least 1), a node which is already scheduled is
+   moved */
+void ac_timer_wheel_add(ac_timer_wheel_t *w, ac_timer_wheel_node_t *n,
+                        uint64_t ticks);
+
+/* nothing happens if n isn't scheduled */
+static inline void ac_timer_wheel_cancel(ac_timer_wheel_t *w,
+                                         ac_timer_wheel_node_t *n);
+
+static inline bool ac_timer_wheel_pending(ac_timer_wheel_node_t *n);
+
+/* moves the wheel forward to tick now and calls the callback of every timer
+   which expired (in the order of their ticks).  A callback may add or cancel
+   any timer, including its own.  Returns the number of timers which fired. */
+size_t ac_timer_wheel_advance(ac_timer_wheel_t *w, uint64_t now);
+
+static inline uint64_t ac_timer_wheel_now(ac_timer_wheel_t *w);
+
+/* the number of scheduled timers */
+static inline size_t ac_timer_wheel_count(ac_timer_wheel_t *w);
+
+#include "impl/ac_timer_wheel.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
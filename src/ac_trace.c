@@ -0,0 +1,212 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ac_trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+__thread ac_trace_buffer_t *_ac_trace_buffer = NULL;
+bool _ac_trace_on = true;
+
+/* every buffer which has been created (protected by lock) */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static ac_trace_buffer_t *buffers = NULL;
+static pthread_key_t thread_key;
+static uint32_t next_tid = 1;
+
+/* a timestamp and the time it was taken at, the timestamps of a trace are
+   converted to time using this and a second pair taken when dumping */
+static uint64_t anchor_ticks = 0;
+static uint64_t anchor_ns = 0;
+
+typedef struct {
+  ac_trace_buffer_t buffer;
+  bool exited;
+} trace_buffer_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void thread_exit(void *arg) {
+  trace_buffer_t *b = (trace_buffer_t *)arg;
+  pthread_mutex_lock(&lock);
+  b->exited = true;
+  pthread_mutex_unlock(&lock);
+}
+
+void ac_trace_enable(bool on) {
+  __atomic_store_n(&_ac_trace_on, on, __ATOMIC_RELAXED);
+}
+
+bool ac_trace_enabled(void) {
+  return __atomic_load_n(&_ac_trace_on, __ATOMIC_RELAXED);
+}
+
+/* The buffers are allocated with malloc instead of ac_malloc because they
+   are never freed (a buffer whose thread exited is reused by the next
+   thread to trace). */
+ac_trace_buffer_t *_ac_trace_thread_buffer(void) {
+  pthread_mutex_lock(&lock);
+  if (!anchor_ns) {
+    pthread_key_create(&thread_key, thread_exit);
+    anchor_ticks = _ac_trace_now();
+    anchor_ns = now_ns();
+  }
+  trace_buffer_t *b = NULL;
+  /* the buffer of a thread which exited can be reused once its events have
+     been dumped or reset */
+  for (ac_trace_buffer_t *p = buffers; p; p = p->next) {
+    if (((trace_buffer_t *)p)->exited && p->start == p->pos) {
+      b = (trace_buffer_t *)p;
+      break;
+    }
+  }
+  if (!b) {
+    b = (trace_buffer_t *)malloc(sizeof(trace_buffer_t));
+    b->buffer.events = (ac_trace_event_t *)malloc(sizeof(ac_trace_event_t) *
+                                                  AC_TRACE_BUFFER_SIZE);
+    if (!b->buffer.events)
+      abort();
+    b->buffer.pos = 0;
+    b->buffer.next = buffers;
+    buffers = &b->buffer;
+  }
+  b->buffer.start = b->buffer.pos;
+  b->buffer.tid = next_tid++;
+  b->buffer.thread_name = NULL;
+  b->exited = false;
+  pthread_setspecific(thread_key, b);
+  pthread_mutex_unlock(&lock);
+  _ac_trace_buffer = &b->buffer;
+  return &b->buffer;
+}
+
+void ac_trace_name_thread(const char *name) {
+  ac_trace_buffer_t *b = _ac_trace_buffer;
+  if (!b)
+    b = _ac_trace_thread_buffer();
+  pthread_mutex_lock(&lock);
+  b->thread_name = name;
+  pthread_mutex_unlock(&lock);
+}
+
+void ac_trace_reset(void) {
+  pthread_mutex_lock(&lock);
+  for (ac_trace_buffer_t *b = buffers; b; b = b->next)
+    b->start = __atomic_load_n(&b->pos, __ATOMIC_ACQUIRE);
+  pthread_mutex_unlock(&lock);
+}
+
+static void print_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', out);
+    if ((unsigned char)*s >= ' ')
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+void ac_trace_dump(FILE *out) {
+  ac_trace_event_t *events = (ac_trace_event_t *)malloc(
+      sizeof(ac_trace_event_t) * AC_TRACE_BUFFER_SIZE);
+  if (!events)
+    abort();
+  int pid = (int)getpid();
+  bool first = true;
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  pthread_mutex_lock(&lock);
+  double us_per_tick = 0.001;
+#ifdef _AC_TRACE_TSC
+  if (anchor_ns) {
+    uint64_t ticks = _ac_trace_now();
+    uint64_t ns = now_ns();
+    if (ticks > anchor_ticks)
+      us_per_tick = 0.001 * (double)(ns - anchor_ns) / (ticks - anchor_ticks);
+  }
+#endif
+  for (ac_trace_buffer_t *b = buffers; b; b = b->next) {
+    uint64_t end = __atomic_load_n(&b->pos, __ATOMIC_ACQUIRE);
+    uint64_t start = b->start;
+    bool exited = ((trace_buffer_t *)b)->exited;
+    if (exited) {
+      /* the thread is gone, so its events are only written once */
+      if (start == end)
+        continue;
+      b->start = end;
+    }
+    if (end - start > AC_TRACE_BUFFER_SIZE)
+      start = end - AC_TRACE_BUFFER_SIZE;
+    for (uint64_t i = start; i < end; i++)
+      events[i & (AC_TRACE_BUFFER_SIZE - 1)] =
+          b->events[i & (AC_TRACE_BUFFER_SIZE - 1)];
+    /* the thread may have wrapped around onto the oldest events while they
+       were copied (and may be writing the slot of event now) */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&b->pos, __ATOMIC_ACQUIRE);
+    if (now - start >= AC_TRACE_BUFFER_SIZE)
+      start = now - AC_TRACE_BUFFER_SIZE + 1;
+    if (start > end)
+      start = end;
+
+    if (b->thread_name) {
+      fprintf(out,
+              "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+              "\"tid\": %u, \"args\": {\"name\": ",
+              first ? "" : ",", pid, b->tid);
+      print_string(out, b->thread_name);
+      fprintf(out, "}}");
+      first = false;
+    }
+    for (uint64_t i = start; i < end; i++) {
+      ac_trace_event_t *e = events + (i & (AC_TRACE_BUFFER_SIZE - 1));
+      double ts = (double)(int64_t)(e->ts - anchor_ticks) * us_per_tick;
+      fprintf(out, "%s\n  {\"name\": ", first ? "" : ",");
+      print_string(out, e->name);
+      fprintf(out, ", \"ph\": \"%c\", \"ts\": %0.3f, \"pid\": %d, \"tid\": %u",
+              e->phase, ts, pid, b->tid);
+      if (e->phase == 'i')
+        fprintf(out, ", \"s\": \"t\", \"args\": {\"arg\": %llu}",
+                (unsigned long long)e->arg);
+      else if (e->phase == 'C')
+        fprintf(out, ", \"args\": {\"value\": %llu}",
+                (unsigned long long)e->arg);
+      fprintf(out, "}");
+      first = false;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  fprintf(out, "\n]}\n");
+  free(events);
+}
+
+bool ac_trace_dump_file(const char *filename) {
+  FILE *out = fopen(filename, "w");
+  if (!out)
+    return false;
+  ac_trace_dump(out);
+  fclose(out);
+  return true;
+}
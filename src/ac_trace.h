@@ -0,0 +1,103 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_trace_H
+#define _ac_trace_H
+
+#include "ac_common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_trace records where time goes in hot paths.  Probes write a timestamp,
+  the probe's name (a string literal, its address is the probe id), and an
+  argument into a ring buffer which belongs to the thread, so a probe never
+  takes a lock and costs a few nanoseconds.  Each ring keeps the last
+  AC_TRACE_BUFFER_SIZE (a power of two) events of its thread.  ac_trace_dump
+  writes every thread's events as Chrome trace (Perfetto) json, which can be
+  opened in chrome://tracing or ui.perfetto.dev.  The ring of a thread which
+  exits is kept until its events have been dumped (or reset) and is then
+  reused by the next thread which traces.
+
+  The probes are macros which are compiled out unless AC_TRACE is defined,
+  so they cost nothing in a normal build.  The functions below always
+  exist.  With AC_TRACE, tracing is on until ac_trace_enable(false).
+
+    void handle(request_t *r) {
+      AC_TRACE_SCOPE("handle");
+      ...
+      AC_TRACE_EVENT("cache_miss", r->id);
+    }
+
+  On x86, the timestamps are the time stamp counter (which is assumed to
+  be invariant, as on all recent cpus).  They are converted to time when
+  the trace is dumped.  Define AC_TRACE_MONOTONIC to use clock_gettime
+  instead.
+*/
+
+#ifndef AC_TRACE_BUFFER_SIZE
+#define AC_TRACE_BUFFER_SIZE 16384
+#endif
+
+#ifdef AC_TRACE
+/* the start and end of a span on the current thread */
+#define AC_TRACE_BEGIN(name) _ac_trace_write('B', name, 0)
+#define AC_TRACE_END(name) _ac_trace_write('E', name, 0)
+/* a span which ends when the enclosing block exits */
+#define AC_TRACE_SCOPE(name) _AC_TRACE_SCOPE(name, __LINE__)
+/* a point in time with an argument */
+#define AC_TRACE_EVENT(name, arg) _ac_trace_write('i', name, arg)
+/* the value of a counter (shown as a graph) */
+#define AC_TRACE_COUNTER(name, value) _ac_trace_write('C', name, value)
+#else
+#define AC_TRACE_BEGIN(name) ((void)0)
+#define AC_TRACE_END(name) ((void)0)
+#define AC_TRACE_SCOPE(name) ((void)0)
+#define AC_TRACE_EVENT(name, arg) ((void)0)
+#define AC_TRACE_COUNTER(name, value) ((void)0)
+#endif
+
+/* pause or resume recording (for every thread) */
+void ac_trace_enable(bool on);
+bool ac_trace_enabled(void);
+
+/* name the current thread in the trace (name should be a literal or live
+   as long as the trace) */
+void ac_trace_name_thread(const char *name);
+
+/* write the events recorded since the last reset as Chrome trace json.
+   Threads may keep recording while the trace is dumped, events which are
+   overwritten during the dump are left out.  Returns false if filename
+   can't be written. */
+void ac_trace_dump(FILE *out);
+bool ac_trace_dump_file(const char *filename);
+
+/* forget the events recorded so far */
+void ac_trace_reset(void);
+
+#include "impl/ac_trace.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
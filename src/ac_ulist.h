@@ -0,0 +1,98 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _ac_ulist_H
+#define _ac_ulist_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_ulist is an unrolled list (a deque) of a given type.  Each node holds
+  an array of items, so iterating reads consecutive memory instead of
+  following a pointer to a new cache line for every item, and adding an
+  item only allocates once per node.  Items are added and removed at either
+  end in O(1) and can be erased while iterating.
+
+  If a pool is passed to name_init, nodes are allocated from the pool (an
+  arena which is cleared or destroyed all at once, so name_destroy doesn't
+  need to be called).  Otherwise, ac_malloc is used and name_destroy frees
+  the nodes.  Either way, nodes which empty are kept on a freelist and
+  reused, so a list used as a queue stops allocating once it reaches its
+  largest size.
+
+  Each node is about AC_ULIST_NODE_SIZE bytes (and holds at least 4 items).
+
+  Place ac_ulist_def where the declarations are needed (it defines the
+  types) and ac_ulist_m in one source file.
+
+  ac_ulist_def(name, type)
+  ac_ulist_m(name, type)
+    defines: name_t, name_node_t, name_iter_t
+
+    void name_init(name_t *h, ac_pool_t *pool);
+    void name_destroy(name_t *h);
+
+    void name_push_back(name_t *h, type item);
+    void name_push_front(name_t *h, type item);
+
+    removes the first (or last) item and copies it to item, returns false
+    if the list is empty
+    bool name_pop_front(name_t *h, type *item);
+    bool name_pop_back(name_t *h, type *item);
+
+    the first (or last) item, NULL if the list is empty
+    type *name_front(name_t *h);
+    type *name_back(name_t *h);
+
+    removes all of the items (keeping the nodes for reuse)
+    void name_clear(name_t *h);
+    size_t name_size(name_t *h);
+
+    iterate over the items in order, each returns NULL at the end
+    type *name_first(name_t *h, name_iter_t *it);
+    type *name_next(name_iter_t *it);
+
+    erase the item which it is on and return the one after it (it moves to
+    that item)
+    type *name_erase(name_t *h, name_iter_t *it);
+
+  The nodes can also be visited directly, which lets a loop work on an
+  array at a time:
+
+    for (name_node_t *n = h->head; n; n = n->next)
+      process(n->items + n->start, n->num);
+*/
+
+#ifndef AC_ULIST_NODE_SIZE
+#define AC_ULIST_NODE_SIZE 512
+#endif
+
+#include "impl/ac_ulist.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,375 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef struct op_s {
+  ac_uring_f cb;
+  void *arg;
+  struct op_s *next;
+} op_t;
+
+struct ac_uring_s {
+  int fd;
+  int event_fd;
+  unsigned entries;
+
+  /* the submission ring, the kernel moves head */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  /* the completion ring, the kernel moves tail */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  /* requests which are queued but not submitted */
+  unsigned to_submit;
+  size_t pending;
+
+  /* one op for every request which can be in flight */
+  op_t *ops;
+  op_t *free_ops;
+
+  struct iovec *buffers;
+  unsigned num_buffers;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg,
+                          unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_uring_t *_ac_uring_init(unsigned entries, const char *caller) {
+#else
+ac_uring_t *_ac_uring_init(unsigned entries) {
+#endif
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = uring_setup(entries, &p);
+  if (fd < 0)
+    return NULL;
+
+  size_t sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && cq_ring_size > sq_ring_size)
+    sq_ring_size = cq_ring_size;
+  void *sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  void *cq_ring = sq_ring;
+  if (!single_mmap) {
+    cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      munmap(sq_ring, sq_ring_size);
+      close(fd);
+      return NULL;
+    }
+  }
+  size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (!single_mmap)
+      munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    close(fd);
+    return NULL;
+  }
+
+#ifdef _AC_DEBUG_MEMORY_
+  ac_uring_t *h = (ac_uring_t *)_ac_calloc_d(
+      NULL, caller, sizeof(ac_uring_t) + sizeof(op_t) * p.cq_entries, false);
+#else
+  ac_uring_t *h =
+      (ac_uring_t *)ac_calloc(sizeof(ac_uring_t) + sizeof(op_t) * p.cq_entries);
+#endif
+  h->fd = fd;
+  h->entries = p.sq_entries;
+  h->sq_ring = sq_ring;
+  h->sq_ring_size = sq_ring_size;
+  h->cq_ring = single_mmap ? NULL : cq_ring;
+  h->cq_ring_size = cq_ring_size;
+  h->sqes_size = sqes_size;
+
+  char *sq = (char *)sq_ring;
+  h->sq_head = (unsigned *)(sq + p.sq_off.head);
+  h->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  h->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  h->sq_array = (unsigned *)(sq + p.sq_off.array);
+  h->sqes = (struct io_uring_sqe *)sqes;
+  char *cq = (char *)cq_ring;
+  h->cq_head = (unsigned *)(cq + p.cq_off.head);
+  h->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  h->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  h->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  /* no more requests than completions can be in flight */
+  h->ops = (op_t *)(h + 1);
+  for (unsigned i = 0; i < p.cq_entries; i++) {
+    h->ops[i].next = h->free_ops;
+    h->free_ops = h->ops + i;
+  }
+
+  h->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (h->event_fd >= 0 &&
+      uring_register(fd, IORING_REGISTER_EVENTFD, &h->event_fd, 1) < 0) {
+    close(h->event_fd);
+    h->event_fd = -1;
+  }
+  return h;
+}
+
+void ac_uring_destroy(ac_uring_t *h) {
+  if (h->buffers)
+    ac_free(h->buffers);
+  if (h->event_fd >= 0)
+    close(h->event_fd);
+  munmap(h->sqes, h->sqes_size);
+  if (h->cq_ring)
+    munmap(h->cq_ring, h->cq_ring_size);
+  munmap(h->sq_ring, h->sq_ring_size);
+  close(h->fd);
+  ac_free(h);
+}
+
+bool ac_uring_register_buffers(ac_uring_t *h, void *base, size_t buffer_size,
+                               unsigned num) {
+  if (h->buffers)
+    return false;
+  struct iovec *iov = (struct iovec *)ac_malloc(sizeof(struct iovec) * num);
+  for (unsigned i = 0; i < num; i++) {
+    iov[i].iov_base = (char *)base + buffer_size * i;
+    iov[i].iov_len = buffer_size;
+  }
+  if (uring_register(h->fd, IORING_REGISTER_BUFFERS, iov, num) < 0) {
+    ac_free(iov);
+    return false;
+  }
+  h->buffers = iov;
+  h->num_buffers = num;
+  return true;
+}
+
+void *ac_uring_buffer(ac_uring_t *h, unsigned i) {
+  return h->buffers[i].iov_base;
+}
+
+static struct io_uring_sqe *get_sqe(ac_uring_t *h, ac_uring_f cb, void *arg) {
+  unsigned tail = *h->sq_tail;
+  unsigned head = __atomic_load_n(h->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= h->entries || !h->free_ops)
+    return NULL;
+  op_t *op = h->free_ops;
+  h->free_ops = op->next;
+  op->cb = cb;
+  op->arg = arg;
+
+  unsigned index = tail & h->sq_mask;
+  struct io_uring_sqe *sqe = h->sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+  h->sq_array[index] = index;
+  return sqe;
+}
+
+static void push_sqe(ac_uring_t *h) {
+  __atomic_store_n(h->sq_tail, *h->sq_tail + 1, __ATOMIC_RELEASE);
+  h->to_submit++;
+  h->pending++;
+}
+
+static bool queue_rw(ac_uring_t *h, int opcode, int fd, void *buf, size_t len,
+                     uint64_t offset, int buf_index, ac_uring_f cb,
+                     void *arg) {
+  struct io_uring_sqe *sqe = get_sqe(h, cb, arg);
+  if (!sqe)
+    return false;
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (unsigned)len;
+  sqe->off = offset;
+  if (buf_index >= 0)
+    sqe->buf_index = (uint16_t)buf_index;
+  push_sqe(h);
+  return true;
+}
+
+bool ac_uring_read(ac_uring_t *h, int fd, void *buf, size_t len,
+                   uint64_t offset, ac_uring_f cb, void *arg) {
+  return queue_rw(h, IORING_OP_READ, fd, buf, len, offset, -1, cb, arg);
+}
+
+bool ac_uring_write(ac_uring_t *h, int fd, const void *buf, size_t len,
+                    uint64_t offset, ac_uring_f cb, void *arg) {
+  return queue_rw(h, IORING_OP_WRITE, fd, (void *)buf, len, offset, -1, cb,
+                  arg);
+}
+
+bool ac_uring_read_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                         uint64_t offset, ac_uring_f cb, void *arg) {
+  return queue_rw(h, IORING_OP_READ_FIXED, fd, h->buffers[i].iov_base, len,
+                  offset, i, cb, arg);
+}
+
+bool ac_uring_write_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                          uint64_t offset, ac_uring_f cb, void *arg) {
+  return queue_rw(h, IORING_OP_WRITE_FIXED, fd, h->buffers[i].iov_base, len,
+                  offset, i, cb, arg);
+}
+
+int ac_uring_submit(ac_uring_t *h) {
+  int submitted = 0;
+  while (h->to_submit) {
+    int n = uring_enter(h->fd, h->to_submit, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        break;
+      abort();
+    }
+    h->to_submit -= n;
+    submitted += n;
+  }
+  return submitted;
+}
+
+int ac_uring_complete(ac_uring_t *h, bool wait) {
+  if (h->event_fd >= 0) {
+    uint64_t v;
+    ssize_t r = read(h->event_fd, &v, sizeof(v));
+    (void)r;
+  }
+  ac_uring_submit(h);
+  unsigned head = *h->cq_head;
+  if (wait && h->pending &&
+      head == __atomic_load_n(h->cq_tail, __ATOMIC_ACQUIRE)) {
+    while (uring_enter(h->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+      if (errno != EINTR)
+        abort();
+    }
+  }
+  int n = 0;
+  while (head != __atomic_load_n(h->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = h->cqes + (head & h->cq_mask);
+    op_t *op = (op_t *)(uintptr_t)cqe->user_data;
+    int res = cqe->res;
+    head++;
+    /* release the entry before the callback, which may queue requests */
+    __atomic_store_n(h->cq_head, head, __ATOMIC_RELEASE);
+    h->pending--;
+    ac_uring_f cb = op->cb;
+    void *arg = op->arg;
+    op->next = h->free_ops;
+    h->free_ops = op;
+    if (cb)
+      cb(arg, res);
+    n++;
+    head = *h->cq_head;
+  }
+  return n;
+}
+
+size_t ac_uring_pending(ac_uring_t *h) { return h->pending; }
+
+int ac_uring_eventfd(ac_uring_t *h) { return h->event_fd; }
+
+#else
+
+#ifdef _AC_DEBUG_MEMORY_
+ac_uring_t *_ac_uring_init(unsigned entries, const char *caller) {
+#else
+ac_uring_t *_ac_uring_init(unsigned entries) {
+#endif
+  return NULL;
+}
+
+void ac_uring_destroy(ac_uring_t *h) {}
+
+bool ac_uring_register_buffers(ac_uring_t *h, void *base, size_t buffer_size,
+                               unsigned num) {
+  return false;
+}
+
+void *ac_uring_buffer(ac_uring_t *h, unsigned i) { return NULL; }
+
+bool ac_uring_read(ac_uring_t *h, int fd, void *buf, size_t len,
+                   uint64_t offset, ac_uring_f cb, void *arg) {
+  return false;
+}
+
+bool ac_uring_write(ac_uring_t *h, int fd, const void *buf, size_t len,
+                    uint64_t offset, ac_uring_f cb, void *arg) {
+  return false;
+}
+
+bool ac_uring_read_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                         uint64_t offset, ac_uring_f cb, void *arg) {
+  return false;
+}
+
+bool ac_uring_write_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                          uint64_t offset, ac_uring_f cb, void *arg) {
+  return false;
+}
+
+int ac_uring_submit(ac_uring_t *h) { return 0; }
+
+int ac_uring_complete(ac_uring_t *h, bool wait) { return 0; }
+
+size_t ac_uring_pending(ac_uring_t *h) { return 0; }
+
+int ac_uring_eventfd(ac_uring_t *h) { return -1; }
+
+#endif
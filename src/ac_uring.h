@@ -0,0 +1,107 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_uring_H
+#define _ac_uring_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_uring_t batches reads and writes through an io_uring (using the system
+  calls directly, liburing isn't needed).  Reads and writes are queued and
+  then sent to the kernel with one ac_uring_submit, and ac_uring_complete
+  calls the callback of every finished request.  A ring belongs to one
+  thread (a uv loop or an ac_threaded_pipe worker).
+
+  To use the ring as a completion source for a loop, poll ac_uring_eventfd
+  (with uv_poll) and call ac_uring_complete(h, false) when it is readable.  A
+  completion callback can hand the result on with ac_threaded_pipe_write.
+
+  Buffers (for example a block from ac_pool_alloc or ac_slab) can be
+  registered once so that the fixed variants don't map the pages for every
+  request.  ac_uring_init returns NULL if io_uring isn't available (another
+  OS, an old kernel, or a seccomp policy), in which case plain read/write
+  should be used.
+*/
+struct ac_uring_s;
+typedef struct ac_uring_s ac_uring_t;
+
+/* res is the number of bytes transferred or -errno */
+typedef void (*ac_uring_f)(void *arg, int res);
+
+/* use as the offset of pipes, sockets, and to read at the file position */
+#define AC_URING_NO_OFFSET ((uint64_t)-1)
+
+/* entries is the number of requests which can be queued at once */
+#ifdef _AC_DEBUG_MEMORY_
+#define ac_uring_init(entries)                                                 \
+  _ac_uring_init(entries, AC_FILE_LINE_MACRO("ac_uring"))
+ac_uring_t *_ac_uring_init(unsigned entries, const char *caller);
+#else
+#define ac_uring_init(entries) _ac_uring_init(entries)
+ac_uring_t *_ac_uring_init(unsigned entries);
+#endif
+
+void ac_uring_destroy(ac_uring_t *h);
+
+/* register num buffers of buffer_size bytes each starting at base, returns
+   false if the kernel refuses (the memory is locked, see RLIMIT_MEMLOCK) */
+bool ac_uring_register_buffers(ac_uring_t *h, void *base, size_t buffer_size,
+                               unsigned num);
+
+/* the registered buffer i */
+void *ac_uring_buffer(ac_uring_t *h, unsigned i);
+
+/* queue a request, returns false if the ring is full (submit and complete
+   some requests and try again) */
+bool ac_uring_read(ac_uring_t *h, int fd, void *buf, size_t len,
+                   uint64_t offset, ac_uring_f cb, void *arg);
+bool ac_uring_write(ac_uring_t *h, int fd, const void *buf, size_t len,
+                    uint64_t offset, ac_uring_f cb, void *arg);
+
+/* read into (or write from) the first len bytes of registered buffer i */
+bool ac_uring_read_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                         uint64_t offset, ac_uring_f cb, void *arg);
+bool ac_uring_write_fixed(ac_uring_t *h, int fd, unsigned i, size_t len,
+                          uint64_t offset, ac_uring_f cb, void *arg);
+
+/* send the queued requests to the kernel, returns the number sent */
+int ac_uring_submit(ac_uring_t *h);
+
+/* call the callbacks of the finished requests (waiting for at least one if
+   wait is true and requests are pending), returns the number called.  Queued
+   requests are submitted first. */
+int ac_uring_complete(ac_uring_t *h, bool wait);
+
+/* the number of requests which haven't completed */
+size_t ac_uring_pending(ac_uring_t *h);
+
+/* an eventfd which is readable when requests have completed (-1 if it
+   couldn't be registered) */
+int ac_uring_eventfd(ac_uring_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_vector_H
+#define _ac_vector_H
+
+#include "ac_allocator.h"
+#include "ac_common.h"
+#include "ac_pool.h"
+#include "ac_search.h"
+#include "ac_sort.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  ac_vector is a growable array of a given type.  The array doubles when it
+  runs out of room, so appending n items copies at most 2n items (an
+  ac_buffer grows by a little less than an eighth and works in bytes).
+
+  If a pool is passed to name_init, the array is allocated from the pool.
+  When the array is the last allocation from the pool, it is extended in
+  place (see ac_pool_extend) instead of being copied, so a vector which is
+  filled before anything else is allocated from the pool never moves until
+  the pool's block is full.  Otherwise, the old array is left in the pool
+  until it is cleared.  Without a pool, ac_realloc is used and name_destroy
+  frees the array.
+
+  The items are in base[0..num) and can be used directly, such as with the
+  functions created by ac_sort_m or ac_search_m.  Any function which grows
+  the vector can move base.
+
+  Place ac_vector_def where the declarations are needed (it defines the
+  type) and ac_vector_m in one source file.
+
+  ac_vector_def(name, type)
+  ac_vector_m(name, type)
+    defines: name_t { type *base; size_t num; size_t size; ... }
+
+    size is the number of items to reserve room for (it can be 0)
+    void name_init(name_t *h, ac_pool_t *pool, size_t size);
+    void name_destroy(name_t *h);
+
+    makes room for at least size items
+    void name_reserve(name_t *h, size_t size);
+
+    appends an item
+    void name_push(name_t *h, type item);
+
+    appends n uninitialized items and returns the first one
+    type *name_append(name_t *h, size_t n);
+
+    removes the last item and returns it (or NULL if the vector is empty),
+    the item is valid until the vector grows
+    type *name_pop(name_t *h);
+
+    sets the number of items (new items are uninitialized)
+    void name_resize(name_t *h, size_t num);
+
+    removes all of the items (keeping the array)
+    void name_clear(name_t *h);
+    size_t name_size(name_t *h);
+
+  The following create functions which sort and search a vector using the
+  macros in ac_sort.h and ac_search.h (the compare functions are the same).
+  Place them after ac_vector_def.
+
+  ac_vector_sort_m(name, type, compare)
+    expects: int compare(const type *a, const type *b);
+    returns: void name_sort(name_t *h);
+
+  ac_vector_search_m(name, keytype, type, compare)
+    expects: int compare(keytype *key, type *item);
+    returns: type *name_search(name_t *h, keytype *key);
+             type *name_lower_bound(name_t *h, keytype *key);
+*/
+
+#include "impl/ac_vector.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+struct ac_bloom_s {
+  uint32_t *blocks;
+  uint64_t num_blocks;
+};
+
+/* each word of a block gets the bit selected by the top 5 bits of the key
+   times its salt */
+static const uint32_t ac_bloom_salt[8] = {0x47b6137bU, 0x44974d91U,
+                                          0x8824ad5bU, 0xa2b7289dU,
+                                          0x705495c7U, 0x2df1424bU,
+                                          0x9efc4947U, 0x5c6bfb31U};
+
+static inline uint32_t *_ac_bloom_block(ac_bloom_t *h, uint64_t hash) {
+  return h->blocks + (((hash >> 32) * h->num_blocks) >> 32) * 8;
+}
+
+#ifdef __AVX2__
+static inline __m256i _ac_bloom_mask(uint32_t key) {
+  __m256i salt = _mm256_loadu_si256((const __m256i *)ac_bloom_salt);
+  __m256i bits = _mm256_srli_epi32(
+      _mm256_mullo_epi32(_mm256_set1_epi32((int)key), salt), 27);
+  return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+}
+
+static inline void ac_bloom_add(ac_bloom_t *h, uint64_t hash) {
+  __m256i *b = (__m256i *)_ac_bloom_block(h, hash);
+  _mm256_storeu_si256(b, _mm256_or_si256(_mm256_loadu_si256(b),
+                                         _ac_bloom_mask((uint32_t)hash)));
+}
+
+static inline bool ac_bloom_maybe_contains(ac_bloom_t *h, uint64_t hash) {
+  __m256i b = _mm256_loadu_si256((const __m256i *)_ac_bloom_block(h, hash));
+  return _mm256_testc_si256(b, _ac_bloom_mask((uint32_t)hash));
+}
+#else
+static inline void ac_bloom_add(ac_bloom_t *h, uint64_t hash) {
+  uint32_t *b = _ac_bloom_block(h, hash);
+  uint32_t key = (uint32_t)hash;
+  for (int i = 0; i < 8; i++)
+    b[i] |= 1U << ((key * ac_bloom_salt[i]) >> 27);
+}
+
+static inline bool ac_bloom_maybe_contains(ac_bloom_t *h, uint64_t hash) {
+  const uint32_t *b = _ac_bloom_block(h, hash);
+  uint32_t key = (uint32_t)hash;
+  uint32_t missing = 0;
+  for (int i = 0; i < 8; i++)
+    missing |= ~b[i] & (1U << ((key * ac_bloom_salt[i]) >> 27));
+  return !missing;
+}
+#endif
+
+static inline void ac_bloom_add_atomic(ac_bloom_t *h, uint64_t hash) {
+  uint32_t *b = _ac_bloom_block(h, hash);
+  uint32_t key = (uint32_t)hash;
+  for (int i = 0; i < 8; i++) {
+    uint32_t bit = 1U << ((key * ac_bloom_salt[i]) >> 27);
+    if (!(__atomic_load_n(b + i, __ATOMIC_RELAXED) & bit))
+      __atomic_fetch_or(b + i, bit, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,494 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+/* keys are packed into arrays of about AC_BTREE_NODE_BYTES bytes so that a
+   search within a node only touches a few cache lines */
+#define AC_BTREE_NODE_BYTES 256
+#define AC_BTREE_KEYS(keytype)                                                 \
+  (sizeof(keytype) > AC_BTREE_NODE_BYTES / 4                                   \
+       ? 4                                                                     \
+       : (int)(AC_BTREE_NODE_BYTES / sizeof(keytype)))
+
+/* with at least 2 keys per node, 32 levels is far more than enough */
+#define AC_BTREE_MAX_HEIGHT 32
+
+#define ac_btree_def(name, keytype, valuetype)                                 \
+  typedef struct name##_node_s {                                               \
+    int num_keys;                                                              \
+    bool leaf;                                                                 \
+    keytype keys[AC_BTREE_KEYS(keytype)];                                      \
+  } name##_node_t;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node_t node;                                                        \
+    valuetype values[AC_BTREE_KEYS(keytype)];                                  \
+    name##_node_t *next;                                                       \
+    name##_node_t *prev;                                                       \
+  } name##_leaf_t;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node_t node;                                                        \
+    name##_node_t *children[AC_BTREE_KEYS(keytype) + 1];                       \
+  } name##_inner_t;                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node_t *root;                                                       \
+    size_t size;                                                               \
+    int height;                                                                \
+  } name##_t;                                                                  \
+                                                                               \
+  typedef struct {                                                             \
+    name##_leaf_t *leaf;                                                       \
+    int pos;                                                                   \
+  } name##_iter_t;                                                             \
+                                                                               \
+  void name##_init(name##_t *t);                                               \
+  void name##_destroy(name##_t *t);                                            \
+  bool name##_insert(name##_t *t, const keytype *key, const valuetype *value); \
+  valuetype *name##_find(name##_t *t, const keytype *key);                     \
+  bool name##_erase(name##_t *t, const keytype *key);                          \
+  bool name##_first(name##_t *t, name##_iter_t *it);                           \
+  bool name##_last(name##_t *t, name##_iter_t *it);                            \
+  bool name##_lower_bound(name##_t *t, const keytype *key, name##_iter_t *it); \
+  bool name##_upper_bound(name##_t *t, const keytype *key, name##_iter_t *it); \
+  bool name##_next(name##_iter_t *it);                                         \
+  bool name##_previous(name##_iter_t *it);                                     \
+  static inline keytype *name##_iter_key(name##_iter_t *it) {                  \
+    return it->leaf->node.keys + it->pos;                                      \
+  }                                                                            \
+  static inline valuetype *name##_iter_value(name##_iter_t *it) {              \
+    return it->leaf->values + it->pos;                                         \
+  }                                                                            \
+  static inline size_t name##_size(name##_t *t) { return t->size; }
+
+#define ac_btree_m(name, keytype, valuetype, compare)                          \
+  /* the first position in the node whose key is not less than key */          \
+  static inline int _##name##_lower(name##_node_t *n, const keytype *key) {    \
+    int low = 0, high = n->num_keys;                                           \
+    while (low < high) {                                                       \
+      int mid = (low + high) >> 1;                                             \
+      if (compare(n->keys + mid, key) < 0)                                     \
+        low = mid + 1;                                                         \
+      else                                                                     \
+        high = mid;                                                            \
+    }                                                                          \
+    return low;                                                                \
+  }                                                                            \
+                                                                               \
+  /* the first position in the node whose key is greater than key */           \
+  static inline int _##name##_upper(name##_node_t *n, const keytype *key) {    \
+    int low = 0, high = n->num_keys;                                           \
+    while (low < high) {                                                       \
+      int mid = (low + high) >> 1;                                             \
+      if (compare(n->keys + mid, key) <= 0)                                    \
+        low = mid + 1;                                                         \
+      else                                                                     \
+        high = mid;                                                            \
+    }                                                                          \
+    return low;                                                                \
+  }                                                                            \
+                                                                               \
+  static name##_node_t *_##name##_new_node(bool leaf) {                        \
+    name##_node_t *n;                                                          \
+    if (leaf) {                                                                \
+      name##_leaf_t *l = (name##_leaf_t *)ac_malloc(sizeof(name##_leaf_t));    \
+      if (!l)                                                                  \
+        abort();                                                               \
+      l->next = NULL;                                                          \
+      l->prev = NULL;                                                          \
+      n = &l->node;                                                            \
+    } else {                                                                   \
+      name##_inner_t *in =                                                     \
+          (name##_inner_t *)ac_malloc(sizeof(name##_inner_t));                 \
+      if (!in)                                                                 \
+        abort();                                                               \
+      n = &in->node;                                                           \
+    }                                                                          \
+    n->num_keys = 0;                                                           \
+    n->leaf = leaf;                                                            \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static void _##name##_free_node(name##_node_t *n) {                          \
+    if (!n->leaf) {                                                            \
+      name##_inner_t *in = (name##_inner_t *)n;                                \
+      for (int i = 0; i <= n->num_keys; i++)                                   \
+        _##name##_free_node(in->children[i]);                                  \
+    }                                                                          \
+    ac_free(n);                                                                \
+  }                                                                            \
+                                                                               \
+  void name##_init(name##_t *t) {                                              \
+    t->root = NULL;                                                            \
+    t->size = 0;                                                               \
+    t->height = 0;                                                             \
+  }                                                                            \
+                                                                               \
+  void name##_destroy(name##_t *t) {                                           \
+    if (t->root)                                                               \
+      _##name##_free_node(t->root);                                            \
+    name##_init(t);                                                            \
+  }                                                                            \
+                                                                               \
+  /* descend to the leaf which would hold key */                               \
+  static inline name##_leaf_t *_##name##_find_leaf(name##_t *t,                \
+                                                 const keytype *key) {         \
+    name##_node_t *n = t->root;                                                \
+    if (!n)                                                                    \
+      return NULL;                                                             \
+    while (!n->leaf)                                                           \
+      n = ((name##_inner_t *)n)->children[_##name##_upper(n, key)];            \
+    return (name##_leaf_t *)n;                                                 \
+  }                                                                            \
+                                                                               \
+  valuetype *name##_find(name##_t *t, const keytype *key) {                    \
+    name##_leaf_t *l = _##name##_find_leaf(t, key);                            \
+    if (!l)                                                                    \
+      return NULL;                                                             \
+    int pos = _##name##_lower(&l->node, key);                                  \
+    if (pos < l->node.num_keys && compare(l->node.keys + pos, key) == 0)       \
+      return l->values + pos;                                                  \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  bool name##_insert(name##_t *t, const keytype *key,                          \
+                     const valuetype *value) {                                 \
+    const int max_keys = AC_BTREE_KEYS(keytype);                               \
+    if (!t->root) {                                                            \
+      t->root = _##name##_new_node(true);                                      \
+      t->height = 1;                                                           \
+    }                                                                          \
+    name##_inner_t *path[AC_BTREE_MAX_HEIGHT];                                 \
+    int path_pos[AC_BTREE_MAX_HEIGHT];                                         \
+    int depth = 0;                                                             \
+    name##_node_t *n = t->root;                                                \
+    while (!n->leaf) {                                                         \
+      int pos = _##name##_upper(n, key);                                       \
+      path[depth] = (name##_inner_t *)n;                                       \
+      path_pos[depth] = pos;                                                   \
+      depth++;                                                                 \
+      n = ((name##_inner_t *)n)->children[pos];                                \
+    }                                                                          \
+    name##_leaf_t *l = (name##_leaf_t *)n;                                     \
+    int pos = _##name##_lower(n, key);                                         \
+    if (pos < n->num_keys && compare(n->keys + pos, key) == 0)                 \
+      return false;                                                            \
+    t->size++;                                                                 \
+    if (n->num_keys < max_keys) {                                              \
+      memmove(n->keys + pos + 1, n->keys + pos,                                \
+              (n->num_keys - pos) * sizeof(keytype));                          \
+      memmove(l->values + pos + 1, l->values + pos,                            \
+              (n->num_keys - pos) * sizeof(valuetype));                        \
+      n->keys[pos] = *key;                                                     \
+      l->values[pos] = *value;                                                 \
+      n->num_keys++;                                                           \
+      return true;                                                             \
+    }                                                                          \
+                                                                               \
+    /* split the leaf, the left half keeps (max_keys+1)/2 entries */           \
+    int left_keys = (max_keys + 1) >> 1;                                       \
+    name##_leaf_t *r = (name##_leaf_t *)_##name##_new_node(true);              \
+    r->next = l->next;                                                         \
+    if (r->next)                                                               \
+      ((name##_leaf_t *)r->next)->prev = &r->node;                             \
+    r->prev = &l->node;                                                        \
+    l->next = &r->node;                                                        \
+    if (pos < left_keys) {                                                     \
+      int moved = max_keys - (left_keys - 1);                                  \
+      memcpy(r->node.keys, n->keys + left_keys - 1, moved * sizeof(keytype));  \
+      memcpy(r->values, l->values + left_keys - 1, moved * sizeof(valuetype)); \
+      r->node.num_keys = moved;                                                \
+      n->num_keys = left_keys - 1;                                             \
+      memmove(n->keys + pos + 1, n->keys + pos,                                \
+              (n->num_keys - pos) * sizeof(keytype));                          \
+      memmove(l->values + pos + 1, l->values + pos,                            \
+              (n->num_keys - pos) * sizeof(valuetype));                        \
+      n->keys[pos] = *key;                                                     \
+      l->values[pos] = *value;                                                 \
+      n->num_keys++;                                                           \
+    } else {                                                                   \
+      int moved = max_keys - left_keys;                                        \
+      int rpos = pos - left_keys;                                              \
+      memcpy(r->node.keys, n->keys + left_keys, rpos * sizeof(keytype));       \
+      memcpy(r->values, l->values + left_keys, rpos * sizeof(valuetype));      \
+      r->node.keys[rpos] = *key;                                               \
+      r->values[rpos] = *value;                                                \
+      memcpy(r->node.keys + rpos + 1, n->keys + pos,                           \
+             (max_keys - pos) * sizeof(keytype));                              \
+      memcpy(r->values + rpos + 1, l->values + pos,                            \
+             (max_keys - pos) * sizeof(valuetype));                            \
+      r->node.num_keys = moved + 1;                                            \
+      n->num_keys = left_keys;                                                 \
+    }                                                                          \
+                                                                               \
+    /* insert the separator and the new right node into the parents */         \
+    keytype sep = r->node.keys[0];                                             \
+    name##_node_t *right = &r->node;                                           \
+    while (depth > 0) {                                                        \
+      depth--;                                                                 \
+      name##_inner_t *p = path[depth];                                         \
+      int ppos = path_pos[depth];                                              \
+      name##_node_t *pn = &p->node;                                            \
+      if (pn->num_keys < max_keys) {                                           \
+        memmove(pn->keys + ppos + 1, pn->keys + ppos,                          \
+                (pn->num_keys - ppos) * sizeof(keytype));                      \
+        memmove(p->children + ppos + 2, p->children + ppos + 1,                \
+                (pn->num_keys - ppos) * sizeof(name##_node_t *));              \
+        pn->keys[ppos] = sep;                                                  \
+        p->children[ppos + 1] = right;                                         \
+        pn->num_keys++;                                                        \
+        return true;                                                           \
+      }                                                                        \
+      /* the parent is full, split it around the middle key */                 \
+      keytype keys[AC_BTREE_KEYS(keytype) + 1];                                \
+      name##_node_t *children[AC_BTREE_KEYS(keytype) + 2];                     \
+      memcpy(keys, pn->keys, ppos * sizeof(keytype));                          \
+      keys[ppos] = sep;                                                        \
+      memcpy(keys + ppos + 1, pn->keys + ppos,                                 \
+             (max_keys - ppos) * sizeof(keytype));                             \
+      memcpy(children, p->children, (ppos + 1) * sizeof(name##_node_t *));     \
+      children[ppos + 1] = right;                                              \
+      memcpy(children + ppos + 2, p->children + ppos + 1,                      \
+             (max_keys - ppos) * sizeof(name##_node_t *));                     \
+      int mid = (max_keys + 1) >> 1;                                           \
+      name##_inner_t *q = (name##_inner_t *)_##name##_new_node(false);         \
+      pn->num_keys = mid;                                                      \
+      memcpy(pn->keys, keys, mid * sizeof(keytype));                           \
+      memcpy(p->children, children, (mid + 1) * sizeof(name##_node_t *));      \
+      q->node.num_keys = max_keys - mid;                                       \
+      memcpy(q->node.keys, keys + mid + 1,                                     \
+             q->node.num_keys * sizeof(keytype));                              \
+      memcpy(q->children, children + mid + 1,                                  \
+             (q->node.num_keys + 1) * sizeof(name##_node_t *));                \
+      sep = keys[mid];                                                         \
+      right = &q->node;                                                        \
+    }                                                                          \
+    /* the root was split */                                                   \
+    name##_inner_t *root = (name##_inner_t *)_##name##_new_node(false);        \
+    root->node.num_keys = 1;                                                   \
+    root->node.keys[0] = sep;                                                  \
+    root->children[0] = t->root;                                               \
+    root->children[1] = right;                                                 \
+    t->root = &root->node;                                                     \
+    t->height++;                                                               \
+    if (t->height > AC_BTREE_MAX_HEIGHT)                                       \
+      abort();                                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* fix the child at position i of p which has too few keys */                \
+  static void _##name##_rebalance(name##_inner_t *p, int i) {                  \
+    const int min_keys = AC_BTREE_KEYS(keytype) >> 1;                          \
+    name##_node_t *n = p->children[i];                                         \
+    name##_node_t *left = i > 0 ? p->children[i - 1] : NULL;                   \
+    name##_node_t *right = i < p->node.num_keys ? p->children[i + 1] : NULL;   \
+    if (left && left->num_keys > min_keys) {                                   \
+      /* borrow the last entry of the left sibling */                          \
+      memmove(n->keys + 1, n->keys, n->num_keys * sizeof(keytype));            \
+      if (n->leaf) {                                                           \
+        name##_leaf_t *l = (name##_leaf_t *)n, *ll = (name##_leaf_t *)left;    \
+        memmove(l->values + 1, l->values, n->num_keys * sizeof(valuetype));    \
+        n->keys[0] = left->keys[left->num_keys - 1];                           \
+        l->values[0] = ll->values[left->num_keys - 1];                         \
+        p->node.keys[i - 1] = n->keys[0];                                      \
+      } else {                                                                 \
+        name##_inner_t *in = (name##_inner_t *)n;                              \
+        name##_inner_t *il = (name##_inner_t *)left;                           \
+        memmove(in->children + 1, in->children,                                \
+                (n->num_keys + 1) * sizeof(name##_node_t *));                  \
+        n->keys[0] = p->node.keys[i - 1];                                      \
+        in->children[0] = il->children[left->num_keys];                        \
+        p->node.keys[i - 1] = left->keys[left->num_keys - 1];                  \
+      }                                                                        \
+      n->num_keys++;                                                           \
+      left->num_keys--;                                                        \
+      return;                                                                  \
+    }                                                                          \
+    if (right && right->num_keys > min_keys) {                                 \
+      /* borrow the first entry of the right sibling */                        \
+      if (n->leaf) {                                                           \
+        name##_leaf_t *l = (name##_leaf_t *)n, *lr = (name##_leaf_t *)right;   \
+        n->keys[n->num_keys] = right->keys[0];                                 \
+        l->values[n->num_keys] = lr->values[0];                                \
+        memmove(right->keys, right->keys + 1,                                  \
+                (right->num_keys - 1) * sizeof(keytype));                      \
+        memmove(lr->values, lr->values + 1,                                    \
+                (right->num_keys - 1) * sizeof(valuetype));                    \
+        p->node.keys[i] = right->keys[0];                                      \
+      } else {                                                                 \
+        name##_inner_t *in = (name##_inner_t *)n;                              \
+        name##_inner_t *ir = (name##_inner_t *)right;                          \
+        n->keys[n->num_keys] = p->node.keys[i];                                \
+        in->children[n->num_keys + 1] = ir->children[0];                       \
+        p->node.keys[i] = right->keys[0];                                      \
+        memmove(right->keys, right->keys + 1,                                  \
+                (right->num_keys - 1) * sizeof(keytype));                      \
+        memmove(ir->children, ir->children + 1,                                \
+                right->num_keys * sizeof(name##_node_t *));                    \
+      }                                                                        \
+      n->num_keys++;                                                           \
+      right->num_keys--;                                                       \
+      return;                                                                  \
+    }                                                                          \
+    /* merge with a sibling, j is the left node of the pair */                 \
+    int j = left ? i - 1 : i;                                                  \
+    name##_node_t *a = p->children[j];                                         \
+    name##_node_t *b = p->children[j + 1];                                     \
+    if (a->leaf) {                                                             \
+      name##_leaf_t *la = (name##_leaf_t *)a, *lb = (name##_leaf_t *)b;        \
+      memcpy(a->keys + a->num_keys, b->keys, b->num_keys * sizeof(keytype));   \
+      memcpy(la->values + a->num_keys, lb->values,                             \
+             b->num_keys * sizeof(valuetype));                                 \
+      a->num_keys += b->num_keys;                                              \
+      la->next = lb->next;                                                     \
+      if (la->next)                                                            \
+        ((name##_leaf_t *)la->next)->prev = a;                                 \
+    } else {                                                                   \
+      name##_inner_t *ia = (name##_inner_t *)a, *ib = (name##_inner_t *)b;     \
+      a->keys[a->num_keys] = p->node.keys[j];                                  \
+      memcpy(a->keys + a->num_keys + 1, b->keys,                               \
+             b->num_keys * sizeof(keytype));                                   \
+      memcpy(ia->children + a->num_keys + 1, ib->children,                     \
+             (b->num_keys + 1) * sizeof(name##_node_t *));                     \
+      a->num_keys += b->num_keys + 1;                                          \
+    }                                                                          \
+    ac_free(b);                                                                \
+    memmove(p->node.keys + j, p->node.keys + j + 1,                            \
+            (p->node.num_keys - j - 1) * sizeof(keytype));                     \
+    memmove(p->children + j + 1, p->children + j + 2,                          \
+            (p->node.num_keys - j - 1) * sizeof(name##_node_t *));             \
+    p->node.num_keys--;                                                        \
+  }                                                                            \
+                                                                               \
+  bool name##_erase(name##_t *t, const keytype *key) {                         \
+    const int min_keys = AC_BTREE_KEYS(keytype) >> 1;                          \
+    if (!t->root)                                                              \
+      return false;                                                            \
+    name##_inner_t *path[AC_BTREE_MAX_HEIGHT];                                 \
+    int path_pos[AC_BTREE_MAX_HEIGHT];                                         \
+    int depth = 0;                                                             \
+    name##_node_t *n = t->root;                                                \
+    while (!n->leaf) {                                                         \
+      int pos = _##name##_upper(n, key);                                       \
+      path[depth] = (name##_inner_t *)n;                                       \
+      path_pos[depth] = pos;                                                   \
+      depth++;                                                                 \
+      n = ((name##_inner_t *)n)->children[pos];                                \
+    }                                                                          \
+    name##_leaf_t *l = (name##_leaf_t *)n;                                     \
+    int pos = _##name##_lower(n, key);                                         \
+    if (pos >= n->num_keys || compare(n->keys + pos, key) != 0)                \
+      return false;                                                            \
+    memmove(n->keys + pos, n->keys + pos + 1,                                  \
+            (n->num_keys - pos - 1) * sizeof(keytype));                        \
+    memmove(l->values + pos, l->values + pos + 1,                              \
+            (n->num_keys - pos - 1) * sizeof(valuetype));                      \
+    n->num_keys--;                                                             \
+    t->size--;                                                                 \
+                                                                               \
+    /* the separators above may still hold the erased key, which is fine since \
+       they only need to bound the keys of the subtrees */                     \
+    while (depth > 0 && n->num_keys < min_keys) {                              \
+      depth--;                                                                 \
+      _##name##_rebalance(path[depth], path_pos[depth]);                       \
+      n = &path[depth]->node;                                                  \
+    }                                                                          \
+    if (!t->root->leaf && t->root->num_keys == 0) {                            \
+      name##_node_t *root = t->root;                                           \
+      t->root = ((name##_inner_t *)root)->children[0];                         \
+      ac_free(root);                                                           \
+      t->height--;                                                             \
+    } else if (t->root->leaf && t->root->num_keys == 0) {                      \
+      ac_free(t->root);                                                        \
+      t->root = NULL;                                                          \
+      t->height = 0;                                                           \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  bool name##_first(name##_t *t, name##_iter_t *it) {                          \
+    name##_node_t *n = t->root;                                                \
+    if (!n)                                                                    \
+      return false;                                                            \
+    while (!n->leaf)                                                           \
+      n = ((name##_inner_t *)n)->children[0];                                  \
+    it->leaf = (name##_leaf_t *)n;                                             \
+    it->pos = 0;                                                               \
+    return n->num_keys > 0;                                                    \
+  }                                                                            \
+                                                                               \
+  bool name##_last(name##_t *t, name##_iter_t *it) {                           \
+    name##_node_t *n = t->root;                                                \
+    if (!n)                                                                    \
+      return false;                                                            \
+    while (!n->leaf)                                                           \
+      n = ((name##_inner_t *)n)->children[n->num_keys];                        \
+    it->leaf = (name##_leaf_t *)n;                                             \
+    it->pos = n->num_keys - 1;                                                 \
+    return n->num_keys > 0;                                                    \
+  }                                                                            \
+                                                                               \
+  bool name##_next(name##_iter_t *it) {                                        \
+    it->pos++;                                                                 \
+    if (it->pos < it->leaf->node.num_keys)                                     \
+      return true;                                                             \
+    if (!it->leaf->next)                                                       \
+      return false;                                                            \
+    it->leaf = (name##_leaf_t *)it->leaf->next;                                \
+    it->pos = 0;                                                               \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  bool name##_previous(name##_iter_t *it) {                                    \
+    if (it->pos > 0) {                                                         \
+      it->pos--;                                                               \
+      return true;                                                             \
+    }                                                                          \
+    if (!it->leaf->prev)                                                       \
+      return false;                                                            \
+    it->leaf = (name##_leaf_t *)it->leaf->prev;                                \
+    it->pos = it->leaf->node.num_keys - 1;                                     \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  bool name##_lower_bound(name##_t *t, const keytype *key,                     \
+                          name##_iter_t *it) {                                 \
+    name##_leaf_t *l = _##name##_find_leaf(t, key);                            \
+    if (!l)                                                                    \
+      return false;                                                            \
+    it->leaf = l;                                                              \
+    it->pos = _##name##_lower(&l->node, key);                                  \
+    if (it->pos < l->node.num_keys)                                            \
+      return true;                                                             \
+    it->pos--;                                                                 \
+    return name##_next(it);                                                    \
+  }                                                                            \
+                                                                               \
+  bool name##_upper_bound(name##_t *t, const keytype *key,                     \
+                          name##_iter_t *it) {                                 \
+    name##_leaf_t *l = _##name##_find_leaf(t, key);                            \
+    if (!l)                                                                    \
+      return false;                                                            \
+    it->leaf = l;                                                              \
+    it->pos = _##name##_upper(&l->node, key);                                  \
+    if (it->pos < l->node.num_keys)                                            \
+      return true;                                                             \
+    it->pos--;                                                                 \
+    return name##_next(it);                                                    \
+  }
@@ -26,8 +26,36 @@ struct ac_buffer_s {
   size_t length;
   size_t size;
   ac_pool_t *pool;
+  /* attached memory is referenced by data until the buffer is modified */
+  ac_buffer_release_cb release;
+  void *release_arg;
+  bool attached;
+  /* has_inline is true if AC_BUFFER_INLINE_SIZE bytes follow the structure
+     (see ac_buffer_inline_t), embedded if the structure wasn't allocated by
+     ac_buffer_init */
+  bool has_inline;
+  bool embedded;
 };
 
+struct ac_buffer_inline_s {
+  ac_buffer_t buffer;
+  char space[AC_BUFFER_INLINE_SIZE + 1];
+};
+
+/* true if data points to the space after the structure */
+static inline bool _ac_buffer_inline(ac_buffer_t *h) {
+  return h->has_inline && h->data == (char *)(h + 1);
+}
+
+/* true if data must be freed with ac_free */
+static inline bool _ac_buffer_owns_data(ac_buffer_t *h) {
+  return !h->pool && h->size && !_ac_buffer_inline(h);
+}
+
+/* used internally */
+void _ac_buffer_detach_copy(ac_buffer_t *h, size_t length);
+void _ac_buffer_detach_release(ac_buffer_t *h);
+
 static inline ac_buffer_t *ac_buffer_pool_init(ac_pool_t *pool,
                                                    size_t initial_size) {
   ac_buffer_t *h =
@@ -37,28 +65,81 @@ static inline ac_buffer_t *ac_buffer_pool_init(ac_pool_t *pool,
   h->length = 0;
   h->size = initial_size;
   h->pool = pool;
+  h->release = NULL;
+  h->release_arg = NULL;
+  h->attached = false;
+  h->has_inline = false;
+  h->embedded = true;
   return h;
 }
 
+static inline bool ac_buffer_attached(ac_buffer_t *h) { return h->attached; }
+
 static inline void ac_buffer_clear(ac_buffer_t *h) {
+  if (h->attached)
+    _ac_buffer_detach_release(h);
   h->length = 0;
   h->data[0] = 0;
 }
 
 static inline char *ac_buffer_data(ac_buffer_t *h) { return h->data; }
 static inline size_t ac_buffer_length(ac_buffer_t *h) { return h->length; }
+static inline size_t ac_buffer_capacity(ac_buffer_t *h) { return h->size; }
 
-static inline void _ac_buffer_grow(ac_buffer_t *h, size_t length) {
-  size_t len = (length + 50) + (h->size >> 3);
+/* makes room for size bytes (and the zero terminator) */
+static inline void _ac_buffer_set_size(ac_buffer_t *h, size_t size) {
   if (!h->pool) {
-    char *data = (char *)ac_malloc(len + 1);
+    char *data = (char *)ac_malloc(size + 1);
     memcpy(data, h->data, h->length + 1);
-    if (h->size)
+    if (_ac_buffer_owns_data(h))
       ac_free(h->data);
     h->data = data;
-  } else
-    h->data = (char *)ac_pool_dup(h->pool, h->data, len + 1);
-  h->size = len;
+  } else if (!h->size ||
+             !ac_pool_extend(h->pool, h->data, h->size + 1, size + 1)) {
+    char *data = (char *)ac_pool_alloc(h->pool, size + 1);
+    memcpy(data, h->data, h->length + 1);
+    h->data = data;
+  }
+  h->size = size;
+}
+
+static inline void _ac_buffer_grow(ac_buffer_t *h, size_t length) {
+  if (h->attached) {
+    _ac_buffer_detach_copy(h, length);
+    return;
+  }
+  size_t len = length + 50;
+  size_t geometric = h->size + (h->size / 100) * AC_BUFFER_GROWTH_PERCENT;
+  if (geometric > len)
+    len = geometric;
+  _ac_buffer_set_size(h, len);
+}
+
+static inline void ac_buffer_reserve(ac_buffer_t *h, size_t size) {
+  if (h->attached)
+    _ac_buffer_detach_copy(h, size > h->length ? size : h->length);
+  else if (size > h->size)
+    _ac_buffer_set_size(h, size);
+}
+
+static inline ac_buffer_t *ac_buffer_init_inline(ac_buffer_inline_t *b) {
+  ac_buffer_t *h = &b->buffer;
+#ifdef _AC_DEBUG_MEMORY_
+  h->dump.dump = NULL;
+  h->initial_size = AC_BUFFER_INLINE_SIZE;
+  h->max_length = 0;
+#endif
+  h->data = b->space;
+  h->data[0] = 0;
+  h->length = 0;
+  h->size = AC_BUFFER_INLINE_SIZE;
+  h->pool = NULL;
+  h->release = NULL;
+  h->release_arg = NULL;
+  h->attached = false;
+  h->has_inline = true;
+  h->embedded = true;
+  return h;
 }
 
 static inline void *ac_buffer_shrink_by(ac_buffer_t *h, size_t length) {
@@ -66,12 +147,13 @@ static inline void *ac_buffer_shrink_by(ac_buffer_t *h, size_t length) {
     h->length -= length;
   else
     h->length = 0;
-  h->data[h->length] = 0;
+  if (!h->attached)
+    h->data[h->length] = 0;
   return h->data;
 }
 
 static inline void *ac_buffer_resize(ac_buffer_t *h, size_t length) {
-  if (length > h->size)
+  if (length > h->size || h->attached)
     _ac_buffer_grow(h, length);
   h->length = length;
   h->data[h->length] = 0;
@@ -83,11 +165,11 @@ static inline void *ac_buffer_resize(ac_buffer_t *h, size_t length) {
 }
 
 static inline void *ac_buffer_append_alloc(ac_buffer_t *h, size_t length) {
-  if (length + h->length > h->size)
+  if (length + h->length > h->size || h->attached)
     _ac_buffer_grow(h, length + h->length);
   char *r = h->data + h->length;
   h->length += length;
-  r[h->length] = 0;
+  h->data[h->length] = 0;
 #ifdef _AC_DEBUG_MEMORY_
   if (length > h->max_length)
     h->max_length = length;
@@ -139,9 +221,11 @@ static inline void ac_buffer_appendn(ac_buffer_t *h, char ch, ssize_t n) {
 }
 
 static inline void _ac_buffer_alloc(ac_buffer_t *h, size_t length) {
+  if (h->attached)
+    _ac_buffer_detach_release(h);
   size_t len = (length + 50) + (h->size >> 3);
   if (!h->pool) {
-    if (h->size)
+    if (_ac_buffer_owns_data(h))
       ac_free(h->data);
     h->data = (char *)ac_malloc(len + 1);
   } else
@@ -150,7 +234,7 @@ static inline void _ac_buffer_alloc(ac_buffer_t *h, size_t length) {
 }
 
 static inline void *ac_buffer_alloc(ac_buffer_t *h, size_t length) {
-  if (length > h->size)
+  if (length > h->size || h->attached)
     _ac_buffer_alloc(h, length);
   h->length = length;
 #ifdef _AC_DEBUG_MEMORY_
@@ -163,7 +247,7 @@ static inline void *ac_buffer_alloc(ac_buffer_t *h, size_t length) {
 
 static inline void _ac_buffer_set(ac_buffer_t *h, const void *data,
                                     size_t length) {
-  if (length > h->size)
+  if (length > h->size || h->attached)
     _ac_buffer_alloc(h, length);
   memcpy(h->data, data, length);
   h->length = length;
@@ -188,18 +272,18 @@ static inline void ac_buffer_setc(ac_buffer_t *h, char c) {
 }
 
 static inline void ac_buffer_setn(ac_buffer_t *h, char ch, ssize_t n) {
-  h->length = 0;
+  ac_buffer_clear(h);
   ac_buffer_appendn(h, ch, n);
 }
 
 static inline void ac_buffer_setvf(ac_buffer_t *h, const char *fmt,
                                      va_list args) {
-  h->length = 0;
+  ac_buffer_clear(h);
   ac_buffer_appendvf(h, fmt, args);
 }
 
 static inline void ac_buffer_setf(ac_buffer_t *h, const char *fmt, ...) {
-  h->length = 0;
+  ac_buffer_clear(h);
   va_list args;
   va_start(args, fmt);
   ac_buffer_appendvf(h, fmt, args);
@@ -212,3 +296,8 @@ static inline void ac_buffer_appendf(ac_buffer_t *h, const char *fmt, ...) {
   ac_buffer_appendvf(h, fmt, args);
   va_end(args);
 }
+
+static inline void ac_buffer_append_escaped_json(ac_buffer_t *h, const char *s,
+                                                 size_t length) {
+  ac_buffer_append_escaped(h, AC_ESCAPE_JSON, s, length);
+}
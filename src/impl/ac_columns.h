@@ -0,0 +1,103 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+
+static inline void ac_columns_clear(ac_columns_t *h) { h->num_rows = 0; }
+
+static inline size_t ac_columns_rows(ac_columns_t *h) { return h->num_rows; }
+
+static inline void *ac_columns_get(ac_columns_t *h, size_t column) {
+  return h->columns[column];
+}
+
+/* gathers every column except skip */
+void _ac_columns_permute(ac_columns_t *h, const uint32_t *order, size_t skip);
+
+#define _ac_columns_sort_core_m(name, keytype)                                 \
+  typedef struct {                                                             \
+    keytype key;                                                               \
+    uint32_t row;                                                              \
+  } name##_pair_t;                                                             \
+                                                                               \
+  static name##_pair_t *name##_pairs(ac_columns_t *h, size_t column) {         \
+    size_t n = h->num_rows;                                                    \
+    name##_pair_t *pairs =                                                     \
+        (name##_pair_t *)ac_malloc(sizeof(name##_pair_t) * (n ? n : 1));       \
+    if (!pairs)                                                                \
+      abort();                                                                 \
+    const keytype *keys = (const keytype *)h->columns[column];                 \
+    for (size_t i = 0; i < n; i++) {                                           \
+      pairs[i].key = keys[i];                                                  \
+      pairs[i].row = (uint32_t)i;                                              \
+    }                                                                          \
+    return pairs;                                                              \
+  }                                                                            \
+                                                                               \
+  static void name##_pairs_sort(name##_pair_t *pairs, size_t n);               \
+                                                                               \
+  void name##_order(ac_columns_t *h, size_t column, uint32_t *order) {         \
+    name##_pair_t *pairs = name##_pairs(h, column);                            \
+    name##_pairs_sort(pairs, h->num_rows);                                     \
+    for (size_t i = 0; i < h->num_rows; i++)                                   \
+      order[i] = pairs[i].row;                                                 \
+    ac_free(pairs);                                                            \
+  }                                                                            \
+                                                                               \
+  void name(ac_columns_t *h, size_t column) {                                  \
+    size_t n = h->num_rows;                                                    \
+    name##_pair_t *pairs = name##_pairs(h, column);                            \
+    name##_pairs_sort(pairs, n);                                               \
+    uint32_t *order = (uint32_t *)ac_malloc(sizeof(uint32_t) * (n ? n : 1));   \
+    if (!order)                                                                \
+      abort();                                                                 \
+    /* the key column is written from the pairs instead of being gathered */   \
+    keytype *keys = (keytype *)h->columns[column];                             \
+    for (size_t i = 0; i < n; i++) {                                           \
+      keys[i] = pairs[i].key;                                                  \
+      order[i] = pairs[i].row;                                                 \
+    }                                                                          \
+    ac_free(pairs);                                                            \
+    _ac_columns_permute(h, order, column);                                     \
+    ac_free(order);                                                            \
+  }
+
+#define ac_columns_sort_m(name, keytype, compare)                              \
+  _ac_columns_sort_core_m(name, keytype)                                       \
+                                                                               \
+  static inline int name##_pair_compare(const name##_pair_t *a,                \
+                                        const name##_pair_t *b) {              \
+    return compare(&a->key, &b->key);                                          \
+  }                                                                            \
+                                                                               \
+  static ac_sort_m(name##_pairs_sort_, name##_pair_t, name##_pair_compare)     \
+                                                                               \
+  static void name##_pairs_sort(name##_pair_t *pairs, size_t n) {              \
+    name##_pairs_sort_(pairs, n);                                              \
+  }
+
+#define ac_columns_radix_sort_m(name, keytype)                                 \
+  _ac_columns_sort_core_m(name, keytype)                                       \
+                                                                               \
+  static inline keytype name##_pair_key(const name##_pair_t *p) {              \
+    return p->key;                                                             \
+  }                                                                            \
+                                                                               \
+  ac_radix_sort_m(name##_pairs_sort_, name##_pair_t, name##_pair_key)          \
+                                                                               \
+  static void name##_pairs_sort(name##_pair_t *pairs, size_t n) {              \
+    name##_pairs_sort_(pairs, n, NULL);                                        \
+  }
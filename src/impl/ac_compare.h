@@ -0,0 +1,133 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* char * with the const applying to the pointer (const char ** isn't
+   compatible with char **) */
+typedef char *_ac_compare_str_t;
+
+/* the type of an element, the type of a search key, how to read a key, and
+   how to compare two values of each kind */
+#define _ac_compare_type_int32 int32_t
+#define _ac_compare_type_uint32 uint32_t
+#define _ac_compare_type_int64 int64_t
+#define _ac_compare_type_uint64 uint64_t
+#define _ac_compare_type_float float
+#define _ac_compare_type_double double
+#define _ac_compare_type_str _ac_compare_str_t
+
+#define _ac_compare_key_int32 int32_t
+#define _ac_compare_key_uint32 uint32_t
+#define _ac_compare_key_int64 int64_t
+#define _ac_compare_key_uint64 uint64_t
+#define _ac_compare_key_float float
+#define _ac_compare_key_double double
+#define _ac_compare_key_str char
+
+#define _ac_compare_keyval_int32(k) (*(k))
+#define _ac_compare_keyval_uint32(k) (*(k))
+#define _ac_compare_keyval_int64(k) (*(k))
+#define _ac_compare_keyval_uint64(k) (*(k))
+#define _ac_compare_keyval_float(k) (*(k))
+#define _ac_compare_keyval_double(k) (*(k))
+#define _ac_compare_keyval_str(k) ((const char *)(k))
+
+#define _ac_compare_number(x, y) (((x) > (y)) - ((x) < (y)))
+#define _ac_compare_int32(x, y) _ac_compare_number(x, y)
+#define _ac_compare_uint32(x, y) _ac_compare_number(x, y)
+#define _ac_compare_int64(x, y) _ac_compare_number(x, y)
+#define _ac_compare_uint64(x, y) _ac_compare_number(x, y)
+#define _ac_compare_float(x, y) _ac_compare_number(x, y)
+#define _ac_compare_double(x, y) _ac_compare_number(x, y)
+#define _ac_compare_str(x, y) strcmp(x, y)
+
+#define _ac_compare_array_m(kind)                                              \
+  static inline int ac_compare_##kind(const _ac_compare_type_##kind *a,        \
+                                      const _ac_compare_type_##kind *b) {      \
+    return _ac_compare_##kind(*a, *b);                                         \
+  }
+
+_ac_compare_array_m(int32)
+_ac_compare_array_m(uint32)
+_ac_compare_array_m(int64)
+_ac_compare_array_m(uint64)
+_ac_compare_array_m(float)
+_ac_compare_array_m(double)
+_ac_compare_array_m(str)
+
+#define ac_compare_field_m(name, datatype, field, kind)                        \
+  static inline int name(const datatype *a, const datatype *b) {               \
+    return _ac_compare_##kind(a->field, b->field);                             \
+  }
+
+#define ac_compare_key_m(name, datatype, field, kind)                          \
+  static inline int name(const _ac_compare_key_##kind *key,                    \
+                         const datatype *v) {                                  \
+    return _ac_compare_##kind(_ac_compare_keyval_##kind(key), v->field);       \
+  }
+
+#define ac_compare_mem_field_m(name, datatype, field, length)                  \
+  static inline int name(const datatype *a, const datatype *b) {               \
+    return memcmp(a->field, b->field, length);                                 \
+  }
+
+#define ac_compare_mem_key_m(name, datatype, field, length)                    \
+  static inline int name(const char *key, const datatype *v) {                 \
+    return memcmp(key, v->field, length);                                      \
+  }
+
+#define ac_sort_int32_m(name) ac_sort_m(name, int32_t, ac_compare_int32)
+#define ac_sort_uint32_m(name) ac_sort_m(name, uint32_t, ac_compare_uint32)
+#define ac_sort_int64_m(name) ac_sort_m(name, int64_t, ac_compare_int64)
+#define ac_sort_uint64_m(name) ac_sort_m(name, uint64_t, ac_compare_uint64)
+#define ac_sort_float_m(name) ac_sort_m(name, float, ac_compare_float)
+#define ac_sort_double_m(name) ac_sort_m(name, double, ac_compare_double)
+#define ac_sort_str_m(name) ac_sort_m(name, char *, ac_compare_str)
+
+#define ac_sort_by_m(name, datatype, field, kind)                              \
+  ac_compare_field_m(name##_compare, datatype, field, kind)                    \
+  ac_sort_m(name, datatype, name##_compare)
+
+#define ac_search_by_m(name, datatype, field, kind)                            \
+  ac_compare_key_m(name##_compare, datatype, field, kind)                      \
+  ac_search_m(name, _ac_compare_key_##kind, datatype, name##_compare)
+
+#define ac_search_lower_bound_by_m(name, datatype, field, kind)                \
+  ac_compare_key_m(name##_compare, datatype, field, kind)                      \
+  ac_search_lower_bound_m(name, _ac_compare_key_##kind, datatype,              \
+                          name##_compare)
+
+#define ac_map_find_by_m(name, datatype, field, kind)                          \
+  ac_compare_key_m(name##_compare, datatype, field, kind)                      \
+  ac_map_find_m(name, _ac_compare_key_##kind, datatype, name##_compare)
+
+#define ac_map_lower_bound_by_m(name, datatype, field, kind)                   \
+  ac_compare_key_m(name##_compare, datatype, field, kind)                      \
+  ac_map_lower_bound_m(name, _ac_compare_key_##kind, datatype,                 \
+                       name##_compare)
+
+#define ac_map_insert_by_m(name, datatype, field, kind)                        \
+  ac_compare_field_m(name##_compare, datatype, field, kind)                    \
+  ac_map_insert_m(name, datatype, name##_compare)
+
+#define ac_multimap_insert_by_m(name, datatype, field, kind)                   \
+  ac_compare_field_m(name##_compare, datatype, field, kind)                    \
+  ac_multimap_insert_m(name, datatype, name##_compare)
+
+#define ac_map_find_str_m(name, datatype, field)                               \
+  ac_map_find_by_m(name, datatype, field, str)
+
+#define ac_map_insert_str_m(name, datatype, field)                             \
+  ac_map_insert_by_m(name, datatype, field, str)
@@ -0,0 +1,79 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* used by the macros */
+ac_map_t *_ac_concurrent_map_dup(const ac_map_t *n, size_t size);
+
+/* these must be called with the mutex held */
+ac_map_t *_ac_concurrent_map_copy(ac_map_t *n, void *m);
+void _ac_concurrent_map_retire(ac_concurrent_map_t *m, ac_map_t *n);
+
+/* publishes the new root, retires the replaced nodes, and unlocks */
+void _ac_concurrent_map_publish(ac_concurrent_map_t *m, ac_map_t *root);
+
+#define ac_concurrent_map_insert_m(name, datatype, compare)                    \
+  bool name(ac_concurrent_map_t *m, const datatype *d) {                       \
+    ac_map_t *path[AC_MAP_MAX_HEIGHT];                                         \
+    char dirs[AC_MAP_MAX_HEIGHT];                                              \
+    int depth = 0;                                                             \
+    bool replace = false;                                                      \
+    ac_map_t *node = _ac_concurrent_map_dup((const ac_map_t *)d,               \
+                                            sizeof(datatype));                 \
+    pthread_mutex_lock(&m->mutex);                                             \
+    m->node_size = sizeof(datatype);                                           \
+    ac_map_t *root = m->root;                                                  \
+    while (root) {                                                             \
+      path[depth] = root;                                                      \
+      int n = compare((datatype *)node, (datatype *)root);                     \
+      if (!n) {                                                                \
+        _ac_concurrent_map_retire(m, root);                                    \
+        replace = true;                                                        \
+        depth++;                                                               \
+        break;                                                                 \
+      }                                                                        \
+      dirs[depth++] = n > 0;                                                   \
+      root = n < 0 ? root->left : root->right;                                 \
+    }                                                                          \
+    root = ac_map_persistent_insert(path, dirs, depth, replace, node,          \
+                                    _ac_concurrent_map_copy, m);               \
+    _ac_concurrent_map_publish(m, root);                                       \
+    return !replace;                                                           \
+  }
+
+#define ac_concurrent_map_erase_m(name, keytype, datatype, compare)            \
+  bool name(ac_concurrent_map_t *m, const keytype *key) {                      \
+    ac_map_t *path[AC_MAP_MAX_HEIGHT];                                         \
+    char dirs[AC_MAP_MAX_HEIGHT];                                              \
+    int depth = 0;                                                             \
+    pthread_mutex_lock(&m->mutex);                                             \
+    m->node_size = sizeof(datatype);                                           \
+    ac_map_t *n = m->root;                                                     \
+    while (n) {                                                                \
+      path[depth] = n;                                                         \
+      int c = compare(key, (const datatype *)n);                               \
+      if (!c) {                                                                \
+        _ac_concurrent_map_retire(m, n);                                       \
+        n = ac_map_persistent_erase(path, dirs, depth + 1,                     \
+                                    _ac_concurrent_map_copy, m);               \
+        _ac_concurrent_map_publish(m, n);                                      \
+        return true;                                                           \
+      }                                                                        \
+      dirs[depth++] = c > 0;                                                   \
+      n = c < 0 ? n->left : n->right;                                          \
+    }                                                                          \
+    pthread_mutex_unlock(&m->mutex);                                           \
+    return false;                                                              \
+  }
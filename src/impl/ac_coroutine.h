@@ -0,0 +1,87 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+static inline void ac_co_init(ac_co_t *co, ac_co_f fn, ac_co_post_f post,
+                              void *post_arg) {
+  co->line = 0;
+  co->fn = fn;
+  co->post = post;
+  co->post_arg = post_arg;
+  co->job = NULL;
+  co->object = NULL;
+  co->arg = NULL;
+  co->result = NULL;
+  co->pending = 0;
+}
+
+static inline bool ac_co_resume(ac_co_t *co) { return co->fn(co); }
+
+static inline bool ac_co_done(ac_co_t *co) { return co->line == -1; }
+
+static inline void ac_co_wake(ac_co_t *co, void *result) {
+  co->result = result;
+  co->post(co->post_arg, co);
+}
+
+static inline void _ac_co_job_task(void *global_arg, void *thread_arg,
+                                   void *object, void *arg) {
+  ac_co_t *co = (ac_co_t *)object;
+  ac_co_wake(co, co->job(global_arg, thread_arg, co->object, co->arg));
+}
+
+/* returns false (and sets co->result to NULL) if the job couldn't be
+   written */
+static inline bool _ac_co_write_job(ac_co_t *co, ac_threaded_pipe_t *pipe,
+                                    ac_threaded_pipe_job_f job, void *object,
+                                    void *arg) {
+  co->job = job;
+  co->object = object;
+  co->arg = arg;
+  if (ac_threaded_pipe_write(pipe, _ac_co_job_task, co, NULL))
+    return true;
+  co->result = NULL;
+  return false;
+}
+
+/* the last job to finish posts the coroutine */
+static inline void _ac_co_jobs_task(void *global_arg, void *thread_arg,
+                                    void *object, void *arg) {
+  ac_co_job_t *j = (ac_co_job_t *)object;
+  ac_co_t *co = j->co;
+  j->result = j->job(global_arg, thread_arg, j->object, j->arg);
+  if (__atomic_sub_fetch(&co->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    co->post(co->post_arg, co);
+}
+
+/* returns false if none of the jobs are running (jobs which couldn't be
+   written have a NULL result) */
+static inline bool _ac_co_write_jobs(ac_co_t *co, ac_threaded_pipe_t *pipe,
+                                     ac_co_job_t *jobs, size_t num_jobs) {
+  /* the extra count keeps the jobs from posting until all are written */
+  co->pending = num_jobs + 1;
+  size_t failed = 1;
+  for (size_t i = 0; i < num_jobs; i++) {
+    jobs[i].co = co;
+    jobs[i].result = NULL;
+    if (!ac_threaded_pipe_write(pipe, _ac_co_jobs_task, jobs + i, NULL))
+      failed++;
+  }
+  if (__atomic_sub_fetch(&co->pending, failed, __ATOMIC_ACQ_REL) == 0) {
+    /* every written job has already finished (or none were written) */
+    return false;
+  }
+  return true;
+}
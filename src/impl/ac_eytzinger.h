@@ -0,0 +1,121 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the number of nodes which are 1-4 levels below a node (a power of two, so
+   that they are k * span ... k * span + span - 1).  These are adjacent in the
+   layout and are about one cache line, so one prefetch covers the next few
+   steps of the search. */
+#define _ac_eytzinger_span(datatype)                                           \
+  (sizeof(datatype) <= 4 ? 16 : sizeof(datatype) <= 8 ? 8                      \
+                            : sizeof(datatype) <= 16 ? 4 : 2)
+
+/* fills the tree in order from sorted starting with node k, returns the
+   index of the next element in sorted */
+static inline size_t _ac_eytzinger_fill(char *dest, const char *sorted,
+                                        size_t i, size_t k, size_t n,
+                                        size_t size) {
+  while (k <= n) {
+    i = _ac_eytzinger_fill(dest, sorted, i, k << 1, n, size);
+    memcpy(dest + (k - 1) * size, sorted + i * size, size);
+    i++;
+    k = (k << 1) + 1;
+  }
+  return i;
+}
+
+static inline void ac_eytzinger_build(void *dest, const void *sorted,
+                                      size_t num_elements,
+                                      size_t element_size) {
+  _ac_eytzinger_fill((char *)dest, (const char *)sorted, 0, 1, num_elements,
+                     element_size);
+}
+
+/* the node reached after falling off of the tree at k is the last node where
+   the search went left, which is found by removing the trailing 1 bits (the
+   right turns) and one more */
+static inline size_t _ac_eytzinger_resolve(size_t k) {
+  return k >> (__builtin_ctzl(~k) + 1);
+}
+
+#define ac_eytzinger_search_def(name, keytype, datatype)                       \
+  datatype *name(keytype *p, datatype *base, size_t num_elements);
+
+#define ac_eytzinger_search_arg_def(name, keytype, datatype)                   \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg);
+
+#define ac_eytzinger_lower_bound_def(name, keytype, datatype)                  \
+  datatype *name(keytype *p, datatype *base, size_t num_elements);
+
+#define ac_eytzinger_lower_bound_arg_def(name, keytype, datatype)              \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg);
+
+#define ac_eytzinger_upper_bound_def(name, keytype, datatype)                  \
+  datatype *name(keytype *p, datatype *base, size_t num_elements);
+
+#define ac_eytzinger_upper_bound_arg_def(name, keytype, datatype)              \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg);
+
+/* cmp is the comparison which sends the search to the right child */
+#define _ac_eytzinger_loop(datatype, cmp)                                      \
+  size_t k = 1;                                                                \
+  while (k <= num_elements) {                                                  \
+    __builtin_prefetch(base + k * _ac_eytzinger_span(datatype) - 1);           \
+    k = (k << 1) + (cmp);                                                      \
+  }                                                                            \
+  k = _ac_eytzinger_resolve(k)
+
+#define ac_eytzinger_search_m(name, keytype, datatype, compare)                \
+  datatype *name(keytype *p, datatype *base, size_t num_elements) {            \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1) > 0);                \
+    if (k && !compare(p, base + k - 1))                                        \
+      return base + k - 1;                                                     \
+    return NULL;                                                               \
+  }
+
+#define ac_eytzinger_search_arg_m(name, keytype, datatype, compare)            \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg) { \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1, arg) > 0);           \
+    if (k && !compare(p, base + k - 1, arg))                                   \
+      return base + k - 1;                                                     \
+    return NULL;                                                               \
+  }
+
+#define ac_eytzinger_lower_bound_m(name, keytype, datatype, compare)           \
+  datatype *name(keytype *p, datatype *base, size_t num_elements) {            \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1) > 0);                \
+    return k ? base + k - 1 : NULL;                                            \
+  }
+
+#define ac_eytzinger_lower_bound_arg_m(name, keytype, datatype, compare)       \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg) { \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1, arg) > 0);           \
+    return k ? base + k - 1 : NULL;                                            \
+  }
+
+#define ac_eytzinger_upper_bound_m(name, keytype, datatype, compare)           \
+  datatype *name(keytype *p, datatype *base, size_t num_elements) {            \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1) >= 0);               \
+    return k ? base + k - 1 : NULL;                                            \
+  }
+
+#define ac_eytzinger_upper_bound_arg_m(name, keytype, datatype, compare)       \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg) { \
+    _ac_eytzinger_loop(datatype, compare(p, base + k - 1, arg) >= 0);          \
+    return k ? base + k - 1 : NULL;                                            \
+  }
@@ -0,0 +1,303 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The control bytes hold the low 7 bits of the hash of a full slot or one of
+   the following (which have the high bit set). */
+#define AC_HASHMAP_EMPTY 0x80
+#define AC_HASHMAP_DELETED 0xFE
+
+/* The slots are probed a group at a time */
+#define AC_HASHMAP_GROUP_SIZE 16
+
+/* How many old slots each insert or erase moves while resizing */
+#define AC_HASHMAP_MIGRATE_SLOTS 64
+
+/* the following return a bitmask of the slots in the group which match */
+#ifdef __SSE2__
+static inline uint32_t ac_hashmap_match(const uint8_t *ctrl, uint8_t h2) {
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+}
+
+static inline uint32_t ac_hashmap_match_empty(const uint8_t *ctrl) {
+  return ac_hashmap_match(ctrl, AC_HASHMAP_EMPTY);
+}
+
+/* empty or deleted */
+static inline uint32_t ac_hashmap_match_free(const uint8_t *ctrl) {
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+static inline uint32_t ac_hashmap_match(const uint8_t *ctrl, uint8_t h2) {
+  uint32_t r = 0;
+  for (int i = 0; i < AC_HASHMAP_GROUP_SIZE; i++)
+    if (ctrl[i] == h2)
+      r |= (1 << i);
+  return r;
+}
+
+static inline uint32_t ac_hashmap_match_empty(const uint8_t *ctrl) {
+  return ac_hashmap_match(ctrl, AC_HASHMAP_EMPTY);
+}
+
+/* empty or deleted */
+static inline uint32_t ac_hashmap_match_free(const uint8_t *ctrl) {
+  uint32_t r = 0;
+  for (int i = 0; i < AC_HASHMAP_GROUP_SIZE; i++)
+    if (ctrl[i] & 0x80)
+      r |= (1 << i);
+  return r;
+}
+#endif
+
+#define ac_hashmap_def(name, keytype, datatype)                                \
+  typedef struct {                                                             \
+    size_t hv;                                                                 \
+    datatype *d;                                                               \
+  } name##_slot_t;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    uint8_t *ctrl;                                                             \
+    name##_slot_t *slots;                                                      \
+    size_t capacity;                                                           \
+    size_t growth_left;                                                        \
+  } name##_table_t;                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    name##_table_t table;                                                      \
+    /* while the map is being resized, old holds the items which haven't been  \
+       moved yet (old.ctrl is NULL otherwise) */                               \
+    name##_table_t old;                                                        \
+    size_t migrate_pos;                                                        \
+    size_t size;                                                               \
+    ac_pool_t *pool;                                                           \
+  } name##_t;                                                                  \
+                                                                               \
+  void name##_init(name##_t *h, ac_pool_t *pool, size_t expected);             \
+  void name##_destroy(name##_t *h);                                            \
+  datatype *name##_find(name##_t *h, const keytype *key);                      \
+  datatype *name##_insert(name##_t *h, const keytype *key, datatype *d);       \
+  datatype *name##_erase(name##_t *h, const keytype *key);                     \
+  datatype *name##_next(name##_t *h, size_t *pos);                             \
+  static inline size_t name##_size(name##_t *h) { return h->size; }
+
+#define ac_hashmap_m(name, keytype, datatype, hash, equal)                     \
+  static void _##name##_table_init(name##_t *h, name##_table_t *t,             \
+                                   size_t capacity) {                          \
+    t->capacity = capacity;                                                    \
+    t->growth_left = capacity - (capacity >> 3);                               \
+    size_t len = capacity * sizeof(name##_slot_t) + capacity;                  \
+    char *m = h->pool ? (char *)ac_pool_alloc(h->pool, len)                    \
+                      : (char *)ac_malloc(len);                                \
+    if (!m)                                                                    \
+      abort();                                                                 \
+    t->slots = (name##_slot_t *)m;                                             \
+    t->ctrl = (uint8_t *)(m + capacity * sizeof(name##_slot_t));               \
+    memset(t->ctrl, AC_HASHMAP_EMPTY, capacity);                               \
+  }                                                                            \
+                                                                               \
+  static void _##name##_table_free(name##_t *h, name##_table_t *t) {           \
+    if (!h->pool && t->slots)                                                  \
+      ac_free(t->slots);                                                       \
+    t->slots = NULL;                                                           \
+    t->ctrl = NULL;                                                            \
+    t->capacity = 0;                                                           \
+    t->growth_left = 0;                                                        \
+  }                                                                            \
+                                                                               \
+  void name##_init(name##_t *h, ac_pool_t *pool, size_t expected) {            \
+    size_t capacity = AC_HASHMAP_GROUP_SIZE;                                   \
+    while (capacity - (capacity >> 3) < expected)                              \
+      capacity <<= 1;                                                          \
+    h->pool = pool;                                                            \
+    h->size = 0;                                                               \
+    h->migrate_pos = 0;                                                        \
+    h->old.slots = NULL;                                                       \
+    h->old.ctrl = NULL;                                                        \
+    h->old.capacity = 0;                                                       \
+    h->old.growth_left = 0;                                                    \
+    _##name##_table_init(h, &h->table, capacity);                              \
+  }                                                                            \
+                                                                               \
+  void name##_destroy(name##_t *h) {                                           \
+    _##name##_table_free(h, &h->table);                                        \
+    _##name##_table_free(h, &h->old);                                          \
+    h->size = 0;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline name##_slot_t *_##name##_table_find(name##_table_t *t,         \
+                                                    const keytype *key,        \
+                                                    size_t hv) {               \
+    size_t group_mask = (t->capacity / AC_HASHMAP_GROUP_SIZE) - 1;             \
+    size_t g = (hv >> 7) & group_mask;                                         \
+    uint8_t h2 = hv & 0x7F;                                                    \
+    for (size_t i = 1;; i++) {                                                 \
+      const uint8_t *ctrl = t->ctrl + g * AC_HASHMAP_GROUP_SIZE;               \
+      uint32_t m = ac_hashmap_match(ctrl, h2);                                 \
+      while (m) {                                                              \
+        name##_slot_t *s =                                                     \
+            t->slots + g * AC_HASHMAP_GROUP_SIZE + __builtin_ctz(m);           \
+        if (s->hv == hv && equal(key, s->d))                                   \
+          return s;                                                            \
+        m &= m - 1;                                                            \
+      }                                                                        \
+      if (ac_hashmap_match_empty(ctrl))                                        \
+        return NULL;                                                           \
+      if (i > group_mask)                                                      \
+        return NULL;                                                           \
+      g = (g + i) & group_mask;                                                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* place an item which is known not to be in the table */                    \
+  static inline void _##name##_table_put(name##_table_t *t, size_t hv,         \
+                                         datatype *d) {                        \
+    size_t group_mask = (t->capacity / AC_HASHMAP_GROUP_SIZE) - 1;             \
+    size_t g = (hv >> 7) & group_mask;                                         \
+    for (size_t i = 1;; i++) {                                                 \
+      uint8_t *ctrl = t->ctrl + g * AC_HASHMAP_GROUP_SIZE;                     \
+      uint32_t m = ac_hashmap_match_free(ctrl);                                \
+      if (m) {                                                                 \
+        size_t pos = g * AC_HASHMAP_GROUP_SIZE + __builtin_ctz(m);             \
+        if (t->ctrl[pos] == AC_HASHMAP_EMPTY)                                  \
+          t->growth_left--;                                                    \
+        t->ctrl[pos] = hv & 0x7F;                                              \
+        t->slots[pos].hv = hv;                                                 \
+        t->slots[pos].d = d;                                                   \
+        return;                                                                \
+      }                                                                        \
+      g = (g + i) & group_mask;                                                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void _##name##_table_remove(name##_table_t *t,                 \
+                                            name##_slot_t *s) {                \
+    size_t pos = s - t->slots;                                                 \
+    uint8_t *ctrl = t->ctrl + (pos & ~(size_t)(AC_HASHMAP_GROUP_SIZE - 1));    \
+    /* a probe only stops at a group with an empty slot, so if the group       \
+       already has one, this slot can become empty too */                      \
+    if (ac_hashmap_match_empty(ctrl)) {                                        \
+      t->ctrl[pos] = AC_HASHMAP_EMPTY;                                         \
+      t->growth_left++;                                                        \
+    } else                                                                     \
+      t->ctrl[pos] = AC_HASHMAP_DELETED;                                       \
+  }                                                                            \
+                                                                               \
+  /* move up to num slots of the old table into the new table */               \
+  static void _##name##_migrate(name##_t *h, size_t num) {                     \
+    name##_table_t *old = &h->old;                                             \
+    size_t ep = h->migrate_pos + num;                                          \
+    if (ep > old->capacity)                                                    \
+      ep = old->capacity;                                                      \
+    for (size_t i = h->migrate_pos; i < ep; i++) {                             \
+      if (old->ctrl[i] & 0x80)                                                 \
+        continue;                                                              \
+      _##name##_table_put(&h->table, old->slots[i].hv, old->slots[i].d);       \
+      /* the item now lives in the new table, find, erase and next must not   \
+         see it here as well (deleted keeps the old probe chains intact) */    \
+      old->ctrl[i] = AC_HASHMAP_DELETED;                                       \
+    }                                                                          \
+    h->migrate_pos = ep;                                                       \
+    if (ep == old->capacity)                                                   \
+      _##name##_table_free(h, old);                                            \
+  }                                                                            \
+                                                                               \
+  static void _##name##_grow(name##_t *h) {                                    \
+    /* finish any resize which is in progress */                               \
+    if (h->old.ctrl)                                                           \
+      _##name##_migrate(h, h->old.capacity);                                   \
+    /* if most of the slots are tombstones, rehashing at the same size is      \
+       enough */                                                               \
+    size_t capacity = h->table.capacity;                                       \
+    if (h->size > (capacity >> 2))                                             \
+      capacity <<= 1;                                                          \
+    h->old = h->table;                                                         \
+    h->migrate_pos = 0;                                                        \
+    _##name##_table_init(h, &h->table, capacity);                              \
+  }                                                                            \
+                                                                               \
+  datatype *name##_find(name##_t *h, const keytype *key) {                     \
+    size_t hv = hash(key);                                                     \
+    name##_slot_t *s = _##name##_table_find(&h->table, key, hv);               \
+    if (s)                                                                     \
+      return s->d;                                                             \
+    if (h->old.ctrl) {                                                         \
+      s = _##name##_table_find(&h->old, key, hv);                              \
+      if (s)                                                                   \
+        return s->d;                                                           \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  datatype *name##_insert(name##_t *h, const keytype *key, datatype *d) {      \
+    size_t hv = hash(key);                                                     \
+    name##_slot_t *s = _##name##_table_find(&h->table, key, hv);               \
+    if (s)                                                                     \
+      return s->d;                                                             \
+    if (h->old.ctrl) {                                                         \
+      s = _##name##_table_find(&h->old, key, hv);                              \
+      if (s)                                                                   \
+        return s->d;                                                           \
+      _##name##_migrate(h, AC_HASHMAP_MIGRATE_SLOTS);                          \
+    }                                                                          \
+    if (!h->table.growth_left)                                                 \
+      _##name##_grow(h);                                                       \
+    _##name##_table_put(&h->table, hv, d);                                     \
+    h->size++;                                                                 \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  datatype *name##_erase(name##_t *h, const keytype *key) {                    \
+    size_t hv = hash(key);                                                     \
+    name##_table_t *t = &h->table;                                             \
+    name##_slot_t *s = _##name##_table_find(t, key, hv);                       \
+    if (!s && h->old.ctrl) {                                                   \
+      t = &h->old;                                                             \
+      s = _##name##_table_find(t, key, hv);                                    \
+    }                                                                          \
+    if (!s)                                                                    \
+      return NULL;                                                             \
+    datatype *r = s->d;                                                        \
+    _##name##_table_remove(t, s);                                              \
+    h->size--;                                                                 \
+    if (h->old.ctrl)                                                           \
+      _##name##_migrate(h, AC_HASHMAP_MIGRATE_SLOTS);                          \
+    return r;                                                                  \
+  }                                                                            \
+                                                                               \
+  datatype *name##_next(name##_t *h, size_t *pos) {                            \
+    /* positions below the old capacity refer to the old table */              \
+    size_t old_capacity = h->old.ctrl ? h->old.capacity : 0;                   \
+    while (*pos < old_capacity) {                                              \
+      size_t i = (*pos)++;                                                     \
+      if (!(h->old.ctrl[i] & 0x80))                                            \
+        return h->old.slots[i].d;                                              \
+    }                                                                          \
+    while (*pos < old_capacity + h->table.capacity) {                          \
+      size_t i = (*pos)++ - old_capacity;                                      \
+      if (!(h->table.ctrl[i] & 0x80))                                          \
+        return h->table.slots[i].d;                                            \
+    }                                                                          \
+    return NULL;                                                               \
+  }
@@ -0,0 +1,79 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+struct ac_histogram_s {
+  uint32_t sub_bucket_bits;
+  uint32_t num_buckets;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t *buckets;
+};
+
+/* values below 2 << sub_bucket_bits have their own bucket, above that the
+   top sub_bucket_bits + 1 bits of the value select the bucket */
+static inline uint32_t _ac_histogram_bucket(uint32_t sub_bucket_bits,
+                                            uint64_t value) {
+  if (value < (2ULL << sub_bucket_bits))
+    return (uint32_t)value;
+  uint32_t e = 63 - __builtin_clzll(value) - sub_bucket_bits;
+  return (e << sub_bucket_bits) + (uint32_t)(value >> e);
+}
+
+/* the counters are only written by one thread, so a relaxed load and store
+   is enough for other threads to read them without tearing */
+static inline void _ac_histogram_add(uint64_t *p, uint64_t v) {
+  __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v,
+                   __ATOMIC_RELAXED);
+}
+
+static inline void ac_histogram_record_n(ac_histogram_t *h, uint64_t value,
+                                         uint64_t n) {
+  _ac_histogram_add(h->buckets + _ac_histogram_bucket(h->sub_bucket_bits,
+                                                      value),
+                    n);
+  _ac_histogram_add(&h->count, n);
+  _ac_histogram_add(&h->sum, value * n);
+  if (value < h->min)
+    __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+  if (value > h->max)
+    __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+static inline void ac_histogram_record(ac_histogram_t *h, uint64_t value) {
+  ac_histogram_record_n(h, value, 1);
+}
+
+static inline void ac_histogram_record_atomic(ac_histogram_t *h,
+                                              uint64_t value) {
+  __atomic_add_fetch(
+      h->buckets + _ac_histogram_bucket(h->sub_bucket_bits, value), 1,
+      __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+  uint64_t v = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+  while (value < v && !__atomic_compare_exchange_n(&h->min, &v, value, true,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+    ;
+  v = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (value > v && !__atomic_compare_exchange_n(&h->max, &v, value, true,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+    ;
+}
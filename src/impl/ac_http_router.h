@@ -0,0 +1,26 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include <string.h>
+
+static inline const char *ac_http_route_param(const ac_http_route_t *route,
+                                              const char *name) {
+  for (size_t i = 0; i < route->num_params; i++)
+    if (!strcmp(route->params[i].name, name))
+      return route->params[i].value;
+  return NULL;
+}
@@ -0,0 +1,35 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <string.h>
+
+/* each string is preceded by its id and its length */
+static inline uint32_t ac_intern_id_of(const char *interned) {
+  return ((const uint32_t *)interned)[-2];
+}
+
+static inline size_t ac_intern_length(const char *interned) {
+  return ((const uint32_t *)interned)[-1];
+}
+
+static inline const char *ac_intern(ac_intern_t *h, const char *s) {
+  return ac_intern_n(h, s, strlen(s));
+}
+
+static inline uint32_t ac_intern_id(ac_intern_t *h, const void *s,
+                                    size_t len) {
+  return ac_intern_id_of(ac_intern_n(h, s, len));
+}
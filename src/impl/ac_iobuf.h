@@ -0,0 +1,78 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+struct ac_iobuf_s {
+  ac_pool_t *pool;
+  size_t chunk_size;
+
+  /* iov[first..num_iov) are the segments which haven't been consumed.  iov
+     holds iov_size entries and is reallocated from the pool as needed. */
+  struct iovec *iov;
+  int first;
+  int num_iov;
+  int iov_size;
+
+  size_t length;
+
+  /* the unused part of the current chunk.  The last segment can only be
+     extended if it ends at tail. */
+  char *tail;
+  char *tail_end;
+};
+
+/* used internally */
+void _ac_iobuf_append(ac_iobuf_t *h, const void *data, size_t length);
+
+static inline size_t ac_iobuf_length(ac_iobuf_t *h) { return h->length; }
+
+static inline struct iovec *ac_iobuf_iov(ac_iobuf_t *h, int *num_iov) {
+  *num_iov = h->num_iov - h->first;
+  return h->iov + h->first;
+}
+
+static inline void ac_iobuf_append(ac_iobuf_t *h, const void *data,
+                                   size_t length) {
+  if (h->num_iov > h->first && h->tail + length <= h->tail_end) {
+    struct iovec *last = h->iov + h->num_iov - 1;
+    if ((char *)last->iov_base + last->iov_len == h->tail) {
+      memcpy(h->tail, data, length);
+      h->tail += length;
+      last->iov_len += length;
+      h->length += length;
+      return;
+    }
+  }
+  _ac_iobuf_append(h, data, length);
+}
+
+static inline void ac_iobuf_appends(ac_iobuf_t *h, const char *s) {
+  ac_iobuf_append(h, s, strlen(s));
+}
+
+static inline void ac_iobuf_appendc(ac_iobuf_t *h, char ch) {
+  ac_iobuf_append(h, &ch, 1);
+}
+
+static inline void ac_iobuf_append_buffer(ac_iobuf_t *h, ac_buffer_t *b) {
+  ac_iobuf_append(h, ac_buffer_data(b), ac_buffer_length(b));
+}
+
+static inline void ac_iobuf_appendf(ac_iobuf_t *h, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  ac_iobuf_appendvf(h, fmt, args);
+  va_end(args);
+}
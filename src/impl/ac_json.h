@@ -0,0 +1,156 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include <string.h>
+
+/* the node's string has escapes which haven't been decoded yet */
+#define AC_JSON_ESCAPED 1
+/* the node is the key of an object member (the value follows it) */
+#define AC_JSON_KEY 2
+
+/* an array or object is followed by its members (keys and values for an
+   object) and then a node of this type */
+#define _ac_json_end 255
+
+struct ac_json_s {
+  /* strings begin after the quote, strings and numbers are zero terminated
+     once the document is parsed */
+  char *ptr;
+  uint32_t length;
+  /* the number of nodes in the value (including the end of a container), so
+     the next value begins skip nodes after this one */
+  uint32_t skip;
+  uint32_t count;
+  uint8_t type;
+  uint8_t flags;
+};
+
+static inline ac_json_type_t ac_json_type(const ac_json_t *j) {
+  return j ? (ac_json_type_t)j->type : ac_json_none;
+}
+
+static inline size_t ac_json_count(const ac_json_t *j) {
+  return j ? j->count : 0;
+}
+
+static inline ac_json_t *ac_json_first(ac_json_t *j) {
+  if (!j || !j->count)
+    return NULL;
+  /* an object's first node is the key of the first member */
+  return j->type == ac_json_object ? j + 2 : j + 1;
+}
+
+static inline ac_json_t *ac_json_next(ac_json_t *j) {
+  if (!j)
+    return NULL;
+  j += j->skip;
+  if (j->type == _ac_json_end)
+    return NULL;
+  return (j->flags & AC_JSON_KEY) ? j + 1 : j;
+}
+
+static inline bool ac_json_is_null(const ac_json_t *j) {
+  return j && j->type == ac_json_null;
+}
+
+static inline void ac_json_writer_init(ac_json_writer_t *w, ac_buffer_t *bh) {
+  w->bh = bh;
+  w->need_comma = false;
+}
+
+static inline void _ac_json_separate(ac_json_writer_t *w) {
+  if (w->need_comma)
+    ac_buffer_appendc(w->bh, ',');
+  w->need_comma = true;
+}
+
+static inline void ac_json_write_object(ac_json_writer_t *w) {
+  _ac_json_separate(w);
+  ac_buffer_appendc(w->bh, '{');
+  w->need_comma = false;
+}
+
+static inline void ac_json_write_object_end(ac_json_writer_t *w) {
+  ac_buffer_appendc(w->bh, '}');
+  w->need_comma = true;
+}
+
+static inline void ac_json_write_array(ac_json_writer_t *w) {
+  _ac_json_separate(w);
+  ac_buffer_appendc(w->bh, '[');
+  w->need_comma = false;
+}
+
+static inline void ac_json_write_array_end(ac_json_writer_t *w) {
+  ac_buffer_appendc(w->bh, ']');
+  w->need_comma = true;
+}
+
+static inline void ac_json_write_key_n(ac_json_writer_t *w, const char *key,
+                                       size_t length) {
+  _ac_json_separate(w);
+  ac_buffer_appendc(w->bh, '"');
+  ac_buffer_append_escaped_json(w->bh, key, length);
+  ac_buffer_append(w->bh, "\":", 2);
+  /* the value follows the colon */
+  w->need_comma = false;
+}
+
+static inline void ac_json_write_key(ac_json_writer_t *w, const char *key) {
+  ac_json_write_key_n(w, key, strlen(key));
+}
+
+static inline void ac_json_write_string_n(ac_json_writer_t *w, const char *s,
+                                          size_t length) {
+  _ac_json_separate(w);
+  ac_buffer_appendc(w->bh, '"');
+  ac_buffer_append_escaped_json(w->bh, s, length);
+  ac_buffer_appendc(w->bh, '"');
+}
+
+static inline void ac_json_write_string(ac_json_writer_t *w, const char *s) {
+  ac_json_write_string_n(w, s, strlen(s));
+}
+
+static inline void ac_json_write_int64(ac_json_writer_t *w, int64_t v) {
+  _ac_json_separate(w);
+  ac_buffer_append_i64(w->bh, v);
+}
+
+static inline void ac_json_write_uint64(ac_json_writer_t *w, uint64_t v) {
+  _ac_json_separate(w);
+  ac_buffer_append_u64(w->bh, v);
+}
+
+static inline void ac_json_write_bool(ac_json_writer_t *w, bool v) {
+  _ac_json_separate(w);
+  if (v)
+    ac_buffer_append(w->bh, "true", 4);
+  else
+    ac_buffer_append(w->bh, "false", 5);
+}
+
+static inline void ac_json_write_null(ac_json_writer_t *w) {
+  _ac_json_separate(w);
+  ac_buffer_append(w->bh, "null", 4);
+}
+
+static inline void ac_json_write_raw(ac_json_writer_t *w, const char *json,
+                                     size_t length) {
+  _ac_json_separate(w);
+  ac_buffer_append(w->bh, json, length);
+}
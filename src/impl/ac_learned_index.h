@@ -0,0 +1,135 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <math.h>
+
+typedef struct {
+  double slope;
+  size_t start;
+} ac_learned_index_segment_t;
+
+struct ac_learned_index_s {
+  /* the first key of each segment */
+  double *keys;
+  ac_learned_index_segment_t *segments;
+  size_t num_segments;
+  size_t num_elements;
+  size_t max_error;
+};
+
+#define ac_learned_index_build_def(name, datatype)                             \
+  ac_learned_index_t *name(ac_pool_t *pool, datatype *base,                    \
+                           size_t num_elements, size_t max_error);
+
+#define ac_learned_index_lower_bound_def(name, keytype, datatype)              \
+  datatype *name(ac_learned_index_t *h, keytype k, datatype *base);
+
+/* Segments are built greedily (a shrinking cone).  Each segment starts at an
+   element and keeps the range of slopes which predict every element so far
+   within max_error of its position.  The segment ends when the next element
+   would make the range empty.  When keys and segments are NULL, the
+   segments are only counted. */
+#define _ac_learned_index_segments_m(name, datatype, key)                      \
+  static inline size_t name##_segments(datatype *base, size_t num_elements,    \
+                                       size_t max_error, double *keys,         \
+                                       ac_learned_index_segment_t *segments) { \
+    size_t num_segments = 0;                                                   \
+    size_t start = 0;                                                          \
+    double eps = (double)max_error;                                            \
+    while (start < num_elements) {                                             \
+      double x0 = (double)key(base + start);                                   \
+      double low = 0.0, high = INFINITY;                                       \
+      size_t i = start + 1;                                                    \
+      for (; i < num_elements; i++) {                                          \
+        double dx = (double)key(base + i) - x0;                                \
+        double dy = (double)(i - start);                                       \
+        if (dx <= 0.0) {                                                       \
+          if (dy > eps)                                                        \
+            break;                                                             \
+          continue;                                                            \
+        }                                                                      \
+        double lo = (dy - eps) / dx;                                           \
+        double hi = (dy + eps) / dx;                                           \
+        if (lo > high || hi < low)                                             \
+          break;                                                               \
+        if (lo > low)                                                          \
+          low = lo;                                                            \
+        if (hi < high)                                                         \
+          high = hi;                                                           \
+      }                                                                        \
+      if (segments) {                                                          \
+        keys[num_segments] = x0;                                               \
+        segments[num_segments].slope =                                         \
+            high == INFINITY ? low : (low + high) * 0.5;                       \
+        segments[num_segments].start = start;                                  \
+      }                                                                        \
+      num_segments++;                                                          \
+      start = i;                                                               \
+    }                                                                          \
+    return num_segments;                                                       \
+  }
+
+#define ac_learned_index_build_m(name, datatype, key)                          \
+  _ac_learned_index_segments_m(name, datatype, key)                            \
+  ac_learned_index_t *name(ac_pool_t *pool, datatype *base,                    \
+                           size_t num_elements, size_t max_error) {            \
+    ac_learned_index_t *h =                                                    \
+        (ac_learned_index_t *)ac_pool_alloc(pool, sizeof(*h));                 \
+    h->num_elements = num_elements;                                            \
+    h->max_error = max_error;                                                  \
+    h->num_segments =                                                          \
+        name##_segments(base, num_elements, max_error, NULL, NULL);            \
+    h->keys = (double *)ac_pool_alloc(pool, (h->num_segments + 1) *            \
+                                                sizeof(double));               \
+    h->segments = (ac_learned_index_segment_t *)ac_pool_alloc(                 \
+        pool, (h->num_segments + 1) * sizeof(ac_learned_index_segment_t));     \
+    name##_segments(base, num_elements, max_error, h->keys, h->segments);      \
+    return h;                                                                  \
+  }
+
+/* The model predicts a position and the lower bound is found within
+   max_error of it.  The window is checked against its neighbors, so if the
+   prediction is ever outside of the bound (such as a key which isn't exactly
+   representable as a double), the search widens instead of being wrong. */
+#define ac_learned_index_lower_bound_m(name, keytype, datatype, key)           \
+  datatype *name(ac_learned_index_t *h, keytype k, datatype *base) {           \
+    size_t num_elements = h->num_elements;                                     \
+    double x = (double)k;                                                      \
+    size_t s = ac_search_upper_bound_double(x, h->keys, h->num_segments) -     \
+               h->keys;                                                        \
+    if (!s)                                                                    \
+      return base;                                                             \
+    s--;                                                                       \
+    double p = (double)h->segments[s].start +                                  \
+               h->segments[s].slope * (x - h->keys[s]);                        \
+    double n = (double)num_elements;                                           \
+    double plo = p - (double)h->max_error - 1.0;                               \
+    double phi = p + (double)h->max_error + 2.0;                               \
+    size_t lo = plo <= 0.0 ? 0 : plo >= n ? num_elements : (size_t)plo;        \
+    size_t hi = phi <= 0.0 ? 0 : phi >= n ? num_elements : (size_t)phi;        \
+    if (lo > 0 && !(key(base + lo - 1) < k))                                   \
+      lo = 0;                                                                  \
+    if (hi < num_elements && key(base + hi) < k)                               \
+      hi = num_elements;                                                       \
+    while (lo < hi) {                                                          \
+      size_t mid = lo + ((hi - lo) >> 1);                                      \
+      if (key(base + mid) < k)                                                 \
+        lo = mid + 1;                                                          \
+      else                                                                     \
+        hi = mid;                                                              \
+    }                                                                          \
+    return base + lo;                                                          \
+  }
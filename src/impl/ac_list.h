@@ -0,0 +1,273 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+static inline void ac_list_init(ac_list_t *l) { l->head = l->tail = NULL; }
+
+static inline bool ac_list_empty(ac_list_t *l) { return !l->head; }
+
+static inline ac_list_node_t *ac_list_first(ac_list_t *l) { return l->head; }
+
+static inline ac_list_node_t *ac_list_last(ac_list_t *l) { return l->tail; }
+
+static inline void ac_list_push_front(ac_list_t *l, ac_list_node_t *n) {
+  n->prev = NULL;
+  n->next = l->head;
+  if (l->head)
+    l->head->prev = n;
+  else
+    l->tail = n;
+  l->head = n;
+}
+
+static inline void ac_list_push_back(ac_list_t *l, ac_list_node_t *n) {
+  n->next = NULL;
+  n->prev = l->tail;
+  if (l->tail)
+    l->tail->next = n;
+  else
+    l->head = n;
+  l->tail = n;
+}
+
+static inline void ac_list_insert_before(ac_list_t *l, ac_list_node_t *pos,
+                                         ac_list_node_t *n) {
+  n->next = pos;
+  n->prev = pos->prev;
+  if (pos->prev)
+    pos->prev->next = n;
+  else
+    l->head = n;
+  pos->prev = n;
+}
+
+static inline void ac_list_insert_after(ac_list_t *l, ac_list_node_t *pos,
+                                        ac_list_node_t *n) {
+  n->prev = pos;
+  n->next = pos->next;
+  if (pos->next)
+    pos->next->prev = n;
+  else
+    l->tail = n;
+  pos->next = n;
+}
+
+static inline void ac_list_erase(ac_list_t *l, ac_list_node_t *n) {
+  if (n->prev)
+    n->prev->next = n->next;
+  else
+    l->head = n->next;
+  if (n->next)
+    n->next->prev = n->prev;
+  else
+    l->tail = n->prev;
+}
+
+static inline ac_list_node_t *ac_list_pop_front(ac_list_t *l) {
+  ac_list_node_t *n = l->head;
+  if (n) {
+    l->head = n->next;
+    if (l->head)
+      l->head->prev = NULL;
+    else
+      l->tail = NULL;
+  }
+  return n;
+}
+
+static inline ac_list_node_t *ac_list_pop_back(ac_list_t *l) {
+  ac_list_node_t *n = l->tail;
+  if (n) {
+    l->tail = n->prev;
+    if (l->tail)
+      l->tail->next = NULL;
+    else
+      l->head = NULL;
+  }
+  return n;
+}
+
+static inline void ac_list_move_to_front(ac_list_t *l, ac_list_node_t *n) {
+  if (l->head == n)
+    return;
+  ac_list_erase(l, n);
+  ac_list_push_front(l, n);
+}
+
+static inline void ac_list_move_to_back(ac_list_t *l, ac_list_node_t *n) {
+  if (l->tail == n)
+    return;
+  ac_list_erase(l, n);
+  ac_list_push_back(l, n);
+}
+
+static inline void ac_list_prepend_chain(ac_list_t *l, ac_list_node_t *first,
+                                         ac_list_node_t *last) {
+  first->prev = NULL;
+  last->next = l->head;
+  if (l->head)
+    l->head->prev = last;
+  else
+    l->tail = last;
+  l->head = first;
+}
+
+static inline void ac_list_append_chain(ac_list_t *l, ac_list_node_t *first,
+                                        ac_list_node_t *last) {
+  last->next = NULL;
+  first->prev = l->tail;
+  if (l->tail)
+    l->tail->next = first;
+  else
+    l->head = first;
+  l->tail = last;
+}
+
+static inline void ac_list_splice_front(ac_list_t *l, ac_list_t *other) {
+  if (!other->head)
+    return;
+  ac_list_prepend_chain(l, other->head, other->tail);
+  other->head = other->tail = NULL;
+}
+
+static inline void ac_list_splice_back(ac_list_t *l, ac_list_t *other) {
+  if (!other->head)
+    return;
+  ac_list_append_chain(l, other->head, other->tail);
+  other->head = other->tail = NULL;
+}
+
+static inline void ac_list_split(ac_list_t *l, ac_list_node_t *n,
+                                 ac_list_t *tail) {
+  tail->head = n;
+  tail->tail = l->tail;
+  l->tail = n->prev;
+  if (n->prev)
+    n->prev->next = NULL;
+  else
+    l->head = NULL;
+  n->prev = NULL;
+}
+
+static inline void ac_slist_init(ac_slist_t *l) { l->head = l->tail = NULL; }
+
+static inline bool ac_slist_empty(ac_slist_t *l) { return !l->head; }
+
+static inline ac_slist_node_t *ac_slist_first(ac_slist_t *l) {
+  return l->head;
+}
+
+static inline ac_slist_node_t *ac_slist_last(ac_slist_t *l) { return l->tail; }
+
+static inline void ac_slist_push_front(ac_slist_t *l, ac_slist_node_t *n) {
+  n->next = l->head;
+  if (!l->head)
+    l->tail = n;
+  l->head = n;
+}
+
+static inline void ac_slist_push_back(ac_slist_t *l, ac_slist_node_t *n) {
+  n->next = NULL;
+  if (l->tail)
+    l->tail->next = n;
+  else
+    l->head = n;
+  l->tail = n;
+}
+
+static inline ac_slist_node_t *ac_slist_pop_front(ac_slist_t *l) {
+  ac_slist_node_t *n = l->head;
+  if (n) {
+    l->head = n->next;
+    if (!l->head)
+      l->tail = NULL;
+  }
+  return n;
+}
+
+static inline void ac_slist_insert_after(ac_slist_t *l, ac_slist_node_t *pos,
+                                         ac_slist_node_t *n) {
+  if (!pos) {
+    ac_slist_push_front(l, n);
+    return;
+  }
+  n->next = pos->next;
+  pos->next = n;
+  if (l->tail == pos)
+    l->tail = n;
+}
+
+static inline ac_slist_node_t *ac_slist_erase_after(ac_slist_t *l,
+                                                    ac_slist_node_t *pos) {
+  if (!pos)
+    return ac_slist_pop_front(l);
+  ac_slist_node_t *n = pos->next;
+  if (n) {
+    pos->next = n->next;
+    if (l->tail == n)
+      l->tail = pos;
+  }
+  return n;
+}
+
+static inline bool ac_slist_erase(ac_slist_t *l, ac_slist_node_t *n) {
+  ac_slist_node_t *prev = NULL;
+  for (ac_slist_node_t *p = l->head; p; prev = p, p = p->next) {
+    if (p == n) {
+      ac_slist_erase_after(l, prev);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void ac_slist_prepend_chain(ac_slist_t *l, ac_slist_node_t *first,
+                                          ac_slist_node_t *last) {
+  last->next = l->head;
+  if (!l->head)
+    l->tail = last;
+  l->head = first;
+}
+
+static inline void ac_slist_append_chain(ac_slist_t *l, ac_slist_node_t *first,
+                                         ac_slist_node_t *last) {
+  last->next = NULL;
+  if (l->tail)
+    l->tail->next = first;
+  else
+    l->head = first;
+  l->tail = last;
+}
+
+static inline void ac_slist_splice_front(ac_slist_t *l, ac_slist_t *other) {
+  if (!other->head)
+    return;
+  ac_slist_prepend_chain(l, other->head, other->tail);
+  other->head = other->tail = NULL;
+}
+
+static inline void ac_slist_splice_back(ac_slist_t *l, ac_slist_t *other) {
+  if (!other->head)
+    return;
+  ac_slist_append_chain(l, other->head, other->tail);
+  other->head = other->tail = NULL;
+}
+
+static inline ac_slist_node_t *ac_slist_take_all(ac_slist_t *l) {
+  ac_slist_node_t *n = l->head;
+  l->head = l->tail = NULL;
+  return n;
+}
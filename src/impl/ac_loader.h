@@ -0,0 +1,48 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#define ac_loader_sort_m(name, datatype, compare)                              \
+  typedef datatype *name##_record_t;                                           \
+                                                                               \
+  static ac_sort_m(name##_sort, name##_record_t, compare)                      \
+                                                                               \
+  ac_merge_m(name##_merge, name##_record_t, compare)                           \
+                                                                               \
+  static void name##_sort_run(void **base, size_t num) {                       \
+    name##_sort((name##_record_t *)base, num);                                 \
+  }                                                                            \
+                                                                               \
+  datatype **name(ac_loader_t *h, size_t *num, int num_threads) {              \
+    ac_loader_sort_runs(h, name##_sort_run, num_threads);                      \
+    size_t num_runs = ac_loader_runs(h);                                       \
+    *num = ac_loader_count(h);                                                 \
+    if (num_runs == 1) {                                                       \
+      size_t n;                                                                \
+      return (datatype **)ac_loader_run(h, 0, &n);                             \
+    }                                                                          \
+    ac_pool_t *pool = ac_loader_pool(h);                                       \
+    const name##_record_t **runs = (const name##_record_t **)ac_pool_alloc(    \
+        pool, sizeof(name##_record_t *) * num_runs);                           \
+    size_t *lengths =                                                          \
+        (size_t *)ac_pool_alloc(pool, sizeof(size_t) * num_runs);              \
+    for (size_t r = 0; r < num_runs; r++)                                      \
+      runs[r] = (const name##_record_t *)ac_loader_run(h, r, lengths + r);     \
+    datatype **res = (datatype **)ac_pool_alloc(                               \
+        pool, sizeof(datatype *) * (*num + 1));                                \
+    name##_merge_k_parallel(res, runs, lengths, num_runs, num_threads);        \
+    return res;                                                                \
+  }
@@ -30,6 +30,13 @@ limitations under the License.
       int compare(const keytype *key, const datatype *value, void *arg),       \
       void *arg);
 
+/* the number of searches which a batch find keeps in flight */
+#define AC_MAP_BATCH 16
+
+#define ac_map_find_batch_def(name, keytype, datatype)                         \
+  void name(const keytype *keys, size_t num, const ac_map_t *root,             \
+            datatype **res);
+
 #define ac_map_insert_def(name, datatype, compare)                           \
   bool name(datatype *node, ac_map_t **root);
 
@@ -169,6 +176,100 @@ limitations under the License.
     return NULL;                                                               \
   }
 
+#define ac_map_find_batch_m(name, keytype, datatype, compare)                  \
+  void name(const keytype *keys, size_t num, const ac_map_t *root,             \
+            datatype **res) {                                                  \
+    const ac_map_t *cur[AC_MAP_BATCH];                                         \
+    size_t idx[AC_MAP_BATCH];                                                  \
+    size_t active = 0, next = 0;                                               \
+    if (!root) {                                                               \
+      for (size_t i = 0; i < num; i++)                                         \
+        res[i] = NULL;                                                         \
+      return;                                                                  \
+    }                                                                          \
+    while (active < AC_MAP_BATCH && next < num) {                              \
+      cur[active] = root;                                                      \
+      idx[active] = next++;                                                    \
+      active++;                                                                \
+    }                                                                          \
+    while (active) {                                                           \
+      for (size_t j = 0; j < active;) {                                        \
+        const ac_map_t *n = cur[j];                                            \
+        const datatype *d = (const datatype *)n;                               \
+        int c = compare(keys + idx[j], d);                                     \
+        if (c) {                                                               \
+          n = c < 0 ? n->left : n->right;                                      \
+          if (n) {                                                             \
+            __builtin_prefetch(n);                                             \
+            cur[j] = n;                                                        \
+            j++;                                                               \
+            continue;                                                          \
+          }                                                                    \
+          res[idx[j]] = NULL;                                                  \
+        } else                                                                 \
+          res[idx[j]] = (datatype *)d;                                         \
+        /* the search is complete, start the next key in its place (or fill    \
+           the hole with the last search) */                                   \
+        if (next < num) {                                                      \
+          cur[j] = root;                                                       \
+          idx[j] = next++;                                                     \
+          j++;                                                                 \
+        } else {                                                               \
+          active--;                                                            \
+          cur[j] = cur[active];                                                \
+          idx[j] = idx[active];                                                \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }
+
+#define ac_map_find_batch2_m(name, keytype, datatype, mapname, compare)        \
+  void name(const keytype *keys, size_t num, const ac_map_t *root,             \
+            datatype **res) {                                                  \
+    const ac_map_t *cur[AC_MAP_BATCH];                                         \
+    size_t idx[AC_MAP_BATCH];                                                  \
+    size_t active = 0, next = 0;                                               \
+    if (!root) {                                                               \
+      for (size_t i = 0; i < num; i++)                                         \
+        res[i] = NULL;                                                         \
+      return;                                                                  \
+    }                                                                          \
+    while (active < AC_MAP_BATCH && next < num) {                              \
+      cur[active] = root;                                                      \
+      idx[active] = next++;                                                    \
+      active++;                                                                \
+    }                                                                          \
+    while (active) {                                                           \
+      for (size_t j = 0; j < active;) {                                        \
+        const ac_map_t *n = cur[j];                                            \
+        datatype *d = ac_parent_object(n, datatype, mapname);                  \
+        int c = compare(keys + idx[j], d);                                     \
+        if (c) {                                                               \
+          n = c < 0 ? n->left : n->right;                                      \
+          if (n) {                                                             \
+            __builtin_prefetch(n);                                             \
+            cur[j] = n;                                                        \
+            j++;                                                               \
+            continue;                                                          \
+          }                                                                    \
+          res[idx[j]] = NULL;                                                  \
+        } else                                                                 \
+          res[idx[j]] = (datatype *)d;                                         \
+        /* the search is complete, start the next key in its place (or fill    \
+           the hole with the last search) */                                   \
+        if (next < num) {                                                      \
+          cur[j] = root;                                                       \
+          idx[j] = next++;                                                     \
+          j++;                                                                 \
+        } else {                                                               \
+          active--;                                                            \
+          cur[j] = cur[active];                                                \
+          idx[j] = idx[active];                                                \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }
+
 #define ac_map_least_m(name, keytype, datatype, compare)                     \
   datatype *name(const keytype *p, const ac_map_t *root) {                   \
     int n = 0;                                                                 \
@@ -1091,3 +1192,241 @@ limitations under the License.
     ac_map_fix_insert(*np, parent, root);                                    \
     return true;                                                               \
   }
+
+#define ac_map_os_insert_m(name, datatype, compare)                            \
+  bool name(datatype *node, ac_map_t **root) {                                 \
+    ac_map_t **np = root, *parent = NULL;                                      \
+    while (*np) {                                                              \
+      parent = *np;                                                            \
+      int n = compare(node, (datatype *)parent);                               \
+      if (n < 0)                                                               \
+        np = &(parent->left);                                                  \
+      else if (n > 0)                                                          \
+        np = &(parent->right);                                                 \
+      else                                                                     \
+        return false;                                                          \
+    }                                                                          \
+    *np = (ac_map_t *)node;                                                    \
+    ac_map_os_fix_insert(*np, parent, root);                                   \
+    return true;                                                               \
+  }
+
+#define ac_multimap_os_insert_m(name, datatype, compare)                       \
+  bool name(datatype *node, ac_map_t **root) {                                 \
+    ac_map_t **np = root, *parent = NULL;                                      \
+    while (*np) {                                                              \
+      parent = *np;                                                            \
+      int n = compare(node, (datatype *)parent);                               \
+      if (n < 0)                                                               \
+        np = &(parent->left);                                                  \
+      else if (n > 0)                                                          \
+        np = &(parent->right);                                                 \
+      else {                                                                   \
+        if (node < (datatype *)parent)                                         \
+          np = &(parent->left);                                                \
+        else if (node > (datatype *)parent)                                    \
+          np = &(parent->right);                                               \
+        else                                                                   \
+          return false;                                                        \
+      }                                                                        \
+    }                                                                          \
+    *np = (ac_map_t *)node;                                                    \
+    ac_map_os_fix_insert(*np, parent, root);                                   \
+    return true;                                                               \
+  }
+
+#define ac_multimap_chain_insert_m(name, datatype, compare)                    \
+  bool name(datatype *node, ac_map_t **root) {                                 \
+    ac_map_t **np = root, *parent = NULL;                                      \
+    while (*np) {                                                              \
+      parent = *np;                                                            \
+      int n = compare(node, (datatype *)parent);                               \
+      if (n < 0)                                                               \
+        np = &(parent->left);                                                  \
+      else if (n > 0)                                                          \
+        np = &(parent->right);                                                 \
+      else {                                                                   \
+        ac_map_chain_append((ac_map_chain_t *)parent, (ac_map_chain_t *)node); \
+        return false;                                                          \
+      }                                                                        \
+    }                                                                          \
+    ac_map_chain_t *c = (ac_map_chain_t *)node;                                \
+    c->next = NULL;                                                            \
+    c->tail = c;                                                               \
+    *np = (ac_map_t *)node;                                                    \
+    ac_map_fix_insert(*np, parent, root);                                      \
+    return true;                                                               \
+  }
+
+#define ac_multimap_chain_insert_arg_m(name, datatype, compare)                \
+  bool name(datatype *node, ac_map_t **root, void *arg) {                      \
+    ac_map_t **np = root, *parent = NULL;                                      \
+    while (*np) {                                                              \
+      parent = *np;                                                            \
+      int n = compare(node, (datatype *)parent, arg);                          \
+      if (n < 0)                                                               \
+        np = &(parent->left);                                                  \
+      else if (n > 0)                                                          \
+        np = &(parent->right);                                                 \
+      else {                                                                   \
+        ac_map_chain_append((ac_map_chain_t *)parent, (ac_map_chain_t *)node); \
+        return false;                                                          \
+      }                                                                        \
+    }                                                                          \
+    ac_map_chain_t *c = (ac_map_chain_t *)node;                                \
+    c->next = NULL;                                                            \
+    c->tail = c;                                                               \
+    *np = (ac_map_t *)node;                                                    \
+    ac_map_fix_insert(*np, parent, root);                                      \
+    return true;                                                               \
+  }
+
+#define ac_map_persistent_insert_m(name, datatype, compare)                    \
+  static ac_map_t *name##_copy(ac_map_t *n, void *pool) {                      \
+    return (ac_map_t *)ac_pool_dup((ac_pool_t *)pool, n, sizeof(datatype));    \
+  }                                                                            \
+                                                                               \
+  ac_map_t *name(datatype *node, ac_map_t *root, ac_pool_t *pool) {            \
+    ac_map_t *path[AC_MAP_MAX_HEIGHT];                                         \
+    char dirs[AC_MAP_MAX_HEIGHT];                                              \
+    int depth = 0;                                                             \
+    while (root) {                                                             \
+      path[depth] = root;                                                      \
+      int n = compare(node, (datatype *)root);                                 \
+      if (!n)                                                                  \
+        return ac_map_persistent_insert(path, dirs, depth + 1, true,           \
+                                        (ac_map_t *)node, name##_copy, pool);  \
+      dirs[depth++] = n > 0;                                                   \
+      root = n < 0 ? root->left : root->right;                                 \
+    }                                                                          \
+    return ac_map_persistent_insert(path, dirs, depth, false,                  \
+                                    (ac_map_t *)node, name##_copy, pool);      \
+  }
+
+#define ac_map_persistent_erase_m(name, keytype, datatype, compare)            \
+  static ac_map_t *name##_copy(ac_map_t *n, void *pool) {                      \
+    return (ac_map_t *)ac_pool_dup((ac_pool_t *)pool, n, sizeof(datatype));    \
+  }                                                                            \
+                                                                               \
+  ac_map_t *name(const keytype *key, ac_map_t *root, ac_pool_t *pool) {        \
+    ac_map_t *path[AC_MAP_MAX_HEIGHT];                                         \
+    char dirs[AC_MAP_MAX_HEIGHT];                                              \
+    int depth = 0;                                                             \
+    ac_map_t *n = root;                                                        \
+    while (n) {                                                                \
+      path[depth] = n;                                                         \
+      int c = compare(key, (const datatype *)n);                               \
+      if (!c)                                                                  \
+        return ac_map_persistent_erase(path, dirs, depth + 1, name##_copy,     \
+                                       pool);                                  \
+      dirs[depth++] = c > 0;                                                   \
+      n = c < 0 ? n->left : n->right;                                          \
+    }                                                                          \
+    return root;                                                               \
+  }
+
+#define ac_map_scan_m(name, keytype, datatype, compare)                        \
+  void name##_init(ac_map_scan_t *s, const keytype *start, const keytype *end, \
+                   const ac_map_t *root) {                                     \
+    s->depth = 0;                                                              \
+    s->end = end;                                                              \
+    /* the stack holds the nodes where the search went left, the top is the    \
+       first node which is not less than start */                              \
+    while (root) {                                                             \
+      const datatype *d = (const datatype *)root;                              \
+      if (!start || compare(start, d) <= 0) {                                  \
+        s->stack[s->depth++] = (ac_map_t *)root;                               \
+        root = root->left;                                                     \
+      } else                                                                   \
+        root = root->right;                                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  size_t name##_fill(ac_map_scan_t *s, datatype **res, size_t max) {           \
+    const keytype *end = (const keytype *)s->end;                              \
+    size_t num = 0;                                                            \
+    while (num < max && s->depth) {                                            \
+      ac_map_t *n = s->stack[--s->depth];                                      \
+      datatype *d = (datatype *)n;                                             \
+      if (end && compare(end, d) <= 0) {                                       \
+        s->depth = 0;                                                          \
+        break;                                                                 \
+      }                                                                        \
+      res[num++] = d;                                                          \
+      n = n->right;                                                            \
+      while (n) {                                                              \
+        s->stack[s->depth++] = n;                                              \
+        n = n->left;                                                           \
+      }                                                                        \
+    }                                                                          \
+    return num;                                                                \
+  }                                                                            \
+                                                                               \
+  size_t name(const keytype *start, const keytype *end, const ac_map_t *root,  \
+              bool (*cb)(datatype *d, void *arg), void *arg) {                 \
+    ac_map_scan_t s;                                                           \
+    datatype *res[AC_MAP_SCAN_BATCH];                                          \
+    size_t total = 0, num;                                                     \
+    name##_init(&s, start, end, root);                                         \
+    while ((num = name##_fill(&s, res, AC_MAP_SCAN_BATCH)) != 0) {             \
+      for (size_t i = 0; i < num; i++) {                                       \
+        total++;                                                               \
+        if (!cb(res[i], arg))                                                  \
+          return total;                                                        \
+      }                                                                        \
+    }                                                                          \
+    return total;                                                              \
+  }
+
+#define ac_map_scan2_m(name, keytype, datatype, mapname, compare)              \
+  void name##_init(ac_map_scan_t *s, const keytype *start, const keytype *end, \
+                   const ac_map_t *root) {                                     \
+    s->depth = 0;                                                              \
+    s->end = end;                                                              \
+    /* the stack holds the nodes where the search went left, the top is the    \
+       first node which is not less than start */                              \
+    while (root) {                                                             \
+      const datatype *d = ac_parent_object(root, datatype, mapname);           \
+      if (!start || compare(start, d) <= 0) {                                  \
+        s->stack[s->depth++] = (ac_map_t *)root;                               \
+        root = root->left;                                                     \
+      } else                                                                   \
+        root = root->right;                                                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  size_t name##_fill(ac_map_scan_t *s, datatype **res, size_t max) {           \
+    const keytype *end = (const keytype *)s->end;                              \
+    size_t num = 0;                                                            \
+    while (num < max && s->depth) {                                            \
+      ac_map_t *n = s->stack[--s->depth];                                      \
+      datatype *d = ac_parent_object(n, datatype, mapname);                    \
+      if (end && compare(end, d) <= 0) {                                       \
+        s->depth = 0;                                                          \
+        break;                                                                 \
+      }                                                                        \
+      res[num++] = d;                                                          \
+      n = n->right;                                                            \
+      while (n) {                                                              \
+        s->stack[s->depth++] = n;                                              \
+        n = n->left;                                                           \
+      }                                                                        \
+    }                                                                          \
+    return num;                                                                \
+  }                                                                            \
+                                                                               \
+  size_t name(const keytype *start, const keytype *end, const ac_map_t *root,  \
+              bool (*cb)(datatype *d, void *arg), void *arg) {                 \
+    ac_map_scan_t s;                                                           \
+    datatype *res[AC_MAP_SCAN_BATCH];                                          \
+    size_t total = 0, num;                                                     \
+    name##_init(&s, start, end, root);                                         \
+    while ((num = name##_fill(&s, res, AC_MAP_SCAN_BATCH)) != 0) {             \
+      for (size_t i = 0; i < num; i++) {                                       \
+        total++;                                                               \
+        if (!cb(res[i], arg))                                                  \
+          return total;                                                        \
+      }                                                                        \
+    }                                                                          \
+    return total;                                                              \
+  }
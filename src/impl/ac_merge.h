@@ -0,0 +1,268 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ac_merge_m(name, type, compare)                                        \
+  static ac_sort_m(name##_sort_samples, type, compare)                         \
+                                                                               \
+  void name(type *dest, const type *a, size_t na, const type *b, size_t nb) {  \
+    const type *ae = a + na;                                                   \
+    const type *be = b + nb;                                                   \
+    if (na && nb) {                                                            \
+      while (true) {                                                           \
+        if (compare(b, a) < 0) {                                               \
+          *dest++ = *b++;                                                      \
+          if (b == be)                                                         \
+            break;                                                             \
+        } else {                                                               \
+          *dest++ = *a++;                                                      \
+          if (a == ae)                                                         \
+            break;                                                             \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    memcpy(dest, a, (ae - a) * sizeof(type));                                  \
+    dest += ae - a;                                                            \
+    memcpy(dest, b, (be - b) * sizeof(type));                                  \
+  }                                                                            \
+                                                                               \
+  /* the smallest i for which b[k-i-1] < a[i] (or which is past the end of     \
+     one side), a[0..i) and b[0..k-i) are the first k elements of the          \
+     merge */                                                                  \
+  size_t name##_corank(size_t k, const type *a, size_t na, const type *b,      \
+                       size_t nb) {                                            \
+    size_t lo = k > nb ? k - nb : 0;                                           \
+    size_t hi = k < na ? k : na;                                               \
+    while (lo < hi) {                                                          \
+      size_t i = lo + ((hi - lo) >> 1);                                        \
+      size_t j = k - i;                                                        \
+      if (j > 0 && i < na && compare(b + j - 1, a + i) >= 0)                   \
+        lo = i + 1;                                                            \
+      else                                                                     \
+        hi = i;                                                                \
+    }                                                                          \
+    return lo;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* tree[0] is the run with the smallest element, tree[1..num_runs) hold      \
+     the losers of the matches on the way up from the leaves (run r is leaf    \
+     num_runs + r).  An empty run loses to every other run. */                 \
+  typedef struct {                                                             \
+    const type **cur;                                                          \
+    const type **end;                                                          \
+    size_t *tree;                                                              \
+    size_t num_runs;                                                           \
+  } name##_tree_t;                                                             \
+                                                                               \
+  static inline bool name##_beats(name##_tree_t *t, size_t x, size_t y) {      \
+    if (t->cur[y] == t->end[y])                                                \
+      return true;                                                             \
+    if (t->cur[x] == t->end[x])                                                \
+      return false;                                                            \
+    int n = compare(t->cur[x], t->cur[y]);                                     \
+    return n < 0 || (n == 0 && x < y);                                         \
+  }                                                                            \
+                                                                               \
+  static size_t name##_tree_build(name##_tree_t *t, size_t node) {             \
+    if (node >= t->num_runs)                                                   \
+      return node - t->num_runs;                                               \
+    size_t x = name##_tree_build(t, node << 1);                                \
+    size_t y = name##_tree_build(t, (node << 1) + 1);                          \
+    if (name##_beats(t, x, y)) {                                               \
+      t->tree[node] = y;                                                       \
+      return x;                                                                \
+    }                                                                          \
+    t->tree[node] = x;                                                         \
+    return y;                                                                  \
+  }                                                                            \
+                                                                               \
+  static void name##_tree_merge(type *dest, const type **cur,                  \
+                                const type **end, size_t num_runs) {           \
+    name##_tree_t t;                                                           \
+    t.cur = cur;                                                               \
+    t.end = end;                                                               \
+    t.num_runs = num_runs;                                                     \
+    t.tree = (size_t *)ac_malloc(sizeof(size_t) * num_runs);                   \
+    size_t w = name##_tree_build(&t, 1);                                       \
+    while (cur[w] != end[w]) {                                                 \
+      *dest++ = *cur[w]++;                                                     \
+      /* replay the matches from w's leaf to the root */                       \
+      for (size_t node = (w + num_runs) >> 1; node; node >>= 1) {              \
+        size_t loser = t.tree[node];                                           \
+        if (name##_beats(&t, loser, w)) {                                      \
+          t.tree[node] = w;                                                    \
+          w = loser;                                                           \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    ac_free(t.tree);                                                           \
+  }                                                                            \
+                                                                               \
+  /* merges runs[r] + from[r] .. runs[r] + to[r] */                            \
+  static void name##_k_range(type *dest, const type **runs,                    \
+                             const size_t *from, const size_t *to,             \
+                             size_t num_runs) {                                \
+    if (num_runs == 1) {                                                       \
+      memcpy(dest, runs[0] + from[0], (to[0] - from[0]) * sizeof(type));       \
+      return;                                                                  \
+    }                                                                          \
+    if (num_runs == 2) {                                                       \
+      name(dest, runs[0] + from[0], to[0] - from[0], runs[1] + from[1],        \
+           to[1] - from[1]);                                                   \
+      return;                                                                  \
+    }                                                                          \
+    const type **cur =                                                         \
+        (const type **)ac_malloc(sizeof(type *) * num_runs * 2);               \
+    const type **end = cur + num_runs;                                         \
+    for (size_t r = 0; r < num_runs; r++) {                                    \
+      cur[r] = runs[r] + from[r];                                              \
+      end[r] = runs[r] + to[r];                                                \
+    }                                                                          \
+    name##_tree_merge(dest, cur, end, num_runs);                               \
+    ac_free(cur);                                                              \
+  }                                                                            \
+                                                                               \
+  void name##_k(type *dest, const type **runs, const size_t *lengths,          \
+                size_t num_runs) {                                             \
+    if (!num_runs)                                                             \
+      return;                                                                  \
+    size_t *from = (size_t *)ac_calloc(sizeof(size_t) * num_runs);             \
+    name##_k_range(dest, runs, from, lengths, num_runs);                       \
+    ac_free(from);                                                             \
+  }                                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    type *dest;                                                                \
+    const type *a;                                                             \
+    size_t na;                                                                 \
+    const type *b;                                                             \
+    size_t nb;                                                                 \
+  } name##_parallel_t;                                                         \
+                                                                               \
+  static void name##_parallel_work(void *arg, size_t chunk, size_t start,      \
+                                   size_t end) {                               \
+    (void)chunk;                                                               \
+    name##_parallel_t *m = (name##_parallel_t *)arg;                           \
+    size_t i = name##_corank(start, m->a, m->na, m->b, m->nb);                 \
+    size_t ie = name##_corank(end, m->a, m->na, m->b, m->nb);                  \
+    name(m->dest + start, m->a + i, ie - i, m->b + (start - i),                \
+         (end - ie) - (start - i));                                            \
+  }                                                                            \
+                                                                               \
+  void name##_parallel(type *dest, const type *a, size_t na, const type *b,    \
+                       size_t nb, int num_threads) {                           \
+    if (num_threads <= 1 || na + nb <= AC_PARALLEL_CHUNK) {                    \
+      name(dest, a, na, b, nb);                                                \
+      return;                                                                  \
+    }                                                                          \
+    name##_parallel_t m;                                                       \
+    m.dest = dest;                                                             \
+    m.a = a;                                                                   \
+    m.na = na;                                                                 \
+    m.b = b;                                                                   \
+    m.nb = nb;                                                                 \
+    ac_parallel_for(na + nb, AC_PARALLEL_CHUNK, num_threads,                   \
+                    name##_parallel_work, &m);                                 \
+  }                                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    type *dest;                                                                \
+    const type **runs;                                                         \
+    size_t num_runs;                                                           \
+    /* piece p is runs[r] + splits[p * num_runs + r] up to the next piece's    \
+       split, dest_offsets[p] is where it goes */                              \
+    size_t *splits;                                                            \
+    size_t *dest_offsets;                                                      \
+  } name##_k_parallel_t;                                                       \
+                                                                               \
+  static void name##_k_parallel_work(void *arg, size_t chunk, size_t start,    \
+                                     size_t end) {                             \
+    name##_k_parallel_t *m = (name##_k_parallel_t *)arg;                       \
+    for (size_t p = start; p < end; p++) {                                     \
+      size_t *from = m->splits + p * m->num_runs;                              \
+      name##_k_range(m->dest + m->dest_offsets[p], m->runs, from,              \
+                     from + m->num_runs, m->num_runs);                         \
+    }                                                                          \
+    (void)chunk;                                                               \
+  }                                                                            \
+                                                                               \
+  /* the first element of run which isn't less than key */                     \
+  static size_t name##_lower_bound(const type *run, size_t n,                  \
+                                   const type *key) {                          \
+    size_t lo = 0, hi = n;                                                     \
+    while (lo < hi) {                                                          \
+      size_t mid = lo + ((hi - lo) >> 1);                                      \
+      if (compare(run + mid, key) < 0)                                         \
+        lo = mid + 1;                                                          \
+      else                                                                     \
+        hi = mid;                                                              \
+    }                                                                          \
+    return lo;                                                                 \
+  }                                                                            \
+                                                                               \
+  void name##_k_parallel(type *dest, const type **runs, const size_t *lengths, \
+                         size_t num_runs, int num_threads) {                   \
+    size_t total = 0;                                                          \
+    for (size_t r = 0; r < num_runs; r++)                                      \
+      total += lengths[r];                                                     \
+    if (num_threads <= 1 || total <= AC_PARALLEL_CHUNK || num_runs < 2) {      \
+      name##_k(dest, runs, lengths, num_runs);                                 \
+      return;                                                                  \
+    }                                                                          \
+    /* a few pieces per thread so that uneven pieces balance out, with every   \
+       sample standing for the same number of elements */                      \
+    size_t num_pieces = (size_t)num_threads * 4;                               \
+    if (num_pieces > total / AC_PARALLEL_CHUNK)                                \
+      num_pieces = total / AC_PARALLEL_CHUNK;                                  \
+    size_t step = total / (num_pieces * 8);                                    \
+    if (!step)                                                                 \
+      step = 1;                                                                \
+    type *samples =                                                            \
+        (type *)ac_malloc(sizeof(type) * (total / step + num_runs));           \
+    size_t num_samples = 0;                                                    \
+    for (size_t r = 0; r < num_runs; r++)                                      \
+      for (size_t i = step >> 1; i < lengths[r]; i += step)                    \
+        samples[num_samples++] = runs[r][i];                                   \
+    name##_sort_samples(samples, num_samples);                                 \
+                                                                               \
+    name##_k_parallel_t m;                                                     \
+    m.dest = dest;                                                             \
+    m.runs = runs;                                                             \
+    m.num_runs = num_runs;                                                     \
+    m.splits = (size_t *)ac_malloc(sizeof(size_t) * (num_pieces + 1) *         \
+                                   (num_runs + 1));                            \
+    m.dest_offsets = m.splits + (num_pieces + 1) * num_runs;                   \
+    for (size_t p = 0; p <= num_pieces; p++) {                                 \
+      size_t *split = m.splits + p * num_runs;                                 \
+      const type *key = samples + (p * num_samples / num_pieces);              \
+      size_t offset = 0;                                                       \
+      for (size_t r = 0; r < num_runs; r++) {                                  \
+        if (p == 0)                                                            \
+          split[r] = 0;                                                        \
+        else if (p == num_pieces)                                              \
+          split[r] = lengths[r];                                               \
+        else                                                                   \
+          split[r] = name##_lower_bound(runs[r], lengths[r], key);             \
+        offset += split[r];                                                    \
+      }                                                                        \
+      m.dest_offsets[p] = offset;                                              \
+    }                                                                          \
+    ac_parallel_for(num_pieces, 1, num_threads, name##_k_parallel_work, &m);   \
+    ac_free(m.splits);                                                         \
+    ac_free(samples);                                                          \
+  }
@@ -0,0 +1,28 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+static inline uint64_t ac_packed_blob_append(ac_buffer_t *blob,
+                                             const void *data, size_t length) {
+  uint64_t r = ac_buffer_length(blob);
+  ac_buffer_append(blob, data, length);
+  ac_buffer_appendc(blob, 0);
+  return r;
+}
+
+static inline const char *ac_packed_string(const ac_packed_t *h,
+                                           uint64_t offset) {
+  return h->blob + offset;
+}
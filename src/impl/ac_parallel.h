@@ -0,0 +1,235 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* defines name##_reduce_chunk(p, ep) */
+#define _ac_parallel_reduce_chunk_m(name, type, identity, combine)             \
+  static inline type name##_reduce_chunk(const type *p, const type *ep) {      \
+    type r = identity;                                                         \
+    for (; p < ep; p++)                                                        \
+      r = combine(r, *p);                                                      \
+    return r;                                                                  \
+  }
+
+#define ac_reduce_m(name, type, identity, combine)                             \
+  _ac_parallel_reduce_chunk_m(name, type, identity, combine)                   \
+                                                                               \
+  typedef struct {                                                             \
+    const type *base;                                                          \
+    type *totals;                                                              \
+  } name##_reduce_t;                                                           \
+                                                                               \
+  static void name##_reduce_work(void *arg, size_t chunk, size_t start,        \
+                                 size_t end) {                                 \
+    name##_reduce_t *r = (name##_reduce_t *)arg;                               \
+    r->totals[chunk] = name##_reduce_chunk(r->base + start, r->base + end);    \
+  }                                                                            \
+                                                                               \
+  type name(const type *base, size_t num_elements, int num_threads) {          \
+    if (num_threads <= 1 || num_elements <= AC_PARALLEL_CHUNK)                 \
+      return name##_reduce_chunk(base, base + num_elements);                   \
+    size_t num_chunks = ac_parallel_chunks(num_elements, AC_PARALLEL_CHUNK);   \
+    name##_reduce_t r;                                                         \
+    r.base = base;                                                             \
+    r.totals = (type *)ac_malloc(sizeof(type) * num_chunks);                   \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_reduce_work, &r);                                   \
+    type res = r.totals[0];                                                    \
+    for (size_t i = 1; i < num_chunks; i++)                                    \
+      res = combine(res, r.totals[i]);                                         \
+    ac_free(r.totals);                                                         \
+    return res;                                                                \
+  }
+
+#define ac_scan_m(name, type, identity, combine)                               \
+  _ac_parallel_reduce_chunk_m(name, type, identity, combine)                   \
+                                                                               \
+  static inline void name##_scan_chunk(type *dest, const type *p,              \
+                                       const type *ep, type acc,               \
+                                       bool exclusive) {                       \
+    if (exclusive) {                                                           \
+      for (; p < ep; p++, dest++) {                                            \
+        type v = *p;                                                           \
+        *dest = acc;                                                           \
+        acc = combine(acc, v);                                                 \
+      }                                                                        \
+    } else {                                                                   \
+      for (; p < ep; p++, dest++) {                                            \
+        acc = combine(acc, *p);                                                \
+        *dest = acc;                                                           \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    type *dest;                                                                \
+    const type *base;                                                          \
+    type *totals;                                                              \
+    bool exclusive;                                                            \
+  } name##_scan_t;                                                             \
+                                                                               \
+  static void name##_scan_reduce_work(void *arg, size_t chunk, size_t start,   \
+                                      size_t end) {                            \
+    name##_scan_t *s = (name##_scan_t *)arg;                                   \
+    s->totals[chunk] = name##_reduce_chunk(s->base + start, s->base + end);    \
+  }                                                                            \
+                                                                               \
+  static void name##_scan_work(void *arg, size_t chunk, size_t start,          \
+                               size_t end) {                                   \
+    name##_scan_t *s = (name##_scan_t *)arg;                                   \
+    name##_scan_chunk(s->dest + start, s->base + start, s->base + end,         \
+                      s->totals[chunk], s->exclusive);                         \
+  }                                                                            \
+                                                                               \
+  static void name##_scan(type *dest, const type *base, size_t num_elements,   \
+                          int num_threads, bool exclusive) {                   \
+    if (num_threads <= 1 || num_elements <= AC_PARALLEL_CHUNK) {               \
+      name##_scan_chunk(dest, base, base + num_elements, identity, exclusive); \
+      return;                                                                  \
+    }                                                                          \
+    size_t num_chunks = ac_parallel_chunks(num_elements, AC_PARALLEL_CHUNK);   \
+    name##_scan_t s;                                                           \
+    s.dest = dest;                                                             \
+    s.base = base;                                                             \
+    s.exclusive = exclusive;                                                   \
+    s.totals = (type *)ac_malloc(sizeof(type) * num_chunks);                   \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_scan_reduce_work, &s);                              \
+    /* each chunk's total becomes the offset it starts from */                 \
+    type acc = identity;                                                       \
+    for (size_t i = 0; i < num_chunks; i++) {                                  \
+      type v = s.totals[i];                                                    \
+      s.totals[i] = acc;                                                       \
+      acc = combine(acc, v);                                                   \
+    }                                                                          \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_scan_work, &s);                                     \
+    ac_free(s.totals);                                                         \
+  }                                                                            \
+                                                                               \
+  void name(type *dest, const type *base, size_t num_elements,                 \
+            int num_threads) {                                                 \
+    name##_scan(dest, base, num_elements, num_threads, false);                 \
+  }                                                                            \
+                                                                               \
+  void name##_exclusive(type *dest, const type *base, size_t num_elements,     \
+                        int num_threads) {                                     \
+    name##_scan(dest, base, num_elements, num_threads, true);                  \
+  }
+
+#define ac_for_each_parallel_m(name, type, fn)                                 \
+  typedef struct {                                                             \
+    type *base;                                                                \
+    void *arg;                                                                 \
+  } name##_each_t;                                                             \
+                                                                               \
+  static void name##_each_work(void *arg, size_t chunk, size_t start,          \
+                               size_t end) {                                   \
+    (void)chunk;                                                               \
+    name##_each_t *e = (name##_each_t *)arg;                                   \
+    type *p = e->base + start;                                                 \
+    type *ep = e->base + end;                                                  \
+    for (; p < ep; p++)                                                        \
+      fn(p, e->arg);                                                           \
+  }                                                                            \
+                                                                               \
+  void name(type *base, size_t num_elements, void *arg, int num_threads) {     \
+    name##_each_t e;                                                           \
+    e.base = base;                                                             \
+    e.arg = arg;                                                               \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_each_work, &e);                                     \
+  }
+
+#define ac_partition_parallel_m(name, type, pred)                              \
+  typedef struct {                                                             \
+    type *base;                                                                \
+    type *tmp;                                                                 \
+    void *arg;                                                                 \
+    /* pred of each element, so it is only called once */                      \
+    uint8_t *flags;                                                            \
+    /* the number of true elements in each chunk, then where the chunk's       \
+       true elements go */                                                     \
+    size_t *counts;                                                            \
+    size_t num_true;                                                           \
+  } name##_partition_t;                                                        \
+                                                                               \
+  static void name##_partition_count(void *arg, size_t chunk, size_t start,    \
+                                     size_t end) {                             \
+    name##_partition_t *h = (name##_partition_t *)arg;                         \
+    size_t n = 0;                                                              \
+    for (size_t i = start; i < end; i++) {                                     \
+      uint8_t f = pred(h->base + i, h->arg) ? 1 : 0;                           \
+      h->flags[i] = f;                                                         \
+      n += f;                                                                  \
+    }                                                                          \
+    h->counts[chunk] = n;                                                      \
+  }                                                                            \
+                                                                               \
+  static void name##_partition_copy(void *arg, size_t chunk, size_t start,     \
+                                    size_t end) {                              \
+    name##_partition_t *h = (name##_partition_t *)arg;                         \
+    type *t = h->tmp + h->counts[chunk];                                       \
+    type *f = h->tmp + h->num_true + (start - h->counts[chunk]);               \
+    for (size_t i = start; i < end; i++) {                                     \
+      if (h->flags[i])                                                         \
+        *t++ = h->base[i];                                                     \
+      else                                                                     \
+        *f++ = h->base[i];                                                     \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_partition_back(void *arg, size_t chunk, size_t start,     \
+                                    size_t end) {                              \
+    (void)chunk;                                                               \
+    name##_partition_t *h = (name##_partition_t *)arg;                         \
+    memcpy(h->base + start, h->tmp + start, (end - start) * sizeof(type));     \
+  }                                                                            \
+                                                                               \
+  size_t name(type *base, size_t num_elements, void *arg, int num_threads) {   \
+    if (!num_elements)                                                         \
+      return 0;                                                                \
+    size_t num_chunks = ac_parallel_chunks(num_elements, AC_PARALLEL_CHUNK);   \
+    name##_partition_t h;                                                      \
+    h.base = base;                                                             \
+    h.arg = arg;                                                               \
+    h.tmp = (type *)ac_malloc(sizeof(type) * num_elements);                    \
+    h.flags = (uint8_t *)ac_malloc(num_elements);                              \
+    h.counts = (size_t *)ac_malloc(sizeof(size_t) * num_chunks);               \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_partition_count, &h);                               \
+    /* the true elements of chunk i go after those of the chunks before it,    \
+       the false elements of a chunk go after num_true plus the false          \
+       elements before it (its start less the true elements before it) */      \
+    size_t acc = 0;                                                            \
+    for (size_t i = 0; i < num_chunks; i++) {                                  \
+      size_t n = h.counts[i];                                                  \
+      h.counts[i] = acc;                                                       \
+      acc += n;                                                                \
+    }                                                                          \
+    h.num_true = acc;                                                          \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_partition_copy, &h);                                \
+    ac_parallel_for(num_elements, AC_PARALLEL_CHUNK, num_threads,              \
+                    name##_partition_back, &h);                                \
+    ac_free(h.counts);                                                         \
+    ac_free(h.flags);                                                          \
+    ac_free(h.tmp);                                                            \
+    return h.num_true;                                                         \
+  }
@@ -23,6 +23,8 @@ limitations under the License.
 
 /* used internally */
 void *_ac_pool_alloc_grow(ac_pool_t *h, size_t len);
+void *_ac_pool_aligned_alloc_grow(ac_pool_t *h, size_t len, size_t align);
+void _ac_pool_pop(ac_pool_t *h, ac_pool_checkpoint_t *cp);
 
 typedef struct ac_pool_node_s {
   /* The ac_pool_node_s includes a block of memory just after it.  endp
@@ -32,8 +34,18 @@ typedef struct ac_pool_node_s {
 
   /* this will be NULL if it is the first block. */
   struct ac_pool_node_s *prev;
+
+  /* where allocations ended when the pool moved on to the next block */
+  char *usedp;
 } ac_pool_node_t;
 
+/* see ac_pool_freeze */
+typedef struct {
+  char *old_start;
+  char *old_end;
+  char *new_start;
+} ac_pool_relocation_t;
+
 struct ac_pool_s {
 #ifdef _AC_DEBUG_MEMORY_
   ac_allocator_dump_t dump;
@@ -60,16 +72,45 @@ struct ac_pool_s {
     later be modified. */
   size_t minimum_growth_size;
 
+  /* the size of the next block, this is the minimum_growth_size unless
+     geometric growth or growth feedback are on.  max_growth_size is 0 if
+     geometric growth is off. */
+  size_t growth_size;
+  size_t max_growth_size;
+  bool growth_feedback;
+
   /* the size doesn't consider the bytes that are used in the current block */
   size_t size;
 
+  /* see ac_pool_stats_t, peak_size is only updated as the pool grows */
+  size_t num_blocks;
+  size_t wasted;
+  size_t grow_count;
+  size_t clear_count;
+  size_t peak_size;
+
   /* the total number of bytes allocated by the pool object */
   size_t used;
+
+  /* if not NULL, extra blocks are taken from and returned to the cache */
+  ac_pool_cache_t *cache;
+
+  /* true if the blocks were mapped by ac_pool_huge_init */
+  bool huge;
+
+  /* true if every allocation is in the current block since ac_pool_freeze,
+     relocations maps the old blocks to the new one */
+  bool frozen;
+  ac_pool_relocation_t *relocations;
+  size_t num_relocations;
+
+  /* NULL unless ac_pool_set_limits or ac_pool_set_shared_limit was called */
+  struct ac_pool_limits_s *limits;
 };
 
 static inline void *ac_pool_ualloc(ac_pool_t *h, size_t len) {
   char *r = h->curp;
-  if (r + len < h->current->endp) {
+  if (ac_likely(r + len < h->current->endp)) {
     h->curp = r + len;
 #ifdef _AC_DEBUG_MEMORY_
     h->cur_size += len;
@@ -85,7 +126,7 @@ static inline void *ac_pool_alloc(ac_pool_t *h, size_t len) {
   char *r =
       h->curp + ((sizeof(size_t) - ((size_t)(h->curp) & (sizeof(size_t) - 1))) &
                  (sizeof(size_t) - 1));
-  if (r + len < h->current->endp) {
+  if (ac_likely(r + len < h->current->endp)) {
     h->curp = r + len;
 #ifdef _AC_DEBUG_MEMORY_
     h->cur_size += len;
@@ -97,11 +138,90 @@ static inline void *ac_pool_alloc(ac_pool_t *h, size_t len) {
   return _ac_pool_alloc_grow(h, len);
 }
 
+static inline void *ac_pool_alloc_n(ac_pool_t *h, size_t num, size_t size) {
+  size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  if (ac_unlikely(size && num > (size_t)-1 / size))
+    abort();
+  return ac_pool_alloc(h, num * size);
+}
+
+static inline void *ac_pool_aligned_alloc(ac_pool_t *h, size_t len,
+                                          size_t align) {
+  char *r = h->curp + ((align - ((size_t)(h->curp) & (align - 1))) &
+                       (align - 1));
+  if (ac_likely(r + len < h->current->endp)) {
+    h->curp = r + len;
+#ifdef _AC_DEBUG_MEMORY_
+    h->cur_size += len;
+    if (h->cur_size > h->max_size)
+      h->max_size = h->cur_size;
+#endif
+    return r;
+  }
+  return _ac_pool_aligned_alloc_grow(h, len, align);
+}
+
+static inline bool ac_pool_extend(ac_pool_t *h, void *p, size_t len,
+                                  size_t new_len) {
+  char *r = (char *)p;
+  if (r + len != h->curp || r + new_len >= h->current->endp)
+    return false;
+  h->curp = r + new_len;
+#ifdef _AC_DEBUG_MEMORY_
+  h->cur_size += new_len - len;
+  if (h->cur_size > h->max_size)
+    h->max_size = h->cur_size;
+#endif
+  return true;
+}
+
+static inline void ac_pool_push(ac_pool_t *h, ac_pool_checkpoint_t *cp) {
+  cp->current = h->current;
+  cp->curp = h->curp;
+  cp->size = h->size;
+  cp->wasted = h->wasted;
+  cp->num_blocks = h->num_blocks;
+  cp->peak_size = h->peak_size;
+#ifdef _AC_DEBUG_MEMORY_
+  cp->cur_size = h->cur_size;
+#endif
+}
+
+static inline void ac_pool_pop(ac_pool_t *h, ac_pool_checkpoint_t *cp) {
+  if (h->current != cp->current) {
+    _ac_pool_pop(h, cp);
+    return;
+  }
+  h->curp = cp->curp;
+  h->peak_size = cp->peak_size;
+#ifdef _AC_DEBUG_MEMORY_
+  h->cur_size = cp->cur_size;
+#endif
+}
+
+static inline size_t ac_pool_offset(ac_pool_t *h, const void *p) {
+  return (const char *)p - (const char *)(h->current + 1);
+}
+
+static inline void *ac_pool_image_relocate(ac_pool_image_t *img,
+                                           const void *saved) {
+  const char *p = (const char *)saved;
+  if (img->fixed || p < img->saved_base ||
+      p > img->saved_base + img->length)
+    return (void *)saved;
+  return img->base + (p - img->saved_base);
+}
+
+static inline void *ac_pool_image_pointer(ac_pool_image_t *img,
+                                          size_t offset) {
+  return img->base + offset;
+}
+
 static inline void *ac_pool_calloc(ac_pool_t *h, size_t len) {
   /* calloc will simply call the pool_alloc function and then zero the memory.
    */
   void *dest = ac_pool_alloc(h, len);
-  if (len)
+  if (dest && len)
     memset(dest, 0, len);
   return dest;
 }
@@ -113,7 +233,7 @@ static inline void *ac_pool_udup(ac_pool_t *h, const void *data,
     of data. Because the data could need aligned, we will use ac_pool_alloc
     instead of ac_pool_ualloc */
   char *dest = (char *)ac_pool_ualloc(h, len);
-  if (len)
+  if (dest && len)
     memcpy(dest, data, len);
   return dest;
 }
@@ -129,10 +249,14 @@ static inline char *ac_pool_strndup(ac_pool_t *h, const char *p,
                                       size_t length) {
   /* strdup will simply allocate enough bytes to hold the duplicated string,
     copy the string, and return the newly allocated string. */
-  size_t len = strlen(p);
-  if (len > length)
-    len = length;
-  return (char *)ac_pool_udup(h, p, len + 1);
+  const char *ep = (const char *)memchr(p, 0, length);
+  size_t len = ep ? (size_t)(ep - p) : length;
+  char *dest = (char *)ac_pool_ualloc(h, len + 1);
+  if (!dest)
+    return NULL;
+  memcpy(dest, p, len);
+  dest[len] = 0;
+  return dest;
 }
 
 static inline void *ac_pool_dup(ac_pool_t *h, const void *data,
@@ -142,7 +266,7 @@ static inline void *ac_pool_dup(ac_pool_t *h, const void *data,
     of data. Because the data could need aligned, we will use ac_pool_alloc
     instead of ac_pool_ualloc */
   char *dest = (char *)ac_pool_alloc(h, len);
-  if (len)
+  if (dest && len)
     memcpy(dest, data, len);
   return dest;
 }
@@ -154,3 +278,41 @@ static inline char *ac_pool_strdupf(ac_pool_t *pool, const char *fmt, ...) {
   va_end(args);
   return r;
 }
+
+static inline void ac_pool_freelist_init(ac_pool_freelist_t *fl,
+                                         ac_pool_t *pool, size_t object_size) {
+  if (object_size < sizeof(void *))
+    object_size = sizeof(void *);
+  fl->pool = pool;
+  fl->object_size = (object_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  fl->head = NULL;
+  fl->num_free = 0;
+}
+
+static inline void *ac_pool_freelist_alloc(ac_pool_freelist_t *fl) {
+  void *r = fl->head;
+  if (r) {
+    fl->head = *(void **)r;
+    fl->num_free--;
+    return r;
+  }
+  return ac_pool_alloc(fl->pool, fl->object_size);
+}
+
+static inline void *ac_pool_freelist_calloc(ac_pool_freelist_t *fl) {
+  void *r = ac_pool_freelist_alloc(fl);
+  if (r)
+    memset(r, 0, fl->object_size);
+  return r;
+}
+
+static inline void ac_pool_freelist_free(ac_pool_freelist_t *fl, void *p) {
+  *(void **)p = fl->head;
+  fl->head = p;
+  fl->num_free++;
+}
+
+static inline void ac_pool_freelist_clear(ac_pool_freelist_t *fl) {
+  fl->head = NULL;
+  fl->num_free = 0;
+}
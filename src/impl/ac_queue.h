@@ -0,0 +1,231 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+static inline bool ac_queue_spsc_push(ac_queue_spsc_t *q, void *object) {
+  size_t tail = q->tail;
+  if (tail - q->cached_head > q->mask) {
+    q->cached_head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail - q->cached_head > q->mask)
+      return false;
+  }
+  q->cells[tail & q->mask] = object;
+  __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static inline void *ac_queue_spsc_pop(ac_queue_spsc_t *q) {
+  size_t head = q->head;
+  if (head == q->cached_tail) {
+    q->cached_tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head == q->cached_tail)
+      return NULL;
+  }
+  void *object = q->cells[head & q->mask];
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+  return object;
+}
+
+static inline size_t ac_queue_spsc_size(ac_queue_spsc_t *q) {
+  size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+/* a cell is ready to be written at pos when seq == pos and ready to be read
+   when seq == pos + 1, so producers and consumers only contend on their own
+   position counter */
+static inline bool ac_queue_mpmc_push(ac_queue_mpmc_t *q, void *object) {
+  size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    ac_queue_cell_t *cell = q->cells + (pos & q->mask);
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->object = object;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0)
+      return false;
+    else
+      pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void *ac_queue_mpmc_pop(ac_queue_mpmc_t *q) {
+  size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    ac_queue_cell_t *cell = q->cells + (pos & q->mask);
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        void *object = cell->object;
+        __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        return object;
+      }
+    } else if (diff < 0)
+      return NULL;
+    else
+      pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void ac_queue_mpsc_init(ac_queue_mpsc_t *q) {
+  q->stub.next = NULL;
+  q->head = &q->stub;
+  q->tail = &q->stub;
+}
+
+static inline void ac_queue_mpsc_push(ac_queue_mpsc_t *q, ac_queue_node_t *n) {
+  __atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+  ac_queue_node_t *prev = __atomic_exchange_n(&q->head, n, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/* the stub keeps the queue from ever being empty, so producers never touch
+   tail.  The stub is skipped when it's at the tail and pushed again when
+   the last node is popped. */
+static inline ac_queue_node_t *ac_queue_mpsc_pop(ac_queue_mpsc_t *q) {
+  ac_queue_node_t *tail = q->tail;
+  ac_queue_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (tail == &q->stub) {
+    if (!next)
+      return NULL;
+    q->tail = next;
+    tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  /* tail is the last node unless a push is in progress */
+  if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+    return NULL;
+  ac_queue_mpsc_push(q, &q->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+static inline bool ac_queue_mpsc_empty(ac_queue_mpsc_t *q) {
+  return q->tail == &q->stub &&
+         __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == &q->stub;
+}
+
+#define _AC_STACK_POINTER_MASK                                                 \
+  ((((ac_stack_top_t)1) << AC_STACK_POINTER_BITS) - 1)
+
+static inline ac_stack_node_t *_ac_stack_pointer(ac_stack_top_t top) {
+  return (ac_stack_node_t *)(uintptr_t)(top & _AC_STACK_POINTER_MASK);
+}
+
+/* n with the tag of top (for push) */
+static inline ac_stack_top_t _ac_stack_same_tag(ac_stack_node_t *n,
+                                                ac_stack_top_t top) {
+  return (top & ~_AC_STACK_POINTER_MASK) | (uintptr_t)n;
+}
+
+/* n with the tag of top plus one (for pop) */
+static inline ac_stack_top_t _ac_stack_next_tag(ac_stack_node_t *n,
+                                                ac_stack_top_t top) {
+  return ((((top >> AC_STACK_POINTER_BITS) + 1) << AC_STACK_POINTER_BITS) &
+          ~_AC_STACK_POINTER_MASK) |
+         (uintptr_t)n;
+}
+
+#if AC_STACK_POINTER_BITS == 64
+/* gcc only inlines the 16 byte compare and swap of the __sync builtins, so
+   top is read as two halves.  A torn read just makes the compare and swap
+   fail and return the current top. */
+static inline ac_stack_top_t _ac_stack_load(ac_stack_t *s) {
+  union {
+    ac_stack_top_t top;
+    uint64_t half[2];
+  } u;
+  uint64_t *p = (uint64_t *)&s->top;
+  u.half[0] = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  u.half[1] = __atomic_load_n(p + 1, __ATOMIC_ACQUIRE);
+  return u.top;
+}
+
+static inline bool _ac_stack_cas(ac_stack_t *s, ac_stack_top_t *expected,
+                                 ac_stack_top_t desired) {
+  ac_stack_top_t prev = __sync_val_compare_and_swap(&s->top, *expected,
+                                                    desired);
+  if (prev == *expected)
+    return true;
+  *expected = prev;
+  return false;
+}
+#else
+static inline ac_stack_top_t _ac_stack_load(ac_stack_t *s) {
+  return __atomic_load_n(&s->top, __ATOMIC_ACQUIRE);
+}
+
+static inline bool _ac_stack_cas(ac_stack_t *s, ac_stack_top_t *expected,
+                                 ac_stack_top_t desired) {
+  return __atomic_compare_exchange_n(&s->top, expected, desired, true,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+static inline void ac_stack_init(ac_stack_t *s) { s->top = 0; }
+
+static inline void ac_stack_push_list(ac_stack_t *s, ac_stack_node_t *first,
+                                      ac_stack_node_t *last) {
+  ac_stack_top_t top = _ac_stack_load(s);
+  do {
+    __atomic_store_n(&last->next, _ac_stack_pointer(top), __ATOMIC_RELAXED);
+  } while (!_ac_stack_cas(s, &top, _ac_stack_same_tag(first, top)));
+}
+
+static inline void ac_stack_push(ac_stack_t *s, ac_stack_node_t *n) {
+  ac_stack_push_list(s, n, n);
+}
+
+static inline ac_stack_node_t *ac_stack_pop(ac_stack_t *s) {
+  ac_stack_top_t top = _ac_stack_load(s);
+  while (true) {
+    ac_stack_node_t *n = _ac_stack_pointer(top);
+    if (!n)
+      return NULL;
+    /* n may have been popped (and even pushed again) by now, the tag makes
+       the compare and swap fail if so */
+    ac_stack_node_t *next = __atomic_load_n(&n->next, __ATOMIC_RELAXED);
+    if (_ac_stack_cas(s, &top, _ac_stack_next_tag(next, top)))
+      return n;
+  }
+}
+
+static inline ac_stack_node_t *ac_stack_pop_all(ac_stack_t *s) {
+  ac_stack_top_t top = _ac_stack_load(s);
+  while (_ac_stack_pointer(top)) {
+    if (_ac_stack_cas(s, &top, _ac_stack_next_tag(NULL, top)))
+      return _ac_stack_pointer(top);
+  }
+  return NULL;
+}
+
+static inline ac_stack_node_t *ac_stack_peek(ac_stack_t *s) {
+  return _ac_stack_pointer(_ac_stack_load(s));
+}
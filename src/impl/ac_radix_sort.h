@@ -0,0 +1,210 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t ac_radix_int32_key(int32_t v) {
+  return (uint32_t)v ^ 0x80000000U;
+}
+
+static inline uint64_t ac_radix_int64_key(int64_t v) {
+  return (uint64_t)v ^ 0x8000000000000000ULL;
+}
+
+/* negative values have every bit flipped, positive values only the sign bit
+   so that -0.0 orders just before 0.0 */
+static inline uint32_t ac_radix_float_key(float v) {
+  uint32_t u;
+  memcpy(&u, &v, sizeof(u));
+  return u ^ ((u >> 31) ? 0xFFFFFFFFU : 0x80000000U);
+}
+
+static inline uint64_t ac_radix_double_key(double v) {
+  uint64_t u;
+  memcpy(&u, &v, sizeof(u));
+  return u ^ ((u >> 63) ? 0xFFFFFFFFFFFFFFFFULL : 0x8000000000000000ULL);
+}
+
+typedef struct {
+  void *base;
+  size_t num_elements;
+  size_t depth;
+} ac_radix_sort_range_t;
+
+#define ac_radix_sort_def(name, datatype)                                      \
+  void name(datatype *base, size_t num_elements, ac_pool_t *pool);
+
+#define ac_radix_sort_bytes_def(name, datatype)                                \
+  void name(datatype *base, size_t num_elements, ac_pool_t *pool);
+
+#define _ac_radix_sort_tmp(tmp, datatype, num_elements, pool)                  \
+  datatype *tmp = (datatype *)((pool) ? ac_pool_alloc(pool, sizeof(datatype) * \
+                                                            (num_elements))    \
+                                      : ac_malloc(sizeof(datatype) *           \
+                                                  (num_elements)));            \
+  if (!tmp)                                                                    \
+    abort()
+
+#define ac_radix_sort_m(name, datatype, key)                                   \
+  static inline int name##_cmp(datatype *a, datatype *b) {                     \
+    uint64_t ka = key(a);                                                      \
+    uint64_t kb = key(b);                                                      \
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);                                   \
+  }                                                                            \
+                                                                               \
+  static ac_sort_m(name##_small, datatype, name##_cmp)                         \
+                                                                               \
+  void name(datatype *base, size_t num_elements, ac_pool_t *pool) {            \
+    if (num_elements <= AC_RADIX_SORT_CUTOFF) {                                \
+      name##_small(base, num_elements);                                        \
+      return;                                                                  \
+    }                                                                          \
+    const size_t passes = sizeof(key(base));                                   \
+    size_t counts[sizeof(key(base))][256];                                     \
+    memset(counts, 0, sizeof(counts));                                         \
+    datatype *p = base;                                                        \
+    datatype *ep = base + num_elements;                                        \
+    while (p < ep) {                                                           \
+      uint64_t k = key(p);                                                     \
+      for (size_t i = 0; i < passes; i++)                                      \
+        counts[i][(uint8_t)(k >> (i << 3))]++;                                 \
+      p++;                                                                     \
+    }                                                                          \
+                                                                               \
+    _ac_radix_sort_tmp(tmp, datatype, num_elements, pool);                     \
+    datatype *src = base;                                                      \
+    datatype *dest = tmp;                                                      \
+    for (size_t i = 0; i < passes; i++) {                                      \
+      size_t *c = counts[i];                                                   \
+      size_t shift = i << 3;                                                   \
+      if (c[(uint8_t)((uint64_t)key(src) >> shift)] == num_elements)           \
+        continue;                                                              \
+      size_t offs = 0;                                                         \
+      for (size_t j = 0; j < 256; j++) {                                       \
+        size_t n = c[j];                                                       \
+        c[j] = offs;                                                           \
+        offs += n;                                                             \
+      }                                                                        \
+      p = src;                                                                 \
+      ep = src + num_elements;                                                 \
+      while (p < ep) {                                                         \
+        dest[c[(uint8_t)((uint64_t)key(p) >> shift)]++] = *p;                  \
+        p++;                                                                   \
+      }                                                                        \
+      p = src;                                                                 \
+      src = dest;                                                              \
+      dest = p;                                                                \
+    }                                                                          \
+    if (src != base)                                                           \
+      memcpy(base, src, sizeof(datatype) * num_elements);                      \
+    if (!pool)                                                                 \
+      ac_free(tmp);                                                            \
+  }
+
+#define ac_radix_sort_bytes_m(name, datatype, key)                             \
+  /* arg points to the depth where the keys start to differ */                 \
+  static inline int name##_cmp(datatype *a, datatype *b, void *arg) {          \
+    size_t depth = *(size_t *)arg;                                             \
+    size_t alen, blen;                                                         \
+    const uint8_t *ak = (const uint8_t *)key(a, &alen);                        \
+    const uint8_t *bk = (const uint8_t *)key(b, &blen);                        \
+    int n = memcmp(ak + depth, bk + depth,                                     \
+                   (alen < blen ? alen : blen) - depth);                       \
+    if (n)                                                                     \
+      return n;                                                                \
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);                           \
+  }                                                                            \
+                                                                               \
+  static ac_sort_arg_m(name##_small, datatype, name##_cmp)                     \
+                                                                               \
+  static inline size_t name##_digit(datatype *el, size_t depth) {              \
+    size_t len;                                                                \
+    const uint8_t *k = (const uint8_t *)key(el, &len);                         \
+    return depth < len ? k[depth] + 1 : 0;                                     \
+  }                                                                            \
+                                                                               \
+  void name(datatype *base, size_t num_elements, ac_pool_t *pool) {            \
+    size_t depth = 0;                                                          \
+    if (num_elements <= AC_RADIX_SORT_CUTOFF) {                                \
+      name##_small(base, num_elements, &depth);                                \
+      return;                                                                  \
+    }                                                                          \
+    _ac_radix_sort_tmp(tmp, datatype, num_elements, pool);                     \
+    size_t stack_size = 64;                                                    \
+    ac_radix_sort_range_t *stack = (ac_radix_sort_range_t *)ac_malloc(         \
+        sizeof(ac_radix_sort_range_t) * stack_size);                           \
+    if (!stack)                                                                \
+      abort();                                                                 \
+    size_t top = 0;                                                            \
+    size_t counts[257];                                                        \
+    datatype *p, *ep;                                                          \
+    while (true) {                                                             \
+      if (num_elements <= AC_RADIX_SORT_CUTOFF) {                              \
+        name##_small(base, num_elements, &depth);                              \
+      } else {                                                                 \
+        memset(counts, 0, sizeof(counts));                                     \
+        for (p = base, ep = base + num_elements; p < ep; p++)                  \
+          counts[name##_digit(p, depth)]++;                                    \
+        size_t first = name##_digit(base, depth);                              \
+        if (counts[first] == num_elements) {                                   \
+          /* a common prefix, there is nothing to move */                      \
+          if (first) {                                                         \
+            depth++;                                                           \
+            continue;                                                          \
+          }                                                                    \
+        } else {                                                               \
+          size_t offs = 0;                                                     \
+          for (size_t j = 0; j < 257; j++) {                                   \
+            size_t n = counts[j];                                              \
+            counts[j] = offs;                                                  \
+            offs += n;                                                         \
+          }                                                                    \
+          for (p = base; p < ep; p++)                                          \
+            tmp[counts[name##_digit(p, depth)]++] = *p;                        \
+          memcpy(base, tmp, sizeof(datatype) * num_elements);                  \
+          if (top + 256 > stack_size) {                                        \
+            stack_size = (top + 256) << 1;                                     \
+            stack = (ac_radix_sort_range_t *)ac_realloc(                       \
+                stack, sizeof(ac_radix_sort_range_t) * stack_size);            \
+            if (!stack)                                                        \
+              abort();                                                         \
+          }                                                                    \
+          /* bucket 0 holds the keys which ended at depth, they are equal */   \
+          offs = counts[0];                                                    \
+          for (size_t j = 1; j < 257; j++) {                                   \
+            size_t n = counts[j] - offs;                                       \
+            if (n > 1) {                                                       \
+              stack[top].base = base + offs;                                   \
+              stack[top].num_elements = n;                                     \
+              stack[top].depth = depth + 1;                                    \
+              top++;                                                           \
+            }                                                                  \
+            offs = counts[j];                                                  \
+          }                                                                    \
+        }                                                                      \
+      }                                                                        \
+      if (!top)                                                                \
+        break;                                                                 \
+      top--;                                                                   \
+      base = (datatype *)stack[top].base;                                      \
+      num_elements = stack[top].num_elements;                                  \
+      depth = stack[top].depth;                                                \
+    }                                                                          \
+    ac_free(stack);                                                            \
+    if (!pool)                                                                 \
+      ac_free(tmp);                                                            \
+  }
@@ -0,0 +1,42 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+/* moves *full_at forward by tokens unless that would take more than the
+   bucket holds */
+static inline bool ac_ratelimit_take_at(uint64_t *full_at, uint64_t interval,
+                                        uint64_t tolerance, uint64_t now,
+                                        uint32_t tokens) {
+  uint64_t cost;
+  if (__builtin_mul_overflow(interval, (uint64_t)tokens, &cost) ||
+      cost > tolerance)
+    return false;
+  uint64_t cur = __atomic_load_n(full_at, __ATOMIC_RELAXED);
+  while (true) {
+    uint64_t next = (cur > now ? cur : now) + cost;
+    if (next - now > tolerance)
+      return false;
+    if (__atomic_compare_exchange_n(full_at, &cur, next, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return true;
+  }
+}
+
+static inline bool ac_ratelimit_bucket_take(ac_ratelimit_bucket_t *b,
+                                            uint32_t tokens) {
+  return ac_ratelimit_take_at(&b->full_at, b->interval, b->tolerance,
+                              ac_timer_now_ns(), tokens);
+}
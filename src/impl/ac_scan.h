@@ -0,0 +1,195 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline int _ac_scan_lower(int c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline bool ac_scan_equal_nocase(const char *a, const char *b,
+                                        size_t length) {
+  const char *ep = a + length;
+#if defined(__SSE2__)
+  /* bytes above 127 are negative, so they are never seen as upper case */
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  for (; ep - a >= 16; a += 16, b += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)a);
+    __m128i vb = _mm_loadu_si128((const __m128i *)b);
+    __m128i ua = _mm_and_si128(_mm_cmpgt_epi8(va, before_a),
+                               _mm_cmplt_epi8(va, after_z));
+    __m128i ub = _mm_and_si128(_mm_cmpgt_epi8(vb, before_a),
+                               _mm_cmplt_epi8(vb, after_z));
+    va = _mm_or_si128(va, _mm_and_si128(ua, case_bit));
+    vb = _mm_or_si128(vb, _mm_and_si128(ub, case_bit));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+      return false;
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t big_a = vdupq_n_u8('A');
+  const uint8x16_t big_z = vdupq_n_u8('Z');
+  const uint8x16_t case_bit = vdupq_n_u8(0x20);
+  for (; ep - a >= 16; a += 16, b += 16) {
+    uint8x16_t va = vld1q_u8((const uint8_t *)a);
+    uint8x16_t vb = vld1q_u8((const uint8_t *)b);
+    va = vorrq_u8(va, vandq_u8(vandq_u8(vcgeq_u8(va, big_a),
+                                        vcleq_u8(va, big_z)),
+                               case_bit));
+    vb = vorrq_u8(vb, vandq_u8(vandq_u8(vcgeq_u8(vb, big_a),
+                                        vcleq_u8(vb, big_z)),
+                               case_bit));
+    if (vminvq_u8(vceqq_u8(va, vb)) != 0xFF)
+      return false;
+  }
+#endif
+  for (; a < ep; a++, b++) {
+    if (*a != *b && _ac_scan_lower((unsigned char)*a) !=
+                        _ac_scan_lower((unsigned char)*b))
+      return false;
+  }
+  return true;
+}
+
+static inline void ac_scan_set_init(ac_scan_set_t *set, const char *chars) {
+  memset(set, 0, sizeof(*set));
+  for (; *chars; chars++) {
+    uint8_t c = (uint8_t)*chars;
+    if (set->bits[c >> 6] & (1ULL << (c & 63)))
+      continue;
+    if (set->num == AC_SCAN_SET_MAX) {
+      fprintf(stderr, "ac_scan_set_init: more than %d bytes\n",
+              AC_SCAN_SET_MAX);
+      abort();
+    }
+    set->bytes[set->num++] = c;
+    set->bits[c >> 6] |= 1ULL << (c & 63);
+  }
+}
+
+static inline bool _ac_scan_in_set(const ac_scan_set_t *set, uint8_t c) {
+  return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static inline const char *ac_scan_find(const char *p, const char *ep,
+                                       const ac_scan_set_t *set) {
+#if defined(__SSE2__)
+  for (; ep - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->bytes[0]));
+    for (uint32_t i = 1; i < set->num; i++)
+      m = _mm_or_si128(
+          m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->bytes[i])));
+    int mask = _mm_movemask_epi8(m);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#elif defined(__ARM_NEON)
+  for (; ep - p >= 16; p += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m = vceqq_u8(v, vdupq_n_u8(set->bytes[0]));
+    for (uint32_t i = 1; i < set->num; i++)
+      m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(set->bytes[i])));
+    /* four bits per byte */
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll(mask) >> 2);
+  }
+#endif
+  for (; p < ep; p++)
+    if (_ac_scan_in_set(set, (uint8_t)*p))
+      return p;
+  return NULL;
+}
+
+/* the first '\r' or c in p..ep (ep if neither is there) */
+static inline const char *_ac_scan_find_cr(const char *p, const char *ep,
+                                           char c) {
+#if defined(__SSE2__)
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i cv = _mm_set1_epi8(c);
+  for (; ep - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, cv)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t cr = vdupq_n_u8('\r');
+  const uint8x16_t cv = vdupq_n_u8((uint8_t)c);
+  for (; ep - p >= 16; p += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m = vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, cv));
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll(mask) >> 2);
+  }
+#endif
+  for (; p < ep && *p != '\r' && *p != c; p++)
+    ;
+  return p;
+}
+
+static inline const char *ac_scan_find_crlf(const char *p, const char *ep) {
+  while ((p = _ac_scan_find_cr(p, ep, '\r')) + 1 < ep) {
+    if (p[1] == '\n')
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+static inline const char *ac_scan_header(const char *p, const char *ep,
+                                         ac_scan_header_t *h) {
+  h->name = p;
+  h->value = NULL;
+  h->value_length = 0;
+  h->space_before_colon = false;
+  /* the name ends at the colon, or the line ends without one */
+  const char *q = p;
+  while ((q = _ac_scan_find_cr(q, ep, ':')) < ep && *q == '\r' &&
+         (q + 1 == ep || q[1] != '\n'))
+    q++;
+  if (q == ep || *q == '\r') {
+    h->name_length = q - p;
+    return q == ep ? ep : q + 2;
+  }
+  h->name_length = q - p;
+  h->space_before_colon = q > p && (q[-1] == ' ' || q[-1] == '\t');
+  for (q++; q < ep && *q == ' '; q++)
+    ;
+  h->value = q;
+  const char *eol = ac_scan_find_crlf(q, ep);
+  if (!eol) {
+    h->value_length = ep - q;
+    return ep;
+  }
+  h->value_length = eol - q;
+  return eol + 2;
+}
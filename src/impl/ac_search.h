@@ -16,6 +16,7 @@ limitations under the License.
 
 #include "ac_common.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 #define ac_search_def(name, keytype, datatype)                               \
@@ -46,7 +47,7 @@ limitations under the License.
       else if (n < 0)                                                          \
         high = mid;                                                            \
       else                                                                     \
-        return low;                                                            \
+        return mid;                                                            \
     }                                                                          \
     return NULL;                                                               \
   }
@@ -95,7 +96,7 @@ limitations under the License.
   }
 
 #define ac_search_lower_bound_m(name, keytype, datatype, compare)            \
-  datatype *name(char *p, datatype *base, size_t num_elements) {               \
+  datatype *name(keytype *p, datatype *base, size_t num_elements) {            \
     datatype *low = base;                                                      \
     datatype *high = base + num_elements;                                      \
     datatype *mid;                                                             \
@@ -111,7 +112,7 @@ limitations under the License.
   }
 
 #define ac_search_upper_bound_m(name, keytype, datatype, compare)            \
-  datatype *name(char *p, datatype *base, size_t num_elements) {               \
+  datatype *name(keytype *p, datatype *base, size_t num_elements) {            \
     datatype *low = base;                                                      \
     datatype *high = base + num_elements;                                      \
     datatype *mid;                                                             \
@@ -140,7 +141,7 @@ limitations under the License.
       else if (n < 0)                                                          \
         high = mid;                                                            \
       else                                                                     \
-        return low;                                                            \
+        return mid;                                                            \
     }                                                                          \
     return NULL;                                                               \
   }
@@ -237,7 +238,7 @@ limitations under the License.
       else if (n < 0)                                                          \
         high = mid;                                                            \
       else                                                                     \
-        return low;                                                            \
+        return mid;                                                            \
     }                                                                          \
     return NULL;                                                               \
   }
@@ -286,7 +287,7 @@ limitations under the License.
   }
 
 #define ac_search_lower_bound_arg_m(name, keytype, datatype, compare)        \
-  datatype *name(char *p, datatype *base, size_t num_elements, void *arg) {    \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg) { \
     datatype *low = base;                                                      \
     datatype *high = base + num_elements;                                      \
     datatype *mid;                                                             \
@@ -302,7 +303,7 @@ limitations under the License.
   }
 
 #define ac_search_upper_bound_arg_m(name, keytype, datatype, compare)        \
-  datatype *name(char *p, datatype *base, size_t num_elements, void *arg) {    \
+  datatype *name(keytype *p, datatype *base, size_t num_elements, void *arg) { \
     datatype *low = base;                                                      \
     datatype *high = base + num_elements;                                      \
     datatype *mid;                                                             \
@@ -332,7 +333,7 @@ limitations under the License.
       else if (n < 0)                                                          \
         high = mid;                                                            \
       else                                                                     \
-        return low;                                                            \
+        return mid;                                                            \
     }                                                                          \
     return NULL;                                                               \
   }
@@ -421,3 +422,141 @@ limitations under the License.
     }                                                                          \
     return low;                                                                \
   }
+
+/* ranges at or below this size are finished by counting the elements which
+   are less than the key.  The count has no branches and is vectorized by the
+   compiler. */
+#ifndef AC_SEARCH_LINEAR_CUTOFF
+#define AC_SEARCH_LINEAR_CUTOFF 16
+#endif
+
+/* The answer is always within [p, p + len].  Each step halves len and the
+   comparison selects the next p with a conditional move. */
+#define _ac_search_bound_key_m(name, type, less)                               \
+  static inline type *name(type key, type *base, size_t num_elements) {        \
+    type *p = base;                                                            \
+    size_t len = num_elements;                                                 \
+    while (len > AC_SEARCH_LINEAR_CUTOFF) {                                    \
+      size_t half = len >> 1;                                                  \
+      p = less(p[half], key) ? p + half : p;                                   \
+      len -= half;                                                             \
+    }                                                                          \
+    size_t count = 0;                                                          \
+    for (size_t i = 0; i < len; i++)                                           \
+      count += less(p[i], key);                                                \
+    return p + count;                                                          \
+  }
+
+#define _ac_search_less(a, b) ((a) < (b))
+#define _ac_search_less_equal(a, b) ((a) <= (b))
+
+#define _ac_search_key_m(suffix, type)                                         \
+  _ac_search_bound_key_m(ac_search_lower_bound_##suffix, type,                 \
+                         _ac_search_less)                                      \
+  _ac_search_bound_key_m(ac_search_upper_bound_##suffix, type,                 \
+                         _ac_search_less_equal)
+
+_ac_search_key_m(int32, int32_t)
+_ac_search_key_m(uint32, uint32_t)
+_ac_search_key_m(int64, int64_t)
+_ac_search_key_m(uint64, uint64_t)
+_ac_search_key_m(float, float)
+_ac_search_key_m(double, double)
+
+/* the number of unsorted keys which are searched together */
+#ifndef AC_SEARCH_BATCH_GROUP
+#define AC_SEARCH_BATCH_GROUP 8
+#endif
+
+#define ac_search_batch_def(name, keytype, datatype)                           \
+  void name(keytype *keys, size_t num_keys, datatype *base,                    \
+            size_t num_elements, datatype **res);
+
+/* Each key starts at the lower bound of the previous key (keys must be
+   sorted).  If the answer isn't there, an exponential search finds a range
+   which holds it and a binary search finishes.  A key which is near the last
+   costs a few comparisons instead of log(num_elements). */
+#define _ac_search_batch_gallop_m(name, keytype, datatype, compare, exact)     \
+  void name(keytype *keys, size_t num_keys, datatype *base,                    \
+            size_t num_elements, datatype **res) {                             \
+    size_t lo = 0;                                                             \
+    for (size_t i = 0; i < num_keys; i++) {                                    \
+      keytype *p = keys + i;                                                   \
+      if (lo < num_elements && compare(p, base + lo) > 0) {                    \
+        /* base[lo] < key */                                                   \
+        size_t bound = 1;                                                      \
+        while (lo + bound < num_elements &&                                    \
+               compare(p, base + lo + bound) > 0) {                            \
+          lo += bound;                                                         \
+          bound <<= 1;                                                         \
+        }                                                                      \
+        size_t high = lo + bound;                                              \
+        if (high > num_elements)                                               \
+          high = num_elements;                                                 \
+        lo++;                                                                  \
+        while (lo < high) {                                                    \
+          size_t mid = lo + ((high - lo) >> 1);                                \
+          if (compare(p, base + mid) > 0)                                      \
+            lo = mid + 1;                                                      \
+          else                                                                 \
+            high = mid;                                                        \
+        }                                                                      \
+      }                                                                        \
+      if (!exact)                                                              \
+        res[i] = base + lo;                                                    \
+      else if (lo < num_elements && !compare(p, base + lo))                    \
+        res[i] = base + lo;                                                    \
+      else                                                                     \
+        res[i] = NULL;                                                         \
+    }                                                                          \
+  }
+
+/* AC_SEARCH_BATCH_GROUP keys are searched in lockstep.  Every search over
+   the same array takes the same number of steps, so the steps of the group
+   are interleaved and the next probe of each key is prefetched while the
+   others are compared.  This hides most of the cache misses for large
+   arrays. */
+#define _ac_search_batch_interleave_m(name, keytype, datatype, compare,        \
+                                      exact)                                   \
+  void name(keytype *keys, size_t num_keys, datatype *base,                    \
+            size_t num_elements, datatype **res) {                             \
+    datatype *p[AC_SEARCH_BATCH_GROUP];                                        \
+    for (size_t i = 0; i < num_keys; i += AC_SEARCH_BATCH_GROUP) {             \
+      size_t group = num_keys - i;                                             \
+      if (group > AC_SEARCH_BATCH_GROUP)                                       \
+        group = AC_SEARCH_BATCH_GROUP;                                         \
+      keytype *k = keys + i;                                                   \
+      for (size_t j = 0; j < group; j++)                                       \
+        p[j] = base;                                                           \
+      size_t len = num_elements;                                               \
+      while (len > 1) {                                                        \
+        size_t half = len >> 1;                                                \
+        len -= half;                                                           \
+        for (size_t j = 0; j < group; j++) {                                   \
+          p[j] = compare(k + j, p[j] + half) > 0 ? p[j] + half : p[j];         \
+          __builtin_prefetch(p[j] + (len >> 1));                               \
+        }                                                                      \
+      }                                                                        \
+      for (size_t j = 0; j < group; j++) {                                     \
+        datatype *r = p[j];                                                    \
+        if (num_elements && compare(k + j, r) > 0)                             \
+          r++;                                                                 \
+        if (exact && (r == base + num_elements || compare(k + j, r)))          \
+          r = NULL;                                                            \
+        res[i + j] = r;                                                        \
+      }                                                                        \
+    }                                                                          \
+  }
+
+#define ac_search_batch_m(name, keytype, datatype, compare)                    \
+  _ac_search_batch_gallop_m(name, keytype, datatype, compare, true)
+
+#define ac_search_batch_lower_bound_m(name, keytype, datatype, compare)        \
+  _ac_search_batch_gallop_m(name, keytype, datatype, compare, false)
+
+#define ac_search_batch_unsorted_m(name, keytype, datatype, compare)           \
+  _ac_search_batch_interleave_m(name, keytype, datatype, compare, true)
+
+#define ac_search_batch_unsorted_lower_bound_m(name, keytype, datatype,        \
+                                               compare)                        \
+  _ac_search_batch_interleave_m(name, keytype, datatype, compare, false)
@@ -0,0 +1,393 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+
+/* ranges at or below this size are finished with an insertion sort */
+#define AC_SELECT_INSERTION_CUTOFF 16
+
+#define ac_select_def(name, type)                                              \
+  void name(type *base, size_t num_elements, size_t nth);
+
+#define ac_select_arg_def(name, type)                                          \
+  void name(type *base, size_t num_elements, size_t nth, void *arg);
+
+#define ac_select_compare_def(name, type)                                      \
+  void name(type *base, size_t num_elements, size_t nth,                       \
+            int (*compare)(type * a, type * b));
+
+#define ac_select_compare_arg_def(name, type)                                  \
+  void name(type *base, size_t num_elements, size_t nth,                       \
+            int (*compare)(type * a, type * b, void *arg), void *arg);
+
+#define ac_partial_sort_def(name, type)                                        \
+  void name(type *base, size_t num_elements, size_t k);
+
+#define ac_partial_sort_arg_def(name, type)                                    \
+  void name(type *base, size_t num_elements, size_t k, void *arg);
+
+#define ac_partial_sort_compare_def(name, type)                                \
+  void name(type *base, size_t num_elements, size_t k,                         \
+            int (*compare)(type * a, type * b));
+
+#define ac_partial_sort_compare_arg_def(name, type)                            \
+  void name(type *base, size_t num_elements, size_t k,                         \
+            int (*compare)(type * a, type * b, void *arg), void *arg);
+
+#define ac_topk_def(name, type)                                                \
+  size_t name(type *res, size_t k, type *base, size_t num_elements);
+
+#define ac_topk_arg_def(name, type)                                            \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              void *arg);
+
+#define ac_topk_compare_def(name, type)                                        \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              int (*compare)(type * a, type * b));
+
+#define ac_topk_compare_arg_def(name, type)                                    \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              int (*compare)(type * a, type * b, void *arg), void *arg);
+
+static inline size_t ac_select_depth(size_t num_elements) {
+  size_t depth = 0;
+  while (num_elements >>= 1)
+    depth += 2;
+  return depth;
+}
+
+/* expects name##_less(a, b, arg), all of the helpers are static so that
+   several generators can be used in one file with different names */
+#define _ac_select_core_m(name, type)                                          \
+  static inline void name##_insertion_sort(type *base, size_t num_elements,    \
+                                           void *arg) {                        \
+    type tmp;                                                                  \
+    type *ep = base + num_elements;                                            \
+    for (type *p = base + 1; p < ep; p++) {                                    \
+      if (!name##_less(p, p - 1, arg))                                         \
+        continue;                                                              \
+      tmp = *p;                                                                \
+      type *q = p;                                                             \
+      do {                                                                     \
+        *q = *(q - 1);                                                         \
+        q--;                                                                   \
+      } while (q > base && name##_less(&tmp, q - 1, arg));                     \
+      *q = tmp;                                                                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* base is a heap where no child is less than its parent */                  \
+  static inline void name##_sift_down(type *base, size_t i,                    \
+                                      size_t num_elements, void *arg) {        \
+    type tmp = base[i];                                                        \
+    size_t child;                                                              \
+    while ((child = (i << 1) + 1) < num_elements) {                            \
+      if (child + 1 < num_elements &&                                          \
+          name##_less(base + child, base + child + 1, arg))                    \
+        child++;                                                               \
+      if (!name##_less(&tmp, base + child, arg))                               \
+        break;                                                                 \
+      base[i] = base[child];                                                   \
+      i = child;                                                               \
+    }                                                                          \
+    base[i] = tmp;                                                             \
+  }                                                                            \
+                                                                               \
+  static inline void name##_heap_sort(type *base, size_t num_elements,         \
+                                      void *arg) {                             \
+    type tmp;                                                                  \
+    for (size_t i = num_elements >> 1; i > 0; i--)                             \
+      name##_sift_down(base, i - 1, num_elements, arg);                        \
+    while (num_elements > 1) {                                                 \
+      num_elements--;                                                          \
+      tmp = base[0];                                                           \
+      base[0] = base[num_elements];                                            \
+      base[num_elements] = tmp;                                                \
+      name##_sift_down(base, 0, num_elements, arg);                            \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_median3(type *a, type *b, type *c, void *arg) {   \
+    if (name##_less(a, b, arg)) {                                              \
+      if (name##_less(b, c, arg))                                              \
+        return b;                                                              \
+      return name##_less(a, c, arg) ? c : a;                                   \
+    }                                                                          \
+    if (name##_less(a, c, arg))                                                \
+      return a;                                                                \
+    return name##_less(b, c, arg) ? c : b;                                     \
+  }                                                                            \
+                                                                               \
+  /* partitions base around a median of three (or a ninther for larger         \
+     ranges) and returns the final position of the pivot.  The elements        \
+     before it are not greater than the pivot and the elements after it are    \
+     not less.  Equal elements stop both scans so that many duplicates still   \
+     split the range evenly. */                                                \
+  static inline size_t name##_partition(type *base, size_t num_elements,       \
+                                        void *arg) {                           \
+    type tmp;                                                                  \
+    type *ep = base + num_elements - 1;                                        \
+    type *mid = base + (num_elements >> 1);                                    \
+    type *pivot;                                                               \
+    if (num_elements > 128) {                                                  \
+      size_t s = num_elements >> 3;                                            \
+      pivot = name##_median3(                                                  \
+          name##_median3(base + 1, base + s, base + (s << 1), arg),            \
+          name##_median3(mid - s, mid, mid + s, arg),                          \
+          name##_median3(ep - (s << 1), ep - s, ep, arg), arg);                \
+    } else                                                                     \
+      pivot = name##_median3(base + 1, mid, ep, arg);                          \
+    tmp = *base;                                                               \
+    *base = *pivot;                                                            \
+    *pivot = tmp;                                                              \
+                                                                               \
+    type *a = base;                                                            \
+    type *b = ep + 1;                                                          \
+    while (1) {                                                                \
+      do {                                                                     \
+        a++;                                                                   \
+      } while (a < ep && name##_less(a, base, arg));                           \
+      do {                                                                     \
+        b--;                                                                   \
+      } while (name##_less(base, b, arg));                                     \
+      if (a >= b)                                                              \
+        break;                                                                 \
+      tmp = *a;                                                                \
+      *a = *b;                                                                 \
+      *b = tmp;                                                                \
+    }                                                                          \
+    tmp = *base;                                                               \
+    *base = *b;                                                                \
+    *b = tmp;                                                                  \
+    return b - base;                                                           \
+  }                                                                            \
+                                                                               \
+  /* introselect, if the partitions are repeatedly bad the range is heap       \
+     sorted so that the worst case is O(n log n) */                            \
+  static inline void name##_select_nth(type *base, size_t num_elements,        \
+                                       size_t nth, void *arg) {                \
+    size_t depth = ac_select_depth(num_elements);                              \
+    while (num_elements > AC_SELECT_INSERTION_CUTOFF) {                        \
+      if (!depth) {                                                            \
+        name##_heap_sort(base, num_elements, arg);                             \
+        return;                                                                \
+      }                                                                        \
+      depth--;                                                                 \
+      size_t p = name##_partition(base, num_elements, arg);                    \
+      if (p == nth)                                                            \
+        return;                                                                \
+      if (nth < p)                                                             \
+        num_elements = p;                                                      \
+      else {                                                                   \
+        p++;                                                                   \
+        base += p;                                                             \
+        num_elements -= p;                                                     \
+        nth -= p;                                                              \
+      }                                                                        \
+    }                                                                          \
+    name##_insertion_sort(base, num_elements, arg);                            \
+  }                                                                            \
+                                                                               \
+  /* introsort, recursing on the smaller side of each partition */             \
+  static inline void name##_sort_range(type *base, size_t num_elements,        \
+                                       size_t depth, void *arg) {              \
+    while (num_elements > AC_SELECT_INSERTION_CUTOFF) {                        \
+      if (!depth) {                                                            \
+        name##_heap_sort(base, num_elements, arg);                             \
+        return;                                                                \
+      }                                                                        \
+      depth--;                                                                 \
+      size_t p = name##_partition(base, num_elements, arg);                    \
+      size_t right = num_elements - p - 1;                                     \
+      if (p < right) {                                                         \
+        name##_sort_range(base, p, depth, arg);                                \
+        base += p + 1;                                                         \
+        num_elements = right;                                                  \
+      } else {                                                                 \
+        name##_sort_range(base + p + 1, right, depth, arg);                    \
+        num_elements = p;                                                      \
+      }                                                                        \
+    }                                                                          \
+    name##_insertion_sort(base, num_elements, arg);                            \
+  }                                                                            \
+                                                                               \
+  static inline void name##_partial_sort(type *base, size_t num_elements,      \
+                                         size_t k, void *arg) {                \
+    if (k >= num_elements)                                                     \
+      k = num_elements;                                                        \
+    else if (k)                                                                \
+      name##_select_nth(base, num_elements, k - 1, arg);                       \
+    if (k > 1)                                                                 \
+      name##_sort_range(base, k, ac_select_depth(k), arg);                     \
+  }                                                                            \
+                                                                               \
+  /* res is kept as a heap with the greatest of the k least elements on top,   \
+     so each remaining element costs one comparison unless it belongs in the   \
+     result */                                                                 \
+  static inline size_t name##_topk(type *res, size_t k, type *base,            \
+                                   size_t num_elements, void *arg) {           \
+    if (k > num_elements)                                                      \
+      k = num_elements;                                                        \
+    if (!k)                                                                    \
+      return 0;                                                                \
+    for (size_t i = 0; i < k; i++)                                             \
+      res[i] = base[i];                                                        \
+    for (size_t i = k >> 1; i > 0; i--)                                        \
+      name##_sift_down(res, i - 1, k, arg);                                    \
+    type *ep = base + num_elements;                                            \
+    for (type *p = base + k; p < ep; p++) {                                    \
+      if (name##_less(p, res, arg)) {                                          \
+        res[0] = *p;                                                           \
+        name##_sift_down(res, 0, k, arg);                                      \
+      }                                                                        \
+    }                                                                          \
+    name##_heap_sort(res, k, arg);                                             \
+    return k;                                                                  \
+  }
+
+#define _ac_select_compare_less_m(name, type)                                  \
+  typedef struct {                                                             \
+    int (*compare)(type *a, type *b);                                          \
+  } name##_compare_t;                                                          \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    return ((name##_compare_t *)arg)->compare(a, b) < 0;                       \
+  }
+
+#define _ac_select_compare_arg_less_m(name, type)                              \
+  typedef struct {                                                             \
+    int (*compare)(type *a, type *b, void *arg);                               \
+    void *arg;                                                                 \
+  } name##_compare_t;                                                          \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    name##_compare_t *c = (name##_compare_t *)arg;                             \
+    return c->compare(a, b, c->arg) < 0;                                       \
+  }
+
+#define ac_select_m(name, type, compare)                                       \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    (void)arg;                                                                 \
+    return compare(a, b) < 0;                                                  \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t nth) {                     \
+    if (nth < num_elements)                                                    \
+      name##_select_nth(base, num_elements, nth, NULL);                        \
+  }
+
+#define ac_select_arg_m(name, type, compare)                                   \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    return compare(a, b, arg) < 0;                                             \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t nth, void *arg) {          \
+    if (nth < num_elements)                                                    \
+      name##_select_nth(base, num_elements, nth, arg);                         \
+  }
+
+#define ac_select_compare_m(name, type)                                        \
+  _ac_select_compare_less_m(name, type)                                        \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t nth,                       \
+            int (*compare)(type * a, type * b)) {                              \
+    name##_compare_t c = {compare};                                            \
+    if (nth < num_elements)                                                    \
+      name##_select_nth(base, num_elements, nth, &c);                          \
+  }
+
+#define ac_select_compare_arg_m(name, type)                                    \
+  _ac_select_compare_arg_less_m(name, type)                                    \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t nth,                       \
+            int (*compare)(type * a, type * b, void *arg), void *arg) {        \
+    name##_compare_t c = {compare, arg};                                       \
+    if (nth < num_elements)                                                    \
+      name##_select_nth(base, num_elements, nth, &c);                          \
+  }
+
+#define ac_partial_sort_m(name, type, compare)                                 \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    (void)arg;                                                                 \
+    return compare(a, b) < 0;                                                  \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t k) {                       \
+    name##_partial_sort(base, num_elements, k, NULL);                          \
+  }
+
+#define ac_partial_sort_arg_m(name, type, compare)                             \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    return compare(a, b, arg) < 0;                                             \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t k, void *arg) {            \
+    name##_partial_sort(base, num_elements, k, arg);                           \
+  }
+
+#define ac_partial_sort_compare_m(name, type)                                  \
+  _ac_select_compare_less_m(name, type)                                        \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t k,                         \
+            int (*compare)(type * a, type * b)) {                              \
+    name##_compare_t c = {compare};                                            \
+    name##_partial_sort(base, num_elements, k, &c);                            \
+  }
+
+#define ac_partial_sort_compare_arg_m(name, type)                              \
+  _ac_select_compare_arg_less_m(name, type)                                    \
+  _ac_select_core_m(name, type)                                                \
+  void name(type *base, size_t num_elements, size_t k,                         \
+            int (*compare)(type * a, type * b, void *arg), void *arg) {        \
+    name##_compare_t c = {compare, arg};                                       \
+    name##_partial_sort(base, num_elements, k, &c);                            \
+  }
+
+#define ac_topk_m(name, type, compare)                                         \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    (void)arg;                                                                 \
+    return compare(a, b) < 0;                                                  \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  size_t name(type *res, size_t k, type *base, size_t num_elements) {          \
+    return name##_topk(res, k, base, num_elements, NULL);                      \
+  }
+
+#define ac_topk_arg_m(name, type, compare)                                     \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    return compare(a, b, arg) < 0;                                             \
+  }                                                                            \
+  _ac_select_core_m(name, type)                                                \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              void *arg) {                                                     \
+    return name##_topk(res, k, base, num_elements, arg);                       \
+  }
+
+#define ac_topk_compare_m(name, type)                                          \
+  _ac_select_compare_less_m(name, type)                                        \
+  _ac_select_core_m(name, type)                                                \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              int (*compare)(type * a, type * b)) {                            \
+    name##_compare_t c = {compare};                                            \
+    return name##_topk(res, k, base, num_elements, &c);                        \
+  }
+
+#define ac_topk_compare_arg_m(name, type)                                      \
+  _ac_select_compare_arg_less_m(name, type)                                    \
+  _ac_select_core_m(name, type)                                                \
+  size_t name(type *res, size_t k, type *base, size_t num_elements,            \
+              int (*compare)(type * a, type * b, void *arg), void *arg) {      \
+    name##_compare_t c = {compare, arg};                                       \
+    return name##_topk(res, k, base, num_elements, &c);                        \
+  }
@@ -0,0 +1,250 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* a writer makes the sequence number odd before it changes the shard and
+   even again after */
+static inline void ac_sharded_hashmap_write_begin(size_t *seq) {
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void ac_sharded_hashmap_write_end(size_t *seq) {
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#define ac_sharded_hashmap_def(name, keytype, datatype)                        \
+  typedef struct {                                                             \
+    size_t hv;                                                                 \
+    datatype *d;                                                               \
+  } name##_slot_t;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    pthread_mutex_t mutex;                                                     \
+    size_t seq;                                                                \
+    name##_slot_t *slots;                                                      \
+    /* set when an item is found, cleared as the clock hand passes */          \
+    uint8_t *referenced;                                                       \
+    size_t mask;                                                               \
+    size_t size;                                                               \
+    size_t max_size;                                                           \
+    size_t hand;                                                               \
+    char pad[64];                                                              \
+  } name##_shard_t;                                                            \
+                                                                               \
+  typedef struct {                                                             \
+    name##_shard_t *shards;                                                    \
+    size_t shard_mask;                                                         \
+    int shard_bits;                                                            \
+    ac_slab_t *slab;                                                           \
+  } name##_t;                                                                  \
+                                                                               \
+  void name##_init(name##_t *h, size_t num_shards, size_t max_bytes);          \
+  void name##_destroy(name##_t *h);                                            \
+  bool name##_find(name##_t *h, const keytype *key, datatype *res);            \
+  bool name##_insert(name##_t *h, const keytype *key, const datatype *d);      \
+  bool name##_erase(name##_t *h, const keytype *key);                          \
+  size_t name##_size(name##_t *h);
+
+#define ac_sharded_hashmap_m(name, keytype, datatype, hash, equal)             \
+  void name##_init(name##_t *h, size_t num_shards, size_t max_bytes) {         \
+    h->shard_bits = 0;                                                         \
+    while (((size_t)1 << h->shard_bits) < num_shards)                          \
+      h->shard_bits++;                                                         \
+    num_shards = (size_t)1 << h->shard_bits;                                   \
+    h->shard_mask = num_shards - 1;                                            \
+    h->slab = ac_slab_init(sizeof(datatype));                                  \
+    size_t max_size = max_bytes / num_shards / ac_slab_object_size(h->slab);   \
+    if (!max_size)                                                             \
+      max_size = 1;                                                            \
+    size_t capacity = 2;                                                       \
+    while (capacity < max_size * 2)                                            \
+      capacity <<= 1;                                                          \
+    h->shards = (name##_shard_t *)ac_calloc(sizeof(name##_shard_t) *           \
+                                            num_shards);                       \
+    for (size_t i = 0; i < num_shards; i++) {                                  \
+      name##_shard_t *s = h->shards + i;                                       \
+      pthread_mutex_init(&s->mutex, NULL);                                     \
+      s->slots = (name##_slot_t *)ac_calloc(sizeof(name##_slot_t) * capacity); \
+      s->referenced = (uint8_t *)ac_calloc(capacity);                          \
+      s->mask = capacity - 1;                                                  \
+      s->max_size = max_size;                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void name##_destroy(name##_t *h) {                                           \
+    for (size_t i = 0; i <= h->shard_mask; i++) {                              \
+      name##_shard_t *s = h->shards + i;                                       \
+      pthread_mutex_destroy(&s->mutex);                                        \
+      ac_free(s->slots);                                                       \
+      ac_free(s->referenced);                                                  \
+    }                                                                          \
+    ac_free(h->shards);                                                        \
+    ac_slab_destroy(h->slab);                                                  \
+    h->shards = NULL;                                                          \
+    h->slab = NULL;                                                            \
+  }                                                                            \
+                                                                               \
+  /* returns the item which matches key (and its slot in pos) or NULL.  The    \
+     table is never more than half full, so a reader which sees a table that   \
+     is being changed still reaches an empty slot. */                          \
+  static inline datatype *_##name##_find_slot(name##_t *h, name##_shard_t *s,  \
+                                              const keytype *key, size_t hv,   \
+                                              size_t *pos) {                   \
+    size_t i = (hv >> h->shard_bits) & s->mask;                                \
+    for (size_t n = 0; n <= s->mask; n++) {                                    \
+      datatype *d = __atomic_load_n(&s->slots[i].d, __ATOMIC_RELAXED);         \
+      if (!d)                                                                  \
+        return NULL;                                                           \
+      if (__atomic_load_n(&s->slots[i].hv, __ATOMIC_RELAXED) == hv &&          \
+          equal(key, d)) {                                                     \
+        *pos = i;                                                              \
+        return d;                                                              \
+      }                                                                        \
+      i = (i + 1) & s->mask;                                                   \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* empty slot i, moving the following items back so that every item can      \
+     still be reached from its home slot (so there are no tombstones) */       \
+  static void _##name##_remove_slot(name##_t *h, name##_shard_t *s,            \
+                                    size_t i) {                                \
+    size_t j = i;                                                              \
+    while (true) {                                                             \
+      j = (j + 1) & s->mask;                                                   \
+      if (!s->slots[j].d)                                                      \
+        break;                                                                 \
+      size_t k = (s->slots[j].hv >> h->shard_bits) & s->mask;                  \
+      /* the item at j may move to i unless its home k is in (i, j] */         \
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j))                      \
+        continue;                                                              \
+      __atomic_store_n(&s->slots[i].hv, s->slots[j].hv, __ATOMIC_RELAXED);     \
+      __atomic_store_n(&s->slots[i].d, s->slots[j].d, __ATOMIC_RELAXED);       \
+      __atomic_store_n(s->referenced + i, s->referenced[j], __ATOMIC_RELAXED); \
+      i = j;                                                                   \
+    }                                                                          \
+    __atomic_store_n(&s->slots[i].d, NULL, __ATOMIC_RELAXED);                  \
+    __atomic_store_n(s->referenced + i, 0, __ATOMIC_RELAXED);                  \
+    s->size--;                                                                 \
+  }                                                                            \
+                                                                               \
+  static void _##name##_evict(name##_t *h, name##_shard_t *s) {                \
+    while (true) {                                                             \
+      size_t i = s->hand & s->mask;                                            \
+      s->hand++;                                                               \
+      if (!s->slots[i].d)                                                      \
+        continue;                                                              \
+      if (__atomic_load_n(s->referenced + i, __ATOMIC_RELAXED)) {              \
+        __atomic_store_n(s->referenced + i, 0, __ATOMIC_RELAXED);              \
+        continue;                                                              \
+      }                                                                        \
+      datatype *d = s->slots[i].d;                                             \
+      _##name##_remove_slot(h, s, i);                                          \
+      ac_slab_free(h->slab, d);                                                \
+      return;                                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  bool name##_find(name##_t *h, const keytype *key, datatype *res) {           \
+    size_t hv = hash(key);                                                     \
+    name##_shard_t *s = h->shards + (hv & h->shard_mask);                      \
+    for (int tries = 0; tries < AC_SHARDED_HASHMAP_RETRIES; tries++) {         \
+      size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);                 \
+      if (seq & 1)                                                             \
+        continue;                                                              \
+      size_t i;                                                                \
+      datatype *d = _##name##_find_slot(h, s, key, hv, &i);                    \
+      if (d)                                                                   \
+        memcpy(res, d, sizeof(datatype));                                      \
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);                                 \
+      if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)                   \
+        continue;                                                              \
+      if (!d)                                                                  \
+        return false;                                                          \
+      if (!__atomic_load_n(s->referenced + i, __ATOMIC_RELAXED))               \
+        __atomic_store_n(s->referenced + i, 1, __ATOMIC_RELAXED);              \
+      return true;                                                             \
+    }                                                                          \
+    pthread_mutex_lock(&s->mutex);                                             \
+    size_t i;                                                                  \
+    datatype *d = _##name##_find_slot(h, s, key, hv, &i);                      \
+    if (d) {                                                                   \
+      memcpy(res, d, sizeof(datatype));                                        \
+      __atomic_store_n(s->referenced + i, 1, __ATOMIC_RELAXED);                \
+    }                                                                          \
+    pthread_mutex_unlock(&s->mutex);                                           \
+    return d != NULL;                                                          \
+  }                                                                            \
+                                                                               \
+  bool name##_insert(name##_t *h, const keytype *key, const datatype *d) {     \
+    size_t hv = hash(key);                                                     \
+    name##_shard_t *s = h->shards + (hv & h->shard_mask);                      \
+    pthread_mutex_lock(&s->mutex);                                             \
+    ac_sharded_hashmap_write_begin(&s->seq);                                   \
+    bool inserted = true;                                                      \
+    size_t i;                                                                  \
+    datatype *found = _##name##_find_slot(h, s, key, hv, &i);                  \
+    if (found) {                                                               \
+      memcpy(found, d, sizeof(datatype));                                      \
+      inserted = false;                                                        \
+    } else {                                                                   \
+      if (s->size >= s->max_size)                                              \
+        _##name##_evict(h, s);                                                 \
+      datatype *e = (datatype *)ac_slab_alloc(h->slab);                        \
+      memcpy(e, d, sizeof(datatype));                                          \
+      i = (hv >> h->shard_bits) & s->mask;                                     \
+      while (s->slots[i].d)                                                    \
+        i = (i + 1) & s->mask;                                                 \
+      __atomic_store_n(&s->slots[i].hv, hv, __ATOMIC_RELAXED);                 \
+      __atomic_store_n(&s->slots[i].d, e, __ATOMIC_RELAXED);                   \
+      __atomic_store_n(s->referenced + i, 0, __ATOMIC_RELAXED);                \
+      s->size++;                                                               \
+    }                                                                          \
+    ac_sharded_hashmap_write_end(&s->seq);                                     \
+    pthread_mutex_unlock(&s->mutex);                                           \
+    return inserted;                                                           \
+  }                                                                            \
+                                                                               \
+  bool name##_erase(name##_t *h, const keytype *key) {                         \
+    size_t hv = hash(key);                                                     \
+    name##_shard_t *s = h->shards + (hv & h->shard_mask);                      \
+    pthread_mutex_lock(&s->mutex);                                             \
+    size_t i;                                                                  \
+    datatype *d = _##name##_find_slot(h, s, key, hv, &i);                      \
+    if (d) {                                                                   \
+      ac_sharded_hashmap_write_begin(&s->seq);                                 \
+      _##name##_remove_slot(h, s, i);                                          \
+      ac_sharded_hashmap_write_end(&s->seq);                                   \
+    }                                                                          \
+    pthread_mutex_unlock(&s->mutex);                                           \
+    /* readers never hold on to an entry and the slab's memory stays mapped,   \
+       so the entry can be freed as soon as it is unlinked */                  \
+    if (d)                                                                     \
+      ac_slab_free(h->slab, d);                                                \
+    return d != NULL;                                                          \
+  }                                                                            \
+                                                                               \
+  size_t name##_size(name##_t *h) {                                            \
+    size_t size = 0;                                                           \
+    for (size_t i = 0; i <= h->shard_mask; i++)                                \
+      size += __atomic_load_n(&h->shards[i].size, __ATOMIC_RELAXED);           \
+    return size;                                                               \
+  }
@@ -0,0 +1,43 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+struct ac_slice_s {
+  char *data;
+  size_t length;
+  size_t refs;
+  /* the slice which the data belongs to (the slice itself unless it came
+     from ac_slice_sub) */
+  ac_slice_t *owner;
+  ac_slice_pool_t *pool;
+  /* the size class of the allocation or -1 if it was malloc'd */
+  int size_class;
+};
+
+static inline ac_slice_t *ac_slice_ref(ac_slice_t *s) {
+  __atomic_fetch_add(&s->refs, 1, __ATOMIC_RELAXED);
+  return s;
+}
+
+static inline const char *ac_slice_data(const ac_slice_t *s) {
+  return s->data;
+}
+
+static inline size_t ac_slice_length(const ac_slice_t *s) {
+  return s->length;
+}
+
+static inline char *ac_slice_mutable_data(ac_slice_t *s) { return s->data; }
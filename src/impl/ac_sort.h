@@ -162,10 +162,14 @@ limitations under the License.
   *(a) = *(b);                                                                 \
   *(b) = tmp
 
+/* shared with ac_sort.h and ac_sortl.h */
+#ifndef _ac_sort_stack_t_
+#define _ac_sort_stack_t_
 typedef struct {
   void *base;
   ssize_t num_elements;
 } sort_stack_t;
+#endif
 
 #define ac_sort_def(name, type) void name(type *base, size_t num_elements);
 
@@ -279,20 +283,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (compare(c, a) < 0) {                                           \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
@@ -380,7 +377,7 @@ typedef struct {
     }                                                                          \
                                                                                \
     while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
+      if (num_elements < AC_SORT_SMALL_CUTOFF) {                               \
         if (num_elements < 6) {                                                \
           if (num_elements == 2) {                                             \
             if (compare(base + 1, base) < 0) {                                 \
@@ -609,7 +606,7 @@ typedef struct {
     top++;                                                                     \
     if (num_elements > 12) {                                                   \
       a = base;                                                                \
-      e = base + num_elements - 1;                                             \
+      high = e = base + num_elements - 1;                                      \
       pivot = num_elements >> 1;                                               \
       c = a + pivot;                                                           \
       if (compare(e, a, arg) < 0) {                                            \
@@ -692,20 +689,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (compare(c, a, arg) < 0) {                                      \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
@@ -792,7 +782,7 @@ typedef struct {
     }                                                                          \
                                                                                \
     while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
+      if (num_elements < AC_SORT_SMALL_CUTOFF) {                               \
         if (num_elements < 6) {                                                \
           if (num_elements == 2) {                                             \
             if (compare(base + 1, base, arg) < 0) {                            \
@@ -938,7 +928,7 @@ typedef struct {
         }                                                                      \
       } else {                                                                 \
         a = base;                                                              \
-        e = base + num_elements - 1;                                           \
+        high = e = base + num_elements - 1;                                    \
         pivot = num_elements >> 1;                                             \
         c = a + pivot;                                                         \
         if (compare(c, a, arg) < 0) {                                          \
@@ -1023,7 +1013,7 @@ typedef struct {
     top++;                                                                     \
     if (num_elements > 12) {                                                   \
       a = base;                                                                \
-      e = base + num_elements - 1;                                             \
+      high = e = base + num_elements - 1;                                      \
       pivot = num_elements >> 1;                                               \
       c = a + pivot;                                                           \
       if (compare(e, a) < 0) {                                                 \
@@ -1106,20 +1096,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (compare(c, a) < 0) {                                           \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
@@ -1206,7 +1189,7 @@ typedef struct {
     }                                                                          \
                                                                                \
     while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
+      if (num_elements < AC_SORT_SMALL_CUTOFF) {                               \
         if (num_elements < 6) {                                                \
           if (num_elements == 2) {                                             \
             if (compare(base + 1, base) < 0) {                                 \
@@ -1352,7 +1335,7 @@ typedef struct {
         }                                                                      \
       } else {                                                                 \
         a = base;                                                              \
-        e = base + num_elements - 1;                                           \
+        high = e = base + num_elements - 1;                                    \
         pivot = num_elements >> 1;                                             \
         c = a + pivot;                                                         \
         if (compare(c, a) < 0) {                                               \
@@ -1438,7 +1421,7 @@ typedef struct {
     top++;                                                                     \
     if (num_elements > 12) {                                                   \
       a = base;                                                                \
-      e = base + num_elements - 1;                                             \
+      high = e = base + num_elements - 1;                                      \
       pivot = num_elements >> 1;                                               \
       c = a + pivot;                                                           \
       if (compare(e, a, arg) < 0) {                                            \
@@ -1521,20 +1504,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (compare(c, a, arg) < 0) {                                      \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
@@ -1621,7 +1597,7 @@ typedef struct {
     }                                                                          \
                                                                                \
     while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
+      if (num_elements < AC_SORT_SMALL_CUTOFF) {                               \
         if (num_elements < 6) {                                                \
           if (num_elements == 2) {                                             \
             if (compare(base + 1, base, arg) < 0) {                            \
@@ -1767,7 +1743,7 @@ typedef struct {
         }                                                                      \
       } else {                                                                 \
         a = base;                                                              \
-        e = base + num_elements - 1;                                           \
+        high = e = base + num_elements - 1;                                    \
         pivot = num_elements >> 1;                                             \
         c = a + pivot;                                                         \
         if (compare(c, a, arg) < 0) {                                          \
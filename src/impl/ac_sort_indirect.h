@@ -0,0 +1,98 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+
+/* elements smaller than this are sorted in place */
+#ifndef AC_SORT_INDIRECT_MIN_SIZE
+#define AC_SORT_INDIRECT_MIN_SIZE 256
+#endif
+
+#define ac_sort_indirect_def(name, type)                                       \
+  void name(type *base, size_t num_elements);
+
+#define ac_sort_indirect_arg_def(name, type)                                   \
+  void name(type *base, size_t num_elements, void *arg);
+
+/* expects name##_pointers_block_sort and name##_direct_block_sort */
+#define _ac_sort_indirect_core_m(name, type)                                   \
+  /* order[i] points to the element which belongs at base[i].  Each cycle of   \
+     the permutation is followed once, so every element is copied once plus    \
+     one extra copy per cycle. */                                              \
+  static inline void name##_permute(type *base, type **order,                  \
+                                    size_t num_elements) {                     \
+    type tmp;                                                                  \
+    for (size_t i = 0; i < num_elements; i++) {                                \
+      if (order[i] == base + i)                                                \
+        continue;                                                              \
+      tmp = base[i];                                                           \
+      size_t j = i;                                                            \
+      while (1) {                                                              \
+        size_t k = order[j] - base;                                            \
+        order[j] = base + j;                                                   \
+        if (k == i) {                                                          \
+          base[j] = tmp;                                                       \
+          break;                                                               \
+        }                                                                      \
+        base[j] = base[k];                                                     \
+        j = k;                                                                 \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_indirect(type *base, size_t num_elements,          \
+                                     void *arg) {                              \
+    if (sizeof(type) < AC_SORT_INDIRECT_MIN_SIZE || num_elements < 16) {       \
+      name##_direct_block_sort(base, num_elements, arg);                       \
+      return;                                                                  \
+    }                                                                          \
+    type **order = (type **)ac_malloc(num_elements * sizeof(type *));          \
+    for (size_t i = 0; i < num_elements; i++)                                  \
+      order[i] = base + i;                                                     \
+    name##_pointers_block_sort(order, num_elements, arg);                      \
+    name##_permute(base, order, num_elements);                                 \
+    ac_free(order);                                                            \
+  }
+
+#define ac_sort_indirect_m(name, type, compare)                                \
+  static inline bool name##_direct_less(type *a, type *b, void *arg) {         \
+    (void)arg;                                                                 \
+    return compare(a, b) < 0;                                                  \
+  }                                                                            \
+  static inline bool name##_pointers_less(type **a, type **b, void *arg) {     \
+    (void)arg;                                                                 \
+    return compare(*a, *b) < 0;                                                \
+  }                                                                            \
+  _ac_sortl_block_core_m(name##_direct, type)                                  \
+  _ac_sortl_block_core_m(name##_pointers, type *)                              \
+  _ac_sort_indirect_core_m(name, type)                                         \
+  void name(type *base, size_t num_elements) {                                 \
+    name##_indirect(base, num_elements, NULL);                                 \
+  }
+
+#define ac_sort_indirect_arg_m(name, type, compare)                            \
+  static inline bool name##_direct_less(type *a, type *b, void *arg) {         \
+    return compare(a, b, arg) < 0;                                             \
+  }                                                                            \
+  static inline bool name##_pointers_less(type **a, type **b, void *arg) {     \
+    return compare(*a, *b, arg) < 0;                                           \
+  }                                                                            \
+  _ac_sortl_block_core_m(name##_direct, type)                                  \
+  _ac_sortl_block_core_m(name##_pointers, type *)                              \
+  _ac_sort_indirect_core_m(name, type)                                         \
+  void name(type *base, size_t num_elements, void *arg) {                      \
+    name##_indirect(base, num_elements, arg);                                  \
+  }
@@ -0,0 +1,141 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+
+#define ac_sort_parallel_def(name, type)                                       \
+  void name(type *base, size_t num_elements, int num_threads);
+
+#define ac_sort_parallel_arg_def(name, type)                                   \
+  void name(type *base, size_t num_elements, void *arg, int num_threads);
+
+/* expects name##_cmp(a, b, arg) and name##_finish(base, num_elements, arg) */
+#define _ac_sort_parallel_core_m(name, type)                                   \
+  static inline type *name##_median3(type *a, type *b, type *c, void *arg) {   \
+    if (name##_cmp(a, b, arg) < 0) {                                           \
+      if (name##_cmp(b, c, arg) < 0)                                           \
+        return b;                                                              \
+      return name##_cmp(a, c, arg) < 0 ? c : a;                                \
+    }                                                                          \
+    if (name##_cmp(a, c, arg) < 0)                                             \
+      return a;                                                                \
+    return name##_cmp(b, c, arg) < 0 ? c : b;                                  \
+  }                                                                            \
+                                                                               \
+  /* the pivot (a median of medians of nine elements) is moved to its final    \
+     position and the position is returned.  Elements which are equal to the   \
+     pivot stop both scans, so runs of equal keys are split evenly. */         \
+  static size_t name##_partition(type *base, size_t num_elements, void *arg) { \
+    type tmp;                                                                  \
+    size_t step = num_elements >> 3;                                           \
+    type *mid = base + (num_elements >> 1);                                    \
+    type *high = base + num_elements - 1;                                      \
+    type *p = name##_median3(                                                  \
+        name##_median3(base, base + step, base + step + step, arg),            \
+        name##_median3(mid - step, mid, mid + step, arg),                      \
+        name##_median3(high - step - step, high - step, high, arg), arg);      \
+    sort_swap(base, p);                                                        \
+    type *a = base;                                                            \
+    type *b = base + num_elements;                                             \
+    while (true) {                                                             \
+      do                                                                       \
+        a++;                                                                   \
+      while (a < b && name##_cmp(a, base, arg) < 0);                           \
+      do                                                                       \
+        b--;                                                                   \
+      while (name##_cmp(base, b, arg) < 0);                                    \
+      if (a >= b)                                                              \
+        break;                                                                 \
+      sort_swap(a, b);                                                         \
+    }                                                                          \
+    sort_swap(base, b);                                                        \
+    return b - base;                                                           \
+  }                                                                            \
+                                                                               \
+  /* the sequential sort returns early for sorted input, check for that        \
+     before starting any threads */                                            \
+  static bool name##_sorted(type *base, size_t num_elements, void *arg) {      \
+    type *ep = base + num_elements;                                            \
+    for (base++; base < ep; base++)                                            \
+      if (name##_cmp(base, base - 1, arg) < 0)                                 \
+        return false;                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static void name##_work(ac_sort_parallel_t *h, void *p,                      \
+                          size_t num_elements) {                               \
+    type *base = (type *)p;                                                    \
+    void *arg = ac_sort_parallel_arg(h);                                       \
+    while (num_elements > AC_SORT_PARALLEL_CUTOFF) {                           \
+      size_t pivot = name##_partition(base, num_elements, arg);                \
+      size_t right = num_elements - (pivot + 1);                               \
+      if (pivot < right) {                                                     \
+        if (pivot > 1)                                                         \
+          ac_sort_parallel_push(h, base, pivot);                               \
+        base += pivot + 1;                                                     \
+        num_elements = right;                                                  \
+      } else {                                                                 \
+        if (right > 1)                                                         \
+          ac_sort_parallel_push(h, base + pivot + 1, right);                   \
+        num_elements = pivot;                                                  \
+      }                                                                        \
+    }                                                                          \
+    name##_finish(base, num_elements, arg);                                    \
+  }
+
+#define ac_sort_parallel_m(name, type, compare)                                \
+  static ac_sort_m(name##_sequential, type, compare)                           \
+                                                                               \
+  static inline int name##_cmp(type *a, type *b, void *arg) {                  \
+    (void)arg;                                                                 \
+    return compare(a, b);                                                      \
+  }                                                                            \
+                                                                               \
+  static inline void name##_finish(type *base, size_t num_elements,            \
+                                   void *arg) {                                \
+    (void)arg;                                                                 \
+    name##_sequential(base, num_elements);                                     \
+  }                                                                            \
+                                                                               \
+  _ac_sort_parallel_core_m(name, type)                                         \
+                                                                               \
+  void name(type *base, size_t num_elements, int num_threads) {                \
+    if (num_threads <= 1 || num_elements <= AC_SORT_PARALLEL_CUTOFF)           \
+      name##_sequential(base, num_elements);                                   \
+    else if (!name##_sorted(base, num_elements, NULL))                         \
+      ac_sort_parallel(base, num_elements, num_threads, name##_work, NULL);    \
+  }
+
+#define ac_sort_parallel_arg_m(name, type, compare)                            \
+  static ac_sort_arg_m(name##_sequential, type, compare)                       \
+                                                                               \
+  static inline int name##_cmp(type *a, type *b, void *arg) {                  \
+    return compare(a, b, arg);                                                 \
+  }                                                                            \
+                                                                               \
+  static inline void name##_finish(type *base, size_t num_elements,            \
+                                   void *arg) {                                \
+    name##_sequential(base, num_elements, arg);                                \
+  }                                                                            \
+                                                                               \
+  _ac_sort_parallel_core_m(name, type)                                         \
+                                                                               \
+  void name(type *base, size_t num_elements, void *arg, int num_threads) {     \
+    if (num_threads <= 1 || num_elements <= AC_SORT_PARALLEL_CUTOFF)           \
+      name##_sequential(base, num_elements, arg);                              \
+    else if (!name##_sorted(base, num_elements, arg))                          \
+      ac_sort_parallel(base, num_elements, num_threads, name##_work, arg);     \
+  }
@@ -0,0 +1,215 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  size_t start;
+  size_t len;
+} ac_sort_stable_run_t;
+
+/* run lengths grow at least as fast as the fibonacci sequence, so this is
+   enough for any size_t */
+#define AC_SORT_STABLE_MAX_RUNS 96
+
+/* a minimum run length between 32 and 64 so that num_elements / min_run is
+   a power of two or a little less than one */
+static inline size_t ac_sort_stable_min_run(size_t num_elements) {
+  size_t r = 0;
+  while (num_elements >= 64) {
+    r |= num_elements & 1;
+    num_elements >>= 1;
+  }
+  return num_elements + r;
+}
+
+#define ac_sort_stable_def(name, type)                                         \
+  void name(type *base, size_t num_elements);
+
+#define ac_sortl_stable_def(name, type)                                        \
+  void name(type *base, size_t num_elements);
+
+/* expects name##_less(a, b) */
+#define _ac_sort_stable_core_m(name, type)                                     \
+  /* returns the length of the run at base, a descending run is reversed */    \
+  static inline size_t name##_run(type *base, size_t num_elements) {           \
+    if (num_elements < 2)                                                      \
+      return num_elements;                                                     \
+    type *p = base + 2;                                                        \
+    type *ep = base + num_elements;                                            \
+    if (name##_less(base + 1, base)) {                                         \
+      while (p < ep && name##_less(p, p - 1))                                  \
+        p++;                                                                   \
+      type *a = base;                                                          \
+      type *b = p - 1;                                                         \
+      type tmp;                                                                \
+      while (a < b) {                                                          \
+        tmp = *a;                                                              \
+        *a = *b;                                                               \
+        *b = tmp;                                                              \
+        a++;                                                                   \
+        b--;                                                                   \
+      }                                                                        \
+    } else {                                                                   \
+      while (p < ep && !name##_less(p, p - 1))                                 \
+        p++;                                                                   \
+    }                                                                          \
+    return p - base;                                                           \
+  }                                                                            \
+                                                                               \
+  /* base[0..sorted) is in order, insert the rest of base[0..num_elements) */  \
+  static void name##_insertion_sort(type *base, size_t sorted,                 \
+                                    size_t num_elements) {                     \
+    type tmp;                                                                  \
+    for (; sorted < num_elements; sorted++) {                                  \
+      tmp = base[sorted];                                                      \
+      size_t low = 0;                                                          \
+      size_t high = sorted;                                                    \
+      while (low < high) {                                                     \
+        size_t mid = (low + high) >> 1;                                        \
+        if (name##_less(&tmp, base + mid))                                     \
+          high = mid;                                                          \
+        else                                                                   \
+          low = mid + 1;                                                       \
+      }                                                                        \
+      memmove(base + low + 1, base + low, (sorted - low) * sizeof(type));      \
+      base[low] = tmp;                                                         \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* merges a[0..na) and a[na..na+nb) using buf */                             \
+  static void name##_merge(type *a, size_t na, size_t nb, type *buf) {         \
+    type *b = a + na;                                                          \
+    /* the start of a which is not greater than b[0] is in place */            \
+    size_t low = 0;                                                            \
+    size_t high = na;                                                          \
+    while (low < high) {                                                       \
+      size_t mid = (low + high) >> 1;                                          \
+      if (name##_less(b, a + mid))                                             \
+        high = mid;                                                            \
+      else                                                                     \
+        low = mid + 1;                                                         \
+    }                                                                          \
+    a += low;                                                                  \
+    na -= low;                                                                 \
+    if (!na)                                                                   \
+      return;                                                                  \
+    /* the end of b which is not less than the last of a is in place */        \
+    low = 0;                                                                   \
+    high = nb;                                                                 \
+    while (low < high) {                                                       \
+      size_t mid = (low + high) >> 1;                                          \
+      if (name##_less(b + mid, b - 1))                                         \
+        low = mid + 1;                                                         \
+      else                                                                     \
+        high = mid;                                                            \
+    }                                                                          \
+    nb = low;                                                                  \
+    if (!nb)                                                                   \
+      return;                                                                  \
+                                                                               \
+    if (na <= nb) {                                                            \
+      memcpy(buf, a, na * sizeof(type));                                       \
+      type *p = buf;                                                           \
+      type *ep = buf + na;                                                     \
+      type *bp = b;                                                            \
+      type *be = b + nb;                                                       \
+      type *dest = a;                                                          \
+      while (p < ep && bp < be) {                                              \
+        if (name##_less(bp, p))                                                \
+          *dest++ = *bp++;                                                     \
+        else                                                                   \
+          *dest++ = *p++;                                                      \
+      }                                                                        \
+      memcpy(dest, p, (ep - p) * sizeof(type));                                \
+    } else {                                                                   \
+      memcpy(buf, b, nb * sizeof(type));                                       \
+      type *p = buf + nb;                                                      \
+      type *ap = b;                                                            \
+      type *dest = b + nb;                                                     \
+      while (p > buf && ap > a) {                                              \
+        if (name##_less(p - 1, ap - 1))                                        \
+          *--dest = *--ap;                                                     \
+        else                                                                   \
+          *--dest = *--p;                                                      \
+      }                                                                        \
+      memcpy(dest - (p - buf), buf, (p - buf) * sizeof(type));                 \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void name(type *base, size_t num_elements) {                                 \
+    size_t min_run = ac_sort_stable_min_run(num_elements);                     \
+    if (num_elements <= min_run) {                                             \
+      name##_insertion_sort(base, name##_run(base, num_elements),              \
+                            num_elements);                                     \
+      return;                                                                  \
+    }                                                                          \
+    type *buf = (type *)ac_malloc(sizeof(type) * ((num_elements >> 1) + 1));   \
+    if (!buf)                                                                  \
+      abort();                                                                 \
+    ac_sort_stable_run_t runs[AC_SORT_STABLE_MAX_RUNS];                        \
+    size_t num_runs = 0;                                                       \
+    size_t start = 0;                                                          \
+    while (true) {                                                             \
+      if (start < num_elements) {                                              \
+        size_t rest = num_elements - start;                                    \
+        size_t len = name##_run(base + start, rest);                           \
+        if (len < min_run) {                                                   \
+          size_t n = rest < min_run ? rest : min_run;                          \
+          name##_insertion_sort(base + start, len, n);                         \
+          len = n;                                                             \
+        }                                                                      \
+        runs[num_runs].start = start;                                          \
+        runs[num_runs].len = len;                                              \
+        num_runs++;                                                            \
+        start += len;                                                          \
+      }                                                                        \
+      /* keep len[i-2] > len[i-1] + len[i] and len[i-1] > len[i] for the       \
+         top four runs, or merge everything once the input is used up */       \
+      while (num_runs > 1) {                                                   \
+        size_t n = num_runs - 2;                                               \
+        ac_sort_stable_run_t *r = runs + n;                                    \
+        if (start >= num_elements) {                                           \
+          if (n > 0 && r[-1].len < r[1].len)                                   \
+            n--;                                                               \
+        } else if ((n > 0 && r[-1].len <= r[0].len + r[1].len) ||              \
+                   (n > 1 && r[-2].len <= r[-1].len + r[0].len)) {             \
+          if (r[-1].len < r[1].len)                                            \
+            n--;                                                               \
+        } else if (r[0].len > r[1].len)                                        \
+          break;                                                               \
+        name##_merge(base + runs[n].start, runs[n].len, runs[n + 1].len, buf); \
+        runs[n].len += runs[n + 1].len;                                        \
+        if (n + 2 < num_runs)                                                  \
+          runs[n + 1] = runs[n + 2];                                           \
+        num_runs--;                                                            \
+      }                                                                        \
+      if (start >= num_elements)                                               \
+        break;                                                                 \
+    }                                                                          \
+    ac_free(buf);                                                              \
+  }
+
+#define ac_sort_stable_m(name, type, compare)                                  \
+  static inline bool name##_less(type *a, type *b) {                           \
+    return compare(a, b) < 0;                                                  \
+  }                                                                            \
+  _ac_sort_stable_core_m(name, type)
+
+#define ac_sortl_stable_m(name, type, less)                                    \
+  static inline bool name##_less(type *a, type *b) { return less(a, b); }      \
+  _ac_sort_stable_core_m(name, type)
@@ -0,0 +1,217 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <string.h>
+
+/* galloping is used when one array is this many times larger than the other
+   (otherwise the arrays are merged) */
+#ifndef AC_SORTED_SET_GALLOP_RATIO
+#define AC_SORTED_SET_GALLOP_RATIO 32
+#endif
+
+#define ac_intersect_def(name, type)                                           \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b);
+
+#define ac_union_def(name, type)                                               \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b);
+
+#define ac_difference_def(name, type)                                          \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b);
+
+/* returns the index of the first element of base[lo, num_elements) which is
+   not less than key, searching exponentially outward from lo */
+#define _ac_sorted_set_gallop_m(name, type, compare)                           \
+  static inline size_t name##_gallop(type *key, type *base, size_t lo,         \
+                                     size_t num_elements) {                    \
+    if (lo >= num_elements || compare(base + lo, key) >= 0)                    \
+      return lo;                                                               \
+    size_t bound = 1;                                                          \
+    while (lo + bound < num_elements && compare(base + lo + bound, key) < 0) { \
+      lo += bound;                                                             \
+      bound <<= 1;                                                             \
+    }                                                                          \
+    size_t high = lo + bound;                                                  \
+    if (high > num_elements)                                                   \
+      high = num_elements;                                                     \
+    lo++;                                                                      \
+    while (lo < high) {                                                        \
+      size_t mid = lo + ((high - lo) >> 1);                                    \
+      if (compare(base + mid, key) < 0)                                        \
+        lo = mid + 1;                                                          \
+      else                                                                     \
+        high = mid;                                                            \
+    }                                                                          \
+    return lo;                                                                 \
+  }
+
+#define _ac_sorted_set_intersect_m(name, type, compare)                        \
+  static inline size_t name##_intersect(type *res, type *a, size_t num_a,      \
+                                        type *b, size_t num_b) {               \
+    size_t i = 0, j = 0, r = 0;                                                \
+    if (num_a * AC_SORTED_SET_GALLOP_RATIO < num_b) {                          \
+      for (; i < num_a; i++) {                                                 \
+        j = name##_gallop(a + i, b, j, num_b);                                 \
+        if (j == num_b)                                                        \
+          break;                                                               \
+        if (!compare(a + i, b + j)) {                                          \
+          res[r++] = a[i];                                                     \
+          j++;                                                                 \
+        }                                                                      \
+      }                                                                        \
+    } else if (num_b * AC_SORTED_SET_GALLOP_RATIO < num_a) {                   \
+      for (; j < num_b; j++) {                                                 \
+        i = name##_gallop(b + j, a, i, num_a);                                 \
+        if (i == num_a)                                                        \
+          break;                                                               \
+        if (!compare(a + i, b + j)) {                                          \
+          res[r++] = a[i];                                                     \
+          i++;                                                                 \
+        }                                                                      \
+      }                                                                        \
+    } else {                                                                   \
+      while (i < num_a && j < num_b) {                                         \
+        int n = compare(a + i, b + j);                                         \
+        if (n < 0)                                                             \
+          i++;                                                                 \
+        else if (n > 0)                                                        \
+          j++;                                                                 \
+        else {                                                                 \
+          res[r++] = a[i];                                                     \
+          i++;                                                                 \
+          j++;                                                                 \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    return r;                                                                  \
+  }
+
+#define _ac_sorted_set_union_m(name, type, compare)                            \
+  static inline size_t name##_union(type *res, type *a, size_t num_a, type *b, \
+                                    size_t num_b) {                            \
+    size_t i = 0, j = 0, r = 0, k;                                             \
+    if (num_a * AC_SORTED_SET_GALLOP_RATIO < num_b) {                          \
+      for (; i < num_a; i++) {                                                 \
+        k = name##_gallop(a + i, b, j, num_b);                                 \
+        memcpy(res + r, b + j, (k - j) * sizeof(type));                        \
+        r += k - j;                                                            \
+        j = k;                                                                 \
+        res[r++] = a[i];                                                       \
+        if (j < num_b && !compare(a + i, b + j))                               \
+          j++;                                                                 \
+      }                                                                        \
+    } else if (num_b * AC_SORTED_SET_GALLOP_RATIO < num_a) {                   \
+      for (; j < num_b; j++) {                                                 \
+        k = name##_gallop(b + j, a, i, num_a);                                 \
+        memcpy(res + r, a + i, (k - i) * sizeof(type));                        \
+        r += k - i;                                                            \
+        i = k;                                                                 \
+        if (i < num_a && !compare(a + i, b + j))                               \
+          res[r++] = a[i++];                                                   \
+        else                                                                   \
+          res[r++] = b[j];                                                     \
+      }                                                                        \
+    } else {                                                                   \
+      while (i < num_a && j < num_b) {                                         \
+        int n = compare(a + i, b + j);                                         \
+        if (n < 0)                                                             \
+          res[r++] = a[i++];                                                   \
+        else if (n > 0)                                                        \
+          res[r++] = b[j++];                                                   \
+        else {                                                                 \
+          res[r++] = a[i++];                                                   \
+          j++;                                                                 \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    memcpy(res + r, a + i, (num_a - i) * sizeof(type));                        \
+    r += num_a - i;                                                            \
+    memcpy(res + r, b + j, (num_b - j) * sizeof(type));                        \
+    r += num_b - j;                                                            \
+    return r;                                                                  \
+  }
+
+#define _ac_sorted_set_difference_m(name, type, compare)                       \
+  static inline size_t name##_difference(type *res, type *a, size_t num_a,     \
+                                         type *b, size_t num_b) {              \
+    size_t i = 0, j = 0, r = 0, k;                                             \
+    if (num_a * AC_SORTED_SET_GALLOP_RATIO < num_b) {                          \
+      for (; i < num_a; i++) {                                                 \
+        j = name##_gallop(a + i, b, j, num_b);                                 \
+        if (j < num_b && !compare(a + i, b + j))                               \
+          j++;                                                                 \
+        else                                                                   \
+          res[r++] = a[i];                                                     \
+      }                                                                        \
+    } else if (num_b * AC_SORTED_SET_GALLOP_RATIO < num_a) {                   \
+      for (; j < num_b; j++) {                                                 \
+        k = name##_gallop(b + j, a, i, num_a);                                 \
+        memcpy(res + r, a + i, (k - i) * sizeof(type));                        \
+        r += k - i;                                                            \
+        i = k;                                                                 \
+        if (i < num_a && !compare(a + i, b + j))                               \
+          i++;                                                                 \
+      }                                                                        \
+    } else {                                                                   \
+      while (i < num_a && j < num_b) {                                         \
+        int n = compare(a + i, b + j);                                         \
+        if (n < 0)                                                             \
+          res[r++] = a[i++];                                                   \
+        else if (n > 0)                                                        \
+          j++;                                                                 \
+        else {                                                                 \
+          i++;                                                                 \
+          j++;                                                                 \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    memcpy(res + r, a + i, (num_a - i) * sizeof(type));                        \
+    r += num_a - i;                                                            \
+    return r;                                                                  \
+  }
+
+#define ac_intersect_m(name, type, compare)                                    \
+  _ac_sorted_set_gallop_m(name, type, compare)                                 \
+  _ac_sorted_set_intersect_m(name, type, compare)                              \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b) {                                          \
+    size_t max = num_a < num_b ? num_a : num_b;                                \
+    type *res = (type *)ac_pool_alloc(pool, max * sizeof(type));               \
+    *num_res = name##_intersect(res, a, num_a, b, num_b);                      \
+    return res;                                                                \
+  }
+
+#define ac_union_m(name, type, compare)                                        \
+  _ac_sorted_set_gallop_m(name, type, compare)                                 \
+  _ac_sorted_set_union_m(name, type, compare)                                  \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b) {                                          \
+    type *res = (type *)ac_pool_alloc(pool, (num_a + num_b) * sizeof(type));   \
+    *num_res = name##_union(res, a, num_a, b, num_b);                          \
+    return res;                                                                \
+  }
+
+#define ac_difference_m(name, type, compare)                                   \
+  _ac_sorted_set_gallop_m(name, type, compare)                                 \
+  _ac_sorted_set_difference_m(name, type, compare)                             \
+  type *name(ac_pool_t *pool, size_t *num_res, type *a, size_t num_a,          \
+             type *b, size_t num_b) {                                          \
+    type *res = (type *)ac_pool_alloc(pool, num_a * sizeof(type));             \
+    *num_res = name##_difference(res, a, num_a, b, num_b);                     \
+    return res;                                                                \
+  }
@@ -162,10 +162,14 @@ limitations under the License.
   *(a) = *(b);                                                                 \
   *(b) = tmp
 
+/* shared with ac_sort.h and ac_sortl.h */
+#ifndef _ac_sort_stack_t_
+#define _ac_sort_stack_t_
 typedef struct {
   void *base;
   ssize_t num_elements;
 } sort_stack_t;
+#endif
 
 #define ac_sortl_def(name, type) void name(type *base, size_t num_elements);
 
@@ -180,828 +184,341 @@ typedef struct {
   void name(type *base, size_t num_elements,                                   \
             bool (*less)(datatype * a, datatype * b, void *arg), void *arg);
 
-#define ac_sortl_m(name, type, less)                                           \
-  void name(type *base, size_t num_elements) {                                 \
-    type *a;                                                                   \
-    type *b;                                                                   \
-    type *c;                                                                   \
-    type *d;                                                                   \
-    type *e;                                                                   \
-    type *mid;                                                                 \
-    type *high;                                                                \
-    type tmp;                                                                  \
-    ssize_t pivot;                                                             \
-    sort_stack_t stack[64];                                                    \
-    sort_stack_t *top = stack;                                                 \
-    top->base = NULL;                                                          \
-    top++;                                                                     \
-    if (num_elements > 12) {                                                   \
-      a = base;                                                                \
-      high = e = base + num_elements - 1;                                      \
-      pivot = num_elements >> 1;                                               \
-      c = a + pivot;                                                           \
-      if (less(e, a)) {                                                        \
-        b = a;                                                                 \
-        a = e;                                                                 \
-        e = b;                                                                 \
-        pivot >>= 1;                                                           \
-        b = c + pivot;                                                         \
-        d = e + pivot;                                                         \
-        pivot = -1;                                                            \
-      } else {                                                                 \
-        pivot >>= 1;                                                           \
-        b = a + pivot;                                                         \
-        d = c + pivot;                                                         \
-        pivot = 1;                                                             \
-      }                                                                        \
-                                                                               \
-      if (less(d, c)) {                                                        \
-        pivot = 0;                                                             \
-        if (less(e, d)) {                                                      \
-          sort_swap(c, e);                                                     \
-        } else {                                                               \
-          sort_swap(c, d);                                                     \
-        }                                                                      \
-      } else if (less(e, c)) {                                                 \
-        pivot = 0;                                                             \
-        sort_swap(c, e);                                                       \
-      }                                                                        \
-      if (less(c, a)) {                                                        \
-        pivot = 0;                                                             \
-        sort_swap(a, c);                                                       \
-        if (less(d, c)) {                                                      \
-          if (less(e, d)) {                                                    \
-            sort_swap(c, e);                                                   \
-          } else {                                                             \
-            sort_swap(c, d);                                                   \
-          }                                                                    \
-        } else if (less(e, c)) {                                               \
-          sort_swap(c, e);                                                     \
-        }                                                                      \
-      }                                                                        \
-      if (less(c, b)) {                                                        \
-        pivot = 0;                                                             \
-        sort_swap(b, c);                                                       \
-        if (less(d, c)) {                                                      \
-          if (less(e, d)) {                                                    \
-            sort_swap(c, e);                                                   \
-          } else {                                                             \
-            sort_swap(c, d);                                                   \
-          }                                                                    \
-        } else if (less(e, c)) {                                               \
-          sort_swap(c, e);                                                     \
-        }                                                                      \
-      }                                                                        \
-      if (!pivot || less(b, a) || less(c, b) || less(d, c) || less(e, a)) {    \
-        if (e < a) {                                                           \
-          mid = a;                                                             \
-          a = e;                                                               \
-          e = mid;                                                             \
-          mid = b;                                                             \
-          b = d;                                                               \
-          d = mid;                                                             \
-          sort_swap(a, e);                                                     \
-          sort_swap(b, d);                                                     \
-        }                                                                      \
-        sort_swap(b, a + 1);                                                   \
-        sort_swap(d, e - 1);                                                   \
-        b = a + 2;                                                             \
-        d = e - 2;                                                             \
-      } else {                                                                 \
-        if (pivot == 1) {                                                      \
-          mid = a + 1;                                                         \
-          while (a < e) {                                                      \
-            if (less(mid, a))                                                  \
-              break;                                                           \
-            a++;                                                               \
-            mid++;                                                             \
-          }                                                                    \
-          if (a >= e)                                                          \
-            return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (less(c, a)) {                                                  \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
-          a = base;                                                            \
-        } else {                                                               \
-          if (e < a) {                                                         \
-            mid = a;                                                           \
-            a = e;                                                             \
-            e = mid;                                                           \
-            mid = b;                                                           \
-            b = d;                                                             \
-            d = mid;                                                           \
-          }                                                                    \
-          mid = e - 1;                                                         \
-          high = e;                                                            \
-          while (mid > a) {                                                    \
-            if (less(mid, high))                                               \
-              break;                                                           \
-            high--;                                                            \
-            mid--;                                                             \
-          }                                                                    \
-          if (mid <= a) {                                                      \
-            while (a < e) {                                                    \
-              sort_swap(a, e);                                                 \
-              a++;                                                             \
-              e--;                                                             \
-            }                                                                  \
-            return;                                                            \
-          } else {                                                             \
-            sort_swap(a, e);                                                   \
-            sort_swap(b, d);                                                   \
-            sort_swap(b, a + 1);                                               \
-            sort_swap(d, e - 1);                                               \
-            b = a + 2;                                                         \
-            d = e - 2;                                                         \
-            high = e;                                                          \
-          }                                                                    \
-        }                                                                      \
-      }                                                                        \
-                                                                               \
-      e = c;                                                                   \
-      while (1) {                                                              \
-        while (less(b, c))                                                     \
-          b++;                                                                 \
-        while (less(c, d))                                                     \
-          d--;                                                                 \
-        if (b < d) {                                                           \
-          sort_swap(b, d);                                                     \
-          if (b == c)                                                          \
-            c = d;                                                             \
-          else if (d == c)                                                     \
-            c = b;                                                             \
-          b++;                                                                 \
-          d--;                                                                 \
-        } else                                                                 \
-          break;                                                               \
-      }                                                                        \
-      if (e != c) {                                                            \
-        if (c <= d) {                                                          \
-          sort_swap(c, d);                                                     \
-          pivot = d - a;                                                       \
-        } else {                                                               \
-          sort_swap(c, b);                                                     \
-          pivot = b - a;                                                       \
-        }                                                                      \
-      } else {                                                                 \
-        pivot = c - a;                                                         \
-      }                                                                        \
-      if ((pivot << 1) < num_elements) {                                       \
-        if (pivot == 0 && !(less(base, base + 1))) {                           \
-          a = base + 2;                                                        \
-          while (a <= high && !(less(base, a)))                                \
-            a++;                                                               \
-          num_elements -= (a - base);                                          \
-          base = a;                                                            \
-        } else {                                                               \
-          top->base = base + pivot + 1;                                        \
-          top->num_elements = num_elements - (pivot + 1);                      \
-          num_elements = pivot;                                                \
-          top++;                                                               \
-        }                                                                      \
-      } else {                                                                 \
-        top->base = base;                                                      \
-        top->num_elements = pivot;                                             \
-        base += pivot + 1;                                                     \
-        num_elements -= (pivot + 1);                                           \
-        top++;                                                                 \
-      }                                                                        \
-    }                                                                          \
-                                                                               \
-    while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
-        if (num_elements < 6) {                                                \
-          if (num_elements == 2) {                                             \
-            if (less(base + 1, base)) {                                        \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-          } else if (num_elements == 3) {                                      \
-            if (less(base + 1, base)) {                                        \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-            if (less(base + 2, base + 1)) {                                    \
-              sort_swap(base + 1, base + 2);                                   \
-              if (less(base + 1, base)) {                                      \
-                sort_swap(base, base + 1);                                     \
-              }                                                                \
-            }                                                                  \
-          } else if (num_elements == 4) {                                      \
-            if (less(base + 1, base)) {                                        \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-            if (less(base + 3, base + 2)) {                                    \
-              sort_swap(base + 2, base + 3);                                   \
-            }                                                                  \
-            if (less(base + 2, base)) {                                        \
-              if (less(base + 3, base)) {                                      \
-                sort_swap(base, base + 2);                                     \
-                sort_swap(base + 1, base + 3);                                 \
-              } else {                                                         \
-                sort_swap(base, base + 1);                                     \
-                sort_swap(base + 0, base + 2);                                 \
-                if (less(base + 3, base + 2)) {                                \
-                  sort_swap(base + 2, base + 3);                               \
-                }                                                              \
-              }                                                                \
-            } else {                                                           \
-              if (less(base + 2, base + 1)) {                                  \
-                sort_swap(base + 1, base + 2);                                 \
-                if (less(base + 3, base + 2)) {                                \
-                  sort_swap(base + 2, base + 3);                               \
-                }                                                              \
-              }                                                                \
-            }                                                                  \
-          } else if (num_elements == 5) {                                      \
-            a = base;                                                          \
-            b = a + 1;                                                         \
-            c = b + 1;                                                         \
-            d = c + 1;                                                         \
-            e = d + 1;                                                         \
-                                                                               \
-            if (less(d, c)) {                                                  \
-              pivot = 0;                                                       \
-              if (less(e, d)) {                                                \
-                sort_swap(c, e);                                               \
-              } else {                                                         \
-                sort_swap(c, d);                                               \
-              }                                                                \
-            } else if (less(e, c)) {                                           \
-              pivot = 0;                                                       \
-              sort_swap(c, e);                                                 \
-            }                                                                  \
-            if (less(c, a)) {                                                  \
-              pivot = 0;                                                       \
-              sort_swap(a, c);                                                 \
-              if (less(d, c)) {                                                \
-                if (less(e, d)) {                                              \
-                  sort_swap(c, e);                                             \
-                } else {                                                       \
-                  sort_swap(c, d);                                             \
-                }                                                              \
-              } else if (less(e, c)) {                                         \
-                sort_swap(c, e);                                               \
-              }                                                                \
-            }                                                                  \
-            if (less(c, b)) {                                                  \
-              pivot = 0;                                                       \
-              sort_swap(b, c);                                                 \
-              if (less(d, c)) {                                                \
-                if (less(e, d)) {                                              \
-                  sort_swap(c, e);                                             \
-                } else {                                                       \
-                  sort_swap(c, d);                                             \
-                }                                                              \
-              } else if (less(e, c)) {                                         \
-                sort_swap(c, e);                                               \
-              }                                                                \
-            }                                                                  \
-                                                                               \
-            if (less(b, a)) {                                                  \
-              sort_swap(a, b);                                                 \
-            }                                                                  \
-            if (less(e, d)) {                                                  \
-              sort_swap(d, e);                                                 \
-            }                                                                  \
-          }                                                                    \
-          top--;                                                               \
-          base = (type *)top->base;                                            \
-          if (!base)                                                           \
-            return;                                                            \
-          num_elements = top->num_elements;                                    \
-        } else {                                                               \
-          mid = base + (num_elements >> 1);                                    \
-          high = base + (num_elements - 1);                                    \
-          if (less(mid, base)) {                                               \
-            sort_swap(base, mid);                                              \
-          }                                                                    \
-          if (less(high, mid)) {                                               \
-            if (less(high, base)) {                                            \
-              sort_swap(base, high);                                           \
-            }                                                                  \
-          } else {                                                             \
-            sort_swap(mid, high);                                              \
-          }                                                                    \
-          a = b = base;                                                        \
-          while (a < high) {                                                   \
-            if (less(a, high)) {                                               \
-              sort_swap(a, b);                                                 \
-              b++;                                                             \
-            }                                                                  \
-            a++;                                                               \
-          }                                                                    \
-          sort_swap(b, high);                                                  \
-          pivot = b - base;                                                    \
-          if ((pivot << 1) < num_elements) {                                   \
-            if (pivot == 0 && !(less(base, base + 1))) {                       \
-              a = base + 2;                                                    \
-              while (a <= high && !(less(base, a)))                            \
-                a++;                                                           \
-              num_elements -= (a - base);                                      \
-              base = a;                                                        \
-            } else {                                                           \
-              top->base = base + pivot + 1;                                    \
-              top->num_elements = num_elements - (pivot + 1);                  \
-              num_elements = pivot;                                            \
-              top++;                                                           \
-            }                                                                  \
-          } else {                                                             \
-            top->base = base;                                                  \
-            top->num_elements = pivot;                                         \
-            base += pivot + 1;                                                 \
-            num_elements -= (pivot + 1);                                       \
-            top++;                                                             \
-          }                                                                    \
-        }                                                                      \
-      } else {                                                                 \
-        a = base;                                                              \
-        high = e = base + num_elements - 1;                                    \
-        pivot = num_elements >> 1;                                             \
-        c = a + pivot;                                                         \
-        if (less(c, a)) {                                                      \
-          sort_swap(c, a);                                                     \
-        }                                                                      \
-        if (less(e, c)) {                                                      \
-          sort_swap(e, c);                                                     \
-          if (less(c, a)) {                                                    \
-            sort_swap(c, a);                                                   \
-          }                                                                    \
-        }                                                                      \
-                                                                               \
-        b = a + 1;                                                             \
-        d = e - 1;                                                             \
-        e = c;                                                                 \
-        while (1) {                                                            \
-          while (less(b, c))                                                   \
-            b++;                                                               \
-          while (less(c, d))                                                   \
-            d--;                                                               \
-          if (b < d) {                                                         \
-            sort_swap(b, d);                                                   \
-            if (b == c)                                                        \
-              c = d;                                                           \
-            else if (d == c)                                                   \
-              c = b;                                                           \
-            b++;                                                               \
-            d--;                                                               \
-          } else                                                               \
-            break;                                                             \
-        }                                                                      \
-        if (e != c) {                                                          \
-          if (c <= d) {                                                        \
-            sort_swap(c, d);                                                   \
-            pivot = d - a;                                                     \
-          } else {                                                             \
-            sort_swap(c, b);                                                   \
-            pivot = b - a;                                                     \
-          }                                                                    \
-        } else {                                                               \
-          pivot = c - a;                                                       \
-        }                                                                      \
-        if ((pivot << 1) < num_elements) {                                     \
-          if (pivot == 0 && !(less(base, base + 1))) {                         \
-            a = base + 2;                                                      \
-            while (a <= high && !(less(base, a)))                              \
-              a++;                                                             \
-            num_elements -= (a - base);                                        \
-            base = a;                                                          \
-          } else {                                                             \
-            top->base = base + pivot + 1;                                      \
-            top->num_elements = num_elements - (pivot + 1);                    \
-            num_elements = pivot;                                              \
-            top++;                                                             \
-          }                                                                    \
-        } else {                                                               \
-          top->base = base;                                                    \
-          top->num_elements = pivot;                                           \
-          base += pivot + 1;                                                   \
-          num_elements -= (pivot + 1);                                         \
-          top++;                                                               \
-        }                                                                      \
-      }                                                                        \
-    }                                                                          \
-  }
-
-#define ac_sortl_arg_m(name, type, less)                                       \
-  void name(type *base, size_t num_elements, void *arg) {                      \
-    type *a;                                                                   \
-    type *b;                                                                   \
-    type *c;                                                                   \
-    type *d;                                                                   \
-    type *e;                                                                   \
-    type *mid;                                                                 \
-    type *high;                                                                \
-    type tmp;                                                                  \
-    ssize_t pivot;                                                             \
-    sort_stack_t stack[64];                                                    \
-    sort_stack_t *top = stack;                                                 \
-    top->base = NULL;                                                          \
-    top++;                                                                     \
-    if (num_elements > 12) {                                                   \
-      a = base;                                                                \
-      e = base + num_elements - 1;                                             \
-      pivot = num_elements >> 1;                                               \
-      c = a + pivot;                                                           \
-      if (less(e, a, arg)) {                                                   \
-        b = a;                                                                 \
-        a = e;                                                                 \
-        e = b;                                                                 \
-        pivot >>= 1;                                                           \
-        b = c + pivot;                                                         \
-        d = e + pivot;                                                         \
-        pivot = -1;                                                            \
-      } else {                                                                 \
-        pivot >>= 1;                                                           \
-        b = a + pivot;                                                         \
-        d = c + pivot;                                                         \
-        pivot = 1;                                                             \
-      }                                                                        \
-                                                                               \
-      if (less(d, c, arg)) {                                                   \
-        pivot = 0;                                                             \
-        if (less(e, d, arg)) {                                                 \
-          sort_swap(c, e);                                                     \
-        } else {                                                               \
-          sort_swap(c, d);                                                     \
-        }                                                                      \
-      } else if (less(e, c, arg)) {                                            \
-        pivot = 0;                                                             \
-        sort_swap(c, e);                                                       \
-      }                                                                        \
-      if (less(c, a, arg)) {                                                   \
-        pivot = 0;                                                             \
-        sort_swap(a, c);                                                       \
-        if (less(d, c, arg)) {                                                 \
-          if (less(e, d, arg)) {                                               \
-            sort_swap(c, e);                                                   \
-          } else {                                                             \
-            sort_swap(c, d);                                                   \
-          }                                                                    \
-        } else if (less(e, c, arg)) {                                          \
-          sort_swap(c, e);                                                     \
-        }                                                                      \
-      }                                                                        \
-      if (less(c, b, arg)) {                                                   \
-        pivot = 0;                                                             \
-        sort_swap(b, c);                                                       \
-        if (less(d, c, arg)) {                                                 \
-          if (less(e, d, arg)) {                                               \
-            sort_swap(c, e);                                                   \
-          } else {                                                             \
-            sort_swap(c, d);                                                   \
-          }                                                                    \
-        } else if (less(e, c, arg)) {                                          \
-          sort_swap(c, e);                                                     \
-        }                                                                      \
-      }                                                                        \
-                                                                               \
-      if (!pivot || less(b, a, arg) || less(c, b, arg) || less(d, c, arg) ||   \
-          less(e, a, arg)) {                                                   \
-        if (e < a) {                                                           \
-          mid = a;                                                             \
-          a = e;                                                               \
-          e = mid;                                                             \
-          mid = b;                                                             \
-          b = d;                                                               \
-          d = mid;                                                             \
-          sort_swap(a, e);                                                     \
-          sort_swap(b, d);                                                     \
-        }                                                                      \
-        sort_swap(b, a + 1);                                                   \
-        sort_swap(d, e - 1);                                                   \
-        b = a + 2;                                                             \
-        d = e - 2;                                                             \
-      } else {                                                                 \
-        if (pivot == 1) {                                                      \
-          mid = a + 1;                                                         \
-          while (a < e) {                                                      \
-            if (less(mid, a, arg))                                             \
-              break;                                                           \
-            a++;                                                               \
-            mid++;                                                             \
-          }                                                                    \
-          if (a >= e)                                                          \
-            return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (less(c, a, arg)) {                                             \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
-          a = base;                                                            \
-        } else {                                                               \
-          if (e < a) {                                                         \
-            mid = a;                                                           \
-            a = e;                                                             \
-            e = mid;                                                           \
-            mid = b;                                                           \
-            b = d;                                                             \
-            d = mid;                                                           \
-          }                                                                    \
-          mid = e - 1;                                                         \
-          high = e;                                                            \
-          while (mid > a) {                                                    \
-            if (less(mid, high, arg))                                          \
-              break;                                                           \
-            high--;                                                            \
-            mid--;                                                             \
-          }                                                                    \
-          if (mid <= a) {                                                      \
-            while (a < e) {                                                    \
-              sort_swap(a, e);                                                 \
-              a++;                                                             \
-              e--;                                                             \
-            }                                                                  \
-            return;                                                            \
-          } else {                                                             \
-            sort_swap(a, e);                                                   \
-            sort_swap(b, d);                                                   \
-            sort_swap(b, a + 1);                                               \
-            sort_swap(d, e - 1);                                               \
-            b = a + 2;                                                         \
-            d = e - 2;                                                         \
-          }                                                                    \
-        }                                                                      \
-      }                                                                        \
-                                                                               \
-      e = c;                                                                   \
-      while (1) {                                                              \
-        while (less(b, c, arg))                                                \
-          b++;                                                                 \
-        while (less(c, d, arg))                                                \
-          d--;                                                                 \
-        if (b < d) {                                                           \
-          sort_swap(b, d);                                                     \
-          if (b == c)                                                          \
-            c = d;                                                             \
-          else if (d == c)                                                     \
-            c = b;                                                             \
-          b++;                                                                 \
-          d--;                                                                 \
-        } else                                                                 \
-          break;                                                               \
-      }                                                                        \
-      if (e != c) {                                                            \
-        if (c <= d) {                                                          \
-          sort_swap(c, d);                                                     \
-          pivot = d - a;                                                       \
-        } else {                                                               \
-          sort_swap(c, b);                                                     \
-          pivot = b - a;                                                       \
-        }                                                                      \
-      } else {                                                                 \
-        pivot = c - a;                                                         \
-      }                                                                        \
-      if ((pivot << 1) < num_elements) {                                       \
-        if (pivot == 0 && !(less(base, base + 1, arg))) {                      \
-          a = base + 2;                                                        \
-          while (a <= high && !(less(base, a, arg)))                           \
-            a++;                                                               \
-          num_elements -= (a - base);                                          \
-          base = a;                                                            \
-        } else {                                                               \
-          top->base = base + pivot + 1;                                        \
-          top->num_elements = num_elements - (pivot + 1);                      \
-          num_elements = pivot;                                                \
-          top++;                                                               \
-        }                                                                      \
-      } else {                                                                 \
-        top->base = base;                                                      \
-        top->num_elements = pivot;                                             \
-        base += pivot + 1;                                                     \
-        num_elements -= (pivot + 1);                                           \
-        top++;                                                                 \
-      }                                                                        \
+#define AC_SORTL_BLOCK_SIZE 64
+
+/* expects name##_less(a, b, arg) */
+#define _ac_sortl_block_core_m(name, type)                                     \
+  static inline void name##_sort2(type *a, type *b, void *arg) {               \
+    if (name##_less(b, a, arg)) {                                              \
+      type tmp = *a;                                                           \
+      *a = *b;                                                                 \
+      *b = tmp;                                                                \
     }                                                                          \
+  }                                                                            \
                                                                                \
-    while (1) {                                                                \
-      if (num_elements < 40) {                                                 \
-        if (num_elements < 6) {                                                \
-          if (num_elements == 2) {                                             \
-            if (less(base + 1, base, arg)) {                                   \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-          } else if (num_elements == 3) {                                      \
-            if (less(base + 1, base, arg)) {                                   \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-            if (less(base + 2, base + 1, arg)) {                               \
-              sort_swap(base + 1, base + 2);                                   \
-              if (less(base + 1, base, arg)) {                                 \
-                sort_swap(base, base + 1);                                     \
-              }                                                                \
-            }                                                                  \
-          } else if (num_elements == 4) {                                      \
-            if (less(base + 1, base, arg)) {                                   \
-              sort_swap(base, base + 1);                                       \
-            }                                                                  \
-            if (less(base + 3, base + 2, arg)) {                               \
-              sort_swap(base + 2, base + 3);                                   \
-            }                                                                  \
-            if (less(base + 2, base, arg)) {                                   \
-              if (less(base + 3, base, arg)) {                                 \
-                sort_swap(base, base + 2);                                     \
-                sort_swap(base + 1, base + 3);                                 \
-              } else {                                                         \
-                sort_swap(base, base + 1);                                     \
-                sort_swap(base + 0, base + 2);                                 \
-                if (less(base + 3, base + 2, arg)) {                           \
-                  sort_swap(base + 2, base + 3);                               \
-                }                                                              \
-              }                                                                \
-            } else {                                                           \
-              if (less(base + 2, base + 1, arg)) {                             \
-                sort_swap(base + 1, base + 2);                                 \
-                if (less(base + 3, base + 2, arg)) {                           \
-                  sort_swap(base + 2, base + 3);                               \
-                }                                                              \
-              }                                                                \
-            }                                                                  \
-          } else if (num_elements == 5) {                                      \
-            a = base;                                                          \
-            b = a + 1;                                                         \
-            c = b + 1;                                                         \
-            d = c + 1;                                                         \
-            e = d + 1;                                                         \
+  static inline void name##_sort3(type *a, type *b, type *c, void *arg) {      \
+    name##_sort2(a, b, arg);                                                   \
+    name##_sort2(b, c, arg);                                                   \
+    name##_sort2(a, b, arg);                                                   \
+  }                                                                            \
                                                                                \
-            if (less(d, c, arg)) {                                             \
-              pivot = 0;                                                       \
-              if (less(e, d, arg)) {                                           \
-                sort_swap(c, e);                                               \
-              } else {                                                         \
-                sort_swap(c, d);                                               \
-              }                                                                \
-            } else if (less(e, c, arg)) {                                      \
-              pivot = 0;                                                       \
-              sort_swap(c, e);                                                 \
-            }                                                                  \
-            if (less(c, a, arg)) {                                             \
-              pivot = 0;                                                       \
-              sort_swap(a, c);                                                 \
-              if (less(d, c, arg)) {                                           \
-                if (less(e, d, arg)) {                                         \
-                  sort_swap(c, e);                                             \
-                } else {                                                       \
-                  sort_swap(c, d);                                             \
-                }                                                              \
-              } else if (less(e, c, arg)) {                                    \
-                sort_swap(c, e);                                               \
-              }                                                                \
-            }                                                                  \
-            if (less(c, b, arg)) {                                             \
-              pivot = 0;                                                       \
-              sort_swap(b, c);                                                 \
-              if (less(d, c, arg)) {                                           \
-                if (less(e, d, arg)) {                                         \
-                  sort_swap(c, e);                                             \
-                } else {                                                       \
-                  sort_swap(c, d);                                             \
-                }                                                              \
-              } else if (less(e, c, arg)) {                                    \
-                sort_swap(c, e);                                               \
-              }                                                                \
-            }                                                                  \
+  static inline void name##_swap(type *a, type *b) {                           \
+    type tmp = *a;                                                             \
+    *a = *b;                                                                   \
+    *b = tmp;                                                                  \
+  }                                                                            \
                                                                                \
-            if (less(b, a, arg)) {                                             \
-              sort_swap(a, b);                                                 \
-            }                                                                  \
-            if (less(e, d, arg)) {                                             \
-              sort_swap(d, e);                                                 \
-            }                                                                  \
-          }                                                                    \
-          top--;                                                               \
-          base = (type *)top->base;                                            \
-          if (!base)                                                           \
-            return;                                                            \
-          num_elements = top->num_elements;                                    \
-        } else {                                                               \
-          mid = base + (num_elements >> 1);                                    \
-          high = base + (num_elements - 1);                                    \
-          if (less(mid, base, arg)) {                                          \
-            sort_swap(base, mid);                                              \
-          }                                                                    \
-          if (less(high, mid, arg)) {                                          \
-            if (less(high, base, arg)) {                                       \
-              sort_swap(base, high);                                           \
-            }                                                                  \
-          } else {                                                             \
-            sort_swap(mid, high);                                              \
-          }                                                                    \
-          a = b = base;                                                        \
-          while (a < high) {                                                   \
-            if (less(a, high, arg)) {                                          \
-              sort_swap(a, b);                                                 \
-              b++;                                                             \
-            }                                                                  \
-            a++;                                                               \
-          }                                                                    \
-          sort_swap(b, high);                                                  \
-          pivot = b - base;                                                    \
+  /* when guarded is false, base[-1] must not be greater than any element */   \
+  static inline void name##_insertion_sort(type *base, type *end,              \
+                                           bool guarded, void *arg) {          \
+    type tmp;                                                                  \
+    for (type *p = base + 1; p < end; p++) {                                   \
+      type *hole = p;                                                          \
+      if (!name##_less(p, p - 1, arg))                                         \
+        continue;                                                              \
+      tmp = *p;                                                                \
+      do {                                                                     \
+        *hole = *(hole - 1);                                                   \
+        hole--;                                                                \
+      } while ((!guarded || hole > base) && name##_less(&tmp, hole - 1, arg)); \
+      *hole = tmp;                                                             \
+    }                                                                          \
+  }                                                                            \
                                                                                \
-          if ((pivot << 1) < num_elements) {                                   \
-            if (pivot == 0 && !(less(base, base + 1, arg))) {                  \
-              a = base + 2;                                                    \
-              while (a <= high && !(less(base, a, arg)))                       \
-                a++;                                                           \
-              num_elements -= (a - base);                                      \
-              base = a;                                                        \
-            } else {                                                           \
-              top->base = base + pivot + 1;                                    \
-              top->num_elements = num_elements - (pivot + 1);                  \
-              num_elements = pivot;                                            \
-              top++;                                                           \
-            }                                                                  \
-          } else {                                                             \
-            top->base = base;                                                  \
-            top->num_elements = pivot;                                         \
-            base += pivot + 1;                                                 \
-            num_elements -= (pivot + 1);                                       \
-            top++;                                                             \
-          }                                                                    \
+  /* insertion sort which gives up (returning false) after moving more than    \
+     eight elements */                                                         \
+  static inline bool name##_partial_insertion_sort(type *base, type *end,      \
+                                                   void *arg) {                \
+    type tmp;                                                                  \
+    size_t moved = 0;                                                          \
+    for (type *p = base + 1; p < end; p++) {                                   \
+      type *hole = p;                                                          \
+      if (!name##_less(p, p - 1, arg))                                         \
+        continue;                                                              \
+      tmp = *p;                                                                \
+      do {                                                                     \
+        *hole = *(hole - 1);                                                   \
+        hole--;                                                                \
+      } while (hole > base && name##_less(&tmp, hole - 1, arg));               \
+      *hole = tmp;                                                             \
+      moved += p - hole;                                                       \
+      if (moved > 8)                                                           \
+        return false;                                                          \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static void name##_heap_sort(type *base, size_t num_elements, void *arg) {   \
+    size_t i = num_elements >> 1;                                              \
+    while (true) {                                                             \
+      if (i > 0)                                                               \
+        i--;                                                                   \
+      else {                                                                   \
+        num_elements--;                                                        \
+        if (!num_elements)                                                     \
+          return;                                                              \
+        name##_swap(base, base + num_elements);                                \
+      }                                                                        \
+      size_t parent = i;                                                       \
+      size_t child = (parent << 1) + 1;                                        \
+      while (child < num_elements) {                                           \
+        if (child + 1 < num_elements &&                                        \
+            name##_less(base + child, base + child + 1, arg))                  \
+          child++;                                                             \
+        if (!name##_less(base + parent, base + child, arg))                    \
+          break;                                                               \
+        name##_swap(base + parent, base + child);                              \
+        parent = child;                                                        \
+        child = (parent << 1) + 1;                                             \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* moves the elements which are equal to the pivot (base[0]) to the left,    \
+     used when the element before base is equal to the pivot */                \
+  static inline type *name##_partition_left(type *base, type *end,             \
+                                            void *arg) {                       \
+    type pivot = *base;                                                        \
+    type *first = base;                                                        \
+    type *last = end;                                                          \
+    while (name##_less(&pivot, --last, arg))                                   \
+      ;                                                                        \
+    if (last + 1 == end)                                                       \
+      while (first < last && !name##_less(&pivot, ++first, arg))               \
+        ;                                                                      \
+    else                                                                       \
+      while (!name##_less(&pivot, ++first, arg))                               \
+        ;                                                                      \
+    while (first < last) {                                                     \
+      name##_swap(first, last);                                                \
+      while (name##_less(&pivot, --last, arg))                                 \
+        ;                                                                      \
+      while (!name##_less(&pivot, ++first, arg))                               \
+        ;                                                                      \
+    }                                                                          \
+    *base = *last;                                                             \
+    *last = pivot;                                                             \
+    return last;                                                               \
+  }                                                                            \
+                                                                               \
+  /* partitions around base[0] (elements equal to the pivot go right).  The    \
+     comparisons are recorded as offsets into blocks of                        \
+     AC_SORTL_BLOCK_SIZE elements instead of being branched on, and the        \
+     misplaced elements are then swapped in a second loop. */                  \
+  static inline type *name##_partition_right(type *base, type *end,            \
+                                             bool *already_partitioned,        \
+                                             void *arg) {                      \
+    type pivot = *base;                                                        \
+    type *first = base;                                                        \
+    type *last = end;                                                          \
+    type tmp;                                                                  \
+    /* the median selection guarantees an element which isn't less than        \
+       the pivot */                                                            \
+    while (name##_less(++first, &pivot, arg))                                  \
+      ;                                                                        \
+    if (first - 1 == base)                                                     \
+      while (first < last && !name##_less(--last, &pivot, arg))                \
+        ;                                                                      \
+    else                                                                       \
+      while (!name##_less(--last, &pivot, arg))                                \
+        ;                                                                      \
+    *already_partitioned = first >= last;                                      \
+    if (first < last) {                                                        \
+      name##_swap(first, last);                                                \
+      first++;                                                                 \
+      unsigned char offsets_l[AC_SORTL_BLOCK_SIZE];                            \
+      unsigned char offsets_r[AC_SORTL_BLOCK_SIZE];                            \
+      type *base_l = first;                                                    \
+      type *base_r = last;                                                     \
+      size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;                   \
+      while (first < last) {                                                   \
+        size_t unknown = last - first;                                         \
+        size_t split_l = num_l ? 0 : (num_r ? unknown : unknown >> 1);         \
+        size_t split_r = num_r ? 0 : unknown - split_l;                        \
+        if (split_l > AC_SORTL_BLOCK_SIZE)                                     \
+          split_l = AC_SORTL_BLOCK_SIZE;                                       \
+        if (split_r > AC_SORTL_BLOCK_SIZE)                                     \
+          split_r = AC_SORTL_BLOCK_SIZE;                                       \
+        for (size_t i = 0; i < split_l; i++) {                                 \
+          offsets_l[num_l] = i;                                                \
+          num_l += !name##_less(first, &pivot, arg);                           \
+          first++;                                                             \
         }                                                                      \
-      } else {                                                                 \
-        a = base;                                                              \
-        e = base + num_elements - 1;                                           \
-        pivot = num_elements >> 1;                                             \
-        c = a + pivot;                                                         \
-        if (less(c, a, arg)) {                                                 \
-          sort_swap(c, a);                                                     \
+        for (size_t i = 1; i <= split_r; i++) {                                \
+          offsets_r[num_r] = i;                                                \
+          num_r += name##_less(--last, &pivot, arg);                           \
         }                                                                      \
-        if (less(e, c, arg)) {                                                 \
-          sort_swap(e, c);                                                     \
-          if (less(c, a, arg)) {                                               \
-            sort_swap(c, a);                                                   \
+        size_t num = num_l < num_r ? num_l : num_r;                            \
+        if (num) {                                                             \
+          unsigned char *ol = offsets_l + start_l;                             \
+          unsigned char *or_ = offsets_r + start_r;                            \
+          type *l = base_l + ol[0];                                            \
+          type *r = base_r - or_[0];                                           \
+          tmp = *l;                                                            \
+          *l = *r;                                                             \
+          for (size_t i = 1; i < num; i++) {                                   \
+            l = base_l + ol[i];                                                \
+            *r = *l;                                                           \
+            r = base_r - or_[i];                                               \
+            *l = *r;                                                           \
           }                                                                    \
+          *r = tmp;                                                            \
+        }                                                                      \
+        num_l -= num;                                                          \
+        num_r -= num;                                                          \
+        start_l += num;                                                        \
+        start_r += num;                                                        \
+        if (!num_l) {                                                          \
+          start_l = 0;                                                         \
+          base_l = first;                                                      \
+        }                                                                      \
+        if (!num_r) {                                                          \
+          start_r = 0;                                                         \
+          base_r = last;                                                       \
+        }                                                                      \
+      }                                                                        \
+      if (num_l) {                                                             \
+        unsigned char *ol = offsets_l + start_l;                               \
+        while (num_l--)                                                        \
+          name##_swap(base_l + ol[num_l], --last);                             \
+        first = last;                                                          \
+      }                                                                        \
+      if (num_r) {                                                             \
+        unsigned char *or_ = offsets_r + start_r;                              \
+        while (num_r--) {                                                      \
+          name##_swap(base_r - or_[num_r], first);                             \
+          first++;                                                             \
         }                                                                      \
+        last = first;                                                          \
+      }                                                                        \
+    }                                                                          \
+    type *pivot_pos = first - 1;                                               \
+    *base = *pivot_pos;                                                        \
+    *pivot_pos = pivot;                                                        \
+    return pivot_pos;                                                          \
+  }                                                                            \
                                                                                \
-        b = a + 1;                                                             \
-        d = e - 1;                                                             \
-        e = c;                                                                 \
-        while (1) {                                                            \
-          while (less(b, c, arg))                                              \
-            b++;                                                               \
-          while (less(c, d, arg))                                              \
-            d--;                                                               \
-          if (b < d) {                                                         \
-            sort_swap(b, d);                                                   \
-            if (b == c)                                                        \
-              c = d;                                                           \
-            else if (d == c)                                                   \
-              c = b;                                                           \
-            b++;                                                               \
-            d--;                                                               \
-          } else                                                               \
-            break;                                                             \
+  static void name##_loop(type *base, type *end, int bad_allowed,              \
+                          bool leftmost, void *arg) {                          \
+    while (true) {                                                             \
+      size_t size = end - base;                                                \
+      if (size < AC_SORTL_INSERTION_CUTOFF) {                                  \
+        name##_insertion_sort(base, end, leftmost, arg);                       \
+        return;                                                                \
+      }                                                                        \
+      size_t s2 = size >> 1;                                                   \
+      if (size > AC_SORTL_NINTHER_CUTOFF) {                                    \
+        name##_sort3(base, base + s2, end - 1, arg);                           \
+        name##_sort3(base + 1, base + (s2 - 1), end - 2, arg);                 \
+        name##_sort3(base + 2, base + (s2 + 1), end - 3, arg);                 \
+        name##_sort3(base + (s2 - 1), base + s2, base + (s2 + 1), arg);        \
+        name##_swap(base, base + s2);                                          \
+      } else                                                                   \
+        name##_sort3(base + s2, base, end - 1, arg);                           \
+                                                                               \
+      if (!leftmost && !name##_less(base - 1, base, arg)) {                    \
+        base = name##_partition_left(base, end, arg) + 1;                      \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      bool already_partitioned;                                                \
+      type *pivot =                                                            \
+          name##_partition_right(base, end, &already_partitioned, arg);        \
+      size_t l_size = pivot - base;                                            \
+      size_t r_size = end - (pivot + 1);                                       \
+      if (l_size < (size >> 3) || r_size < (size >> 3)) {                      \
+        /* shuffle a few elements to break up patterns, give up on             \
+           quicksort if this keeps happening */                                \
+        if (--bad_allowed == 0) {                                              \
+          name##_heap_sort(base, size, arg);                                   \
+          return;                                                              \
         }                                                                      \
-        if (e != c) {                                                          \
-          if (c <= d) {                                                        \
-            sort_swap(c, d);                                                   \
-            pivot = d - a;                                                     \
-          } else {                                                             \
-            sort_swap(c, b);                                                   \
-            pivot = b - a;                                                     \
+        if (l_size >= AC_SORTL_INSERTION_CUTOFF) {                             \
+          size_t q = l_size >> 2;                                              \
+          name##_swap(base, base + q);                                         \
+          name##_swap(pivot - 1, pivot - q);                                   \
+          if (l_size > AC_SORTL_NINTHER_CUTOFF) {                              \
+            name##_swap(base + 1, base + (q + 1));                             \
+            name##_swap(base + 2, base + (q + 2));                             \
+            name##_swap(pivot - 2, pivot - (q + 1));                           \
+            name##_swap(pivot - 3, pivot - (q + 2));                           \
           }                                                                    \
-        } else {                                                               \
-          pivot = c - a;                                                       \
         }                                                                      \
-        if ((pivot << 1) < num_elements) {                                     \
-          if (pivot == 0 && !(less(base, base + 1, arg))) {                    \
-            a = base + 2;                                                      \
-            while (a <= high && !(less(base, a, arg)))                         \
-              a++;                                                             \
-            num_elements -= (a - base);                                        \
-            base = a;                                                          \
-          } else {                                                             \
-            top->base = base + pivot + 1;                                      \
-            top->num_elements = num_elements - (pivot + 1);                    \
-            num_elements = pivot;                                              \
-            top++;                                                             \
+        if (r_size >= AC_SORTL_INSERTION_CUTOFF) {                             \
+          size_t q = r_size >> 2;                                              \
+          name##_swap(pivot + 1, pivot + (1 + q));                             \
+          name##_swap(end - 1, end - q);                                       \
+          if (r_size > AC_SORTL_NINTHER_CUTOFF) {                              \
+            name##_swap(pivot + 2, pivot + (2 + q));                           \
+            name##_swap(pivot + 3, pivot + (3 + q));                           \
+            name##_swap(end - 2, end - (1 + q));                               \
+            name##_swap(end - 3, end - (2 + q));                               \
           }                                                                    \
-        } else {                                                               \
-          top->base = base;                                                    \
-          top->num_elements = pivot;                                           \
-          base += pivot + 1;                                                   \
-          num_elements -= (pivot + 1);                                         \
-          top++;                                                               \
         }                                                                      \
+      } else if (already_partitioned &&                                        \
+                 name##_partial_insertion_sort(base, pivot, arg) &&            \
+                 name##_partial_insertion_sort(pivot + 1, end, arg))           \
+        return;                                                                \
+                                                                               \
+      /* recurse into the smaller side so the stack stays O(log n) */          \
+      if (l_size < r_size) {                                                   \
+        name##_loop(base, pivot, bad_allowed, leftmost, arg);                  \
+        base = pivot + 1;                                                      \
+        leftmost = false;                                                      \
+      } else {                                                                 \
+        name##_loop(pivot + 1, end, bad_allowed, false, arg);                  \
+        end = pivot;                                                           \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_block_sort(type *base, size_t num_elements,        \
+                                       void *arg) {                            \
+    if (num_elements < 2)                                                      \
+      return;                                                                  \
+    /* sorted and reversed input are common enough to check for first */       \
+    type *p = base + 1;                                                        \
+    type *ep = base + num_elements;                                            \
+    while (p < ep && !name##_less(p, p - 1, arg))                              \
+      p++;                                                                     \
+    if (p == ep)                                                               \
+      return;                                                                  \
+    if (p == base + 1) {                                                       \
+      while (p < ep && !name##_less(p - 1, p, arg))                            \
+        p++;                                                                   \
+      if (p == ep) {                                                           \
+        for (p = base, ep--; p < ep; p++, ep--)                                \
+          name##_swap(p, ep);                                                  \
+        return;                                                                \
       }                                                                        \
     }                                                                          \
+    int bad_allowed = 1;                                                       \
+    while (num_elements >> bad_allowed)                                        \
+      bad_allowed++;                                                           \
+    name##_loop(base, base + num_elements, bad_allowed, true, arg);            \
+  }                                                                            \
+
+#define ac_sortl_m(name, type, less)                                           \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    (void)arg;                                                                 \
+    return less(a, b);                                                         \
+  }                                                                            \
+                                                                               \
+  _ac_sortl_block_core_m(name, type)                                           \
+                                                                               \
+  void name(type *base, size_t num_elements) {                                 \
+    name##_block_sort(base, num_elements, NULL);                               \
+  }
+
+#define ac_sortl_arg_m(name, type, less)                                       \
+  static inline bool name##_less(type *a, type *b, void *arg) {                \
+    return less(a, b, arg);                                                    \
+  }                                                                            \
+                                                                               \
+  _ac_sortl_block_core_m(name, type)                                           \
+                                                                               \
+  void name(type *base, size_t num_elements, void *arg) {                      \
+    name##_block_sort(base, num_elements, arg);                                \
   }
 
 #define ac_sortl_less_m(name, type)                                            \
@@ -1104,20 +621,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (less(c, a)) {                                                  \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
@@ -1518,20 +1028,13 @@ typedef struct {
           }                                                                    \
           if (a >= e)                                                          \
             return;                                                            \
-          sort_swap(a, mid);                                                   \
-          if (a < c) {                                                         \
-            if (less(c, a, arg)) {                                             \
-              sort_swap(c, a);                                                 \
-            }                                                                  \
-            sort_swap(d, e - 1);                                               \
-            b = a;                                                             \
-            d = e - 2;                                                         \
-          } else {                                                             \
-            c = a;                                                             \
-            d = e - 1;                                                         \
-            b = a - 1;                                                         \
-          }                                                                    \
+          /* the sorted prefix may hold elements which are greater             \
+             than the pivot, so partition the whole range */                   \
           a = base;                                                            \
+          sort_swap(b, a + 1);                                                 \
+          sort_swap(d, e - 1);                                                 \
+          b = a + 2;                                                           \
+          d = e - 2;                                                           \
         } else {                                                               \
           if (e < a) {                                                         \
             mid = a;                                                           \
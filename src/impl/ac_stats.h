@@ -0,0 +1,96 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+/* the slot of the calling thread plus one (0 until it has one) */
+extern __thread uint32_t _ac_stats_thread;
+
+uint32_t _ac_stats_thread_slot(void);
+
+struct ac_stats_metric_s;
+
+struct ac_stats_s {
+  /* the counters of each thread slot (the last is shared), allocated by the
+     thread when it first adds to a counter */
+  uint64_t *blocks[AC_STATS_MAX_THREADS + 1];
+  /* protects the registration and export of the metrics */
+  pthread_mutex_t mutex;
+  struct ac_stats_metric_s **metrics;
+  size_t num_metrics;
+  size_t max_metrics;
+  uint32_t num_counters;
+};
+
+struct ac_stats_counter_s {
+  ac_stats_t *stats;
+  uint32_t index;
+};
+
+struct ac_stats_gauge_s {
+  int64_t value;
+};
+
+struct ac_stats_histogram_s {
+  ac_histogram_t *threads[AC_STATS_MAX_THREADS + 1];
+  uint32_t sub_bucket_bits;
+};
+
+uint64_t *_ac_stats_block(ac_stats_t *s, uint32_t slot);
+ac_histogram_t *_ac_stats_thread_histogram(ac_stats_histogram_t *h,
+                                           uint32_t slot);
+
+static inline uint32_t _ac_stats_slot(void) {
+  uint32_t t = _ac_stats_thread;
+  return t ? t - 1 : _ac_stats_thread_slot();
+}
+
+static inline void ac_stats_add(ac_stats_counter_t *c, uint64_t v) {
+  uint32_t slot = _ac_stats_slot();
+  uint64_t *block = c->stats->blocks[slot];
+  if (!block)
+    block = _ac_stats_block(c->stats, slot);
+  uint64_t *p = block + c->index;
+  if (slot == AC_STATS_MAX_THREADS)
+    __atomic_add_fetch(p, v, __ATOMIC_RELAXED);
+  else
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v,
+                     __ATOMIC_RELAXED);
+}
+
+static inline void ac_stats_inc(ac_stats_counter_t *c) { ac_stats_add(c, 1); }
+
+static inline void ac_stats_gauge_set(ac_stats_gauge_t *g, int64_t v) {
+  __atomic_store_n(&g->value, v, __ATOMIC_RELAXED);
+}
+
+static inline void ac_stats_gauge_add(ac_stats_gauge_t *g, int64_t v) {
+  __atomic_add_fetch(&g->value, v, __ATOMIC_RELAXED);
+}
+
+static inline int64_t ac_stats_gauge_value(ac_stats_gauge_t *g) {
+  return __atomic_load_n(&g->value, __ATOMIC_RELAXED);
+}
+
+static inline void ac_stats_record(ac_stats_histogram_t *h, uint64_t value) {
+  uint32_t slot = _ac_stats_slot();
+  ac_histogram_t *t = __atomic_load_n(h->threads + slot, __ATOMIC_RELAXED);
+  if (!t)
+    t = _ac_stats_thread_histogram(h, slot);
+  if (slot == AC_STATS_MAX_THREADS)
+    ac_histogram_record_atomic(t, value);
+  else
+    ac_histogram_record(t, value);
+}
@@ -0,0 +1,48 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+static inline void ac_timer_wheel_node_init(ac_timer_wheel_node_t *n,
+                                            ac_timer_wheel_f cb) {
+  n->next = NULL;
+  n->pprev = NULL;
+  n->expires = 0;
+  n->cb = cb;
+}
+
+static inline void ac_timer_wheel_cancel(ac_timer_wheel_t *w,
+                                         ac_timer_wheel_node_t *n) {
+  if (!n->pprev)
+    return;
+  *n->pprev = n->next;
+  if (n->next)
+    n->next->pprev = n->pprev;
+  n->next = NULL;
+  n->pprev = NULL;
+  w->count--;
+}
+
+static inline bool ac_timer_wheel_pending(ac_timer_wheel_node_t *n) {
+  return n->pprev != NULL;
+}
+
+static inline uint64_t ac_timer_wheel_now(ac_timer_wheel_t *w) {
+  return w->now;
+}
+
+static inline size_t ac_timer_wheel_count(ac_timer_wheel_t *w) {
+  return w->count;
+}
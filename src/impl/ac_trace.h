@@ -0,0 +1,87 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(AC_TRACE_MONOTONIC)
+#include <x86intrin.h>
+#define _AC_TRACE_TSC
+#else
+#include <time.h>
+#endif
+
+typedef struct {
+  uint64_t ts;
+  const char *name;
+  uint64_t arg;
+  char phase;
+} ac_trace_event_t;
+
+typedef struct ac_trace_buffer_s {
+  ac_trace_event_t *events;
+  /* the number of events written (only written by the owning thread) */
+  uint64_t pos;
+  /* the pos of the last reset (only used by the dump) */
+  uint64_t start;
+  uint32_t tid;
+  const char *thread_name;
+  struct ac_trace_buffer_s *next;
+} ac_trace_buffer_t;
+
+extern __thread ac_trace_buffer_t *_ac_trace_buffer;
+extern bool _ac_trace_on;
+
+/* creates and registers the buffer for the current thread */
+ac_trace_buffer_t *_ac_trace_thread_buffer(void);
+
+static inline uint64_t _ac_trace_now(void) {
+#ifdef _AC_TRACE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void _ac_trace_write(char phase, const char *name,
+                                   uint64_t arg) {
+  if (!__atomic_load_n(&_ac_trace_on, __ATOMIC_RELAXED))
+    return;
+  ac_trace_buffer_t *b = _ac_trace_buffer;
+  if (!b)
+    b = _ac_trace_thread_buffer();
+  uint64_t pos = b->pos;
+  /* the slot must not be overwritten before the last pos is visible, as the
+     dump uses pos to find the slots which changed while they were copied
+     (this is only a compiler barrier on x86) */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ac_trace_event_t *e = b->events + (pos & (AC_TRACE_BUFFER_SIZE - 1));
+  e->ts = _ac_trace_now();
+  e->name = name;
+  e->arg = arg;
+  e->phase = phase;
+  __atomic_store_n(&b->pos, pos + 1, __ATOMIC_RELEASE);
+}
+
+static inline void _ac_trace_scope_end(const char **name) {
+  _ac_trace_write('E', *name, 0);
+}
+
+#define _AC_TRACE_SCOPE2(name, line)                                           \
+  const char *_ac_trace_scope_##line                                           \
+      __attribute__((cleanup(_ac_trace_scope_end))) =                          \
+          (_ac_trace_write('B', name, 0), name)
+#define _AC_TRACE_SCOPE(name, line) _AC_TRACE_SCOPE2(name, line)
@@ -0,0 +1,243 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the number of items in a node of type, at least 4 */
+#define _AC_ULIST_ITEMS(type)                                                  \
+  ((AC_ULIST_NODE_SIZE - 2 * sizeof(void *) - 8) / sizeof(type) < 4            \
+       ? 4                                                                     \
+       : (AC_ULIST_NODE_SIZE - 2 * sizeof(void *) - 8) / sizeof(type))
+
+#define ac_ulist_def(name, type)                                               \
+  enum { name##_node_items = _AC_ULIST_ITEMS(type) };                          \
+                                                                               \
+  /* the node's items are items[start..start+num) */                           \
+  typedef struct name##_node_s {                                               \
+    struct name##_node_s *next;                                                \
+    struct name##_node_s *prev;                                                \
+    uint32_t start;                                                            \
+    uint32_t num;                                                              \
+    type items[name##_node_items];                                             \
+  } name##_node_t;                                                             \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node_t *head;                                                       \
+    name##_node_t *tail;                                                       \
+    name##_node_t *free_nodes;                                                 \
+    size_t num;                                                                \
+    ac_pool_t *pool;                                                           \
+  } name##_t;                                                                  \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node_t *node;                                                       \
+    uint32_t i;                                                                \
+  } name##_iter_t;                                                             \
+                                                                               \
+  void name##_init(name##_t *h, ac_pool_t *pool);                              \
+  void name##_destroy(name##_t *h);                                            \
+  void name##_clear(name##_t *h);                                              \
+  name##_node_t *_##name##_add_back(name##_t *h);                              \
+  name##_node_t *_##name##_add_front(name##_t *h);                             \
+  void _##name##_release(name##_t *h, name##_node_t *n);                       \
+                                                                               \
+  static inline void name##_push_back(name##_t *h, type item) {                \
+    name##_node_t *n = h->tail;                                                \
+    if (ac_unlikely(!n || n->start + n->num == name##_node_items))             \
+      n = _##name##_add_back(h);                                               \
+    n->items[n->start + n->num++] = item;                                      \
+    h->num++;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_push_front(name##_t *h, type item) {               \
+    name##_node_t *n = h->head;                                                \
+    if (ac_unlikely(!n || !n->start))                                          \
+      n = _##name##_add_front(h);                                              \
+    n->items[--n->start] = item;                                               \
+    n->num++;                                                                  \
+    h->num++;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_pop_front(name##_t *h, type *item) {               \
+    name##_node_t *n = h->head;                                                \
+    if (!n)                                                                    \
+      return false;                                                            \
+    *item = n->items[n->start++];                                              \
+    h->num--;                                                                  \
+    if (!--n->num)                                                             \
+      _##name##_release(h, n);                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_pop_back(name##_t *h, type *item) {                \
+    name##_node_t *n = h->tail;                                                \
+    if (!n)                                                                    \
+      return false;                                                            \
+    *item = n->items[n->start + --n->num];                                     \
+    h->num--;                                                                  \
+    if (!n->num)                                                               \
+      _##name##_release(h, n);                                                 \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_front(name##_t *h) {                              \
+    return h->head ? h->head->items + h->head->start : NULL;                   \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_back(name##_t *h) {                               \
+    return h->tail ? h->tail->items + h->tail->start + h->tail->num - 1        \
+                   : NULL;                                                     \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_size(name##_t *h) { return h->num; }             \
+                                                                               \
+  static inline type *name##_first(name##_t *h, name##_iter_t *it) {           \
+    it->node = h->head;                                                        \
+    if (!it->node)                                                             \
+      return NULL;                                                             \
+    it->i = it->node->start;                                                   \
+    return it->node->items + it->i;                                            \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_next(name##_iter_t *it) {                         \
+    name##_node_t *n = it->node;                                               \
+    if (!n)                                                                    \
+      return NULL;                                                             \
+    if (ac_likely(++it->i < n->start + n->num))                                \
+      return n->items + it->i;                                                 \
+    it->node = n = n->next;                                                    \
+    if (!n)                                                                    \
+      return NULL;                                                             \
+    it->i = n->start;                                                          \
+    return n->items + it->i;                                                   \
+  }                                                                            \
+                                                                               \
+  /* the shorter side of the node moves over the erased item */                \
+  static inline type *name##_erase(name##_t *h, name##_iter_t *it) {           \
+    name##_node_t *n = it->node;                                               \
+    uint32_t i = it->i, end = n->start + n->num;                               \
+    if (i - n->start < end - i - 1) {                                          \
+      memmove(n->items + n->start + 1, n->items + n->start,                    \
+              (i - n->start) * sizeof(type));                                  \
+      n->start++;                                                              \
+      i++;                                                                     \
+    } else {                                                                   \
+      memmove(n->items + i, n->items + i + 1, (end - i - 1) * sizeof(type));   \
+    }                                                                          \
+    n->num--;                                                                  \
+    h->num--;                                                                  \
+    if (i < n->start + n->num) {                                               \
+      it->i = i;                                                               \
+      return n->items + i;                                                     \
+    }                                                                          \
+    name##_node_t *next = n->next;                                             \
+    if (!n->num)                                                               \
+      _##name##_release(h, n);                                                 \
+    it->node = next;                                                           \
+    if (!next)                                                                 \
+      return NULL;                                                             \
+    it->i = next->start;                                                       \
+    return next->items + it->i;                                                \
+  }
+
+#define ac_ulist_m(name, type)                                                 \
+  void name##_init(name##_t *h, ac_pool_t *pool) {                             \
+    h->head = h->tail = h->free_nodes = NULL;                                  \
+    h->num = 0;                                                                \
+    h->pool = pool;                                                            \
+  }                                                                            \
+                                                                               \
+  static void _##name##_free_nodes(name##_node_t *n) {                         \
+    while (n) {                                                                \
+      name##_node_t *next = n->next;                                           \
+      ac_free(n);                                                              \
+      n = next;                                                                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void name##_destroy(name##_t *h) {                                           \
+    if (!h->pool) {                                                            \
+      _##name##_free_nodes(h->head);                                           \
+      _##name##_free_nodes(h->free_nodes);                                     \
+    }                                                                          \
+    h->head = h->tail = h->free_nodes = NULL;                                  \
+    h->num = 0;                                                                \
+  }                                                                            \
+                                                                               \
+  void name##_clear(name##_t *h) {                                             \
+    if (h->tail) {                                                             \
+      h->tail->next = h->free_nodes;                                           \
+      h->free_nodes = h->head;                                                 \
+    }                                                                          \
+    h->head = h->tail = NULL;                                                  \
+    h->num = 0;                                                                \
+  }                                                                            \
+                                                                               \
+  static name##_node_t *_##name##_node(name##_t *h) {                          \
+    name##_node_t *n = h->free_nodes;                                          \
+    if (n)                                                                     \
+      h->free_nodes = n->next;                                                 \
+    else if (h->pool)                                                          \
+      n = (name##_node_t *)ac_pool_alloc(h->pool, sizeof(name##_node_t));      \
+    else {                                                                     \
+      n = (name##_node_t *)ac_malloc(sizeof(name##_node_t));                   \
+      if (!n)                                                                  \
+        abort();                                                               \
+    }                                                                          \
+    n->num = 0;                                                                \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  name##_node_t *_##name##_add_back(name##_t *h) {                             \
+    name##_node_t *n = _##name##_node(h);                                      \
+    n->start = 0;                                                              \
+    n->next = NULL;                                                            \
+    n->prev = h->tail;                                                         \
+    if (h->tail)                                                               \
+      h->tail->next = n;                                                       \
+    else                                                                       \
+      h->head = n;                                                             \
+    h->tail = n;                                                               \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  name##_node_t *_##name##_add_front(name##_t *h) {                            \
+    name##_node_t *n = _##name##_node(h);                                      \
+    n->start = name##_node_items;                                              \
+    n->prev = NULL;                                                            \
+    n->next = h->head;                                                         \
+    if (h->head)                                                               \
+      h->head->prev = n;                                                       \
+    else                                                                       \
+      h->tail = n;                                                             \
+    h->head = n;                                                               \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  void _##name##_release(name##_t *h, name##_node_t *n) {                      \
+    if (n->prev)                                                               \
+      n->prev->next = n->next;                                                 \
+    else                                                                       \
+      h->head = n->next;                                                       \
+    if (n->next)                                                               \
+      n->next->prev = n->prev;                                                 \
+    else                                                                       \
+      h->tail = n->prev;                                                       \
+    n->next = h->free_nodes;                                                   \
+    h->free_nodes = n;                                                         \
+  }
@@ -0,0 +1,117 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ac_vector_def(name, type)                                              \
+  typedef struct {                                                             \
+    type *base;                                                                \
+    size_t num;                                                                \
+    size_t size;                                                               \
+    ac_pool_t *pool;                                                           \
+  } name##_t;                                                                  \
+                                                                               \
+  void name##_init(name##_t *h, ac_pool_t *pool, size_t size);                 \
+  void name##_destroy(name##_t *h);                                            \
+  void name##_reserve(name##_t *h, size_t size);                               \
+  void _##name##_grow(name##_t *h, size_t n);                                  \
+                                                                               \
+  static inline type *name##_append(name##_t *h, size_t n) {                   \
+    if (h->num + n > h->size)                                                  \
+      _##name##_grow(h, n);                                                    \
+    type *r = h->base + h->num;                                                \
+    h->num += n;                                                               \
+    return r;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_push(name##_t *h, type item) {                     \
+    if (h->num == h->size)                                                     \
+      _##name##_grow(h, 1);                                                    \
+    h->base[h->num++] = item;                                                  \
+  }                                                                            \
+                                                                               \
+  static inline type *name##_pop(name##_t *h) {                                \
+    return h->num ? h->base + (--h->num) : NULL;                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##_resize(name##_t *h, size_t num) {                  \
+    if (num > h->size)                                                         \
+      name##_reserve(h, num);                                                  \
+    h->num = num;                                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_clear(name##_t *h) { h->num = 0; }                 \
+  static inline size_t name##_size(name##_t *h) { return h->num; }
+
+#define ac_vector_m(name, type)                                                \
+  void name##_init(name##_t *h, ac_pool_t *pool, size_t size) {                \
+    h->base = NULL;                                                            \
+    h->num = 0;                                                                \
+    h->size = 0;                                                               \
+    h->pool = pool;                                                            \
+    if (size)                                                                  \
+      name##_reserve(h, size);                                                 \
+  }                                                                            \
+                                                                               \
+  void name##_destroy(name##_t *h) {                                           \
+    if (!h->pool && h->base)                                                   \
+      ac_free(h->base);                                                        \
+    h->base = NULL;                                                            \
+    h->num = h->size = 0;                                                      \
+  }                                                                            \
+                                                                               \
+  void name##_reserve(name##_t *h, size_t size) {                              \
+    if (size <= h->size)                                                       \
+      return;                                                                  \
+    if (!h->pool) {                                                            \
+      h->base = (type *)ac_realloc(h->base, size * sizeof(type));              \
+      if (!h->base)                                                            \
+        abort();                                                               \
+    } else if (!h->base || !ac_pool_extend(h->pool, h->base,                   \
+                                           h->size * sizeof(type),             \
+                                           size * sizeof(type))) {             \
+      type *base = (type *)ac_pool_alloc(h->pool, size * sizeof(type));        \
+      if (h->num)                                                              \
+        memcpy(base, h->base, h->num * sizeof(type));                          \
+      h->base = base;                                                          \
+    }                                                                          \
+    h->size = size;                                                            \
+  }                                                                            \
+                                                                               \
+  void _##name##_grow(name##_t *h, size_t n) {                                 \
+    size_t size = h->size ? h->size * 2 : 8;                                   \
+    if (size < h->num + n)                                                     \
+      size = h->num + n;                                                       \
+    name##_reserve(h, size);                                                   \
+  }
+
+#define ac_vector_sort_m(name, type, compare)                                  \
+  static ac_sort_m(_##name##_sort, type, compare)                              \
+  static inline void name##_sort(name##_t *h) {                                \
+    _##name##_sort(h->base, h->num);                                           \
+  }
+
+#define ac_vector_search_m(name, keytype, type, compare)                       \
+  static ac_search_m(_##name##_search, keytype, type, compare)                 \
+  static ac_search_lower_bound_m(_##name##_lower_bound, keytype, type,         \
+                                 compare)                                      \
+  static inline type *name##_search(name##_t *h, keytype *key) {               \
+    return _##name##_search(key, h->base, h->num);                             \
+  }                                                                            \
+  static inline type *name##_lower_bound(name##_t *h, keytype *key) {          \
+    return _##name##_lower_bound(key, h->base, h->num);                        \
+  }
@@ -0,0 +1,125 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+static void expect(const char *name, ac_buffer_t *bh, const char *expected) {
+  if (strcmp(ac_buffer_data(bh), expected) ||
+      ac_buffer_length(bh) != strlen(expected)) {
+    printf("%s: \"%s\" != \"%s\"\n", name, ac_buffer_data(bh), expected);
+    failures++;
+  }
+}
+
+static void replace(const char *name, const char *s, const char *from,
+                    const char *to, const char *expected) {
+  /* a small buffer so that a longer result moves the data */
+  ac_buffer_t *bh = ac_buffer_init(4);
+  ac_buffer_sets(bh, s);
+  ac_buffer_replace_all(bh, from, strlen(from), to, strlen(to));
+  expect(name, bh, expected);
+  ac_buffer_destroy(bh);
+}
+
+static void test_replace_all(void) {
+  replace("shorter", "a--b--c", "--", "-", "a-b-c");
+  replace("longer", "a-b-c", "-", "---", "a---b---c");
+  replace("same length", "abab", "ab", "xy", "xyxy");
+  replace("removed", "xaxbx", "x", "", "ab");
+  replace("no match", "abc", "d", "e", "abc");
+  replace("non overlapping", "aaaa", "aa", "b", "bb");
+  replace("at the ends", "xabx", "x", "yy", "yyabyy");
+
+  /* to and from in the buffer itself */
+  ac_buffer_t *bh = ac_buffer_init(4);
+  ac_buffer_sets(bh, "abXcdXef");
+  ac_buffer_replace_all(bh, "X", 1, ac_buffer_data(bh), 8);
+  expect("to is the buffer (longer)", bh, "ababXcdXefcdabXcdXefef");
+  ac_buffer_sets(bh, "abXXcdXX");
+  ac_buffer_replace_all(bh, ac_buffer_data(bh) + 2, 2, ac_buffer_data(bh), 1);
+  expect("from and to are the buffer (shorter)", bh, "abacda");
+  ac_buffer_destroy(bh);
+
+  /* the buffer has room, so to is overwritten as the bytes move unless it
+     is copied first */
+  bh = ac_buffer_init(64);
+  ac_buffer_sets(bh, "aXbc");
+  ac_buffer_replace_all(bh, "X", 1, ac_buffer_data(bh) + 2, 2);
+  expect("to is the end of the buffer", bh, "abcbc");
+  ac_buffer_destroy(bh);
+}
+
+static void escape(const char *name, ac_escape_t kind, const char *s,
+                   const char *expected) {
+  size_t length = strlen(s);
+  ac_buffer_t *bh = ac_buffer_init(4);
+  ac_buffer_append_escaped(bh, kind, s, length);
+  expect(name, bh, expected);
+  /* the alias is the same function */
+  if (kind == AC_ESCAPE_JSON) {
+    ac_buffer_clear(bh);
+    ac_buffer_append_escaped_json(bh, s, length);
+    expect(name, bh, expected);
+  }
+  ac_buffer_destroy(bh);
+}
+
+static void test_escaped(void) {
+  escape("json", AC_ESCAPE_JSON, "a\"b\\c\n\x01", "a\\\"b\\\\c\\n\\u0001");
+  /* the escapes are past the first 16 bytes */
+  escape("json runs", AC_ESCAPE_JSON, "0123456789abcdef0123\t\"",
+         "0123456789abcdef0123\\t\\\"");
+  escape("html", AC_ESCAPE_HTML, "<a href='x'>&\"</a>",
+         "&lt;a href=&#39;x&#39;&gt;&amp;&quot;&lt;/a&gt;");
+  escape("csv plain", AC_ESCAPE_CSV, "abc", "abc");
+  escape("csv quoted", AC_ESCAPE_CSV, "a,\"b\"", "\"a,\"\"b\"\"\"");
+}
+
+/* appending nothing to read only attached memory must copy it before the
+   terminator is written */
+static void test_attached(void) {
+  static const char ro[] = "abc";
+  ac_buffer_t *bh = ac_buffer_init(4);
+  ac_buffer_attach(bh, ro, 0, NULL, NULL);
+  ac_buffer_appends(bh, "");
+  expect("empty append to attached", bh, "");
+  ac_buffer_attach(bh, ro, 2, NULL, NULL);
+  ac_buffer_append_alloc(bh, 0);
+  expect("empty append_alloc to attached", bh, "ab");
+  if (ac_buffer_attached(bh) || strcmp(ro, "abc")) {
+    printf("attached memory was written\n");
+    failures++;
+  }
+  ac_buffer_destroy(bh);
+}
+
+int main(int argc, char *argv[]) {
+  test_replace_all();
+  test_attached();
+  test_escaped();
+  if (failures) {
+    printf("test_buffer: %d failures\n", failures);
+    return 1;
+  }
+  printf("test_buffer passed\n");
+  return 0;
+}
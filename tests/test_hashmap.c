@@ -0,0 +1,159 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_hashmap.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  uint64_t key;
+} item_t;
+
+static inline size_t hash_key(const uint64_t *k) {
+  uint64_t h = *k;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+static inline bool equal_key(const uint64_t *k, const item_t *d) {
+  return d->key == *k;
+}
+
+ac_hashmap_def(test_map, uint64_t, item_t);
+ac_hashmap_m(test_map, uint64_t, item_t, hash_key, equal_key);
+
+#define check(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+/* every item must be returned by name_next exactly once */
+static void check_iteration(test_map_t *h, item_t *items, size_t num_items) {
+  size_t count = 0;
+  size_t pos = 0;
+  item_t *d;
+  while ((d = test_map_next(h, &pos)) != NULL) {
+    check(!(d->key & (1ULL << 63)));
+    d->key |= 1ULL << 63; /* seen */
+    count++;
+  }
+  for (size_t i = 0; i < num_items; i++)
+    items[i].key &= ~(1ULL << 63);
+  check(count == test_map_size(h));
+}
+
+/* insert until the map starts to grow from a table which is big enough that
+   the old table stays around for several inserts or erases */
+static size_t fill_until_migrating(test_map_t *h, item_t *items,
+                                   size_t num_items) {
+  size_t n = 0;
+  while (n < num_items &&
+         (!h->old.ctrl || h->old.capacity < 4 * AC_HASHMAP_MIGRATE_SLOTS)) {
+    items[n].key = n;
+    check(test_map_insert(h, &items[n].key, items + n) == NULL);
+    n++;
+  }
+  check(h->old.ctrl != NULL);
+  return n;
+}
+
+static void test_erase_while_migrating(ac_pool_t *pool) {
+  size_t num_items = 10000;
+  item_t *items = (item_t *)ac_malloc(num_items * sizeof(item_t));
+  test_map_t h;
+  test_map_init(&h, pool, 0);
+  size_t n = fill_until_migrating(&h, items, num_items);
+  check_iteration(&h, items, n);
+
+  /* each erase moves part of the old table, erase everything (keys which
+     have already moved and keys which haven't) */
+  for (size_t i = 0; i < n; i++) {
+    uint64_t key = i;
+    check(test_map_erase(&h, &key) == items + i);
+    check(test_map_find(&h, &key) == NULL);
+    check(test_map_erase(&h, &key) == NULL);
+    check(test_map_size(&h) == n - i - 1);
+    if ((i & 15) == 0)
+      check_iteration(&h, items, n);
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint64_t key = i;
+    check(test_map_find(&h, &key) == NULL);
+  }
+  size_t pos = 0;
+  check(test_map_next(&h, &pos) == NULL);
+  test_map_destroy(&h);
+  ac_free(items);
+}
+
+static void test_insert_while_migrating(ac_pool_t *pool) {
+  size_t num_items = 100000;
+  item_t *items = (item_t *)ac_malloc(num_items * sizeof(item_t));
+  test_map_t h;
+  test_map_init(&h, pool, 0);
+  size_t n = fill_until_migrating(&h, items, num_items);
+
+  /* a key which is still in the old table must not be inserted again */
+  for (size_t i = 0; i < n; i++) {
+    uint64_t key = i;
+    check(test_map_insert(&h, &key, items + i) == items + i);
+  }
+  check(test_map_size(&h) == n);
+
+  /* keep inserting (through several resizes), erasing a key for every third
+     insert */
+  size_t first = n;
+  for (; n < num_items; n++) {
+    items[n].key = n;
+    check(test_map_insert(&h, &items[n].key, items + n) == NULL);
+    if (n % 3 == 0) {
+      uint64_t key = n / 3;
+      check(test_map_erase(&h, &key) == items + key);
+    }
+    if ((n & 1023) == 0)
+      check_iteration(&h, items, n + 1);
+  }
+  size_t expected = 0;
+  for (size_t i = 0; i < num_items; i++) {
+    uint64_t key = i;
+    bool erased = i * 3 >= first && i * 3 < num_items;
+    check(test_map_find(&h, &key) == (erased ? NULL : items + i));
+    if (!erased)
+      expected++;
+  }
+  check(test_map_size(&h) == expected);
+  check_iteration(&h, items, num_items);
+  test_map_destroy(&h);
+  ac_free(items);
+}
+
+int main(int argc, char *argv[]) {
+  ac_pool_t *pool = ac_pool_init(1024);
+  test_erase_while_migrating(NULL);
+  test_erase_while_migrating(pool);
+  test_insert_while_migrating(NULL);
+  test_insert_while_migrating(pool);
+  ac_pool_destroy(pool);
+  printf("test_hashmap passed\n");
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* The same requests are given to the builtin parser (test_http) and llhttp
+   (test_http_llhttp, built with LLHTTP_FLAGS), so a request which one of
+   them rejects and the other accepts fails one of the two programs. */
+
+#include "ac_buffer.h"
+#include "ac_http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  int requests;
+  int errors;
+  ac_buffer_t *body;
+} result_t;
+
+static void on_headers(ac_http_t *p) {}
+
+static void on_end(ac_http_t *p, const char *data, size_t length) {
+  result_t *r = (result_t *)ac_http_get_arg(p);
+  r->requests++;
+  ac_buffer_append(r->body, data, length);
+  ac_buffer_appendc(r->body, '|');
+}
+
+static void on_error(ac_http_t *p) {
+  result_t *r = (result_t *)ac_http_get_arg(p);
+  r->errors++;
+}
+
+static int failures = 0;
+
+/* parses the request in pieces of step bytes (0 for all at once) */
+static void parse(ac_http_group_t *g, result_t *r, const char *request,
+                  size_t step) {
+  ac_http_t *p = ac_http_init(g);
+  ac_http_set_arg(p, r);
+  r->requests = r->errors = 0;
+  ac_buffer_clear(r->body);
+  size_t length = strlen(request);
+  if (!step)
+    step = length;
+  for (size_t i = 0; i < length; i += step)
+    ac_http_parse(p, request + i, i + step > length ? length - i : step);
+  ac_http_release(p);
+}
+
+/* body is what the end callbacks saw ("a|b|" for two requests with bodies a
+   and b), NULL if the request must go to the error callback */
+static void expect(ac_http_group_t *g, const char *name, const char *request,
+                   const char *body) {
+  result_t r;
+  r.body = ac_buffer_init(256);
+  size_t steps[] = {0, 1, 2, 3, 7};
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    parse(g, &r, request, steps[i]);
+    bool ok = body ? (r.errors == 0 && !strcmp(ac_buffer_data(r.body), body))
+                   : (r.errors == 1);
+    if (!ok) {
+      printf("%s (%zu bytes at a time): %d requests, %d errors, body "
+             "\"%s\"\n",
+             name, steps[i], r.requests, r.errors, ac_buffer_data(r.body));
+      failures++;
+      break;
+    }
+  }
+  ac_buffer_destroy(r.body);
+}
+
+int main(int argc, char *argv[]) {
+  ac_http_group_t *g = ac_http_group_init(on_headers, NULL, on_end, on_error);
+
+  expect(g, "content length",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", "hello|");
+  expect(g, "chunked",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n",
+         "hello world|");
+  expect(g, "many headers",
+         "POST / HTTP/1.1\r\nContent-Length: 2\r\nA: 1\r\nB: 2\r\nC: 3\r\n"
+         "D: 4\r\nE: 5\r\nF: 6\r\nG: 7\r\nH: 8\r\nI: 9\r\nJ: 10\r\n"
+         "K: 11\r\nL: 12\r\nM: 13\r\nN: 14\r\nO: 15\r\nP: 16\r\n"
+         "Q: 17\r\n\r\nok",
+         "ok|");
+  expect(g, "pipelined",
+         "GET /a HTTP/1.1\r\n\r\n"
+         "POST /b HTTP/1.1\r\nContent-Length: 1\r\n\r\nx"
+         "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "1\r\ny\r\n0\r\n\r\n",
+         "|x|y|");
+
+  expect(g, "repeated content length",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n"
+         "hello",
+         NULL);
+  expect(g, "different content lengths",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n"
+         "hello!",
+         NULL);
+  expect(g, "signed content length",
+         "POST / HTTP/1.1\r\nContent-Length: +5\r\n\r\nhello", NULL);
+  expect(g, "content length and transfer encoding",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+         "Transfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n",
+         NULL);
+  expect(g, "transfer encoding and content length",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+         "Content-Length: 5\r\n\r\n5\r\nhello\r\n0\r\n\r\n",
+         NULL);
+  expect(g, "chunked isn't the last coding",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"
+         "5\r\nhello\r\n0\r\n\r\n",
+         NULL);
+  expect(g, "chunked isn't the last transfer encoding",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+         "Transfer-Encoding: gzip\r\n\r\n5\r\nhello\r\n0\r\n\r\n",
+         NULL);
+  expect(g, "space before colon",
+         "POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\nhello", NULL);
+  expect(g, "tab before colon",
+         "GET / HTTP/1.1\r\nHost\t: example.com\r\n\r\n", NULL);
+  expect(g, "no crlf after chunk",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "5\r\nhelloXY0\r\n\r\n",
+         NULL);
+  expect(g, "half a crlf after chunk",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "5\r\nhello\rX0\r\n\r\n",
+         NULL);
+  expect(g, "bad chunk size",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "5g\r\nhello\r\n0\r\n\r\n",
+         NULL);
+
+  ac_http_group_destroy(g);
+  if (failures) {
+    printf("%s: %d failures\n", argv[0], failures);
+    return 1;
+  }
+  printf("%s passed\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,179 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_logstore.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define check(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+static void remove_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *ent;
+  char path[4096];
+  while ((ent = readdir(d)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+static void put_key(ac_logstore_t *h, size_t i, size_t version) {
+  char key[32], value[64];
+  int key_length = snprintf(key, sizeof(key), "key-%zu", i);
+  int value_length =
+      snprintf(value, sizeof(value), "value-%zu-%zu", i, version);
+  ac_logstore_put(h, key, key_length, value, value_length, false);
+}
+
+/* checks key i has the given version (or is gone if version is 0) */
+static void check_key(ac_logstore_t *h, ac_pool_t *pool, size_t i,
+                      size_t version) {
+  char key[32], value[64];
+  int key_length = snprintf(key, sizeof(key), "key-%zu", i);
+  size_t length = 0;
+  char *r = (char *)ac_logstore_get(h, pool, key, key_length, &length);
+  if (!version) {
+    check(r == NULL);
+    return;
+  }
+  snprintf(value, sizeof(value), "value-%zu-%zu", i, version);
+  check(r != NULL);
+  check(length == strlen(value) && !strcmp(r, value));
+}
+
+static bool erase_key(ac_logstore_t *h, size_t i) {
+  char key[32];
+  int key_length = snprintf(key, sizeof(key), "key-%zu", i);
+  return ac_logstore_erase(h, key, key_length, false);
+}
+
+/* The index grows from 256 to 512 slots at the 225th key (and to 1024 at
+   the 449th) and each later insert or erase only moves 64 of the old slots,
+   so with 226 or 450 keys the store is closed (and the erases start) while
+   the index still has its old table. */
+static void test_keys(const char *dir, ac_pool_t *pool, size_t num_keys) {
+  ac_logstore_t *h = ac_logstore_open(dir);
+  check(h != NULL);
+  for (size_t i = 0; i < num_keys; i++)
+    put_key(h, i, 1);
+  check(ac_logstore_count(h) == num_keys);
+  ac_logstore_close(h);
+
+  h = ac_logstore_open(dir);
+  check(h != NULL);
+  check(ac_logstore_count(h) == num_keys);
+  /* update the even keys and erase the odd ones */
+  for (size_t i = 0; i < num_keys; i++) {
+    if (i & 1)
+      check(erase_key(h, i));
+    else
+      put_key(h, i, 2);
+  }
+  for (size_t i = 0; i < num_keys; i++) {
+    check_key(h, pool, i, (i & 1) ? 0 : 2);
+    if (i & 1)
+      check(!erase_key(h, i));
+  }
+  check(ac_logstore_count(h) == (num_keys + 1) / 2);
+  ac_pool_clear(pool);
+  ac_logstore_close(h);
+
+  h = ac_logstore_open(dir);
+  check(h != NULL);
+  check(ac_logstore_count(h) == (num_keys + 1) / 2);
+  for (size_t i = 0; i < num_keys; i++)
+    check_key(h, pool, i, (i & 1) ? 0 : 2);
+  ac_pool_clear(pool);
+  /* erase everything, none of the keys may come back */
+  for (size_t i = 0; i < num_keys; i += 2)
+    check(erase_key(h, i));
+  check(ac_logstore_count(h) == 0);
+  for (size_t i = 0; i < num_keys; i++)
+    check_key(h, pool, i, 0);
+  ac_logstore_close(h);
+}
+
+#define FILLERS 12
+
+/* puts a group of 12 fillers (about 5 KB), the sync writes them, which
+   seals the segment */
+static void put_fillers(ac_logstore_t *h, char group, char fill) {
+  char key[32], value[400];
+  memset(value, fill, sizeof(value));
+  for (size_t i = 0; i < FILLERS; i++) {
+    int key_length = snprintf(key, sizeof(key), "%c-%zu", group, i);
+    ac_logstore_put(h, key, key_length, value, sizeof(value), false);
+  }
+  ac_logstore_sync(h);
+}
+
+/* The erase of K is in a segment which isn't the oldest and K is put again
+   in a later segment.  Compacting the erase's segment must not copy the
+   erase past the new put, or K is gone after the log is replayed. */
+static void test_compact_after_put_again(const char *dir, ac_pool_t *pool) {
+  ac_logstore_t *h = ac_logstore_open(dir);
+  check(h != NULL);
+  put_fillers(h, 'a', 'a');
+  put_key(h, 0, 1);
+  check(erase_key(h, 0));
+  put_fillers(h, 'b', 'b');
+  put_key(h, 0, 2);
+  put_fillers(h, 'c', 'c');
+  /* the erase's segment is now mostly garbage */
+  put_fillers(h, 'b', 'B');
+  ac_logstore_compact(h, 50);
+  check_key(h, pool, 0, 2);
+  ac_logstore_close(h);
+
+  h = ac_logstore_open(dir);
+  check(h != NULL);
+  check_key(h, pool, 0, 2);
+  check(ac_logstore_count(h) == 1 + 3 * FILLERS);
+  ac_pool_clear(pool);
+  ac_logstore_close(h);
+}
+
+int main(int argc, char *argv[]) {
+  char dir[] = "/tmp/test_logstore_XXXXXX";
+  check(mkdtemp(dir) != NULL);
+  ac_pool_t *pool = ac_pool_init(4096);
+  size_t key_counts[] = {1, 100, 226, 228, 450, 1000};
+  for (size_t i = 0; i < sizeof(key_counts) / sizeof(key_counts[0]); i++) {
+    test_keys(dir, pool, key_counts[i]);
+    remove_dir(dir); /* ac_logstore_open creates it again */
+  }
+  test_compact_after_put_again(dir, pool);
+  remove_dir(dir);
+  ac_pool_destroy(pool);
+  printf("test_logstore passed\n");
+  return 0;
+}
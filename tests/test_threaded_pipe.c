@@ -0,0 +1,366 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_threaded_pipe.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define check(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define MIN_THREADS 1
+#define MAX_THREADS 8
+#define SPAWNS 16
+#define TASKS_PER_SPAWN 400
+
+static ac_threaded_pipe_t *pipe_h;
+static uint64_t tasks_run = 0;
+static uint64_t tasks_written = 0;
+
+static void task(void *global_arg, void *thread_arg, void *object,
+                 void *arg) {
+  usleep(20);
+  __atomic_add_fetch(&tasks_run, 1, __ATOMIC_RELAXED);
+}
+
+/* written by a worker, so with work stealing the tasks go to its deque (and
+   with the small queue, some are run by the worker itself) */
+static void spawn(void *global_arg, void *thread_arg, void *object,
+                  void *arg) {
+  __atomic_add_fetch(&tasks_run, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < TASKS_PER_SPAWN; i++) {
+    check(ac_threaded_pipe_write(pipe_h, task, NULL, NULL));
+    __atomic_add_fetch(&tasks_written, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static int num_threads(void) {
+  ac_threaded_pipe_stats_t stats;
+  ac_threaded_pipe_stats(pipe_h, &stats, NULL);
+  return stats.num_threads;
+}
+
+/* holds its worker until a worker is retired and then writes more tasks
+   than the worker's deque and the queue hold.  If the retired worker is
+   running one, it has tasks in its deque (or its own writes to run) as it
+   retires. */
+static void hold(void *global_arg, void *thread_arg, void *object,
+                 void *arg) {
+  __atomic_add_fetch(&tasks_run, 1, __ATOMIC_RELAXED);
+  int n = (int)(intptr_t)arg;
+  for (int i = 0; i < 1000 && num_threads() >= n; i++)
+    usleep(1000);
+  for (int i = 0; i < TASKS_PER_SPAWN; i++) {
+    check(ac_threaded_pipe_write(pipe_h, task, NULL, NULL));
+    __atomic_add_fetch(&tasks_written, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/* every task which ran is counted once in the workers' stats, whether a
+   worker took it from a queue, stole it, ran it while writing to a full
+   queue, or ran it while retiring */
+static void check_counts(void) {
+  ac_threaded_pipe_stats_t stats;
+  ac_threaded_pipe_stats(pipe_h, &stats, NULL);
+  uint64_t run = __atomic_load_n(&tasks_run, __ATOMIC_RELAXED);
+  check(run == __atomic_load_n(&tasks_written, __ATOMIC_RELAXED));
+  check(stats.total.tasks == run);
+  check(stats.rejected_writes == 0);
+}
+
+static void test_scaling(void) {
+  pipe_h = ac_threaded_pipe_init(MIN_THREADS);
+  ac_threaded_pipe_set_threads(pipe_h, MIN_THREADS, MAX_THREADS);
+  ac_threaded_pipe_set_scaling(pipe_h, 100, 20);
+  ac_threaded_pipe_set_work_stealing(pipe_h);
+  ac_threaded_pipe_set_queue_size(pipe_h, 16);
+  ac_threaded_pipe_open(pipe_h);
+
+  for (int round = 0; round < 3; round++) {
+    int most_threads = num_threads();
+    for (int i = 0; i < SPAWNS; i++) {
+      check(ac_threaded_pipe_write(pipe_h, spawn, NULL, NULL));
+      __atomic_add_fetch(&tasks_written, 1, __ATOMIC_RELAXED);
+    }
+    while (!ac_threaded_pipe_drain(pipe_h, 1)) {
+      int n = num_threads();
+      if (n > most_threads)
+        most_threads = n;
+    }
+    check(most_threads > MIN_THREADS);
+    check(most_threads <= MAX_THREADS);
+    check_counts();
+
+    /* keep all but one of the workers busy until the idle one (or, if it
+       is the last, a busy one) is retired */
+    int n = num_threads();
+    for (int i = 0; i < n - 1; i++) {
+      check(ac_threaded_pipe_write(pipe_h, hold, NULL, (void *)(intptr_t)n));
+      __atomic_add_fetch(&tasks_written, 1, __ATOMIC_RELAXED);
+    }
+    check(ac_threaded_pipe_drain(pipe_h, 0));
+    check_counts();
+
+    /* the idle workers are retired one at a time */
+    for (int i = 0; i < 500 && num_threads() > MIN_THREADS; i++)
+      usleep(10000);
+    check(num_threads() == MIN_THREADS);
+    check_counts();
+  }
+  ac_threaded_pipe_close(pipe_h);
+}
+
+static void *double_job(void *global_arg, void *thread_arg, void *object,
+                        void *arg) {
+  return (void *)((intptr_t)object * 2);
+}
+
+static int notified = 0;
+
+static void on_done(void *done_arg, ac_threaded_pipe_future_t *f) {
+  check(ac_threaded_pipe_future_done(f));
+  check(ac_threaded_pipe_future_result(f) == done_arg);
+  __atomic_add_fetch(&notified, 1, __ATOMIC_RELAXED);
+}
+
+/* sums the range [object, arg) by splitting it in two futures until it is
+   small, so workers wait on futures which other workers (or they) run */
+static void *sum_job(void *global_arg, void *thread_arg, void *object,
+                     void *arg) {
+  intptr_t lo = (intptr_t)object, hi = (intptr_t)arg;
+  if (hi - lo <= 16) {
+    intptr_t sum = 0;
+    for (intptr_t i = lo; i < hi; i++)
+      sum += i;
+    return (void *)sum;
+  }
+  intptr_t mid = lo + (hi - lo) / 2;
+  ac_threaded_pipe_future_t *left =
+      ac_threaded_pipe_submit(pipe_h, sum_job, (void *)lo, (void *)mid);
+  ac_threaded_pipe_future_t *right =
+      ac_threaded_pipe_submit(pipe_h, sum_job, (void *)mid, (void *)hi);
+  check(left && right);
+  intptr_t sum = (intptr_t)ac_threaded_pipe_future_wait(right) +
+                 (intptr_t)ac_threaded_pipe_future_wait(left);
+  ac_threaded_pipe_future_destroy(left);
+  ac_threaded_pipe_future_destroy(right);
+  return (void *)sum;
+}
+
+static void test_futures(bool work_stealing) {
+  pipe_h = ac_threaded_pipe_init(4);
+  if (work_stealing)
+    ac_threaded_pipe_set_work_stealing(pipe_h);
+  ac_threaded_pipe_open(pipe_h);
+
+  /* waited for from outside the pipe */
+  ac_threaded_pipe_future_t *f[64];
+  for (intptr_t i = 0; i < 64; i++) {
+    f[i] = ac_threaded_pipe_submit(pipe_h, double_job, (void *)i, NULL);
+    check(f[i] != NULL);
+  }
+  for (intptr_t i = 63; i >= 0; i--) {
+    check(ac_threaded_pipe_future_wait(f[i]) == (void *)(i * 2));
+    check(ac_threaded_pipe_future_done(f[i]));
+    check(ac_threaded_pipe_future_result(f[i]) == (void *)(i * 2));
+    ac_threaded_pipe_future_destroy(f[i]);
+  }
+
+  /* the done callback, with the future destroyed before it is done */
+  notified = 0;
+  for (intptr_t i = 0; i < 64; i++) {
+    ac_threaded_pipe_future_t *n = ac_threaded_pipe_submit_notify(
+        pipe_h, double_job, (void *)i, NULL, on_done, (void *)(i * 2));
+    check(n != NULL);
+    ac_threaded_pipe_future_destroy(n);
+  }
+  check(ac_threaded_pipe_drain(pipe_h, 0));
+  check(notified == 64);
+
+  /* fork/join from the workers */
+  intptr_t n = 100000;
+  ac_threaded_pipe_future_t *sum =
+      ac_threaded_pipe_submit(pipe_h, sum_job, (void *)0, (void *)n);
+  check(sum != NULL);
+  check((intptr_t)ac_threaded_pipe_future_wait(sum) == n * (n - 1) / 2);
+  ac_threaded_pipe_future_destroy(sum);
+  ac_threaded_pipe_close(pipe_h);
+}
+
+#define ORDERED_OBJECTS 2000
+
+typedef struct {
+  uint64_t next;
+  int null_results;
+} emitted_t;
+
+/* the later objects finish first within each group of 8 */
+static void *slow_job(void *global_arg, void *thread_arg, void *object,
+                      void *arg) {
+  intptr_t i = (intptr_t)object;
+  usleep((8 - (i & 7)) * 20);
+  return (void *)(i + 1);
+}
+
+static void emit(void *emit_arg, uint64_t seq, void *object, void *result) {
+  emitted_t *e = (emitted_t *)emit_arg;
+  check(seq == e->next);
+  check(object == (void *)(intptr_t)seq);
+  if (result)
+    check(result == (void *)(intptr_t)(seq + 1));
+  else
+    e->null_results++;
+  e->next++;
+}
+
+static void test_ordered(void) {
+  pipe_h = ac_threaded_pipe_init(8);
+  ac_threaded_pipe_set_work_stealing(pipe_h);
+  ac_threaded_pipe_open(pipe_h);
+
+  emitted_t e = {0, 0};
+  ac_threaded_pipe_ordered_t *o =
+      ac_threaded_pipe_ordered_init(pipe_h, 32, slow_job, NULL, emit, &e);
+  for (intptr_t i = 0; i < ORDERED_OBJECTS; i++)
+    check(ac_threaded_pipe_ordered_write(o, (void *)i));
+  ac_threaded_pipe_ordered_finish(o);
+  check(e.next == ORDERED_OBJECTS);
+
+  /* destroyed with slots still pending, it waits for them */
+  e.next = 0;
+  ac_threaded_pipe_ordered_destroy(o);
+  o = ac_threaded_pipe_ordered_init(pipe_h, 64, slow_job, NULL, emit, &e);
+  for (intptr_t i = 0; i < 64; i++)
+    check(ac_threaded_pipe_ordered_write(o, (void *)i));
+  ac_threaded_pipe_ordered_destroy(o);
+  check(e.next == 64);
+  check(e.null_results == 0);
+  ac_threaded_pipe_close(pipe_h);
+}
+
+static int released = 0;
+static int expired = 0;
+static int tasks_done = 0;
+static int expired_objects[4];
+
+static void wait_for(int *flag) {
+  while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+    usleep(100);
+}
+
+/* runs until the test is about to abort, and then long enough for the abort
+   to have started */
+static void blocker(void *global_arg, void *thread_arg, void *object,
+                    void *arg) {
+  wait_for(&released);
+  usleep(100000);
+}
+
+static void count_task(void *global_arg, void *thread_arg, void *object,
+                       void *arg) {
+  __atomic_add_fetch(&tasks_done, 1, __ATOMIC_RELAXED);
+}
+
+static void on_expired(void *global_arg, void *thread_arg, void *object,
+                       void *arg) {
+  /* only the tasks written below, never a future or an ordered slot */
+  check(object >= (void *)expired_objects &&
+        object < (void *)(expired_objects + 4));
+  __atomic_add_fetch(&expired, 1, __ATOMIC_RELAXED);
+}
+
+static void *child_job(void *global_arg, void *thread_arg, void *object,
+                       void *arg) {
+  return object;
+}
+
+static int parent_waiting = 0;
+
+/* a fork/join job which is waiting on its child (queued after the blocker,
+   along with a job of the ordered stream arg) as the pipe is aborted */
+static void *parent_job(void *global_arg, void *thread_arg, void *object,
+                        void *arg) {
+  check(ac_threaded_pipe_write(pipe_h, blocker, NULL, NULL));
+  check(ac_threaded_pipe_ordered_write((ac_threaded_pipe_ordered_t *)arg,
+                                       NULL));
+  ac_threaded_pipe_future_t *f =
+      ac_threaded_pipe_submit(pipe_h, child_job, object, NULL);
+  check(f != NULL);
+  __atomic_store_n(&parent_waiting, 1, __ATOMIC_RELEASE);
+  void *r = ac_threaded_pipe_future_wait(f);
+  check(ac_threaded_pipe_future_done(f));
+  ac_threaded_pipe_future_destroy(f);
+  return r;
+}
+
+static void test_drain_and_abort(void) {
+  /* drain without a timeout waits for every task */
+  pipe_h = ac_threaded_pipe_init(2);
+  ac_threaded_pipe_open(pipe_h);
+  for (int i = 0; i < 100; i++)
+    check(ac_threaded_pipe_write(pipe_h, count_task, NULL, NULL));
+  check(ac_threaded_pipe_drain(pipe_h, 0));
+  check(tasks_done == 100);
+  ac_threaded_pipe_close(pipe_h);
+
+  /* with one worker, everything written after the parent waits behind the
+     blocker and is expired by the abort */
+  pipe_h = ac_threaded_pipe_init(1);
+  ac_threaded_pipe_set_expired_cb(pipe_h, on_expired);
+  ac_threaded_pipe_open(pipe_h);
+  emitted_t e = {0, 0};
+  ac_threaded_pipe_ordered_t *o =
+      ac_threaded_pipe_ordered_init(pipe_h, 4, slow_job, NULL, emit, &e);
+  ac_threaded_pipe_future_t *parent =
+      ac_threaded_pipe_submit(pipe_h, parent_job, &parent_waiting, o);
+  check(parent != NULL);
+  wait_for(&parent_waiting);
+  for (int i = 0; i < 4; i++)
+    check(ac_threaded_pipe_write(pipe_h, count_task, expired_objects + i,
+                                 NULL));
+  __atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+  ac_threaded_pipe_abort(pipe_h);
+
+  /* the child was never run, the parent still finished */
+  check(ac_threaded_pipe_future_done(parent));
+  check(ac_threaded_pipe_future_result(parent) == NULL);
+  ac_threaded_pipe_future_destroy(parent);
+  check(expired == 4);
+  check(tasks_done == 100);
+  /* the ordered slot was released without running the job */
+  check(e.next == 1 && e.null_results == 1);
+  ac_threaded_pipe_ordered_destroy(o);
+}
+
+int main(int argc, char *argv[]) {
+  /* a task which is never woken fails instead of hanging */
+  alarm(120);
+  test_scaling();
+  test_futures(false);
+  test_futures(true);
+  test_ordered();
+  test_drain_and_abort();
+  printf("test_threaded_pipe passed\n");
+  return 0;
+}
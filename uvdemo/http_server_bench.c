@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ac_http_server.h"
+#include "ac_threaded_pipe.h"
+
+/*
+  A wrk style benchmark of ac_http_server.  The server answers every request
+  with a small body, either on the loops or on a pool of workers.  Each
+  client thread keeps its connections busy with pipeline requests at a time
+  (like wrk with a pipelining script) for the given number of seconds and
+  the requests per second over all of the clients are reported.
+
+  usage: http_server_bench [loops] [workers] [client threads]
+                           [connections per thread] [pipeline] [seconds]
+
+  A workers of 0 handles the requests on the loops.
+*/
+
+#define port 18090
+
+static const char body[] = "Hello, World!";
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void handler(ac_http_server_request_t *r, void *arg) {
+  ac_http_response_t *res =
+      ac_http_response_init(ac_http_server_pool(r), 200);
+  ac_http_response_header(res, "Content-Type", "text/plain");
+  ac_http_response_body(res, body, sizeof(body) - 1);
+  ac_http_server_respond(r, res);
+}
+
+typedef struct {
+  int connections;
+  int pipeline;
+  int seconds;
+  uint64_t requests;
+  uint64_t errors;
+} client_t;
+
+static int connect_to_server() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/* counts the responses in data (each ends with the body) */
+static int count_responses(const char *data, size_t length, size_t *used) {
+  int n = 0;
+  const char *p = data;
+  const char *ep = data + length;
+  while (p < ep) {
+    const char *h = (const char *)memmem(p, ep - p, "\r\n\r\n", 4);
+    if (!h || h + 4 + sizeof(body) - 1 > ep)
+      break;
+    p = h + 4 + sizeof(body) - 1;
+    n++;
+  }
+  *used = p - data;
+  return n;
+}
+
+static void *run_client(void *arg) {
+  client_t *c = (client_t *)arg;
+  static const char request[] = "GET /plaintext HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "User-Agent: http_server_bench\r\n"
+                                "Accept: */*\r\n\r\n";
+  size_t request_length = sizeof(request) - 1;
+  char *requests = (char *)malloc(request_length * c->pipeline);
+  for (int i = 0; i < c->pipeline; i++)
+    memcpy(requests + i * request_length, request, request_length);
+
+  int *fds = (int *)malloc(sizeof(int) * c->connections);
+  for (int i = 0; i < c->connections; i++)
+    fds[i] = connect_to_server();
+
+  char buf[65536];
+  uint64_t end = now_ns() + c->seconds * 1000000000ULL;
+  while (now_ns() < end) {
+    for (int i = 0; i < c->connections; i++)
+      if (write(fds[i], requests, request_length * c->pipeline) < 0)
+        c->errors++;
+    for (int i = 0; i < c->connections; i++) {
+      int received = 0;
+      size_t have = 0;
+      while (received < c->pipeline) {
+        ssize_t n = read(fds[i], buf + have, sizeof(buf) - have);
+        if (n <= 0) {
+          c->errors++;
+          break;
+        }
+        have += n;
+        size_t used;
+        received += count_responses(buf, have, &used);
+        memmove(buf, buf + used, have - used);
+        have -= used;
+      }
+      c->requests += received;
+    }
+  }
+  for (int i = 0; i < c->connections; i++)
+    close(fds[i]);
+  free(fds);
+  free(requests);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int num_loops = argc > 1 ? atoi(argv[1]) : 2;
+  int num_workers = argc > 2 ? atoi(argv[2]) : 0;
+  int num_clients = argc > 3 ? atoi(argv[3]) : 2;
+  int connections = argc > 4 ? atoi(argv[4]) : 16;
+  int pipeline = argc > 5 ? atoi(argv[5]) : 16;
+  int seconds = argc > 6 ? atoi(argv[6]) : 5;
+
+  ac_threaded_pipe_t *workers = NULL;
+  ac_http_server_t *server = ac_http_server_init(handler, NULL);
+  ac_http_server_set_loops(server, num_loops);
+  if (num_workers) {
+    workers = ac_threaded_pipe_init(num_workers);
+    ac_threaded_pipe_open(workers);
+    ac_http_server_set_workers(server, workers);
+  }
+  if (!ac_http_server_listen(server, "127.0.0.1", port)) {
+    perror("ac_http_server_listen");
+    return 1;
+  }
+
+  client_t *clients = (client_t *)calloc(num_clients, sizeof(client_t));
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * num_clients);
+  uint64_t start = now_ns();
+  for (int i = 0; i < num_clients; i++) {
+    clients[i].connections = connections;
+    clients[i].pipeline = pipeline;
+    clients[i].seconds = seconds;
+    pthread_create(threads + i, NULL, run_client, clients + i);
+  }
+  uint64_t requests = 0, errors = 0;
+  for (int i = 0; i < num_clients; i++) {
+    pthread_join(threads[i], NULL);
+    requests += clients[i].requests;
+    errors += clients[i].errors;
+  }
+  double elapsed = (now_ns() - start) / 1000000000.0;
+
+  ac_http_server_destroy(server);
+  if (workers)
+    ac_threaded_pipe_close(workers);
+
+  printf("%d loops, %d workers, %d connections, pipeline %d\n", num_loops,
+         num_workers, num_clients * connections, pipeline);
+  printf("%llu requests in %0.2fs, %0.0f requests/sec, %llu errors\n",
+         (unsigned long long)requests, elapsed, requests / elapsed,
+         (unsigned long long)errors);
+  free(threads);
+  free(clients);
+  return 0;
+}
@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ac_histogram.h"
+#include "ac_object_pipe.h"
+#include "ac_threaded_pipe.h"
+
+/*
+  pipe_bench measures the throughput (jobs per second) and the latency from
+  enqueue to the start of the job (percentiles, in microseconds) of
+
+    threaded       ac_threaded_pipe_write to the workers' shared queue
+    batch          ac_threaded_pipe_write_batch, BATCH jobs at a time
+    stealing       producers write one task per FANOUT jobs, the worker which
+                   runs it writes the jobs (onto its own deque, so the other
+                   workers steal them)
+    object_pipe    ac_object_pipe_write to one loop per consumer over pipe(2)
+    object_queue   the same over the queue transport (ac_object_pipe_open_queue)
+
+  for every combination of producer threads, consumers (workers or loops),
+  and payload size.  A producer fills the payload of each job before it is
+  written and the consumer reads all of it.  Each producer reuses INFLIGHT
+  jobs (waiting for the oldest to finish), so the queues never hold more
+  than producers * INFLIGHT jobs and the latency is that of a loaded pipe
+  rather than of an ever growing backlog.  The time covers writing every job
+  and closing the pipe (which waits for the jobs to finish).
+
+  pipe_bench [-f text|csv|json] [-p 1,4] [-c 1,4] [-b 0,64,1024,16384]
+             [-j jobs] [-m mode]
+
+  -j is the number of jobs per producer (default 100000) and -m only runs the
+  modes whose name contains the given text.
+*/
+
+#define INFLIGHT 1024
+#define BATCH 64
+#define FANOUT 16
+
+typedef struct {
+  uint64_t enqueued;
+  uint64_t checksum;
+  int done;
+  char *payload;
+} job_t;
+
+struct bench_s;
+
+typedef struct {
+  struct bench_s *b;
+  ac_histogram_t *latency;
+  uv_loop_t loop;
+  ac_object_pipe_t *pipe;
+  pthread_t thread;
+} consumer_t;
+
+typedef struct {
+  struct bench_s *b;
+  int id;
+  job_t *jobs;
+  char *payloads;
+  pthread_t thread;
+} producer_t;
+
+typedef struct bench_s {
+  int mode;
+  int num_producers;
+  int num_consumers;
+  size_t payload_size;
+  size_t jobs_per_producer;
+  ac_threaded_pipe_t *tp;
+  consumer_t *consumers;
+  ac_histogram_t *latency;
+  pthread_mutex_t mutex;
+  int start;
+} bench_t;
+
+enum { THREADED, BATCHED, STEALING, OBJECT_PIPE, OBJECT_QUEUE, NUM_MODES };
+
+static const char *modes[NUM_MODES] = {"threaded", "batch", "stealing",
+                                       "object_pipe", "object_queue"};
+
+typedef struct {
+  const char *mode;
+  int producers;
+  int consumers;
+  size_t payload;
+  size_t jobs;
+  double seconds;
+  ac_histogram_summary_t latency;
+} result_t;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void run_job(ac_histogram_t *latency, size_t payload_size, job_t *j) {
+  ac_histogram_record(latency, now_ns() - j->enqueued);
+  uint64_t sum = 0;
+  const unsigned char *p = (const unsigned char *)j->payload;
+  for (size_t i = 0; i < payload_size; i++)
+    sum += p[i];
+  j->checksum = sum;
+  __atomic_store_n(&j->done, 1, __ATOMIC_RELEASE);
+}
+
+static void *create_histogram(void *global_arg) {
+  return ac_histogram_init(3);
+}
+
+static void merge_histogram(void *global_arg, void *thread_arg) {
+  bench_t *b = (bench_t *)global_arg;
+  ac_histogram_t *h = (ac_histogram_t *)thread_arg;
+  pthread_mutex_lock(&b->mutex);
+  ac_histogram_merge(b->latency, h);
+  pthread_mutex_unlock(&b->mutex);
+  ac_histogram_destroy(h);
+}
+
+static void threaded_job(void *global_arg, void *thread_arg, void *object,
+                         void *arg) {
+  bench_t *b = (bench_t *)global_arg;
+  run_job((ac_histogram_t *)thread_arg, b->payload_size, (job_t *)object);
+}
+
+/* object points to FANOUT consecutive jobs, written from the worker */
+static void spawn_jobs(void *global_arg, void *thread_arg, void *object,
+                       void *arg) {
+  bench_t *b = (bench_t *)global_arg;
+  job_t *jobs = (job_t *)object;
+  for (int i = 0; i < FANOUT; i++) {
+    jobs[i].enqueued = now_ns();
+    ac_threaded_pipe_write(b->tp, threaded_job, jobs + i, NULL);
+  }
+}
+
+static void object_job(void *arg, void *object) {
+  consumer_t *c = (consumer_t *)arg;
+  run_job(c->latency, c->b->payload_size, (job_t *)object);
+}
+
+static void *run_loop(void *arg) {
+  consumer_t *c = (consumer_t *)arg;
+  uv_run(&c->loop, UV_RUN_DEFAULT);
+  return NULL;
+}
+
+/* wait for the job which last used the slot and fill the payload */
+static job_t *next_job(producer_t *p, size_t k) {
+  job_t *j = p->jobs + (k % INFLIGHT);
+  while (!__atomic_load_n(&j->done, __ATOMIC_ACQUIRE))
+    sched_yield();
+  j->done = 0;
+  if (p->b->payload_size)
+    memset(j->payload, (int)k, p->b->payload_size);
+  return j;
+}
+
+static void *produce(void *arg) {
+  producer_t *p = (producer_t *)arg;
+  bench_t *b = p->b;
+  while (!__atomic_load_n(&b->start, __ATOMIC_ACQUIRE))
+    sched_yield();
+
+  job_t *batch[BATCH];
+  size_t n = b->jobs_per_producer;
+  size_t k = 0;
+  while (k < n) {
+    if (b->mode == BATCHED || b->mode == STEALING) {
+      size_t num = b->mode == BATCHED ? BATCH : FANOUT;
+      if (num > n - k)
+        num = n - k;
+      /* jobs are taken in blocks, so a block never wraps around the slots */
+      if (b->mode == STEALING && num < FANOUT) {
+        for (size_t i = 0; i < num; i++) {
+          job_t *j = next_job(p, k++);
+          j->enqueued = now_ns();
+          ac_threaded_pipe_write(b->tp, threaded_job, j, NULL);
+        }
+        continue;
+      }
+      for (size_t i = 0; i < num; i++)
+        batch[i] = next_job(p, k++);
+      if (b->mode == STEALING)
+        ac_threaded_pipe_write(b->tp, spawn_jobs, batch[0], NULL);
+      else {
+        uint64_t now = now_ns();
+        for (size_t i = 0; i < num; i++)
+          batch[i]->enqueued = now;
+        ac_threaded_pipe_write_batch(b->tp, threaded_job, (void **)batch, num,
+                                     NULL);
+      }
+      continue;
+    }
+    job_t *j = next_job(p, k);
+    j->enqueued = now_ns();
+    if (b->mode == THREADED)
+      ac_threaded_pipe_write(b->tp, threaded_job, j, NULL);
+    else
+      ac_object_pipe_write(
+          b->consumers[(k + p->id) % b->num_consumers].pipe, j);
+    k++;
+  }
+  return NULL;
+}
+
+static void run(bench_t *b, result_t *r) {
+  b->latency = ac_histogram_init(3);
+  pthread_mutex_init(&b->mutex, NULL);
+  b->start = 0;
+  b->tp = NULL;
+  b->consumers = NULL;
+
+  producer_t *producers =
+      (producer_t *)calloc(b->num_producers, sizeof(producer_t));
+  for (int i = 0; i < b->num_producers; i++) {
+    producer_t *p = producers + i;
+    p->b = b;
+    p->id = i;
+    p->jobs = (job_t *)calloc(INFLIGHT, sizeof(job_t));
+    p->payloads = (char *)malloc(INFLIGHT * b->payload_size + 1);
+    memset(p->payloads, 0, INFLIGHT * b->payload_size + 1);
+    for (int j = 0; j < INFLIGHT; j++) {
+      p->jobs[j].done = 1;
+      p->jobs[j].payload = p->payloads + j * b->payload_size;
+    }
+  }
+
+  if (b->mode == OBJECT_PIPE || b->mode == OBJECT_QUEUE) {
+    b->consumers = (consumer_t *)calloc(b->num_consumers, sizeof(consumer_t));
+    for (int i = 0; i < b->num_consumers; i++) {
+      consumer_t *c = b->consumers + i;
+      c->b = b;
+      c->latency = ac_histogram_init(3);
+      uv_loop_init(&c->loop);
+      if (b->mode == OBJECT_PIPE)
+        c->pipe = ac_object_pipe_open(&c->loop, object_job, c);
+      else
+        c->pipe = ac_object_pipe_open_queue(&c->loop, object_job, c,
+                                            INFLIGHT * b->num_producers);
+      pthread_create(&c->thread, NULL, run_loop, c);
+    }
+  } else {
+    b->tp = ac_threaded_pipe_init(b->num_consumers);
+    ac_threaded_pipe_set_global_arg(b->tp, b, NULL);
+    ac_threaded_pipe_set_thread_methods(b->tp, create_histogram, NULL,
+                                        merge_histogram);
+    if (b->mode == STEALING)
+      ac_threaded_pipe_set_work_stealing(b->tp);
+    ac_threaded_pipe_open(b->tp);
+  }
+
+  for (int i = 0; i < b->num_producers; i++)
+    pthread_create(&producers[i].thread, NULL, produce, producers + i);
+
+  uint64_t start = now_ns();
+  __atomic_store_n(&b->start, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < b->num_producers; i++)
+    pthread_join(producers[i].thread, NULL);
+  if (b->tp)
+    ac_threaded_pipe_close(b->tp);
+  else {
+    for (int i = 0; i < b->num_consumers; i++)
+      ac_object_pipe_close(b->consumers[i].pipe);
+    for (int i = 0; i < b->num_consumers; i++) {
+      consumer_t *c = b->consumers + i;
+      pthread_join(c->thread, NULL);
+      uv_loop_close(&c->loop);
+      ac_histogram_merge(b->latency, c->latency);
+      ac_histogram_destroy(c->latency);
+    }
+  }
+  uint64_t end = now_ns();
+
+  r->mode = modes[b->mode];
+  r->producers = b->num_producers;
+  r->consumers = b->num_consumers;
+  r->payload = b->payload_size;
+  r->jobs = b->jobs_per_producer * b->num_producers;
+  r->seconds = (end - start) / 1000000000.0;
+  ac_histogram_summary(b->latency, &r->latency);
+  if (r->latency.count != r->jobs)
+    fprintf(stderr, "%s ran %llu of %zu jobs\n", r->mode,
+            (unsigned long long)r->latency.count, r->jobs);
+
+  for (int i = 0; i < b->num_producers; i++) {
+    free(producers[i].jobs);
+    free(producers[i].payloads);
+  }
+  free(producers);
+  free(b->consumers);
+  ac_histogram_destroy(b->latency);
+  pthread_mutex_destroy(&b->mutex);
+}
+
+static size_t parse_list(const char *s, size_t *values, size_t max) {
+  size_t n = 0;
+  while (*s && n < max) {
+    char *end;
+    values[n++] = strtoull(s, &end, 10);
+    if (*end != ',')
+      break;
+    s = end + 1;
+  }
+  return n;
+}
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "%s [-f text|csv|json] [-p 1,4] [-c 1,4] [-b 0,64,1024,16384]\n"
+          "    [-j jobs] [-m mode]\n",
+          program);
+}
+
+static void print_result(const char *format, result_t *r, bool first) {
+  double jobs_per_second = r->seconds > 0 ? r->jobs / r->seconds : 0;
+  ac_histogram_summary_t *l = &r->latency;
+  if (!strcmp(format, "csv"))
+    printf("%s,%d,%d,%zu,%zu,%0.6f,%0.0f,%llu,%llu,%llu,%llu,%llu\n",
+           r->mode, r->producers, r->consumers, r->payload, r->jobs,
+           r->seconds, jobs_per_second, (unsigned long long)l->p50,
+           (unsigned long long)l->p90, (unsigned long long)l->p99,
+           (unsigned long long)l->p999, (unsigned long long)l->max);
+  else if (!strcmp(format, "json"))
+    printf("%s\n  {\"mode\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+           "\"payload\": %zu, \"jobs\": %zu, \"seconds\": %0.6f, "
+           "\"jobs_per_second\": %0.0f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+           "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+           first ? "" : ",", r->mode, r->producers, r->consumers, r->payload,
+           r->jobs, r->seconds, jobs_per_second, (unsigned long long)l->p50,
+           (unsigned long long)l->p90, (unsigned long long)l->p99,
+           (unsigned long long)l->p999, (unsigned long long)l->max);
+  else
+    printf("%-13s %5d %5d %8zu %12.0f %9.1f %9.1f %9.1f %9.1f %10.1f\n",
+           r->mode, r->producers, r->consumers, r->payload, jobs_per_second,
+           l->p50 / 1000.0, l->p90 / 1000.0, l->p99 / 1000.0,
+           l->p999 / 1000.0, l->max / 1000.0);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  const char *format = "text";
+  const char *filter = NULL;
+  size_t producers[16] = {1, 4};
+  size_t num_producers = 2;
+  size_t consumers[16] = {1, 4};
+  size_t num_consumers = 2;
+  size_t payloads[16] = {0, 64, 1024, 16384};
+  size_t num_payloads = 4;
+  size_t jobs = 100000;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    if (!strcmp(argv[i], "-f"))
+      format = argv[++i];
+    else if (!strcmp(argv[i], "-m"))
+      filter = argv[++i];
+    else if (!strcmp(argv[i], "-p"))
+      num_producers = parse_list(argv[++i], producers, 16);
+    else if (!strcmp(argv[i], "-c"))
+      num_consumers = parse_list(argv[++i], consumers, 16);
+    else if (!strcmp(argv[i], "-b"))
+      num_payloads = parse_list(argv[++i], payloads, 16);
+    else if (!strcmp(argv[i], "-j"))
+      jobs = strtoull(argv[++i], NULL, 10);
+    else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (!strcmp(format, "csv"))
+    printf("mode,producers,consumers,payload,jobs,seconds,jobs_per_second,"
+           "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+  else if (!strcmp(format, "json"))
+    printf("{\"results\": [");
+  else
+    printf("%-13s %5s %5s %8s %12s %9s %9s %9s %9s %10s\n", "mode", "prod",
+           "cons", "payload", "jobs/sec", "p50_us", "p90_us", "p99_us",
+           "p999_us", "max_us");
+
+  bool first = true;
+  for (int m = 0; m < NUM_MODES; m++) {
+    if (filter && !strstr(modes[m], filter))
+      continue;
+    for (size_t p = 0; p < num_producers; p++) {
+      for (size_t c = 0; c < num_consumers; c++) {
+        for (size_t s = 0; s < num_payloads; s++) {
+          if (!producers[p] || !consumers[c])
+            continue;
+          bench_t b;
+          memset(&b, 0, sizeof(b));
+          b.mode = m;
+          b.num_producers = producers[p];
+          b.num_consumers = consumers[c];
+          b.payload_size = payloads[s];
+          b.jobs_per_producer = jobs;
+          result_t r;
+          run(&b, &r);
+          print_result(format, &r, first);
+          first = false;
+        }
+      }
+    }
+  }
+  if (!strcmp(format, "json"))
+    printf("\n]}\n");
+  return 0;
+}
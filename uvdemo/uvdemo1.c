@@ -52,10 +52,6 @@ typedef struct {
   pthread_cond_t cond;
 } global_arg_t;
 
-typedef struct {
-  ac_pool_t *pool;
-} thread_arg_t;
-
 void destroy_global_arg(void *update_arg, void *global_arg) {
   global_arg_t *g = (global_arg_t *)global_arg;
   ac_object_pipe_close(g->object_pipe);
@@ -112,27 +108,9 @@ void *create_global_arg(void *update_arg) {
   return g;
 }
 
-void *create_thread_arg(void *global_arg) {
-  // global_arg_t *g = (global_arg_t *)global_arg;
-  thread_arg_t *t = (thread_arg_t *)ac_malloc(sizeof(*t));
-  t->pool = ac_pool_init(100);
-  return t;
-}
-
-void clear_thread_arg(void *thread_arg) {
-  thread_arg_t *t = (thread_arg_t *)thread_arg;
-  ac_pool_clear(t->pool);
-}
-
-void destroy_thread_arg(void *global_arg, void *thread_arg) {
-  thread_arg_t *t = (thread_arg_t *)thread_arg;
-  ac_pool_destroy(t->pool);
-  ac_free(t);
-}
-
 void do_work(void *global_arg, void *thread_arg, void *object, void *arg) {
   global_arg_t *g = (global_arg_t *)global_arg;
-  // thread_arg_t *t = (thread_arg_t *)thread_arg;
+  // ac_pool_t *pool = ac_threaded_pipe_pool();
   object_t *o = (object_t *)object;
   char *p = ac_buffer_data(o->bh);
   char *ep = p + ac_buffer_length(o->bh);
@@ -186,8 +164,7 @@ int main(int argc, char *argv[]) {
   uv_loop_t *loop = uv_default_loop();
   void *global_arg = create_global_arg(loop);
   ac_threaded_pipe_set_global_arg(threaded_pipe, global_arg, NULL);
-  ac_threaded_pipe_set_thread_methods(threaded_pipe, create_thread_arg,
-                                        clear_thread_arg, destroy_thread_arg);
+  ac_threaded_pipe_set_worker_pool(threaded_pipe, 4096);
 
   ac_threaded_pipe_open(threaded_pipe);
   pthread_t uv_thread;